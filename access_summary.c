@@ -0,0 +1,543 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Storage access patterns per file (--summary-access option).
+ *
+ * The size of each read and write and whether it starts where
+ * the previous access of the same descriptor has ended are accounted
+ * to the path of the descriptor, along with the bytes moved by sendfile,
+ * splice, and copy_file_range.  The file position of each descriptor
+ * is tracked per thread group from open, lseek, and the number of bytes
+ * transferred; accesses to descriptors with an unknown position,
+ * e.g. inherited ones, are not classified until their position is known.
+ */
+
+#include "defs.h"
+#include "syscall.h"
+#include "strintern.h"
+#include <sys/param.h>
+#include <fcntl.h>
+
+enum access_op {
+	ACCESS_READ,
+	ACCESS_WRITE,
+	ACCESS_COPY_FROM,	/* The file is the source of a copy */
+	ACCESS_COPY_TO,		/* The file is the destination of a copy */
+	ACCESS_NOPS
+};
+
+static const char *const access_op_names[] = {
+	[ACCESS_READ] = "read",
+	[ACCESS_WRITE] = "write",
+	[ACCESS_COPY_FROM] = "copy-from",
+	[ACCESS_COPY_TO] = "copy-to",
+};
+
+/* Upper bounds of the size buckets, the last one is unbounded. */
+static const uint64_t size_buckets[] = { 512, 4096, 65536, 1048576 };
+static const char *const size_bucket_names[] = {
+	"<=512", "<=4K", "<=64K", "<=1M", ">1M"
+};
+#define NBUCKETS ARRAY_SIZE(size_bucket_names)
+
+struct access_op_counts {
+	uint64_t calls, bytes;
+	uint64_t sequential, random;
+	uint64_t sizes[NBUCKETS];
+};
+
+struct access_counts {
+	struct access_counts *next;
+	const char *path;	/* interned */
+	uint64_t bytes;
+	struct access_op_counts ops[ACCESS_NOPS];
+};
+
+struct access_fd {
+	uint64_t pos;		/* The file position */
+	uint64_t next;		/* Where the last access has ended */
+	bool pos_known;
+	bool next_known;
+	bool append;
+};
+
+struct access_table {
+	struct access_table *next;
+	int tgid;
+	struct access_fd *fds;
+	unsigned int nfds;
+};
+
+unsigned int summary_access;
+
+static struct access_table **table_hash;
+static unsigned int table_hash_size;
+static unsigned int table_hash_count;
+static struct access_counts **access_hash;
+static unsigned int access_hash_size;
+static unsigned int access_hash_count;
+
+static void
+table_hash_expand(void)
+{
+	struct access_table **const old_hash = table_hash;
+	const unsigned int old_size = table_hash_size;
+	unsigned int i;
+
+	table_hash_size = old_size ? old_size * 2 : 64;
+	table_hash = xcalloc(table_hash_size, sizeof(table_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct access_table *at, *next;
+
+		for (at = old_hash[i]; at; at = next) {
+			const unsigned int b =
+				(unsigned int) at->tgid & (table_hash_size - 1);
+
+			next = at->next;
+			at->next = table_hash[b];
+			table_hash[b] = at;
+		}
+	}
+
+	free(old_hash);
+}
+
+static struct access_table *
+get_access_table(struct tcb *const tcp)
+{
+	const int tgid = get_tcb_tgid(tcp);
+	struct access_table *at;
+
+	if (table_hash_size) {
+		for (at = table_hash[(unsigned int) tgid
+				     & (table_hash_size - 1)];
+		     at; at = at->next) {
+			if (at->tgid == tgid)
+				return at;
+		}
+	}
+
+	if (table_hash_count >= table_hash_size)
+		table_hash_expand();
+
+	const unsigned int b = (unsigned int) tgid & (table_hash_size - 1);
+
+	at = xcalloc(1, sizeof(*at));
+	at->tgid = tgid;
+	at->next = table_hash[b];
+	table_hash[b] = at;
+	++table_hash_count;
+
+	return at;
+}
+
+/* Return the state of the descriptor, NULL if fd is invalid. */
+static struct access_fd *
+get_access_fd(struct tcb *const tcp, const int fd)
+{
+	if (fd < 0)
+		return NULL;
+
+	struct access_table *const at = get_access_table(tcp);
+
+	if ((unsigned int) fd >= at->nfds) {
+		const unsigned int n = MAX((unsigned int) fd + 1, at->nfds * 2);
+
+		at->fds = xreallocarray(at->fds, n, sizeof(at->fds[0]));
+		memset(&at->fds[at->nfds], 0,
+		       (n - at->nfds) * sizeof(at->fds[0]));
+		at->nfds = n;
+	}
+
+	return &at->fds[fd];
+}
+
+static unsigned int
+hash_path(const char *const path)
+{
+	/* Interned strings are compared by their addresses.  */
+	return (unsigned int) ((uintptr_t) path >> 4) * 2654435761U;
+}
+
+static void
+access_hash_expand(void)
+{
+	struct access_counts **const old_hash = access_hash;
+	const unsigned int old_size = access_hash_size;
+	unsigned int i;
+
+	access_hash_size = old_size ? old_size * 2 : 64;
+	access_hash = xcalloc(access_hash_size, sizeof(access_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct access_counts *ac, *next;
+
+		for (ac = old_hash[i]; ac; ac = next) {
+			const unsigned int b =
+				hash_path(ac->path) & (access_hash_size - 1);
+
+			next = ac->next;
+			ac->next = access_hash[b];
+			access_hash[b] = ac;
+		}
+	}
+
+	free(old_hash);
+}
+
+static struct access_counts *
+get_access_counts(struct tcb *const tcp, const int fd)
+{
+	char buf[PATH_MAX + 1];
+
+	if (getfdpath(tcp, fd, buf, sizeof(buf)) < 0)
+		snprintf(buf, sizeof(buf), "<pid %d fd %d>", tcp->pid, fd);
+
+	const char *const path = str_intern(buf);
+	struct access_counts *ac;
+
+	if (access_hash_size) {
+		for (ac = access_hash[hash_path(path) & (access_hash_size - 1)];
+		     ac; ac = ac->next) {
+			if (ac->path == path) {
+				str_intern_release(path);
+				return ac;
+			}
+		}
+	}
+
+	if (access_hash_count >= access_hash_size)
+		access_hash_expand();
+
+	const unsigned int b = hash_path(path) & (access_hash_size - 1);
+
+	ac = xcalloc(1, sizeof(*ac));
+	ac->path = path;
+	ac->next = access_hash[b];
+	access_hash[b] = ac;
+	++access_hash_count;
+
+	return ac;
+}
+
+static struct access_op_counts *
+account_op(struct tcb *const tcp, const int fd, const enum access_op op,
+	   const uint64_t bytes)
+{
+	struct access_counts *const ac = get_access_counts(tcp, fd);
+	struct access_op_counts *const oc = &ac->ops[op];
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(size_buckets); ++i)
+		if (bytes <= size_buckets[i])
+			break;
+
+	oc->calls++;
+	oc->bytes += bytes;
+	oc->sizes[i]++;
+	ac->bytes += bytes;
+
+	return oc;
+}
+
+/*
+ * Account a read or a write of BYTES at OFFSET, or at the file position
+ * if OFFSET is negative.
+ */
+static void
+account_access(struct tcb *const tcp, const int fd, const enum access_op op,
+	       const int64_t offset)
+{
+	struct access_fd *const af = get_access_fd(tcp, fd);
+
+	if (!af)
+		return;
+
+	const uint64_t bytes = tcp->u_rval;
+	struct access_op_counts *const oc = account_op(tcp, fd, op, bytes);
+
+	/* Appends are sequential, but where they end is not known. */
+	if (op == ACCESS_WRITE && af->append && offset < 0) {
+		oc->sequential++;
+		af->next_known = false;
+		return;
+	}
+
+	const bool known = offset >= 0 || af->pos_known;
+	const uint64_t start = offset >= 0 ? (uint64_t) offset : af->pos;
+
+	if (known && af->next_known) {
+		if (start == af->next)
+			oc->sequential++;
+		else
+			oc->random++;
+	}
+
+	if (offset < 0 && af->pos_known)
+		af->pos += bytes;
+	af->next = start + bytes;
+	af->next_known = known;
+}
+
+static void
+fd_opened(struct tcb *const tcp, const int fd, const bool append)
+{
+	struct access_fd *const af = get_access_fd(tcp, fd);
+
+	if (!af)
+		return;
+
+	*af = (struct access_fd) {
+		.pos_known = !append,
+		.next_known = !append,
+		.append = append,
+	};
+}
+
+static void
+fd_unknown(struct tcb *const tcp, const int fd)
+{
+	struct access_fd *const af = get_access_fd(tcp, fd);
+
+	if (af)
+		memset(af, 0, sizeof(*af));
+}
+
+static void
+fd_seeked(struct tcb *const tcp, const int fd, const uint64_t pos)
+{
+	struct access_fd *const af = get_access_fd(tcp, fd);
+
+	if (!af)
+		return;
+
+	af->pos = pos;
+	af->pos_known = true;
+	if (!af->next_known) {
+		/* The first access after the seek starts a run. */
+		af->next = pos;
+		af->next_known = true;
+	}
+}
+
+/*
+ * Account BYTES copied from or to fd.  The file position is advanced
+ * unless the offset is passed by address OFFSET_ADDR.
+ */
+static void
+account_copy(struct tcb *const tcp, const int fd, const enum access_op op,
+	     const kernel_ulong_t offset_addr)
+{
+	struct access_fd *const af = get_access_fd(tcp, fd);
+
+	if (!af)
+		return;
+
+	account_op(tcp, fd, op, tcp->u_rval);
+	if (!offset_addr && af->pos_known)
+		af->pos += tcp->u_rval;
+}
+
+/* Return the offset passed in two arguments by preadv and pwritev. */
+static int64_t
+get_lo_hi_offset(struct tcb *const tcp, const int arg)
+{
+#if SIZEOF_KERNEL_LONG_T > 4
+# ifndef current_klongsize
+	if (current_klongsize < SIZEOF_KERNEL_LONG_T)
+		return (tcp->u_arg[arg + 1] << 32) | tcp->u_arg[arg];
+# endif
+	return tcp->u_arg[arg];
+#else
+	return ((int64_t) tcp->u_arg[arg + 1] << 32) | tcp->u_arg[arg];
+#endif
+}
+
+static int64_t
+get_ll_offset(struct tcb *const tcp, const int arg)
+{
+	unsigned long long offset;
+
+	getllval(tcp, &offset, arg);
+	return offset;
+}
+
+void
+count_access(struct tcb *const tcp)
+{
+	const int fd = tcp->u_arg[0];
+
+	if (tcp->s_ent->sen == SEN_close) {
+		fd_unknown(tcp, fd);
+		return;
+	}
+
+	if (syserror(tcp))
+		return;
+
+	switch (tcp->s_ent->sen) {
+	case SEN_open:
+		fd_opened(tcp, tcp->u_rval, tcp->u_arg[1] & O_APPEND);
+		break;
+	case SEN_openat:
+		fd_opened(tcp, tcp->u_rval, tcp->u_arg[2] & O_APPEND);
+		break;
+	case SEN_creat:
+		fd_opened(tcp, tcp->u_rval, false);
+		break;
+	case SEN_dup:
+	case SEN_dup2:
+	case SEN_dup3:
+		/* The position is shared, it is not known when it changes. */
+		if (tcp->u_rval != fd) {
+			fd_unknown(tcp, fd);
+			fd_unknown(tcp, tcp->u_rval);
+		}
+		break;
+	case SEN_lseek:
+		fd_seeked(tcp, fd, (kernel_ulong_t) tcp->u_rval);
+		break;
+	case SEN_llseek: {
+		uint64_t pos;
+
+		if (!umove(tcp, tcp->u_arg[3], &pos))
+			fd_seeked(tcp, fd, pos);
+		break;
+	}
+	case SEN_read:
+	case SEN_readv:
+		account_access(tcp, fd, ACCESS_READ, -1);
+		break;
+	case SEN_write:
+	case SEN_writev:
+		account_access(tcp, fd, ACCESS_WRITE, -1);
+		break;
+	case SEN_pread:
+		account_access(tcp, fd, ACCESS_READ, get_ll_offset(tcp, 3));
+		break;
+	case SEN_pwrite:
+		account_access(tcp, fd, ACCESS_WRITE, get_ll_offset(tcp, 3));
+		break;
+	case SEN_preadv:
+	case SEN_preadv2:
+		/* preadv2 uses the file position when the offset is -1. */
+		account_access(tcp, fd, ACCESS_READ, get_lo_hi_offset(tcp, 3));
+		break;
+	case SEN_pwritev:
+	case SEN_pwritev2:
+		account_access(tcp, fd, ACCESS_WRITE,
+			       get_lo_hi_offset(tcp, 3));
+		break;
+	case SEN_sendfile:
+	case SEN_sendfile64:
+		/* out_fd, in_fd, offset */
+		account_copy(tcp, tcp->u_arg[1], ACCESS_COPY_FROM,
+			     tcp->u_arg[2]);
+		account_copy(tcp, fd, ACCESS_COPY_TO, 0);
+		break;
+	case SEN_splice:
+	case SEN_copy_file_range:
+		/* fd_in, off_in, fd_out, off_out */
+		account_copy(tcp, fd, ACCESS_COPY_FROM, tcp->u_arg[1]);
+		account_copy(tcp, tcp->u_arg[2], ACCESS_COPY_TO,
+			     tcp->u_arg[3]);
+		break;
+	}
+}
+
+static int
+access_counts_cmp(const void *a, const void *b)
+{
+	const struct access_counts *const x = *(const struct access_counts **) a;
+	const struct access_counts *const y = *(const struct access_counts **) b;
+
+	return (x->bytes < y->bytes) ? 1 : (x->bytes > y->bytes) ? -1
+	     : strcmp(x->path, y->path);
+}
+
+/*
+ * Print the access patterns of summary_access files that moved the most
+ * bytes, a row for each kind of access.
+ */
+void
+access_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	struct access_counts **sorted;
+	unsigned int i, j, n = 0;
+
+	if (!access_hash_count)
+		return;
+
+	sorted = xcalloc(access_hash_count, sizeof(sorted[0]));
+	for (i = 0; i < access_hash_size; ++i) {
+		struct access_counts *ac;
+
+		for (ac = access_hash[i]; ac; ac = ac->next)
+			sorted[n++] = ac;
+	}
+	sort_top(sorted, n, sizeof(sorted[0]), summary_access,
+		 access_counts_cmp);
+
+	fprintf(outf, "\n%9.9s %14.14s %5.5s", "calls", "bytes", "seq%");
+	for (j = 0; j < NBUCKETS; ++j)
+		fprintf(outf, " %7.7s", size_bucket_names[j]);
+	fprintf(outf, " %-9.9s %s\n", "access", "file");
+	fprintf(outf, "%9.9s %14.14s %5.5s", dashes, dashes, dashes);
+	for (j = 0; j < NBUCKETS; ++j)
+		fprintf(outf, " %7.7s", dashes);
+	fprintf(outf, " %-9.9s %s\n", dashes, dashes);
+
+	for (i = 0; i < n && i < summary_access; ++i) {
+		unsigned int op;
+
+		for (op = 0; op < ACCESS_NOPS; ++op) {
+			const struct access_op_counts *const oc =
+				&sorted[i]->ops[op];
+			const uint64_t classified = oc->sequential + oc->random;
+
+			if (!oc->calls)
+				continue;
+
+			fprintf(outf, "%9" PRIu64 " %14" PRIu64,
+				oc->calls, oc->bytes);
+			if (classified)
+				fprintf(outf, " %5.1f",
+					100.0 * oc->sequential / classified);
+			else
+				fprintf(outf, " %5s", "-");
+			for (j = 0; j < NBUCKETS; ++j)
+				fprintf(outf, " %7" PRIu64, oc->sizes[j]);
+			fprintf(outf, " %-9s %s\n",
+				access_op_names[op], sorted[i]->path);
+		}
+	}
+
+	free(sorted);
+}
@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Syscall argument value distributions (--summary-args option).
+ *
+ * Each specification selects a set of syscalls and one of their
+ * raw arguments or their return value, and the values are counted
+ * straight from u_arg[] and u_rval, without any decoding, separately
+ * for each syscall of the set.  The values are counted either in a
+ * log2 histogram, which suits sizes and lengths, or by value, which
+ * suits flags, modes, timeouts, and descriptors.  Return values are
+ * counted for successful syscalls only.
+ */
+
+#include "defs.h"
+#include "filter.h"
+#include "number_set.h"
+
+#define ARGS_RETVAL MAX_ARGS
+
+/* Values of 0, and of [2^(i-1), 2^i) for i = 1..64.  */
+#define LOG2_BUCKETS 65
+
+/* The values that do not fit are counted as other values.  */
+#define MAX_ARG_VALUES 1024
+#define ARG_VALUES_SIZE (MAX_ARG_VALUES * 2)
+
+struct arg_value {
+	kernel_ulong_t value;
+	uint64_t count;
+};
+
+/* The counts of a specification for one syscall.  */
+struct args_counts {
+	struct args_counts *next;
+	const char *sys_name;
+	uint64_t count;
+	uint64_t buckets[LOG2_BUCKETS];
+	struct arg_value *values;	/* Open addressing hash table */
+	unsigned int nvalues;
+	uint64_t other;
+};
+
+struct args_spec {
+	struct args_spec *next;
+	struct number_set *syscalls;
+	unsigned int operand;	/* Argument index or ARGS_RETVAL */
+	unsigned int top;	/* Count by value if not zero */
+	struct args_counts *counts, *last;
+};
+
+unsigned int summary_args;
+static struct args_spec *spec_list, **spec_tail = &spec_list;
+
+/*
+ * Parse SET:argN or SET:retval, optionally followed by :top or :top=N,
+ * where SET is a syscall specification of -e trace.
+ */
+bool
+add_summary_args(const char *const arg)
+{
+	char *const copy = xstrdup(arg);
+	char *kind = strrchr(copy, ':');
+	unsigned int top = 0;
+
+	if (kind && !strncmp(kind + 1, "top", 3)) {
+		*kind = '\0';
+		kind += 4;
+		if (*kind == '=') {
+			const int n = string_to_uint(kind + 1);
+
+			if (n <= 0)
+				goto bad;
+			top = n;
+		} else if (*kind) {
+			goto bad;
+		} else {
+			top = DEFAULT_SUMMARY_ARGS_TOP;
+		}
+	}
+
+	char *const operand = strrchr(copy, ':');
+	unsigned int idx;
+
+	if (!operand || operand == copy)
+		goto bad;
+	*operand = '\0';
+	if (!strcmp(operand + 1, "retval"))
+		idx = ARGS_RETVAL;
+	else if (!strncmp(operand + 1, "arg", 3)
+		 && operand[4] >= '0' && operand[4] < '0' + MAX_ARGS
+		 && !operand[5])
+		idx = operand[4] - '0';
+	else
+		goto bad;
+
+	struct args_spec *const as = xcalloc(1, sizeof(*as));
+
+	as->syscalls = alloc_number_set_array(SUPPORTED_PERSONALITIES);
+	qualify_syscall_tokens(copy, as->syscalls, "system call");
+	as->operand = idx;
+	as->top = top;
+	*spec_tail = as;
+	spec_tail = &as->next;
+	++summary_args;
+
+	free(copy);
+	return true;
+
+bad:
+	free(copy);
+	return false;
+}
+
+static struct args_counts *
+get_counts(struct args_spec *const as, const char *const sys_name)
+{
+	struct args_counts *ac;
+
+	if (as->last && as->last->sys_name == sys_name)
+		return as->last;
+
+	for (ac = as->counts; ac; ac = ac->next) {
+		if (!strcmp(ac->sys_name, sys_name))
+			return as->last = ac;
+	}
+
+	ac = xcalloc(1, sizeof(*ac));
+	ac->sys_name = sys_name;
+	if (as->top)
+		ac->values = xcalloc(ARG_VALUES_SIZE, sizeof(*ac->values));
+	ac->next = as->counts;
+	as->counts = ac;
+
+	return as->last = ac;
+}
+
+static unsigned int
+log2_bucket(kernel_ulong_t v)
+{
+	unsigned int i = 0;
+
+	for (; v; v >>= 1)
+		++i;
+
+	return i;
+}
+
+static void
+count_value(struct args_counts *const ac, const kernel_ulong_t v)
+{
+	unsigned int i = ((uint64_t) v * 0x9e3779b97f4a7c15ULL) >> 53;
+
+	for (;; i = (i + 1) % ARG_VALUES_SIZE) {
+		struct arg_value *const av = &ac->values[i];
+
+		if (av->count && av->value == v) {
+			av->count++;
+			return;
+		}
+		if (!av->count)
+			break;
+	}
+
+	if (ac->nvalues >= MAX_ARG_VALUES) {
+		ac->other++;
+		return;
+	}
+
+	ac->values[i].value = v;
+	ac->values[i].count = 1;
+	ac->nvalues++;
+}
+
+void
+count_args(struct tcb *const tcp)
+{
+	struct args_spec *as;
+
+	for (as = spec_list; as; as = as->next) {
+		if (!is_number_in_set_array(tcp->scno, as->syscalls,
+					    current_personality))
+			continue;
+
+		kernel_ulong_t v;
+
+		if (as->operand == ARGS_RETVAL) {
+			if (syserror(tcp))
+				continue;
+			v = tcp->u_rval;
+		} else {
+			if (as->operand >= tcp->s_ent->nargs)
+				continue;
+			v = tcp->u_arg[as->operand];
+		}
+
+		struct args_counts *const ac =
+			get_counts(as, tcp->s_ent->sys_name);
+
+		ac->count++;
+		if (as->top)
+			count_value(ac, v);
+		else
+			ac->buckets[log2_bucket(v)]++;
+	}
+}
+
+static void
+print_log2(FILE *outf, const struct args_counts *const ac)
+{
+	const char *dashes = "------------------------";
+	unsigned int i;
+
+	fprintf(outf, "%20.20s %20.20s %9.9s\n", "from", "to", "count");
+	fprintf(outf, "%20.20s %20.20s %9.9s\n", dashes, dashes, dashes);
+	for (i = 0; i < LOG2_BUCKETS; ++i) {
+		if (!ac->buckets[i])
+			continue;
+
+		const uint64_t lo = i ? 1ULL << (i - 1) : 0;
+		const uint64_t hi = i ? lo * 2 - 1 : 0;
+
+		fprintf(outf, "%20" PRIu64 " %20" PRIu64 " %9" PRIu64 "\n",
+			lo, hi, ac->buckets[i]);
+	}
+}
+
+static int
+arg_value_cmp(const void *a, const void *b)
+{
+	const struct arg_value *const x = a;
+	const struct arg_value *const y = b;
+
+	if (x->count != y->count)
+		return x->count < y->count ? 1 : -1;
+	return (x->value > y->value) - (x->value < y->value);
+}
+
+static void
+print_top(FILE *outf, const struct args_counts *const ac,
+	  const unsigned int top)
+{
+	const char *dashes = "------------------------";
+	struct arg_value *sorted = xcalloc(ac->nvalues, sizeof(*sorted));
+	unsigned int i, n = 0;
+
+	for (i = 0; i < ARG_VALUES_SIZE; ++i) {
+		if (ac->values[i].count)
+			sorted[n++] = ac->values[i];
+	}
+	sort_top(sorted, n, sizeof(*sorted), top, arg_value_cmp);
+
+	uint64_t rest = ac->other;
+
+	for (i = top; i < n; ++i)
+		rest += sorted[i].count;
+
+	fprintf(outf, "%20.20s %18.18s %9.9s\n", "value", "hex", "count");
+	fprintf(outf, "%20.20s %18.18s %9.9s\n", dashes, dashes, dashes);
+	for (i = 0; i < n && i < top; ++i) {
+		fprintf(outf, "%20" PRId64 " %#18" PRIx64 " %9" PRIu64 "\n",
+			(int64_t) sorted[i].value, (uint64_t) sorted[i].value,
+			sorted[i].count);
+	}
+	if (rest)
+		fprintf(outf, "%20s %18s %9" PRIu64 "\n", "other", "", rest);
+
+	free(sorted);
+}
+
+static int
+args_counts_cmp(const void *a, const void *b)
+{
+	const struct args_counts *const x = *(const struct args_counts **) a;
+	const struct args_counts *const y = *(const struct args_counts **) b;
+
+	return strcmp(x->sys_name, y->sys_name);
+}
+
+/*
+ * Print the distributions of the specifications in the order
+ * they were given, and of their syscalls in the order of names.
+ */
+void
+args_summary(FILE *outf)
+{
+	struct args_spec *as;
+
+	for (as = spec_list; as; as = as->next) {
+		struct args_counts **sorted;
+		struct args_counts *ac;
+		unsigned int i, n = 0;
+
+		for (ac = as->counts; ac; ac = ac->next)
+			++n;
+		if (!n)
+			continue;
+
+		sorted = xcalloc(n, sizeof(*sorted));
+		n = 0;
+		for (ac = as->counts; ac; ac = ac->next)
+			sorted[n++] = ac;
+		qsort(sorted, n, sizeof(*sorted), args_counts_cmp);
+
+		for (i = 0; i < n; ++i) {
+			ac = sorted[i];
+			fprintf(outf, "\n%s ", ac->sys_name);
+			if (as->operand == ARGS_RETVAL)
+				fprintf(outf, "retval");
+			else
+				fprintf(outf, "arg%u", as->operand);
+			fprintf(outf, ", %" PRIu64 " calls\n", ac->count);
+
+			if (as->top)
+				print_top(outf, ac, as->top);
+			else
+				print_log2(outf, ac);
+		}
+
+		free(sorted);
+	}
+}
@@ -0,0 +1,357 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Asynchronous trace output (--output-async option).
+ *
+ * Each output stream has two buffers: the tracer appends the data
+ * to one of them while a writer thread shared by all streams writes
+ * the other one out.  Whenever the writer is done with the previous
+ * buffer of a stream, the next write of the tracer swaps the buffers
+ * and hands the filled one over, so the output is as timely as it is
+ * written inline when the file keeps up, and is written in larger
+ * chunks when it does not.  When the buffer being filled reaches
+ * --output-queue bytes while the writer is still busy with the other
+ * one, --output-policy decides whether the tracer waits for the writer,
+ * or the output is dropped.
+ */
+
+#include "defs.h"
+
+bool output_async;
+
+#ifdef HAVE_FOPENCOOKIE
+
+# include <pthread.h>
+# include <signal.h>
+
+/* The largest --sample rate the sample policy raises the rate to.  */
+# define MAX_SAMPLE_RATE_SCALE 1024
+
+struct async_stream {
+	struct async_stream *next;	/* In the list of all streams */
+	struct async_stream *next_ready; /* In the list of handed over ones */
+	FILE *out;
+	char *name;
+	char *fill;		/* The buffer the tracer appends to */
+	size_t fill_len;
+	size_t fill_size;
+	char *flush;		/* The buffer handed over to the writer */
+	size_t flush_len;
+	size_t flush_size;
+	bool busy;		/* The writer owns the flush buffer */
+	bool closed;		/* The writer closes the stream when done */
+	bool error_reported;
+	uint64_t dropped_writes;
+	uint64_t dropped_bytes;
+};
+
+static struct async_stream *streams;
+static struct async_stream *ready_head, **ready_tail = &ready_head;
+static bool closing;
+static bool started;
+static bool finished;
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stream_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t stream_done = PTHREAD_COND_INITIALIZER;
+static pthread_t writer;
+static unsigned int base_sample_rate;
+
+static void
+write_out(struct async_stream *const s, const char *const data,
+	  const size_t len)
+{
+	if (len && fwrite(data, 1, len, s->out) != len &&
+	    !s->error_reported) {
+		s->error_reported = true;
+		perror_msg("%s", s->name);
+	}
+}
+
+static void
+report_dropped(const struct async_stream *const s)
+{
+	if (s->dropped_writes)
+		error_msg("%" PRIu64 " writes (%" PRIu64 " bytes) of output"
+			  " to %s have been dropped", s->dropped_writes,
+			  s->dropped_bytes, s->name);
+}
+
+static void
+unlink_stream(struct async_stream *const s)
+{
+	struct async_stream **p;
+
+	for (p = &streams; *p != s; p = &(*p)->next)
+		;
+	*p = s->next;
+}
+
+/* Close the stream, the caller is the only one that refers to it.  */
+static void
+destroy(struct async_stream *const s)
+{
+	write_out(s, s->fill, s->fill_len);
+	if (fclose(s->out))
+		perror_msg("%s", s->name);
+	report_dropped(s);
+	free(s->name);
+	free(s->fill);
+	free(s->flush);
+	free(s);
+}
+
+static void *
+writer_thread(void *arg)
+{
+	pthread_mutex_lock(&async_lock);
+	for (;;) {
+		while (!ready_head && !closing)
+			pthread_cond_wait(&stream_ready, &async_lock);
+
+		struct async_stream *const s = ready_head;
+
+		if (!s)
+			break;
+		ready_head = s->next_ready;
+		if (!ready_head)
+			ready_tail = &ready_head;
+		pthread_mutex_unlock(&async_lock);
+
+		write_out(s, s->flush, s->flush_len);
+
+		pthread_mutex_lock(&async_lock);
+		s->flush_len = 0;
+		s->busy = false;
+		if (s->closed) {
+			/* The tracer has let go of the stream.  */
+			unlink_stream(s);
+			pthread_mutex_unlock(&async_lock);
+			destroy(s);
+			pthread_mutex_lock(&async_lock);
+		} else {
+			pthread_cond_broadcast(&stream_done);
+		}
+	}
+	pthread_mutex_unlock(&async_lock);
+	return NULL;
+}
+
+/*
+ * The thread is started with the first buffer rather than with the first
+ * stream, so the tracer is still single-threaded when it forks the command.
+ */
+static void
+start_writer(void)
+{
+	sigset_t all, saved;
+	int rc;
+
+	/* Signals are handled by the tracer thread only.  */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &saved);
+	rc = pthread_create(&writer, NULL, writer_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	if (rc) {
+		errno = rc;
+		perror_msg_and_die("pthread_create");
+	}
+	started = true;
+}
+
+/* Hand over the filled buffer, the caller holds async_lock.  */
+static void
+swap_buffers(struct async_stream *const s)
+{
+	char *const buf = s->flush;
+	const size_t size = s->flush_size;
+
+	s->flush = s->fill;
+	s->flush_len = s->fill_len;
+	s->flush_size = s->fill_size;
+	s->fill = buf;
+	s->fill_len = 0;
+	s->fill_size = size;
+	s->busy = true;
+
+	s->next_ready = NULL;
+	*ready_tail = s;
+	ready_tail = &s->next_ready;
+	pthread_cond_signal(&stream_ready);
+}
+
+static void
+append(struct async_stream *const s, const char *const data,
+       const size_t len)
+{
+	if (s->fill_len + len > s->fill_size) {
+		s->fill_size = MAX(s->fill_size * 2, s->fill_len + len);
+		s->fill = xreallocarray(s->fill, s->fill_size, 1);
+	}
+	memcpy(s->fill + s->fill_len, data, len);
+	s->fill_len += len;
+}
+
+static ssize_t
+async_write(void *cookie, const char *data, size_t len)
+{
+	struct async_stream *const s = cookie;
+
+	if (finished) {
+		/* The writer is gone, this is the flush at exit.  */
+		write_out(s, data, len);
+		return len;
+	}
+
+	if (!started)
+		start_writer();
+
+	pthread_mutex_lock(&async_lock);
+
+	if (s->busy && s->fill_len + len > output_queue_size) {
+		if (output_policy == OUTPUT_POLICY_BLOCK) {
+			while (s->busy)
+				pthread_cond_wait(&stream_done, &async_lock);
+		} else {
+			++s->dropped_writes;
+			s->dropped_bytes += len;
+			if (output_policy == OUTPUT_POLICY_SAMPLE &&
+			    sample_rate < base_sample_rate
+					  * MAX_SAMPLE_RATE_SCALE)
+				sample_rate *= 2;
+			pthread_mutex_unlock(&async_lock);
+			return len;
+		}
+	}
+
+	append(s, data, len);
+	if (!s->busy) {
+		swap_buffers(s);
+		/* Go back to the original rate once the writer has caught up.  */
+		if (output_policy == OUTPUT_POLICY_SAMPLE &&
+		    sample_rate > base_sample_rate)
+			sample_rate /= 2;
+	}
+
+	pthread_mutex_unlock(&async_lock);
+	return len;
+}
+
+static int
+async_close(void *cookie)
+{
+	struct async_stream *const s = cookie;
+
+	if (!started) {
+		unlink_stream(s);
+		destroy(s);
+		return 0;
+	}
+
+	/*
+	 * The tracer does not wait for the data to be written,
+	 * the writer closes the stream once it is done with it.
+	 */
+	pthread_mutex_lock(&async_lock);
+	s->closed = true;
+	if (!s->busy)
+		swap_buffers(s);
+	pthread_mutex_unlock(&async_lock);
+	return 0;
+}
+
+FILE *
+async_open(FILE *const out, const char *const name)
+{
+	static const cookie_io_functions_t async_funcs = {
+		.write = async_write,
+		.close = async_close
+	};
+	struct async_stream *const s = xcalloc(1, sizeof(*s));
+	FILE *fp;
+
+	s->out = out;
+	s->name = xstrdup(name);
+	setvbuf(out, NULL, _IONBF, 0);
+	if (!base_sample_rate)
+		base_sample_rate = sample_rate;
+
+	fp = fopencookie(s, "w", async_funcs);
+	if (!fp)
+		perror_msg_and_die("fopencookie");
+
+	pthread_mutex_lock(&async_lock);
+	s->next = streams;
+	streams = s;
+	pthread_mutex_unlock(&async_lock);
+
+	return fp;
+}
+
+/*
+ * Wait for the writer to write out all the handed over data,
+ * and write out the rest of the streams that are still open.
+ */
+void
+async_finish(void)
+{
+	struct async_stream *s;
+
+	if (!started)
+		return;
+
+	pthread_mutex_lock(&async_lock);
+	closing = true;
+	pthread_cond_signal(&stream_ready);
+	pthread_mutex_unlock(&async_lock);
+
+	pthread_join(writer, NULL);
+	started = false;
+	finished = true;
+
+	for (s = streams; s; s = s->next) {
+		write_out(s, s->fill, s->fill_len);
+		s->fill_len = 0;
+		report_dropped(s);
+		s->dropped_writes = 0;
+	}
+}
+
+#else /* !HAVE_FOPENCOOKIE */
+
+FILE *
+async_open(FILE *const out, const char *const name)
+{
+	error_msg_and_die("--output-async is not supported by this build");
+}
+
+void
+async_finish(void)
+{
+}
+
+#endif /* HAVE_FOPENCOOKIE */
@@ -52,6 +52,62 @@ qualify_syscall_number(const char *s, struct number_set *set)
 	return done;
 }
 
+/*
+ * Syscalls of all personalities sorted by name, so that the name
+ * of a syscall is found by binary search, and a regular expression
+ * is matched against each distinct name once.
+ */
+struct syscall_name {
+	const char *name;
+	unsigned int scno;
+	unsigned int pers;
+};
+
+static struct syscall_name *syscall_names;
+static unsigned int nsyscall_names;
+
+static int
+syscall_name_cmp(const void *a, const void *b)
+{
+	const struct syscall_name *const n1 = a;
+	const struct syscall_name *const n2 = b;
+	const int rc = strcmp(n1->name, n2->name);
+
+	if (rc)
+		return rc;
+	if (n1->pers != n2->pers)
+		return n1->pers < n2->pers ? -1 : 1;
+	return n1->scno < n2->scno ? -1 : n1->scno > n2->scno;
+}
+
+static void
+init_syscall_names(void)
+{
+	unsigned int p, i, n = 0;
+
+	if (syscall_names)
+		return;
+
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p)
+		n += nsyscall_vec[p];
+	syscall_names = xcalloc(n, sizeof(*syscall_names));
+
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		for (i = 0; i < nsyscall_vec[p]; ++i) {
+			if (!sysent_vec[p][i].sys_name)
+				continue;
+			syscall_names[nsyscall_names].name =
+				sysent_vec[p][i].sys_name;
+			syscall_names[nsyscall_names].scno = i;
+			syscall_names[nsyscall_names].pers = p;
+			++nsyscall_names;
+		}
+	}
+
+	qsort(syscall_names, nsyscall_names, sizeof(*syscall_names),
+	      syscall_name_cmp);
+}
+
 static void
 regerror_msg_and_die(int errcode, const regex_t *preg,
 		     const char *str, const char *pattern)
@@ -71,23 +127,24 @@ qualify_syscall_regex(const char *s, struct number_set *set)
 	if ((rc = regcomp(&preg, s, REG_EXTENDED | REG_NOSUB)) != 0)
 		regerror_msg_and_die(rc, &preg, "regcomp", s);
 
-	unsigned int p;
+	init_syscall_names();
+
+	unsigned int i;
 	bool found = false;
-	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
-		unsigned int i;
+	bool match = false;
+	for (i = 0; i < nsyscall_names; ++i) {
+		const struct syscall_name *const sn = &syscall_names[i];
 
-		for (i = 0; i < nsyscall_vec[p]; ++i) {
-			if (!sysent_vec[p][i].sys_name)
-				continue;
-			rc = regexec(&preg, sysent_vec[p][i].sys_name,
-				     0, NULL, 0);
-			if (rc == REG_NOMATCH)
-				continue;
-			else if (rc)
+		if (!i || strcmp(sn->name, sn[-1].name)) {
+			rc = regexec(&preg, sn->name, 0, NULL, 0);
+			if (rc && rc != REG_NOMATCH)
 				regerror_msg_and_die(rc, &preg, "regexec", s);
-			add_number_to_set_array(i, set, p);
-			found = true;
+			match = !rc;
 		}
+		if (!match)
+			continue;
+		add_number_to_set_array(sn->scno, set, sn->pers);
+		found = true;
 	}
 
 	regfree(&preg);
@@ -160,20 +217,25 @@ qualify_syscall_class(const char *s, struct number_set *set)
 static bool
 qualify_syscall_name(const char *s, struct number_set *set)
 {
-	unsigned int p;
-	bool found = false;
+	init_syscall_names();
 
-	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
-		unsigned int i;
+	/* Find the first entry with the name.  */
+	unsigned int lo = 0, hi = nsyscall_names;
+	while (lo < hi) {
+		const unsigned int mid = lo + (hi - lo) / 2;
 
-		for (i = 0; i < nsyscall_vec[p]; ++i) {
-			if (!sysent_vec[p][i].sys_name
-			    || strcmp(s, sysent_vec[p][i].sys_name)) {
-				continue;
-			}
-			add_number_to_set_array(i, set, p);
-			found = true;
-		}
+		if (strcmp(syscall_names[mid].name, s) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	bool found = false;
+	for (; lo < nsyscall_names && !strcmp(syscall_names[lo].name, s);
+	     ++lo) {
+		add_number_to_set_array(syscall_names[lo].scno, set,
+					syscall_names[lo].pers);
+		found = true;
 	}
 
 	return found;
@@ -0,0 +1,1051 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "defs.h"
+#include "bintrace.h"
+#include <sys/stat.h>
+#ifdef HAVE_OPEN_MEMSTREAM
+# include <pthread.h>
+#endif
+
+/*
+ * Binary trace is a sequence of fixed size records following a header.
+ * The records hold raw syscall information only, they are meant to be
+ * turned into text offline by strace --binary-decode on the same
+ * architecture.
+ *
+ * When the trace is written to a regular file, an index is written
+ * to the file with the .idx suffix alongside.  For every block of
+ * BINTRACE_INDEX_RECORDS records it holds the time range of the block,
+ * the pids that have records in it, and bitmaps of the syscalls entered
+ * or exited and of the syscalls failed in it, so that --binary-query
+ * reads only the blocks that may have matching records.
+ */
+
+#define BINTRACE_MAGIC "STRACEB"
+#define BINTRACE_VERSION 1
+
+struct bintrace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t nargs;
+	uint32_t personalities;
+};
+
+enum bintrace_record_type {
+	BINTRACE_SYSCALL_ENTERING = 1,
+	BINTRACE_SYSCALL_EXITING = 2,
+};
+
+struct bintrace_record {
+	uint32_t type;
+	int32_t pid;
+	uint32_t personality;
+	uint32_t pad;
+	uint64_t scno;
+	int64_t tv_sec;
+	int64_t tv_usec;
+	uint64_t args[MAX_ARGS];
+	int64_t rval;
+	uint64_t error;
+};
+
+#define BINTRACE_INDEX_MAGIC "STRACEI"
+#define BINTRACE_INDEX_VERSION 1
+#define BINTRACE_INDEX_RECORDS 4096
+
+/*
+ * The index header is followed by the number of syscalls
+ * of each personality, which give the sizes of the bitmaps.
+ */
+struct bintrace_index_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t block_records;
+	uint32_t personalities;
+	uint32_t pad;
+};
+
+/*
+ * An index block is followed by its pids, and by the bitmaps
+ * of the syscalls seen and of the syscalls failed of each personality.
+ */
+struct bintrace_index_block {
+	uint64_t first_record;
+	uint32_t nrecords;
+	uint32_t npids;
+	int64_t first_ts;	/* in nanoseconds */
+	int64_t last_ts;
+};
+
+/* The index block being filled, or read by --binary-query */
+struct index_block {
+	struct bintrace_index_block hdr;
+	int32_t *pids;
+	unsigned int pids_size;
+	uint64_t *seen[SUPPORTED_PERSONALITIES];
+	uint64_t *failed[SUPPORTED_PERSONALITIES];
+};
+
+static FILE *bintrace_file;
+static const char *bintrace_path;
+static FILE *index_file;
+static char *index_path;
+static struct index_block index_block;
+static uint64_t nrecords;
+
+static unsigned int
+bitmap_words(const unsigned int personality)
+{
+	return (nsyscall_vec[personality] + 63) / 64;
+}
+
+static void
+bitmap_set(uint64_t *const bitmap, const uint64_t bit)
+{
+	bitmap[bit / 64] |= 1ULL << (bit % 64);
+}
+
+static bool
+bitmap_test(const uint64_t *const bitmap, const uint64_t bit)
+{
+	return bitmap[bit / 64] & (1ULL << (bit % 64));
+}
+
+static void
+index_block_alloc(struct index_block *const b)
+{
+	unsigned int p;
+
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		b->seen[p] = xcalloc(bitmap_words(p), sizeof(uint64_t));
+		b->failed[p] = xcalloc(bitmap_words(p), sizeof(uint64_t));
+	}
+}
+
+static void
+index_write(const void *const buf, const size_t size)
+{
+	if (size && fwrite(buf, size, 1, index_file) != 1)
+		perror_msg_and_die("%s", index_path);
+}
+
+static void
+index_init(void)
+{
+	struct stat st;
+
+	/* Pipes and devices cannot be seeked in by --binary-query.  */
+	if (fstat(fileno(bintrace_file), &st) || !S_ISREG(st.st_mode))
+		return;
+
+	const struct bintrace_index_header hdr = {
+		.magic = BINTRACE_INDEX_MAGIC,
+		.version = BINTRACE_INDEX_VERSION,
+		.block_records = BINTRACE_INDEX_RECORDS,
+		.personalities = SUPPORTED_PERSONALITIES
+	};
+	unsigned int p;
+
+	index_path = xmalloc(strlen(bintrace_path) + sizeof(".idx"));
+	strcpy(stpcpy(index_path, bintrace_path), ".idx");
+	index_file = fopen(index_path, "w");
+	if (!index_file)
+		perror_msg_and_die("Can't fopen '%s'", index_path);
+
+	index_write(&hdr, sizeof(hdr));
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		const uint32_t n = nsyscall_vec[p];
+
+		index_write(&n, sizeof(n));
+	}
+	index_block_alloc(&index_block);
+}
+
+static void
+index_flush(void)
+{
+	struct index_block *const b = &index_block;
+	unsigned int p;
+
+	if (!b->hdr.nrecords)
+		return;
+
+	index_write(&b->hdr, sizeof(b->hdr));
+	index_write(b->pids, b->hdr.npids * sizeof(b->pids[0]));
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		index_write(b->seen[p], bitmap_words(p) * sizeof(uint64_t));
+		index_write(b->failed[p], bitmap_words(p) * sizeof(uint64_t));
+		memset(b->seen[p], 0, bitmap_words(p) * sizeof(uint64_t));
+		memset(b->failed[p], 0, bitmap_words(p) * sizeof(uint64_t));
+	}
+
+	b->hdr.first_record = nrecords;
+	b->hdr.nrecords = 0;
+	b->hdr.npids = 0;
+}
+
+static void
+index_add(const struct bintrace_record *const rec, const int64_t ts)
+{
+	struct index_block *const b = &index_block;
+	unsigned int i;
+
+	if (!b->hdr.nrecords)
+		b->hdr.first_ts = ts;
+	b->hdr.last_ts = ts;
+	++b->hdr.nrecords;
+
+	/* The records of a pid tend to come in runs, search from the end. */
+	for (i = b->hdr.npids; i > 0; --i) {
+		if (b->pids[i - 1] == rec->pid)
+			break;
+	}
+	if (!i) {
+		if (b->hdr.npids >= b->pids_size) {
+			b->pids_size = b->pids_size ? b->pids_size * 2 : 16;
+			b->pids = xreallocarray(b->pids, b->pids_size,
+						sizeof(b->pids[0]));
+		}
+		b->pids[b->hdr.npids++] = rec->pid;
+	}
+
+	if (rec->scno < nsyscall_vec[rec->personality]) {
+		bitmap_set(b->seen[rec->personality], rec->scno);
+		if (rec->error)
+			bitmap_set(b->failed[rec->personality], rec->scno);
+	}
+
+	if (b->hdr.nrecords >= BINTRACE_INDEX_RECORDS)
+		index_flush();
+}
+
+bool
+bintrace_enabled(void)
+{
+	return bintrace_file;
+}
+
+void
+bintrace_init(FILE *fp, const char *path)
+{
+	const struct bintrace_header hdr = {
+		.magic = BINTRACE_MAGIC,
+		.version = BINTRACE_VERSION,
+		.record_size = sizeof(struct bintrace_record),
+		.nargs = MAX_ARGS,
+		.personalities = SUPPORTED_PERSONALITIES
+	};
+
+	bintrace_file = fp;
+	bintrace_path = path;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, bintrace_file) != 1)
+		perror_msg_and_die("%s", path);
+
+	index_init();
+}
+
+void
+bintrace_finish(void)
+{
+	if (!index_file)
+		return;
+
+	index_flush();
+	if (fclose(index_file))
+		perror_msg("%s", index_path);
+	index_file = NULL;
+}
+
+static void
+bintrace_write(const struct tcb *tcp, const enum bintrace_record_type type)
+{
+	struct bintrace_record rec = {
+		.type = type,
+		.pid = tcp->pid,
+		.personality = current_personality,
+		.scno = tcp->scno
+	};
+	struct timeval tv;
+	unsigned int i;
+
+	gettimeofday(&tv, NULL);
+	rec.tv_sec = tv.tv_sec;
+	rec.tv_usec = tv.tv_usec;
+
+	if (type == BINTRACE_SYSCALL_ENTERING) {
+		for (i = 0; i < MAX_ARGS; ++i)
+			rec.args[i] = tcp->u_arg[i];
+	} else {
+		rec.rval = tcp->u_rval;
+		rec.error = tcp->u_error;
+	}
+
+	if (fwrite(&rec, sizeof(rec), 1, bintrace_file) != 1)
+		perror_msg_and_die("%s", bintrace_path);
+
+	if (index_file)
+		index_add(&rec, tv.tv_sec * 1000000000LL + tv.tv_usec * 1000LL);
+	++nrecords;
+}
+
+void
+bintrace_syscall_entering(const struct tcb *tcp)
+{
+	bintrace_write(tcp, BINTRACE_SYSCALL_ENTERING);
+}
+
+void
+bintrace_syscall_exiting(const struct tcb *tcp)
+{
+	bintrace_write(tcp, BINTRACE_SYSCALL_EXITING);
+}
+
+static const char *
+bintrace_syscall_name(const struct bintrace_record *rec, char *buf)
+{
+	if (rec->personality < SUPPORTED_PERSONALITIES &&
+	    rec->scno < nsyscall_vec[rec->personality] &&
+	    sysent_vec[rec->personality][rec->scno].sys_name)
+		return sysent_vec[rec->personality][rec->scno].sys_name;
+
+	sprintf(buf, "syscall_%" PRIu64, rec->scno);
+	return buf;
+}
+
+static void
+bintrace_print_entering(FILE *fp, const struct bintrace_record *rec,
+			const char *name)
+{
+	unsigned int nargs = MAX_ARGS;
+	unsigned int i;
+
+	if (rec->personality < SUPPORTED_PERSONALITIES &&
+	    rec->scno < nsyscall_vec[rec->personality])
+		nargs = sysent_vec[rec->personality][rec->scno].nargs;
+
+	fprintf(fp, "%-5d %lld.%06lld %s(", rec->pid,
+		(long long) rec->tv_sec, (long long) rec->tv_usec, name);
+	for (i = 0; i < nargs; ++i)
+		fprintf(fp, "%s%#" PRIx64, i ? ", " : "", rec->args[i]);
+}
+
+static void
+bintrace_print_exiting(FILE *fp, const struct bintrace_record *rec)
+{
+	if (rec->error) {
+		const char *err = err_name(rec->error);
+
+		if (err)
+			fprintf(fp, ") = -1 %s (errno %" PRIu64 ")\n",
+				err, rec->error);
+		else
+			fprintf(fp, ") = -1 (errno %" PRIu64 ")\n",
+				rec->error);
+	} else {
+		fprintf(fp, ") = %#" PRIx64 "\n", (uint64_t) rec->rval);
+	}
+}
+
+/*
+ * Open the binary trace file and check its header.
+ * Returns NULL if the file is not a binary trace.
+ */
+static FILE *
+bintrace_open(const char *path)
+{
+	struct bintrace_header hdr;
+	FILE *fp = fopen(path, "r");
+
+	if (!fp)
+		perror_msg_and_die("Can't fopen '%s'", path);
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    memcmp(hdr.magic, BINTRACE_MAGIC, sizeof(BINTRACE_MAGIC)) ||
+	    hdr.version != BINTRACE_VERSION) {
+		fclose(fp);
+		return NULL;
+	}
+	if (hdr.record_size != sizeof(struct bintrace_record) ||
+	    hdr.nargs != MAX_ARGS ||
+	    hdr.personalities != SUPPORTED_PERSONALITIES)
+		error_msg_and_die("%s: binary trace of a different architecture",
+				  path);
+
+	return fp;
+}
+
+bool
+bintrace_read(const char *path,
+	      void (*func)(const struct bintrace_event *, void *), void *data)
+{
+	struct bintrace_record rec;
+	char buf[sizeof("syscall_") + sizeof(rec.scno) * 3];
+	FILE *fp = bintrace_open(path);
+
+	if (!fp)
+		return false;
+
+	while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+		const struct bintrace_event ev = {
+			.pid = rec.pid,
+			.exiting = rec.type == BINTRACE_SYSCALL_EXITING,
+			.ts = rec.tv_sec * 1000000000ULL + rec.tv_usec * 1000,
+			.name = bintrace_syscall_name(&rec, buf),
+			.rval = rec.rval,
+			.error = rec.error,
+			.personality = rec.personality,
+			.scno = rec.scno,
+			.args = rec.args
+		};
+
+		func(&ev, data);
+	}
+
+	if (ferror(fp))
+		perror_msg_and_die("%s", path);
+	fclose(fp);
+
+	return true;
+}
+
+/* The syscalls selected by --binary-query.  */
+struct bintrace_query {
+	int pid;
+	int64_t from;	/* in nanoseconds */
+	int64_t to;
+	bool failed;
+	bool syscalls;	/* whether only the syscalls of the bitmaps match */
+	uint64_t *bitmap[SUPPORTED_PERSONALITIES];
+};
+
+/*
+ * Syscall entering records of a query, kept until the syscall exiting,
+ * one per pid.
+ */
+struct query_entering {
+	struct bintrace_record *recs;
+	unsigned int size;
+	unsigned int count;
+};
+
+/* Parse the seconds since the Epoch with an optional fraction.  */
+static int64_t
+parse_query_time(const char *const str, const char *const query)
+{
+	char *end;
+	long long sec;
+	int64_t nsec = 0;
+	int64_t mult = 100000000;
+
+	errno = 0;
+	sec = strtoll(str, &end, 10);
+	if (errno || end == str || sec < 0 || sec > INT64_MAX / 1000000000 - 1)
+		error_msg_and_die("invalid time in query '%s'", query);
+	if (*end == '.') {
+		for (++end; *end >= '0' && *end <= '9'; ++end) {
+			nsec += (*end - '0') * mult;
+			mult /= 10;
+		}
+	}
+	if (*end)
+		error_msg_and_die("invalid time in query '%s'", query);
+
+	return sec * 1000000000 + nsec;
+}
+
+static void
+query_add_syscall(struct bintrace_query *const q, const char *const name,
+		  const char *const query)
+{
+	bool found = false;
+	unsigned int p;
+	kernel_ulong_t scno;
+
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		for (scno = 0; scno < nsyscall_vec[p]; ++scno) {
+			if (sysent_vec[p][scno].sys_name &&
+			    !strcmp(sysent_vec[p][scno].sys_name, name)) {
+				bitmap_set(q->bitmap[p], scno);
+				found = true;
+			}
+		}
+	}
+	if (!found)
+		error_msg_and_die("invalid syscall '%s' in query '%s'",
+				  name, query);
+	q->syscalls = true;
+}
+
+/*
+ * Parse the comma separated terms of a query: pid=PID, from=TIME,
+ * to=TIME, syscall=NAME, and failed.  Syscalls of several syscall=
+ * terms are all selected.
+ */
+static void
+parse_query(struct bintrace_query *const q, const char *const query)
+{
+	char *copy = xstrdup(query);
+	char *saveptr = NULL;
+	char *term;
+	unsigned int p;
+
+	q->pid = 0;
+	q->from = 0;
+	q->to = INT64_MAX;
+	q->failed = false;
+	q->syscalls = false;
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p)
+		q->bitmap[p] = xcalloc(bitmap_words(p), sizeof(uint64_t));
+
+	for (term = strtok_r(copy, ",", &saveptr); term;
+	     term = strtok_r(NULL, ",", &saveptr)) {
+		if (!strncmp(term, "pid=", 4)) {
+			q->pid = string_to_uint(term + 4);
+			if (q->pid <= 0)
+				error_msg_and_die("invalid pid in query '%s'",
+						  query);
+		} else if (!strncmp(term, "from=", 5)) {
+			q->from = parse_query_time(term + 5, query);
+		} else if (!strncmp(term, "to=", 3)) {
+			q->to = parse_query_time(term + 3, query);
+		} else if (!strncmp(term, "syscall=", 8)) {
+			query_add_syscall(q, term + 8, query);
+		} else if (!strcmp(term, "failed")) {
+			q->failed = true;
+		} else {
+			error_msg_and_die("invalid term '%s' in query '%s'",
+					  term, query);
+		}
+	}
+
+	free(copy);
+}
+
+/* Whether the syscall exiting record is selected by the query.  */
+static bool
+query_match(const struct bintrace_query *const q,
+	    const struct bintrace_record *const rec)
+{
+	const int64_t ts = rec->tv_sec * 1000000000LL + rec->tv_usec * 1000LL;
+
+	if (q->pid && rec->pid != q->pid)
+		return false;
+	if (ts < q->from || ts > q->to)
+		return false;
+	if (q->failed && !rec->error)
+		return false;
+	if (q->syscalls &&
+	    (rec->personality >= SUPPORTED_PERSONALITIES ||
+	     rec->scno >= nsyscall_vec[rec->personality] ||
+	     !bitmap_test(q->bitmap[rec->personality], rec->scno)))
+		return false;
+
+	return true;
+}
+
+/* Whether the index block may have records selected by the query.  */
+static bool
+query_match_block(const struct bintrace_query *const q,
+		  const struct index_block *const b)
+{
+	unsigned int i;
+	unsigned int p;
+
+	if (b->hdr.last_ts < q->from || b->hdr.first_ts > q->to)
+		return false;
+
+	if (q->pid) {
+		for (i = 0; i < b->hdr.npids; ++i) {
+			if (b->pids[i] == q->pid)
+				break;
+		}
+		if (i == b->hdr.npids)
+			return false;
+	}
+
+	if (!q->syscalls && !q->failed)
+		return true;
+
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		const uint64_t *const bits = q->failed ? b->failed[p]
+						       : b->seen[p];
+
+		for (i = 0; i < bitmap_words(p); ++i) {
+			if (bits[i] & (q->syscalls ? q->bitmap[p][i] : -1ULL))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+static void
+query_record(const struct bintrace_query *const q,
+	     struct query_entering *const e,
+	     const struct bintrace_record *const rec, const char *const path)
+{
+	char buf[sizeof("syscall_") + sizeof(rec->scno) * 3];
+	unsigned int i;
+
+	for (i = 0; i < e->count; ++i) {
+		if (e->recs[i].pid == rec->pid)
+			break;
+	}
+
+	switch (rec->type) {
+	case BINTRACE_SYSCALL_ENTERING:
+		if (i == e->count) {
+			if (e->count >= e->size) {
+				e->size = e->size ? e->size * 2 : 16;
+				e->recs = xreallocarray(e->recs, e->size,
+							sizeof(e->recs[0]));
+			}
+			++e->count;
+		}
+		e->recs[i] = *rec;
+		break;
+	case BINTRACE_SYSCALL_EXITING:
+		if (query_match(q, rec)) {
+			const char *name = bintrace_syscall_name(rec, buf);
+
+			if (i < e->count && e->recs[i].scno == rec->scno &&
+			    e->recs[i].personality == rec->personality)
+				bintrace_print_entering(stdout, &e->recs[i],
+							name);
+			else
+				printf("%-5d %lld.%06lld <... %s resumed> ",
+				       rec->pid, (long long) rec->tv_sec,
+				       (long long) rec->tv_usec, name);
+			bintrace_print_exiting(stdout, rec);
+		}
+		if (i < e->count)
+			e->recs[i] = e->recs[--e->count];
+		break;
+	default:
+		error_msg_and_die("%s: invalid record type %u",
+				  path, rec->type);
+	}
+}
+
+static void
+query_records(const struct bintrace_query *const q,
+	      struct query_entering *const e,
+	      FILE *const fp, const char *const path, uint64_t n)
+{
+	struct bintrace_record rec;
+
+	for (; n && fread(&rec, sizeof(rec), 1, fp) == 1; --n)
+		query_record(q, e, &rec, path);
+	if (ferror(fp))
+		perror_msg_and_die("%s", path);
+}
+
+/* Seek to the record unless it follows the last one read.  */
+static void
+query_seek(struct query_entering *const e, FILE *const fp,
+	   const char *const path, uint64_t *const next, const uint64_t record)
+{
+	if (record == *next)
+		return;
+
+	/*
+	 * The syscall entering records kept are not followed
+	 * by their exiting records any longer.
+	 */
+	e->count = 0;
+	if (fseeko(fp, sizeof(struct bintrace_header) +
+		       record * sizeof(struct bintrace_record), SEEK_SET))
+		perror_msg_and_die("%s", path);
+	*next = record;
+}
+
+static bool
+index_read(FILE *const fp, void *const buf, const size_t size)
+{
+	return !size || fread(buf, size, 1, fp) == 1;
+}
+
+/*
+ * Open the index of the binary trace and check its header.
+ * Returns NULL if there is no usable index.
+ */
+static FILE *
+index_open(const char *const path)
+{
+	struct bintrace_index_header hdr;
+	char *idx_path = xmalloc(strlen(path) + sizeof(".idx"));
+	unsigned int p;
+	FILE *fp;
+
+	strcpy(stpcpy(idx_path, path), ".idx");
+	fp = fopen(idx_path, "r");
+	free(idx_path);
+	if (!fp)
+		return NULL;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    memcmp(hdr.magic, BINTRACE_INDEX_MAGIC,
+		   sizeof(BINTRACE_INDEX_MAGIC)) ||
+	    hdr.version != BINTRACE_INDEX_VERSION ||
+	    hdr.personalities != SUPPORTED_PERSONALITIES)
+		goto invalid;
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		uint32_t n;
+
+		if (fread(&n, sizeof(n), 1, fp) != 1 || n != nsyscall_vec[p])
+			goto invalid;
+	}
+
+	return fp;
+
+invalid:
+	error_msg("%s.idx: invalid index, reading the whole trace", path);
+	fclose(fp);
+	return NULL;
+}
+
+/*
+ * Print the syscalls of the binary trace selected by the query.
+ * The blocks of records that have none of them according to the index
+ * are not read.  The records written after the last index block,
+ * or all of them when there is no index, are read in turn.
+ */
+static void
+bintrace_query(FILE *const fp, const char *const path, const char *const query)
+{
+	struct bintrace_query q;
+	struct query_entering e = { NULL, 0, 0 };
+	struct index_block b = { .pids = NULL };
+	/* The record following the last one read. */
+	uint64_t next = 0;
+	/* The record following the last one indexed. */
+	uint64_t indexed = 0;
+	FILE *idx = index_open(path);
+	unsigned int p;
+
+	parse_query(&q, query);
+
+	if (idx) {
+		index_block_alloc(&b);
+
+		while (index_read(idx, &b.hdr, sizeof(b.hdr))) {
+			if (b.hdr.npids > b.pids_size) {
+				b.pids_size = b.hdr.npids;
+				b.pids = xreallocarray(b.pids, b.pids_size,
+						       sizeof(b.pids[0]));
+			}
+			if (!index_read(idx, b.pids,
+					b.hdr.npids * sizeof(b.pids[0])))
+				break;
+			for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+				const size_t size =
+					bitmap_words(p) * sizeof(uint64_t);
+
+				if (!index_read(idx, b.seen[p], size) ||
+				    !index_read(idx, b.failed[p], size))
+					break;
+			}
+			if (p < SUPPORTED_PERSONALITIES)
+				break;
+			indexed = b.hdr.first_record + b.hdr.nrecords;
+
+			if (!query_match_block(&q, &b))
+				continue;
+
+			query_seek(&e, fp, path, &next, b.hdr.first_record);
+			query_records(&q, &e, fp, path, b.hdr.nrecords);
+			next = indexed;
+		}
+
+		/* Read the records written after the last index block. */
+		query_seek(&e, fp, path, &next, indexed);
+		fclose(idx);
+		free(b.pids);
+		for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+			free(b.seen[p]);
+			free(b.failed[p]);
+		}
+	}
+
+	query_records(&q, &e, fp, path, UINT64_MAX);
+
+	free(e.recs);
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p)
+		free(q.bitmap[p]);
+}
+
+/*
+ * Print the record.  The pending pid is the pid whose syscall entering
+ * has been printed last, or 0 if the line has been finished.
+ */
+static void
+decode_record(FILE *const out, const struct bintrace_record *const rec,
+	      int *const pending_pid, const char *const path)
+{
+	char buf[sizeof("syscall_") + sizeof(rec->scno) * 3];
+	const char *name = bintrace_syscall_name(rec, buf);
+
+	switch (rec->type) {
+	case BINTRACE_SYSCALL_ENTERING:
+		if (*pending_pid)
+			fputs(" <unfinished ...>\n", out);
+		bintrace_print_entering(out, rec, name);
+		*pending_pid = rec->pid;
+		break;
+	case BINTRACE_SYSCALL_EXITING:
+		if (*pending_pid != rec->pid) {
+			if (*pending_pid)
+				fputs(" <unfinished ...>\n", out);
+			fprintf(out, "%-5d %lld.%06lld <... %s resumed> ",
+				rec->pid, (long long) rec->tv_sec,
+				(long long) rec->tv_usec, name);
+		}
+		bintrace_print_exiting(out, rec);
+		*pending_pid = 0;
+		break;
+	default:
+		error_msg_and_die("%s: invalid record type %u",
+				  path, rec->type);
+	}
+}
+
+#ifdef HAVE_OPEN_MEMSTREAM
+
+/*
+ * Parallel decoding: the records are split into blocks of
+ * DECODE_BLOCK_RECORDS records that worker threads decode into memory,
+ * and the main thread writes the text of the blocks out in order.
+ * Workers run at most DECODE_WINDOW blocks per job ahead of the block
+ * being written, which bounds the memory used.
+ *
+ * The text of a record depends on the previous record only,
+ * so a worker reads the record preceding its block first.
+ */
+
+# define DECODE_BLOCK_RECORDS 65536
+# define DECODE_WINDOW 2
+
+struct decode_block {
+	char *text;
+	size_t size;
+	bool done;
+};
+
+struct decode_state {
+	const char *path;
+	int fd;
+	uint64_t nrecords;
+	uint64_t nblocks;
+	uint64_t next;		/* The block to be decoded next */
+	uint64_t written;	/* The block to be written out next */
+	unsigned int window;
+	struct decode_block *blocks;	/* Indexed modulo the window */
+	pthread_mutex_t lock;
+	pthread_cond_t block_done;
+	pthread_cond_t block_written;
+};
+
+static void
+decode_block(struct decode_state *const s, const uint64_t block,
+	     struct bintrace_record *const recs, struct decode_block *const b)
+{
+	const uint64_t first = block * DECODE_BLOCK_RECORDS;
+	const uint64_t start = first ? first - 1 : 0;
+	const uint64_t end = MIN(first + DECODE_BLOCK_RECORDS, s->nrecords);
+	const size_t size = (end - start) * sizeof(recs[0]);
+	const off_t offset = sizeof(struct bintrace_header) +
+			     start * sizeof(recs[0]);
+	int pending_pid = 0;
+	FILE *out;
+	uint64_t i;
+
+	if (pread(s->fd, recs, size, offset) != (ssize_t) size)
+		perror_msg_and_die("%s", s->path);
+
+	out = open_memstream(&b->text, &b->size);
+	if (!out)
+		perror_msg_and_die("open_memstream");
+
+	i = first - start;
+	if (i && recs[0].type == BINTRACE_SYSCALL_ENTERING)
+		pending_pid = recs[0].pid;
+	for (; i < end - start; ++i)
+		decode_record(out, &recs[i], &pending_pid, s->path);
+
+	/* The next block finishes the line of the last record. */
+	if (pending_pid && end == s->nrecords)
+		fputs(" <unfinished ...>\n", out);
+	if (fclose(out))
+		perror_msg_and_die("open_memstream");
+}
+
+static void *
+decode_worker(void *const arg)
+{
+	struct decode_state *const s = arg;
+	struct bintrace_record *const recs =
+		xcalloc(DECODE_BLOCK_RECORDS + 1, sizeof(*recs));
+
+	pthread_mutex_lock(&s->lock);
+	while (s->next < s->nblocks) {
+		const uint64_t block = s->next;
+
+		if (block >= s->written + s->window) {
+			pthread_cond_wait(&s->block_written, &s->lock);
+			continue;
+		}
+		++s->next;
+		pthread_mutex_unlock(&s->lock);
+
+		struct decode_block b = { NULL, 0, true };
+
+		decode_block(s, block, recs, &b);
+
+		pthread_mutex_lock(&s->lock);
+		s->blocks[block % s->window] = b;
+		pthread_cond_broadcast(&s->block_done);
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	free(recs);
+	return NULL;
+}
+
+/*
+ * Decode the binary trace using the given number of threads.
+ * Returns false if the trace is too small to be split.
+ */
+static bool
+decode_parallel(FILE *const fp, const char *const path, unsigned int jobs)
+{
+	struct decode_state s = {
+		.path = path,
+		.fd = fileno(fp),
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.block_done = PTHREAD_COND_INITIALIZER,
+		.block_written = PTHREAD_COND_INITIALIZER
+	};
+	struct stat st;
+	pthread_t *threads;
+	uint64_t block;
+	unsigned int i;
+
+	if (fstat(s.fd, &st) || !S_ISREG(st.st_mode) ||
+	    (uint64_t) st.st_size < sizeof(struct bintrace_header))
+		return false;
+
+	s.nrecords = (st.st_size - sizeof(struct bintrace_header)) /
+		     sizeof(struct bintrace_record);
+	s.nblocks = (s.nrecords + DECODE_BLOCK_RECORDS - 1) /
+		    DECODE_BLOCK_RECORDS;
+	if (s.nblocks < 2)
+		return false;
+	if (jobs > s.nblocks)
+		jobs = s.nblocks;
+
+	s.window = jobs * DECODE_WINDOW;
+	s.blocks = xcalloc(s.window, sizeof(*s.blocks));
+	threads = xcalloc(jobs, sizeof(*threads));
+	for (i = 0; i < jobs; ++i) {
+		errno = pthread_create(&threads[i], NULL, decode_worker, &s);
+		if (errno)
+			perror_msg_and_die("pthread_create");
+	}
+
+	for (block = 0; block < s.nblocks; ++block) {
+		struct decode_block *const b = &s.blocks[block % s.window];
+
+		pthread_mutex_lock(&s.lock);
+		while (!b->done)
+			pthread_cond_wait(&s.block_done, &s.lock);
+		pthread_mutex_unlock(&s.lock);
+
+		if (b->size && fwrite(b->text, b->size, 1, stdout) != 1)
+			perror_msg_and_die("stdout");
+		free(b->text);
+
+		pthread_mutex_lock(&s.lock);
+		b->done = false;
+		++s.written;
+		pthread_cond_broadcast(&s.block_written);
+		pthread_mutex_unlock(&s.lock);
+	}
+
+	for (i = 0; i < jobs; ++i)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	free(s.blocks);
+
+	return true;
+}
+
+#endif /* HAVE_OPEN_MEMSTREAM */
+
+void ATTRIBUTE_NORETURN
+bintrace_decode(const char *path, const char *query, unsigned int jobs)
+{
+	struct bintrace_record rec;
+	int pending_pid = 0;
+	FILE *fp = bintrace_open(path);
+
+	if (!fp)
+		error_msg_and_die("%s: not a binary trace", path);
+
+	if (query) {
+		bintrace_query(fp, path, query);
+		fclose(fp);
+		if (fflush(stdout))
+			perror_msg_and_die("stdout");
+		exit(0);
+	}
+
+#ifdef HAVE_OPEN_MEMSTREAM
+	if (jobs > 1 && decode_parallel(fp, path, jobs)) {
+		fclose(fp);
+		if (fflush(stdout))
+			perror_msg_and_die("stdout");
+		exit(0);
+	}
+#endif
+
+	while (fread(&rec, sizeof(rec), 1, fp) == 1)
+		decode_record(stdout, &rec, &pending_pid, path);
+
+	if (pending_pid)
+		fputs(" <unfinished ...>\n", stdout);
+	if (ferror(fp))
+		perror_msg_and_die("%s", path);
+	fclose(fp);
+
+	if (fflush(stdout))
+		perror_msg_and_die("stdout");
+	exit(0);
+}
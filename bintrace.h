@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef STRACE_BINTRACE_H
+#define STRACE_BINTRACE_H
+
+#include "defs.h"
+
+extern bool bintrace_enabled(void);
+extern void bintrace_init(FILE *, const char *path);
+extern void bintrace_finish(void);
+extern void bintrace_syscall_entering(const struct tcb *);
+extern void bintrace_syscall_exiting(const struct tcb *);
+/* The largest number of threads of --binary-decode.  */
+#define MAX_DECODE_JOBS 1024
+
+/*
+ * Print the syscalls of the binary trace, those of the query if not NULL,
+ * decoding them with the given number of threads.
+ */
+extern void bintrace_decode(const char *path, const char *query,
+			    unsigned int jobs) ATTRIBUTE_NORETURN;
+
+/* Syscall entering or exiting read from a binary trace. */
+struct bintrace_event {
+	int pid;
+	bool exiting;
+	unsigned long long ts;	/* in nanoseconds */
+	const char *name;
+	int64_t rval;
+	uint64_t error;
+	unsigned int personality;
+	uint64_t scno;
+	const uint64_t *args;	/* of syscall entering, MAX_ARGS of them */
+};
+
+/*
+ * Call the function for each record of the binary trace file.
+ * Returns false if the file is not a binary trace.
+ */
+extern bool bintrace_read(const char *path,
+			  void (*)(const struct bintrace_event *, void *),
+			  void *data);
+
+#endif /* !STRACE_BINTRACE_H */
@@ -0,0 +1,790 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Counting backend of -c that aggregates syscall statistics in the kernel
+ * (--count-backend=bpf option).
+ *
+ * BPF programs attached to the raw_syscalls tracepoints of all CPUs
+ * account the calls, errors and durations of syscalls of the whole system,
+ * or of a cgroup, into per-CPU maps, so there are no wakeups of the tracer
+ * per syscall.  The maps are read periodically and the changes since the
+ * last read are accounted with count_syscall_aggregate.
+ */
+
+#include "defs.h"
+
+#if defined HAVE_LINUX_BPF_H && defined HAVE_LINUX_PERF_EVENT_H
+
+# include <fcntl.h>
+# include <poll.h>
+# include <sys/ioctl.h>
+# include <sys/resource.h>
+# include <sys/wait.h>
+# include <linux/bpf.h>
+# include <linux/perf_event.h>
+# include "number_set.h"
+# include "perf_count.h"
+# include "scno.h"
+
+# ifndef BPF_PSEUDO_MAP_FD
+#  define BPF_PSEUDO_MAP_FD 1
+# endif
+# ifndef PERF_FLAG_FD_CLOEXEC
+#  define PERF_FLAG_FD_CLOEXEC (1UL << 3)
+# endif
+
+/*
+ * The parts of the bpf syscall ABI in use, defined here as the fields
+ * of union bpf_attr and the helpers available vary between headers.
+ */
+enum {
+	CMD_MAP_CREATE = 0,
+	CMD_MAP_LOOKUP_ELEM = 1,
+	CMD_MAP_GET_NEXT_KEY = 4,
+	CMD_PROG_LOAD = 5,
+
+	MAP_TYPE_HASH = 1,
+	MAP_TYPE_PERCPU_HASH = 5,
+	MAP_TYPE_PERCPU_ARRAY = 6,
+
+	PROG_TYPE_TRACEPOINT = 5,
+
+	FN_MAP_LOOKUP_ELEM = 1,
+	FN_MAP_UPDATE_ELEM = 2,
+	FN_MAP_DELETE_ELEM = 3,
+	FN_KTIME_GET_NS = 5,
+	FN_GET_CURRENT_PID_TGID = 14,
+	FN_GET_CURRENT_CGROUP_ID = 80,
+
+	UPDATE_ANY = 0,
+	UPDATE_NOEXIST = 1,
+};
+
+struct map_create_attr {
+	uint32_t map_type, key_size, value_size, max_entries, map_flags;
+};
+
+struct map_elem_attr {
+	uint32_t map_fd, pad;
+	uint64_t key, value, flags;
+};
+
+struct prog_load_attr {
+	uint32_t prog_type, insn_cnt;
+	uint64_t insns, license;
+	uint32_t log_level, log_size;
+	uint64_t log_buf;
+	uint32_t kern_version;
+};
+
+/* Per-CPU statistics of a syscall, the value of stats_fd.  */
+struct bpf_call_stats {
+	uint64_t calls, errors, time_ns, max_ns;
+	/* UINT64_MAX minus the shortest duration, so that 0 means none */
+	uint64_t inv_min_ns;
+};
+
+/*
+ * Keys of hist_fd are the syscall number shifted by HIST_KEY_BITS
+ * combined with the latency bucket: durations below 8 nanoseconds
+ * have a bucket each, others are bucketed by the position of their
+ * highest set bit and the next 3 bits.
+ */
+# define HIST_KEY_BITS 10
+/* Threads with a syscall in progress.  */
+# define START_ENTRIES 65536
+/* Used syscall and latency bucket pairs.  */
+# define HIST_ENTRIES 16384
+# define MAX_INSNS 128
+
+static int start_fd = -1, stats_fd = -1, hist_fd = -1;
+static unsigned int nstats;
+static unsigned int possible_cpus;
+static int *event_fds;
+static unsigned int nevent_fds;
+static int bpf_child;
+static bool bpf_child_exited;
+static int bpf_child_status;
+
+/* Totals of the last read of the maps.  */
+static struct bpf_call_stats *last_stats;
+static uint64_t **last_hist;
+
+struct prog_builder {
+	struct bpf_insn insns[MAX_INSNS];
+	unsigned int len;
+	/* Jumps to be pointed to labels by resolve_labels.  */
+	struct {
+		unsigned int insn, label;
+	} fixups[16];
+	unsigned int nfixups;
+	int labels[4];
+};
+
+enum { LABEL_OUT, LABEL_NO_ERROR, LABEL_SMALL, LABEL_INSERT };
+
+static long
+sys_bpf(const unsigned int cmd, void *const attr, const unsigned int size)
+{
+	return syscall(__NR_bpf, cmd, attr, size);
+}
+
+static void
+emit(struct prog_builder *const b, const uint8_t code, const uint8_t dst,
+     const uint8_t src, const int16_t off, const int32_t imm)
+{
+	if (b->len >= MAX_INSNS)
+		error_msg_and_die("BPF program is too long");
+
+	struct bpf_insn *const insn = &b->insns[b->len++];
+
+	memset(insn, 0, sizeof(*insn));
+	insn->code = code;
+	insn->dst_reg = dst;
+	insn->src_reg = src;
+	insn->off = off;
+	insn->imm = imm;
+}
+
+# define MOV_REG(b, d, s)	emit(b, BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+# define MOV_IMM(b, d, i)	emit(b, BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+# define ALU_REG(b, op, d, s)	emit(b, BPF_ALU64 | (op) | BPF_X, d, s, 0, 0)
+# define ALU_IMM(b, op, d, i)	emit(b, BPF_ALU64 | (op) | BPF_K, d, 0, 0, i)
+# define LDX(b, sz, d, s, o)	emit(b, BPF_LDX | BPF_MEM | (sz), d, s, o, 0)
+# define STX(b, sz, d, s, o)	emit(b, BPF_STX | BPF_MEM | (sz), d, s, o, 0)
+# define ST_IMM(b, sz, d, o, i)	emit(b, BPF_ST | BPF_MEM | (sz), d, 0, o, i)
+# define JMP_IMM(b, op, d, i, o) emit(b, BPF_JMP | (op) | BPF_K, d, 0, o, i)
+# define JMP_REG(b, op, d, s, o) emit(b, BPF_JMP | (op) | BPF_X, d, s, o, 0)
+# define CALL(b, fn)		emit(b, BPF_JMP | BPF_CALL, 0, 0, 0, fn)
+# define EXIT(b)		emit(b, BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+static void
+emit_ld_imm64(struct prog_builder *const b, const uint8_t dst,
+	      const uint8_t src, const uint64_t imm)
+{
+	emit(b, BPF_LD | BPF_DW | BPF_IMM, dst, src, 0, (uint32_t) imm);
+	emit(b, 0, 0, 0, 0, imm >> 32);
+}
+
+static void
+emit_ld_map_fd(struct prog_builder *const b, const uint8_t dst, const int fd)
+{
+	emit_ld_imm64(b, dst, BPF_PSEUDO_MAP_FD, fd);
+}
+
+/* Emit a conditional jump (or an unconditional one for BPF_JA) to LABEL.  */
+static void
+emit_jump(struct prog_builder *const b, const uint8_t code, const uint8_t dst,
+	  const uint8_t src, const int32_t imm, const unsigned int label)
+{
+	b->fixups[b->nfixups].insn = b->len;
+	b->fixups[b->nfixups].label = label;
+	++b->nfixups;
+	emit(b, code, dst, src, 0, imm);
+}
+
+static void
+set_label(struct prog_builder *const b, const unsigned int label)
+{
+	b->labels[label] = b->len;
+}
+
+static void
+resolve_labels(struct prog_builder *const b)
+{
+	unsigned int i;
+
+	for (i = 0; i < b->nfixups; ++i)
+		b->insns[b->fixups[i].insn].off =
+			b->labels[b->fixups[i].label] - b->fixups[i].insn - 1;
+}
+
+/* Load a tracepoint field of the context in r6 to DST sign-extended.  */
+static void
+emit_load_field(struct prog_builder *const b, const uint8_t dst,
+		const struct tp_field *const f)
+{
+	if (f->size == 8) {
+		LDX(b, BPF_DW, dst, BPF_REG_6, f->offset);
+	} else {
+		LDX(b, BPF_W, dst, BPF_REG_6, f->offset);
+		ALU_IMM(b, BPF_LSH, dst, 32);
+		ALU_IMM(b, BPF_ARSH, dst, 32);
+	}
+}
+
+/*
+ * Common prologue: save the context to r6, pid_tgid to r7 and to the key
+ * at r10 - 8, skip the tracer itself and tasks outside of the cgroup.
+ */
+static void
+emit_prologue(struct prog_builder *const b, const uint64_t cgroup_id)
+{
+	MOV_REG(b, BPF_REG_6, BPF_REG_1);
+	CALL(b, FN_GET_CURRENT_PID_TGID);
+	MOV_REG(b, BPF_REG_7, BPF_REG_0);
+	MOV_REG(b, BPF_REG_1, BPF_REG_0);
+	ALU_IMM(b, BPF_RSH, BPF_REG_1, 32);
+	emit_jump(b, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_1, 0,
+		  getpid(), LABEL_OUT);
+	if (cgroup_id) {
+		CALL(b, FN_GET_CURRENT_CGROUP_ID);
+		emit_ld_imm64(b, BPF_REG_1, 0, cgroup_id);
+		emit_jump(b, BPF_JMP | BPF_JNE | BPF_X, BPF_REG_0, BPF_REG_1,
+			  0, LABEL_OUT);
+	}
+	STX(b, BPF_DW, BPF_REG_10, BPF_REG_7, -8);
+}
+
+static void
+emit_epilogue(struct prog_builder *const b)
+{
+	set_label(b, LABEL_OUT);
+	MOV_IMM(b, BPF_REG_0, 0);
+	EXIT(b);
+	resolve_labels(b);
+}
+
+/* sys_enter: start[pid_tgid] = now */
+static void
+build_enter_prog(struct prog_builder *const b, const uint64_t cgroup_id)
+{
+	emit_prologue(b, cgroup_id);
+	CALL(b, FN_KTIME_GET_NS);
+	STX(b, BPF_DW, BPF_REG_10, BPF_REG_0, -16);
+	emit_ld_map_fd(b, BPF_REG_1, start_fd);
+	MOV_REG(b, BPF_REG_2, BPF_REG_10);
+	ALU_IMM(b, BPF_ADD, BPF_REG_2, -8);
+	MOV_REG(b, BPF_REG_3, BPF_REG_10);
+	ALU_IMM(b, BPF_ADD, BPF_REG_3, -16);
+	MOV_IMM(b, BPF_REG_4, UPDATE_ANY);
+	CALL(b, FN_MAP_UPDATE_ELEM);
+	emit_epilogue(b);
+}
+
+/* Add SRC_REG, or 1 if it is 0, to the field at r7 + OFF.  */
+static void
+emit_add_stat(struct prog_builder *const b, const int16_t off,
+	      const uint8_t src_reg)
+{
+	LDX(b, BPF_DW, BPF_REG_1, BPF_REG_7, off);
+	if (src_reg)
+		ALU_REG(b, BPF_ADD, BPF_REG_1, src_reg);
+	else
+		ALU_IMM(b, BPF_ADD, BPF_REG_1, 1);
+	STX(b, BPF_DW, BPF_REG_7, BPF_REG_1, off);
+}
+
+/* Store VAL_REG to the field at r7 + OFF if it is greater than the field.  */
+static void
+emit_max_stat(struct prog_builder *const b, const int16_t off,
+	      const uint8_t val_reg)
+{
+	LDX(b, BPF_DW, BPF_REG_1, BPF_REG_7, off);
+	JMP_REG(b, BPF_JGE, BPF_REG_1, val_reg, 1);
+	STX(b, BPF_DW, BPF_REG_7, val_reg, off);
+}
+
+/*
+ * sys_exit: account now - start[pid_tgid] into stats[id],
+ * and with --summary-latency into hist[id << HIST_KEY_BITS | bucket].
+ */
+static void
+build_exit_prog(struct prog_builder *const b, const uint64_t cgroup_id,
+		const struct raw_syscalls_tp *const tp)
+{
+	static const int shifts[] = { 32, 16, 8, 4, 2, 1 };
+	unsigned int i;
+
+	emit_prologue(b, cgroup_id);
+
+	/* r8 = start[pid_tgid], delete it */
+	emit_ld_map_fd(b, BPF_REG_1, start_fd);
+	MOV_REG(b, BPF_REG_2, BPF_REG_10);
+	ALU_IMM(b, BPF_ADD, BPF_REG_2, -8);
+	CALL(b, FN_MAP_LOOKUP_ELEM);
+	emit_jump(b, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 0, LABEL_OUT);
+	LDX(b, BPF_DW, BPF_REG_8, BPF_REG_0, 0);
+	emit_ld_map_fd(b, BPF_REG_1, start_fd);
+	MOV_REG(b, BPF_REG_2, BPF_REG_10);
+	ALU_IMM(b, BPF_ADD, BPF_REG_2, -8);
+	CALL(b, FN_MAP_DELETE_ELEM);
+
+	/* r8 = duration */
+	CALL(b, FN_KTIME_GET_NS);
+	ALU_REG(b, BPF_SUB, BPF_REG_0, BPF_REG_8);
+	MOV_REG(b, BPF_REG_8, BPF_REG_0);
+
+	/* r9 = syscall number, r7 = &stats[r9] */
+	emit_load_field(b, BPF_REG_9, &tp->scno);
+	emit_jump(b, BPF_JMP | BPF_JGE | BPF_K, BPF_REG_9, 0, nstats,
+		  LABEL_OUT);
+	STX(b, BPF_W, BPF_REG_10, BPF_REG_9, -16);
+	emit_ld_map_fd(b, BPF_REG_1, stats_fd);
+	MOV_REG(b, BPF_REG_2, BPF_REG_10);
+	ALU_IMM(b, BPF_ADD, BPF_REG_2, -16);
+	CALL(b, FN_MAP_LOOKUP_ELEM);
+	emit_jump(b, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 0, LABEL_OUT);
+	MOV_REG(b, BPF_REG_7, BPF_REG_0);
+
+	emit_add_stat(b, offsetof(struct bpf_call_stats, calls), 0);
+	emit_add_stat(b, offsetof(struct bpf_call_stats, time_ns), BPF_REG_8);
+	emit_max_stat(b, offsetof(struct bpf_call_stats, max_ns), BPF_REG_8);
+	MOV_IMM(b, BPF_REG_2, -1);
+	ALU_REG(b, BPF_SUB, BPF_REG_2, BPF_REG_8);
+	emit_max_stat(b, offsetof(struct bpf_call_stats, inv_min_ns),
+		      BPF_REG_2);
+
+	/* Return values from -4095 to -1 are errors.  */
+	emit_load_field(b, BPF_REG_1, &tp->ret);
+	MOV_IMM(b, BPF_REG_2, -4095);
+	emit_jump(b, BPF_JMP | BPF_JGT | BPF_X, BPF_REG_2, BPF_REG_1, 0,
+		  LABEL_NO_ERROR);
+	emit_add_stat(b, offsetof(struct bpf_call_stats, errors), 0);
+	set_label(b, LABEL_NO_ERROR);
+
+	if (hist_fd >= 0) {
+		/* r2 = index of the highest set bit of the duration */
+		MOV_REG(b, BPF_REG_1, BPF_REG_8);
+		MOV_IMM(b, BPF_REG_2, 0);
+		for (i = 0; i < ARRAY_SIZE(shifts); ++i) {
+			MOV_REG(b, BPF_REG_3, BPF_REG_1);
+			ALU_IMM(b, BPF_RSH, BPF_REG_3, shifts[i]);
+			JMP_IMM(b, BPF_JEQ, BPF_REG_3, 0, 2);
+			MOV_REG(b, BPF_REG_1, BPF_REG_3);
+			ALU_IMM(b, BPF_ADD, BPF_REG_2, shifts[i]);
+		}
+
+		/* r4 = bucket */
+		MOV_REG(b, BPF_REG_4, BPF_REG_8);
+		MOV_IMM(b, BPF_REG_3, 7);
+		emit_jump(b, BPF_JMP | BPF_JGE | BPF_X, BPF_REG_3, BPF_REG_8,
+			  0, LABEL_SMALL);
+		MOV_REG(b, BPF_REG_3, BPF_REG_2);
+		ALU_IMM(b, BPF_ADD, BPF_REG_3, -3);
+		ALU_REG(b, BPF_RSH, BPF_REG_4, BPF_REG_3);
+		ALU_IMM(b, BPF_AND, BPF_REG_4, 7);
+		ALU_IMM(b, BPF_LSH, BPF_REG_2, 3);
+		ALU_REG(b, BPF_OR, BPF_REG_4, BPF_REG_2);
+		set_label(b, LABEL_SMALL);
+
+		ALU_IMM(b, BPF_LSH, BPF_REG_9, HIST_KEY_BITS);
+		ALU_REG(b, BPF_OR, BPF_REG_9, BPF_REG_4);
+		STX(b, BPF_W, BPF_REG_10, BPF_REG_9, -24);
+
+		/* ++hist[key], or insert 1 if there is none yet */
+		emit_ld_map_fd(b, BPF_REG_1, hist_fd);
+		MOV_REG(b, BPF_REG_2, BPF_REG_10);
+		ALU_IMM(b, BPF_ADD, BPF_REG_2, -24);
+		CALL(b, FN_MAP_LOOKUP_ELEM);
+		emit_jump(b, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 0,
+			  LABEL_INSERT);
+		MOV_REG(b, BPF_REG_7, BPF_REG_0);
+		emit_add_stat(b, 0, 0);
+		emit_jump(b, BPF_JMP | BPF_JA, 0, 0, 0, LABEL_OUT);
+		set_label(b, LABEL_INSERT);
+		ST_IMM(b, BPF_DW, BPF_REG_10, -32, 1);
+		emit_ld_map_fd(b, BPF_REG_1, hist_fd);
+		MOV_REG(b, BPF_REG_2, BPF_REG_10);
+		ALU_IMM(b, BPF_ADD, BPF_REG_2, -24);
+		MOV_REG(b, BPF_REG_3, BPF_REG_10);
+		ALU_IMM(b, BPF_ADD, BPF_REG_3, -32);
+		MOV_IMM(b, BPF_REG_4, UPDATE_NOEXIST);
+		CALL(b, FN_MAP_UPDATE_ELEM);
+	}
+
+	emit_epilogue(b);
+}
+
+static int
+create_map(const uint32_t type, const uint32_t key_size,
+	   const uint32_t value_size, const uint32_t max_entries)
+{
+	struct map_create_attr attr = {
+		.map_type = type,
+		.key_size = key_size,
+		.value_size = value_size,
+		.max_entries = max_entries,
+	};
+	const int fd = sys_bpf(CMD_MAP_CREATE, &attr, sizeof(attr));
+
+	if (fd < 0)
+		perror_msg_and_die("bpf: BPF_MAP_CREATE");
+	return fd;
+}
+
+static int
+load_prog(const struct prog_builder *const b, const char *const name)
+{
+	static const char license[] = "Dual BSD/GPL";
+	struct prog_load_attr attr = {
+		.prog_type = PROG_TYPE_TRACEPOINT,
+		.insn_cnt = b->len,
+		.insns = (uintptr_t) b->insns,
+		.license = (uintptr_t) license,
+	};
+	int fd = sys_bpf(CMD_PROG_LOAD, &attr, sizeof(attr));
+
+	if (fd >= 0)
+		return fd;
+
+	const int saved_errno = errno;
+
+	/* Load it again with the verifier log to explain the failure.  */
+	if (debug_flag) {
+		static char log[65536];
+
+		attr.log_level = 1;
+		attr.log_size = sizeof(log);
+		attr.log_buf = (uintptr_t) log;
+		if (sys_bpf(CMD_PROG_LOAD, &attr, sizeof(attr)) < 0)
+			error_msg("BPF verifier log of %s:\n%s", name, log);
+	}
+
+	errno = saved_errno;
+	perror_msg_and_die("bpf: BPF_PROG_LOAD %s", name);
+}
+
+/* The id of a cgroup v2 directory is in its file handle.  */
+static uint64_t
+get_cgroup_id(const char *const path)
+{
+	union {
+		struct file_handle fh;
+		char buf[sizeof(struct file_handle) + sizeof(uint64_t)];
+	} h = { .fh.handle_bytes = sizeof(uint64_t) };
+	int mount_id;
+	uint64_t id;
+
+	if (name_to_handle_at(AT_FDCWD, path, &h.fh, &mount_id, 0))
+		perror_msg_and_die("Cannot get the id of cgroup %s", path);
+
+	memcpy(&id, h.fh.f_handle, sizeof(id));
+	return id;
+}
+
+/* The number of CPUs per-CPU map values are given for.  */
+static unsigned int
+get_possible_cpus(void)
+{
+	FILE *const fp = fopen("/sys/devices/system/cpu/possible", "r");
+	unsigned int first, last, n = 0;
+	int c = ',';
+
+	if (!fp)
+		perror_msg_and_die("/sys/devices/system/cpu/possible");
+
+	/* A list of ranges like "0-3,8-11" or of single CPUs.  */
+	while (c == ',' && fscanf(fp, "%u", &first) == 1) {
+		last = first;
+		c = fgetc(fp);
+		if (c == '-') {
+			if (fscanf(fp, "%u", &last) != 1)
+				break;
+			c = fgetc(fp);
+		}
+		if (last + 1 > n)
+			n = last + 1;
+	}
+	fclose(fp);
+
+	if (!n)
+		error_msg_and_die("Cannot parse"
+				  " /sys/devices/system/cpu/possible");
+	return n;
+}
+
+static void
+attach_prog(const struct raw_syscalls_tp *const tp, const int prog_fd,
+	    const char *const name)
+{
+	const long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	long cpu;
+
+	for (cpu = 0; cpu < ncpus; ++cpu) {
+		struct perf_event_attr attr = {
+			.type = PERF_TYPE_TRACEPOINT,
+			.size = sizeof(attr),
+			.config = tp->id,
+			.sample_period = 1,
+		};
+		const int fd = syscall(__NR_perf_event_open, &attr, -1, cpu,
+				       -1, PERF_FLAG_FD_CLOEXEC);
+
+		if (fd < 0) {
+			/* Offline CPUs cannot be traced.  */
+			if (errno == ENODEV)
+				continue;
+			perror_msg_and_die("perf_event_open: raw_syscalls:%s"
+					   " on cpu %ld", name, cpu);
+		}
+		if (ioctl(fd, PERF_EVENT_IOC_SET_BPF, prog_fd))
+			perror_msg_and_die("ioctl: PERF_EVENT_IOC_SET_BPF");
+
+		event_fds = xreallocarray(event_fds, nevent_fds + 1,
+					  sizeof(*event_fds));
+		event_fds[nevent_fds++] = fd;
+	}
+}
+
+/*
+ * Load and attach the programs, then start the command if there is one:
+ * counting stops when it exits, otherwise when strace is interrupted.
+ */
+int
+bpf_count_startup(char **argv, const char *const cgroup)
+{
+	struct raw_syscalls_tp enter_tp, exit_tp;
+	static struct prog_builder enter_prog, exit_prog;
+	const uint64_t cgroup_id = cgroup ? get_cgroup_id(cgroup) : 0;
+	const struct rlimit rlim = { RLIM_INFINITY, RLIM_INFINITY };
+	unsigned int i;
+	int enter_fd, exit_fd;
+
+	read_raw_syscalls_tracepoints(&enter_tp, &exit_tp);
+	if (enter_tp.scno.size != exit_tp.scno.size)
+		error_msg_and_die("Unexpected raw_syscalls tracepoint format");
+
+	/* Older kernels charge BPF maps to RLIMIT_MEMLOCK.  */
+	setrlimit(RLIMIT_MEMLOCK, &rlim);
+
+	possible_cpus = get_possible_cpus();
+	nstats = nsyscalls;
+	start_fd = create_map(MAP_TYPE_HASH, sizeof(uint64_t),
+			      sizeof(uint64_t), START_ENTRIES);
+	stats_fd = create_map(MAP_TYPE_PERCPU_ARRAY, sizeof(uint32_t),
+			      sizeof(struct bpf_call_stats), nstats);
+	if (summary_latency)
+		hist_fd = create_map(MAP_TYPE_PERCPU_HASH, sizeof(uint32_t),
+				     sizeof(uint64_t), HIST_ENTRIES);
+
+	build_enter_prog(&enter_prog, cgroup_id);
+	build_exit_prog(&exit_prog, cgroup_id, &exit_tp);
+	enter_fd = load_prog(&enter_prog, "sys_enter");
+	exit_fd = load_prog(&exit_prog, "sys_exit");
+
+	/* Attach sys_exit first so that no entry is left unaccounted.  */
+	attach_prog(&exit_tp, exit_fd, "sys_exit");
+	attach_prog(&enter_tp, enter_fd, "sys_enter");
+	close(enter_fd);
+	close(exit_fd);
+
+	last_stats = xcalloc(nstats, sizeof(*last_stats));
+	if (hist_fd >= 0)
+		last_hist = xcalloc(nstats, sizeof(*last_hist));
+
+	for (i = 0; i < nevent_fds; ++i) {
+		if (ioctl(event_fds[i], PERF_EVENT_IOC_ENABLE, 0))
+			perror_msg_and_die("ioctl: PERF_EVENT_IOC_ENABLE");
+	}
+
+	if (!argv[0])
+		return 0;
+
+	bpf_child = fork();
+	if (bpf_child < 0)
+		perror_msg_and_die("fork");
+	if (bpf_child == 0) {
+		execvp(argv[0], argv);
+		perror_msg_and_die("exec");
+	}
+
+	return bpf_child;
+}
+
+static bool
+lookup_elem(const int fd, const void *const key, void *const value)
+{
+	struct map_elem_attr attr = {
+		.map_fd = fd,
+		.key = (uintptr_t) key,
+		.value = (uintptr_t) value,
+	};
+
+	return sys_bpf(CMD_MAP_LOOKUP_ELEM, &attr, sizeof(attr)) == 0;
+}
+
+static void
+read_stats(void)
+{
+	struct bpf_call_stats *const percpu =
+		xcalloc(possible_cpus, sizeof(*percpu));
+	uint32_t scno;
+	unsigned int cpu;
+
+	for (scno = 0; scno < nstats; ++scno) {
+		struct bpf_call_stats sum = { 0 };
+
+		if (!lookup_elem(stats_fd, &scno, percpu))
+			continue;
+
+		for (cpu = 0; cpu < possible_cpus; ++cpu) {
+			sum.calls += percpu[cpu].calls;
+			sum.errors += percpu[cpu].errors;
+			sum.time_ns += percpu[cpu].time_ns;
+			sum.max_ns = MAX(sum.max_ns, percpu[cpu].max_ns);
+			sum.inv_min_ns = MAX(sum.inv_min_ns,
+					     percpu[cpu].inv_min_ns);
+		}
+
+		struct bpf_call_stats *const last = &last_stats[scno];
+
+		if (sum.calls == last->calls)
+			continue;
+
+		/*
+		 * The shortest and the longest calls are those since
+		 * the start, not since the last read.
+		 */
+		if (is_number_in_set_array(scno, trace_set, 0))
+			count_syscall_aggregate(scno, sum.calls - last->calls,
+						sum.errors - last->errors,
+						sum.time_ns - last->time_ns,
+						UINT64_MAX - sum.inv_min_ns,
+						sum.max_ns);
+		*last = sum;
+	}
+
+	free(percpu);
+}
+
+/* The shortest duration of the bucket of a hist_fd key.  */
+static uint64_t
+hist_key_ns(const uint32_t key)
+{
+	const unsigned int bucket = key & ((1U << HIST_KEY_BITS) - 1);
+	const unsigned int exp = bucket >> 3;
+
+	if (bucket < 8)
+		return bucket;
+
+	return (uint64_t) (8 | (bucket & 7)) << (exp - 3);
+}
+
+static void
+read_hist(void)
+{
+	uint64_t *const percpu = xcalloc(possible_cpus, sizeof(*percpu));
+	struct map_elem_attr attr = { .map_fd = hist_fd };
+	uint32_t key = UINT32_MAX, next_key;
+	unsigned int cpu;
+
+	attr.value = (uintptr_t) &next_key;
+	for (;;) {
+		attr.key = (uintptr_t) &key;
+		if (sys_bpf(CMD_MAP_GET_NEXT_KEY, &attr, sizeof(attr)))
+			break;
+		key = next_key;
+
+		const uint32_t scno = key >> HIST_KEY_BITS;
+		const unsigned int bucket =
+			key & ((1U << HIST_KEY_BITS) - 1);
+		uint64_t sum = 0;
+
+		if (scno >= nstats || !lookup_elem(hist_fd, &key, percpu))
+			continue;
+		for (cpu = 0; cpu < possible_cpus; ++cpu)
+			sum += percpu[cpu];
+
+		if (!last_hist[scno])
+			last_hist[scno] = xcalloc(1U << HIST_KEY_BITS,
+						  sizeof(**last_hist));
+
+		uint64_t *const last = &last_hist[scno][bucket];
+
+		if (sum == *last)
+			continue;
+		if (is_number_in_set_array(scno, trace_set, 0))
+			count_syscall_latency(scno, hist_key_ns(key),
+					      sum - *last);
+		*last = sum;
+	}
+
+	free(percpu);
+}
+
+/*
+ * Wait for a second with signals in SIGMASK unblocked and account what
+ * the programs have aggregated since the last call.
+ * Returns false when the command has exited.
+ */
+bool
+bpf_count_poll(const sigset_t *const sigmask)
+{
+	const struct timespec timeout = { .tv_sec = 1 };
+
+	if (ppoll(NULL, 0, &timeout, sigmask) < 0 && errno != EINTR)
+		perror_msg_and_die("ppoll");
+
+	read_stats();
+	if (hist_fd >= 0)
+		read_hist();
+
+	if (bpf_child && !bpf_child_exited &&
+	    waitpid(bpf_child, &bpf_child_status, WNOHANG) == bpf_child)
+		bpf_child_exited = true;
+
+	return !bpf_child_exited;
+}
+
+/*
+ * Detach the programs and account what is left, kill the command with SIG
+ * if it is still running and SIG is not 0, and return its wait status,
+ * or 0 if there is no command.
+ */
+int
+bpf_count_finish(const int sig)
+{
+	unsigned int i;
+
+	for (i = 0; i < nevent_fds; ++i)
+		close(event_fds[i]);
+	nevent_fds = 0;
+
+	read_stats();
+	if (hist_fd >= 0)
+		read_hist();
+
+	if (!bpf_child)
+		return 0;
+
+	if (sig && !bpf_child_exited)
+		kill(bpf_child, sig);
+
+	while (!bpf_child_exited) {
+		if (waitpid(bpf_child, &bpf_child_status, 0) == bpf_child)
+			bpf_child_exited = true;
+		else if (errno != EINTR)
+			perror_msg_and_die("waitpid");
+	}
+
+	return bpf_child_status;
+}
+
+#endif /* HAVE_LINUX_BPF_H && HAVE_LINUX_PERF_EVENT_H */
@@ -141,19 +141,147 @@ print_bpf_filter_block(struct tcb *const tcp, void *const elem_buf,
 	return true;
 }
 
+/*
+ * Table of unique programs for --bpf-dedup.  Programs are compared
+ * by their instructions and by the kind of filter they are.
+ */
+struct bpf_prog {
+	struct bpf_prog *next;
+	unsigned int id;
+	unsigned short len;
+	print_bpf_filter_fn print_k;
+	struct bpf_filter_block *insns;
+};
+
+static struct bpf_prog **bpf_prog_hash;
+static unsigned int bpf_prog_hash_size;
+static unsigned int nbpf_progs;
+
+static unsigned int
+bpf_prog_insns_hash(const struct bpf_filter_block *const insns,
+		    const unsigned short len)
+{
+	const unsigned char *const p = (const unsigned char *) insns;
+	const size_t size = len * sizeof(*insns);
+	uint64_t h = 0xcbf29ce484222325ULL;	/* FNV-1a */
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+
+	return h ^ (h >> 32);
+}
+
+static void
+grow_bpf_prog_hash(void)
+{
+	const unsigned int new_size = bpf_prog_hash_size
+				      ? bpf_prog_hash_size * 2 : 64;
+	struct bpf_prog **new_hash = xcalloc(new_size, sizeof(*new_hash));
+	unsigned int i;
+
+	for (i = 0; i < bpf_prog_hash_size; ++i) {
+		struct bpf_prog *prog, *next;
+
+		for (prog = bpf_prog_hash[i]; prog; prog = next) {
+			const unsigned int j =
+				bpf_prog_insns_hash(prog->insns, prog->len) &
+				(new_size - 1);
+
+			next = prog->next;
+			prog->next = new_hash[j];
+			new_hash[j] = prog;
+		}
+	}
+
+	free(bpf_prog_hash);
+	bpf_prog_hash = new_hash;
+	bpf_prog_hash_size = new_size;
+}
+
+/*
+ * Return the program with the given instructions,
+ * adding it to the table if it is new.
+ */
+static const struct bpf_prog *
+get_bpf_prog(const struct bpf_filter_block *const insns,
+	     const unsigned short len, const print_bpf_filter_fn print_k,
+	     bool *const is_new)
+{
+	const size_t size = len * sizeof(*insns);
+	const unsigned int h = bpf_prog_insns_hash(insns, len);
+	struct bpf_prog *prog;
+
+	if (bpf_prog_hash_size) {
+		for (prog = bpf_prog_hash[h & (bpf_prog_hash_size - 1)]; prog;
+		     prog = prog->next) {
+			if (prog->len == len && prog->print_k == print_k &&
+			    !memcmp(prog->insns, insns, size)) {
+				*is_new = false;
+				return prog;
+			}
+		}
+	}
+
+	if (nbpf_progs >= bpf_prog_hash_size)
+		grow_bpf_prog_hash();
+
+	const unsigned int i = h & (bpf_prog_hash_size - 1);
+
+	prog = xmalloc(sizeof(*prog));
+	prog->id = ++nbpf_progs;
+	prog->len = len;
+	prog->print_k = print_k;
+	prog->insns = xmalloc(size);
+	memcpy(prog->insns, insns, size);
+	prog->next = bpf_prog_hash[i];
+	bpf_prog_hash[i] = prog;
+
+	*is_new = true;
+	return prog;
+}
+
 void
 print_bpf_fprog(struct tcb *const tcp, const kernel_ulong_t addr,
 		const unsigned short len, const print_bpf_filter_fn print_k)
 {
 	if (abbrev(tcp)) {
 		printaddr(addr);
-	} else {
-		struct bpf_filter_block_data fbd = { .fn = print_k };
-		struct bpf_filter_block filter;
+		return;
+	}
 
-		print_array(tcp, addr, len, &filter, sizeof(filter),
-			    umoven_or_printaddr, print_bpf_filter_block, &fbd);
+	struct bpf_filter_block_data fbd = { .fn = print_k };
+	struct bpf_filter_block filter;
+	const struct bpf_prog *prog = NULL;
+
+	if (bpf_dedup && addr && len) {
+		/*
+		 * Fetch the whole program at once, the elements printed
+		 * below are then copied from the snapshot.
+		 */
+		const struct umove_range range = {
+			.addr = addr,
+			.len = len * sizeof(filter)
+		};
+		struct bpf_filter_block *const insns =
+			tcb_scratch_alloc(tcp, range.len);
+		bool is_new;
+
+		umove_snapshot(tcp, &range, 1);
+		if (!umoven(tcp, addr, range.len, insns)) {
+			prog = get_bpf_prog(insns, len, print_k, &is_new);
+			if (!is_new) {
+				printaddr(addr);
+				tprintf_comment("bpf program %u", prog->id);
+				return;
+			}
+		}
 	}
+
+	print_array(tcp, addr, len, &filter, sizeof(filter),
+		    umoven_or_printaddr, print_bpf_filter_block, &fbd);
+	if (prog)
+		tprintf_comment("bpf program %u", prog->id);
 }
 
 void
@@ -457,19 +457,35 @@ btrfs_print_tree_search(struct tcb *tcp, struct btrfs_ioctl_search_key *key,
 		if (abbrev(tcp))
 			tprints("...");
 		else {
+			/*
+			 * The buffer can be up to 16 MiB large, fetch only
+			 * the item headers a window at a time and stop
+			 * at the abbreviation limit.
+			 */
+			struct umove_window w = {
+				.addr = buf_addr, .len = buf_size
+			};
 			uint64_t i;
 			uint64_t off = 0;
 			tprints("[");
 			for (i = 0; i < key->nr_items; i++) {
 				struct btrfs_ioctl_search_header sh;
-				uint64_t addr = buf_addr + off;
+				const void *p;
 				if (i)
 					tprints(", ");
-				if (i > max_strlen ||
-				    umove(tcp, addr, &sh)) {
+				if (i >= tcb_max_strlen(tcp)) {
 					tprints("...");
+					tprintf_comment("%" PRIu64 " more items",
+							key->nr_items - i);
 					break;
 				}
+				/* Items are not aligned in the buffer.  */
+				p = umove_window_get(tcp, &w, off, sizeof(sh));
+				if (!p) {
+					tprints("...");
+					break;
+				}
+				memcpy(&sh, p, sizeof(sh));
 				tprintf("{transid=%" PRI__u64 ", objectid=",
 					sh.transid);
 				btrfs_print_objectid(sh.objectid);
@@ -477,7 +493,6 @@ btrfs_print_tree_search(struct tcb *tcp, struct btrfs_ioctl_search_key *key,
 				btrfs_print_key_type(sh.type);
 				tprintf(", len=%u}", sh.len);
 				off += sizeof(sh) + sh.len;
-
 			}
 			tprints("]");
 		}
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "defs.h"
+#include <sys/wait.h>
+#include <asm/unistd.h>
+#include "ptrace.h"
+
+/*
+ * Estimate the tracing overhead included in syscall times measured
+ * by -c: a throwaway child makes CALIBRATION_CALLS getppid syscalls
+ * under PTRACE_SYSCALL, and the time between each entry and exit stop
+ * is compared with the time of the same syscall made without tracing.
+ */
+
+#define CALIBRATION_CALLS 1000
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t
+isqrt(uint64_t n)
+{
+	uint64_t x = n, y = (x + 1) / 2;
+
+	while (y < x) {
+		x = y;
+		y = (x + n / x) / 2;
+	}
+
+	return x;
+}
+
+struct stop_times {
+	uint64_t sum, sum_sq;
+	unsigned int n;
+};
+
+static void
+add_sample(struct stop_times *st, const uint64_t ns)
+{
+	st->sum += ns;
+	st->sum_sq += ns * ns;
+	st->n++;
+}
+
+static uint64_t
+mean_ns(const struct stop_times *st)
+{
+	return st->n ? st->sum / st->n : 0;
+}
+
+/* Half-width of the 95% confidence interval of the mean. */
+static uint64_t
+ci95_ns(const struct stop_times *st)
+{
+	if (st->n < 2)
+		return 0;
+
+	const uint64_t mean = mean_ns(st);
+	const uint64_t sq_mean = st->sum_sq / st->n;
+	const uint64_t var = sq_mean > mean * mean ? sq_mean - mean * mean : 0;
+
+	return 196 * isqrt(var) / isqrt((uint64_t) st->n * 10000);
+}
+
+static int
+wait_stop(const int pid)
+{
+	int status;
+
+	while (waitpid(pid, &status, __WALL) < 0) {
+		if (errno != EINTR)
+			perror_msg_and_die("%s: waitpid", __func__);
+	}
+
+	return status;
+}
+
+static void
+kill_child(const int pid)
+{
+	kill(pid, SIGKILL);
+	while (!WIFSIGNALED(wait_stop(pid)))
+		;
+}
+
+void
+calibrate_overhead(void)
+{
+	struct stop_times entry = {}, exit_stops = {};
+	uint64_t untraced, t, prev = 0;
+	unsigned int i;
+	int pid, status;
+
+	/* Need fork for calibration. NOMMU has no forks */
+	if (NOMMU_SYSTEM) {
+		error_msg("overhead calibration is not supported, "
+			  "using the default");
+		return;
+	}
+
+	t = now_ns();
+	for (i = 0; i < CALIBRATION_CALLS; ++i)
+		syscall(__NR_getppid);
+	untraced = (now_ns() - t) / CALIBRATION_CALLS;
+
+	pid = fork();
+	if (pid < 0)
+		perror_msg_and_die("fork");
+
+	if (pid == 0) {
+		if (ptrace(PTRACE_TRACEME, 0L, 0L, 0L) < 0)
+			_exit(1);
+		kill(getpid(), SIGSTOP);
+		for (;;)
+			syscall(__NR_getppid);
+	}
+
+	status = wait_stop(pid);
+	if (!WIFSTOPPED(status) || WSTOPSIG(status) != SIGSTOP ||
+	    ptrace(PTRACE_SETOPTIONS, pid, 0L, PTRACE_O_TRACESYSGOOD) < 0) {
+		error_msg("overhead calibration failed, using the default");
+		kill_child(pid);
+		return;
+	}
+
+	/*
+	 * The signal-delivery-stop happens after the exit of kill syscall,
+	 * so stops of getppid syscall alternate starting from its entry.
+	 */
+	for (i = 0; i < 2 * CALIBRATION_CALLS; ++i) {
+		if (ptrace(PTRACE_SYSCALL, pid, 0L, 0L) < 0)
+			break;
+		status = wait_stop(pid);
+		t = now_ns();
+		if (!WIFSTOPPED(status) || WSTOPSIG(status) != (SIGTRAP | 0x80))
+			break;
+		if (i)
+			add_sample(i & 1 ? &exit_stops : &entry, t - prev);
+		prev = t;
+	}
+
+	kill_child(pid);
+
+	if (i < 2 * CALIBRATION_CALLS) {
+		error_msg("overhead calibration failed, using the default");
+		return;
+	}
+
+	const uint64_t exit_ns = mean_ns(&exit_stops);
+	set_calibrated_overhead(exit_ns > untraced ? exit_ns - untraced : 0,
+				ci95_ns(&exit_stops), mean_ns(&entry));
+}
@@ -144,6 +144,13 @@ SYS_FUNC(clone)
 	return 0;
 }
 
+/* Whether the clone syscall of the tracee creates a thread.  */
+bool
+clone_creates_thread(const struct tcb *const tcp)
+{
+	return tcp->u_arg[ARG_FLAGS] & CLONE_THREAD;
+}
+
 SYS_FUNC(setns)
 {
 	printfd(tcp, tcp->u_arg[0]);
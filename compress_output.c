@@ -0,0 +1,338 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Compression of the trace output (--output-compress option).
+ *
+ * Each output file is written through a stream that collects the data
+ * in memory; full blocks are handed over to a compressor thread shared
+ * by all files that writes every block as a separate gzip member.
+ * The tracer only copies the data, and a trace cut short by a crash
+ * can still be read up to the last complete block.
+ */
+
+#include "defs.h"
+
+/* Compression level, 0 means the output is not compressed.  */
+unsigned int output_compress_level;
+
+#if defined HAVE_FOPENCOOKIE && defined HAVE_ZLIB
+
+# include <pthread.h>
+# include <signal.h>
+# include <zlib.h>
+
+/* Size of the block compressed into a gzip member.  */
+# define COMPRESS_BLOCK_SIZE (128 * 1024)
+/* Blocks queued for the compressor thread before the tracer waits.  */
+# define COMPRESS_QUEUE_BLOCKS 8
+
+struct compress_stream {
+	FILE *out;
+	char *buf;
+	size_t len;
+	size_t size;
+	bool written;	/* A gzip member has been written to OUT */
+};
+
+struct compress_job {
+	struct compress_job *next;
+	struct compress_stream *stream;
+	char *data;
+	size_t len;
+	bool last;	/* Close the stream after writing the data */
+};
+
+static struct compress_job *queue_head, **queue_tail = &queue_head;
+static unsigned int queue_len;
+static bool closing;
+static bool started;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_not_full = PTHREAD_COND_INITIALIZER;
+static pthread_t compressor;
+
+static z_stream zs;
+static Bytef *zbuf;
+static uLong zbuf_size;
+
+static void
+compress_job(const struct compress_job *const job)
+{
+	struct compress_stream *const s = job->stream;
+
+	if (job->len || !s->written) {
+		const uLong bound = deflateBound(&zs, job->len);
+
+		if (bound > zbuf_size) {
+			zbuf_size = bound;
+			zbuf = xreallocarray(zbuf, zbuf_size, 1);
+		}
+
+		deflateReset(&zs);
+		zs.next_in = (Bytef *) job->data;
+		zs.avail_in = job->len;
+		zs.next_out = zbuf;
+		zs.avail_out = zbuf_size;
+		if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+			error_msg_and_die("deflate: %s",
+					  zs.msg ? zs.msg : "failed");
+
+		const size_t n = zbuf_size - zs.avail_out;
+
+		if (fwrite(zbuf, 1, n, s->out) != n)
+			perror_msg("fwrite");
+		s->written = true;
+	}
+
+	if (job->last) {
+		if (fclose(s->out))
+			perror_msg("fclose");
+		free(s);
+	}
+}
+
+static void *
+compressor_thread(void *arg)
+{
+	pthread_mutex_lock(&queue_lock);
+	for (;;) {
+		while (!queue_head && !closing)
+			pthread_cond_wait(&queue_not_empty, &queue_lock);
+
+		struct compress_job *const job = queue_head;
+
+		if (!job)
+			break;
+		queue_head = job->next;
+		if (!queue_head)
+			queue_tail = &queue_head;
+		--queue_len;
+		pthread_cond_signal(&queue_not_full);
+		pthread_mutex_unlock(&queue_lock);
+
+		compress_job(job);
+		free(job->data);
+		free(job);
+
+		pthread_mutex_lock(&queue_lock);
+	}
+	pthread_mutex_unlock(&queue_lock);
+	return NULL;
+}
+
+/*
+ * The thread is started with the first block rather than with the first
+ * stream, so the tracer is still single-threaded when it forks the command.
+ */
+static void
+start_compressor(void)
+{
+	sigset_t all, saved;
+	int rc;
+
+	if (deflateInit2(&zs, output_compress_level, Z_DEFLATED,
+			 MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		error_msg_and_die("deflateInit2 failed");
+
+	/* Signals are handled by the tracer thread only.  */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &saved);
+	rc = pthread_create(&compressor, NULL, compressor_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	if (rc) {
+		errno = rc;
+		perror_msg_and_die("pthread_create");
+	}
+	started = true;
+}
+
+/* Hand over the collected data of the stream to the compressor thread.  */
+static void
+submit(struct compress_stream *const s, const bool last)
+{
+	struct compress_job *const job = xmalloc(sizeof(*job));
+
+	job->next = NULL;
+	job->stream = s;
+	job->data = s->buf;
+	job->len = s->len;
+	job->last = last;
+	s->buf = NULL;
+	s->len = s->size = 0;
+
+	if (!started)
+		start_compressor();
+
+	pthread_mutex_lock(&queue_lock);
+	while (queue_len >= COMPRESS_QUEUE_BLOCKS)
+		pthread_cond_wait(&queue_not_full, &queue_lock);
+	*queue_tail = job;
+	queue_tail = &job->next;
+	++queue_len;
+	pthread_cond_signal(&queue_not_empty);
+	pthread_mutex_unlock(&queue_lock);
+}
+
+static ssize_t
+compress_write(void *cookie, const char *data, size_t len)
+{
+	struct compress_stream *const s = cookie;
+	const ssize_t ret = len;
+
+	while (len) {
+		if (s->len == s->size) {
+			/*
+			 * Grow the buffer gradually, most of -ff files
+			 * of short-lived processes are small.
+			 */
+			s->size = s->size ? s->size * 2 : 4096;
+			s->buf = xreallocarray(s->buf, s->size, 1);
+		}
+
+		const size_t n = MIN(len, s->size - s->len);
+
+		memcpy(s->buf + s->len, data, n);
+		s->len += n;
+		data += n;
+		len -= n;
+
+		if (s->len >= COMPRESS_BLOCK_SIZE)
+			submit(s, false);
+	}
+
+	return ret;
+}
+
+static int
+compress_close(void *cookie)
+{
+	submit(cookie, true);
+	return 0;
+}
+
+FILE *
+compress_open(FILE *const out)
+{
+	static const cookie_io_functions_t compress_funcs = {
+		.write = compress_write,
+		.close = compress_close
+	};
+	struct compress_stream *const s = xcalloc(1, sizeof(*s));
+	FILE *fp;
+
+	s->out = out;
+	setvbuf(out, NULL, _IONBF, 0);
+
+	fp = fopencookie(s, "w", compress_funcs);
+	if (!fp)
+		perror_msg_and_die("fopencookie");
+
+	return fp;
+}
+
+void
+compress_finish(void)
+{
+	if (!started)
+		return;
+
+	pthread_mutex_lock(&queue_lock);
+	closing = true;
+	pthread_cond_signal(&queue_not_empty);
+	pthread_mutex_unlock(&queue_lock);
+
+	pthread_join(compressor, NULL);
+	deflateEnd(&zs);
+	free(zbuf);
+	started = false;
+}
+
+static ssize_t
+gz_read(void *cookie, char *buf, size_t size)
+{
+	return gzread(cookie, buf, size);
+}
+
+static int
+gz_close(void *cookie)
+{
+	return gzclose(cookie) == Z_OK ? 0 : -1;
+}
+
+/*
+ * Open the trace file for reading, the file is decompressed
+ * if it is compressed with gzip.  A truncated file reads as if
+ * it ended at the last complete block.
+ */
+FILE *
+decompress_fopen(const char *const path)
+{
+	static const cookie_io_functions_t gz_funcs = {
+		.read = gz_read,
+		.close = gz_close
+	};
+	gzFile gz = gzopen(path, "rb");
+	FILE *fp;
+
+	if (!gz)
+		return NULL;
+
+	fp = fopencookie(gz, "r", gz_funcs);
+	if (!fp)
+		perror_msg_and_die("fopencookie");
+
+	return fp;
+}
+
+#else /* !(HAVE_FOPENCOOKIE && HAVE_ZLIB) */
+
+FILE *
+compress_open(FILE *const out)
+{
+	error_msg_and_die("--output-compress is not supported by this build");
+}
+
+void
+compress_finish(void)
+{
+}
+
+FILE *
+decompress_fopen(const char *const path)
+{
+	const size_t len = strlen(path);
+
+	if (len > 3 && !strcmp(path + len - 3, ".gz"))
+		error_msg_and_die("Reading of compressed trace '%s'"
+				  " is not supported by this build", path);
+
+	return fopen(path, "r");
+}
+
+#endif /* HAVE_FOPENCOOKIE && HAVE_ZLIB */
@@ -0,0 +1,590 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Outbound connection accounting (--summary-connects option).
+ *
+ * Calls of connect are accounted per destination address, which is read
+ * from the tracee and reduced to the fields that tell destinations apart,
+ * so the calls never have to be decoded or printed.  A connect that
+ * returns EINPROGRESS, or is interrupted by a signal, is pending until
+ * its outcome is seen: a connect on the same descriptor that reports it,
+ * or a getsockopt SO_ERROR on it.  Its latency is the time from the entry
+ * of the first connect to the return of that call.  A pending connect
+ * whose descriptor is closed first has an unknown outcome.
+ */
+
+#include "defs.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "latency_hist.h"
+#include "syscall.h"
+
+struct connect_error {
+	int err;
+	uint64_t count;
+};
+
+struct connect_dest {
+	struct connect_dest *next;
+	unsigned int hash;
+	socklen_t len;
+	struct sockaddr_storage addr;
+	uint64_t connects, ok, failed, unknown;
+	/* Connects in progress, their outcome is not known yet */
+	uint64_t pending;
+	/* Latency of the successful connects */
+	uint64_t time_ns, min_ns, max_ns;
+	struct latency_hist hist;
+	struct connect_error *errors;
+	unsigned int nerrors;
+};
+
+struct connect_pending {
+	struct connect_pending *next;
+	int tgid;
+	int fd;
+	struct connect_dest *dest;
+	struct timespec start_ts;
+};
+
+#define PENDING_HASH_SIZE 256
+
+unsigned int summary_connects;
+static struct connect_dest **dest_hash;
+static unsigned int dest_hash_size;
+static unsigned int dest_hash_count;
+static struct connect_pending *pending_hash[PENDING_HASH_SIZE];
+
+static unsigned int
+hash_addr(const struct sockaddr_storage *const addr, const socklen_t len)
+{
+	const unsigned char *const p = (const unsigned char *) addr;
+	unsigned int h = 2166136261U;
+	socklen_t i;
+
+	for (i = 0; i < len; ++i)
+		h = (h ^ p[i]) * 16777619U;
+
+	return h;
+}
+
+static void
+dest_hash_expand(void)
+{
+	struct connect_dest **const old_hash = dest_hash;
+	const unsigned int old_size = dest_hash_size;
+	unsigned int i;
+
+	dest_hash_size = old_size ? old_size * 2 : 64;
+	dest_hash = xcalloc(dest_hash_size, sizeof(dest_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct connect_dest *cd, *next;
+
+		for (cd = old_hash[i]; cd; cd = next) {
+			const unsigned int b = cd->hash & (dest_hash_size - 1);
+
+			next = cd->next;
+			cd->next = dest_hash[b];
+			dest_hash[b] = cd;
+		}
+	}
+
+	free(old_hash);
+}
+
+/*
+ * Fetch the destination address of the connect and keep only the family
+ * and the fields that identify the destination: the port and the address
+ * of inet sockets, the path of unix sockets.
+ */
+static socklen_t
+fetch_dest_addr(struct tcb *const tcp, const kernel_ulong_t addr,
+		const kernel_ulong_t addrlen, struct sockaddr_storage *const key)
+{
+	struct sockaddr_storage sa;
+	socklen_t len = addrlen < sizeof(sa) ? addrlen : sizeof(sa);
+
+	if (len < sizeof(sa.ss_family) || umoven(tcp, addr, len, &sa))
+		return 0;
+
+	memset(key, 0, sizeof(*key));
+	key->ss_family = sa.ss_family;
+
+	switch (sa.ss_family) {
+	case AF_INET: {
+		const struct sockaddr_in *const in = (const void *) &sa;
+		struct sockaddr_in *const out = (void *) key;
+
+		if (len < sizeof(*in))
+			return 0;
+		out->sin_port = in->sin_port;
+		out->sin_addr = in->sin_addr;
+		return sizeof(*out);
+	}
+	case AF_INET6: {
+		const struct sockaddr_in6 *const in6 = (const void *) &sa;
+		struct sockaddr_in6 *const out = (void *) key;
+
+		if (len < sizeof(*in6))
+			return 0;
+		out->sin6_port = in6->sin6_port;
+		out->sin6_addr = in6->sin6_addr;
+		out->sin6_scope_id = in6->sin6_scope_id;
+		return sizeof(*out);
+	}
+	case AF_UNIX: {
+		const struct sockaddr_un *const un = (const void *) &sa;
+		const socklen_t offset = offsetof(struct sockaddr_un, sun_path);
+		socklen_t path_len = len - offset;
+
+		/* A pathname ends at its terminating null byte.  */
+		if (path_len && un->sun_path[0])
+			path_len = strnlen(un->sun_path, path_len);
+		memcpy(key, un, offset + path_len);
+		return offset + path_len;
+	}
+	default:
+		memcpy(key, &sa, len);
+		return len;
+	}
+}
+
+static struct connect_dest *
+get_dest(const struct sockaddr_storage *const addr, const socklen_t len)
+{
+	const unsigned int hash = hash_addr(addr, len);
+	struct connect_dest *cd;
+
+	if (dest_hash_size) {
+		for (cd = dest_hash[hash & (dest_hash_size - 1)];
+		     cd; cd = cd->next) {
+			if (cd->hash == hash && cd->len == len
+			    && !memcmp(&cd->addr, addr, len))
+				return cd;
+		}
+	}
+
+	if (dest_hash_count >= dest_hash_size)
+		dest_hash_expand();
+
+	const unsigned int b = hash & (dest_hash_size - 1);
+
+	cd = xcalloc(1, sizeof(*cd));
+	cd->hash = hash;
+	cd->len = len;
+	memcpy(&cd->addr, addr, len);
+	cd->next = dest_hash[b];
+	dest_hash[b] = cd;
+	++dest_hash_count;
+
+	return cd;
+}
+
+static struct connect_pending **
+find_pending(const int tgid, const int fd)
+{
+	struct connect_pending **pp;
+
+	for (pp = &pending_hash[(unsigned int) (tgid * 31 + fd)
+				% PENDING_HASH_SIZE];
+	     *pp; pp = &(*pp)->next) {
+		if ((*pp)->tgid == tgid && (*pp)->fd == fd)
+			break;
+	}
+
+	return pp;
+}
+
+static void
+add_pending(const int tgid, const int fd, struct connect_dest *const cd,
+	    const struct timespec *const start_ts)
+{
+	struct connect_pending **const pp = find_pending(tgid, fd);
+	struct connect_pending *cp = *pp;
+
+	if (!cp) {
+		cp = xcalloc(1, sizeof(*cp));
+		cp->tgid = tgid;
+		cp->fd = fd;
+		*pp = cp;
+	} else {
+		/* The outcome of the previous connect is unknown.  */
+		cp->dest->pending--;
+		cp->dest->unknown++;
+	}
+	cp->dest = cd;
+	cd->pending++;
+	cp->start_ts = *start_ts;
+}
+
+static void
+record_error(struct connect_dest *const cd, const int err)
+{
+	unsigned int i;
+
+	cd->failed++;
+	for (i = 0; i < cd->nerrors; ++i) {
+		if (cd->errors[i].err == err) {
+			cd->errors[i].count++;
+			return;
+		}
+	}
+
+	cd->errors = xreallocarray(cd->errors, cd->nerrors + 1,
+				   sizeof(cd->errors[0]));
+	cd->errors[cd->nerrors].err = err;
+	cd->errors[cd->nerrors].count = 1;
+	cd->nerrors++;
+}
+
+static void
+record_outcome(struct connect_dest *const cd, const int err,
+	       const uint64_t ns)
+{
+	if (err) {
+		record_error(cd, err);
+		return;
+	}
+
+	cd->ok++;
+	cd->time_ns += ns;
+	if (cd->ok == 1 || ns < cd->min_ns)
+		cd->min_ns = ns;
+	if (ns > cd->max_ns)
+		cd->max_ns = ns;
+
+	uint32_t *const b = &cd->hist.buckets[hist_bucket(ns)];
+
+	if (*b < UINT32_MAX)
+		++*b;
+}
+
+/* Complete the pending connect at *pp with the given error.  */
+static void
+complete_pending(struct connect_pending **const pp, const int err,
+		 const struct timespec *const ts)
+{
+	struct connect_pending *const cp = *pp;
+	struct timespec dt;
+
+	ts_sub(&dt, ts, &cp->start_ts);
+	cp->dest->pending--;
+	record_outcome(cp->dest, err,
+		       (uint64_t) dt.tv_sec * 1000000000 + dt.tv_nsec);
+	*pp = cp->next;
+	free(cp);
+}
+
+static bool
+connect_in_progress(const int err)
+{
+	switch (err) {
+	case EINPROGRESS:
+	case EINTR:
+	case ERESTARTSYS:
+	case ERESTARTNOINTR:
+	case ERESTARTNOHAND:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void
+account_connect(struct tcb *const tcp, const uint64_t wall_ns,
+		const struct timespec *const ts)
+{
+	const int tgid = get_tcb_tgid(tcp);
+	const int fd = (int) tcp->u_arg[0];
+	const int err = syserror(tcp) ? tcp->u_error : 0;
+	struct connect_pending **const pp = find_pending(tgid, fd);
+
+	if (*pp) {
+		/* A connect in progress is reported by the next connect.  */
+		if (err == EALREADY || connect_in_progress(err))
+			return;
+		complete_pending(pp, err == EISCONN ? 0 : err, ts);
+		return;
+	}
+
+	struct sockaddr_storage addr;
+	const socklen_t len = fetch_dest_addr(tcp, tcp->u_arg[1],
+					      tcp->u_arg[2], &addr);
+
+	if (!len)
+		return;
+
+	struct connect_dest *const cd = get_dest(&addr, len);
+
+	cd->connects++;
+	if (connect_in_progress(err))
+		add_pending(tgid, fd, cd, &tcp->etime);
+	else
+		record_outcome(cd, err, wall_ns);
+}
+
+static void
+account_so_error(struct tcb *const tcp, const struct timespec *const ts)
+{
+	int err;
+
+	if (syserror(tcp) || tcp->u_arg[1] != SOL_SOCKET
+	    || tcp->u_arg[2] != SO_ERROR)
+		return;
+
+	struct connect_pending **const pp =
+		find_pending(get_tcb_tgid(tcp), (int) tcp->u_arg[0]);
+
+	if (*pp && !umove(tcp, tcp->u_arg[3], &err))
+		complete_pending(pp, err, ts);
+}
+
+static void
+account_close(struct tcb *const tcp)
+{
+	struct connect_pending **const pp =
+		find_pending(get_tcb_tgid(tcp), (int) tcp->u_arg[0]);
+	struct connect_pending *const cp = *pp;
+
+	if (!cp || syserror(tcp))
+		return;
+
+	cp->dest->pending--;
+	cp->dest->unknown++;
+	*pp = cp->next;
+	free(cp);
+}
+
+void
+count_connect(struct tcb *const tcp, const uint64_t wall_ns,
+	      const struct timespec *const ts)
+{
+	switch (tcp->s_ent->sen) {
+	case SEN_connect:
+		account_connect(tcp, wall_ns, ts);
+		break;
+	case SEN_getsockopt:
+		account_so_error(tcp, ts);
+		break;
+	case SEN_close:
+		account_close(tcp);
+		break;
+	}
+}
+
+static uint64_t
+dest_percentile(const struct connect_dest *const cd,
+		const unsigned int permille)
+{
+	const uint64_t rank = (cd->ok * permille + 999) / 1000;
+	uint64_t seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; ++i) {
+		seen += cd->hist.buckets[i];
+		if (seen >= rank) {
+			const uint64_t v = hist_bucket_value(i);
+
+			return v < cd->min_ns ? cd->min_ns
+			     : v > cd->max_ns ? cd->max_ns : v;
+		}
+	}
+
+	return cd->max_ns;
+}
+
+static void
+print_dest(FILE *outf, const struct connect_dest *const cd)
+{
+	char buf[INET6_ADDRSTRLEN];
+
+	switch (cd->addr.ss_family) {
+	case AF_INET: {
+		const struct sockaddr_in *const in = (const void *) &cd->addr;
+
+		inet_ntop(AF_INET, &in->sin_addr, buf, sizeof(buf));
+		fprintf(outf, "%s:%u", buf, ntohs(in->sin_port));
+		break;
+	}
+	case AF_INET6: {
+		const struct sockaddr_in6 *const in6 =
+			(const void *) &cd->addr;
+
+		inet_ntop(AF_INET6, &in6->sin6_addr, buf, sizeof(buf));
+		if (in6->sin6_scope_id)
+			fprintf(outf, "[%s%%%u]:%u", buf, in6->sin6_scope_id,
+				ntohs(in6->sin6_port));
+		else
+			fprintf(outf, "[%s]:%u", buf, ntohs(in6->sin6_port));
+		break;
+	}
+	case AF_UNIX: {
+		const struct sockaddr_un *const un = (const void *) &cd->addr;
+		const socklen_t path_len =
+			cd->len - offsetof(struct sockaddr_un, sun_path);
+		socklen_t i;
+
+		if (!path_len) {
+			fputs("UNIX:(unnamed)", outf);
+			break;
+		}
+		fputs("UNIX:", outf);
+		for (i = 0; i < path_len; ++i) {
+			const unsigned char c = un->sun_path[i];
+
+			/* An abstract name starts with a null byte.  */
+			fputc(!i && !c ? '@' : c >= ' ' && c < 0x7f ? c : '?',
+			      outf);
+		}
+		break;
+	}
+	default: {
+		const char *const name = xlookup(addrfams,
+						 cd->addr.ss_family);
+
+		if (name)
+			fputs(name, outf);
+		else
+			fprintf(outf, "%#x", cd->addr.ss_family);
+		fputs(":[", outf);
+
+		const unsigned char *const p = (const void *) &cd->addr;
+		socklen_t i;
+
+		for (i = sizeof(cd->addr.ss_family); i < cd->len; ++i)
+			fprintf(outf, "%02x", p[i]);
+		fputc(']', outf);
+		break;
+	}
+	}
+}
+
+static int
+connect_error_cmp(const void *a, const void *b)
+{
+	const struct connect_error *const x = a;
+	const struct connect_error *const y = b;
+
+	return (x->count < y->count) ? 1 : (x->count > y->count) ? -1
+	     : x->err - y->err;
+}
+
+static void
+print_errors(FILE *outf, struct connect_dest *const cd)
+{
+	unsigned int i;
+
+	if (!cd->nerrors)
+		return;
+
+	qsort(cd->errors, cd->nerrors, sizeof(cd->errors[0]),
+	      connect_error_cmp);
+	for (i = 0; i < cd->nerrors; ++i) {
+		const char *const name = err_name(cd->errors[i].err);
+
+		fprintf(outf, i ? ", " : " (");
+		if (name)
+			fprintf(outf, "%s %" PRIu64, name,
+				cd->errors[i].count);
+		else
+			fprintf(outf, "%d %" PRIu64, cd->errors[i].err,
+				cd->errors[i].count);
+	}
+	fputc(')', outf);
+}
+
+static int
+connect_dest_cmp(const void *a, const void *b)
+{
+	const struct connect_dest *const x = *(const struct connect_dest **) a;
+	const struct connect_dest *const y = *(const struct connect_dest **) b;
+
+	if (x->connects != y->connects)
+		return x->connects < y->connects ? 1 : -1;
+	if (x->failed != y->failed)
+		return x->failed < y->failed ? 1 : -1;
+	if (x->len != y->len)
+		return x->len < y->len ? -1 : 1;
+	return memcmp(&x->addr, &y->addr, x->len);
+}
+
+/*
+ * Print the summary_connects destinations connected to the most,
+ * with the outcome of their connects and the latency of the successful
+ * ones.  The connects still in progress are shown with an unknown outcome.
+ */
+void
+connect_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	struct connect_dest **sorted;
+	unsigned int i, n = 0;
+
+	if (!dest_hash_count)
+		return;
+
+	sorted = xcalloc(dest_hash_count, sizeof(sorted[0]));
+	for (i = 0; i < dest_hash_size; ++i) {
+		struct connect_dest *cd;
+
+		for (cd = dest_hash[i]; cd; cd = cd->next)
+			sorted[n++] = cd;
+	}
+	sort_top(sorted, n, sizeof(sorted[0]), summary_connects,
+		 connect_dest_cmp);
+	if (n > summary_connects)
+		n = summary_connects;
+
+	fprintf(outf, "\n%9.9s %9.9s %9.9s %9.9s %9.9s %9.9s %9.9s %9.9s %s\n",
+		"connects", "ok", "failed", "unknown", "p50 usecs",
+		"p90 usecs", "p99 usecs", "max usecs", "destination");
+	fprintf(outf, "%9.9s %9.9s %9.9s %9.9s %9.9s %9.9s %9.9s %9.9s %s\n",
+		dashes, dashes, dashes, dashes, dashes, dashes, dashes,
+		dashes, dashes);
+	for (i = 0; i < n; ++i) {
+		struct connect_dest *const cd = sorted[i];
+
+		fprintf(outf, "%9" PRIu64 " %9" PRIu64 " %9" PRIu64
+			" %9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %9" PRIu64
+			" %9" PRIu64 " ",
+			cd->connects, cd->ok, cd->failed,
+			cd->unknown + cd->pending,
+			dest_percentile(cd, 500) / 1000,
+			dest_percentile(cd, 900) / 1000,
+			dest_percentile(cd, 990) / 1000,
+			cd->max_ns / 1000);
+		print_dest(outf, cd);
+		print_errors(outf, cd);
+		fputc('\n', outf);
+	}
+
+	free(sorted);
+}
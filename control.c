@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Runtime control socket (--control option).
+ *
+ * strace listens on a unix stream socket and reads commands, one per line,
+ * from one connection at a time, a new connection replaces the previous
+ * one.  The socket is waited for in the event loop of the main loop,
+ * so commands are applied between events, never in the middle of decoding
+ * a syscall.  Each command is answered with "ok", or with an error message
+ * followed by "error":
+ *
+ *   qualify EXPR	apply -e EXPR, e.g. "qualify trace=%file"
+ *   path PATH		add PATH to the -P set
+ *   flush		flush the trace output
+ *   rotate		rotate the -o file
+ *   summary		print the -c summary gathered so far
+ *   attach PID		attach to the process PID, like -p PID
+ *   detach PID		detach from the process PID and its threads
+ *   quit		exit once there are no tracees, see --resident
+ *
+ * With --resident, strace keeps running without tracees, so a tracer
+ * that has parsed its options and set up its tables once serves many
+ * short traces: each of them costs just an attach command, and with
+ * -ff -o PREFIX each traced process gets its own output file.
+ *
+ * The qualifier parser dies on invalid input, so an expression is parsed
+ * in a forked child first and is applied only when the child succeeds,
+ * that is, a command either is applied as a whole or does not change
+ * anything.
+ */
+
+#include "defs.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define CONTROL_LINE_MAX 4096
+
+static char *control_path;
+static pid_t control_pid;
+static char line[CONTROL_LINE_MAX];
+static size_t line_len;
+static bool line_overflow;
+
+static void
+control_cleanup(void)
+{
+	/* Forked children that validate expressions exit, too.  */
+	if (getpid() == control_pid)
+		unlink(control_path);
+}
+
+/* Listen on the control socket, return its descriptor for the event loop.  */
+int
+control_init(const char *const path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	const size_t len = strlen(path);
+
+	if (len >= sizeof(addr.sun_path))
+		error_msg_and_die("Socket path is too long: %s", path);
+	memcpy(addr.sun_path, path, len);
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK
+				       | SOCK_CLOEXEC, 0);
+
+	if (fd < 0)
+		perror_msg_and_die("socket");
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)))
+		perror_msg_and_die("bind: %s", path);
+	if (listen(fd, 1))
+		perror_msg_and_die("listen: %s", path);
+
+	control_path = xstrdup(path);
+	control_pid = getpid();
+	atexit(control_cleanup);
+
+	return fd;
+}
+
+/*
+ * Accept a new connection to the control socket LISTEN_FD, which replaces
+ * the connection CONN_FD if there is one.  Return the descriptor of the new
+ * connection for the event loop, or -1.
+ */
+int
+control_accept(const int listen_fd, const int conn_fd)
+{
+	const int fd = accept4(listen_fd, NULL, NULL,
+			       SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+	if (fd < 0)
+		return conn_fd;
+
+	if (conn_fd >= 0)
+		close(conn_fd);
+	line_len = 0;
+	line_overflow = false;
+
+	return fd;
+}
+
+static void
+reply(const int fd, const char *const str)
+{
+	/* A client that does not read the replies just loses them.  */
+	if (write(fd, str, strlen(str)) < 0)
+		return;
+}
+
+/*
+ * Parse the qualifying expression in a child process, which reports
+ * parse errors to the client, return true if the expression is valid.
+ */
+static bool
+qualify_is_valid(const int fd, const char *const expr)
+{
+	int status;
+
+	/* Do not let the child write out buffered trace output again.  */
+	fflush(NULL);
+
+	const pid_t pid = fork();
+
+	if (pid < 0) {
+		perror_msg("fork");
+		return false;
+	}
+
+	if (!pid) {
+		dup2(fd, STDERR_FILENO);
+		qualify(expr);
+		_exit(0);
+	}
+
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR)
+			return false;
+	}
+
+	return WIFEXITED(status) && !WEXITSTATUS(status);
+}
+
+static bool
+control_command(const int fd, const char *const cmd)
+{
+	const char *arg;
+
+	if ((arg = STR_STRIP_PREFIX(cmd, "qualify ")) != cmd) {
+		if (!qualify_is_valid(fd, arg))
+			return false;
+		qualify(arg);
+		return true;
+	}
+
+	if ((arg = STR_STRIP_PREFIX(cmd, "path ")) != cmd) {
+		if (!*arg)
+			return false;
+		pathtrace_select(arg);
+		return true;
+	}
+
+	if (!strcmp(cmd, "flush"))
+		return !fflush(NULL);
+
+	if (!strcmp(cmd, "rotate"))
+		return rotate_all_output();
+
+	if (!strcmp(cmd, "summary"))
+		return print_current_summary();
+
+	if ((arg = STR_STRIP_PREFIX(cmd, "attach ")) != cmd)
+		return attach_pid(string_to_uint(arg));
+
+	if ((arg = STR_STRIP_PREFIX(cmd, "detach ")) != cmd)
+		return detach_pid(string_to_uint(arg));
+
+	if (!strcmp(cmd, "quit")) {
+		leave_resident();
+		return true;
+	}
+
+	reply(fd, "unknown command\n");
+	return false;
+}
+
+/*
+ * Read and run the commands that have arrived on the connection FD.
+ * Return false if the connection has been closed.
+ */
+bool
+control_input(const int fd)
+{
+	for (;;) {
+		const ssize_t n = read(fd, line + line_len,
+				       sizeof(line) - line_len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EAGAIN)
+			return true;
+		if (n <= 0) {
+			close(fd);
+			return false;
+		}
+
+		const size_t end = line_len + n;
+		size_t start = 0;
+		char *nl;
+
+		while ((nl = memchr(line + start, '\n', end - start))) {
+			*nl = '\0';
+			if (nl > line + start && nl[-1] == '\r')
+				nl[-1] = '\0';
+			if (line_overflow) {
+				reply(fd, "line is too long\nerror\n");
+				line_overflow = false;
+			} else if (line[start]) {
+				reply(fd, control_command(fd, line + start)
+					  ? "ok\n" : "error\n");
+			}
+			start = nl + 1 - line;
+		}
+
+		line_len = end - start;
+		memmove(line, line + start, line_len);
+		if (line_len == sizeof(line)) {
+			/* Skip the rest of the line.  */
+			line_overflow = true;
+			line_len = 0;
+		}
+	}
+}
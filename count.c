@@ -35,212 +35,2288 @@
  */
 
 #include "defs.h"
+#include <sys/ioctl.h>
+#include <sys/param.h>
+#include "strintern.h"
+#include "syscall.h"
+#include "latency_hist.h"
+#include <linux/aio_abi.h>
 
 /* Per-syscall stats structure */
 struct call_counts {
 	/* time may be total latency or system time */
-	struct timeval time;
-	int calls, errors;
+	uint64_t time_ns;
+	uint64_t min_ns, max_ns;
+	uint64_t calls, errors;
+	/* allocated on first call with --summary-latency only */
+	struct latency_hist *hist;
 };
 
 static struct call_counts *countv[SUPPORTED_PERSONALITIES];
-#define counts (countv[current_personality])
+/* Statistics since the last --summary-interval snapshot */
+static struct call_counts *interval_countv[SUPPORTED_PERSONALITIES];
+/* The statistics being summarized */
+static struct call_counts **summary_countv = countv;
+#define counts (summary_countv[current_personality])
 
-static struct timeval shortest = { 1000000, 0 };
+static uint64_t shortest_ns = 1000000ULL * 1000000000;
+
+/*
+ * Time spent in mere measuring, subtracted from every call.
+ * -1 means that it is guessed from shortest_ns when the summary is printed.
+ */
+static int64_t overhead_ns = -1;
+/* Set by calibrate_overhead */
+static bool overhead_calibrated;
+static uint64_t overhead_ci_ns, entry_overhead_ns;
+
+bool summary_latency;
+bool summary_histogram;
+enum summary_format summary_format;
+
+/*
+ * I/O volume per file, keyed by the path of the descriptor.
+ * Descriptors without a path are keyed by pid and fd number.
+ */
+struct io_counts {
+	struct io_counts *next;
+	const char *path;	/* interned */
+	uint64_t read_bytes, write_bytes;
+	uint64_t reads, writes;
+	uint64_t time_ns;
+};
+
+unsigned int summary_io;
+unsigned int summary_interval;
+
+/*
+ * Contention per futex word, keyed by its address.  Words of different
+ * processes that happen to have the same address are not told apart.
+ */
+struct futex_pair {
+	struct futex_pair *next;
+	int waker, waiter;
+	uint64_t count;
+};
+
+struct futex_counts {
+	struct futex_counts *next;
+	kernel_ulong_t uaddr;
+	uint64_t waits, wakes, woken, timeouts;
+	uint64_t wait_ns, max_wait_ns;
+	/* The tid of the last successful waker, 0 if none */
+	int last_waker;
+	/* Who has woken whom, a waiter is attributed to the last waker */
+	struct futex_pair *pairs;
+};
+
+unsigned int summary_futex;
+static struct futex_counts **futex_hash;
+static unsigned int futex_hash_size;
+static unsigned int futex_hash_count;
+
+/*
+ * Asynchronous I/O requests in flight, keyed by the thread group,
+ * the AIO context, and the address of the iocb, from io_submit
+ * until their completion is reaped by io_getevents.
+ */
+struct aio_request {
+	struct aio_request *next;
+	int tgid;
+	kernel_ulong_t ctx, iocb;
+	struct timespec submit_ts;
+	const char *path;	/* interned */
+	unsigned int opcode;
+};
+
+/* Completion latency of AIO requests per file or per opcode */
+struct aio_counts {
+	struct aio_counts *next;
+	const char *path;	/* interned */
+	struct call_counts cc;	/* errors are failed completions */
+	uint64_t cancelled;
+};
+
+static const char *const aio_opcode_names[] = {
+	"pread", "pwrite", "fsync", "fdsync", "preadx",
+	"poll", "noop", "preadv", "pwritev", "other"
+};
+#define AIO_OPCODE_OTHER (ARRAY_SIZE(aio_opcode_names) - 1)
+/* Number of iocb pointers or io_events fetched at once */
+#define AIO_BATCH 64
+
+unsigned int summary_aio;
+static struct aio_request **aio_hash;
+static unsigned int aio_hash_size;
+static unsigned int aio_hash_count;
+static struct aio_counts **aio_file_hash;
+static unsigned int aio_file_hash_size;
+static unsigned int aio_file_hash_count;
+static struct aio_counts aio_opcode_counts[ARRAY_SIZE(aio_opcode_names)];
+
+/*
+ * Statistics of a single tracee, kept for the lifetime of its tcb
+ * and printed for the busiest tracees after the merged summary.
+ */
+struct pid_counts {
+	struct pid_counts *next;
+	int pid;
+	char comm[sizeof("1234567890123456")];
+	uint64_t time_ns;
+	uint64_t calls;
+	/* Calls since the last --top refresh */
+	uint64_t interval_calls;
+	struct call_counts *countv[SUPPORTED_PERSONALITIES];
+};
+
+unsigned int summary_pids;
+bool top_mode;
+static struct pid_counts *pid_counts_list;
+static unsigned int pid_counts_count;
+
+/* Number of the busiest tracees shown by --top */
+#define TOP_PIDS 5
+
+/* Signal-delivery-stops and group-stops per signal number */
+struct signal_counts {
+	uint64_t delivered, stopped;
+};
+
+static struct signal_counts signal_counts[NSIG];
+static bool signals_counted;
+
+/*
+ * Syscalls that returned ERESTART* codes per syscall and the signal
+ * that interrupted them, which is the next signal delivered to the tracee.
+ */
+struct restart_counts {
+	struct restart_counts *next;
+	unsigned int pers;
+	unsigned int sig;	/* 0 if no signal delivery has been seen */
+	kernel_ulong_t scno;
+	uint64_t calls;
+	uint64_t time_ns, max_ns; /* Time spent before the interruption */
+};
+
+static struct restart_counts *restart_list;
+static unsigned int restart_count;
+
+#ifdef USE_LIBUNWIND
+/*
+ * Statistics per call site, that is, per syscall and -k stack,
+ * gathered when -c is combined with -k.
+ */
+struct site_counts {
+	struct site_counts *next;
+	unsigned int stack_id;
+	unsigned int pers;
+	kernel_ulong_t scno;
+	uint64_t time_ns;
+	uint64_t calls, errors;
+};
+
+#define SUMMARY_SITES 20
+
+static struct site_counts **site_hash;
+static unsigned int site_hash_size;
+static unsigned int site_hash_count;
+#endif
+
+static struct pid_counts *
+alloc_pid_counts(const struct tcb *tcp)
+{
+	struct pid_counts *const pc = xcalloc(1, sizeof(*pc));
+
+	pc->pid = tcp->pid;
+	read_proc_comm(tcp->pid, pc->comm, sizeof(pc->comm));
+
+	pc->next = pid_counts_list;
+	pid_counts_list = pc;
+	++pid_counts_count;
+
+	return pc;
+}
+static struct io_counts **io_hash;
+static unsigned int io_hash_size;
+static unsigned int io_hash_count;
+
+static unsigned int
+hash_str(const char *str)
+{
+	/* FNV-1a */
+	unsigned int h = 2166136261U;
+
+	for (; *str; ++str)
+		h = (h ^ (unsigned char) *str) * 16777619U;
+
+	return h;
+}
+
+static void
+io_hash_expand(void)
+{
+	struct io_counts **const old_hash = io_hash;
+	const unsigned int old_size = io_hash_size;
+	unsigned int i;
+
+	io_hash_size = old_size ? old_size * 2 : 256;
+	io_hash = xcalloc(io_hash_size, sizeof(io_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct io_counts *ic, *next;
+
+		for (ic = old_hash[i]; ic; ic = next) {
+			const unsigned int b =
+				hash_str(ic->path) & (io_hash_size - 1);
+
+			next = ic->next;
+			ic->next = io_hash[b];
+			io_hash[b] = ic;
+		}
+	}
+
+	free(old_hash);
+}
+
+static struct io_counts *
+get_io_counts(const char *path)
+{
+	struct io_counts *ic;
+
+	if (io_hash_size) {
+		for (ic = io_hash[hash_str(path) & (io_hash_size - 1)];
+		     ic; ic = ic->next) {
+			if (strcmp(ic->path, path) == 0)
+				return ic;
+		}
+	}
+
+	if (io_hash_count >= io_hash_size)
+		io_hash_expand();
+
+	const unsigned int b = hash_str(path) & (io_hash_size - 1);
+
+	ic = xcalloc(1, sizeof(*ic));
+	ic->path = str_intern(path);
+	ic->next = io_hash[b];
+	io_hash[b] = ic;
+	++io_hash_count;
+
+	return ic;
+}
+
+static void
+count_io(struct tcb *tcp, const uint64_t ns)
+{
+	bool is_write;
+
+	switch (tcp->s_ent->sen) {
+	case SEN_read:
+	case SEN_pread:
+	case SEN_readv:
+	case SEN_preadv:
+	case SEN_preadv2:
+	case SEN_recv:
+	case SEN_recvfrom:
+	case SEN_recvmsg:
+		is_write = false;
+		break;
+	case SEN_write:
+	case SEN_pwrite:
+	case SEN_writev:
+	case SEN_pwritev:
+	case SEN_pwritev2:
+	case SEN_send:
+	case SEN_sendto:
+	case SEN_sendmsg:
+		is_write = true;
+		break;
+	default:
+		return;
+	}
+
+	if (syserror(tcp))
+		return;
+
+	const int fd = tcp->u_arg[0];
+	char path[PATH_MAX + 1];
+
+	if (getfdpath(tcp, fd, path, sizeof(path)) < 0)
+		snprintf(path, sizeof(path), "<pid %d fd %d>", tcp->pid, fd);
+
+	struct io_counts *const ic = get_io_counts(path);
+
+	if (is_write) {
+		ic->writes++;
+		ic->write_bytes += tcp->u_rval;
+	} else {
+		ic->reads++;
+		ic->read_bytes += tcp->u_rval;
+	}
+	ic->time_ns += ns;
+}
+
+static unsigned int
+hash_uaddr(const kernel_ulong_t uaddr)
+{
+	/* Futex words are 4-byte aligned.  */
+	return (unsigned int) (uaddr >> 2) * 2654435761U;
+}
+
+static void
+futex_hash_expand(void)
+{
+	struct futex_counts **const old_hash = futex_hash;
+	const unsigned int old_size = futex_hash_size;
+	unsigned int i;
+
+	futex_hash_size = old_size ? old_size * 2 : 256;
+	futex_hash = xcalloc(futex_hash_size, sizeof(futex_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct futex_counts *fc, *next;
+
+		for (fc = old_hash[i]; fc; fc = next) {
+			const unsigned int b =
+				hash_uaddr(fc->uaddr) & (futex_hash_size - 1);
+
+			next = fc->next;
+			fc->next = futex_hash[b];
+			futex_hash[b] = fc;
+		}
+	}
+
+	free(old_hash);
+}
+
+static struct futex_counts *
+get_futex_counts(const kernel_ulong_t uaddr)
+{
+	struct futex_counts *fc;
+
+	if (futex_hash_size) {
+		for (fc = futex_hash[hash_uaddr(uaddr) & (futex_hash_size - 1)];
+		     fc; fc = fc->next) {
+			if (fc->uaddr == uaddr)
+				return fc;
+		}
+	}
+
+	if (futex_hash_count >= futex_hash_size)
+		futex_hash_expand();
+
+	const unsigned int b = hash_uaddr(uaddr) & (futex_hash_size - 1);
+
+	fc = xcalloc(1, sizeof(*fc));
+	fc->uaddr = uaddr;
+	fc->next = futex_hash[b];
+	futex_hash[b] = fc;
+	++futex_hash_count;
+
+	return fc;
+}
+
+static void
+count_futex_pair(struct futex_counts *const fc, const int waiter)
+{
+	struct futex_pair *fp;
+
+	for (fp = fc->pairs; fp; fp = fp->next) {
+		if (fp->waker == fc->last_waker && fp->waiter == waiter)
+			break;
+	}
+	if (!fp) {
+		fp = xcalloc(1, sizeof(*fp));
+		fp->waker = fc->last_waker;
+		fp->waiter = waiter;
+		fp->next = fc->pairs;
+		fc->pairs = fp;
+	}
+	fp->count++;
+}
+
+/*
+ * Only the raw futex operation, address, and return value are used,
+ * so the syscall does not have to be decoded.
+ */
+static void
+count_futex(struct tcb *tcp, const uint64_t wall_ns)
+{
+	if (tcp->s_ent->sen != SEN_futex)
+		return;
+
+	const enum futex_op_kind kind = futex_op_kind(tcp->u_arg[1]);
+
+	if (kind == FUTEX_OP_KIND_OTHER)
+		return;
+
+	struct futex_counts *const fc = get_futex_counts(tcp->u_arg[0]);
+
+	if (kind == FUTEX_OP_KIND_WAKE) {
+		fc->wakes++;
+		if (!syserror(tcp) && tcp->u_rval > 0) {
+			fc->woken += tcp->u_rval;
+			fc->last_waker = tcp->pid;
+		}
+		return;
+	}
+
+	fc->waits++;
+	fc->wait_ns += wall_ns;
+	if (wall_ns > fc->max_wait_ns)
+		fc->max_wait_ns = wall_ns;
+	if (syserror(tcp)) {
+		if (tcp->u_error == ETIMEDOUT)
+			fc->timeouts++;
+	} else if (fc->last_waker) {
+		count_futex_pair(fc, tcp->pid);
+	}
+}
+
+#ifdef USE_LIBUNWIND
+static unsigned int
+hash_site(const unsigned int stack_id, const unsigned int pers,
+	  const kernel_ulong_t scno)
+{
+	return (stack_id * 2654435761U) ^ (scno * 40503U) ^ pers;
+}
+
+static void
+site_hash_expand(void)
+{
+	struct site_counts **const old_hash = site_hash;
+	const unsigned int old_size = site_hash_size;
+	unsigned int i;
+
+	site_hash_size = old_size ? old_size * 2 : 256;
+	site_hash = xcalloc(site_hash_size, sizeof(site_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct site_counts *sc, *next;
+
+		for (sc = old_hash[i]; sc; sc = next) {
+			const unsigned int b =
+				hash_site(sc->stack_id, sc->pers, sc->scno)
+				& (site_hash_size - 1);
+
+			next = sc->next;
+			sc->next = site_hash[b];
+			site_hash[b] = sc;
+		}
+	}
+
+	free(old_hash);
+}
+
+static void
+count_site(struct tcb *tcp, const uint64_t ns)
+{
+	const unsigned int stack_id = unwind_stack_id(tcp);
+	const unsigned int h =
+		hash_site(stack_id, current_personality, tcp->scno);
+	struct site_counts *sc = NULL;
+
+	if (site_hash_size) {
+		for (sc = site_hash[h & (site_hash_size - 1)]; sc;
+		     sc = sc->next) {
+			if (sc->stack_id == stack_id &&
+			    sc->pers == current_personality &&
+			    sc->scno == tcp->scno)
+				break;
+		}
+	}
+
+	if (!sc) {
+		if (site_hash_count >= site_hash_size)
+			site_hash_expand();
+
+		const unsigned int b = h & (site_hash_size - 1);
+
+		sc = xcalloc(1, sizeof(*sc));
+		sc->stack_id = stack_id;
+		sc->pers = current_personality;
+		sc->scno = tcp->scno;
+		sc->next = site_hash[b];
+		site_hash[b] = sc;
+		++site_hash_count;
+	}
+
+	sc->calls++;
+	if (syserror(tcp))
+		sc->errors++;
+	sc->time_ns += ns;
+}
+#endif /* USE_LIBUNWIND */
+
+static void
+hist_add(struct call_counts *cc, const uint64_t ns, const uint64_t calls)
+{
+	if (!cc->hist)
+		cc->hist = xcalloc(1, sizeof(*cc->hist));
+
+	uint32_t *const b = &cc->hist->buckets[hist_bucket(ns)];
+	*b = calls < UINT32_MAX - *b ? *b + calls : UINT32_MAX;
+}
+
+static void
+hist_record(struct call_counts *cc, const uint64_t ns)
+{
+	hist_add(cc, ns, 1);
+}
+
+/*
+ * Return the value below which the given permille of calls fall,
+ * rounded down to its bucket and clamped to the observed range.
+ */
+static uint64_t
+hist_percentile(const struct call_counts *cc, const unsigned int permille)
+{
+	const uint64_t rank = (cc->calls * permille + 999) / 1000;
+	uint64_t seen = 0;
+	unsigned int i;
+
+	if (!cc->hist)
+		return cc->max_ns;
+
+	for (i = 0; i < HIST_BUCKETS; ++i) {
+		seen += cc->hist->buckets[i];
+		if (seen >= rank) {
+			const uint64_t v = hist_bucket_value(i);
+
+			return v < cc->min_ns ? cc->min_ns
+			     : v > cc->max_ns ? cc->max_ns : v;
+		}
+	}
+
+	return cc->max_ns;
+}
+
+static uint64_t
+tv_to_ns(const struct timeval *tv)
+{
+	return (uint64_t) tv->tv_sec * 1000000000 + tv->tv_usec * 1000;
+}
+
+static struct call_counts *
+get_call_counts(struct call_counts **const tables, const kernel_ulong_t scno)
+{
+	if (!tables[current_personality])
+		tables[current_personality] =
+			xcalloc(nsyscalls, sizeof(struct call_counts));
+
+	return &tables[current_personality][scno];
+}
+
+static void
+account_call(struct call_counts **const tables, const kernel_ulong_t scno,
+	     const bool error, const uint64_t ns)
+{
+	struct call_counts *const cc = get_call_counts(tables, scno);
+
+	/* Each sampled syscall stands for sample_rate of them.  */
+	cc->calls += sample_rate;
+	if (error)
+		cc->errors += sample_rate;
+
+	cc->time_ns += ns * sample_rate;
+	if (cc->calls == sample_rate || ns < cc->min_ns)
+		cc->min_ns = ns;
+	if (ns > cc->max_ns)
+		cc->max_ns = ns;
+	if (summary_latency)
+		hist_record(cc, ns);
+}
+
+static unsigned int
+hash_aio_request(const int tgid, const kernel_ulong_t ctx,
+		 const kernel_ulong_t iocb)
+{
+	/* iocbs are 64 bytes long and usually 8-byte aligned.  */
+	return ((unsigned int) (iocb >> 3) ^ (unsigned int) ctx ^ tgid)
+	       * 2654435761U;
+}
+
+static void
+aio_hash_expand(void)
+{
+	struct aio_request **const old_hash = aio_hash;
+	const unsigned int old_size = aio_hash_size;
+	unsigned int i;
+
+	aio_hash_size = old_size ? old_size * 2 : 256;
+	aio_hash = xcalloc(aio_hash_size, sizeof(aio_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct aio_request *ar, *next;
+
+		for (ar = old_hash[i]; ar; ar = next) {
+			const unsigned int b =
+				hash_aio_request(ar->tgid, ar->ctx, ar->iocb)
+				& (aio_hash_size - 1);
+
+			next = ar->next;
+			ar->next = aio_hash[b];
+			aio_hash[b] = ar;
+		}
+	}
+
+	free(old_hash);
+}
+
+/* Return the link that points to the request, or to NULL if none.  */
+static struct aio_request **
+find_aio_request(const int tgid, const kernel_ulong_t ctx,
+		 const kernel_ulong_t iocb)
+{
+	struct aio_request **p;
+
+	if (!aio_hash_size)
+		return NULL;
+
+	for (p = &aio_hash[hash_aio_request(tgid, ctx, iocb)
+			   & (aio_hash_size - 1)];
+	     *p; p = &(*p)->next) {
+		if ((*p)->iocb == iocb && (*p)->ctx == ctx
+		    && (*p)->tgid == tgid)
+			break;
+	}
+
+	return p;
+}
+
+static void
+aio_file_hash_expand(void)
+{
+	struct aio_counts **const old_hash = aio_file_hash;
+	const unsigned int old_size = aio_file_hash_size;
+	unsigned int i;
+
+	aio_file_hash_size = old_size ? old_size * 2 : 256;
+	aio_file_hash = xcalloc(aio_file_hash_size, sizeof(aio_file_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct aio_counts *ac, *next;
+
+		for (ac = old_hash[i]; ac; ac = next) {
+			const unsigned int b =
+				hash_str(ac->path) & (aio_file_hash_size - 1);
+
+			next = ac->next;
+			ac->next = aio_file_hash[b];
+			aio_file_hash[b] = ac;
+		}
+	}
+
+	free(old_hash);
+}
+
+static struct aio_counts *
+get_aio_file_counts(const char *path)
+{
+	struct aio_counts *ac;
+
+	if (aio_file_hash_size) {
+		for (ac = aio_file_hash[hash_str(path)
+					& (aio_file_hash_size - 1)];
+		     ac; ac = ac->next) {
+			if (ac->path == path)
+				return ac;
+		}
+	}
+
+	if (aio_file_hash_count >= aio_file_hash_size)
+		aio_file_hash_expand();
+
+	const unsigned int b = hash_str(path) & (aio_file_hash_size - 1);
+
+	ac = xcalloc(1, sizeof(*ac));
+	ac->path = path;
+	ac->next = aio_file_hash[b];
+	aio_file_hash[b] = ac;
+	++aio_file_hash_count;
+
+	return ac;
+}
+
+static void
+account_aio_latency(struct aio_counts *const ac, const uint64_t ns,
+		    const bool error)
+{
+	struct call_counts *const cc = &ac->cc;
+
+	cc->calls++;
+	if (error)
+		cc->errors++;
+	cc->time_ns += ns;
+	if (cc->calls == 1 || ns < cc->min_ns)
+		cc->min_ns = ns;
+	if (ns > cc->max_ns)
+		cc->max_ns = ns;
+	hist_record(cc, ns);
+}
+
+static void
+add_aio_request(struct tcb *tcp, const kernel_ulong_t ctx,
+		const kernel_ulong_t iocb)
+{
+	struct iocb cb;
+
+	if (umove(tcp, iocb, &cb))
+		return;
+
+	const int tgid = get_tcb_tgid(tcp);
+	struct aio_request **const p = find_aio_request(tgid, ctx, iocb);
+	/*
+	 * An iocb that is submitted again before its completion
+	 * has been seen replaces the old request.
+	 */
+	struct aio_request *ar = p ? *p : NULL;
+
+	if (!ar) {
+		if (aio_hash_count >= aio_hash_size)
+			aio_hash_expand();
+
+		const unsigned int b =
+			hash_aio_request(tgid, ctx, iocb) & (aio_hash_size - 1);
+
+		ar = xcalloc(1, sizeof(*ar));
+		ar->tgid = tgid;
+		ar->ctx = ctx;
+		ar->iocb = iocb;
+		ar->next = aio_hash[b];
+		aio_hash[b] = ar;
+		++aio_hash_count;
+	}
+
+	const int fd = cb.aio_fildes;
+	char path[PATH_MAX + 1];
+
+	if (getfdpath(tcp, fd, path, sizeof(path)) < 0)
+		snprintf(path, sizeof(path), "<pid %d fd %d>", tcp->pid, fd);
+
+	ar->submit_ts = tcp->etime;
+	ar->path = str_intern(path);
+	ar->opcode = MIN(cb.aio_lio_opcode, AIO_OPCODE_OTHER);
+}
+
+/* Account the completion of the request and forget it.  */
+static void
+complete_aio_request(struct aio_request **const p,
+		     const struct timespec *const ts, const bool cancelled,
+		     const bool error)
+{
+	struct aio_request *const ar = *p;
+	struct aio_counts *const acs[] = {
+		get_aio_file_counts(ar->path), &aio_opcode_counts[ar->opcode]
+	};
+	struct timespec dt;
+	unsigned int i;
+
+	ts_sub(&dt, ts, &ar->submit_ts);
+
+	const uint64_t ns = (uint64_t) dt.tv_sec * 1000000000 + dt.tv_nsec;
+
+	for (i = 0; i < ARRAY_SIZE(acs); ++i) {
+		if (cancelled)
+			acs[i]->cancelled++;
+		else
+			account_aio_latency(acs[i], ns, error);
+	}
+
+	*p = ar->next;
+	free(ar);
+	--aio_hash_count;
+}
+
+static void
+count_aio_submit(struct tcb *tcp, const kernel_ulong_t ctx)
+{
+	const unsigned int wordsize = current_wordsize;
+	const kernel_ulong_t addr = tcp->u_arg[2];
+	union {
+		uint32_t p32[AIO_BATCH];
+		uint64_t p64[AIO_BATCH];
+	} buf;
+	kernel_long_t i, j, n;
+
+	/* The first u_rval iocbs have been submitted.  */
+	for (i = 0; i < tcp->u_rval; i += n) {
+		n = MIN(tcp->u_rval - i, AIO_BATCH);
+		if (umoven(tcp, addr + i * wordsize, n * wordsize, &buf))
+			return;
+		for (j = 0; j < n; ++j)
+			add_aio_request(tcp, ctx, wordsize < sizeof(buf.p64[0])
+						  ? buf.p32[j] : buf.p64[j]);
+	}
+}
+
+static void
+count_aio_getevents(struct tcb *tcp, const kernel_ulong_t ctx,
+		    const struct timespec *ts)
+{
+	const int tgid = get_tcb_tgid(tcp);
+	struct io_event events[AIO_BATCH];
+	kernel_long_t i, j, n;
+
+	for (i = 0; i < tcp->u_rval; i += n) {
+		n = MIN(tcp->u_rval - i, AIO_BATCH);
+		if (umoven(tcp, tcp->u_arg[3] + i * sizeof(events[0]),
+			   n * sizeof(events[0]), events))
+			return;
+		for (j = 0; j < n; ++j) {
+			struct aio_request **const p =
+				find_aio_request(tgid, ctx, events[j].obj);
+
+			if (p && *p)
+				complete_aio_request(p, ts, false,
+						     (int64_t) events[j].res < 0);
+		}
+	}
+}
+
+/* io_destroy cancels all requests of the context.  */
+static void
+count_aio_destroy(struct tcb *tcp, const kernel_ulong_t ctx,
+		  const struct timespec *ts)
+{
+	const int tgid = get_tcb_tgid(tcp);
+	unsigned int b;
+
+	for (b = 0; b < aio_hash_size; ++b) {
+		struct aio_request **p = &aio_hash[b];
+
+		while (*p) {
+			if ((*p)->ctx == ctx && (*p)->tgid == tgid)
+				complete_aio_request(p, ts, true, false);
+			else
+				p = &(*p)->next;
+		}
+	}
+}
+
+/*
+ * Requests are matched by the iocb addresses that are passed to io_submit
+ * and returned in the obj field of io_event, the latency is measured from
+ * entering of io_submit to exiting of io_getevents that has reaped them.
+ */
+static void
+count_aio(struct tcb *tcp, const struct timespec *ts)
+{
+	const kernel_ulong_t ctx = tcp->u_arg[0];
+	struct aio_request **p;
+
+	if (syserror(tcp))
+		return;
+
+	switch (tcp->s_ent->sen) {
+	case SEN_io_submit:
+		count_aio_submit(tcp, ctx);
+		break;
+	case SEN_io_getevents:
+		count_aio_getevents(tcp, ctx, ts);
+		break;
+	case SEN_io_cancel:
+		p = find_aio_request(get_tcb_tgid(tcp), ctx, tcp->u_arg[1]);
+		if (p && *p)
+			complete_aio_request(p, ts, true, false);
+		break;
+	case SEN_io_destroy:
+		count_aio_destroy(tcp, ctx, ts);
+		break;
+	}
+}
+
+static void
+account_restart(const unsigned int pers, const kernel_ulong_t scno,
+		const unsigned int sig, const uint64_t calls,
+		const uint64_t time_ns, const uint64_t max_ns)
+{
+	struct restart_counts *rc;
+
+	for (rc = restart_list; rc; rc = rc->next) {
+		if (rc->pers == pers && rc->scno == scno && rc->sig == sig)
+			break;
+	}
+	if (!rc) {
+		rc = xcalloc(1, sizeof(*rc));
+		rc->pers = pers;
+		rc->scno = scno;
+		rc->sig = sig;
+		rc->next = restart_list;
+		restart_list = rc;
+		++restart_count;
+	}
+
+	rc->calls += calls;
+	rc->time_ns += time_ns;
+	if (max_ns > rc->max_ns)
+		rc->max_ns = max_ns;
+}
+
+/*
+ * Account the interrupted syscall of the tracee to SIG, the signal
+ * delivered to it, or to 0 when the tracee has made another syscall
+ * without a signal delivery.
+ */
+void
+count_restart(struct tcb *const tcp, const unsigned int sig)
+{
+	tcp->flags &= ~TCB_RESTART_PENDING;
+	account_restart(tcp->restart_pers, tcp->restart_scno,
+			sig < NSIG ? sig : 0, sample_rate,
+			tcp->restart_ns * sample_rate, tcp->restart_ns);
+}
+
+/*
+ * Return the system time spent in the syscall, as accounted by the rusage
+ * of the stops of the tracee, or a substitute if it has not been accounted.
+ */
+static uint64_t
+syscall_system_ns(const struct tcb *const tcp, const uint64_t wall_ns)
+{
+	const uint64_t dtime_ns = tv_to_ns(&tcp->dtime);
+	uint64_t ns = wall_ns;
+
+	/* Spent more wall clock time than spent system time? (usually yes) */
+	if (ns > dtime_ns) {
+		static int64_t one_tick_ns = -1;
+
+		if (one_tick_ns == -1) {
+			/* Initialize it.  */
+			struct itimerval it, saved;
+
+			memset(&it, 0, sizeof(it));
+			it.it_interval.tv_usec = 1;
+			setitimer(ITIMER_REAL, &it, &saved);
+			getitimer(ITIMER_REAL, &it);
+			/* Do not disarm the --summary-interval timer. */
+			setitimer(ITIMER_REAL, &saved, NULL);
+			one_tick_ns = tv_to_ns(&it.it_interval);
+//FIXME: this hack doesn't work (tested on linux-3.6.11): one_tick = 0.000000
+		}
+
+		if (dtime_ns)
+			/* ns = system time spent, if it isn't 0 */
+			ns = dtime_ns;
+		else if (ns > (uint64_t) one_tick_ns) {
+			/* ns = smallest "sane" time interval */
+			if (shortest_ns < (uint64_t) one_tick_ns)
+				ns = shortest_ns;
+			else
+				ns = one_tick_ns;
+		}
+	}
+
+	return ns;
+}
 
 void
-count_syscall(struct tcb *tcp, const struct timeval *syscall_exiting_tv)
+count_syscall(struct tcb *tcp, const struct timespec *syscall_exiting_ts)
+{
+	struct timespec wts;
+
+	if (tcp->flags & TCB_RESTART_PENDING)
+		count_restart(tcp, 0);
+
+	if (!scno_in_range(tcp->scno))
+		return;
+
+	/* wtv = wall clock time spent while in syscall */
+	ts_sub(&wts, syscall_exiting_ts, &tcp->etime);
+
+	const uint64_t wall_ns = (uint64_t) wts.tv_sec * 1000000000
+				 + wts.tv_nsec;
+
+	if (is_erestart(tcp)) {
+		tcp->flags |= TCB_RESTART_PENDING;
+		tcp->restart_pers = current_personality;
+		tcp->restart_scno = tcp->scno;
+		tcp->restart_ns = wall_ns;
+	}
+	uint64_t ns = count_wallclock ? wall_ns
+		      : syscall_system_ns(tcp, wall_ns);
+	if (ns < shortest_ns)
+		shortest_ns = ns;
+	if (overhead_ns >= 0)
+		ns = ns > (uint64_t) overhead_ns ? ns - overhead_ns : 0;
+
+	account_call(countv, tcp->scno, syserror(tcp), ns);
+	if (summary_interval)
+		account_call(interval_countv, tcp->scno, syserror(tcp), ns);
+	if (summary_pids || top_mode) {
+		if (!tcp->pid_counts)
+			tcp->pid_counts = alloc_pid_counts(tcp);
+		if (summary_pids)
+			account_call(tcp->pid_counts->countv, tcp->scno,
+				     syserror(tcp), ns);
+		tcp->pid_counts->time_ns += ns * sample_rate;
+		tcp->pid_counts->calls += sample_rate;
+		tcp->pid_counts->interval_calls += sample_rate;
+	}
+	if (summary_io)
+		count_io(tcp, ns);
+	if (summary_access)
+		count_access(tcp);
+	if (summary_flows)
+		count_flow(tcp, wall_ns);
+	if (summary_connects)
+		count_connect(tcp, wall_ns, syscall_exiting_ts);
+	if (summary_fds)
+		count_fds(tcp, syscall_exiting_ts);
+	if (summary_futex)
+		count_futex(tcp, wall_ns);
+	if (summary_ipc)
+		count_ipc(tcp, wall_ns);
+	if (summary_handoff)
+		count_handoff(tcp, syscall_exiting_ts);
+	if (summary_aio)
+		count_aio(tcp, syscall_exiting_ts);
+	if (summary_epoll)
+		count_epoll(tcp, syscall_exiting_ts);
+	if (summary_v4l2)
+		count_v4l2(tcp, syscall_exiting_ts);
+	if (summary_notify)
+		count_notify(tcp);
+	if (summary_mmap)
+		count_mmap(tcp, syscall_exiting_ts);
+	if (summary_sync)
+		count_sync(tcp, wall_ns);
+	if (summary_oversleep)
+		count_oversleep(tcp, wall_ns);
+	if (summary_sigdelivery)
+		count_sigdelivery_exit(tcp);
+	if (summary_args)
+		count_args(tcp);
+#ifdef USE_LIBUNWIND
+	if (stack_trace_enabled && stack_traced(tcp))
+		count_site(tcp, ns);
+#endif
+}
+
+/*
+ * Account a syscall of the current personality recorded by the perf
+ * counting backend, where NS is the time between its tracepoints.
+ */
+void
+count_syscall_raw(const kernel_ulong_t scno, const bool error,
+		  const uint64_t ns)
+{
+	if (!scno_in_range(scno))
+		return;
+
+	account_call(countv, scno, error, ns);
+	if (summary_interval)
+		account_call(interval_countv, scno, error, ns);
+}
+
+static void
+account_calls(struct call_counts **const tables, const kernel_ulong_t scno,
+	      const uint64_t calls, const uint64_t errors,
+	      const uint64_t time_ns, const uint64_t min_ns,
+	      const uint64_t max_ns)
+{
+	struct call_counts *const cc = get_call_counts(tables, scno);
+
+	cc->calls += calls;
+	cc->errors += errors;
+	cc->time_ns += time_ns;
+	if (cc->calls == calls || min_ns < cc->min_ns)
+		cc->min_ns = min_ns;
+	if (max_ns > cc->max_ns)
+		cc->max_ns = max_ns;
+}
+
+/*
+ * Account CALLS syscalls of the current personality aggregated elsewhere,
+ * e.g. in the kernel by the bpf counting backend.
+ */
+void
+count_syscall_aggregate(const kernel_ulong_t scno, const uint64_t calls,
+			const uint64_t errors, const uint64_t time_ns,
+			const uint64_t min_ns, const uint64_t max_ns)
+{
+	if (!scno_in_range(scno) || !calls)
+		return;
+
+	account_calls(countv, scno, calls, errors, time_ns, min_ns, max_ns);
+	if (summary_interval)
+		account_calls(interval_countv, scno, calls, errors,
+			      time_ns, min_ns, max_ns);
+}
+
+/*
+ * Add CALLS syscalls that took about NS to the --summary-latency histogram,
+ * their other statistics are accounted by count_syscall_aggregate.
+ */
+void
+count_syscall_latency(const kernel_ulong_t scno, const uint64_t ns,
+		      const uint64_t calls)
+{
+	if (!summary_latency || !scno_in_range(scno) || !calls)
+		return;
+
+	hist_add(get_call_counts(countv, scno), ns, calls);
+	if (summary_interval)
+		hist_add(get_call_counts(interval_countv, scno), ns, calls);
+}
+
+/*
+ * The statistics of a --shards tracer are sent to the coordinator
+ * as records, which are added to those of the coordinator by import_counts.
+ * Both ends are the same strace binary, so the records are raw structures.
+ */
+enum counts_record_kind {
+	COUNTS_SYSCALL,		/* followed by the histogram, if any */
+	COUNTS_SIGNAL,		/* calls are deliveries, errors are stops */
+	COUNTS_SHORTEST,	/* time_ns is the shortest syscall */
+	COUNTS_RESTART,		/* calls are restarts, errors is the signal */
+};
+
+struct counts_record {
+	uint32_t kind;
+	uint32_t pers;
+	uint64_t num;
+	uint64_t calls, errors;
+	uint64_t time_ns, min_ns, max_ns;
+};
+
+void
+export_counts(void (*const send)(const void *, size_t))
+{
+	struct {
+		struct counts_record rec;
+		struct latency_hist hist;
+	} buf;
+	unsigned int p, i;
+
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		if (!countv[p])
+			continue;
+		for (i = 0; i < nsyscall_vec[p]; ++i) {
+			const struct call_counts *const cc = &countv[p][i];
+
+			if (!cc->calls)
+				continue;
+			buf.rec = (struct counts_record) {
+				.kind = COUNTS_SYSCALL,
+				.pers = p,
+				.num = i,
+				.calls = cc->calls,
+				.errors = cc->errors,
+				.time_ns = cc->time_ns,
+				.min_ns = cc->min_ns,
+				.max_ns = cc->max_ns
+			};
+			if (cc->hist)
+				buf.hist = *cc->hist;
+			send(&buf, cc->hist ? sizeof(buf) : sizeof(buf.rec));
+		}
+	}
+
+	for (i = 1; i < ARRAY_SIZE(signal_counts); ++i) {
+		if (!signal_counts[i].delivered && !signal_counts[i].stopped)
+			continue;
+		buf.rec = (struct counts_record) {
+			.kind = COUNTS_SIGNAL,
+			.num = i,
+			.calls = signal_counts[i].delivered,
+			.errors = signal_counts[i].stopped
+		};
+		send(&buf.rec, sizeof(buf.rec));
+	}
+
+	const struct restart_counts *rc;
+
+	for (rc = restart_list; rc; rc = rc->next) {
+		buf.rec = (struct counts_record) {
+			.kind = COUNTS_RESTART,
+			.pers = rc->pers,
+			.num = rc->scno,
+			.calls = rc->calls,
+			.errors = rc->sig,
+			.time_ns = rc->time_ns,
+			.max_ns = rc->max_ns
+		};
+		send(&buf.rec, sizeof(buf.rec));
+	}
+
+	buf.rec = (struct counts_record) {
+		.kind = COUNTS_SHORTEST,
+		.time_ns = shortest_ns
+	};
+	send(&buf.rec, sizeof(buf.rec));
+}
+
+void
+import_counts(const void *const data, const size_t len)
+{
+	struct counts_record rec;
+	struct call_counts *cc;
+	unsigned int i;
+
+	if (len < sizeof(rec))
+		return;
+	memcpy(&rec, data, sizeof(rec));
+
+	switch (rec.kind) {
+	case COUNTS_SYSCALL:
+		if (rec.pers >= SUPPORTED_PERSONALITIES
+		    || rec.num >= nsyscall_vec[rec.pers])
+			return;
+		set_personality(rec.pers);
+		account_calls(countv, rec.num, rec.calls, rec.errors,
+			      rec.time_ns, rec.min_ns, rec.max_ns);
+		if (len < sizeof(rec) + sizeof(struct latency_hist))
+			return;
+
+		struct latency_hist hist;
+
+		memcpy(&hist, (const char *) data + sizeof(rec), sizeof(hist));
+		cc = get_call_counts(countv, rec.num);
+		for (i = 0; i < HIST_BUCKETS; ++i) {
+			if (hist.buckets[i])
+				hist_add(cc, hist_bucket_value(i),
+					 hist.buckets[i]);
+		}
+		break;
+	case COUNTS_SIGNAL:
+		if (rec.num >= ARRAY_SIZE(signal_counts))
+			return;
+		signal_counts[rec.num].delivered += rec.calls;
+		signal_counts[rec.num].stopped += rec.errors;
+		signals_counted = true;
+		break;
+	case COUNTS_SHORTEST:
+		if (rec.time_ns < shortest_ns)
+			shortest_ns = rec.time_ns;
+		break;
+	case COUNTS_RESTART:
+		if (rec.pers >= SUPPORTED_PERSONALITIES
+		    || rec.num >= nsyscall_vec[rec.pers]
+		    || rec.errors >= NSIG)
+			return;
+		account_restart(rec.pers, rec.num, rec.errors, rec.calls,
+				rec.time_ns, rec.max_ns);
+		break;
+	}
+}
+
+/*
+ * Keys the syscall summary is sorted by, in the order of their priority.
+ * Ties left by all of them are broken by syscall number.
+ */
+enum summary_sort_key {
+	SORT_BY_TIME,
+	SORT_BY_CALLS,
+	SORT_BY_ERRORS,
+	SORT_BY_NAME,
+	SORT_BY_NUM_KEYS
+};
+
+static const char *const sort_key_names[] = {
+	[SORT_BY_TIME] = "time",
+	[SORT_BY_CALLS] = "calls",
+	[SORT_BY_ERRORS] = "errors",
+	[SORT_BY_NAME] = "name",
+};
+
+static enum summary_sort_key sort_keys[SORT_BY_NUM_KEYS];
+static unsigned int sort_keys_count;
+
+/* A line of the syscall summary */
+struct summary_row {
+	const struct call_counts *cc;
+	const char *name;
+	unsigned int scno;
+	double percent;
+};
+
+static int
+uint64_cmp_desc(const uint64_t m, const uint64_t n)
+{
+	return (m < n) ? 1 : (m > n) ? -1 : 0;
+}
+
+static int
+summary_row_cmp(const void *a, const void *b)
+{
+	const struct summary_row *const x = a;
+	const struct summary_row *const y = b;
+	unsigned int i;
+	int rc = 0;
+
+	for (i = 0; i < sort_keys_count && !rc; ++i) {
+		switch (sort_keys[i]) {
+		case SORT_BY_TIME:
+			rc = uint64_cmp_desc(x->cc->time_ns, y->cc->time_ns);
+			break;
+		case SORT_BY_CALLS:
+			rc = uint64_cmp_desc(x->cc->calls, y->cc->calls);
+			break;
+		case SORT_BY_ERRORS:
+			rc = uint64_cmp_desc(x->cc->errors, y->cc->errors);
+			break;
+		case SORT_BY_NAME:
+			rc = strcmp(x->name ? x->name : "",
+				    y->name ? y->name : "");
+			break;
+		case SORT_BY_NUM_KEYS:
+			break;
+		}
+	}
+
+	return rc ? rc : (x->scno > y->scno) - (x->scno < y->scno);
+}
+
+/* Number of syscalls in the summary, 0 means all of them. */
+unsigned int summary_top;
+
+void
+set_sortby(const char *sortby)
+{
+	char *const copy = xstrdup(sortby);
+	char *saveptr = NULL;
+	const char *token;
+
+	sort_keys_count = 0;
+	if (strcmp(sortby, "nothing") == 0)
+		goto out;
+
+	for (token = strtok_r(copy, ",", &saveptr); token;
+	     token = strtok_r(NULL, ",", &saveptr)) {
+		unsigned int i;
+
+		for (i = 0; i < ARRAY_SIZE(sort_key_names); ++i)
+			if (strcmp(token, sort_key_names[i]) == 0)
+				break;
+		if (i >= ARRAY_SIZE(sort_key_names)
+		    || sort_keys_count >= ARRAY_SIZE(sort_keys))
+			error_msg_and_help("invalid sortby: '%s'", sortby);
+		sort_keys[sort_keys_count++] = i;
+	}
+	if (!sort_keys_count)
+		error_msg_and_help("invalid sortby: '%s'", sortby);
+
+out:
+	free(copy);
+}
+
+void set_overhead(int n)
+{
+	overhead_ns = (int64_t) n * 1000;
+}
+
+void
+set_calibrated_overhead(uint64_t ns, uint64_t ci_ns, uint64_t entry_ns)
+{
+	overhead_ns = ns;
+	overhead_ci_ns = ci_ns;
+	entry_overhead_ns = entry_ns;
+	overhead_calibrated = true;
+}
+
+static void
+print_summary_dashes(FILE *outf)
+{
+	const char *dashes = "----------------";
+
+	fprintf(outf, "%6.6s %11.11s %11.11s %9.9s %9.9s",
+		dashes, dashes, dashes, dashes, dashes);
+	if (summary_latency)
+		fprintf(outf, " %11.11s %11.11s %11.11s %11.11s %11.11s %11.11s",
+			dashes, dashes, dashes, dashes, dashes, dashes);
+	fprintf(outf, " %s\n", dashes);
+}
+
+static void
+print_summary_line(FILE *outf, const char *percent, double seconds,
+		   const char *usecs, uint64_t calls, uint64_t errors,
+		   const struct call_counts *cc, const char *name)
+{
+	char calls_str[sizeof(calls) * 3];
+	char errors_str[sizeof(errors) * 3];
+
+	sprintf(calls_str, "%" PRIu64, calls);
+	errors_str[0] = '\0';
+	if (errors)
+		sprintf(errors_str, "%" PRIu64, errors);
+
+	fprintf(outf, "%6.6s %11.6f %11.11s %9s %9.9s", percent, seconds,
+		usecs, calls_str, errors_str);
+	if (summary_latency) {
+		if (cc)
+			fprintf(outf, " %11" PRIu64 " %11" PRIu64 " %11" PRIu64
+				" %11" PRIu64 " %11" PRIu64 " %11" PRIu64,
+				cc->min_ns / 1000,
+				hist_percentile(cc, 500) / 1000,
+				hist_percentile(cc, 900) / 1000,
+				hist_percentile(cc, 990) / 1000,
+				hist_percentile(cc, 999) / 1000,
+				cc->max_ns / 1000);
+		else
+			fprintf(outf, " %11.11s %11.11s %11.11s %11.11s"
+				" %11.11s %11.11s", "", "", "", "", "", "");
+	}
+	fprintf(outf, " %s\n", name);
+}
+
+static void
+print_summary_header(FILE *outf)
+{
+	fprintf(outf, "%6.6s %11.11s %11.11s %9.9s %9.9s",
+		"% time", "seconds", "usecs/call", "calls", "errors");
+	if (summary_latency)
+		fprintf(outf, " %11.11s %11.11s %11.11s %11.11s %11.11s %11.11s",
+			"min usecs", "p50", "p90", "p99", "p99.9", "max usecs");
+	fprintf(outf, " %s\n", "syscall");
+	print_summary_dashes(outf);
+}
+
+static void
+print_histogram(FILE *outf, const struct call_counts *cc, const char *name)
+{
+	unsigned int i;
+
+	if (!cc->hist)
+		return;
+
+	fprintf(outf, "\n%s latency histogram (usecs):\n", name);
+	for (i = 0; i < HIST_BUCKETS; ++i) {
+		if (!cc->hist->buckets[i])
+			continue;
+		fprintf(outf, "%14.3f - %14.3f %9u\n",
+			hist_bucket_value(i) / 1e3,
+			i + 1 < HIST_BUCKETS
+			? (hist_bucket_value(i + 1) - 1) / 1e3
+			: UINT64_MAX / 1e3,
+			cc->hist->buckets[i]);
+	}
+}
+
+/* Time and length of the summary being printed in a machine format */
+static long long summary_timestamp;
+static unsigned int summary_length;
+
+static void
+print_summary_csv_header(FILE *outf)
+{
+	fprintf(outf, "timestamp,interval,wordsize,syscall,calls,errors"
+		",time_ns,min_ns,max_ns");
+	if (summary_latency)
+		fprintf(outf, ",p50_ns,p90_ns,p99_ns,p999_ns");
+	fprintf(outf, "\n");
+}
+
+static void
+print_summary_csv_row(FILE *outf, const struct call_counts *cc,
+		      const char *name)
+{
+	fprintf(outf, "%lld,%u,%u,%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64
+		",%" PRIu64 ",%" PRIu64, summary_timestamp, summary_length,
+		current_wordsize * 8, name, cc->calls, cc->errors,
+		cc->time_ns, cc->min_ns, cc->max_ns);
+	if (summary_latency)
+		fprintf(outf, ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64,
+			hist_percentile(cc, 500), hist_percentile(cc, 900),
+			hist_percentile(cc, 990), hist_percentile(cc, 999));
+	fprintf(outf, "\n");
+}
+
+static void
+print_summary_json_row(FILE *outf, const struct call_counts *cc,
+		       const char *name, const bool first)
+{
+	unsigned int i;
+
+	fprintf(outf, "%s{\"name\":\"%s\",\"calls\":%" PRIu64
+		",\"errors\":%" PRIu64 ",\"time_ns\":%" PRIu64
+		",\"min_ns\":%" PRIu64 ",\"max_ns\":%" PRIu64,
+		first ? "" : ",", name, cc->calls, cc->errors, cc->time_ns,
+		cc->min_ns, cc->max_ns);
+	if (summary_latency)
+		fprintf(outf, ",\"p50_ns\":%" PRIu64 ",\"p90_ns\":%" PRIu64
+			",\"p99_ns\":%" PRIu64 ",\"p999_ns\":%" PRIu64,
+			hist_percentile(cc, 500), hist_percentile(cc, 900),
+			hist_percentile(cc, 990), hist_percentile(cc, 999));
+	if (summary_histogram && cc->hist) {
+		bool first_bucket = true;
+
+		/* Pairs of the lowest value of a bucket and its count */
+		fprintf(outf, ",\"histogram\":[");
+		for (i = 0; i < HIST_BUCKETS; ++i) {
+			if (!cc->hist->buckets[i])
+				continue;
+			fprintf(outf, "%s[%" PRIu64 ",%u]",
+				first_bucket ? "" : ",",
+				hist_bucket_value(i), cc->hist->buckets[i]);
+			first_bucket = false;
+		}
+		fprintf(outf, "]");
+	}
+	fprintf(outf, "}");
+}
+
+static void
+call_summary_pers(FILE *outf)
 {
-	struct timeval wtv;
-	struct timeval *tv = &wtv;
-	struct call_counts *cc;
+	unsigned int i, n = 0;
+	uint64_t call_cum, error_cum, time_cum_ns;
+	char    usecs_str[sizeof(uint64_t) * 3];
+	char    percent_str[sizeof("100.00") + sizeof(double) * 3];
+	struct summary_row *rows = NULL;
 
-	if (!scno_in_range(tcp->scno))
+	if (summary_format == SUMMARY_FORMAT_TEXT)
+		print_summary_header(outf);
+
+	call_cum = error_cum = time_cum_ns = 0;
+	/* A given overhead is subtracted by count_syscall already. */
+	const uint64_t guessed_overhead_ns =
+		overhead_ns == -1 ? shortest_ns * 8 / 10 : 0;
+	if (counts)
+		rows = xcalloc(nsyscalls, sizeof(*rows));
+	for (i = 0; i < nsyscalls; i++) {
+		if (counts == NULL || counts[i].calls == 0)
+			continue;
+		const uint64_t dns = guessed_overhead_ns * counts[i].calls;
+		counts[i].time_ns = counts[i].time_ns > dns
+				    ? counts[i].time_ns - dns : 0;
+		call_cum += counts[i].calls;
+		error_cum += counts[i].errors;
+		time_cum_ns += counts[i].time_ns;
+		rows[n].cc = &counts[i];
+		rows[n].name = sysent[i].sys_name;
+		rows[n].scno = i;
+		++n;
+	}
+	for (i = 0; i < n; ++i) {
+		rows[i].percent = 100.0 * rows[i].cc->time_ns;
+		if (rows[i].percent != 0.0)
+			rows[i].percent /= time_cum_ns;
+		/* else: time_cum_ns can be 0 too and we get 0/0 = NAN */
+	}
+	if (summary_top && summary_top < n) {
+		if (sort_keys_count)
+			sort_top(rows, n, sizeof(*rows), summary_top,
+				 summary_row_cmp);
+		n = summary_top;
+	} else if (sort_keys_count) {
+		qsort(rows, n, sizeof(*rows), summary_row_cmp);
+	}
+
+	if (summary_format == SUMMARY_FORMAT_CSV) {
+		for (i = 0; i < n; i++)
+			print_summary_csv_row(outf, rows[i].cc, rows[i].name);
+		free(rows);
 		return;
+	}
 
-	if (!counts)
-		counts = xcalloc(nsyscalls, sizeof(*counts));
-	cc = &counts[tcp->scno];
+	if (summary_format == SUMMARY_FORMAT_JSON) {
+		fprintf(outf, "{\"wordsize\":%u,\"overhead_ns\":%" PRIu64
+			",\"syscalls\":[", current_wordsize * 8,
+			overhead_ns == -1 ? guessed_overhead_ns
+					  : (uint64_t) overhead_ns);
+		for (i = 0; i < n; i++)
+			print_summary_json_row(outf, rows[i].cc, rows[i].name,
+					       !i);
+		fprintf(outf, "],\"total\":{\"calls\":%" PRIu64
+			",\"errors\":%" PRIu64 ",\"time_ns\":%" PRIu64 "}}",
+			call_cum, error_cum, time_cum_ns);
+		free(rows);
+		return;
+	}
 
-	cc->calls++;
-	if (syserror(tcp))
-		cc->errors++;
+	for (i = 0; i < n; i++) {
+		const struct call_counts *const cc = rows[i].cc;
 
-	/* tv = wall clock time spent while in syscall */
-	tv_sub(tv, syscall_exiting_tv, &tcp->etime);
+		sprintf(percent_str, "%6.2f", rows[i].percent);
+		sprintf(usecs_str, "%" PRIu64, cc->time_ns / cc->calls / 1000);
+		print_summary_line(outf, percent_str, cc->time_ns / 1e9,
+				   usecs_str, cc->calls, cc->errors, cc,
+				   rows[i].name);
+	}
 
-	/* Spent more wall clock time than spent system time? (usually yes) */
-	if (tv_cmp(tv, &tcp->dtime) > 0) {
-		static struct timeval one_tick = { -1, 0 };
+	print_summary_dashes(outf);
+	print_summary_line(outf, "100.00", time_cum_ns / 1e9, "",
+			   call_cum, error_cum, NULL, "total");
 
-		if (one_tick.tv_sec == -1) {
-			/* Initialize it.  */
-			struct itimerval it;
+	if (summary_histogram) {
+		for (i = 0; i < n; i++)
+			print_histogram(outf, rows[i].cc, rows[i].name);
+	}
+	free(rows);
+}
 
-			memset(&it, 0, sizeof(it));
-			it.it_interval.tv_usec = 1;
-			setitimer(ITIMER_REAL, &it, NULL);
-			getitimer(ITIMER_REAL, &it);
-			one_tick = it.it_interval;
-//FIXME: this hack doesn't work (tested on linux-3.6.11): one_tick = 0.000000
-//tprintf(" one_tick.tv_usec:%u\n", (unsigned)one_tick.tv_usec);
-		}
+void
+count_signal(const unsigned int sig, const bool stopped)
+{
+	if (sig >= ARRAY_SIZE(signal_counts))
+		return;
 
-		if (tv_nz(&tcp->dtime))
-			/* tv = system time spent, if it isn't 0 */
-			tv = &tcp->dtime;
-		else if (tv_cmp(tv, &one_tick) > 0) {
-			/* tv = smallest "sane" time interval */
-			if (tv_cmp(&shortest, &one_tick) < 0)
-				tv = &shortest;
-			else
-				tv = &one_tick;
-		}
+	if (stopped)
+		++signal_counts[sig].stopped;
+	else
+		++signal_counts[sig].delivered;
+	signals_counted = true;
+}
+
+/* Print how many times each signal has been delivered or stopped tracees. */
+static void
+signal_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	unsigned int i;
+
+	fprintf(outf, "\n%9.9s %9.9s %s\n", "delivered", "stopped", "signal");
+	fprintf(outf, "%9.9s %9.9s %s\n", dashes, dashes, dashes);
+	for (i = 1; i < ARRAY_SIZE(signal_counts); ++i) {
+		if (signal_counts[i].delivered || signal_counts[i].stopped)
+			fprintf(outf, "%9" PRIu64 " %9" PRIu64 " %s\n",
+				signal_counts[i].delivered,
+				signal_counts[i].stopped, signame(i));
 	}
-	if (tv_cmp(tv, &shortest) < 0)
-		shortest = *tv;
-	tv_add(&cc->time, &cc->time, count_wallclock ? &wtv : tv);
 }
 
 static int
-time_cmp(void *a, void *b)
+restart_counts_cmp(const void *a, const void *b)
 {
-	return -tv_cmp(&counts[*((int *) a)].time,
-		       &counts[*((int *) b)].time);
+	const struct restart_counts *const x =
+		*(const struct restart_counts **) a;
+	const struct restart_counts *const y =
+		*(const struct restart_counts **) b;
+
+	if (x->time_ns != y->time_ns)
+		return x->time_ns < y->time_ns ? 1 : -1;
+	if (x->calls != y->calls)
+		return x->calls < y->calls ? 1 : -1;
+	if (x->pers != y->pers)
+		return x->pers < y->pers ? -1 : 1;
+	if (x->scno != y->scno)
+		return x->scno < y->scno ? -1 : 1;
+	return (x->sig > y->sig) - (x->sig < y->sig);
 }
 
-static int
-syscall_cmp(void *a, void *b)
+/*
+ * Print the syscalls interrupted to be restarted, and the time they
+ * spent before the interruption, per syscall and signal.
+ */
+static void
+restart_summary(FILE *outf)
 {
-	const char *a_name = sysent[*((int *) a)].sys_name;
-	const char *b_name = sysent[*((int *) b)].sys_name;
-	return strcmp(a_name ? a_name : "", b_name ? b_name : "");
+	const char *dashes = "----------------";
+	struct restart_counts **sorted;
+	struct restart_counts *rc;
+	unsigned int i, n = 0;
+
+	sorted = xcalloc(restart_count, sizeof(sorted[0]));
+	for (rc = restart_list; rc; rc = rc->next)
+		sorted[n++] = rc;
+	qsort(sorted, n, sizeof(sorted[0]), restart_counts_cmp);
+
+	fprintf(outf, "\n%9.9s %11.11s %9.9s %-16.16s %s\n",
+		"restarts", "seconds", "max usecs", "syscall", "signal");
+	fprintf(outf, "%9.9s %11.11s %9.9s %-16.16s %s\n",
+		dashes, dashes, dashes, dashes, dashes);
+	for (i = 0; i < n; ++i) {
+		rc = sorted[i];
+		fprintf(outf, "%9" PRIu64 " %11.6f %9" PRIu64 " %-16s %s\n",
+			rc->calls, rc->time_ns / 1e9, rc->max_ns / 1000,
+			sysent_vec[rc->pers][rc->scno].sys_name,
+			rc->sig ? signame(rc->sig) : "?");
+	}
+
+	free(sorted);
 }
 
 static int
-count_cmp(void *a, void *b)
+io_counts_cmp(const void *a, const void *b)
 {
-	int     m = counts[*((int *) a)].calls;
-	int     n = counts[*((int *) b)].calls;
+	const struct io_counts *const x = *(const struct io_counts **) a;
+	const struct io_counts *const y = *(const struct io_counts **) b;
+	const uint64_t m = x->read_bytes + x->write_bytes;
+	const uint64_t n = y->read_bytes + y->write_bytes;
 
-	return (m < n) ? 1 : (m > n) ? -1 : 0;
+	return (m < n) ? 1 : (m > n) ? -1 : strcmp(x->path, y->path);
+}
+
+/* Print files that moved the most bytes, at most summary_io of them. */
+static void
+io_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	struct io_counts **sorted;
+	unsigned int i, n = 0;
+
+	if (!io_hash_count)
+		return;
+
+	sorted = xcalloc(io_hash_count, sizeof(sorted[0]));
+	for (i = 0; i < io_hash_size; ++i) {
+		struct io_counts *ic;
+
+		for (ic = io_hash[i]; ic; ic = ic->next)
+			sorted[n++] = ic;
+	}
+	sort_top(sorted, n, sizeof(sorted[0]), summary_io, io_counts_cmp);
+
+	fprintf(outf, "\n%14.14s %14.14s %9.9s %9.9s %11.11s %s\n",
+		"bytes read", "bytes written", "reads", "writes", "seconds",
+		"file");
+	fprintf(outf, "%14.14s %14.14s %9.9s %9.9s %11.11s %s\n",
+		dashes, dashes, dashes, dashes, dashes, dashes);
+	for (i = 0; i < n && i < summary_io; ++i)
+		fprintf(outf, "%14" PRIu64 " %14" PRIu64 " %9" PRIu64
+			" %9" PRIu64 " %11.6f %s\n",
+			sorted[i]->read_bytes, sorted[i]->write_bytes,
+			sorted[i]->reads, sorted[i]->writes,
+			sorted[i]->time_ns / 1e9, sorted[i]->path);
+
+	free(sorted);
 }
 
-static int (*sortfun)();
-static struct timeval overhead = { -1, -1 };
+static int
+futex_counts_cmp(const void *a, const void *b)
+{
+	const struct futex_counts *const x = *(const struct futex_counts **) a;
+	const struct futex_counts *const y = *(const struct futex_counts **) b;
+
+	return (x->wait_ns < y->wait_ns) ? 1 : (x->wait_ns > y->wait_ns) ? -1
+	     : (x->waits < y->waits) ? 1 : (x->waits > y->waits) ? -1
+	     : (x->uaddr > y->uaddr) - (x->uaddr < y->uaddr);
+}
 
-void
-set_sortby(const char *sortby)
+/*
+ * Print futex words waited on for the longest time,
+ * at most summary_futex of them.
+ */
+static void
+futex_summary(FILE *outf)
 {
-	if (strcmp(sortby, "time") == 0)
-		sortfun = time_cmp;
-	else if (strcmp(sortby, "calls") == 0)
-		sortfun = count_cmp;
-	else if (strcmp(sortby, "name") == 0)
-		sortfun = syscall_cmp;
-	else if (strcmp(sortby, "nothing") == 0)
-		sortfun = NULL;
-	else {
-		error_msg_and_help("invalid sortby: '%s'", sortby);
+	const char *dashes = "------------------";
+	struct futex_counts **sorted;
+	unsigned int i, n = 0;
+
+	if (!futex_hash_count)
+		return;
+
+	sorted = xcalloc(futex_hash_count, sizeof(sorted[0]));
+	for (i = 0; i < futex_hash_size; ++i) {
+		struct futex_counts *fc;
+
+		for (fc = futex_hash[i]; fc; fc = fc->next)
+			sorted[n++] = fc;
 	}
+	sort_top(sorted, n, sizeof(sorted[0]), summary_futex,
+		 futex_counts_cmp);
+
+	fprintf(outf, "\n%18.18s %9.9s %9.9s %9.9s %9.9s %11.11s %11.11s %s\n",
+		"futex", "waits", "wakes", "woken", "timeouts", "seconds",
+		"max wait", "top waker>waiter");
+	fprintf(outf, "%18.18s %9.9s %9.9s %9.9s %9.9s %11.11s %11.11s %s\n",
+		dashes, dashes, dashes, dashes, dashes, dashes, dashes, dashes);
+	for (i = 0; i < n && i < summary_futex; ++i) {
+		const struct futex_counts *const fc = sorted[i];
+		const struct futex_pair *fp, *top = NULL;
+
+		for (fp = fc->pairs; fp; fp = fp->next) {
+			if (!top || fp->count > top->count)
+				top = fp;
+		}
+
+		fprintf(outf, "%#18" PRI_klx " %9" PRIu64 " %9" PRIu64
+			" %9" PRIu64 " %9" PRIu64 " %11.6f %11.6f",
+			fc->uaddr, fc->waits, fc->wakes, fc->woken,
+			fc->timeouts, fc->wait_ns / 1e9, fc->max_wait_ns / 1e9);
+		if (top)
+			fprintf(outf, " %d>%d (%" PRIu64 ")",
+				top->waker, top->waiter, top->count);
+		fputc('\n', outf);
+	}
+
+	free(sorted);
 }
 
-void set_overhead(int n)
+static int
+aio_counts_cmp(const void *a, const void *b)
 {
-	overhead.tv_sec = n / 1000000;
-	overhead.tv_usec = n % 1000000;
+	const struct aio_counts *const x = *(const struct aio_counts **) a;
+	const struct aio_counts *const y = *(const struct aio_counts **) b;
+
+	return (x->cc.time_ns < y->cc.time_ns) ? 1
+	     : (x->cc.time_ns > y->cc.time_ns) ? -1
+	     : strcmp(x->path, y->path);
 }
 
 static void
-call_summary_pers(FILE *outf)
+print_aio_line(FILE *outf, const struct aio_counts *const ac,
+	       const char *const name)
+{
+	const struct call_counts *const cc = &ac->cc;
+
+	fprintf(outf, "%9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %11" PRIu64
+		" %11" PRIu64 " %11" PRIu64 " %11" PRIu64 " %11" PRIu64
+		" %11" PRIu64 " %s\n", cc->calls, cc->errors, ac->cancelled,
+		cc->min_ns / 1000, hist_percentile(cc, 500) / 1000,
+		hist_percentile(cc, 900) / 1000,
+		hist_percentile(cc, 990) / 1000,
+		hist_percentile(cc, 999) / 1000, cc->max_ns / 1000, name);
+}
+
+static void
+print_aio_header(FILE *outf, const char *const name)
 {
-	unsigned int i;
-	int     call_cum, error_cum;
-	struct timeval tv_cum, dtv;
-	double  float_tv_cum;
-	double  percent;
 	const char *dashes = "----------------";
-	char    error_str[sizeof(int)*3];
-	int    *sorted_count;
 
-	fprintf(outf, "%6.6s %11.11s %11.11s %9.9s %9.9s %s\n",
-		"% time", "seconds", "usecs/call",
-		"calls", "errors", "syscall");
-	fprintf(outf, "%6.6s %11.11s %11.11s %9.9s %9.9s %s\n",
+	fprintf(outf, "\n%9.9s %9.9s %9.9s %11.11s %11.11s %11.11s %11.11s"
+		" %11.11s %11.11s %s\n", "completed", "errors", "cancelled",
+		"min usecs", "p50", "p90", "p99", "p99.9", "max usecs", name);
+	fprintf(outf, "%9.9s %9.9s %9.9s %11.11s %11.11s %11.11s %11.11s"
+		" %11.11s %11.11s %s\n", dashes, dashes, dashes, dashes,
 		dashes, dashes, dashes, dashes, dashes, dashes);
+}
+
+/*
+ * Print the completion latency of AIO requests per opcode
+ * and for the summary_aio files that waited for them the longest.
+ */
+static void
+aio_summary(FILE *outf)
+{
+	struct aio_counts **sorted;
+	unsigned int i, n = 0;
+
+	if (aio_file_hash_count) {
+		print_aio_header(outf, "opcode");
+		for (i = 0; i < ARRAY_SIZE(aio_opcode_counts); ++i) {
+			if (aio_opcode_counts[i].cc.calls
+			    || aio_opcode_counts[i].cancelled)
+				print_aio_line(outf, &aio_opcode_counts[i],
+					       aio_opcode_names[i]);
+		}
 
-	sorted_count = xcalloc(sizeof(int), nsyscalls);
-	call_cum = error_cum = tv_cum.tv_sec = tv_cum.tv_usec = 0;
-	if (overhead.tv_sec == -1) {
-		tv_mul(&overhead, &shortest, 8);
-		tv_div(&overhead, &overhead, 10);
+		sorted = xcalloc(aio_file_hash_count, sizeof(sorted[0]));
+		for (i = 0; i < aio_file_hash_size; ++i) {
+			struct aio_counts *ac;
+
+			for (ac = aio_file_hash[i]; ac; ac = ac->next)
+				sorted[n++] = ac;
+		}
+		sort_top(sorted, n, sizeof(sorted[0]), summary_aio,
+			 aio_counts_cmp);
+
+		print_aio_header(outf, "file");
+		for (i = 0; i < n && i < summary_aio; ++i)
+			print_aio_line(outf, sorted[i], sorted[i]->path);
+
+		free(sorted);
 	}
-	for (i = 0; i < nsyscalls; i++) {
-		sorted_count[i] = i;
-		if (counts == NULL || counts[i].calls == 0)
-			continue;
-		tv_mul(&dtv, &overhead, counts[i].calls);
-		tv_sub(&counts[i].time, &counts[i].time, &dtv);
-		call_cum += counts[i].calls;
-		error_cum += counts[i].errors;
-		tv_add(&tv_cum, &tv_cum, &counts[i].time);
-	}
-	float_tv_cum = tv_float(&tv_cum);
-	if (counts) {
-		if (sortfun)
-			qsort((void *) sorted_count, nsyscalls, sizeof(int), sortfun);
-		for (i = 0; i < nsyscalls; i++) {
-			double float_syscall_time;
-			int idx = sorted_count[i];
-			struct call_counts *cc = &counts[idx];
-			if (cc->calls == 0)
-				continue;
-			tv_div(&dtv, &cc->time, cc->calls);
-			error_str[0] = '\0';
-			if (cc->errors)
-				sprintf(error_str, "%u", cc->errors);
-			float_syscall_time = tv_float(&cc->time);
-			percent = (100.0 * float_syscall_time);
-			if (percent != 0.0)
-				   percent /= float_tv_cum;
-			/* else: float_tv_cum can be 0.0 too and we get 0/0 = NAN */
-			fprintf(outf, "%6.2f %11.6f %11lu %9u %9.9s %s\n",
-				percent, float_syscall_time,
-				(long) (1000000 * dtv.tv_sec + dtv.tv_usec),
-				cc->calls,
-				error_str, sysent[idx].sys_name);
-		}
-	}
-	free(sorted_count);
-
-	fprintf(outf, "%6.6s %11.11s %11.11s %9.9s %9.9s %s\n",
-		dashes, dashes, dashes, dashes, dashes, dashes);
-	error_str[0] = '\0';
-	if (error_cum)
-		sprintf(error_str, "%u", error_cum);
-	fprintf(outf, "%6.6s %11.6f %11.11s %9u %9.9s %s\n",
-		"100.00", float_tv_cum, "",
-		call_cum, error_str, "total");
+
+	if (aio_hash_count)
+		fprintf(outf, "\n%u AIO requests have not been seen completed\n",
+			aio_hash_count);
 }
 
-void
-call_summary(FILE *outf)
+#ifdef USE_LIBUNWIND
+static int
+site_counts_cmp(const void *a, const void *b)
+{
+	const struct site_counts *const x = *(const struct site_counts **) a;
+	const struct site_counts *const y = *(const struct site_counts **) b;
+
+	return (x->time_ns < y->time_ns) ? 1 : (x->time_ns > y->time_ns) ? -1
+	     : (x->calls < y->calls) ? 1 : (x->calls > y->calls) ? -1
+	     : (x->stack_id > y->stack_id) - (x->stack_id < y->stack_id);
+}
+
+static const char *
+site_syscall_name(const struct site_counts *sc)
+{
+	if (current_personality != sc->pers)
+		set_personality(sc->pers);
+	return sysent[sc->scno].sys_name;
+}
+
+/*
+ * Print the call sites that spent the most time, at most SUMMARY_SITES
+ * of them, followed by all call sites in the folded stack format.
+ */
+static void
+site_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	const unsigned int old_pers = current_personality;
+	struct site_counts **sorted;
+	unsigned int i, n = 0;
+
+	if (!site_hash_count)
+		return;
+
+	sorted = xcalloc(site_hash_count, sizeof(sorted[0]));
+	for (i = 0; i < site_hash_size; ++i) {
+		struct site_counts *sc;
+
+		for (sc = site_hash[i]; sc; sc = sc->next)
+			sorted[n++] = sc;
+	}
+	sort_top(sorted, n, sizeof(sorted[0]), SUMMARY_SITES,
+		 site_counts_cmp);
+
+	fprintf(outf, "\n%11.11s %9.9s %9.9s %-16.16s %s\n",
+		"seconds", "calls", "errors", "syscall", "call site");
+	fprintf(outf, "%11.11s %9.9s %9.9s %-16.16s %s\n",
+		dashes, dashes, dashes, dashes, dashes);
+	for (i = 0; i < n && i < SUMMARY_SITES; ++i) {
+		fprintf(outf, "%11.6f %9" PRIu64 " %9" PRIu64 " %-16.16s ",
+			sorted[i]->time_ns / 1e9, sorted[i]->calls,
+			sorted[i]->errors, site_syscall_name(sorted[i]));
+		unwind_print_folded_stack(outf, sorted[i]->stack_id);
+		fputc('\n', outf);
+	}
+
+	fprintf(outf, "\nFolded call site stacks (usecs):\n");
+	for (i = 0; i < n; ++i) {
+		unwind_print_folded_stack(outf, sorted[i]->stack_id);
+		fprintf(outf, ";%s %" PRIu64 "\n",
+			site_syscall_name(sorted[i]),
+			sorted[i]->time_ns / 1000);
+	}
+
+	if (old_pers != current_personality)
+		set_personality(old_pers);
+
+	free(sorted);
+}
+#endif /* USE_LIBUNWIND */
+
+static void
+print_summaries(FILE *outf, struct call_counts **const tables)
 {
+	static bool csv_header_printed;
 	unsigned int i, old_pers = current_personality;
+	bool first = true;
+
+	summary_countv = tables;
+
+	if (summary_format == SUMMARY_FORMAT_CSV && !csv_header_printed) {
+		print_summary_csv_header(outf);
+		csv_header_printed = true;
+	}
+	/* A summary is printed as a single line of JSON.  */
+	if (summary_format == SUMMARY_FORMAT_JSON)
+		fprintf(outf, "{\"timestamp\":%lld,\"interval\":%u"
+			",\"sample_rate\":%u,\"personalities\":[",
+			summary_timestamp, summary_length, sample_rate);
 
 	for (i = 0; i < SUPPORTED_PERSONALITIES; ++i) {
-		if (!countv[i])
+		if (!tables[i])
 			continue;
 
 		if (current_personality != i)
 			set_personality(i);
-		if (i)
+		if (summary_format == SUMMARY_FORMAT_JSON && !first)
+			fputc(',', outf);
+		else if (i && summary_format == SUMMARY_FORMAT_TEXT)
 			fprintf(outf,
 				"System call usage summary for %d bit mode:\n",
 				current_wordsize * 8);
 		call_summary_pers(outf);
+		first = false;
 	}
 
+	if (summary_format == SUMMARY_FORMAT_JSON)
+		fprintf(outf, "]}\n");
+
 	if (old_pers != current_personality)
 		set_personality(old_pers);
+
+	summary_countv = countv;
+}
+
+static int
+pid_counts_cmp(const void *a, const void *b)
+{
+	const struct pid_counts *const x = *(const struct pid_counts **) a;
+	const struct pid_counts *const y = *(const struct pid_counts **) b;
+
+	return (x->time_ns < y->time_ns) ? 1 : (x->time_ns > y->time_ns) ? -1
+	     : (x->calls < y->calls) ? 1 : (x->calls > y->calls) ? -1
+	     : x->pid - y->pid;
+}
+
+/* Print summaries of the summary_pids busiest tracees. */
+static void
+pid_summaries(FILE *outf)
+{
+	struct pid_counts **sorted;
+	struct pid_counts *pc;
+	unsigned int i = 0;
+
+	if (!pid_counts_count)
+		return;
+
+	sorted = xcalloc(pid_counts_count, sizeof(sorted[0]));
+	for (pc = pid_counts_list; pc; pc = pc->next)
+		sorted[i++] = pc;
+	sort_top(sorted, pid_counts_count, sizeof(sorted[0]), summary_pids,
+		 pid_counts_cmp);
+
+	for (i = 0; i < pid_counts_count && i < summary_pids; ++i) {
+		fprintf(outf, "\nSystem call usage summary for pid %d (%s):\n",
+			sorted[i]->pid, sorted[i]->comm);
+		print_summaries(outf, sorted[i]->countv);
+	}
+
+	free(sorted);
+}
+
+void
+call_summary(FILE *outf)
+{
+	summary_timestamp = time(NULL);
+	summary_length = 0;
+	print_summaries(outf, countv);
+
+	/* Machine formats have syscall statistics only.  */
+	if (summary_format != SUMMARY_FORMAT_TEXT)
+		return;
+
+	if (sample_rate > 1)
+		fprintf(outf, "\nSampled 1 in %u syscalls of each process,"
+			" calls, errors, and times are extrapolated\n",
+			sample_rate);
+
+	if (overhead_calibrated)
+		fprintf(outf, "\nSubtracted tracer overhead of %.3f usecs per"
+			" syscall (95%% confidence interval +/- %.3f usecs),"
+			" entry stops cost %.3f usecs\n",
+			overhead_ns / 1e3, overhead_ci_ns / 1e3,
+			entry_overhead_ns / 1e3);
+
+	if (signals_counted)
+		signal_summary(outf);
+
+	if (restart_list)
+		restart_summary(outf);
+
+	if (summary_pids)
+		pid_summaries(outf);
+
+	if (summary_io)
+		io_summary(outf);
+
+	if (summary_access)
+		access_summary(outf);
+
+	if (summary_flows)
+		flow_summary(outf);
+
+	if (summary_connects)
+		connect_summary(outf);
+
+	if (summary_fds)
+		fd_summary(outf);
+
+	if (summary_futex)
+		futex_summary(outf);
+
+	if (summary_ipc)
+		ipc_summary(outf);
+
+	if (summary_handoff)
+		handoff_summary(outf);
+
+	if (summary_aio)
+		aio_summary(outf);
+
+	if (summary_epoll)
+		epoll_summary(outf);
+
+	if (summary_v4l2)
+		v4l2_summary(outf);
+
+	if (summary_notify)
+		notify_summary(outf);
+
+	if (summary_mmap)
+		mmap_summary(outf);
+
+	if (summary_sync)
+		sync_summary(outf);
+
+	if (summary_oversleep)
+		oversleep_summary(outf);
+
+	if (summary_sigdelivery)
+		sigdelivery_summary(outf);
+
+	if (summary_args)
+		args_summary(outf);
+
+	if (summary_threads)
+		thread_summary(outf);
+
+	if (summary_rusage)
+		rusage_summary(outf);
+
+	if (summary_stops)
+		stop_summary(outf);
+
+#ifdef USE_LIBUNWIND
+	if (stack_trace_enabled)
+		site_summary(outf);
+#endif
+}
+
+static int
+top_row_cmp(const void *a, const void *b)
+{
+	const struct summary_row *const x = a;
+	const struct summary_row *const y = b;
+
+	return uint64_cmp_desc(x->cc->calls, y->cc->calls)
+	       ?: uint64_cmp_desc(x->cc->time_ns, y->cc->time_ns)
+	       ?: strcmp(x->name, y->name);
+}
+
+static int
+top_pid_cmp(const void *a, const void *b)
+{
+	const struct pid_counts *const x = *(const struct pid_counts **) a;
+	const struct pid_counts *const y = *(const struct pid_counts **) b;
+
+	return uint64_cmp_desc(x->interval_calls, y->interval_calls)
+	       ?: x->pid - y->pid;
+}
+
+/*
+ * Print the --top screen: the syscalls of the last interval sorted
+ * by their rate, with error rates and latency percentiles, followed
+ * by the busiest tracees.  Unless limited by --summary-top,
+ * the table is cut to the height of the terminal.
+ */
+static void
+top_summary(FILE *outf)
+{
+	const double secs = summary_interval;
+	const bool tty = isatty(fileno(outf));
+	struct summary_row *rows;
+	struct pid_counts **pids = NULL;
+	struct pid_counts *pc;
+	unsigned int nrows = 0, n = 0, npids = 0, limit = summary_top;
+	unsigned int p, i;
+	uint64_t calls = 0, errors = 0;
+	const time_t t = summary_timestamp;
+	char str[sizeof("HH:MM:SS")];
+	struct winsize ws;
+
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		if (interval_countv[p])
+			nrows += nsyscall_vec[p];
+	}
+	rows = xcalloc(nrows ?: 1, sizeof(*rows));
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		if (!interval_countv[p])
+			continue;
+		for (i = 0; i < nsyscall_vec[p]; ++i) {
+			const struct call_counts *const cc =
+				&interval_countv[p][i];
+
+			if (!cc->calls)
+				continue;
+			calls += cc->calls;
+			errors += cc->errors;
+			rows[n].cc = cc;
+			rows[n].name = sysent_vec[p][i].sys_name;
+			rows[n].scno = i;
+			++n;
+		}
+	}
+
+	if (pid_counts_count) {
+		pids = xcalloc(pid_counts_count, sizeof(*pids));
+		for (pc = pid_counts_list; pc; pc = pc->next) {
+			if (pc->interval_calls)
+				pids[npids++] = pc;
+		}
+		npids = MIN(npids, TOP_PIDS);
+		sort_top(pids, npids, sizeof(*pids), npids, top_pid_cmp);
+	}
+
+	/* The header, the column titles, and the process table.  */
+	if (!limit && tty && !ioctl(fileno(outf), TIOCGWINSZ, &ws)
+	    && ws.ws_row > 4 + (npids ? npids + 2 : 0))
+		limit = ws.ws_row - 4 - (npids ? npids + 2 : 0);
+	if (limit && limit < n) {
+		sort_top(rows, n, sizeof(*rows), limit, top_row_cmp);
+		n = limit;
+	} else {
+		qsort(rows, n, sizeof(*rows), top_row_cmp);
+	}
+
+	if (tty)
+		fputs("\033[H\033[2J", outf);
+	strftime(str, sizeof(str), "%H:%M:%S", localtime(&t));
+	fprintf(outf, "strace top - %s, %.1f calls/s, %.1f errors/s\n\n",
+		str, calls / secs, errors / secs);
+
+	fprintf(outf, "%10s %7s %10s %10s %10s %s\n", "calls/s", "errors%",
+		"p50 usecs", "p99 usecs", "max usecs", "syscall");
+	for (i = 0; i < n; ++i) {
+		const struct call_counts *const cc = rows[i].cc;
+
+		fprintf(outf, "%10.1f %7.2f %10" PRIu64 " %10" PRIu64
+			" %10" PRIu64 " %s\n",
+			cc->calls / secs, 100.0 * cc->errors / cc->calls,
+			hist_percentile(cc, 500) / 1000,
+			hist_percentile(cc, 990) / 1000,
+			cc->max_ns / 1000, rows[i].name);
+	}
+
+	if (npids) {
+		fprintf(outf, "\n%10s %7s %s\n", "calls/s", "pid", "command");
+		for (i = 0; i < npids; ++i)
+			fprintf(outf, "%10.1f %7d %s\n",
+				pids[i]->interval_calls / secs, pids[i]->pid,
+				pids[i]->comm);
+	}
+	for (pc = pid_counts_list; pc; pc = pc->next)
+		pc->interval_calls = 0;
+
+	free(pids);
+	free(rows);
+}
+
+/*
+ * Print statistics gathered since the previous call and start over.
+ */
+void
+call_summary_interval(FILE *outf)
+{
+	char str[sizeof("YYYY-MM-DD HH:MM:SS")];
+	const time_t t = time(NULL);
+	unsigned int i, j;
+
+	summary_timestamp = t;
+	summary_length = summary_interval;
+	if (top_mode) {
+		top_summary(outf);
+	} else {
+		if (summary_format == SUMMARY_FORMAT_TEXT) {
+			strftime(str, sizeof(str), "%Y-%m-%d %H:%M:%S",
+				 localtime(&t));
+			fprintf(outf, "System call usage summary at %s"
+				" for the last %u seconds:\n",
+				str, summary_interval);
+		}
+		print_summaries(outf, interval_countv);
+	}
+	fflush(outf);
+
+	for (i = 0; i < SUPPORTED_PERSONALITIES; ++i) {
+		if (!interval_countv[i])
+			continue;
+		for (j = 0; j < nsyscall_vec[i]; ++j)
+			free(interval_countv[i][j].hist);
+		free(interval_countv[i]);
+		interval_countv[i] = NULL;
+	}
 }
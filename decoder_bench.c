@@ -0,0 +1,532 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Decoder microbenchmarks (--bench-decoders option).
+ *
+ * Syscall decoders are run on a fake tcb whose memory is a prepared image
+ * served by a memory source, so the cost of formatting is measured apart
+ * from the cost of ptrace stops and of reading the memory of a tracee.
+ * Each case decodes the entering and, unless the decoder is done by then,
+ * the exiting of a syscall with fixed arguments and return value; the time
+ * per decode and the number of bytes printed are reported.
+ */
+
+#include "defs.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <linux/ioctl.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/types.h>
+#include <linux/videodev2.h>
+#ifdef HAVE_LINUX_BTRFS_H
+# include <linux/btrfs.h>
+#endif
+#include "mem_source.h"
+#include "syscall.h"
+
+#define DEFAULT_BENCH_ITERATIONS 10000
+
+/* The first address of the memory image, anything non-zero will do.  */
+#define IMAGE_BASE 0x10000000
+
+struct bench_case {
+	const char *name;
+	/* Prepare the arguments and the memory image, false to skip.  */
+	bool (*prepare)(struct bench_case *);
+	int sen;
+	kernel_ulong_t args[MAX_ARGS];
+	kernel_long_t rval;
+};
+
+static struct mem_source *image;
+static kernel_ulong_t image_next;
+
+/*
+ * Add LEN bytes of DATA to the image and return their address.  Data is
+ * padded with zeroes to 16 bytes, so that adjacent data stays contiguous.
+ */
+static kernel_ulong_t
+image_put(const void *const data, const unsigned int len)
+{
+	const unsigned int size = (len + 15) & ~15U;
+	const kernel_ulong_t addr = image_next;
+	char *const buf = xcalloc(1, size ?: 16);
+
+	memcpy(buf, data, len);
+	mem_source_records_add(image, addr, buf, size ?: 16);
+	free(buf);
+	image_next += size ?: 16;
+	return addr;
+}
+
+static kernel_ulong_t
+image_put_str(const char *const str)
+{
+	return image_put(str, strlen(str) + 1);
+}
+
+/* Add a NULL-terminated array of strings, return the address of it.  */
+static kernel_ulong_t
+image_put_strv(const char *const *const strv)
+{
+	kernel_ulong_t ptrs[32];
+	unsigned int n;
+
+	for (n = 0; strv[n] && n < ARRAY_SIZE(ptrs) - 1; ++n)
+		ptrs[n] = image_put_str(strv[n]);
+	ptrs[n] = 0;
+
+	if (current_wordsize == sizeof(kernel_ulong_t))
+		return image_put(ptrs, (n + 1) * sizeof(ptrs[0]));
+
+	uint32_t ptrs32[ARRAY_SIZE(ptrs)];
+	unsigned int i;
+
+	for (i = 0; i <= n; ++i)
+		ptrs32[i] = ptrs[i];
+	return image_put(ptrs32, (n + 1) * sizeof(ptrs32[0]));
+}
+
+static void *
+image_ptr(const kernel_ulong_t addr)
+{
+	return (void *) (uintptr_t) addr;
+}
+
+static bool
+prepare_openat(struct bench_case *const c)
+{
+	c->args[0] = (kernel_ulong_t) (kernel_long_t) AT_FDCWD;
+	c->args[1] = image_put_str("/usr/lib/x86_64-linux-gnu/libc.so.6");
+	c->args[2] = O_RDONLY | O_CLOEXEC;
+	c->rval = 3;
+	return true;
+}
+
+static bool
+prepare_execve(struct bench_case *const c)
+{
+	static const char *const argv[] = {
+		"/usr/bin/gcc", "-O2", "-Wall", "-c", "-o", "decoder_bench.o",
+		"decoder_bench.c", NULL
+	};
+	static const char *const envp[] = {
+		"HOME=/home/user", "LANG=C.UTF-8", "LOGNAME=user",
+		"PATH=/usr/local/bin:/usr/bin:/bin", "PWD=/home/user/strace",
+		"SHELL=/bin/bash", "TERM=xterm-256color", "USER=user", NULL
+	};
+
+	c->args[0] = image_put_str(argv[0]);
+	c->args[1] = image_put_strv(argv);
+	c->args[2] = image_put_strv(envp);
+	return true;
+}
+
+static bool
+prepare_sendmsg(struct bench_case *const c)
+{
+	static const char head[] = "GET / HTTP/1.1\r\n";
+	static const char body[] = "Host: localhost\r\nAccept: */*\r\n\r\n";
+	const int fds[] = { 4, 5, 6 };
+	const struct ucred cred = { .pid = 1234, .uid = 1000, .gid = 1000 };
+	union {
+		char buf[CMSG_SPACE(sizeof(fds)) + CMSG_SPACE(sizeof(cred))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr mh = {
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf),
+	};
+	struct cmsghdr *cmsg;
+
+	if (current_wordsize != sizeof(long))
+		return false;
+
+	memset(&control, 0, sizeof(control));
+	cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	cmsg = CMSG_NXTHDR(&mh, cmsg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_CREDENTIALS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(cred));
+	memcpy(CMSG_DATA(cmsg), &cred, sizeof(cred));
+
+	const struct iovec iov[] = {
+		{ image_ptr(image_put(head, sizeof(head) - 1)),
+		  sizeof(head) - 1 },
+		{ image_ptr(image_put(body, sizeof(body) - 1)),
+		  sizeof(body) - 1 },
+	};
+
+	mh.msg_iov = image_ptr(image_put(iov, sizeof(iov)));
+	mh.msg_iovlen = ARRAY_SIZE(iov);
+	mh.msg_control = image_ptr(image_put(&control, sizeof(control)));
+
+	c->args[0] = 3;
+	c->args[1] = image_put(&mh, sizeof(mh));
+	c->args[2] = MSG_NOSIGNAL;
+	c->rval = sizeof(head) - 1 + sizeof(body) - 1;
+	return true;
+}
+
+/*
+ * A part of an RTM_GETLINK dump: the netlink protocol of the descriptor
+ * is looked up, so the descriptor is a real NETLINK_ROUTE socket.
+ */
+static bool
+prepare_netlink(struct bench_case *const c)
+{
+	static const char *const names[] = { "lo", "eth0", "eth1", "wlan0" };
+	char buf[1024];
+	unsigned int len = 0, i;
+
+	const int fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+
+	if (fd < 0)
+		return false;
+
+	memset(buf, 0, sizeof(buf));
+	for (i = 0; i < ARRAY_SIZE(names); ++i) {
+		struct nlmsghdr *const nlh = (void *) (buf + len);
+		struct ifinfomsg *const ifi = NLMSG_DATA(nlh);
+		struct rtattr *rta = (void *) ((char *) ifi
+					       + NLMSG_ALIGN(sizeof(*ifi)));
+		const uint32_t mtu = i ? 1500 : 65536;
+
+		ifi->ifi_family = AF_UNSPEC;
+		ifi->ifi_type = i ? ARPHRD_ETHER : ARPHRD_LOOPBACK;
+		ifi->ifi_index = i + 1;
+		ifi->ifi_flags = IFF_UP | IFF_RUNNING | (i ? 0 : IFF_LOOPBACK);
+
+		rta->rta_type = IFLA_IFNAME;
+		rta->rta_len = RTA_LENGTH(strlen(names[i]) + 1);
+		strcpy(RTA_DATA(rta), names[i]);
+		rta = (void *) ((char *) rta + RTA_ALIGN(rta->rta_len));
+		rta->rta_type = IFLA_MTU;
+		rta->rta_len = RTA_LENGTH(sizeof(mtu));
+		memcpy(RTA_DATA(rta), &mtu, sizeof(mtu));
+		rta = (void *) ((char *) rta + RTA_ALIGN(rta->rta_len));
+
+		nlh->nlmsg_len = (char *) rta - (char *) nlh;
+		nlh->nlmsg_type = RTM_NEWLINK;
+		nlh->nlmsg_flags = NLM_F_MULTI;
+		nlh->nlmsg_seq = 1;
+		nlh->nlmsg_pid = 1234;
+		len += NLMSG_ALIGN(nlh->nlmsg_len);
+	}
+
+	struct nlmsghdr *const done = (void *) (buf + len);
+
+	done->nlmsg_len = NLMSG_LENGTH(sizeof(int));
+	done->nlmsg_type = NLMSG_DONE;
+	done->nlmsg_flags = NLM_F_MULTI;
+	done->nlmsg_seq = 1;
+	done->nlmsg_pid = 1234;
+	len += NLMSG_ALIGN(done->nlmsg_len);
+
+	c->args[0] = fd;
+	c->args[1] = image_put(buf, len);
+	c->args[2] = sizeof(buf);
+	c->rval = len;
+	return true;
+}
+
+static bool
+prepare_v4l2(struct bench_case *const c)
+{
+	struct v4l2_buffer b;
+
+	if (current_wordsize != sizeof(long))
+		return false;
+
+	memset(&b, 0, sizeof(b));
+	b.index = 2;
+	b.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	b.bytesused = 614400;
+	b.flags = V4L2_BUF_FLAG_MAPPED | V4L2_BUF_FLAG_DONE;
+	b.field = V4L2_FIELD_NONE;
+	b.timestamp.tv_sec = 1234;
+	b.timestamp.tv_usec = 567890;
+	b.sequence = 42;
+	b.memory = V4L2_MEMORY_MMAP;
+	b.m.offset = 2 * 614400;
+	b.length = 614400;
+
+	c->args[0] = 3;
+	c->args[1] = VIDIOC_DQBUF;
+	c->args[2] = image_put(&b, sizeof(b));
+	return true;
+}
+
+static bool
+prepare_btrfs(struct bench_case *const c)
+{
+#ifdef HAVE_LINUX_BTRFS_H
+	struct btrfs_ioctl_search_args args;
+	unsigned int off = 0, i;
+
+	memset(&args, 0, sizeof(args));
+	args.key.tree_id = 5;
+	args.key.max_objectid = (uint64_t) -1;
+	args.key.max_offset = (uint64_t) -1;
+	args.key.max_transid = (uint64_t) -1;
+	args.key.min_type = 1;
+	args.key.max_type = 1;
+	args.key.nr_items = 8;
+
+	for (i = 0; i < args.key.nr_items; ++i) {
+		const struct btrfs_ioctl_search_header sh = {
+			.transid = 100 + i,
+			.objectid = 256 + i,
+			.offset = 0,
+			.type = 1,
+			.len = 16,
+		};
+
+		memcpy(args.buf + off, &sh, sizeof(sh));
+		off += sizeof(sh) + sh.len;
+	}
+
+	c->args[0] = 3;
+	c->args[1] = BTRFS_IOC_TREE_SEARCH;
+	c->args[2] = image_put(&args, sizeof(args));
+	return true;
+#else
+	return false;
+#endif
+}
+
+static bool
+prepare_epoll_wait(struct bench_case *const c)
+{
+	struct epoll_event ev[8];
+	unsigned int i;
+
+	memset(ev, 0, sizeof(ev));
+	for (i = 0; i < ARRAY_SIZE(ev); ++i) {
+		ev[i].events = EPOLLIN | (i & 1 ? EPOLLOUT : 0);
+		ev[i].data.u64 = i + 4;
+	}
+
+	c->args[0] = 3;
+	c->args[1] = image_put(ev, sizeof(ev));
+	c->args[2] = 64;
+	c->args[3] = (kernel_ulong_t) -1;
+	c->rval = ARRAY_SIZE(ev);
+	return true;
+}
+
+static bool
+prepare_getdents64(struct bench_case *const c)
+{
+	static const char *const names[] = {
+		".", "..", "Makefile.am", "configure.ac", "defs.h", "strace.c",
+		"syscall.c", "util.c", "tests", "linux", "xlat", "README",
+		"NEWS", "COPYING", "strace.1.in", "decoder_bench.c"
+	};
+	char buf[1024];
+	unsigned int len = 0, i;
+
+	memset(buf, 0, sizeof(buf));
+	for (i = 0; i < ARRAY_SIZE(names); ++i) {
+		struct dirent64 *const d = (void *) (buf + len);
+		const unsigned int reclen =
+			(offsetof(struct dirent64, d_name)
+			 + strlen(names[i]) + 1 + 7) & ~7U;
+
+		d->d_ino = 1000 + i;
+		d->d_off = len + reclen;
+		d->d_reclen = reclen;
+		d->d_type = i < 2 || i == 8 || i == 9 || i == 10
+			    ? DT_DIR : DT_REG;
+		strcpy(d->d_name, names[i]);
+		len += reclen;
+	}
+
+	c->args[0] = 3;
+	c->args[1] = image_put(buf, len);
+	c->args[2] = sizeof(buf);
+	c->rval = len;
+	return true;
+}
+
+static struct bench_case cases[] = {
+	{ "openat", prepare_openat, SEN_openat },
+	{ "execve", prepare_execve, SEN_execve },
+	{ "sendmsg", prepare_sendmsg, SEN_sendmsg },
+	{ "netlink", prepare_netlink, SEN_recvfrom },
+	{ "v4l2", prepare_v4l2, SEN_ioctl },
+	{ "btrfs", prepare_btrfs, SEN_ioctl },
+	{ "epoll_wait", prepare_epoll_wait, SEN_epoll_wait },
+	{ "getdents64", prepare_getdents64, SEN_getdents64 },
+};
+
+static bool
+find_scno(const int sen, kernel_ulong_t *const scno)
+{
+	kernel_ulong_t i;
+
+	for (i = 0; i < nsyscalls; ++i) {
+		if (sysent[i].sen == sen && sysent[i].sys_func) {
+			*scno = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void
+decode_once(struct tcb *const tcp, const struct bench_case *const c)
+{
+	memcpy(tcp->u_arg, c->args, sizeof(tcp->u_arg));
+	tcp->flags &= ~TCB_INSYSCALL;
+	tcp->u_error = 0;
+	tcp->u_rval = 0;
+
+	const int res = tcp->s_ent->sys_func(tcp);
+
+	if (!(res & RVAL_DECODED)) {
+		tcp->flags |= TCB_INSYSCALL;
+		tcp->u_rval = c->rval;
+		tcp->s_ent->sys_func(tcp);
+	}
+
+	free_tcb_priv_data(tcp);
+	tcb_scratch_reset(tcp);
+}
+
+static void
+run_case(struct bench_case *const c, FILE *const fp,
+	 const unsigned int iterations)
+{
+	static struct tcb tcb;
+	struct tcb *const tcp = &tcb;
+	kernel_ulong_t scno;
+	struct timespec start, end;
+	unsigned int i;
+
+	image = mem_source_records_new();
+	image_next = IMAGE_BASE;
+	memset(c->args, 0, sizeof(c->args));
+	c->rval = 0;
+
+	if (!find_scno(c->sen, &scno) || !c->prepare(c)) {
+		printf("%-12s %12s\n", c->name, "skipped");
+		mem_source_free(image);
+		return;
+	}
+
+	tcp->pid = getpid();
+	tcp->scno = scno;
+	tcp->s_ent = &sysent[scno];
+	tcp->qual_flg = qual_flags(scno);
+	tcp->mem_source = image;
+	tcp->outf = fp;
+	set_current_tcp(tcp);
+
+	/* The first decode warms the caches up and counts the output.  */
+	rewind(fp);
+	decode_once(tcp, c);
+	const off_t bytes = ftello(fp);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; ++i) {
+		rewind(fp);
+		decode_once(tcp, c);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ts_sub(&end, &end, &start);
+
+	printf("%-12s %12.0f %8lld\n", c->name,
+	       (end.tv_sec * 1e9 + end.tv_nsec) / iterations,
+	       (long long) bytes);
+
+	if (c->sen == SEN_recvfrom)
+		close(c->args[0]);
+	fd_cache_free(tcp);
+	tcp->mem_source = NULL;
+	mem_source_free(image);
+}
+
+/*
+ * Run the cases named in NAMES, all of them if there are none,
+ * ITERATIONS times each, and exit.
+ */
+void
+decoder_bench(unsigned int iterations, char *const *const names,
+	      const unsigned int nnames)
+{
+#ifdef HAVE_OPEN_MEMSTREAM
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *const fp = open_memstream(&buf, &size);
+	unsigned int i, j;
+
+	if (!fp)
+		perror_msg_and_die("open_memstream");
+	if (!iterations)
+		iterations = DEFAULT_BENCH_ITERATIONS;
+
+	for (j = 0; j < nnames; ++j) {
+		for (i = 0; i < ARRAY_SIZE(cases); ++i) {
+			if (!strcmp(names[j], cases[i].name))
+				break;
+		}
+		if (i == ARRAY_SIZE(cases))
+			error_msg_and_die("unknown decoder benchmark '%s'",
+					  names[j]);
+	}
+
+	printf("%-12s %12s %8s\n", "decoder", "ns/decode", "bytes");
+	for (i = 0; i < ARRAY_SIZE(cases); ++i) {
+		for (j = 0; j < nnames; ++j) {
+			if (!strcmp(names[j], cases[i].name))
+				break;
+		}
+		if (nnames && j == nnames)
+			continue;
+		run_case(&cases[i], fp, iterations);
+	}
+
+	fclose(fp);
+	free(buf);
+	exit(0);
+#else
+	error_msg_and_die("--bench-decoders is not supported"
+			  " by this build of strace");
+#endif
+}
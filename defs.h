@@ -176,57 +176,131 @@ extern char *stpcpy(char *dst, const char *src);
 #endif
 
 typedef struct ioctlent {
-	const char *symbol;
 	unsigned int code;
+	unsigned int name;	/* offset of the name in ioctl_names */
 } struct_ioctlent;
 
 #define INJECT_F_SIGNAL 1
 #define INJECT_F_RETVAL 2
+#define INJECT_F_DELAY_ENTER 4
+#define INJECT_F_DELAY_EXIT 8
 
 struct inject_data {
 	uint16_t flags;
 	uint16_t signo;
 	int rval;
+	unsigned int delay_enter;	/* Delays in microseconds */
+	unsigned int delay_exit;
 };
 
+/* Injection probability is measured in millionths */
+#define INJECT_PROB_SCALE	1000000
+
 struct inject_opts {
 	uint16_t first;
 	uint16_t step;
+	uint32_t prob;		/* 0 means always */
+	uint32_t rate;		/* Max injections per second, 0 means unlimited */
+	uint64_t rate_tat;	/* Rate limiter theoretical arrival time, ns */
+	struct path_set *paths;	/* Inject only if a syscall matches these */
 	struct inject_data data;
 };
 
+/* Per-tcb countdown of an injected syscall.  */
+struct inject_counter {
+	unsigned int scno;
+	uint16_t first;
+};
+
 #define MAX_ERRNO_VALUE			4095
 
+/*
+ * Syscall tampering state of a tcb, allocated by get_tcb_inject
+ * only for tracees that invoke injected syscalls.
+ */
+struct tcb_inject {
+	/* Sorted by scno, only for the injected syscalls invoked so far */
+	struct inject_counter *counters[SUPPORTED_PERSONALITIES];
+	unsigned int ncounters[SUPPORTED_PERSONALITIES];
+	struct timespec delay_expiration; /* End of the injected delay */
+	unsigned int delay_idx;	/* Position in the queue of delayed tcbs */
+	unsigned int delay_restart_sig; /* Signal to restart with after delay */
+};
+
+/*
+ * The last syscall line printed for a tcb and its repetitions folded
+ * since then, allocated for tracees with --fold-repeats.
+ */
+struct tcb_repeat {
+	uint64_t key;		/* Hash of scno, arguments and result */
+	uint64_t hash;		/* Hash of the line without leader and time */
+	const struct_sysent *s_ent; /* The syscall of the line */
+	unsigned long count;	/* Repetitions folded so far */
+	struct timespec start;	/* Entry time of the printed line */
+	struct timespec end;	/* Exit time of the last repetition */
+	/* Offsets in the deferred output of the line being printed */
+	int text_start;		/* End of the line leader */
+	int time_start;		/* Start of the -T time */
+	int time_end;		/* End of the -T time */
+};
+
 /* Trace Control Block */
 struct tcb {
+	/*
+	 * Fields used on every stop and by pid lookups come first,
+	 * so they share the first cache lines of the tcb.
+	 */
 	int flags;		/* See below for TCB_ values */
 	int pid;		/* If 0, this tcb is free */
+	struct tcb *next_tcb;	/* Next tcb in the pid hash chain or free list */
 	int qual_flg;		/* qual_flags[scno] or DEFAULT_QUAL_FLAGS + RAW */
-	unsigned long u_error;	/* Error code */
-	kernel_ulong_t scno;	/* System call number */
-	kernel_ulong_t u_arg[MAX_ARGS];	/* System call arguments */
-	kernel_long_t u_rval;	/* Return value */
-#if SUPPORTED_PERSONALITIES > 1
+#if ARCH_PERSONALITIES > 1
 	unsigned int currpers;	/* Personality at the time of scno update */
 #endif
 	int sys_func_rval;	/* Syscall entry parser's return value */
 	int curcol;		/* Output column for this process */
-	FILE *outf;		/* Output file for this process */
+	const struct_sysent *s_ent; /* sysent[scno] or dummy struct for bad scno */
+	kernel_ulong_t scno;	/* System call number */
+	kernel_ulong_t u_arg[MAX_ARGS];	/* System call arguments */
+	kernel_long_t u_rval;	/* Return value */
+	unsigned long u_error;	/* Error code */
 	const char *auxstr;	/* Auxiliary info from syscall (see RVAL_STR) */
+	FILE *outf;		/* Output file for this process */
+	struct timespec etime;	/* Syscall entry time (CLOCK_MONOTONIC) */
 	void *_priv_data;	/* Private data for syscall decoding functions */
 	void (*_free_priv_data)(void *); /* Callback for freeing priv_data */
-	const struct_sysent *s_ent; /* sysent[scno] or dummy struct for bad scno */
+	struct scratch_chunk *_scratch; /* Scratch memory of syscall decoders */
 	const struct_sysent *s_prev_ent; /* for "resuming interrupted SYSCALL" msg */
-	struct inject_opts *inject_vec[SUPPORTED_PERSONALITIES];
+	struct fd_cache *fd_cache; /* Paths of descriptors, see getfdpath */
+	int tgid;		/* Thread group id, 0 if not read yet */
+
+	/* Fields used by particular options or on rare events */
+	unsigned int sample_count; /* Traced syscalls since the last sampled */
+	char *outbuf;		/* Buffer of outf allocated by strace, if any */
+	struct output_log *outlog; /* Rotation state of outf, if any */
+	FILE *deferred_outf;	/* Buffer for output held back by -z, --filter */
+	char *deferred_buf;	/* Contents of deferred_outf */
+	size_t deferred_size;	/* Size of deferred_buf */
+	struct tcb_inject *inj;	/* Syscall tampering state, if any */
+	struct tcb_repeat *rep;	/* --fold-repeats state, if any */
+	struct mem_source *mem_source; /* Memory read instead of the process */
 	struct timeval stime;	/* System time usage as of last process wait */
 	struct timeval dtime;	/* Delta for system time usage */
-	struct timeval etime;	/* Syscall entry time */
+	struct timespec json_time; /* Syscall entry time for --json */
+	struct pid_counts *pid_counts; /* -c statistics of this tcb */
+	struct thread_counts *thread_counts; /* --summary-threads times */
+	struct timespec stop_ts; /* Start of the ptrace stop (--summary-stops) */
+	unsigned int stop_kind;	/* enum stop_kind of the ptrace stop */
+	int64_t sleep_ns;	/* Timeout of the syscall, if positive */
+	struct oversleep_counts *oversleep_counts; /* --summary-oversleep */
+	struct rusage_counts *rusage_counts; /* --summary-rusage */
+	unsigned int restart_pers; /* The syscall of TCB_RESTART_PENDING */
+	kernel_ulong_t restart_scno;
+	uint64_t restart_ns;	/* Its time before the interruption */
 
 #ifdef USE_LIBUNWIND
 	struct UPT_info *libunwind_ui;
-	struct mmap_cache_t *mmap_cache;
-	unsigned int mmap_cache_size;
-	unsigned int mmap_cache_generation;
+	struct address_space_t *address_space; /* Shared mmap cache */
 	struct queue_t *queue;
 #endif
 };
@@ -253,6 +327,19 @@ struct tcb {
 #define TCB_TAMPERED	0x40	/* A syscall has been tampered with */
 #define TCB_HIDE_LOG	0x80	/* We should hide everything (until execve) */
 #define TCB_SKIP_DETACH_ON_FIRST_EXEC	0x100	/* -b execve should skip detach on first execve */
+#define TCB_DELAYED	0x200	/* Restart of the tracee is delayed */
+#define TCB_DELAY_EXIT	0x400	/* Delay the tracee on syscall exit */
+#define TCB_DETACHING	0x800	/* Waiting for a stop to detach */
+#define TCB_FILTER_EXIT	0x1000	/* --filter is decided on syscall exit */
+#define TCB_DEFERRED_OUTPUT	0x2000	/* Output is held until syscall exit */
+#define TCB_GROUP_STOPPED	0x4000	/* The tracee is in group-stop */
+#define TCB_UNTRACED	0x8000	/* Excluded by --trace-{exec,threads} */
+#define TCB_TRIGGER_EXIT	0x10000	/* --trigger-error is checked on syscall exit */
+#define TCB_RATE_LIMITED	0x20000	/* Dropped by --rate-limit or --overhead-budget */
+#define TCB_HANDOFF	0x40000	/* To be handed off to another --shards tracer */
+#define TCB_RESTART_PENDING	0x80000	/* -c awaits the signal of an interrupted syscall */
+#define TCB_AUTO_ATTACHED	0x100000	/* New child attached by the kernel */
+#define TCB_ADOPTED	0x200000	/* Handed off by another --shards tracer */
 
 /* qualifier flags */
 #define QUAL_TRACE	0x001	/* this system call should be traced */
@@ -260,8 +347,9 @@ struct tcb {
 #define QUAL_VERBOSE	0x004	/* decode the structures of this syscall */
 #define QUAL_RAW	0x008	/* print all args in hex for this syscall */
 #define QUAL_INJECT	0x010	/* tamper with this system call on purpose */
+#define QUAL_STACK	0x020	/* capture the stack trace of this syscall (-k) */
 
-#define DEFAULT_QUAL_FLAGS (QUAL_TRACE | QUAL_ABBREV | QUAL_VERBOSE)
+#define DEFAULT_QUAL_FLAGS (QUAL_TRACE | QUAL_ABBREV | QUAL_VERBOSE | QUAL_STACK)
 
 #define entering(tcp)	(!((tcp)->flags & TCB_INSYSCALL))
 #define exiting(tcp)	((tcp)->flags & TCB_INSYSCALL)
@@ -271,6 +359,7 @@ struct tcb {
 #define abbrev(tcp)	((tcp)->qual_flg & QUAL_ABBREV)
 #define raw(tcp)	((tcp)->qual_flg & QUAL_RAW)
 #define inject(tcp)	((tcp)->qual_flg & QUAL_INJECT)
+#define stack_traced(tcp)	((tcp)->qual_flg & QUAL_STACK)
 #define filtered(tcp)	((tcp)->flags & TCB_FILTERED)
 #define hide_log(tcp)	((tcp)->flags & TCB_HIDE_LOG)
 
@@ -283,8 +372,10 @@ extern const struct xlat clocknames[];
 extern const struct xlat dirent_types[];
 extern const struct xlat ethernet_protocols[];
 extern const struct xlat evdev_abs[];
+extern const struct xlat fan_event_flags[];
 extern const struct xlat iffflags[];
 extern const struct xlat inet_protocols[];
+extern const struct xlat inotify_flags[];
 extern const struct xlat ip_type_of_services[];
 extern const struct xlat msg_flags[];
 extern const struct xlat netlink_protocols[];
@@ -363,10 +454,79 @@ typedef enum {
 	CFLAG_BOTH
 } cflag_t;
 extern cflag_t cflag;
+typedef enum {
+	EXECVE_ENV_FULL = 0,
+	EXECVE_ENV_SIZE,
+	EXECVE_ENV_HASH
+} execve_env_t;
+/* How the environment of execve is printed, see --execve-env option. */
+extern execve_env_t execve_env;
+/* Print mmsghdr vectors as statistics, see --mmsg-stats option. */
+extern bool mmsg_stats;
+/* Print each unique BPF program once, see --bpf-dedup option. */
+extern bool bpf_dedup;
+/* Decode inotify and fanotify event buffers, see --notify-events option. */
+extern bool notify_events;
 extern bool debug_flag;
 extern bool Tflag;
+/* Number of fractional digits of printed times: 6 or 9 */
+extern unsigned int time_precision;
 extern bool iflag;
 extern bool count_wallclock;
+extern bool summary_latency;
+extern bool summary_histogram;
+/* Format of the -c summary, see --summary-format option. */
+enum summary_format {
+	SUMMARY_FORMAT_TEXT,
+	SUMMARY_FORMAT_CSV,
+	SUMMARY_FORMAT_JSON
+};
+extern enum summary_format summary_format;
+extern unsigned int summary_io;
+extern unsigned int summary_access;
+extern unsigned int summary_flows;
+extern unsigned int summary_connects;
+extern unsigned int summary_fds;
+extern unsigned int summary_futex;
+extern unsigned int summary_ipc;
+extern unsigned int summary_handoff;
+extern unsigned int summary_aio;
+extern unsigned int summary_epoll;
+extern unsigned int summary_v4l2;
+extern unsigned int summary_notify;
+extern unsigned int summary_mmap;
+extern unsigned int summary_sync;
+extern unsigned int summary_oversleep;
+extern unsigned int summary_sigdelivery;
+extern unsigned int summary_args;
+extern unsigned int summary_interval;
+extern unsigned int summary_pids;
+extern unsigned int summary_threads;
+extern unsigned int summary_rusage;
+extern unsigned int summary_stops;
+extern unsigned int summary_top;
+extern bool top_mode;
+#define DEFAULT_SUMMARY_PIDS 10
+#define DEFAULT_SUMMARY_IO 20
+#define DEFAULT_SUMMARY_ACCESS 20
+#define DEFAULT_SUMMARY_FLOWS 20
+#define DEFAULT_SUMMARY_CONNECTS 20
+#define DEFAULT_SUMMARY_FDS 20
+#define DEFAULT_SUMMARY_FUTEX 10
+#define DEFAULT_SUMMARY_IPC 10
+#define DEFAULT_SUMMARY_HANDOFF 10
+#define DEFAULT_SUMMARY_AIO 20
+#define DEFAULT_SUMMARY_EPOLL 10
+#define DEFAULT_SUMMARY_V4L2 10
+#define DEFAULT_SUMMARY_NOTIFY 10
+#define DEFAULT_SUMMARY_MMAP 10
+#define DEFAULT_SUMMARY_SYNC 10
+#define DEFAULT_SUMMARY_OVERSLEEP 10
+#define DEFAULT_SUMMARY_SIGDELIVERY 10
+#define DEFAULT_SUMMARY_ARGS_TOP 10
+#define DEFAULT_SUMMARY_THREADS 10
+#define DEFAULT_SUMMARY_RUSAGE 10
+#define DEFAULT_SUMMARY_STOPS 10
 extern unsigned int qflag;
 extern bool not_failing_only;
 extern unsigned int show_fd_path;
@@ -374,39 +534,214 @@ extern unsigned int show_fd_path;
 extern struct path_set {
 	const char **paths_selected;
 	unsigned int num_selected;
+	const char **hash;	/* Open addressing hash table of paths */
+	unsigned int hash_size;
+	struct path_glob *glob;	/* Patterns, NULL if none */
 } global_path_set;
 #define tracing_paths (global_path_set.num_selected != 0)
 extern unsigned xflag;
+/* Only every sample_rate'th traced syscall of a tcb is decoded */
+extern unsigned int sample_rate;
+/* Repeated syscall lines of a tcb are folded (--fold-repeats option) */
+extern bool fold_repeats;
 extern unsigned followfork;
+/* Lines of tracees are buffered separately (--complete-lines option) */
+extern bool complete_lines;
+/* Whether each tracee has its own output stream */
+#define tcb_output_separate() (followfork >= 2 || complete_lines)
 #ifdef USE_LIBUNWIND
 /* if this is true do the stack trace for every system call */
 extern bool stack_trace_enabled;
+extern bool stack_unwind_fp;
+extern bool stack_dedup;
+/* size of the stack copied by --stack-snapshot, 0 if disabled */
+extern unsigned int stack_snapshot_size;
+/* print build-ids and file offsets instead of symbols */
+extern bool stack_offline;
+/* directory of symbols kept across runs, NULL if disabled */
+extern const char *stack_cache_dir;
 #endif
 extern unsigned ptrace_setoptions;
 extern unsigned max_strlen;
+extern bool strlen_qualified;
+extern unsigned int qual_strlen(kernel_ulong_t scno);
+
+/* The -s limit of the current syscall of TCP, -e strlen may override it. */
+static inline unsigned int
+tcb_max_strlen(const struct tcb *const tcp)
+{
+	return strlen_qualified ? qual_strlen(tcp->scno) : max_strlen;
+}
 extern unsigned os_release;
 #undef KERNEL_VERSION
 #define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
 
 extern int read_int_from_file(const char *, int *);
+extern int get_proc_tgid(int pid);
+extern int get_tcb_tgid(struct tcb *);
+extern bool clone_creates_thread(const struct tcb *);
+extern void read_proc_comm(int pid, char *, size_t);
 
 extern void set_sortby(const char *);
 extern void set_overhead(int);
+extern void set_calibrated_overhead(uint64_t, uint64_t, uint64_t);
+extern void calibrate_overhead(void);
 extern void print_pc(struct tcb *);
 
 extern int syscall_entering_decode(struct tcb *);
 extern int syscall_entering_trace(struct tcb *, unsigned int *);
 extern void syscall_entering_finish(struct tcb *, int);
 
-extern int syscall_exiting_decode(struct tcb *, struct timeval *);
-extern int syscall_exiting_trace(struct tcb *, struct timeval, int);
+extern int syscall_exiting_decode(struct tcb *, struct timespec *);
+extern int syscall_exiting_trace(struct tcb *, struct timespec, int);
 extern void syscall_exiting_finish(struct tcb *);
 
-extern void count_syscall(struct tcb *, const struct timeval *);
+extern void count_syscall(struct tcb *, const struct timespec *);
+extern void count_syscall_raw(kernel_ulong_t, bool, uint64_t);
+extern void count_syscall_aggregate(kernel_ulong_t, uint64_t calls,
+				    uint64_t errors, uint64_t time_ns,
+				    uint64_t min_ns, uint64_t max_ns);
+extern void count_syscall_latency(kernel_ulong_t, uint64_t ns, uint64_t calls);
+/* The size of the largest record of export_counts */
+#define COUNTS_RECORD_MAX 4096
+extern void export_counts(void (*send)(const void *, size_t));
+extern void import_counts(const void *, size_t);
+extern void count_signal(unsigned int sig, bool stopped);
+extern void count_restart(struct tcb *, unsigned int sig);
+extern void count_mmap(struct tcb *, const struct timespec *);
+extern void mmap_summary(FILE *);
+extern void count_sync(struct tcb *, uint64_t);
+extern void sync_summary(FILE *);
+extern void count_oversleep_entry(struct tcb *);
+extern void count_oversleep(struct tcb *, uint64_t);
+extern void oversleep_summary(FILE *);
+extern void count_sigdelivery_entry(struct tcb *);
+extern void count_sigdelivery_exit(struct tcb *);
+extern void count_sigdelivery(struct tcb *, int sig, int code, int sender);
+extern void sigdelivery_summary(FILE *);
+extern bool add_summary_args(const char *);
+extern void count_args(struct tcb *);
+extern void args_summary(FILE *);
+extern void count_flow(struct tcb *, uint64_t);
+extern void flow_summary(FILE *);
+extern void count_connect(struct tcb *, uint64_t, const struct timespec *);
+extern void connect_summary(FILE *);
+extern void count_ipc(struct tcb *, uint64_t);
+extern void ipc_summary(FILE *);
+extern void count_fds(struct tcb *, const struct timespec *);
+extern void fd_summary(FILE *);
+extern void count_access(struct tcb *);
+extern void access_summary(FILE *);
+extern void count_handoff_entry(struct tcb *);
+extern void count_handoff(struct tcb *, const struct timespec *);
+extern void handoff_summary(FILE *);
+extern void count_epoll(struct tcb *, const struct timespec *);
+extern void epoll_summary(FILE *);
+extern void count_v4l2(struct tcb *, const struct timespec *);
+extern void v4l2_summary(FILE *);
+extern void count_notify(struct tcb *);
+extern void notify_summary(FILE *);
+extern bool decode_notify_events(struct tcb *, int fd, kernel_ulong_t addr,
+				 kernel_ulong_t len);
+extern void count_thread_stop(struct tcb *);
+extern void count_thread_resume(struct tcb *);
+extern void thread_summary(FILE *);
+struct rusage;
+extern void count_rusage_exiting(struct tcb *);
+extern void count_rusage(struct tcb *, const struct rusage *);
+extern void rusage_summary(FILE *);
+
+enum stop_kind {
+	STOP_SYSCALL_ENTRY,
+	STOP_SYSCALL_EXIT,
+	STOP_SIGNAL,
+	STOP_GROUP,
+	STOP_EVENT,
+
+	STOP_KINDS
+};
+extern void count_stop_begin(struct tcb *);
+extern void count_stop_end(struct tcb *);
+extern void stop_summary(FILE *);
+
+enum futex_op_kind {
+	FUTEX_OP_KIND_OTHER,
+	FUTEX_OP_KIND_WAIT,
+	FUTEX_OP_KIND_WAKE,
+};
+extern enum futex_op_kind futex_op_kind(unsigned int op);
+
+extern struct tcb_inject *get_tcb_inject(struct tcb *);
+extern void print_repeats(struct tcb *);
+
+/* Set if any delay injection has been requested */
+extern bool inject_delays;
+extern int delay_timer_init(void);
+extern void delay_tcb(struct tcb *, unsigned int usecs);
+extern void delay_queue_add(struct tcb *);
+extern void delay_queue_remove(struct tcb *);
+extern struct tcb *delay_queue_pop_expired(void);
+
+extern FILE *ring_open(FILE *, size_t);
+
+/*
+ * What -o unix:PATH, -o tcp:HOST:PORT, and --output-async do
+ * when the consumer falls behind.
+ */
+typedef enum {
+	OUTPUT_POLICY_BLOCK,
+	OUTPUT_POLICY_DROP,
+	OUTPUT_POLICY_SAMPLE,
+} output_policy_t;
+extern output_policy_t output_policy;
+extern size_t output_queue_size;
+extern bool is_socket_output(const char *);
+extern FILE *socket_output_open(const char *);
+extern int connect_unix(const char *);
+extern FILE *shm_output_open(const char *);
+
+extern bool output_async;
+extern FILE *async_open(FILE *, const char *name);
+extern void async_finish(void);
+
+extern unsigned int output_compress_level;
+extern FILE *compress_open(FILE *);
+extern void compress_finish(void);
+extern FILE *decompress_fopen(const char *);
+
+extern void merge_logs(const char *prefix) ATTRIBUTE_NORETURN;
+extern const char *parse_log_timestamp(const char *, unsigned long long *ts);
+extern void print_process_tree(const char *path) ATTRIBUTE_NORETURN;
+extern void summary_diff(const char *old_path, const char *new_path)
+	ATTRIBUTE_NORETURN;
+extern void summary_merge(char *const *paths, unsigned int npaths)
+	ATTRIBUTE_NORETURN;
+extern void replay_trace(const char *path, const char *dir, const char *data,
+			 bool fast) ATTRIBUTE_NORETURN;
+extern void ring_dump(void);
+extern void decoder_bench(unsigned int iterations, char *const *names,
+			  unsigned int nnames) ATTRIBUTE_NORETURN;
+extern bool rotate_all_output(void);
+extern bool print_current_summary(void);
+extern bool attach_pid(int pid);
+extern bool detach_pid(int pid);
+extern void leave_resident(void);
+extern int control_init(const char *path);
+extern int control_accept(int listen_fd, int conn_fd);
+extern bool control_input(int fd);
 extern void call_summary(FILE *);
+extern void call_summary_interval(FILE *);
+extern int perf_count_startup(char **argv);
+extern bool perf_count_poll(const sigset_t *);
+extern int perf_count_finish(int sig);
+extern int bpf_count_startup(char **argv, const char *cgroup);
+extern bool bpf_count_poll(const sigset_t *);
+extern int bpf_count_finish(int sig);
 
 extern void clear_regs(void);
 extern int get_scno(struct tcb *);
+extern kernel_ulong_t pause_scno(void);
+extern int syscall_set_scno(struct tcb *, kernel_ulong_t);
 extern kernel_ulong_t get_rt_sigframe_addr(struct tcb *);
 
 /**
@@ -428,6 +763,14 @@ extern int set_tcb_priv_data(struct tcb *, void *priv_data,
 			     void (*free_priv_data)(void *));
 extern void free_tcb_priv_data(struct tcb *);
 
+/*
+ * Allocate temporary memory for decoding the current syscall;
+ * it is released when the syscall decoding is finished.
+ */
+extern void *tcb_scratch_alloc(struct tcb *, size_t size);
+extern void tcb_scratch_reset(struct tcb *);
+extern void tcb_scratch_free(struct tcb *);
+
 static inline unsigned long get_tcb_priv_ulong(const struct tcb *tcp)
 {
 	return (unsigned long) get_tcb_priv_data(tcp);
@@ -456,6 +799,37 @@ umoven_or_printaddr_ignore_syserror(struct tcb *, kernel_ulong_t addr,
 extern int
 umovestr(struct tcb *, kernel_ulong_t addr, unsigned int len, char *laddr);
 
+struct umove_req {
+	kernel_ulong_t addr;
+	unsigned int len;
+	void *laddr;
+	unsigned int nread;
+};
+extern unsigned int
+umoven_batch(struct tcb *, struct umove_req *, unsigned int nreqs);
+
+struct umove_range {
+	kernel_ulong_t addr;
+	unsigned int len;
+};
+extern void
+umove_snapshot(struct tcb *, const struct umove_range *, unsigned int nranges);
+extern void
+umove_snapshot_strings(struct tcb *, const kernel_ulong_t *addrs, unsigned int n);
+extern void umove_cache_invalidate(void);
+
+/* Page-sized window of a large tracee buffer decoded sequentially.  */
+struct umove_window {
+	kernel_ulong_t addr;	/* Address of the tracee buffer */
+	kernel_ulong_t len;	/* Size of the tracee buffer */
+	kernel_ulong_t start;	/* Offset of the window in the buffer */
+	unsigned int size;	/* Number of bytes in the window */
+	char *buf;
+};
+extern const void *
+umove_window_get(struct tcb *, struct umove_window *,
+		 kernel_ulong_t offset, unsigned int size);
+
 extern int upeek(int pid, unsigned long, kernel_ulong_t *);
 extern int upoke(int pid, unsigned long, kernel_ulong_t);
 
@@ -491,6 +865,18 @@ extern bool pathtrace_match_set(struct tcb *, struct path_set *);
 #define pathtrace_match(tcp)	\
 	pathtrace_match_set(tcp, &global_path_set)
 extern int getfdpath(struct tcb *, int, char *, unsigned);
+extern void fd_cache_syscall_hook(const struct tcb *);
+extern void fd_cache_free(struct tcb *);
+extern bool file_deps_enabled(void);
+/* Whether anything relies on paths cached by getfdpath. */
+#define fd_cache_in_use \
+	(tracing_paths || show_fd_path || summary_io || summary_access \
+	 || summary_flows \
+	 || summary_fds || summary_handoff || summary_notify || summary_sync \
+	 || notify_events \
+	 || file_deps_enabled())
+extern bool fd_cache_get_proto(const struct tcb *, int, enum sock_proto *);
+extern void fd_cache_set_proto(struct tcb *, int, enum sock_proto);
 extern unsigned long getfdinode(struct tcb *, int);
 extern enum sock_proto getfdproto(struct tcb *, int);
 
@@ -503,10 +889,12 @@ void dyxlat_free(struct dyxlat *);
 const struct xlat *dyxlat_get(const struct dyxlat *);
 void dyxlat_add_pair(struct dyxlat *, uint64_t val, const char *str, size_t len);
 
-const struct xlat *genl_families_xlat(void);
+extern const char *genl_family_name(uint16_t id);
 
 extern unsigned long get_pagesize(void);
 extern int next_set_bit(const void *bit_array, unsigned cur_bit, unsigned size_bits);
+extern void sort_top(void *base, size_t nmemb, size_t size, size_t n,
+		     int (*cmp)(const void *, const void *));
 
 /*
  * Returns STR if it does not start with PREFIX,
@@ -602,6 +990,8 @@ decode_inet_addr(struct tcb *, kernel_ulong_t addr,
 		 unsigned int len, int family, const char *var_name);
 extern const char *get_sockaddr_by_inode(struct tcb *, int fd, unsigned long inode);
 extern bool print_sockaddr_by_inode(struct tcb *, int fd, unsigned long inode);
+extern void printfd_batch_begin(void);
+extern void printfd_batch_end(void);
 extern void print_dirfd(struct tcb *, int);
 
 extern int
@@ -656,6 +1046,64 @@ extern void print_ifindex(unsigned int);
 
 extern void qualify(const char *);
 extern unsigned int qual_flags(const unsigned int);
+extern bool filter_expr_in_use;
+extern bool filter_expr_timed;
+extern void filter_expr_parse(const char *);
+extern bool filter_expr_entering(struct tcb *);
+extern bool filter_expr_exiting(struct tcb *, const struct timespec *);
+extern void qualify_ring_trigger(const char *);
+extern void qualify_ring_trigger_error(const char *);
+extern bool ring_triggered(const struct tcb *);
+extern void qualify_trigger(const char *);
+extern void qualify_trigger_error(const char *);
+extern void qualify_trigger_signal(const char *);
+extern bool trigger_syscall_matches(const struct tcb *);
+extern bool trigger_errors_in_use(void);
+extern bool trigger_error_matches(const struct tcb *);
+extern bool trigger_signal_matches(unsigned int);
+
+/* trigger.c */
+extern bool triggers_in_use;
+extern void trigger_on_syscalls(void);
+extern void trigger_select_path(const char *);
+extern void trigger_on_signals(void);
+extern bool parse_trigger_window(const char *);
+extern bool trigger_quiet(void);
+extern bool trigger_skips(const struct tcb *);
+extern bool trigger_entering(struct tcb *);
+extern bool trigger_exiting(struct tcb *);
+extern void trigger_signal(unsigned int);
+
+extern bool rate_limits_in_use;
+extern bool token_bucket_allows(unsigned int rate, uint64_t *tat, uint64_t now);
+extern bool parse_rate_limit(const char *);
+extern bool rate_limit_allows(struct tcb *);
+extern void rate_limit_finish(FILE *);
+
+extern bool terse_rates_in_use;
+extern bool parse_terse_rate(const char *);
+extern void terse_rate_account(struct tcb *);
+
+/* governor.c */
+enum governor_level {
+	GOVERNOR_FULL,
+	GOVERNOR_TERSE,
+	GOVERNOR_SAMPLED,
+	GOVERNOR_MINIMAL,
+};
+extern unsigned int overhead_budget;
+extern enum governor_level governor_level;
+extern bool governor_report_pending;
+extern bool parse_overhead_budget(const char *);
+extern void governor_idle_begin(void);
+extern void governor_idle_end(void);
+extern void governor_report(struct tcb *);
+extern void governor_finish(FILE *);
+
+extern bool tracer_mlock;
+extern bool parse_tracer_cpus(const char *);
+extern bool parse_tracer_sched(const char *);
+extern void tracer_sched_apply(void);
 
 #define DECL_IOCTL(name)						\
 extern int								\
@@ -698,14 +1146,24 @@ extern void tv_add(struct timeval *, const struct timeval *, const struct timeva
 extern void tv_sub(struct timeval *, const struct timeval *, const struct timeval *);
 extern void tv_mul(struct timeval *, const struct timeval *, int);
 extern void tv_div(struct timeval *, const struct timeval *, int);
+extern int ts_nz(const struct timespec *);
+extern int ts_cmp(const struct timespec *, const struct timespec *);
+extern double ts_float(const struct timespec *);
+extern void ts_add(struct timespec *, const struct timespec *, const struct timespec *);
+extern void ts_sub(struct timespec *, const struct timespec *, const struct timespec *);
+extern long ts_frac(const struct timespec *);
 
 #ifdef USE_LIBUNWIND
 extern void unwind_init(void);
 extern void unwind_tcb_init(struct tcb *);
 extern void unwind_tcb_fin(struct tcb *);
 extern void unwind_cache_invalidate(struct tcb *);
+extern void unwind_cache_update(struct tcb *);
 extern void unwind_print_stacktrace(struct tcb *);
+extern void unwind_print_snapshot(struct tcb *);
 extern void unwind_capture_stacktrace(struct tcb *);
+extern unsigned int unwind_stack_id(struct tcb *);
+extern void unwind_print_folded_stack(FILE *, unsigned int);
 #endif
 
 static inline void
@@ -787,10 +1245,22 @@ extern void print_user_desc(struct tcb *, kernel_ulong_t addr);
  */
 extern struct tcb *printing_tcp;
 extern void printleader(struct tcb *);
+extern void set_current_tcp(struct tcb *);
+extern void defer_tcp_output(struct tcb *);
+extern void commit_deferred_output(struct tcb *);
+extern void write_deferred_output(struct tcb *, size_t);
+extern void discard_deferred_output(struct tcb *);
+extern size_t end_deferred_output(struct tcb *);
 extern void line_ended(void);
+extern void maybe_flush_tcp_output(const struct tcb *);
 extern void tabto(void);
 extern void tprintf(const char *fmt, ...) ATTRIBUTE_FORMAT((printf, 1, 2));
 extern void tprints(const char *str);
+extern void tprints_n(const char *str, size_t len);
+extern void tprint_int(long long);
+extern void tprint_uint(unsigned long long);
+extern void tprint_hex(unsigned long long);
+extern void tprint_field_name(const char *prefix, const char *name);
 extern void tprintf_comment(const char *fmt, ...) ATTRIBUTE_FORMAT((printf, 1, 2));
 extern void tprints_comment(const char *str);
 
@@ -948,23 +1418,20 @@ extern const struct_sysent sysent0[];
 extern const char *const errnoent0[];
 extern const char *const signalent0[];
 extern const struct_ioctlent ioctlent0[];
+extern const char *const ioctl_names0;
 
-#if SUPPORTED_PERSONALITIES > 1
-extern const struct_sysent *sysent;
-extern const char *const *errnoent;
-extern const char *const *signalent;
-extern const struct_ioctlent *ioctlent;
-#else
+#if SUPPORTED_PERSONALITIES == 1
 # define sysent     sysent0
 # define errnoent   errnoent0
 # define signalent  signalent0
 # define ioctlent   ioctlent0
-#endif
+# define ioctl_names ioctl_names0
 
 extern unsigned nsyscalls;
 extern unsigned nerrnos;
 extern unsigned nsignals;
 extern unsigned nioctlents;
+#endif
 
 extern const unsigned int nsyscall_vec[SUPPORTED_PERSONALITIES];
 extern const struct_sysent *const sysent_vec[SUPPORTED_PERSONALITIES];
@@ -982,6 +1449,45 @@ extern struct inject_opts *inject_vec[SUPPORTED_PERSONALITIES];
 # define MPERS_PRINTER_DECL(type, name, ...) type MPERS_FUNC_NAME(name)(__VA_ARGS__)
 #endif /* !IN_MPERS_BOOTSTRAP */
 
+#if SUPPORTED_PERSONALITIES > 1 && !defined IN_MPERS_BOOTSTRAP
+/*
+ * The tables of a personality.  When the current tracee runs
+ * in a different personality, set_personality switches all of them
+ * at once by changing current_tables.
+ */
+struct personality_tables {
+	const struct_sysent *sysent;
+	const char *const *errnoent;
+	const char *const *signalent;
+	const struct_ioctlent *ioctlent;
+	const char *ioctl_names;
+	const struct_printers *printers;
+	unsigned int nsyscalls;
+	unsigned int nerrnos;
+	unsigned int nsignals;
+	unsigned int nioctlents;
+	unsigned int wordsize;
+	unsigned int klongsize;
+};
+
+extern const struct personality_tables
+	personality_tables[SUPPORTED_PERSONALITIES];
+extern const struct personality_tables *current_tables;
+
+# define sysent		(current_tables->sysent)
+# define errnoent	(current_tables->errnoent)
+# define signalent	(current_tables->signalent)
+# define ioctlent	(current_tables->ioctlent)
+# define ioctl_names	(current_tables->ioctl_names)
+# define printers	(current_tables->printers)
+# define nsyscalls	(current_tables->nsyscalls)
+# define nerrnos	(current_tables->nerrnos)
+# define nsignals	(current_tables->nsignals)
+# define nioctlents	(current_tables->nioctlents)
+#endif
+
+#define ioctlent_name(iop_) (ioctl_names + (iop_)->name)
+
 /* Checks that sysent[scno] is not out of range. */
 static inline bool
 scno_in_range(kernel_ulong_t scno)
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Queue of tracees whose restart is delayed by delay_enter= and
+ * delay_exit= syscall injection.
+ *
+ * A delayed tracee is just left in its syscall stop.  Delayed tracees are
+ * kept in a binary min-heap ordered by their expiration times, a timerfd
+ * is armed for the earliest one, so the tracer keeps handling other
+ * tracees while some are delayed.  The timerfd wakes up the event loop
+ * of the main loop, which then restarts the expired tracees.
+ */
+
+#include "defs.h"
+
+#include <time.h>
+#include <sys/timerfd.h>
+
+bool inject_delays;
+
+static int delay_timer = -1;
+static struct tcb **delay_queue;
+static unsigned int delay_queue_size;
+static unsigned int delay_queue_cap;
+
+/* Create the delay timer, return its descriptor for the event loop.  */
+int
+delay_timer_init(void)
+{
+	delay_timer = timerfd_create(CLOCK_MONOTONIC,
+				     TFD_NONBLOCK | TFD_CLOEXEC);
+	if (delay_timer < 0)
+		perror_msg_and_die("timerfd_create");
+
+	return delay_timer;
+}
+
+void
+delay_tcb(struct tcb *const tcp, const unsigned int usecs)
+{
+	struct timespec *const ts = &get_tcb_inject(tcp)->delay_expiration;
+
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	ts->tv_sec += usecs / 1000000;
+	ts->tv_nsec += usecs % 1000000 * 1000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_nsec -= 1000000000;
+		++ts->tv_sec;
+	}
+
+	tcp->flags |= TCB_DELAYED;
+}
+
+static bool
+delay_before(const struct tcb *const a, const struct tcb *const b)
+{
+	const struct timespec *const a_ts = &a->inj->delay_expiration;
+	const struct timespec *const b_ts = &b->inj->delay_expiration;
+
+	return a_ts->tv_sec != b_ts->tv_sec
+	       ? a_ts->tv_sec < b_ts->tv_sec
+	       : a_ts->tv_nsec < b_ts->tv_nsec;
+}
+
+static void
+delay_queue_set(const unsigned int idx, struct tcb *const tcp)
+{
+	delay_queue[idx] = tcp;
+	tcp->inj->delay_idx = idx;
+}
+
+static void
+delay_sift_up(unsigned int idx)
+{
+	struct tcb *const tcp = delay_queue[idx];
+
+	while (idx) {
+		const unsigned int parent = (idx - 1) / 2;
+
+		if (!delay_before(tcp, delay_queue[parent]))
+			break;
+		delay_queue_set(idx, delay_queue[parent]);
+		idx = parent;
+	}
+	delay_queue_set(idx, tcp);
+}
+
+static void
+delay_sift_down(unsigned int idx)
+{
+	struct tcb *const tcp = delay_queue[idx];
+
+	for (;;) {
+		unsigned int child = idx * 2 + 1;
+
+		if (child >= delay_queue_size)
+			break;
+		if (child + 1 < delay_queue_size
+		    && delay_before(delay_queue[child + 1], delay_queue[child]))
+			++child;
+		if (!delay_before(delay_queue[child], tcp))
+			break;
+		delay_queue_set(idx, delay_queue[child]);
+		idx = child;
+	}
+	delay_queue_set(idx, tcp);
+}
+
+/* Arm the timer for the earliest expiration, disarm if there is none.  */
+static void
+delay_timer_arm(void)
+{
+	struct itimerspec its = { .it_value = { 0, 0 } };
+
+	if (delay_queue_size)
+		its.it_value = delay_queue[0]->inj->delay_expiration;
+
+	if (timerfd_settime(delay_timer, TFD_TIMER_ABSTIME, &its, NULL))
+		perror_msg_and_die("timerfd_settime");
+}
+
+void
+delay_queue_add(struct tcb *const tcp)
+{
+	if (delay_queue_size == delay_queue_cap) {
+		delay_queue_cap = delay_queue_cap ? delay_queue_cap * 2 : 16;
+		delay_queue = xreallocarray(delay_queue, delay_queue_cap,
+					    sizeof(*delay_queue));
+	}
+
+	delay_queue_set(delay_queue_size, tcp);
+	delay_sift_up(delay_queue_size++);
+
+	if (delay_queue[0] == tcp)
+		delay_timer_arm();
+}
+
+static void
+delay_queue_delete(const unsigned int idx)
+{
+	struct tcb *const last = delay_queue[--delay_queue_size];
+
+	if (idx < delay_queue_size) {
+		delay_queue_set(idx, last);
+		delay_sift_up(idx);
+		delay_sift_down(last->inj->delay_idx);
+	}
+}
+
+void
+delay_queue_remove(struct tcb *const tcp)
+{
+	if (!(tcp->flags & TCB_DELAYED))
+		return;
+	tcp->flags &= ~TCB_DELAYED;
+
+	if (tcp->inj->delay_idx >= delay_queue_size
+	    || delay_queue[tcp->inj->delay_idx] != tcp)
+		return;
+
+	const bool first = !tcp->inj->delay_idx;
+
+	delay_queue_delete(tcp->inj->delay_idx);
+	if (first)
+		delay_timer_arm();
+}
+
+/*
+ * Remove and return a tracee whose delay has expired.
+ * When there are no more such tracees, rearm the timer and return NULL.
+ */
+struct tcb *
+delay_queue_pop_expired(void)
+{
+	struct timespec now;
+
+	if (!delay_queue_size)
+		return NULL;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	struct tcb *const tcp = delay_queue[0];
+	const struct timespec *const ts = &tcp->inj->delay_expiration;
+
+	if (ts->tv_sec > now.tv_sec
+	    || (ts->tv_sec == now.tv_sec && ts->tv_nsec > now.tv_nsec)) {
+		delay_timer_arm();
+		return NULL;
+	}
+
+	delay_queue_delete(0);
+	tcp->flags &= ~TCB_DELAYED;
+
+	return tcp;
+}
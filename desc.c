@@ -69,6 +69,31 @@ SYS_FUNC(dup3)
 	return do_dup2(tcp, 2);
 }
 
+/*
+ * Fetch all fd sets of select in a single read, subsequent umoven calls
+ * are served from the snapshot.  Returns a scratch buffer of FDSIZE bytes
+ * to copy fd sets to.
+ */
+static fd_set *
+snapshot_fd_sets(struct tcb *const tcp, const kernel_ulong_t *const args,
+		 const int fdsize)
+{
+	struct umove_range ranges[3];
+	unsigned int i, n = 0;
+
+	for (i = 0; i < ARRAY_SIZE(ranges); ++i) {
+		if (args[i + 1]) {
+			ranges[n].addr = args[i + 1];
+			ranges[n].len = fdsize;
+			++n;
+		}
+	}
+	if (n > 1)
+		umove_snapshot(tcp, ranges, n);
+
+	return tcb_scratch_alloc(tcp, fdsize);
+}
+
 static int
 decode_select(struct tcb *const tcp, const kernel_ulong_t *const args,
 	      void (*const print_tv_ts) (struct tcb *, kernel_ulong_t),
@@ -101,7 +126,8 @@ decode_select(struct tcb *const tcp, const kernel_ulong_t *const args,
 		tprintf("%d", (int) args[0]);
 
 		if (verbose(tcp) && fdsize > 0)
-			fds = malloc(fdsize);
+			fds = snapshot_fd_sets(tcp, args, fdsize);
+		printfd_batch_begin();
 		for (i = 0; i < 3; i++) {
 			addr = args[i+1];
 			tprints(", ");
@@ -122,7 +148,7 @@ decode_select(struct tcb *const tcp, const kernel_ulong_t *const args,
 			}
 			tprints("]");
 		}
-		free(fds);
+		printfd_batch_end();
 		tprints(", ");
 		print_tv_ts(tcp, args[4]);
 	} else {
@@ -140,7 +166,9 @@ decode_select(struct tcb *const tcp, const kernel_ulong_t *const args,
 			return RVAL_STR;
 		}
 
-		fds = malloc(fdsize);
+		/* The kernel has updated fd sets, they have to be read again. */
+		if (fdsize > 0)
+			fds = snapshot_fd_sets(tcp, args, fdsize);
 
 		outptr = outstr;
 		sep = "";
@@ -174,7 +202,6 @@ decode_select(struct tcb *const tcp, const kernel_ulong_t *const args,
 			if (outptr != outstr)
 				*outptr++ = ']';
 		}
-		free(fds);
 		/* This contains no useful information on SunOS.  */
 		if (args[4]) {
 			const char *str = sprint_tv_ts(tcp, args[4]);
@@ -74,8 +74,9 @@ SYS_FUNC(readdir)
 
 SYS_FUNC(getdents)
 {
-	unsigned int i, len, dents = 0;
-	unsigned char *buf;
+	const unsigned int d_name_offset = offsetof(kernel_dirent, d_name);
+	kernel_ulong_t i, len;
+	unsigned int dents = 0;
 
 	if (entering(tcp)) {
 		printfd(tcp, tcp->u_arg[0]);
@@ -92,37 +93,45 @@ SYS_FUNC(getdents)
 	}
 
 	/* Beware of insanely large or too small values in tcp->u_rval */
-	if (tcp->u_rval > 1024*1024)
-		len = 1024*1024;
+	if ((kernel_ulong_t) tcp->u_rval > count)
+		len = count;
 	else if (tcp->u_rval < (int) sizeof(kernel_dirent))
 		len = 0;
 	else
 		len = tcp->u_rval;
 
-	if (len) {
-		buf = malloc(len);
-		if (!buf || umoven(tcp, tcp->u_arg[1], len, buf) < 0) {
-			tprints(", ");
-			printaddr(tcp->u_arg[1]);
-			tprintf(", %u", count);
-			free(buf);
-			return 0;
-		}
-	} else {
-		buf = NULL;
+	/*
+	 * The buffer is fetched a window at a time,
+	 * so that its size does not matter.
+	 */
+	struct umove_window w = { .addr = tcp->u_arg[1], .len = len };
+
+	if (len && !umove_window_get(tcp, &w, 0, sizeof(kernel_dirent))) {
+		tprints(", ");
+		printaddr(tcp->u_arg[1]);
+		tprintf(", %u", count);
+		return 0;
 	}
 
 	tprints(",");
 	if (!abbrev(tcp))
 		tprints(" [");
 	for (i = 0; len && i <= len - sizeof(kernel_dirent); ) {
-		kernel_dirent *d = (kernel_dirent *) &buf[i];
+		const kernel_dirent *d =
+			umove_window_get(tcp, &w, i, sizeof(kernel_dirent));
+
+		if (!d) {
+			tprints("...");
+			break;
+		}
+
+		const unsigned int d_reclen = d->d_reclen;
 
 		if (!abbrev(tcp)) {
-			int oob = d->d_reclen < sizeof(kernel_dirent) ||
-				  i + d->d_reclen - 1 >= len;
-			int d_name_len = oob ? len - i : d->d_reclen;
-			d_name_len -= offsetof(kernel_dirent, d_name) + 1;
+			int oob = d_reclen < sizeof(kernel_dirent) ||
+				  i + d_reclen - 1 >= len;
+			int d_name_len = oob ? len - i : d_reclen;
+			d_name_len -= d_name_offset + 1;
 			if (d_name_len > D_NAME_LEN_MAX)
 				d_name_len = D_NAME_LEN_MAX;
 
@@ -130,29 +139,35 @@ SYS_FUNC(getdents)
 				", d_name=", i ? ", " : "",
 				zero_extend_signed_to_ull(d->d_ino),
 				zero_extend_signed_to_ull(d->d_off),
-				d->d_reclen);
+				d_reclen);
 
-			print_quoted_cstring(d->d_name, d_name_len);
+			d = umove_window_get(tcp, &w, i,
+					     d_name_offset + d_name_len);
+			if (d)
+				print_quoted_cstring(d->d_name, d_name_len);
+			else
+				tprints("???");
 
 			tprints(", d_type=");
-			if (oob)
-				tprints("?");
+			const unsigned char *const d_type = oob ? NULL
+				: umove_window_get(tcp, &w, i + d_reclen - 1, 1);
+			if (d_type)
+				printxval(dirent_types, *d_type, "DT_???");
 			else
-				printxval(dirent_types, buf[i + d->d_reclen - 1], "DT_???");
+				tprints("?");
 			tprints("}");
 		}
 		dents++;
-		if (d->d_reclen < sizeof(kernel_dirent)) {
+		if (d_reclen < sizeof(kernel_dirent)) {
 			tprints_comment("d_reclen < sizeof(struct dirent)");
 			break;
 		}
-		i += d->d_reclen;
+		i += d_reclen;
 	}
 	if (!abbrev(tcp))
 		tprints("]");
 	else
 		tprintf_comment("%u entries", dents);
 	tprintf(", %u", count);
-	free(buf);
 	return 0;
 }
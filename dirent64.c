@@ -42,8 +42,8 @@ SYS_FUNC(getdents64)
 	/* the minimum size of a valid dirent64 structure */
 	const unsigned int d_name_offset = offsetof(struct dirent64, d_name);
 
-	unsigned int i, len, dents = 0;
-	char *buf;
+	kernel_ulong_t i, len;
+	unsigned int dents = 0;
 
 	if (entering(tcp)) {
 		printfd(tcp, tcp->u_arg[0]);
@@ -60,36 +60,45 @@ SYS_FUNC(getdents64)
 	}
 
 	/* Beware of insanely large or too small values in tcp->u_rval */
-	if (tcp->u_rval > 1024*1024)
-		len = 1024*1024;
+	if ((kernel_ulong_t) tcp->u_rval > count)
+		len = count;
 	else if (tcp->u_rval < (int) d_name_offset)
 		len = 0;
 	else
 		len = tcp->u_rval;
 
-	if (len) {
-		buf = malloc(len);
-		if (!buf || umoven(tcp, tcp->u_arg[1], len, buf) < 0) {
-			tprints(", ");
-			printaddr(tcp->u_arg[1]);
-			tprintf(", %u", count);
-			free(buf);
-			return 0;
-		}
-	} else {
-		buf = NULL;
+	/*
+	 * The buffer is fetched a window at a time,
+	 * so that its size does not matter.
+	 */
+	struct umove_window w = { .addr = tcp->u_arg[1], .len = len };
+
+	if (len && !umove_window_get(tcp, &w, 0, d_name_offset)) {
+		tprints(", ");
+		printaddr(tcp->u_arg[1]);
+		tprintf(", %u", count);
+		return 0;
 	}
 
 	tprints(",");
 	if (!abbrev(tcp))
 		tprints(" [");
 	for (i = 0; len && i <= len - d_name_offset; ) {
-		struct dirent64 *d = (struct dirent64 *) &buf[i];
+		const struct dirent64 *d =
+			umove_window_get(tcp, &w, i, d_name_offset);
+
+		if (!d) {
+			tprints("...");
+			break;
+		}
+
+		const unsigned int d_reclen = d->d_reclen;
+
 		if (!abbrev(tcp)) {
 			int d_name_len;
-			if (d->d_reclen >= d_name_offset
-			    && i + d->d_reclen <= len) {
-				d_name_len = d->d_reclen - d_name_offset;
+			if (d_reclen >= d_name_offset
+			    && i + d_reclen <= len) {
+				d_name_len = d_reclen - d_name_offset;
 			} else {
 				d_name_len = len - i - d_name_offset;
 			}
@@ -101,19 +110,24 @@ SYS_FUNC(getdents64)
 				i ? ", " : "",
 				d->d_ino,
 				d->d_off,
-				d->d_reclen);
+				d_reclen);
 			printxval(dirent_types, d->d_type, "DT_???");
 
 			tprints(", d_name=");
-			print_quoted_cstring(d->d_name, d_name_len);
+			d = umove_window_get(tcp, &w, i,
+					     d_name_offset + d_name_len);
+			if (d)
+				print_quoted_cstring(d->d_name, d_name_len);
+			else
+				tprints("???");
 
 			tprints("}");
 		}
-		if (d->d_reclen < d_name_offset) {
+		if (d_reclen < d_name_offset) {
 			tprints_comment("d_reclen < offsetof(struct dirent64, d_name)");
 			break;
 		}
-		i += d->d_reclen;
+		i += d_reclen;
 		dents++;
 	}
 	if (!abbrev(tcp))
@@ -121,6 +135,5 @@ SYS_FUNC(getdents64)
 	else
 		tprintf_comment("%u entries", dents);
 	tprintf(", %u", count);
-	free(buf);
 	return 0;
 }
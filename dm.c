@@ -123,6 +123,27 @@ dm_decode_flags(const struct dm_ioctl *ioc)
 	PRINT_FIELD_FLAGS(", ", *ioc, flags, dm_flags, "DM_???");
 }
 
+/*
+ * The payload of DM_TABLE_STATUS and DM_LIST_DEVICES can be large,
+ * fetch it with a single read, up to the size that is worth decoding,
+ * so that the structures and strings in it are decoded from the snapshot.
+ */
+#  define DM_SNAPSHOT_SIZE (64 * 1024)
+
+static void
+dm_snapshot_data(struct tcb *const tcp, const kernel_ulong_t addr,
+		 const struct dm_ioctl *const ioc)
+{
+	if (ioc->data_start >= ioc->data_size)
+		return;
+
+	const struct umove_range range = {
+		.addr = addr + ioc->data_start,
+		.len = MIN(ioc->data_size - ioc->data_start, DM_SNAPSHOT_SIZE)
+	};
+	umove_snapshot(tcp, &range, 1);
+}
+
 static void
 dm_decode_dm_target_spec(struct tcb *const tcp, const kernel_ulong_t addr,
 			 const struct dm_ioctl *const ioc)
@@ -140,6 +161,9 @@ dm_decode_dm_target_spec(struct tcb *const tcp, const kernel_ulong_t addr,
 		return;
 	}
 
+	if (ioc->target_count)
+		dm_snapshot_data(tcp, addr, ioc);
+
 	for (i = 0; i < ioc->target_count; i++) {
 		tprints(", ");
 
@@ -151,7 +175,7 @@ dm_decode_dm_target_spec(struct tcb *const tcp, const kernel_ulong_t addr,
 		if (offset_end <= offset || offset_end > ioc->data_size)
 			goto misplaced;
 
-		if (i >= max_strlen) {
+		if (i >= tcb_max_strlen(tcp)) {
 			tprints("...");
 			break;
 		}
@@ -222,6 +246,7 @@ dm_decode_dm_target_deps(struct tcb *const tcp, const kernel_ulong_t addr,
 	if (offset_end <= offset || offset_end > ioc->data_size)
 		goto misplaced;
 
+	dm_snapshot_data(tcp, addr, ioc);
 	if (umove_or_printaddr(tcp, addr + offset, &s))
 		return;
 
@@ -264,6 +289,8 @@ dm_decode_dm_name_list(struct tcb *const tcp, const kernel_ulong_t addr,
 		return;
 	}
 
+	dm_snapshot_data(tcp, addr, ioc);
+
 	for (count = 0;; count++) {
 		tprints(", ");
 
@@ -275,7 +302,7 @@ dm_decode_dm_name_list(struct tcb *const tcp, const kernel_ulong_t addr,
 		if (offset_end <= offset || offset_end > ioc->data_size)
 			goto misplaced;
 
-		if (count >= max_strlen) {
+		if (count >= tcb_max_strlen(tcp)) {
 			tprints("...");
 			break;
 		}
@@ -321,6 +348,8 @@ dm_decode_dm_target_versions(struct tcb *const tcp, const kernel_ulong_t addr,
 		return;
 	}
 
+	dm_snapshot_data(tcp, addr, ioc);
+
 	for (count = 0;; count++) {
 		tprints(", ");
 
@@ -332,7 +361,7 @@ dm_decode_dm_target_versions(struct tcb *const tcp, const kernel_ulong_t addr,
 		if (offset_end <= offset || offset_end > ioc->data_size)
 			goto misplaced;
 
-		if (count >= max_strlen) {
+		if (count >= tcb_max_strlen(tcp)) {
 			tprints("...");
 			break;
 		}
@@ -381,6 +410,7 @@ dm_decode_dm_target_msg(struct tcb *const tcp, const kernel_ulong_t addr,
 	if (offset_end > offset && offset_end <= ioc->data_size) {
 		struct dm_target_msg s;
 
+		dm_snapshot_data(tcp, addr, ioc);
 		if (umove_or_printaddr(tcp, addr + offset, &s))
 			return;
 
@@ -409,6 +439,7 @@ dm_decode_string(struct tcb *const tcp, const kernel_ulong_t addr,
 	uint32_t offset = ioc->data_start;
 
 	if (offset <= ioc->data_size) {
+		dm_snapshot_data(tcp, addr, ioc);
 		tprints("string=");
 		printstr_ex(tcp, addr + offset, ioc->data_size - offset,
 			    QUOTE_0_TERMINATED);
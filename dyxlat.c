@@ -25,6 +25,7 @@
  */
 
 #include "defs.h"
+#include "selfprof.h"
 
 struct dyxlat {
 	size_t used;
@@ -47,6 +48,9 @@ dyxlat_alloc(const size_t nmemb)
 	dyxlat->allocated = nmemb ? nmemb : 16;
 	dyxlat->xlat = xcalloc(dyxlat->allocated, sizeof(struct xlat));
 	MARK_END(dyxlat->xlat[0]);
+	selfprof_cache_add(SELFPROF_CACHE_DYXLAT, 0,
+			   sizeof(*dyxlat)
+			   + dyxlat->allocated * sizeof(struct xlat));
 
 	return dyxlat;
 }
@@ -55,11 +59,15 @@ void
 dyxlat_free(struct dyxlat *const dyxlat)
 {
 	size_t i;
+	long bytes = sizeof(*dyxlat) + dyxlat->allocated * sizeof(struct xlat);
 
 	for (i = 0; i < dyxlat->used - 1; ++i) {
+		bytes += strlen(dyxlat->xlat[i].str) + 1;
 		free((void *) dyxlat->xlat[i].str);
 		dyxlat->xlat[i].str = NULL;
 	}
+	selfprof_cache_add(SELFPROF_CACHE_DYXLAT,
+			   -(long) (dyxlat->used - 1), -bytes);
 
 	free(dyxlat->xlat);
 	dyxlat->xlat = NULL;
@@ -84,6 +92,9 @@ dyxlat_add_pair(struct dyxlat *const dyxlat, const uint64_t val,
 			    && dyxlat->xlat[i].str[len] == '\0')
 				return;
 
+			selfprof_cache_add(SELFPROF_CACHE_DYXLAT, 0,
+					   (long) len
+					   - (long) strlen(dyxlat->xlat[i].str));
 			free((void *) dyxlat->xlat[i].str);
 			dyxlat->xlat[i].str = xstrndup(str, len);
 			return;
@@ -91,6 +102,8 @@ dyxlat_add_pair(struct dyxlat *const dyxlat, const uint64_t val,
 	}
 
 	if (dyxlat->used >= dyxlat->allocated) {
+		selfprof_cache_add(SELFPROF_CACHE_DYXLAT, 0,
+				   dyxlat->allocated * sizeof(struct xlat));
 		dyxlat->allocated *= 2;
 		dyxlat->xlat = xreallocarray(dyxlat->xlat, dyxlat->allocated,
 					     sizeof(struct xlat));
@@ -100,4 +113,5 @@ dyxlat_add_pair(struct dyxlat *const dyxlat, const uint64_t val,
 	dyxlat->xlat[dyxlat->used - 1].str = xstrndup(str, len);
 	MARK_END(dyxlat->xlat[dyxlat->used]);
 	dyxlat->used++;
+	selfprof_cache_add(SELFPROF_CACHE_DYXLAT, 1, len + 1);
 }
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Event loop statistics (--summary-epoll option).
+ *
+ * Every epoll instance is tracked from the raw arguments and return
+ * values of epoll_create, epoll_ctl, and epoll_wait calls, so none
+ * of them has to be decoded: the number of registered descriptors
+ * over time, the number of events returned by each wait, and the time
+ * spent waiting versus between the waits.
+ */
+
+#include "defs.h"
+#include "syscall.h"
+#include <sys/epoll.h>
+
+/* Waits returning 0, 1, 2-3, 4-7, ..., 32-63, and 64 or more events */
+#define EPOLL_HIST_BUCKETS 8
+
+struct epoll_counts {
+	struct epoll_counts *next;
+	int tgid;
+	int epfd;
+	bool closed;		/* The descriptor has been reused */
+	unsigned int nfds, peak_nfds;
+	struct timespec first_ts, last_ts;
+	struct timespec change_ts;	/* Last change of nfds */
+	struct timespec wait_exit_ts;	/* Exiting of the last wait */
+	double nfds_ns;		/* nfds integrated over time */
+	uint64_t waits, empty_waits, events, max_events;
+	uint64_t wait_ns, between_ns;
+	uint64_t hist[EPOLL_HIST_BUCKETS];
+};
+
+unsigned int summary_epoll;
+static struct epoll_counts **epoll_hash;
+static unsigned int epoll_hash_size;
+static unsigned int epoll_hash_count;
+
+static unsigned int
+hash_epoll(const int tgid, const int epfd)
+{
+	return (unsigned int) (tgid * 31 + epfd) * 2654435761U;
+}
+
+static void
+epoll_hash_expand(void)
+{
+	struct epoll_counts **const old_hash = epoll_hash;
+	const unsigned int old_size = epoll_hash_size;
+	unsigned int i;
+
+	epoll_hash_size = old_size ? old_size * 2 : 64;
+	epoll_hash = xcalloc(epoll_hash_size, sizeof(epoll_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct epoll_counts *ec, *next;
+
+		for (ec = old_hash[i]; ec; ec = next) {
+			const unsigned int b = hash_epoll(ec->tgid, ec->epfd)
+					       & (epoll_hash_size - 1);
+
+			next = ec->next;
+			ec->next = epoll_hash[b];
+			epoll_hash[b] = ec;
+		}
+	}
+
+	free(old_hash);
+}
+
+/*
+ * Find the epoll instance, create it if CREATE is set or if it has not
+ * been seen created, e.g. because it has been inherited.
+ */
+static struct epoll_counts *
+get_epoll_counts(struct tcb *const tcp, const int epfd, const bool create,
+		 const struct timespec *const ts)
+{
+	const int tgid = get_tcb_tgid(tcp);
+	struct epoll_counts *ec;
+
+	if (epoll_hash_size) {
+		for (ec = epoll_hash[hash_epoll(tgid, epfd)
+				     & (epoll_hash_size - 1)];
+		     ec; ec = ec->next) {
+			if (ec->tgid != tgid || ec->epfd != epfd || ec->closed)
+				continue;
+			if (!create)
+				return ec;
+			/* The descriptor number has been reused.  */
+			ec->closed = true;
+			break;
+		}
+	}
+
+	if (epoll_hash_count >= epoll_hash_size)
+		epoll_hash_expand();
+
+	const unsigned int b = hash_epoll(tgid, epfd) & (epoll_hash_size - 1);
+
+	ec = xcalloc(1, sizeof(*ec));
+	ec->tgid = tgid;
+	ec->epfd = epfd;
+	ec->first_ts = ec->last_ts = ec->change_ts = *ts;
+	ec->next = epoll_hash[b];
+	epoll_hash[b] = ec;
+	++epoll_hash_count;
+
+	return ec;
+}
+
+static uint64_t
+ts_diff_ns(const struct timespec *const a, const struct timespec *const b)
+{
+	struct timespec dt;
+
+	ts_sub(&dt, a, b);
+	return (uint64_t) dt.tv_sec * 1000000000 + dt.tv_nsec;
+}
+
+static void
+set_epoll_nfds(struct epoll_counts *const ec, const unsigned int nfds,
+	       const struct timespec *const ts)
+{
+	ec->nfds_ns += (double) ec->nfds * ts_diff_ns(ts, &ec->change_ts);
+	ec->change_ts = *ts;
+	ec->nfds = nfds;
+	if (nfds > ec->peak_nfds)
+		ec->peak_nfds = nfds;
+}
+
+static unsigned int
+epoll_hist_bucket(const uint64_t events)
+{
+	unsigned int i = 0;
+
+	if (!events)
+		return 0;
+	for (i = 1; i < EPOLL_HIST_BUCKETS - 1 && events >> i; ++i)
+		;
+	return i;
+}
+
+static void
+count_epoll_wait(struct tcb *const tcp, struct epoll_counts *const ec,
+		 const struct timespec *const ts)
+{
+	struct timespec dt;
+
+	ts_sub(&dt, ts, &tcp->etime);
+
+	const uint64_t events = syserror(tcp) ? 0 : tcp->u_rval;
+
+	ec->waits++;
+	ec->wait_ns += (uint64_t) dt.tv_sec * 1000000000 + dt.tv_nsec;
+	if (ts_nz(&ec->wait_exit_ts)
+	    && ts_cmp(&tcp->etime, &ec->wait_exit_ts) > 0)
+		ec->between_ns += ts_diff_ns(&tcp->etime, &ec->wait_exit_ts);
+	ec->wait_exit_ts = *ts;
+
+	/* Interrupted waits are not wakeups with events.  */
+	if (syserror(tcp))
+		return;
+	if (!events)
+		ec->empty_waits++;
+	ec->events += events;
+	if (events > ec->max_events)
+		ec->max_events = events;
+	ec->hist[epoll_hist_bucket(events)]++;
+}
+
+void
+count_epoll(struct tcb *const tcp, const struct timespec *const ts)
+{
+	struct epoll_counts *ec;
+
+	switch (tcp->s_ent->sen) {
+	case SEN_epoll_create:
+	case SEN_epoll_create1:
+		if (!syserror(tcp))
+			get_epoll_counts(tcp, tcp->u_rval, true, ts);
+		return;
+	case SEN_epoll_ctl:
+		if (syserror(tcp))
+			return;
+		ec = get_epoll_counts(tcp, tcp->u_arg[0], false, ts);
+		switch (tcp->u_arg[1]) {
+		case EPOLL_CTL_ADD:
+			set_epoll_nfds(ec, ec->nfds + 1, ts);
+			break;
+		case EPOLL_CTL_DEL:
+			if (ec->nfds)
+				set_epoll_nfds(ec, ec->nfds - 1, ts);
+			break;
+		}
+		break;
+	case SEN_epoll_wait:
+	case SEN_epoll_pwait:
+		ec = get_epoll_counts(tcp, tcp->u_arg[0], false, &tcp->etime);
+		count_epoll_wait(tcp, ec, ts);
+		break;
+	default:
+		return;
+	}
+
+	ec->last_ts = *ts;
+}
+
+static int
+epoll_counts_cmp(const void *a, const void *b)
+{
+	const struct epoll_counts *const x = *(const struct epoll_counts **) a;
+	const struct epoll_counts *const y = *(const struct epoll_counts **) b;
+
+	return (x->waits < y->waits) ? 1 : (x->waits > y->waits) ? -1
+	     : (x->tgid != y->tgid) ? x->tgid - y->tgid
+	     : x->epfd - y->epfd;
+}
+
+/* Print the summary_epoll epoll instances that have been waited on most.  */
+void
+epoll_summary(FILE *outf)
+{
+	static const char *const hist_names[EPOLL_HIST_BUCKETS] = {
+		"0", "1", "2-3", "4-7", "8-15", "16-31", "32-63", "64+"
+	};
+	const char *dashes = "----------------";
+	struct epoll_counts **sorted;
+	unsigned int i, j, n = 0;
+
+	if (!epoll_hash_count)
+		return;
+
+	sorted = xcalloc(epoll_hash_count, sizeof(sorted[0]));
+	for (i = 0; i < epoll_hash_size; ++i) {
+		struct epoll_counts *ec;
+
+		for (ec = epoll_hash[i]; ec; ec = ec->next)
+			sorted[n++] = ec;
+	}
+	sort_top(sorted, n, sizeof(sorted[0]), summary_epoll,
+		 epoll_counts_cmp);
+	if (n > summary_epoll)
+		n = summary_epoll;
+
+	fprintf(outf, "\n%9.9s %9.9s %11.11s %9.9s %11.11s %11.11s %9.9s"
+		" %9.9s %s\n", "waits", "empty", "events", "max/wait",
+		"wait secs", "between", "avg fds", "peak fds", "pid:epfd");
+	fprintf(outf, "%9.9s %9.9s %11.11s %9.9s %11.11s %11.11s %9.9s"
+		" %9.9s %s\n", dashes, dashes, dashes, dashes, dashes, dashes,
+		dashes, dashes, dashes);
+	for (i = 0; i < n; ++i) {
+		struct epoll_counts *const ec = sorted[i];
+		const uint64_t life_ns = ts_diff_ns(&ec->last_ts,
+						    &ec->first_ts);
+
+		set_epoll_nfds(ec, ec->nfds, &ec->last_ts);
+		fprintf(outf, "%9" PRIu64 " %9" PRIu64 " %11" PRIu64
+			" %9" PRIu64 " %11.6f %11.6f %9.2f %9u %d:%d\n",
+			ec->waits, ec->empty_waits, ec->events,
+			ec->max_events, ec->wait_ns / 1e9,
+			ec->between_ns / 1e9,
+			life_ns ? ec->nfds_ns / life_ns : ec->nfds,
+			ec->peak_nfds, ec->tgid, ec->epfd);
+	}
+
+	fprintf(outf, "\nEvents returned per wait:\n");
+	for (j = 0; j < EPOLL_HIST_BUCKETS; ++j)
+		fprintf(outf, "%9.9s ", hist_names[j]);
+	fprintf(outf, "%s\n", "pid:epfd");
+	for (j = 0; j < EPOLL_HIST_BUCKETS; ++j)
+		fprintf(outf, "%9.9s ", dashes);
+	fprintf(outf, "%s\n", dashes);
+	for (i = 0; i < n; ++i) {
+		for (j = 0; j < EPOLL_HIST_BUCKETS; ++j)
+			fprintf(outf, "%9" PRIu64 " ", sorted[i]->hist[j]);
+		fprintf(outf, "%d:%d\n", sorted[i]->tgid, sorted[i]->epfd);
+	}
+
+	free(sorted);
+}
@@ -34,6 +34,41 @@
 
 #include "defs.h"
 
+/* The number of array elements fetched at once. */
+#define ARGV_CHUNK_SIZE 8
+
+/*
+ * Fetch up to ARGV_CHUNK_SIZE pointers of the array at the given address,
+ * without crossing a page boundary.  Returns the number of pointers fetched.
+ */
+static unsigned int
+fetch_argv_chunk(struct tcb *const tcp, const kernel_ulong_t addr,
+		 kernel_ulong_t *const ptrs)
+{
+	const unsigned int wordsize = current_wordsize;
+	const size_t page_size = get_pagesize();
+	unsigned int n = (page_size - (addr & (page_size - 1))) / wordsize;
+	union {
+		unsigned int p32[ARGV_CHUNK_SIZE];
+		kernel_ulong_t p64[ARGV_CHUNK_SIZE];
+	} buf;
+	unsigned int i;
+
+	if (n > ARGV_CHUNK_SIZE)
+		n = ARGV_CHUNK_SIZE;
+	if (!n || umoven(tcp, addr, n * wordsize, &buf)) {
+		n = 1;
+		if (umoven(tcp, addr, wordsize, &buf))
+			return 0;
+	}
+
+	for (i = 0; i < n; ++i)
+		ptrs[i] = wordsize < sizeof(buf.p64[0]) ? buf.p32[i]
+							: buf.p64[i];
+
+	return n;
+}
+
 static void
 printargv(struct tcb *const tcp, kernel_ulong_t addr)
 {
@@ -45,33 +80,42 @@ printargv(struct tcb *const tcp, kernel_ulong_t addr)
 	const char *const start_sep = "[";
 	const char *sep = start_sep;
 	const unsigned int wordsize = current_wordsize;
+	kernel_ulong_t ptrs[ARGV_CHUNK_SIZE];
+	unsigned int nptrs = 0, pos = 0;
 	unsigned int n;
 
 	for (n = 0; addr; sep = ", ", addr += wordsize, ++n) {
-		union {
-			unsigned int p32;
-			kernel_ulong_t p64;
-			char data[sizeof(kernel_ulong_t)];
-		} cp;
+		if (pos == nptrs) {
+			pos = 0;
+			nptrs = fetch_argv_chunk(tcp, addr, ptrs);
+			if (!nptrs) {
+				if (sep == start_sep)
+					printaddr(addr);
+				else
+					tprints(", ???]");
+				return;
+			}
 
-		if (umoven(tcp, addr, wordsize, cp.data)) {
-			if (sep == start_sep)
-				printaddr(addr);
-			else
-				tprints(", ???]");
-			return;
+			/* Fetch the strings of the chunk at once. */
+			unsigned int nstrs;
+			for (nstrs = 0; nstrs < nptrs && ptrs[nstrs]; ++nstrs)
+				;
+			umove_snapshot_strings(tcp, ptrs, nstrs);
 		}
-		if (!(wordsize < sizeof(cp.p64) ? cp.p32 : cp.p64)) {
+
+		const kernel_ulong_t ptr = ptrs[pos++];
+
+		if (!ptr) {
 			if (sep == start_sep)
 				tprints(start_sep);
 			break;
 		}
-		if (abbrev(tcp) && n >= max_strlen) {
+		if (abbrev(tcp) && n >= tcb_max_strlen(tcp)) {
 			tprintf("%s...", sep);
 			break;
 		}
 		tprints(sep);
-		printstr(tcp, wordsize < sizeof(cp.p64) ? cp.p32 : cp.p64);
+		printstr(tcp, ptr);
 	}
 	tprints("]");
 }
@@ -86,17 +130,22 @@ printargc(struct tcb *const tcp, kernel_ulong_t addr)
 
 	bool unterminated = false;
 	unsigned int count = 0;
-	char *cp = NULL;
+	kernel_ulong_t ptrs[ARGV_CHUNK_SIZE];
+	unsigned int nptrs = 0, pos = 0;
 
 	for (; addr; addr += current_wordsize, ++count) {
-		if (umoven(tcp, addr, current_wordsize, &cp)) {
-			if (!count)
-				return;
+		if (pos == nptrs) {
+			pos = 0;
+			nptrs = fetch_argv_chunk(tcp, addr, ptrs);
+			if (!nptrs) {
+				if (!count)
+					return;
 
-			unterminated = true;
-			break;
+				unterminated = true;
+				break;
+			}
 		}
-		if (!cp)
+		if (!ptrs[pos++])
 			break;
 	}
 	tprintf_comment("%u var%s%s",
@@ -104,6 +153,99 @@ printargc(struct tcb *const tcp, kernel_ulong_t addr)
 		unterminated ? ", unterminated" : "");
 }
 
+/* The longest string accepted by execve is 32 pages long.  */
+#define MAX_ARG_STRLEN_PAGES 32
+
+/*
+ * Add the size of the string at the given address, including its
+ * terminating NUL, to *size, and its bytes to the FNV-1a hash *hash.
+ * The string is read page by page.  Returns false if it cannot be read.
+ */
+static bool
+measure_env_str(struct tcb *const tcp, kernel_ulong_t addr,
+		uint64_t *const size, uint64_t *const hash)
+{
+	static char *buf;
+	const size_t page_size = get_pagesize();
+	unsigned int i, pages;
+
+	if (!buf)
+		buf = xmalloc(page_size);
+
+	for (pages = 0; pages < MAX_ARG_STRLEN_PAGES; ++pages) {
+		const unsigned int len = page_size - (addr & (page_size - 1));
+		const int rc = umovestr(tcp, addr, len, buf);
+
+		if (rc < 0)
+			return false;
+
+		const unsigned int n = rc ? strlen(buf) + 1 : len;
+
+		*size += n;
+		for (i = 0; i < n; ++i) {
+			*hash ^= (unsigned char) buf[i];
+			*hash *= 0x100000001b3ULL;
+		}
+		if (rc)
+			return true;
+		addr += len;
+	}
+
+	return false;
+}
+
+/*
+ * Print the number of environment variables and their total size,
+ * and their hash if requested, instead of the variables themselves.
+ */
+static void
+print_env_summary(struct tcb *const tcp, kernel_ulong_t addr)
+{
+	printaddr(addr);
+
+	if (!addr || !verbose(tcp))
+		return;
+
+	bool unterminated = false, unreadable = false;
+	unsigned int count = 0;
+	uint64_t size = 0, hash = 0xcbf29ce484222325ULL;
+	kernel_ulong_t ptrs[ARGV_CHUNK_SIZE];
+	unsigned int nptrs = 0, pos = 0;
+
+	for (; addr; addr += current_wordsize, ++count) {
+		if (pos == nptrs) {
+			pos = 0;
+			nptrs = fetch_argv_chunk(tcp, addr, ptrs);
+			if (!nptrs) {
+				if (!count)
+					return;
+
+				unterminated = true;
+				break;
+			}
+		}
+
+		const kernel_ulong_t ptr = ptrs[pos++];
+
+		if (!ptr)
+			break;
+		if (!unreadable && !measure_env_str(tcp, ptr, &size, &hash))
+			unreadable = true;
+	}
+
+	const char *const plural = count == 1 ? "" : "s";
+	const char *const tail = unterminated ? ", unterminated" : "";
+
+	if (unreadable)
+		tprintf_comment("%u var%s, unreadable%s", count, plural, tail);
+	else if (execve_env == EXECVE_ENV_SIZE)
+		tprintf_comment("%u var%s, %" PRIu64 " bytes%s",
+				count, plural, size, tail);
+	else
+		tprintf_comment("%u var%s, %" PRIu64 " bytes, hash 0x%016"
+				PRIx64 "%s", count, plural, size, hash, tail);
+}
+
 static void
 decode_execve(struct tcb *tcp, const unsigned int index)
 {
@@ -113,7 +255,11 @@ decode_execve(struct tcb *tcp, const unsigned int index)
 	printargv(tcp, tcp->u_arg[index + 1]);
 	tprints(", ");
 
-	(abbrev(tcp) ? printargc : printargv) (tcp, tcp->u_arg[index + 2]);
+	if (execve_env != EXECVE_ENV_FULL)
+		print_env_summary(tcp, tcp->u_arg[index + 2]);
+	else
+		(abbrev(tcp) ? printargc : printargv) (tcp,
+						       tcp->u_arg[index + 2]);
 }
 
 SYS_FUNC(execve)
@@ -0,0 +1,518 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+/*
+ * Descriptor lifecycle tracking (--summary-fds option).
+ *
+ * Descriptors created and closed by the traced calls are tracked per
+ * thread group from the raw syscall arguments and return values, paths
+ * are obtained by getfdpath, so they come from the descriptor path cache
+ * whenever possible.  Descriptors inherited from the parent or created
+ * before attaching are not known, so closing them is ignored.
+ */
+
+#include "defs.h"
+#include "syscall.h"
+#include "strintern.h"
+#include <sys/param.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#ifndef F_DUPFD_CLOEXEC
+# define F_DUPFD_CLOEXEC (1024 + 6)
+#endif
+
+struct fd_entry {
+	const char *path;	/* interned, NULL if not open */
+	struct timespec open_ts;
+	unsigned int stack_id;	/* of the open site, 0 if unknown */
+	bool cloexec;
+};
+
+struct fd_table {
+	struct fd_table *next;
+	int tgid;
+	struct fd_entry *fds;
+	unsigned int nfds;
+	unsigned int nopen;
+};
+
+struct path_counts {
+	struct path_counts *next;
+	const char *path;	/* interned */
+	uint64_t opens, closes;
+	uint64_t lifetime_ns, max_lifetime_ns;
+};
+
+unsigned int summary_fds;
+
+static struct fd_table **fd_hash;
+static unsigned int fd_hash_size;
+static unsigned int fd_hash_count;
+static struct path_counts **path_hash;
+static unsigned int path_hash_size;
+static unsigned int path_hash_count;
+static struct timespec last_ts;
+
+static void
+fd_hash_expand(void)
+{
+	struct fd_table **const old_hash = fd_hash;
+	const unsigned int old_size = fd_hash_size;
+	unsigned int i;
+
+	fd_hash_size = old_size ? old_size * 2 : 64;
+	fd_hash = xcalloc(fd_hash_size, sizeof(fd_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct fd_table *ft, *next;
+
+		for (ft = old_hash[i]; ft; ft = next) {
+			const unsigned int b =
+				(unsigned int) ft->tgid & (fd_hash_size - 1);
+
+			next = ft->next;
+			ft->next = fd_hash[b];
+			fd_hash[b] = ft;
+		}
+	}
+
+	free(old_hash);
+}
+
+static struct fd_table *
+get_fd_table(struct tcb *const tcp)
+{
+	const int tgid = get_tcb_tgid(tcp);
+	struct fd_table *ft;
+
+	if (fd_hash_size) {
+		for (ft = fd_hash[(unsigned int) tgid & (fd_hash_size - 1)];
+		     ft; ft = ft->next) {
+			if (ft->tgid == tgid)
+				return ft;
+		}
+	}
+
+	if (fd_hash_count >= fd_hash_size)
+		fd_hash_expand();
+
+	const unsigned int b = (unsigned int) tgid & (fd_hash_size - 1);
+
+	ft = xcalloc(1, sizeof(*ft));
+	ft->tgid = tgid;
+	ft->next = fd_hash[b];
+	fd_hash[b] = ft;
+	++fd_hash_count;
+
+	return ft;
+}
+
+static unsigned int
+hash_path(const char *const path)
+{
+	/* Interned strings are compared by their addresses.  */
+	return (unsigned int) ((uintptr_t) path >> 4) * 2654435761U;
+}
+
+static void
+path_hash_expand(void)
+{
+	struct path_counts **const old_hash = path_hash;
+	const unsigned int old_size = path_hash_size;
+	unsigned int i;
+
+	path_hash_size = old_size ? old_size * 2 : 64;
+	path_hash = xcalloc(path_hash_size, sizeof(path_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct path_counts *pc, *next;
+
+		for (pc = old_hash[i]; pc; pc = next) {
+			const unsigned int b =
+				hash_path(pc->path) & (path_hash_size - 1);
+
+			next = pc->next;
+			pc->next = path_hash[b];
+			path_hash[b] = pc;
+		}
+	}
+
+	free(old_hash);
+}
+
+static struct path_counts *
+get_path_counts(const char *const path)
+{
+	struct path_counts *pc;
+
+	if (path_hash_size) {
+		for (pc = path_hash[hash_path(path) & (path_hash_size - 1)];
+		     pc; pc = pc->next) {
+			if (pc->path == path)
+				return pc;
+		}
+	}
+
+	if (path_hash_count >= path_hash_size)
+		path_hash_expand();
+
+	const unsigned int b = hash_path(path) & (path_hash_size - 1);
+
+	pc = xcalloc(1, sizeof(*pc));
+	pc->path = str_intern_ref(path);
+	pc->next = path_hash[b];
+	path_hash[b] = pc;
+	++path_hash_count;
+
+	return pc;
+}
+
+static uint64_t
+ts_diff_ns(const struct timespec *const end, const struct timespec *const start)
+{
+	struct timespec d;
+
+	ts_sub(&d, end, start);
+	return (uint64_t) d.tv_sec * 1000000000 + d.tv_nsec;
+}
+
+static void
+fd_closed(struct fd_table *const ft, const int fd,
+	  const struct timespec *const ts)
+{
+	if (fd < 0 || (unsigned int) fd >= ft->nfds || !ft->fds[fd].path)
+		return;
+
+	struct fd_entry *const fe = &ft->fds[fd];
+	struct path_counts *const pc = get_path_counts(fe->path);
+	const uint64_t ns = ts_diff_ns(ts, &fe->open_ts);
+
+	pc->closes++;
+	pc->lifetime_ns += ns;
+	if (ns > pc->max_lifetime_ns)
+		pc->max_lifetime_ns = ns;
+
+	str_intern_release(fe->path);
+	fe->path = NULL;
+	ft->nopen--;
+}
+
+static void
+fd_opened(struct tcb *const tcp, const int fd, const bool cloexec,
+	  const struct timespec *const ts)
+{
+	if (fd < 0)
+		return;
+
+	struct fd_table *const ft = get_fd_table(tcp);
+	char path[PATH_MAX + 1];
+
+	if ((unsigned int) fd >= ft->nfds) {
+		const unsigned int n = MAX((unsigned int) fd + 1, ft->nfds * 2);
+
+		ft->fds = xreallocarray(ft->fds, n, sizeof(ft->fds[0]));
+		memset(&ft->fds[ft->nfds], 0,
+		       (n - ft->nfds) * sizeof(ft->fds[0]));
+		ft->nfds = n;
+	}
+	/* The descriptor has been closed by a call that is not traced.  */
+	fd_closed(ft, fd, ts);
+
+	if (getfdpath(tcp, fd, path, sizeof(path)) < 0)
+		strcpy(path, "[unknown]");
+
+	struct fd_entry *const fe = &ft->fds[fd];
+
+	fe->path = str_intern(path);
+	fe->open_ts = *ts;
+	fe->cloexec = cloexec;
+	fe->stack_id = 0;
+#ifdef USE_LIBUNWIND
+	if (stack_trace_enabled && stack_traced(tcp))
+		fe->stack_id = unwind_stack_id(tcp);
+#endif
+	ft->nopen++;
+
+	get_path_counts(fe->path)->opens++;
+}
+
+static void
+fd_pair_opened(struct tcb *const tcp, const kernel_ulong_t addr,
+	       const bool cloexec, const struct timespec *const ts)
+{
+	int pair[2];
+
+	if (umove(tcp, addr, &pair))
+		return;
+
+	fd_opened(tcp, pair[0], cloexec, ts);
+	fd_opened(tcp, pair[1], cloexec, ts);
+}
+
+static void
+fd_set_cloexec(struct tcb *const tcp, const int fd, const bool cloexec)
+{
+	struct fd_table *const ft = get_fd_table(tcp);
+
+	if (fd >= 0 && (unsigned int) fd < ft->nfds && ft->fds[fd].path)
+		ft->fds[fd].cloexec = cloexec;
+}
+
+static void
+close_cloexec_fds(struct tcb *const tcp, const struct timespec *const ts)
+{
+	struct fd_table *const ft = get_fd_table(tcp);
+	unsigned int i;
+
+	for (i = 0; i < ft->nfds; ++i) {
+		if (ft->fds[i].cloexec)
+			fd_closed(ft, i, ts);
+	}
+}
+
+static void
+count_fcntl(struct tcb *const tcp, const struct timespec *const ts)
+{
+	switch (tcp->u_arg[1]) {
+	case F_DUPFD:
+		fd_opened(tcp, tcp->u_rval, false, ts);
+		break;
+	case F_DUPFD_CLOEXEC:
+		fd_opened(tcp, tcp->u_rval, true, ts);
+		break;
+	case F_SETFD:
+		fd_set_cloexec(tcp, tcp->u_arg[0], tcp->u_arg[2] & FD_CLOEXEC);
+		break;
+	}
+}
+
+void
+count_fds(struct tcb *const tcp, const struct timespec *const ts)
+{
+	last_ts = *ts;
+
+	if (tcp->s_ent->sen == SEN_close) {
+		/* The descriptor is released even if close fails with EINTR.  */
+		if (!syserror(tcp) || tcp->u_error != EBADF)
+			fd_closed(get_fd_table(tcp), tcp->u_arg[0], ts);
+		return;
+	}
+
+	if (syserror(tcp))
+		return;
+
+	switch (tcp->s_ent->sen) {
+	case SEN_open:
+		fd_opened(tcp, tcp->u_rval, tcp->u_arg[1] & O_CLOEXEC, ts);
+		break;
+	case SEN_openat:
+	case SEN_open_by_handle_at:
+		fd_opened(tcp, tcp->u_rval, tcp->u_arg[2] & O_CLOEXEC, ts);
+		break;
+	case SEN_creat:
+	case SEN_dup:
+	case SEN_accept:
+		fd_opened(tcp, tcp->u_rval, false, ts);
+		break;
+	case SEN_dup2:
+		if (tcp->u_arg[0] != tcp->u_arg[1])
+			fd_opened(tcp, tcp->u_rval, false, ts);
+		break;
+	case SEN_dup3:
+		fd_opened(tcp, tcp->u_rval, tcp->u_arg[2] & O_CLOEXEC, ts);
+		break;
+	case SEN_fcntl:
+	case SEN_fcntl64:
+		count_fcntl(tcp, ts);
+		break;
+	case SEN_socket:
+		fd_opened(tcp, tcp->u_rval, tcp->u_arg[1] & SOCK_CLOEXEC, ts);
+		break;
+	case SEN_accept4:
+		fd_opened(tcp, tcp->u_rval, tcp->u_arg[3] & SOCK_CLOEXEC, ts);
+		break;
+	case SEN_pipe:
+#ifdef HAVE_GETRVAL2
+		fd_opened(tcp, tcp->u_rval, false, ts);
+		fd_opened(tcp, getrval2(tcp), false, ts);
+#else
+		fd_pair_opened(tcp, tcp->u_arg[0], false, ts);
+#endif
+		break;
+	case SEN_pipe2:
+		fd_pair_opened(tcp, tcp->u_arg[0], tcp->u_arg[1] & O_CLOEXEC,
+			       ts);
+		break;
+	case SEN_socketpair:
+		fd_pair_opened(tcp, tcp->u_arg[3], tcp->u_arg[1] & SOCK_CLOEXEC,
+			       ts);
+		break;
+	case SEN_execve:
+	case SEN_execveat:
+	case SEN_execv:
+		close_cloexec_fds(tcp, ts);
+		break;
+	default:
+		break;
+	}
+}
+
+static int
+path_counts_cmp(const void *a, const void *b)
+{
+	const struct path_counts *const x = *(const struct path_counts **) a;
+	const struct path_counts *const y = *(const struct path_counts **) b;
+
+	return (x->opens < y->opens) ? 1 : (x->opens > y->opens) ? -1
+	     : strcmp(x->path, y->path);
+}
+
+/* Print the summary_fds paths opened the most times.  */
+static void
+path_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	struct path_counts **sorted;
+	unsigned int i, n = 0;
+
+	sorted = xcalloc(path_hash_count, sizeof(sorted[0]));
+	for (i = 0; i < path_hash_size; ++i) {
+		struct path_counts *pc;
+
+		for (pc = path_hash[i]; pc; pc = pc->next)
+			sorted[n++] = pc;
+	}
+	sort_top(sorted, n, sizeof(sorted[0]), summary_fds, path_counts_cmp);
+
+	fprintf(outf, "\n%9.9s %9.9s %11.11s %11.11s %s\n",
+		"opens", "closes", "usecs/life", "max life", "path");
+	fprintf(outf, "%9.9s %9.9s %11.11s %11.11s %s\n",
+		dashes, dashes, dashes, dashes, dashes);
+	for (i = 0; i < n && i < summary_fds; ++i) {
+		const struct path_counts *const pc = sorted[i];
+
+		fprintf(outf, "%9" PRIu64 " %9" PRIu64 " %11" PRIu64
+			" %11" PRIu64 " %s\n",
+			pc->opens, pc->closes,
+			pc->closes ? pc->lifetime_ns / pc->closes / 1000 : 0,
+			pc->max_lifetime_ns / 1000, pc->path);
+	}
+
+	free(sorted);
+}
+
+struct open_fd {
+	const struct fd_table *ft;
+	int fd;
+};
+
+static int
+open_fd_cmp(const void *a, const void *b)
+{
+	const struct open_fd *const x = a;
+	const struct open_fd *const y = b;
+
+	/* The oldest descriptors first.  */
+	int rc = ts_cmp(&x->ft->fds[x->fd].open_ts, &y->ft->fds[y->fd].open_ts);
+
+	return rc ? rc
+	     : (x->ft->tgid != y->ft->tgid) ? x->ft->tgid - y->ft->tgid
+	     : x->fd - y->fd;
+}
+
+/*
+ * Print the summary_fds oldest descriptors that have not been closed
+ * by the end of tracing, with their open sites when -k is used.
+ */
+static void
+open_fd_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	struct open_fd *sorted;
+	unsigned int i, n = 0;
+
+	for (i = 0; i < fd_hash_size; ++i) {
+		const struct fd_table *ft;
+
+		for (ft = fd_hash[i]; ft; ft = ft->next)
+			n += ft->nopen;
+	}
+	if (!n)
+		return;
+
+	sorted = xcalloc(n, sizeof(sorted[0]));
+	n = 0;
+	for (i = 0; i < fd_hash_size; ++i) {
+		const struct fd_table *ft;
+
+		for (ft = fd_hash[i]; ft; ft = ft->next) {
+			unsigned int fd;
+
+			for (fd = 0; fd < ft->nfds; ++fd) {
+				if (ft->fds[fd].path)
+					sorted[n++] = (struct open_fd) { ft, fd };
+			}
+		}
+	}
+	sort_top(sorted, n, sizeof(sorted[0]), summary_fds, open_fd_cmp);
+
+	fprintf(outf, "\n%u descriptors not closed\n", n);
+	fprintf(outf, "%7.7s %6.6s %11.11s %s\n",
+		"pid", "fd", "seconds", "path");
+	fprintf(outf, "%7.7s %6.6s %11.11s %s\n",
+		dashes, dashes, dashes, dashes);
+	for (i = 0; i < n && i < summary_fds; ++i) {
+		const struct fd_entry *const fe =
+			&sorted[i].ft->fds[sorted[i].fd];
+
+		fprintf(outf, "%7d %6d %11.6f %s\n",
+			sorted[i].ft->tgid, sorted[i].fd,
+			ts_diff_ns(&last_ts, &fe->open_ts) / 1e9, fe->path);
+#ifdef USE_LIBUNWIND
+		if (stack_trace_enabled) {
+			fprintf(outf, "%26s ", "opened at");
+			unwind_print_folded_stack(outf, fe->stack_id);
+			fputc('\n', outf);
+		}
+#endif
+	}
+
+	free(sorted);
+}
+
+void
+fd_summary(FILE *outf)
+{
+	if (!path_hash_count)
+		return;
+
+	path_summary(outf);
+	open_fd_summary(outf);
+}
@@ -0,0 +1,533 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * File dependency capture (--file-deps option).
+ *
+ * For every process, the paths it has read, written, stat'ed, or executed
+ * are collected from the arguments of the successful syscalls that access
+ * files by name, and written as a compact record when the process exits.
+ * Relative paths are resolved against the current directory or the path
+ * of the directory descriptor, which is taken from the cache of getfdpath.
+ * Paths are interned, so every process keeps a set of path pointers
+ * with the kinds of accesses to each path.
+ */
+
+#include "defs.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include "file_deps.h"
+#include "strintern.h"
+#include "syscall.h"
+
+#ifndef AT_FDCWD
+# define AT_FDCWD	-100
+#endif
+
+enum {
+	DEP_EXEC = 1 << 0,
+	DEP_READ = 1 << 1,
+	DEP_WRITE = 1 << 2,
+	DEP_STAT = 1 << 3,
+};
+
+struct dep {
+	const char *path;	/* interned */
+	unsigned int kinds;
+};
+
+struct deps_record {
+	struct deps_record *next;
+	int pid;
+	/* The current directory, NULL if it is not known yet */
+	char *cwd;
+	/* The path of the execve that has not exited yet */
+	const char *exec_path;	/* interned */
+	/* Paths in the order of the first access */
+	struct dep *deps;
+	unsigned int count, size;
+	/* Indices + 1 of deps, hashed by the path pointer */
+	unsigned int *hash;
+	unsigned int hash_size;
+};
+
+#define RECORD_HASH_SIZE 256
+
+static FILE *file_deps_file;
+static const char *file_deps_path;
+static struct deps_record *record_hash[RECORD_HASH_SIZE];
+
+bool
+file_deps_enabled(void)
+{
+	return file_deps_file;
+}
+
+void
+file_deps_init(FILE *fp, const char *path)
+{
+	file_deps_file = fp;
+	file_deps_path = path;
+}
+
+static unsigned int
+hash_pid(const int pid)
+{
+	return ((unsigned int) pid * 2654435761U) % RECORD_HASH_SIZE;
+}
+
+static struct deps_record **
+find_record(const int pid)
+{
+	struct deps_record **p;
+
+	for (p = &record_hash[hash_pid(pid)]; *p; p = &(*p)->next) {
+		if ((*p)->pid == pid)
+			break;
+	}
+
+	return p;
+}
+
+static struct deps_record *
+get_record(const int pid)
+{
+	struct deps_record **const p = find_record(pid);
+
+	if (!*p) {
+		*p = xcalloc(1, sizeof(**p));
+		(*p)->pid = pid;
+	}
+
+	return *p;
+}
+
+static unsigned int
+hash_dep(const char *const path, const unsigned int size)
+{
+	return ((uintptr_t) path >> 3) * 2654435761U & (size - 1);
+}
+
+static void
+dep_hash_expand(struct deps_record *const rec)
+{
+	unsigned int i;
+
+	free(rec->hash);
+	rec->hash_size = rec->hash_size ? rec->hash_size * 2 : 64;
+	rec->hash = xcalloc(rec->hash_size, sizeof(rec->hash[0]));
+
+	for (i = 0; i < rec->count; ++i) {
+		unsigned int h = hash_dep(rec->deps[i].path, rec->hash_size);
+
+		while (rec->hash[h])
+			h = (h + 1) & (rec->hash_size - 1);
+		rec->hash[h] = i + 1;
+	}
+}
+
+static void
+add_dep(struct deps_record *const rec, const char *const path,
+	const unsigned int kinds)
+{
+	const char *const interned = str_intern(path);
+	unsigned int h;
+
+	/* Keep the hash table at most half full.  */
+	if ((rec->count + 1) * 2 > rec->hash_size)
+		dep_hash_expand(rec);
+
+	for (h = hash_dep(interned, rec->hash_size); rec->hash[h];
+	     h = (h + 1) & (rec->hash_size - 1)) {
+		struct dep *const dep = &rec->deps[rec->hash[h] - 1];
+
+		if (dep->path == interned) {
+			dep->kinds |= kinds;
+			str_intern_release(interned);
+			return;
+		}
+	}
+
+	if (rec->count >= rec->size) {
+		rec->size = rec->size ? rec->size * 2 : 32;
+		rec->deps = xreallocarray(rec->deps, rec->size,
+					  sizeof(rec->deps[0]));
+	}
+	rec->deps[rec->count].path = interned;
+	rec->deps[rec->count].kinds = kinds;
+	rec->hash[h] = ++rec->count;
+}
+
+/*
+ * Store the directory that a path relative to dirfd is resolved against
+ * in buf, return false if it is not known.
+ */
+static bool
+get_dir(struct tcb *const tcp, struct deps_record *const rec,
+	const int dirfd, char *const buf, const unsigned int size)
+{
+	if (dirfd != AT_FDCWD)
+		return getfdpath(tcp, dirfd, buf, size) > 0;
+
+	if (!rec->cwd) {
+		char proc_cwd[sizeof("/proc/%d/cwd") + sizeof(int) * 3];
+
+		sprintf(proc_cwd, "/proc/%d/cwd", tcp->pid);
+		const ssize_t n = readlink(proc_cwd, buf, size - 1);
+		if (n <= 0)
+			return false;
+		buf[n] = '\0';
+		rec->cwd = xstrdup(buf);
+		return true;
+	}
+
+	const size_t n = strlen(rec->cwd);
+	if (n >= size)
+		return false;
+	memcpy(buf, rec->cwd, n + 1);
+	return true;
+}
+
+/*
+ * Fetch the path at addr and add it resolved against dirfd.
+ * An empty path refers to dirfd itself, see AT_EMPTY_PATH.
+ */
+static const char *
+resolve_path(struct tcb *const tcp, struct deps_record *const rec,
+	     const int dirfd, const kernel_ulong_t addr, char *const buf)
+{
+	char path[PATH_MAX];
+	const char *rel = path;
+
+	if (umovestr(tcp, addr, sizeof(path), path) <= 0)
+		return NULL;
+	if (path[0] == '/')
+		return strcpy(buf, path);
+
+	while (rel[0] == '.' && rel[1] == '/')
+		rel += 2;
+	if (!strcmp(rel, "."))
+		++rel;
+
+	if (!get_dir(tcp, rec, dirfd, buf, PATH_MAX))
+		return rel[0] ? strcpy(buf, rel) : NULL;
+
+	if (rel[0]) {
+		size_t n = strlen(buf);
+
+		if (buf[n - 1] != '/')
+			buf[n++] = '/';
+		strcpy(buf + n, rel);
+	}
+
+	return buf;
+}
+
+static void
+add_path(struct tcb *const tcp, struct deps_record *const rec,
+	 const int dirfd, const kernel_ulong_t addr, const unsigned int kinds)
+{
+	char buf[PATH_MAX * 2 + 1];
+
+	if (resolve_path(tcp, rec, dirfd, addr, buf))
+		add_dep(rec, buf, kinds);
+}
+
+static unsigned int
+open_kinds(const unsigned int flags)
+{
+#ifdef O_PATH
+	if (flags & O_PATH)
+		return DEP_STAT;
+#endif
+
+	unsigned int kinds = (flags & (O_CREAT | O_TRUNC)) ? DEP_WRITE : 0;
+
+	switch (flags & O_ACCMODE) {
+	case O_RDONLY:
+		return kinds | DEP_READ;
+	case O_WRONLY:
+		return kinds | DEP_WRITE;
+	default:
+		return kinds | DEP_READ | DEP_WRITE;
+	}
+}
+
+/*
+ * The path of an execve is gone with the old memory of the process
+ * when the execve succeeds, so it is fetched on entering.
+ */
+void
+file_deps_syscall_entering(struct tcb *const tcp)
+{
+	char buf[PATH_MAX * 2 + 1];
+	struct deps_record *rec;
+	const char *path;
+
+	switch (tcp->s_ent->sen) {
+	case SEN_execve:
+	case SEN_execv:
+		rec = get_record(get_tcb_tgid(tcp));
+		path = resolve_path(tcp, rec, AT_FDCWD, tcp->u_arg[0], buf);
+		break;
+	case SEN_execveat:
+		rec = get_record(get_tcb_tgid(tcp));
+		path = resolve_path(tcp, rec, tcp->u_arg[0], tcp->u_arg[1], buf);
+		break;
+	default:
+		return;
+	}
+
+	str_intern_release(rec->exec_path);
+	rec->exec_path = str_intern(path);
+}
+
+void
+file_deps_syscall_exiting(struct tcb *const tcp)
+{
+	const kernel_ulong_t *const args = tcp->u_arg;
+	const int sen = tcp->s_ent->sen;
+
+	switch (sen) {
+	case SEN_access:
+	case SEN_chdir:
+	case SEN_creat:
+	case SEN_execv:
+	case SEN_execve:
+	case SEN_execveat:
+	case SEN_faccessat:
+	case SEN_fchdir:
+	case SEN_fstatat64:
+	case SEN_link:
+	case SEN_linkat:
+	case SEN_lstat:
+	case SEN_lstat64:
+	case SEN_mkdir:
+	case SEN_mkdirat:
+	case SEN_mknod:
+	case SEN_mknodat:
+	case SEN_newfstatat:
+	case SEN_oldlstat:
+	case SEN_oldstat:
+	case SEN_open:
+	case SEN_openat:
+	case SEN_readlink:
+	case SEN_readlinkat:
+	case SEN_rename:
+	case SEN_renameat:
+	case SEN_renameat2:
+	case SEN_rmdir:
+	case SEN_stat:
+	case SEN_stat64:
+	case SEN_statx:
+	case SEN_symlink:
+	case SEN_symlinkat:
+	case SEN_truncate:
+	case SEN_truncate64:
+	case SEN_unlink:
+	case SEN_unlinkat:
+		break;
+	default:
+		return;
+	}
+
+	struct deps_record *const rec = get_record(get_tcb_tgid(tcp));
+
+	if (syserror(tcp)) {
+		if (sen == SEN_execve || sen == SEN_execveat
+		    || sen == SEN_execv) {
+			str_intern_release(rec->exec_path);
+			rec->exec_path = NULL;
+		}
+		return;
+	}
+
+	switch (sen) {
+	case SEN_execv:
+	case SEN_execve:
+	case SEN_execveat:
+		if (rec->exec_path) {
+			add_dep(rec, rec->exec_path, DEP_EXEC);
+			str_intern_release(rec->exec_path);
+			rec->exec_path = NULL;
+		}
+		break;
+	case SEN_chdir:
+	case SEN_fchdir:
+		free(rec->cwd);
+		rec->cwd = NULL;
+		break;
+	case SEN_open:
+		add_path(tcp, rec, AT_FDCWD, args[0], open_kinds(args[1]));
+		break;
+	case SEN_openat:
+		add_path(tcp, rec, args[0], args[1], open_kinds(args[2]));
+		break;
+	case SEN_access:
+	case SEN_lstat:
+	case SEN_lstat64:
+	case SEN_oldlstat:
+	case SEN_oldstat:
+	case SEN_stat:
+	case SEN_stat64:
+		add_path(tcp, rec, AT_FDCWD, args[0], DEP_STAT);
+		break;
+	case SEN_faccessat:
+	case SEN_fstatat64:
+	case SEN_newfstatat:
+	case SEN_statx:
+		add_path(tcp, rec, args[0], args[1], DEP_STAT);
+		break;
+	case SEN_readlink:
+		add_path(tcp, rec, AT_FDCWD, args[0], DEP_READ);
+		break;
+	case SEN_readlinkat:
+		add_path(tcp, rec, args[0], args[1], DEP_READ);
+		break;
+	case SEN_link:
+		add_path(tcp, rec, AT_FDCWD, args[0], DEP_STAT);
+		add_path(tcp, rec, AT_FDCWD, args[1], DEP_WRITE);
+		break;
+	case SEN_linkat:
+		add_path(tcp, rec, args[0], args[1], DEP_STAT);
+		add_path(tcp, rec, args[2], args[3], DEP_WRITE);
+		break;
+	case SEN_rename:
+		add_path(tcp, rec, AT_FDCWD, args[0], DEP_WRITE);
+		add_path(tcp, rec, AT_FDCWD, args[1], DEP_WRITE);
+		break;
+	case SEN_renameat:
+	case SEN_renameat2:
+		add_path(tcp, rec, args[0], args[1], DEP_WRITE);
+		add_path(tcp, rec, args[2], args[3], DEP_WRITE);
+		break;
+	case SEN_symlink:
+		add_path(tcp, rec, AT_FDCWD, args[1], DEP_WRITE);
+		break;
+	case SEN_symlinkat:
+		add_path(tcp, rec, args[1], args[2], DEP_WRITE);
+		break;
+	case SEN_mkdirat:
+	case SEN_mknodat:
+	case SEN_unlinkat:
+		add_path(tcp, rec, args[0], args[1], DEP_WRITE);
+		break;
+	default:
+		/* creat, mkdir, mknod, rmdir, truncate, unlink */
+		add_path(tcp, rec, AT_FDCWD, args[0], DEP_WRITE);
+		break;
+	}
+}
+
+/* Write the path escaping backslashes and control characters.  */
+static void
+write_path(FILE *const fp, const char *path)
+{
+	for (; *path; ++path) {
+		const unsigned char c = *path;
+
+		if (c == '\\')
+			fputs("\\\\", fp);
+		else if (c < ' ' || c == 0x7f)
+			fprintf(fp, "\\%03o", c);
+		else
+			fputc(c, fp);
+	}
+}
+
+static void
+write_record(FILE *const fp, struct deps_record *const rec, const char *status)
+{
+	unsigned int i;
+
+	for (i = 0; i < rec->count; ++i) {
+		const struct dep *const dep = &rec->deps[i];
+
+		fprintf(fp, "%d %s%s%s%s ", rec->pid,
+			dep->kinds & DEP_EXEC ? "x" : "",
+			dep->kinds & DEP_READ ? "r" : "",
+			dep->kinds & DEP_WRITE ? "w" : "",
+			dep->kinds & DEP_STAT ? "s" : "");
+		write_path(fp, dep->path);
+		fputc('\n', fp);
+		str_intern_release(dep->path);
+	}
+	fprintf(fp, "%d exit %s\n", rec->pid, status);
+
+	str_intern_release(rec->exec_path);
+	free(rec->cwd);
+	free(rec->deps);
+	free(rec->hash);
+	free(rec);
+}
+
+void
+file_deps_exited(struct tcb *const tcp, const int status)
+{
+	/* The record of a thread group is written when its leader exits.  */
+	if (tcp->tgid && tcp->tgid != tcp->pid)
+		return;
+
+	struct deps_record **const p = find_record(tcp->pid);
+	struct deps_record *const rec = *p;
+	char buf[sizeof(int) * 3];
+
+	if (!rec)
+		return;
+	*p = rec->next;
+
+	if (WIFSIGNALED(status)) {
+		write_record(file_deps_file, rec, signame(WTERMSIG(status)));
+	} else {
+		sprintf(buf, "%d", WEXITSTATUS(status));
+		write_record(file_deps_file, rec, buf);
+	}
+}
+
+/* Write the records of the processes that have not exited.  */
+void
+file_deps_finish(void)
+{
+	unsigned int i;
+
+	if (!file_deps_file)
+		return;
+
+	for (i = 0; i < RECORD_HASH_SIZE; ++i) {
+		while (record_hash[i]) {
+			struct deps_record *const rec = record_hash[i];
+
+			record_hash[i] = rec->next;
+			write_record(file_deps_file, rec, "-");
+		}
+	}
+
+	if (fflush(file_deps_file) || ferror(file_deps_file))
+		perror_msg("%s", file_deps_path);
+	file_deps_file = NULL;
+}
@@ -36,5 +36,6 @@ void qualify_tokens(const char *str, struct number_set *set,
 		    string_to_uint_func func, const char *name);
 void qualify_syscall_tokens(const char *str, struct number_set *set,
 			    const char *name);
+int errnostr_to_uint(const char *str);
 
 #endif /* !STRACE_FILTER_H */
@@ -0,0 +1,522 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Filter expressions over the raw values of a syscall (--filter option).
+ *
+ * An expression is a combination of comparisons joined with "&&", "||",
+ * "!" and parentheses.  A comparison has the form "OPERAND OP VALUE",
+ * where OPERAND is one of arg0 ... arg5, retval, errno, duration,
+ * and OP is one of ==, !=, <, <=, >, >=, & (any of the bits set).
+ *
+ * Comparisons of arguments are decided on syscall entering, before
+ * the syscall is decoded, so syscalls that fail them are not decoded
+ * at all.  Comparisons of the result are decided on syscall exiting;
+ * if they cannot be decided on entering, the output of the syscall
+ * is held back until its result is known.
+ */
+
+#include "defs.h"
+#include <ctype.h>
+#include "filter.h"
+#include "filter_expr.h"
+
+/* Outcome of an evaluation that may lack the result of the syscall.  */
+enum fe_value {
+	FE_FALSE,
+	FE_TRUE,
+	FE_UNKNOWN,
+};
+
+static struct fe_node *nodes;
+static unsigned int nodes_count;
+static unsigned int nodes_size;
+static unsigned int root;
+
+bool filter_expr_in_use;
+bool filter_expr_timed;
+static bool filter_expr_exits;
+
+static const char *expr_str;
+
+static void ATTRIBUTE_NORETURN
+syntax_error(const char *const pos, const char *const what)
+{
+	if (*pos)
+		error_msg_and_die("invalid filter expression '%s': %s at '%s'",
+				  expr_str, what, pos);
+	error_msg_and_die("invalid filter expression '%s': %s at the end",
+			  expr_str, what);
+}
+
+static unsigned int
+new_node(const enum fe_type type)
+{
+	if (nodes_count >= nodes_size) {
+		nodes_size = nodes_size ? nodes_size * 2 : 16;
+		nodes = xreallocarray(nodes, nodes_size, sizeof(*nodes));
+	}
+	memset(&nodes[nodes_count], 0, sizeof(nodes[nodes_count]));
+	nodes[nodes_count].type = type;
+	return nodes_count++;
+}
+
+static unsigned int
+new_binary_node(const enum fe_type type, const unsigned int left,
+		const unsigned int right)
+{
+	const unsigned int i = new_node(type);
+
+	nodes[i].left = left;
+	nodes[i].right = right;
+	return i;
+}
+
+static const char *
+skip_spaces(const char *s)
+{
+	while (*s == ' ' || *s == '\t')
+		++s;
+	return s;
+}
+
+static size_t
+word_len(const char *const s)
+{
+	size_t len = 0;
+
+	while (isalnum((unsigned char) s[len]) || s[len] == '_')
+		++len;
+	return len;
+}
+
+static enum fe_operand
+parse_operand(const char **const ps)
+{
+	const char *const s = *ps;
+	const size_t len = word_len(s);
+
+	*ps = s + len;
+
+	if (len == 4 && !strncmp(s, "arg", 3) &&
+	    s[3] >= '0' && s[3] < '0' + MAX_ARGS)
+		return FE_ARG0 + s[3] - '0';
+	if (len == 6 && !strncmp(s, "retval", 6))
+		return FE_RETVAL;
+	if (len == 5 && !strncmp(s, "errno", 5))
+		return FE_ERRNO;
+	if (len == 8 && !strncmp(s, "duration", 8))
+		return FE_DURATION;
+
+	syntax_error(s, "unknown operand");
+}
+
+static enum fe_op
+parse_op(const char **const ps)
+{
+	const char *const s = *ps;
+	static const struct {
+		const char *str;
+		enum fe_op op;
+	} ops[] = {
+		/* Longer operators go first.  */
+		{ "==", FE_EQ },
+		{ "!=", FE_NE },
+		{ "<=", FE_LE },
+		{ ">=", FE_GE },
+		{ "<", FE_LT },
+		{ ">", FE_GT },
+		{ "&", FE_MASK },
+	};
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(ops); ++i) {
+		const size_t len = strlen(ops[i].str);
+
+		if (!strncmp(s, ops[i].str, len) &&
+		    (ops[i].op != FE_MASK || s[1] != '&')) {
+			*ps = s + len;
+			return ops[i].op;
+		}
+	}
+
+	syntax_error(s, "comparison operator expected");
+}
+
+static uint64_t
+parse_number(const char **const ps)
+{
+	const char *const s = *ps;
+	char *end;
+	uint64_t val;
+
+	errno = 0;
+	if (*s == '-')
+		val = strtoll(s, &end, 0);
+	else if (isdigit((unsigned char) *s))
+		val = strtoull(s, &end, 0);
+	else
+		end = (char *) s;
+	if (end == s || errno || word_len(end))
+		syntax_error(s, "invalid number");
+
+	*ps = end;
+	return val;
+}
+
+static uint64_t
+parse_errno(const char **const ps)
+{
+	const char *const s = *ps;
+	const size_t len = word_len(s);
+	char *const name = xstrndup(s, len);
+	const int err = len ? errnostr_to_uint(name) : -1;
+
+	free(name);
+	if (err < 0)
+		syntax_error(s, "invalid error code");
+
+	*ps = s + len;
+	return err;
+}
+
+/* Durations are given in seconds with an optional unit suffix.  */
+static uint64_t
+parse_duration(const char **const ps)
+{
+	static const struct {
+		const char *suffix;
+		double scale;
+	} units[] = {
+		{ "ns", 1e0 },
+		{ "us", 1e3 },
+		{ "ms", 1e6 },
+		{ "s", 1e9 },
+	};
+	const char *const s = *ps;
+	char *end;
+	double val;
+	double scale = 1e9;
+
+	errno = 0;
+	val = isdigit((unsigned char) *s) ? strtod(s, &end) : -1;
+	if (val < 0 || errno)
+		syntax_error(s, "invalid duration");
+
+	const size_t len = word_len(end);
+	if (len) {
+		unsigned int i;
+
+		for (i = 0; i < ARRAY_SIZE(units); ++i) {
+			if (len == strlen(units[i].suffix) &&
+			    !strncmp(end, units[i].suffix, len))
+				break;
+		}
+		if (i == ARRAY_SIZE(units))
+			syntax_error(end, "invalid duration unit");
+		scale = units[i].scale;
+		end += len;
+	}
+
+	val *= scale;
+	if (val >= 18e18)
+		syntax_error(s, "invalid duration");
+
+	*ps = end;
+	return val;
+}
+
+static unsigned int
+parse_comparison(const char **const ps)
+{
+	const char *s = skip_spaces(*ps);
+	const unsigned int i = new_node(FE_CMP);
+	const enum fe_operand operand = parse_operand(&s);
+	s = skip_spaces(s);
+	const enum fe_op op = parse_op(&s);
+	uint64_t value;
+
+	s = skip_spaces(s);
+	switch (operand) {
+	case FE_ERRNO:
+		value = parse_errno(&s);
+		filter_expr_exits = true;
+		break;
+	case FE_DURATION:
+		value = parse_duration(&s);
+		filter_expr_exits = filter_expr_timed = true;
+		break;
+	case FE_RETVAL:
+		value = parse_number(&s);
+		filter_expr_exits = true;
+		break;
+	default:
+		value = parse_number(&s);
+		break;
+	}
+
+	nodes[i].operand = operand;
+	nodes[i].op = op;
+	nodes[i].value = value;
+	*ps = s;
+	return i;
+}
+
+static unsigned int parse_or(const char **);
+
+static unsigned int
+parse_unary(const char **const ps)
+{
+	const char *s = skip_spaces(*ps);
+	unsigned int i;
+
+	if (*s == '!' && s[1] != '=') {
+		++s;
+		i = new_node(FE_NOT);
+		const unsigned int left = parse_unary(&s);
+		nodes[i].left = left;
+	} else if (*s == '(') {
+		++s;
+		i = parse_or(&s);
+		s = skip_spaces(s);
+		if (*s != ')')
+			syntax_error(s, "')' expected");
+		++s;
+	} else {
+		i = parse_comparison(&s);
+	}
+
+	*ps = s;
+	return i;
+}
+
+static unsigned int
+parse_and(const char **const ps)
+{
+	unsigned int i = parse_unary(ps);
+
+	for (;;) {
+		const char *s = skip_spaces(*ps);
+
+		if (s[0] != '&' || s[1] != '&')
+			return i;
+		*ps = s + 2;
+		const unsigned int right = parse_unary(ps);
+		i = new_binary_node(FE_AND, i, right);
+	}
+}
+
+static unsigned int
+parse_or(const char **const ps)
+{
+	unsigned int i = parse_and(ps);
+
+	for (;;) {
+		const char *s = skip_spaces(*ps);
+
+		if (s[0] != '|' || s[1] != '|')
+			return i;
+		*ps = s + 2;
+		const unsigned int right = parse_and(ps);
+		i = new_binary_node(FE_OR, i, right);
+	}
+}
+
+/*
+ * Several --filter options are combined with "&&".
+ */
+void
+filter_expr_parse(const char *const str)
+{
+	const char *s = str;
+
+	expr_str = str;
+	unsigned int i = parse_or(&s);
+	s = skip_spaces(s);
+	if (*s)
+		syntax_error(s, "unexpected input");
+
+	if (filter_expr_in_use)
+		i = new_binary_node(FE_AND, root, i);
+	root = i;
+	filter_expr_in_use = true;
+
+#ifndef HAVE_OPEN_MEMSTREAM
+	if (filter_expr_exits)
+		error_msg_and_die("filter expressions on syscall results are"
+				  " not supported by this build of strace");
+#endif
+}
+
+static bool
+compare(const struct fe_node *const node, const uint64_t val, const bool sign)
+{
+	switch (node->op) {
+	case FE_EQ:
+		return val == node->value;
+	case FE_NE:
+		return val != node->value;
+	case FE_MASK:
+		return val & node->value;
+	}
+
+	if (sign) {
+		const int64_t a = val;
+		const int64_t b = node->value;
+
+		switch (node->op) {
+		case FE_LT:
+			return a < b;
+		case FE_LE:
+			return a <= b;
+		case FE_GT:
+			return a > b;
+		default:
+			return a >= b;
+		}
+	}
+
+	switch (node->op) {
+	case FE_LT:
+		return val < node->value;
+	case FE_LE:
+		return val <= node->value;
+	case FE_GT:
+		return val > node->value;
+	default:
+		return val >= node->value;
+	}
+}
+
+static enum fe_value
+eval_cmp(const struct fe_node *const node, const struct tcb *const tcp,
+	 const struct timespec *const ts)
+{
+	uint64_t val;
+	bool sign = false;
+
+	if (node->operand <= FE_ARG5) {
+		val = tcp->u_arg[node->operand - FE_ARG0];
+	} else if (!ts) {
+		return FE_UNKNOWN;
+	} else if (node->operand == FE_RETVAL) {
+		val = syserror(tcp) ? (uint64_t) -1 : (uint64_t) tcp->u_rval;
+		sign = true;
+	} else if (node->operand == FE_ERRNO) {
+		val = tcp->u_error;
+	} else {
+		struct timespec dt;
+
+		ts_sub(&dt, ts, &tcp->etime);
+		val = dt.tv_sec * 1000000000ULL + dt.tv_nsec;
+	}
+
+	return compare(node, val, sign) ? FE_TRUE : FE_FALSE;
+}
+
+/*
+ * Evaluate the expression using three-valued logic,
+ * comparisons of the result are unknown on entering (TS == NULL).
+ */
+static enum fe_value
+eval(const unsigned int i, const struct tcb *const tcp,
+     const struct timespec *const ts)
+{
+	const struct fe_node *const node = &nodes[i];
+	enum fe_value left;
+
+	switch (node->type) {
+	case FE_CMP:
+		return eval_cmp(node, tcp, ts);
+	case FE_NOT:
+		left = eval(node->left, tcp, ts);
+		return left == FE_UNKNOWN ? FE_UNKNOWN
+		       : left == FE_TRUE ? FE_FALSE : FE_TRUE;
+	case FE_AND:
+		left = eval(node->left, tcp, ts);
+		if (left == FE_FALSE)
+			return FE_FALSE;
+		const enum fe_value right_and = eval(node->right, tcp, ts);
+		if (right_and == FE_FALSE)
+			return FE_FALSE;
+		return left == FE_TRUE ? right_and : FE_UNKNOWN;
+	default:
+		left = eval(node->left, tcp, ts);
+		if (left == FE_TRUE)
+			return FE_TRUE;
+		const enum fe_value right_or = eval(node->right, tcp, ts);
+		if (right_or == FE_TRUE)
+			return FE_TRUE;
+		return left == FE_FALSE ? right_or : FE_UNKNOWN;
+	}
+}
+
+const struct fe_node *
+filter_expr_node(const unsigned int i)
+{
+	return &nodes[i];
+}
+
+unsigned int
+filter_expr_root(void)
+{
+	return root;
+}
+
+/*
+ * Return false if the syscall does not match the expression.
+ * If the match depends on the result of the syscall,
+ * set TCB_FILTER_EXIT, so the expression is evaluated again on exiting.
+ */
+bool
+filter_expr_entering(struct tcb *const tcp)
+{
+	tcp->flags &= ~TCB_FILTER_EXIT;
+
+	switch (eval(root, tcp, NULL)) {
+	case FE_FALSE:
+		return false;
+	case FE_UNKNOWN:
+		tcp->flags |= TCB_FILTER_EXIT;
+		break;
+	default:
+		break;
+	}
+
+	return true;
+}
+
+/*
+ * Return false if the syscall does not match the expression.
+ * TS is the time of syscall exiting.
+ */
+bool
+filter_expr_exiting(struct tcb *const tcp, const struct timespec *const ts)
+{
+	return eval(root, tcp, ts) == FE_TRUE;
+}
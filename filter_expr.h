@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef STRACE_FILTER_EXPR_H
+#define STRACE_FILTER_EXPR_H
+
+#include "defs.h"
+
+/*
+ * Nodes of the --filter expression, for the seccomp filter that
+ * compiles the comparisons of arguments.
+ */
+
+enum fe_type {
+	FE_CMP,
+	FE_NOT,
+	FE_AND,
+	FE_OR,
+};
+
+enum fe_operand {
+	FE_ARG0,
+	FE_ARG5 = FE_ARG0 + MAX_ARGS - 1,
+	FE_RETVAL,
+	FE_ERRNO,
+	FE_DURATION,
+};
+
+enum fe_op {
+	FE_EQ,
+	FE_NE,
+	FE_LT,
+	FE_LE,
+	FE_GT,
+	FE_GE,
+	FE_MASK,
+};
+
+struct fe_node {
+	uint8_t type;
+	uint8_t operand;
+	uint8_t op;
+	unsigned int left;
+	unsigned int right;
+	uint64_t value;
+};
+
+/* Return the node, the root one is returned by filter_expr_root.  */
+extern const struct fe_node *filter_expr_node(unsigned int);
+extern unsigned int filter_expr_root(void);
+
+#endif /* !STRACE_FILTER_EXPR_H */
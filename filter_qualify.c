@@ -34,12 +34,49 @@
 struct number_set *read_set;
 struct number_set *write_set;
 struct number_set *signal_set;
+struct number_set *trace_set;
 
 static struct number_set *abbrev_set;
 static struct number_set *inject_set;
 static struct number_set *raw_set;
-static struct number_set *trace_set;
+static struct number_set *stack_set;
 static struct number_set *verbose_set;
+static struct number_set *ring_trigger_set;
+static struct number_set *ring_trigger_error_set;
+static struct number_set *trigger_set;
+static struct number_set *trigger_error_set;
+static struct number_set *trigger_signal_set;
+
+/*
+ * Dense per-personality tables of qualification flags indexed by syscall
+ * number, built on first use and dropped whenever qualifiers change.
+ */
+static uint8_t *qual_flags_table[SUPPORTED_PERSONALITIES];
+
+/* -e strlen= limits, a later one overrides the earlier ones.  */
+struct strlen_rule {
+	struct number_set *set;
+	unsigned int limit;
+};
+
+static struct strlen_rule *strlen_rules;
+static unsigned int nstrlen_rules;
+/* Like qual_flags_table, the limit of each syscall.  */
+static unsigned int *strlen_table[SUPPORTED_PERSONALITIES];
+bool strlen_qualified;
+
+static void
+invalidate_qual_flags(void)
+{
+	unsigned int p;
+
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		free(qual_flags_table[p]);
+		qual_flags_table[p] = NULL;
+		free(strlen_table[p]);
+		strlen_table[p] = NULL;
+	}
+}
 
 static int
 sigstr_to_uint(const char *s)
@@ -82,6 +119,50 @@ find_errno_by_name(const char *name)
 	return -1;
 }
 
+int
+errnostr_to_uint(const char *s)
+{
+	if (*s >= '0' && *s <= '9')
+		return string_to_uint_upto(s, MAX_ERRNO_VALUE);
+
+	return find_errno_by_name(s);
+}
+
+/*
+ * Parse a percentage with up to 4 fractional digits, e.g. "0.1%",
+ * into millionths.  The percent sign is optional.
+ */
+static int
+parse_inject_prob(const char *val)
+{
+	unsigned int prob = 0;
+	unsigned int scale = INJECT_PROB_SCALE / 100;
+	bool digits = false;
+
+	for (; *val >= '0' && *val <= '9'; ++val, digits = true) {
+		prob = prob * 10 + (*val - '0');
+		if (prob > 100)
+			return -1;
+	}
+	prob *= scale;
+
+	if (*val == '.') {
+		for (++val; *val >= '0' && *val <= '9'; ++val, digits = true) {
+			scale /= 10;
+			if (!scale)
+				return -1;
+			prob += (*val - '0') * scale;
+		}
+	}
+
+	if (*val == '%')
+		++val;
+	if (*val || !digits || !prob || prob > INJECT_PROB_SCALE)
+		return -1;
+
+	return prob;
+}
+
 static bool
 parse_inject_token(const char *const token, struct inject_opts *const fopts,
 		   const bool fault_tokens_only)
@@ -147,6 +228,44 @@ parse_inject_token(const char *const token, struct inject_opts *const fopts,
 			return false;
 		fopts->data.signo = intval;
 		fopts->data.flags |= INJECT_F_SIGNAL;
+	} else if (!fault_tokens_only
+		   && (val = STR_STRIP_PREFIX(token, "delay_enter=")) != token) {
+		if (fopts->data.flags & INJECT_F_DELAY_ENTER)
+			return false;
+		intval = string_to_uint(val);
+		if (intval < 0)
+			return false;
+		fopts->data.delay_enter = intval;
+		fopts->data.flags |= INJECT_F_DELAY_ENTER;
+	} else if (!fault_tokens_only
+		   && (val = STR_STRIP_PREFIX(token, "delay_exit=")) != token) {
+		if (fopts->data.flags & INJECT_F_DELAY_EXIT)
+			return false;
+		intval = string_to_uint(val);
+		if (intval < 0)
+			return false;
+		fopts->data.delay_exit = intval;
+		fopts->data.flags |= INJECT_F_DELAY_EXIT;
+	} else if ((val = STR_STRIP_PREFIX(token, "prob=")) != token) {
+		if (fopts->prob)
+			return false;
+		intval = parse_inject_prob(val);
+		if (intval < 1)
+			return false;
+		fopts->prob = intval;
+	} else if ((val = STR_STRIP_PREFIX(token, "rate=")) != token) {
+		if (fopts->rate)
+			return false;
+		intval = string_to_uint(val);
+		if (intval < 1)
+			return false;
+		fopts->rate = intval;
+	} else if ((val = STR_STRIP_PREFIX(token, "path=")) != token) {
+		if (!*val)
+			return false;
+		if (!fopts->paths)
+			fopts->paths = xcalloc(1, sizeof(*fopts->paths));
+		pathtrace_select_set(val, fopts->paths);
 	} else {
 		return false;
 	}
@@ -236,6 +355,49 @@ qualify_raw(const char *const str)
 	qualify_syscall_tokens(str, raw_set, "system call");
 }
 
+static void
+qualify_stack(const char *const str)
+{
+	if (!stack_set)
+		stack_set = alloc_number_set_array(SUPPORTED_PERSONALITIES);
+	qualify_syscall_tokens(str, stack_set, "system call");
+}
+
+/*
+ * Parse comma separated SET:N limits, where SET is a syscall name,
+ * a class, or a regular expression of -e trace.
+ */
+static void
+qualify_strlen(const char *const str)
+{
+	char *copy = xstrdup(str);
+	char *saveptr = NULL;
+	char *token;
+
+	for (token = strtok_r(copy, ",", &saveptr); token;
+	     token = strtok_r(NULL, ",", &saveptr)) {
+		char *const colon = strrchr(token, ':');
+		const int limit = colon ? string_to_uint(colon + 1) : -1;
+
+		if (colon == token || limit < 0
+		    || (unsigned int) limit > -1U / 4)
+			error_msg_and_die("invalid %s '%s'", "strlen", token);
+		*colon = '\0';
+
+		strlen_rules = xreallocarray(strlen_rules, nstrlen_rules + 1,
+					     sizeof(*strlen_rules));
+
+		struct strlen_rule *const rule = &strlen_rules[nstrlen_rules++];
+
+		rule->set = alloc_number_set_array(SUPPORTED_PERSONALITIES);
+		rule->limit = limit;
+		qualify_syscall_tokens(token, rule->set, "system call");
+	}
+
+	free(copy);
+	strlen_qualified = true;
+}
+
 static void
 qualify_inject_common(const char *const str,
 		      const bool fault_tokens_only,
@@ -251,7 +413,7 @@ qualify_inject_common(const char *const str,
 		error_msg_and_die("invalid %s '%s'", description, str);
 	}
 
-	/* If neither of retval, error, or signal is specified, then ... */
+	/* If none of retval, error, signal, or delay is specified, then ... */
 	if (!opts.data.flags) {
 		if (fault_tokens_only) {
 			/* in fault= syntax the default error code is ENOSYS. */
@@ -263,6 +425,9 @@ qualify_inject_common(const char *const str,
 		}
 	}
 
+	if (opts.data.flags & (INJECT_F_DELAY_ENTER | INJECT_F_DELAY_EXIT))
+		inject_delays = true;
+
 	struct number_set *tmp_set =
 		alloc_number_set_array(SUPPORTED_PERSONALITIES);
 	qualify_syscall_tokens(name, tmp_set, description);
@@ -323,6 +488,8 @@ static const struct qual_options {
 	{ "v",		qualify_verbose	},
 	{ "raw",	qualify_raw	},
 	{ "x",		qualify_raw	},
+	{ "stack",	qualify_stack	},
+	{ "k",		qualify_stack	},
 	{ "signal",	qualify_signals	},
 	{ "signals",	qualify_signals	},
 	{ "s",		qualify_signals	},
@@ -334,6 +501,7 @@ static const struct qual_options {
 	{ "w",		qualify_write	},
 	{ "fault",	qualify_fault	},
 	{ "inject",	qualify_inject	},
+	{ "strlen",	qualify_strlen	},
 };
 
 void
@@ -355,19 +523,178 @@ qualify(const char *str)
 	}
 
 	opt->qualify(str);
+	invalidate_qual_flags();
 }
 
-unsigned int
-qual_flags(const unsigned int scno)
+void
+qualify_ring_trigger(const char *const str)
 {
-	return	(is_number_in_set_array(scno, trace_set, current_personality)
+	if (!ring_trigger_set)
+		ring_trigger_set = alloc_number_set_array(SUPPORTED_PERSONALITIES);
+	qualify_syscall_tokens(str, ring_trigger_set, "system call");
+}
+
+void
+qualify_ring_trigger_error(const char *const str)
+{
+	if (!ring_trigger_error_set)
+		ring_trigger_error_set = alloc_number_set_array(1);
+	qualify_tokens(str, ring_trigger_error_set, errnostr_to_uint, "error");
+}
+
+/*
+ * Return true if the finished syscall of TCP triggers a dump
+ * of the --ring-buffer flight recorder.
+ */
+bool
+ring_triggered(const struct tcb *const tcp)
+{
+	return is_number_in_set_array(tcp->scno, ring_trigger_set,
+				      current_personality)
+	       || (syserror(tcp) &&
+		   is_number_in_set(tcp->u_error, ring_trigger_error_set));
+}
+
+void
+qualify_trigger(const char *const str)
+{
+	if (!trigger_set)
+		trigger_set = alloc_number_set_array(SUPPORTED_PERSONALITIES);
+	qualify_syscall_tokens(str, trigger_set, "system call");
+}
+
+void
+qualify_trigger_error(const char *const str)
+{
+	if (!trigger_error_set)
+		trigger_error_set = alloc_number_set_array(1);
+	qualify_tokens(str, trigger_error_set, errnostr_to_uint, "error");
+}
+
+void
+qualify_trigger_signal(const char *const str)
+{
+	if (!trigger_signal_set)
+		trigger_signal_set = alloc_number_set_array(1);
+	qualify_tokens(str, trigger_signal_set, sigstr_to_uint, "signal");
+}
+
+/*
+ * Return true if the syscall of TCP may open a --trigger-window,
+ * either because it is in the --trigger set or because no such set
+ * has been specified.
+ */
+bool
+trigger_syscall_matches(const struct tcb *const tcp)
+{
+	return !trigger_set
+	       || is_number_in_set_array(tcp->scno, trigger_set,
+					 current_personality);
+}
+
+/* Return true if the triggering syscall depends on its result.  */
+bool
+trigger_errors_in_use(void)
+{
+	return trigger_error_set != NULL;
+}
+
+/*
+ * Return true if the finished syscall of TCP fails with an error
+ * of the --trigger-error set.
+ */
+bool
+trigger_error_matches(const struct tcb *const tcp)
+{
+	return syserror(tcp) && is_number_in_set(tcp->u_error,
+						 trigger_error_set);
+}
+
+/* Return true if the signal is in the --trigger-signal set.  */
+bool
+trigger_signal_matches(const unsigned int sig)
+{
+	return is_number_in_set(sig, trigger_signal_set);
+}
+
+static unsigned int
+lookup_qual_flags(const unsigned int scno, const unsigned int p)
+{
+	return	(is_number_in_set_array(scno, trace_set, p)
 		   ? QUAL_TRACE : 0)
-		| (is_number_in_set_array(scno, abbrev_set, current_personality)
+		| (is_number_in_set_array(scno, abbrev_set, p)
 		   ? QUAL_ABBREV : 0)
-		| (is_number_in_set_array(scno, verbose_set, current_personality)
+		| (is_number_in_set_array(scno, verbose_set, p)
 		   ? QUAL_VERBOSE : 0)
-		| (is_number_in_set_array(scno, raw_set, current_personality)
+		| (is_number_in_set_array(scno, raw_set, p)
 		   ? QUAL_RAW : 0)
-		| (is_number_in_set_array(scno, inject_set, current_personality)
-		   ? QUAL_INJECT : 0);
+		| (is_number_in_set_array(scno, inject_set, p)
+		   ? QUAL_INJECT : 0)
+		| (is_number_in_set_array(scno, stack_set, p)
+		   ? QUAL_STACK : 0);
+}
+
+static const uint8_t *
+build_qual_flags(const unsigned int p)
+{
+	const unsigned int n = nsyscall_vec[p];
+	uint8_t *const table = xcalloc(n ? n : 1, sizeof(*table));
+	unsigned int scno;
+
+	for (scno = 0; scno < n; ++scno)
+		table[scno] = lookup_qual_flags(scno, p);
+
+	return qual_flags_table[p] = table;
+}
+
+unsigned int
+qual_flags(const unsigned int scno)
+{
+	const unsigned int p = current_personality;
+
+	if (scno >= nsyscall_vec[p])
+		return lookup_qual_flags(scno, p);
+
+	const uint8_t *table = qual_flags_table[p];
+	if (!table)
+		table = build_qual_flags(p);
+
+	return table[scno];
+}
+
+static unsigned int
+lookup_strlen(const kernel_ulong_t scno, const unsigned int p)
+{
+	unsigned int i;
+
+	for (i = nstrlen_rules; i > 0; --i) {
+		if (is_number_in_set_array(scno, strlen_rules[i - 1].set, p))
+			return strlen_rules[i - 1].limit;
+	}
+
+	return max_strlen;
+}
+
+/* Return the -s limit of the syscall, see tcb_max_strlen.  */
+unsigned int
+qual_strlen(const kernel_ulong_t scno)
+{
+	const unsigned int p = current_personality;
+
+	if (scno >= nsyscall_vec[p])
+		return lookup_strlen(scno, p);
+
+	unsigned int *table = strlen_table[p];
+
+	if (!table) {
+		const unsigned int n = nsyscall_vec[p];
+		unsigned int i;
+
+		table = xcalloc(n ? n : 1, sizeof(*table));
+		for (i = 0; i < n; ++i)
+			table[i] = lookup_strlen(i, p);
+		strlen_table[p] = table;
+	}
+
+	return table[scno];
 }
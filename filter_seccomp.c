@@ -0,0 +1,527 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "defs.h"
+#include "filter_seccomp.h"
+#include "number_set.h"
+#include "ptrace.h"
+#include "syscall.h"
+
+bool seccomp_filtering;
+bool seccomp_before_sysentry;
+
+#if defined HAVE_LINUX_SECCOMP_H \
+ && (defined X86_64 || defined X32 || defined I386 || defined AARCH64 \
+     || defined POWERPC64 || defined POWERPC || defined S390X || defined S390)
+
+# include <sys/prctl.h>
+# include <linux/audit.h>
+# include <linux/filter.h>
+# include <linux/seccomp.h>
+# include "filter_expr.h"
+
+# ifndef SECCOMP_RET_TRACE
+#  define SECCOMP_RET_TRACE	0x7ff00000U
+# endif
+# ifndef SECCOMP_RET_ALLOW
+#  define SECCOMP_RET_ALLOW	0x7fff0000U
+# endif
+# ifndef __X32_SYSCALL_BIT
+#  define __X32_SYSCALL_BIT	0x40000000
+# endif
+
+/*
+ * AUDIT_ARCH_* value and the syscall number flag reported by the kernel
+ * for each personality.  Zero arch means that the filter cannot tell
+ * the syscalls of this personality apart, so they are always traced.
+ */
+struct audit_arch_t {
+	unsigned int arch;
+	unsigned int flag;
+};
+
+static const struct audit_arch_t audit_arch_vec[SUPPORTED_PERSONALITIES] = {
+# if defined X86_64
+	{ AUDIT_ARCH_X86_64, 0 },
+#  if SUPPORTED_PERSONALITIES > 1
+	{ AUDIT_ARCH_I386, 0 },
+	{ AUDIT_ARCH_X86_64, __X32_SYSCALL_BIT },
+#  endif
+# elif defined X32
+	{ AUDIT_ARCH_X86_64, __X32_SYSCALL_BIT },
+#  if SUPPORTED_PERSONALITIES > 1
+	{ AUDIT_ARCH_I386, 0 },
+#  endif
+# elif defined I386
+	{ AUDIT_ARCH_I386, 0 },
+# elif defined AARCH64
+	{ AUDIT_ARCH_AARCH64, 0 },
+#  if SUPPORTED_PERSONALITIES > 1
+	/* arm private syscall numbers are shuffled by strace.  */
+	{ 0, 0 },
+#  endif
+# elif defined POWERPC64
+#  if WORDS_BIGENDIAN
+	{ AUDIT_ARCH_PPC64, 0 },
+#  else
+	{ AUDIT_ARCH_PPC64LE, 0 },
+#  endif
+#  if SUPPORTED_PERSONALITIES > 1
+	{ AUDIT_ARCH_PPC, 0 },
+#  endif
+# elif defined POWERPC
+	{ AUDIT_ARCH_PPC, 0 },
+# elif defined S390X
+	{ AUDIT_ARCH_S390X, 0 },
+	{ AUDIT_ARCH_S390, 0 },
+# elif defined S390
+	{ AUDIT_ARCH_S390, 0 },
+# endif
+};
+
+static const unsigned int klongsize_vec[SUPPORTED_PERSONALITIES] = {
+	PERSONALITY0_KLONGSIZE,
+# if SUPPORTED_PERSONALITIES > 1
+	PERSONALITY1_KLONGSIZE,
+# endif
+# if SUPPORTED_PERSONALITIES > 2
+	PERSONALITY2_KLONGSIZE,
+# endif
+};
+
+static struct sock_filter filter[BPF_MAXINSNS];
+static unsigned short filter_len;
+
+/*
+ * Whether the comparisons of arguments of --filter are compiled
+ * into the filter, see add_expr_block.
+ */
+static bool filter_args;
+
+enum seccomp_action {
+	SECCOMP_SKIP,		/* The syscall does not stop the tracee */
+	SECCOMP_STOP,		/* The syscall always stops the tracee */
+	SECCOMP_MATCH,		/* It does if its arguments match --filter */
+};
+
+/*
+ * Return whether the syscall of the given personality has to produce
+ * a seccomp stop.  Syscalls that strace treats specially regardless of
+ * the trace set, as well as unknown syscalls, are never filtered out.
+ */
+static enum seccomp_action
+traced_by_seccomp(const unsigned int scno, const unsigned int p)
+{
+	const struct_sysent *const s_ent = &sysent_vec[p][scno];
+
+	if (!s_ent->sys_func)
+		return SECCOMP_STOP;
+
+	switch (s_ent->sen) {
+		case SEN_execve:
+		case SEN_execveat:
+		case SEN_execv:
+		case SEN_socketcall:
+		case SEN_ipc:
+			return SECCOMP_STOP;
+		case SEN_close:
+		case SEN_dup2:
+		case SEN_dup3:
+			/* These invalidate descriptor paths cached by getfdpath. */
+			if (fd_cache_in_use)
+				return SECCOMP_STOP;
+	}
+
+# ifdef USE_LIBUNWIND
+	/* These update the memory maps cached by the stack unwinder.  */
+	if (stack_trace_enabled
+	    && (s_ent->sys_flags & STACKTRACE_INVALIDATE_CACHE))
+		return SECCOMP_STOP;
+# endif
+
+	if (!is_number_in_set_array(scno, trace_set, p))
+		return SECCOMP_SKIP;
+
+	return filter_args ? SECCOMP_MATCH : SECCOMP_STOP;
+}
+
+static bool
+add_insn(const struct sock_filter insn)
+{
+	if (filter_len >= BPF_MAXINSNS)
+		return false;
+	filter[filter_len++] = insn;
+	return true;
+}
+
+# define ADD_STMT(code_, k_) \
+	do { \
+		if (!add_insn((struct sock_filter) BPF_STMT((code_), (k_)))) \
+			return false; \
+	} while (0)
+
+# define ADD_JUMP(code_, k_, jt_, jf_) \
+	do { \
+		if (!add_insn((struct sock_filter) \
+			      BPF_JUMP((code_), (k_), (jt_), (jf_)))) \
+			return false; \
+	} while (0)
+
+/*
+ * Return the flag used by another personality sharing the audit arch
+ * of personality p, or 0 if there is no such personality.
+ */
+static unsigned int
+sibling_flag(const unsigned int p)
+{
+	unsigned int i;
+
+	for (i = 0; i < SUPPORTED_PERSONALITIES; ++i) {
+		if (i != p && audit_arch_vec[i].arch == audit_arch_vec[p].arch
+		    && audit_arch_vec[i].flag)
+			return audit_arch_vec[i].flag;
+	}
+
+	return 0;
+}
+
+/*
+ * Lists of jumps to be patched are chained through the offsets
+ * of the jumps, a list is the index of its last jump plus one,
+ * or 0 if it is empty.
+ */
+static bool
+add_jump_to(unsigned int *const list)
+{
+	ADD_STMT(BPF_JMP | BPF_JA, *list);
+	*list = filter_len;
+	return true;
+}
+
+static void
+patch_jumps(unsigned int list, const unsigned int target)
+{
+	while (list) {
+		const unsigned int i = list - 1;
+
+		list = filter[i].k;
+		filter[i].k = target - i - 1;
+	}
+}
+
+# if WORDS_BIGENDIAN
+#  define ARG_LO_OFFSET 4
+#  define ARG_HI_OFFSET 0
+# else
+#  define ARG_LO_OFFSET 0
+#  define ARG_HI_OFFSET 4
+# endif
+
+/*
+ * Add the comparison of an argument, jumping to the list T if it holds
+ * and to the list F otherwise.  Arguments are compared as 64-bit
+ * unsigned numbers, the upper halves of those of personalities with
+ * 32-bit kernel longs are zero, like in tcp->u_arg.
+ */
+static bool
+add_arg_comparison(const struct fe_node *const node, const unsigned int p,
+		   unsigned int *const t, unsigned int *const f)
+{
+	const unsigned int arg = offsetof(struct seccomp_data, args) +
+				 (node->operand - FE_ARG0) * sizeof(uint64_t);
+	const uint32_t hi = node->value >> 32;
+	const uint32_t lo = node->value;
+	unsigned int *const lt = node->op == FE_LT || node->op == FE_LE ? f : t;
+	unsigned int *const lf = lt == t ? f : t;
+	unsigned int jop;
+
+	if (klongsize_vec[p] < sizeof(uint64_t))
+		ADD_STMT(BPF_LD | BPF_IMM, 0);
+	else
+		ADD_STMT(BPF_LD | BPF_W | BPF_ABS, arg + ARG_HI_OFFSET);
+
+	switch (node->op) {
+	case FE_EQ:
+		ADD_JUMP(BPF_JMP | BPF_JEQ | BPF_K, hi, 0, 3);
+		ADD_STMT(BPF_LD | BPF_W | BPF_ABS, arg + ARG_LO_OFFSET);
+		ADD_JUMP(BPF_JMP | BPF_JEQ | BPF_K, lo, 0, 1);
+		return add_jump_to(t) && add_jump_to(f);
+	case FE_NE:
+		ADD_JUMP(BPF_JMP | BPF_JEQ | BPF_K, hi, 0, 3);
+		ADD_STMT(BPF_LD | BPF_W | BPF_ABS, arg + ARG_LO_OFFSET);
+		ADD_JUMP(BPF_JMP | BPF_JEQ | BPF_K, lo, 0, 1);
+		return add_jump_to(f) && add_jump_to(t);
+	case FE_MASK:
+		ADD_JUMP(BPF_JMP | BPF_JSET | BPF_K, hi, 2, 0);
+		ADD_STMT(BPF_LD | BPF_W | BPF_ABS, arg + ARG_LO_OFFSET);
+		ADD_JUMP(BPF_JMP | BPF_JSET | BPF_K, lo, 0, 1);
+		return add_jump_to(t) && add_jump_to(f);
+	}
+
+	/* a < b is !(a >= b), and a <= b is !(a > b).  */
+	jop = node->op == FE_GT || node->op == FE_LE ? BPF_JGT : BPF_JGE;
+	ADD_JUMP(BPF_JMP | BPF_JGT | BPF_K, hi, 3, 0);
+	ADD_JUMP(BPF_JMP | BPF_JEQ | BPF_K, hi, 0, 3);
+	ADD_STMT(BPF_LD | BPF_W | BPF_ABS, arg + ARG_LO_OFFSET);
+	ADD_JUMP(BPF_JMP | jop | BPF_K, lo, 0, 1);
+	return add_jump_to(lt) && add_jump_to(lf);
+}
+
+/*
+ * Add the code of a --filter expression node, jumping to the list YES
+ * if the node may be true (POS) or false (!POS), and to the list NO
+ * otherwise.  Comparisons of the result are not known on entering,
+ * so they may be either.
+ */
+static bool
+add_expr(const unsigned int i, const bool pos, const unsigned int p,
+	 unsigned int *const yes, unsigned int *const no)
+{
+	const struct fe_node *const node = filter_expr_node(i);
+	unsigned int next = 0;
+
+	switch (node->type) {
+	case FE_CMP:
+		if (node->operand > FE_ARG5)
+			return add_jump_to(yes);
+		return pos ? add_arg_comparison(node, p, yes, no)
+			   : add_arg_comparison(node, p, no, yes);
+	case FE_NOT:
+		return add_expr(node->left, !pos, p, yes, no);
+	}
+
+	/*
+	 * An "&&" may be true if both sides may be true, and may be false
+	 * if either side may be false, and the other way round for "||".
+	 */
+	if ((node->type == FE_AND) == pos) {
+		if (!add_expr(node->left, pos, p, &next, no))
+			return false;
+	} else {
+		if (!add_expr(node->left, pos, p, yes, &next))
+			return false;
+	}
+	patch_jumps(next, filter_len);
+
+	return add_expr(node->right, pos, p, yes, no);
+}
+
+/*
+ * Add the block the syscalls that match --filter unless their arguments
+ * do not jump to, which returns SECCOMP_RET_ALLOW for syscalls that
+ * filter_expr_entering would filter out.
+ */
+static bool
+add_expr_block(const unsigned int p, const unsigned int match)
+{
+	unsigned int yes = 0;
+	unsigned int no = 0;
+
+	patch_jumps(match, filter_len);
+	if (!add_expr(filter_expr_root(), true, p, &yes, &no))
+		return false;
+	patch_jumps(yes, filter_len);
+	ADD_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE);
+	patch_jumps(no, filter_len);
+	ADD_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+
+	return true;
+}
+
+static bool
+expr_has_args(const unsigned int i)
+{
+	const struct fe_node *const node = filter_expr_node(i);
+
+	switch (node->type) {
+	case FE_CMP:
+		return node->operand <= FE_ARG5;
+	case FE_NOT:
+		return expr_has_args(node->left);
+	default:
+		return expr_has_args(node->left) || expr_has_args(node->right);
+	}
+}
+
+static bool
+add_personality_block(const unsigned int p)
+{
+	const unsigned int arch = audit_arch_vec[p].arch;
+	const unsigned int flag = audit_arch_vec[p].flag;
+	const unsigned int sibling = sibling_flag(p);
+	const unsigned int nscalls = nsyscall_vec[p];
+	unsigned int skip_to_next[3];
+	unsigned int nskips = 0;
+	unsigned int match = 0;
+	unsigned int i;
+
+	ADD_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch));
+	ADD_JUMP(BPF_JMP | BPF_JEQ | BPF_K, arch, 1, 0);
+	skip_to_next[nskips++] = filter_len;
+	ADD_STMT(BPF_JMP | BPF_JA, 0);
+
+	ADD_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr));
+	if (flag) {
+		ADD_JUMP(BPF_JMP | BPF_JSET | BPF_K, flag, 1, 0);
+		skip_to_next[nskips++] = filter_len;
+		ADD_STMT(BPF_JMP | BPF_JA, 0);
+		ADD_STMT(BPF_ALU | BPF_AND | BPF_K, ~flag);
+	} else if (sibling) {
+		ADD_JUMP(BPF_JMP | BPF_JSET | BPF_K, sibling, 0, 1);
+		skip_to_next[nskips++] = filter_len;
+		ADD_STMT(BPF_JMP | BPF_JA, 0);
+	}
+
+	ADD_JUMP(BPF_JMP | BPF_JGE | BPF_K, nscalls, 0, 1);
+	ADD_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE);
+
+	for (i = 0; i < nscalls; ++i) {
+		const enum seccomp_action action = traced_by_seccomp(i, p);
+		unsigned int lo;
+
+		if (action == SECCOMP_SKIP)
+			continue;
+
+		for (lo = i; i + 1 < nscalls
+			     && traced_by_seccomp(i + 1, p) == action;)
+			++i;
+
+		if (lo == i) {
+			ADD_JUMP(BPF_JMP | BPF_JEQ | BPF_K, lo, 0, 1);
+		} else {
+			ADD_JUMP(BPF_JMP | BPF_JGE | BPF_K, lo, 0, 2);
+			ADD_JUMP(BPF_JMP | BPF_JGT | BPF_K, i, 1, 0);
+		}
+		if (action == SECCOMP_MATCH) {
+			if (!add_jump_to(&match))
+				return false;
+		} else {
+			ADD_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE);
+		}
+	}
+
+	ADD_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+
+	if (match && !add_expr_block(p, match))
+		return false;
+
+	for (i = 0; i < nskips; ++i)
+		filter[skip_to_next[i]].k = filter_len - skip_to_next[i] - 1;
+
+	return true;
+}
+
+static bool
+build_seccomp_filter(void)
+{
+	unsigned int p;
+
+	filter_len = 0;
+
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		if (audit_arch_vec[p].arch && !add_personality_block(p))
+			return false;
+	}
+
+	/* Syscalls of unexpected audit archs are always traced.  */
+	ADD_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE);
+
+	return true;
+}
+
+void
+check_seccomp_filter(void)
+{
+	if (!seccomp_filtering)
+		return;
+
+	filter_args = filter_expr_in_use && expr_has_args(filter_expr_root());
+
+	bool built = build_seccomp_filter();
+
+	if (!built && filter_args) {
+		/* Stop on all syscalls of the trace set instead.  */
+		filter_args = false;
+		built = build_seccomp_filter();
+	}
+	if (!built) {
+		error_msg("seccomp filter is too large, disabling it");
+		seccomp_filtering = false;
+		return;
+	}
+
+	seccomp_before_sysentry = os_release < KERNEL_VERSION(4, 8, 0);
+
+	if (debug_flag)
+		error_msg("seccomp filter: %u instructions%s", filter_len,
+			  filter_args ? ", with --filter arguments" : "");
+}
+
+void
+init_seccomp_filter(void)
+{
+	const struct sock_fprog prog = {
+		.len = filter_len,
+		.filter = filter
+	};
+
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0)
+		perror_msg_and_die("prctl(PR_SET_NO_NEW_PRIVS)");
+
+	if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) < 0)
+		perror_msg_and_die("prctl(PR_SET_SECCOMP)");
+}
+
+#else /* !(HAVE_LINUX_SECCOMP_H && supported architecture) */
+
+void
+check_seccomp_filter(void)
+{
+	if (seccomp_filtering) {
+		error_msg("seccomp filter is not supported on this system");
+		seccomp_filtering = false;
+	}
+}
+
+void
+init_seccomp_filter(void)
+{
+}
+
+#endif
+
+unsigned int
+seccomp_filter_restart_operator(const struct tcb *const tcp)
+{
+	/*
+	 * Syscalls that are not filtered out produce a seccomp stop
+	 * on entering, but the exiting stop still has to be requested
+	 * with PTRACE_SYSCALL.
+	 */
+	return exiting(tcp) ? PTRACE_SYSCALL : PTRACE_CONT;
+}
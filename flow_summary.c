@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Socket flow accounting (--summary-flows option).
+ *
+ * Data transfer calls on sockets are accounted per process and socket
+ * inode, the inode is resolved to its endpoints using the socket
+ * diagnostics interface at most a logarithmic number of times, so the
+ * arguments of the calls never have to be decoded.
+ */
+
+#include "defs.h"
+#include "syscall.h"
+
+struct flow_counts {
+	struct flow_counts *next;
+	int tgid;
+	unsigned long inode;
+	const char *endpoint;	/* NULL if not resolved yet */
+	uint64_t calls;		/* All syscalls on the socket */
+	uint64_t sent_bytes, recv_bytes;
+	uint64_t sends, recvs;
+	uint64_t send_ns, recv_ns;
+	uint64_t send_max_ns, recv_max_ns;
+};
+
+unsigned int summary_flows;
+static struct flow_counts **flow_hash;
+static unsigned int flow_hash_size;
+static unsigned int flow_hash_count;
+
+static unsigned int
+hash_flow(const int tgid, const unsigned long inode)
+{
+	return (unsigned int) (tgid * 31 + inode) * 2654435761U;
+}
+
+static void
+flow_hash_expand(void)
+{
+	struct flow_counts **const old_hash = flow_hash;
+	const unsigned int old_size = flow_hash_size;
+	unsigned int i;
+
+	flow_hash_size = old_size ? old_size * 2 : 64;
+	flow_hash = xcalloc(flow_hash_size, sizeof(flow_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct flow_counts *fc, *next;
+
+		for (fc = old_hash[i]; fc; fc = next) {
+			const unsigned int b = hash_flow(fc->tgid, fc->inode)
+					       & (flow_hash_size - 1);
+
+			next = fc->next;
+			fc->next = flow_hash[b];
+			flow_hash[b] = fc;
+		}
+	}
+
+	free(old_hash);
+}
+
+static struct flow_counts *
+get_flow_counts(const int tgid, const unsigned long inode)
+{
+	struct flow_counts *fc;
+
+	if (flow_hash_size) {
+		for (fc = flow_hash[hash_flow(tgid, inode)
+				    & (flow_hash_size - 1)];
+		     fc; fc = fc->next) {
+			if (fc->tgid == tgid && fc->inode == inode)
+				return fc;
+		}
+	}
+
+	if (flow_hash_count >= flow_hash_size)
+		flow_hash_expand();
+
+	const unsigned int b = hash_flow(tgid, inode) & (flow_hash_size - 1);
+
+	fc = xcalloc(1, sizeof(*fc));
+	fc->tgid = tgid;
+	fc->inode = inode;
+	fc->next = flow_hash[b];
+	flow_hash[b] = fc;
+	++flow_hash_count;
+
+	return fc;
+}
+
+/*
+ * Resolve the endpoints of the socket.  A socket that is not connected yet
+ * resolves to its local address only, so it is resolved again after
+ * connect, and on the calls whose number is a power of two until it has
+ * been resolved at all: a socket of a protocol not supported by the socket
+ * diagnostics interface would cost a dump of all protocols each time.
+ */
+static void
+resolve_flow(struct tcb *const tcp, struct flow_counts *const fc,
+	     const int fd, const bool force)
+{
+	if (!force && (fc->endpoint || (fc->calls & (fc->calls - 1))))
+		return;
+
+	const char *const details = get_sockaddr_by_inode(tcp, fd, fc->inode);
+
+	if (!details)
+		return;
+	free((char *) fc->endpoint);
+	fc->endpoint = xstrdup(details);
+}
+
+static void
+account_transfer(struct tcb *const tcp, const int fd, const bool is_send,
+		 const uint64_t ns)
+{
+	const unsigned long inode = getfdinode(tcp, fd);
+
+	if (!inode)
+		return;
+
+	struct flow_counts *const fc = get_flow_counts(get_tcb_tgid(tcp),
+						       inode);
+	/* sendmmsg and recvmmsg return the number of messages.  */
+	const uint64_t bytes = syserror(tcp)
+			       || tcp->s_ent->sen == SEN_sendmmsg
+			       || tcp->s_ent->sen == SEN_recvmmsg
+			       ? 0 : tcp->u_rval;
+
+	fc->calls++;
+	if (is_send) {
+		fc->sends++;
+		fc->sent_bytes += bytes;
+		fc->send_ns += ns;
+		if (ns > fc->send_max_ns)
+			fc->send_max_ns = ns;
+	} else {
+		fc->recvs++;
+		fc->recv_bytes += bytes;
+		fc->recv_ns += ns;
+		if (ns > fc->recv_max_ns)
+			fc->recv_max_ns = ns;
+	}
+	resolve_flow(tcp, fc, fd, false);
+}
+
+static void
+account_connection(struct tcb *const tcp, const int fd)
+{
+	const unsigned long inode = getfdinode(tcp, fd);
+
+	if (!inode)
+		return;
+
+	struct flow_counts *const fc = get_flow_counts(get_tcb_tgid(tcp),
+						       inode);
+
+	fc->calls++;
+	resolve_flow(tcp, fc, fd, true);
+}
+
+void
+count_flow(struct tcb *const tcp, const uint64_t wall_ns)
+{
+	switch (tcp->s_ent->sen) {
+	case SEN_read:
+	case SEN_readv:
+	case SEN_recv:
+	case SEN_recvfrom:
+	case SEN_recvmsg:
+	case SEN_recvmmsg:
+		account_transfer(tcp, tcp->u_arg[0], false, wall_ns);
+		break;
+	case SEN_write:
+	case SEN_writev:
+	case SEN_send:
+	case SEN_sendto:
+	case SEN_sendmsg:
+	case SEN_sendmmsg:
+		account_transfer(tcp, tcp->u_arg[0], true, wall_ns);
+		break;
+	case SEN_connect:
+		if (!syserror(tcp) || tcp->u_error == EINPROGRESS)
+			account_connection(tcp, tcp->u_arg[0]);
+		break;
+	case SEN_accept:
+	case SEN_accept4:
+		if (!syserror(tcp))
+			account_connection(tcp, tcp->u_rval);
+		break;
+	}
+}
+
+static int
+flow_counts_cmp(const void *a, const void *b)
+{
+	const struct flow_counts *const x = *(const struct flow_counts **) a;
+	const struct flow_counts *const y = *(const struct flow_counts **) b;
+	const uint64_t x_bytes = x->sent_bytes + x->recv_bytes;
+	const uint64_t y_bytes = y->sent_bytes + y->recv_bytes;
+
+	return (x_bytes < y_bytes) ? 1 : (x_bytes > y_bytes) ? -1
+	     : (x->calls < y->calls) ? 1 : (x->calls > y->calls) ? -1
+	     : (x->tgid != y->tgid) ? x->tgid - y->tgid
+	     : (x->inode < y->inode) ? -1 : (x->inode > y->inode);
+}
+
+/* Print the summary_flows sockets that moved the most bytes.  */
+void
+flow_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	struct flow_counts **sorted;
+	unsigned int i, n = 0;
+
+	if (!flow_hash_count)
+		return;
+
+	sorted = xcalloc(flow_hash_count, sizeof(sorted[0]));
+	for (i = 0; i < flow_hash_size; ++i) {
+		struct flow_counts *fc;
+
+		for (fc = flow_hash[i]; fc; fc = fc->next)
+			sorted[n++] = fc;
+	}
+	sort_top(sorted, n, sizeof(sorted[0]), summary_flows,
+		 flow_counts_cmp);
+	if (n > summary_flows)
+		n = summary_flows;
+
+	fprintf(outf, "\n%11.11s %11.11s %8.8s %8.8s %9.9s %9.9s %9.9s %9.9s"
+		" %7.7s %s\n", "sent", "received", "sends", "recvs",
+		"usecs/snd", "max snd", "usecs/rcv", "max rcv",
+		"pid", "endpoint");
+	fprintf(outf, "%11.11s %11.11s %8.8s %8.8s %9.9s %9.9s %9.9s %9.9s"
+		" %7.7s %s\n", dashes, dashes, dashes, dashes, dashes, dashes,
+		dashes, dashes, dashes, dashes);
+	for (i = 0; i < n; ++i) {
+		const struct flow_counts *const fc = sorted[i];
+
+		fprintf(outf, "%11" PRIu64 " %11" PRIu64 " %8" PRIu64
+			" %8" PRIu64 " %9" PRIu64 " %9" PRIu64 " %9" PRIu64
+			" %9" PRIu64 " %7d ",
+			fc->sent_bytes, fc->recv_bytes, fc->sends, fc->recvs,
+			fc->sends ? fc->send_ns / fc->sends / 1000 : 0,
+			fc->send_max_ns / 1000,
+			fc->recvs ? fc->recv_ns / fc->recvs / 1000 : 0,
+			fc->recv_max_ns / 1000, fc->tgid);
+		if (fc->endpoint)
+			fprintf(outf, "%s\n", fc->endpoint);
+		else
+			fprintf(outf, "socket:[%lu]\n", fc->inode);
+	}
+
+	free(sorted);
+}
@@ -42,6 +42,32 @@
 #include "xlat/futexwakeops.h"
 #include "xlat/futexwakecmps.h"
 
+/*
+ * Tell whether a futex operation may block the caller or wakes up
+ * other waiters, for --summary-futex.
+ */
+enum futex_op_kind
+futex_op_kind(const unsigned int op)
+{
+	switch (op & 127) {
+	case FUTEX_WAIT:
+	case FUTEX_WAIT_BITSET:
+	case FUTEX_LOCK_PI:
+	case FUTEX_WAIT_REQUEUE_PI:
+		return FUTEX_OP_KIND_WAIT;
+	case FUTEX_WAKE:
+	case FUTEX_WAKE_BITSET:
+	case FUTEX_WAKE_OP:
+	case FUTEX_REQUEUE:
+	case FUTEX_CMP_REQUEUE:
+	case FUTEX_CMP_REQUEUE_PI:
+	case FUTEX_UNLOCK_PI:
+		return FUTEX_OP_KIND_WAKE;
+	default:
+		return FUTEX_OP_KIND_OTHER;
+	}
+}
+
 SYS_FUNC(futex)
 {
 	const kernel_ulong_t uaddr = tcp->u_arg[0];
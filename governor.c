@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Overhead governor (--overhead-budget option).
+ *
+ * The overhead is estimated as the share of wall-clock time the tracer
+ * is busy rather than blocked waiting for tracees to stop, measured over
+ * windows of a second.  While it is over the budget, the level of detail
+ * is lowered by one step every window: first structures are abbreviated
+ * and not decoded verbosely, then only one of GOVERNOR_SAMPLE_SCALE
+ * syscalls is traced, and then syscalls are only counted with -c or -C,
+ * or not traced at all otherwise.  Once the overhead drops below half
+ * of the budget, detail is restored by one step at a time.  A restore
+ * that takes the overhead over the budget again makes the governor wait
+ * twice as many calm windows before the next one.  Each transition is
+ * reported before the next line printed, like
+ * "<... overhead governor: 12.5% busy, terse decoding>".
+ */
+
+#include "defs.h"
+
+#include <time.h>
+#include "string_to_uint.h"
+
+#define GOVERNOR_WINDOW_NS	1000000000ULL
+#define GOVERNOR_SAMPLE_SCALE	8
+#define GOVERNOR_MAX_HOLD	64
+
+unsigned int overhead_budget;
+enum governor_level governor_level;
+bool governor_report_pending;
+
+static uint64_t window_start_ns;
+static uint64_t idle_start_ns;
+static uint64_t idle_ns;
+static unsigned int calm_windows;
+static unsigned int restore_hold = 1;
+static bool just_restored;
+/* The longest report of set_level */
+static char report[sizeof("overhead governor: 4294967295.4294967295% busy, ")
+		   + sizeof("sampling 1 of %u syscalls") + sizeof(int) * 3];
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Parse the --overhead-budget argument, a percentage from 1 to 99
+ * optionally followed by "%", return false if it is invalid.
+ */
+bool
+parse_overhead_budget(const char *const arg)
+{
+	const size_t len = strlen(arg);
+	char *const str = xstrdup(arg);
+
+	if (len && str[len - 1] == '%')
+		str[len - 1] = '\0';
+
+	const int budget = string_to_uint_upto(str, 99);
+
+	free(str);
+	if (budget <= 0)
+		return false;
+
+	overhead_budget = budget;
+	return true;
+}
+
+static const char *
+level_name(void)
+{
+	static char buf[sizeof("sampling 1 of %u syscalls") + sizeof(int) * 3];
+
+	switch (governor_level) {
+	case GOVERNOR_FULL:
+		return "full decoding";
+	case GOVERNOR_TERSE:
+		return "terse decoding";
+	case GOVERNOR_SAMPLED:
+		sprintf(buf, "sampling 1 of %u syscalls", sample_rate);
+		return buf;
+	case GOVERNOR_MINIMAL:
+		return cflag ? "counting only" : "not tracing syscalls";
+	}
+
+	return "unknown";
+}
+
+static void
+set_level(const enum governor_level level, const unsigned int permille)
+{
+	if (level == GOVERNOR_SAMPLED && governor_level < level)
+		sample_rate *= GOVERNOR_SAMPLE_SCALE;
+	else if (governor_level == GOVERNOR_SAMPLED && level < governor_level)
+		sample_rate /= GOVERNOR_SAMPLE_SCALE;
+	governor_level = level;
+
+	snprintf(report, sizeof(report), "overhead governor: %u.%u%% busy, %s",
+		 permille / 10, permille % 10, level_name());
+	governor_report_pending = true;
+}
+
+/* Lower or restore the level of detail at the end of a window.  */
+static void
+end_window(const uint64_t now)
+{
+	const uint64_t elapsed = now - window_start_ns;
+	const uint64_t busy = elapsed > idle_ns ? elapsed - idle_ns : 0;
+	const unsigned int permille = busy * 1000 / elapsed;
+
+	window_start_ns = now;
+	idle_ns = 0;
+
+	if (permille > overhead_budget * 10) {
+		calm_windows = 0;
+		if (just_restored && restore_hold < GOVERNOR_MAX_HOLD)
+			restore_hold *= 2;
+		just_restored = false;
+		if (governor_level < GOVERNOR_MINIMAL)
+			set_level(governor_level + 1, permille);
+	} else if (permille * 2 < overhead_budget * 10) {
+		just_restored = false;
+		if (governor_level > GOVERNOR_FULL
+		    && ++calm_windows >= restore_hold) {
+			calm_windows = 0;
+			just_restored = true;
+			set_level(governor_level - 1, permille);
+		}
+	} else {
+		calm_windows = 0;
+		just_restored = false;
+	}
+}
+
+/* Called before the tracer blocks waiting for tracees to stop.  */
+void
+governor_idle_begin(void)
+{
+	idle_start_ns = now_ns();
+
+	if (!window_start_ns)
+		window_start_ns = idle_start_ns;
+	else if (idle_start_ns - window_start_ns >= GOVERNOR_WINDOW_NS)
+		end_window(idle_start_ns);
+}
+
+/* Called when the tracer is woken up by a stop.  */
+void
+governor_idle_end(void)
+{
+	idle_ns += now_ns() - idle_start_ns;
+}
+
+/* Report the last transition to the output of TCP.  */
+void
+governor_report(struct tcb *const tcp)
+{
+	printleader(tcp);
+	tprintf("<... %s>\n", report);
+	line_ended();
+	governor_report_pending = false;
+}
+
+/* Report the last transition at the end, if it has not been yet.  */
+void
+governor_finish(FILE *const fp)
+{
+	if (governor_report_pending)
+		fprintf(fp, "<... %s>\n", report);
+	governor_report_pending = false;
+}
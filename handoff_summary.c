@@ -0,0 +1,405 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Cross-process handoff accounting (--summary-handoff option).
+ *
+ * A handoff is a read of a pipe or of a unix socket, or a futex wait,
+ * that was blocked until another thread wrote to the pipe or to the peer
+ * socket, or woke the futex word.  Writes and wakes are recorded at their
+ * entry, before the tracee is let go to make the data available, so they
+ * are seen before the reads and waits they complete, and the latency
+ * of a handoff is the time from that entry to the return of the read
+ * or wait.  Reads and waits that entered after the write or wake did not
+ * have to wait for it and are not accounted.
+ *
+ * Pipes are keyed by their inode, unix sockets by the inode of their
+ * receiving end, which is resolved from the sending end using the socket
+ * diagnostics interface, and futexes by address, so words of different
+ * processes at the same address are not told apart.
+ */
+
+#include "defs.h"
+#include <limits.h>
+#include "latency_hist.h"
+#include "syscall.h"
+
+enum handoff_kind {
+	HANDOFF_PIPE,
+	HANDOFF_UNIX,
+	HANDOFF_FUTEX,
+};
+
+static const char *const handoff_kind_names[] = {
+	[HANDOFF_PIPE] = "pipe",
+	[HANDOFF_UNIX] = "unix",
+	[HANDOFF_FUTEX] = "futex",
+};
+
+struct handoff_channel {
+	struct handoff_channel *next;
+	uint64_t key;
+	enum handoff_kind kind;
+	/* Of a unix socket written to, the inode of its peer, 0 if unknown */
+	unsigned long peer;
+	unsigned int sends;
+	/*
+	 * The thread group of the write or wake pending, 0 if none.
+	 * A pipe or socket is woken by the first write not read yet,
+	 * a futex waiter by the last wake.
+	 */
+	int writer;
+	struct timespec write_ts;
+};
+
+struct handoff_pair {
+	struct handoff_pair *next;
+	enum handoff_kind kind;
+	int writer, reader;
+	uint64_t count, time_ns, min_ns, max_ns;
+	struct latency_hist hist;
+};
+
+unsigned int summary_handoff;
+static struct handoff_channel **channel_hash;
+static unsigned int channel_hash_size;
+static unsigned int channel_hash_count;
+static struct handoff_pair *pair_list;
+static unsigned int pair_count;
+
+static unsigned int
+hash_channel(const enum handoff_kind kind, const uint64_t key)
+{
+	return (unsigned int) (key * 31 + kind) * 2654435761U;
+}
+
+static void
+channel_hash_expand(void)
+{
+	struct handoff_channel **const old_hash = channel_hash;
+	const unsigned int old_size = channel_hash_size;
+	unsigned int i;
+
+	channel_hash_size = old_size ? old_size * 2 : 64;
+	channel_hash = xcalloc(channel_hash_size, sizeof(channel_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct handoff_channel *hc, *next;
+
+		for (hc = old_hash[i]; hc; hc = next) {
+			const unsigned int b = hash_channel(hc->kind, hc->key)
+					       & (channel_hash_size - 1);
+
+			next = hc->next;
+			hc->next = channel_hash[b];
+			channel_hash[b] = hc;
+		}
+	}
+
+	free(old_hash);
+}
+
+static struct handoff_channel *
+get_channel(const enum handoff_kind kind, const uint64_t key,
+	    const bool create)
+{
+	struct handoff_channel *hc;
+
+	if (channel_hash_size) {
+		for (hc = channel_hash[hash_channel(kind, key)
+				       & (channel_hash_size - 1)];
+		     hc; hc = hc->next) {
+			if (hc->kind == kind && hc->key == key)
+				return hc;
+		}
+	}
+
+	if (!create)
+		return NULL;
+
+	if (channel_hash_count >= channel_hash_size)
+		channel_hash_expand();
+
+	const unsigned int b = hash_channel(kind, key)
+			       & (channel_hash_size - 1);
+
+	hc = xcalloc(1, sizeof(*hc));
+	hc->kind = kind;
+	hc->key = key;
+	hc->next = channel_hash[b];
+	channel_hash[b] = hc;
+	++channel_hash_count;
+
+	return hc;
+}
+
+/*
+ * Resolve the peer of a unix socket.  A socket that is not connected yet
+ * has no peer, so it is resolved again on the writes whose number
+ * is a power of two until its peer is known.
+ */
+static void
+resolve_peer(struct tcb *const tcp, struct handoff_channel *const hc,
+	     const int fd)
+{
+	if (hc->peer || (hc->sends & (hc->sends - 1)))
+		return;
+
+	const char *const details = get_sockaddr_by_inode(tcp, fd, hc->key);
+	const char *const peer = details ? strstr(details, "->") : NULL;
+
+	if (peer)
+		hc->peer = strtoul(peer + 2, NULL, 10);
+}
+
+/*
+ * Return the channel of a pipe or a unix socket descriptor: of a write,
+ * the channel read from at the other end, created if needed, of a read,
+ * the channel it reads, if some write has been seen on it.
+ */
+static struct handoff_channel *
+get_fd_channel(struct tcb *const tcp, const int fd, const bool writing)
+{
+	char path[PATH_MAX + 1];
+	const char *str;
+
+	if (getfdpath(tcp, fd, path, sizeof(path)) < 0)
+		return NULL;
+
+	str = STR_STRIP_PREFIX(path, "pipe:[");
+	if (str != path)
+		return get_channel(HANDOFF_PIPE, strtoul(str, NULL, 10),
+				   writing);
+
+	str = STR_STRIP_PREFIX(path, "socket:[");
+	if (str == path)
+		return NULL;
+
+	const unsigned long inode = strtoul(str, NULL, 10);
+
+	if (!writing)
+		return get_channel(HANDOFF_UNIX, inode, false);
+	if (getfdproto(tcp, fd) != SOCK_PROTO_UNIX)
+		return NULL;
+
+	struct handoff_channel *const hc =
+		get_channel(HANDOFF_UNIX, inode, true);
+
+	resolve_peer(tcp, hc, fd);
+	hc->sends++;
+
+	return hc->peer ? get_channel(HANDOFF_UNIX, hc->peer, true) : NULL;
+}
+
+/* Record a write or a wake at the entry of the syscall.  */
+void
+count_handoff_entry(struct tcb *const tcp)
+{
+	struct handoff_channel *hc;
+
+	switch (tcp->s_ent->sen) {
+	case SEN_write:
+	case SEN_writev:
+	case SEN_send:
+	case SEN_sendto:
+	case SEN_sendmsg:
+	case SEN_sendmmsg:
+		hc = get_fd_channel(tcp, tcp->u_arg[0], true);
+		if (!hc || hc->writer)
+			return;
+		break;
+	case SEN_futex:
+		if (futex_op_kind(tcp->u_arg[1]) != FUTEX_OP_KIND_WAKE)
+			return;
+		hc = get_channel(HANDOFF_FUTEX, tcp->u_arg[0], true);
+		break;
+	default:
+		return;
+	}
+
+	hc->writer = get_tcb_tgid(tcp);
+	hc->write_ts = tcp->etime;
+}
+
+static struct handoff_pair *
+get_pair(const enum handoff_kind kind, const int writer, const int reader)
+{
+	struct handoff_pair *hp;
+
+	for (hp = pair_list; hp; hp = hp->next) {
+		if (hp->kind == kind && hp->writer == writer
+		    && hp->reader == reader)
+			return hp;
+	}
+
+	hp = xcalloc(1, sizeof(*hp));
+	hp->kind = kind;
+	hp->writer = writer;
+	hp->reader = reader;
+	hp->min_ns = UINT64_MAX;
+	hp->next = pair_list;
+	pair_list = hp;
+	++pair_count;
+
+	return hp;
+}
+
+/* Account a read or a wait that returned at TS.  */
+void
+count_handoff(struct tcb *const tcp, const struct timespec *const ts)
+{
+	struct handoff_channel *hc;
+
+	if (syserror(tcp))
+		return;
+
+	switch (tcp->s_ent->sen) {
+	case SEN_read:
+	case SEN_readv:
+	case SEN_recv:
+	case SEN_recvfrom:
+	case SEN_recvmsg:
+	case SEN_recvmmsg:
+		if (!tcp->u_rval)
+			return;
+		hc = get_fd_channel(tcp, tcp->u_arg[0], false);
+		break;
+	case SEN_futex:
+		if (futex_op_kind(tcp->u_arg[1]) != FUTEX_OP_KIND_WAIT)
+			return;
+		hc = get_channel(HANDOFF_FUTEX, tcp->u_arg[0], false);
+		break;
+	default:
+		return;
+	}
+
+	if (!hc || !hc->writer)
+		return;
+
+	if (ts_cmp(&tcp->etime, &hc->write_ts) < 0) {
+		struct handoff_pair *const hp =
+			get_pair(hc->kind, hc->writer, get_tcb_tgid(tcp));
+		struct timespec wts;
+
+		ts_sub(&wts, ts, &hc->write_ts);
+
+		const uint64_t ns = (uint64_t) wts.tv_sec * 1000000000
+				    + wts.tv_nsec;
+		uint32_t *const b = &hp->hist.buckets[hist_bucket(ns)];
+
+		hp->count++;
+		hp->time_ns += ns;
+		if (ns < hp->min_ns)
+			hp->min_ns = ns;
+		if (ns > hp->max_ns)
+			hp->max_ns = ns;
+		if (*b < UINT32_MAX)
+			++*b;
+	}
+
+	/* The data written has been read, a futex may wake more waiters.  */
+	if (hc->kind != HANDOFF_FUTEX)
+		hc->writer = 0;
+}
+
+static uint64_t
+pair_percentile(const struct handoff_pair *const hp,
+		const unsigned int permille)
+{
+	const uint64_t rank = (hp->count * permille + 999) / 1000;
+	uint64_t seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; ++i) {
+		seen += hp->hist.buckets[i];
+		if (seen >= rank) {
+			const uint64_t v = hist_bucket_value(i);
+
+			return v < hp->min_ns ? hp->min_ns
+			     : v > hp->max_ns ? hp->max_ns : v;
+		}
+	}
+
+	return hp->max_ns;
+}
+
+static int
+handoff_pair_cmp(const void *a, const void *b)
+{
+	const struct handoff_pair *const x = *(const struct handoff_pair **) a;
+	const struct handoff_pair *const y = *(const struct handoff_pair **) b;
+
+	return (x->time_ns < y->time_ns) ? 1 : (x->time_ns > y->time_ns) ? -1
+	     : (x->count < y->count) ? 1 : (x->count > y->count) ? -1
+	     : (x->kind != y->kind) ? (int) x->kind - (int) y->kind
+	     : (x->writer != y->writer) ? x->writer - y->writer
+	     : x->reader - y->reader;
+}
+
+/*
+ * Print the summary_handoff pairs of writer and reader processes
+ * that spent the most time in handoffs.
+ */
+void
+handoff_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	struct handoff_pair **sorted;
+	struct handoff_pair *hp;
+	unsigned int i, n = 0;
+
+	if (!pair_count)
+		return;
+
+	sorted = xcalloc(pair_count, sizeof(sorted[0]));
+	for (hp = pair_list; hp; hp = hp->next)
+		sorted[n++] = hp;
+	sort_top(sorted, n, sizeof(sorted[0]), summary_handoff,
+		 handoff_pair_cmp);
+	if (n > summary_handoff)
+		n = summary_handoff;
+
+	fprintf(outf, "\n%9.9s %11.11s %9.9s %9.9s %9.9s %9.9s %7.7s %7.7s"
+		" %s\n", "handoffs", "seconds", "p50 usecs", "p90 usecs",
+		"p99 usecs", "max usecs", "writer", "reader", "channel");
+	fprintf(outf, "%9.9s %11.11s %9.9s %9.9s %9.9s %9.9s %7.7s %7.7s"
+		" %s\n", dashes, dashes, dashes, dashes, dashes, dashes,
+		dashes, dashes, dashes);
+	for (i = 0; i < n; ++i) {
+		hp = sorted[i];
+		fprintf(outf, "%9" PRIu64 " %11.6f %9" PRIu64 " %9" PRIu64
+			" %9" PRIu64 " %9" PRIu64 " %7d %7d %s\n",
+			hp->count, hp->time_ns / 1e9,
+			pair_percentile(hp, 500) / 1000,
+			pair_percentile(hp, 900) / 1000,
+			pair_percentile(hp, 990) / 1000,
+			hp->max_ns / 1000, hp->writer, hp->reader,
+			handoff_kind_names[hp->kind]);
+	}
+
+	free(sorted);
+}
@@ -41,7 +41,9 @@ SYS_FUNC(read)
 	} else {
 		if (syserror(tcp))
 			printaddr(tcp->u_arg[1]);
-		else
+		else if (!notify_events
+			 || !decode_notify_events(tcp, tcp->u_arg[0],
+						  tcp->u_arg[1], tcp->u_rval))
 			printstrn(tcp, tcp->u_arg[1], tcp->u_rval);
 		tprintf(", %" PRI_klu, tcp->u_arg[2]);
 	}
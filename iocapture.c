@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "defs.h"
+#include <fcntl.h>
+#include "iocapture.h"
+
+/*
+ * Raw capture of the data read from -e read= descriptors and written
+ * to -e write= descriptors.
+ *
+ * With --io-capture, the file starts with a header followed by records,
+ * each record is immediately followed by len bytes of data.
+ * The data of a system call may be split into several records,
+ * the offset of a record is the offset of its data in the data
+ * of the system call.
+ * Tracee memory is read with process_vm_readv straight into the output
+ * buffer, which is written out with a single write call when it fills up.
+ *
+ * With --io-capture-streams, the data of each descriptor of each process
+ * is appended to PREFIX.PID.FD.in or PREFIX.PID.FD.out, and PREFIX.index
+ * maps the offsets in these files to the times of the system calls.
+ */
+
+#define IOCAPTURE_MAGIC "STRACEC"
+#define IOCAPTURE_VERSION 1
+#define IOCAPTURE_BUFFER_SIZE (1024 * 1024)
+/* The buffer is flushed when less room than this is left for data */
+#define IOCAPTURE_MIN_DATA 4096
+
+struct iocapture_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+};
+
+struct iocapture_record {
+	uint32_t type;
+	int32_t pid;
+	int32_t fd;
+	uint32_t len;
+	uint64_t offset;
+	int64_t tv_sec;
+	int64_t tv_nsec;
+};
+
+/* The data of a descriptor of a process in one direction */
+struct iocapture_stream {
+	struct iocapture_stream *next;
+	int tgid;
+	int fd;
+	enum iocapture_record_type type;
+	int out_fd;		/* -1 if the file is closed */
+	uint64_t size;
+	unsigned long last_use;
+};
+
+#define IOCAPTURE_STREAM_HASH_SIZE 256
+/* At most this many stream files are kept open at once */
+#define IOCAPTURE_STREAMS_OPEN_MAX 64
+
+static FILE *iocapture_file;
+static const char *iocapture_path;
+static char *iocapture_buf;
+static size_t iocapture_len;
+/* The record of the system call being captured */
+static struct iocapture_record iocapture_rec;
+
+static const char *streams_prefix;
+static FILE *streams_index;
+static struct iocapture_stream *streams_hash[IOCAPTURE_STREAM_HASH_SIZE];
+static unsigned int streams_open;
+static unsigned long streams_clock;
+/* The stream of the system call being captured, looked up lazily */
+static struct iocapture_stream *cur_stream;
+static int cur_tgid;
+
+bool
+iocapture_enabled(void)
+{
+	return iocapture_buf;
+}
+
+static void
+iocapture_alloc_buffer(void)
+{
+	if (!iocapture_buf)
+		iocapture_buf = xmalloc(IOCAPTURE_BUFFER_SIZE);
+}
+
+void
+iocapture_init(FILE *fp, const char *path)
+{
+	const struct iocapture_header hdr = {
+		.magic = IOCAPTURE_MAGIC,
+		.version = IOCAPTURE_VERSION,
+		.record_size = sizeof(struct iocapture_record)
+	};
+
+	iocapture_file = fp;
+	iocapture_path = path;
+	/* The output is buffered in iocapture_buf only. */
+	setvbuf(fp, NULL, _IONBF, 0);
+
+	iocapture_alloc_buffer();
+	memcpy(iocapture_buf, &hdr, sizeof(hdr));
+	iocapture_len = sizeof(hdr);
+}
+
+void
+iocapture_streams_init(const char *prefix, FILE *index)
+{
+	streams_prefix = prefix;
+	streams_index = index;
+	iocapture_alloc_buffer();
+}
+
+static void
+iocapture_flush(void)
+{
+	if (iocapture_len &&
+	    fwrite(iocapture_buf, 1, iocapture_len, iocapture_file)
+	    != iocapture_len)
+		perror_msg_and_die("%s", iocapture_path);
+	iocapture_len = 0;
+}
+
+void
+iocapture_begin(struct tcb *tcp, const enum iocapture_record_type type)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	iocapture_rec = (struct iocapture_record) {
+		.type = type,
+		.pid = tcp->pid,
+		.fd = tcp->u_arg[0],
+		.tv_sec = ts.tv_sec,
+		.tv_nsec = ts.tv_nsec
+	};
+	cur_stream = NULL;
+	/* Threads share descriptors, their data goes to the same stream. */
+	if (streams_prefix)
+		cur_tgid = get_tcb_tgid(tcp);
+}
+
+static void
+stream_file_name(char *name, const struct iocapture_stream *st)
+{
+	sprintf(name, "%.512s.%d.%d.%s", streams_prefix, st->tgid, st->fd,
+		st->type == IOCAPTURE_READ ? "in" : "out");
+}
+
+static void
+stream_close_lru(void)
+{
+	struct iocapture_stream *lru = NULL;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(streams_hash); ++i) {
+		struct iocapture_stream *st;
+
+		for (st = streams_hash[i]; st; st = st->next)
+			if (st->out_fd >= 0 &&
+			    (!lru || st->last_use < lru->last_use))
+				lru = st;
+	}
+
+	if (lru) {
+		close(lru->out_fd);
+		lru->out_fd = -1;
+		--streams_open;
+	}
+}
+
+static struct iocapture_stream *
+get_stream(void)
+{
+	const unsigned int h = ((unsigned int) cur_tgid * 31 +
+				(unsigned int) iocapture_rec.fd) * 2
+			       + iocapture_rec.type;
+	struct iocapture_stream **const bucket =
+		&streams_hash[h % ARRAY_SIZE(streams_hash)];
+	struct iocapture_stream *st;
+
+	for (st = *bucket; st; st = st->next)
+		if (st->tgid == cur_tgid && st->fd == iocapture_rec.fd &&
+		    st->type == iocapture_rec.type)
+			break;
+
+	if (!st) {
+		st = xcalloc(1, sizeof(*st));
+		st->tgid = cur_tgid;
+		st->fd = iocapture_rec.fd;
+		st->type = iocapture_rec.type;
+		st->out_fd = -1;
+		st->next = *bucket;
+		*bucket = st;
+	}
+
+	if (st->out_fd < 0) {
+		char name[520 + 3 * sizeof(int) * 3];
+
+		if (streams_open >= IOCAPTURE_STREAMS_OPEN_MAX)
+			stream_close_lru();
+		stream_file_name(name, st);
+		/* A reopened file is appended to, a new one is truncated. */
+		st->out_fd = open(name, O_WRONLY | O_CREAT | O_CLOEXEC |
+					(st->size ? O_APPEND : O_TRUNC), 0666);
+		if (st->out_fd < 0)
+			perror_msg_and_die("%s", name);
+		++streams_open;
+	}
+	st->last_use = ++streams_clock;
+
+	return st;
+}
+
+static void
+stream_write(const char *data, const size_t len)
+{
+	if (!cur_stream)
+		cur_stream = get_stream();
+
+	fprintf(streams_index, "%d %d %s %" PRIu64 " %zu %lld.%09lld\n",
+		cur_stream->tgid, cur_stream->fd,
+		cur_stream->type == IOCAPTURE_READ ? "in" : "out",
+		cur_stream->size, len, (long long) iocapture_rec.tv_sec,
+		(long long) iocapture_rec.tv_nsec);
+
+	size_t done = 0;
+	while (done < len) {
+		const ssize_t n = write(cur_stream->out_fd, data + done,
+					len - done);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			char name[520 + 3 * sizeof(int) * 3];
+			stream_file_name(name, cur_stream);
+			perror_msg_and_die("%s", name);
+		}
+		done += n;
+	}
+	cur_stream->size += len;
+}
+
+void
+iocapture_data(struct tcb *tcp, kernel_ulong_t addr, kernel_ulong_t len)
+{
+	const size_t rec_size = sizeof(iocapture_rec);
+
+	while (len) {
+		char *data = iocapture_buf;
+		size_t room = IOCAPTURE_BUFFER_SIZE;
+
+		if (iocapture_file) {
+			if (IOCAPTURE_BUFFER_SIZE - iocapture_len
+			    < rec_size + IOCAPTURE_MIN_DATA)
+				iocapture_flush();
+			data = iocapture_buf + iocapture_len + rec_size;
+			room = IOCAPTURE_BUFFER_SIZE - iocapture_len - rec_size;
+		}
+
+		struct umove_req req = {
+			.addr = addr,
+			.len = MIN(len, room),
+			.laddr = data
+		};
+
+		umoven_batch(tcp, &req, 1);
+		if (!req.nread)
+			return;
+
+		if (iocapture_file) {
+			iocapture_rec.len = req.nread;
+			memcpy(iocapture_buf + iocapture_len, &iocapture_rec,
+			       rec_size);
+			iocapture_len += rec_size + req.nread;
+		}
+		if (streams_prefix)
+			stream_write(data, req.nread);
+		iocapture_rec.offset += req.nread;
+
+		if (req.nread < req.len)
+			return;
+		addr += req.nread;
+		len -= req.nread;
+	}
+}
+
+void
+iocapture_finish(void)
+{
+	if (iocapture_file)
+		iocapture_flush();
+}
+
+bool
+iocapture_read(const char *path,
+	       void (*func)(const struct iocapture_event *, void *),
+	       void *data)
+{
+	struct iocapture_header hdr;
+	struct iocapture_record rec;
+	FILE *fp = fopen(path, "r");
+
+	if (!fp)
+		perror_msg_and_die("Can't fopen '%s'", path);
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    memcmp(hdr.magic, IOCAPTURE_MAGIC, sizeof(IOCAPTURE_MAGIC)) ||
+	    hdr.version != IOCAPTURE_VERSION) {
+		fclose(fp);
+		return false;
+	}
+	if (hdr.record_size != sizeof(rec))
+		error_msg_and_die("%s: I/O capture of a different architecture",
+				  path);
+
+	while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+		const struct iocapture_event ev = {
+			.type = rec.type,
+			.pid = rec.pid,
+			.fd = rec.fd,
+			.len = rec.len,
+			.offset = rec.offset,
+			.data_pos = ftello(fp),
+			.ts = rec.tv_sec * 1000000000ULL + rec.tv_nsec
+		};
+
+		func(&ev, data);
+		if (fseeko(fp, rec.len, SEEK_CUR))
+			perror_msg_and_die("%s", path);
+	}
+
+	if (ferror(fp))
+		perror_msg_and_die("%s", path);
+	fclose(fp);
+
+	return true;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef STRACE_IOCAPTURE_H
+#define STRACE_IOCAPTURE_H
+
+#include "defs.h"
+
+enum iocapture_record_type {
+	IOCAPTURE_READ = 1,
+	IOCAPTURE_WRITE = 2,
+};
+
+extern bool iocapture_enabled(void);
+extern void iocapture_init(FILE *, const char *path);
+extern void iocapture_streams_init(const char *prefix, FILE *index);
+extern void iocapture_begin(struct tcb *, enum iocapture_record_type);
+extern void iocapture_data(struct tcb *, kernel_ulong_t addr,
+			   kernel_ulong_t len);
+extern void iocapture_finish(void);
+
+/* Record read from an I/O capture file. */
+struct iocapture_event {
+	enum iocapture_record_type type;
+	int pid;
+	int fd;
+	unsigned int len;
+	uint64_t offset;	/* in the data of the system call */
+	off_t data_pos;		/* of the data in the file */
+	unsigned long long ts;	/* in nanoseconds */
+};
+
+/*
+ * Call the function for each record of the I/O capture file.
+ * Returns false if the file is not an I/O capture.
+ */
+extern bool iocapture_read(const char *path,
+			   void (*)(const struct iocapture_event *, void *),
+			   void *data);
+
+#endif /* !STRACE_IOCAPTURE_H */
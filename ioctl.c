@@ -31,6 +31,7 @@
 
 #include "defs.h"
 #include <linux/ioctl.h>
+#include "selfprof.h"
 #include "xlat/ioctl_dirs.h"
 
 #ifdef HAVE_LINUX_INPUT_H
@@ -40,29 +41,66 @@
 #include "xlat/evdev_abs.h"
 #include "xlat/evdev_ev.h"
 
-static int
-compare(const void *a, const void *b)
+/*
+ * Open addressing hash of the current personality's ioctlent table,
+ * mapping an ioctl code to the first of its (adjacent) entries.
+ * Slots hold entry index + 1, 0 denotes an empty slot.
+ */
+struct ioctl_hash {
+	unsigned int *slots;
+	unsigned int mask;
+};
+
+static struct ioctl_hash ioctl_hashes[SUPPORTED_PERSONALITIES];
+
+static unsigned int
+ioctl_hash_code(const unsigned int code)
 {
-	const unsigned int code1 = (const uintptr_t) a;
-	const unsigned int code2 = ((struct_ioctlent *) b)->code;
-	return (code1 > code2) ? 1 : (code1 < code2) ? -1 : 0;
+	/* Fibonacci hashing, the type and number bytes vary the most.  */
+	return code * 2654435761U;
+}
+
+static void
+ioctl_hash_build(struct ioctl_hash *const h)
+{
+	unsigned int size = 2;
+	unsigned int i;
+
+	while (size < nioctlents * 2)
+		size <<= 1;
+	h->slots = xcalloc(size, sizeof(*h->slots));
+	h->mask = size - 1;
+
+	for (i = 0; i < nioctlents; ++i) {
+		unsigned int pos;
+
+		if (i && ioctlent[i].code == ioctlent[i - 1].code)
+			continue;
+		for (pos = ioctl_hash_code(ioctlent[i].code) & h->mask;
+		     h->slots[pos]; pos = (pos + 1) & h->mask)
+			;
+		h->slots[pos] = i + 1;
+	}
 }
 
 static const struct_ioctlent *
 ioctl_lookup(const unsigned int code)
 {
-	struct_ioctlent *iop;
-
-	iop = bsearch((const void *) (const uintptr_t) code, ioctlent,
-			nioctlents, sizeof(ioctlent[0]), compare);
-	while (iop > ioctlent) {
-		iop--;
-		if (iop->code != code) {
-			iop++;
-			break;
-		}
+	struct ioctl_hash *const h = &ioctl_hashes[current_personality];
+	unsigned int pos;
+
+	if (!h->slots)
+		ioctl_hash_build(h);
+
+	for (pos = ioctl_hash_code(code) & h->mask; h->slots[pos];
+	     pos = (pos + 1) & h->mask) {
+		const struct_ioctlent *const iop = &ioctlent[h->slots[pos] - 1];
+
+		if (iop->code == code)
+			return iop;
 	}
-	return iop;
+
+	return NULL;
 }
 
 static const struct_ioctlent *
@@ -252,7 +290,7 @@ ioctl_decode_command_number(struct tcb *tcp)
  *         and passes all other bits of ioctl_decode return value unchanged.
  */
 static int
-ioctl_decode(struct tcb *tcp)
+ioctl_decode_type(struct tcb *tcp)
 {
 	const unsigned int code = tcp->u_arg[1];
 	const kernel_ulong_t arg = tcp->u_arg[2];
@@ -320,6 +358,15 @@ ioctl_decode(struct tcb *tcp)
 	return 0;
 }
 
+static int
+ioctl_decode(struct tcb *tcp)
+{
+	selfprof_enter_ioctl(tcp->u_arg[1]);
+	const int rc = ioctl_decode_type(tcp);
+	selfprof_leave_ioctl();
+	return rc;
+}
+
 SYS_FUNC(ioctl)
 {
 	const struct_ioctlent *iop;
@@ -334,9 +381,9 @@ SYS_FUNC(ioctl)
 			if (iop) {
 				if (ret)
 					tprints(" or ");
-				tprints(iop->symbol);
+				tprints(ioctlent_name(iop));
 				while ((iop = ioctl_next_match(iop)))
-					tprintf(" or %s", iop->symbol);
+					tprintf(" or %s", ioctlent_name(iop));
 			} else if (!ret) {
 				ioctl_print_code(tcp->u_arg[1]);
 			}
@@ -143,7 +143,7 @@ ioctlsort(struct ioctlent *ioctls, size_t nioctls)
 		}
 		if (i == 0 || code(&ioctls[i-1]) != code(&ioctls[i]) ||
 		    !is_prefix(ioctls[i-1].name, ioctls[i].name))
-			printf("{ \"%s\", %#010x },\n",
+			printf("IOCTLENT(%s, %#010x)\n",
 				ioctls[i].name, code(ioctls+i));
 	}
 }
@@ -0,0 +1,498 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * SysV IPC contention accounting (--summary-ipc option).
+ *
+ * Calls of semop and semtimedop are accounted per semaphore set and
+ * per semaphore of the set: an operation that decrements a semaphore
+ * or waits for it to become zero is a wait, the time of the call is its
+ * blocking time, an operation that increments it is a post.  Calls
+ * of msgsnd and msgrcv are accounted per message queue.  IPC identifiers
+ * are system-wide, so they are not told apart by process.  Only the raw
+ * arguments, the array of semaphore operations, and the return value are
+ * used, so the calls do not have to be decoded.
+ */
+
+#include "defs.h"
+#include "latency_hist.h"
+#include "syscall.h"
+
+/* The layout of struct sembuf is the same in all personalities.  */
+struct sembuf_abi {
+	uint16_t sem_num;
+	int16_t sem_op;
+	int16_t sem_flg;
+};
+
+/* The semaphore operations of a call looked at, the rest are ignored.  */
+#define MAX_SEMOPS 64
+
+struct sem_counts {
+	struct sem_counts *next;
+	int semid;
+	/* The semaphore number, -1 for the whole set */
+	int semnum;
+	/* The semaphores of a set, linked by sibling */
+	struct sem_counts *nums, *sibling;
+	uint64_t waits, posts, eagain, errors;
+	uint64_t time_ns, min_ns, max_ns;
+	struct latency_hist hist;
+};
+
+struct msg_counts {
+	struct msg_counts *next;
+	int msqid;
+	uint64_t sends, recvs, sent_bytes, recv_bytes, nomsg;
+	uint64_t send_ns, recv_ns, send_max_ns, recv_max_ns;
+};
+
+unsigned int summary_ipc;
+static struct sem_counts **sem_hash;
+static unsigned int sem_hash_size;
+static unsigned int sem_hash_count;
+static unsigned int sem_set_count;
+static struct msg_counts **msg_hash;
+static unsigned int msg_hash_size;
+static unsigned int msg_hash_count;
+
+static unsigned int
+hash_ipc(const int id, const int num)
+{
+	return (unsigned int) (id * 31 + num) * 2654435761U;
+}
+
+static void
+sem_hash_expand(void)
+{
+	struct sem_counts **const old_hash = sem_hash;
+	const unsigned int old_size = sem_hash_size;
+	unsigned int i;
+
+	sem_hash_size = old_size ? old_size * 2 : 64;
+	sem_hash = xcalloc(sem_hash_size, sizeof(sem_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct sem_counts *sc, *next;
+
+		for (sc = old_hash[i]; sc; sc = next) {
+			const unsigned int b = hash_ipc(sc->semid, sc->semnum)
+					       & (sem_hash_size - 1);
+
+			next = sc->next;
+			sc->next = sem_hash[b];
+			sem_hash[b] = sc;
+		}
+	}
+
+	free(old_hash);
+}
+
+static struct sem_counts *
+get_sem_counts(const int semid, const int semnum)
+{
+	struct sem_counts *sc;
+
+	if (sem_hash_size) {
+		for (sc = sem_hash[hash_ipc(semid, semnum)
+				   & (sem_hash_size - 1)];
+		     sc; sc = sc->next) {
+			if (sc->semid == semid && sc->semnum == semnum)
+				return sc;
+		}
+	}
+
+	if (sem_hash_count >= sem_hash_size)
+		sem_hash_expand();
+
+	const unsigned int b = hash_ipc(semid, semnum) & (sem_hash_size - 1);
+
+	sc = xcalloc(1, sizeof(*sc));
+	sc->semid = semid;
+	sc->semnum = semnum;
+	sc->next = sem_hash[b];
+	sem_hash[b] = sc;
+	++sem_hash_count;
+
+	if (semnum < 0) {
+		++sem_set_count;
+	} else {
+		struct sem_counts *const set = get_sem_counts(semid, -1);
+
+		sc->sibling = set->nums;
+		set->nums = sc;
+	}
+
+	return sc;
+}
+
+static void
+msg_hash_expand(void)
+{
+	struct msg_counts **const old_hash = msg_hash;
+	const unsigned int old_size = msg_hash_size;
+	unsigned int i;
+
+	msg_hash_size = old_size ? old_size * 2 : 16;
+	msg_hash = xcalloc(msg_hash_size, sizeof(msg_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct msg_counts *mc, *next;
+
+		for (mc = old_hash[i]; mc; mc = next) {
+			const unsigned int b = hash_ipc(mc->msqid, 0)
+					       & (msg_hash_size - 1);
+
+			next = mc->next;
+			mc->next = msg_hash[b];
+			msg_hash[b] = mc;
+		}
+	}
+
+	free(old_hash);
+}
+
+static struct msg_counts *
+get_msg_counts(const int msqid)
+{
+	struct msg_counts *mc;
+
+	if (msg_hash_size) {
+		for (mc = msg_hash[hash_ipc(msqid, 0) & (msg_hash_size - 1)];
+		     mc; mc = mc->next) {
+			if (mc->msqid == msqid)
+				return mc;
+		}
+	}
+
+	if (msg_hash_count >= msg_hash_size)
+		msg_hash_expand();
+
+	const unsigned int b = hash_ipc(msqid, 0) & (msg_hash_size - 1);
+
+	mc = xcalloc(1, sizeof(*mc));
+	mc->msqid = msqid;
+	mc->next = msg_hash[b];
+	msg_hash[b] = mc;
+	++msg_hash_count;
+
+	return mc;
+}
+
+static void
+account_sem_wait(struct sem_counts *const sc, const struct tcb *const tcp,
+		 const uint64_t ns)
+{
+	sc->waits++;
+	if (syserror(tcp)) {
+		/* IPC_NOWAIT would block, or the semtimedop timed out.  */
+		if (tcp->u_error == EAGAIN)
+			sc->eagain++;
+		else
+			sc->errors++;
+	}
+
+	sc->time_ns += ns;
+	if (sc->waits == 1 || ns < sc->min_ns)
+		sc->min_ns = ns;
+	if (ns > sc->max_ns)
+		sc->max_ns = ns;
+
+	uint32_t *const b = &sc->hist.buckets[hist_bucket(ns)];
+
+	if (*b < UINT32_MAX)
+		++*b;
+}
+
+static void
+count_semop(struct tcb *const tcp, const uint64_t wall_ns)
+{
+	const int semid = tcp->u_arg[0];
+	const kernel_ulong_t addr = indirect_ipccall(tcp) ? tcp->u_arg[3]
+							  : tcp->u_arg[1];
+	kernel_ulong_t nsops = indirect_ipccall(tcp) ? tcp->u_arg[1]
+						     : tcp->u_arg[2];
+	struct sembuf_abi sops[MAX_SEMOPS];
+	bool waits = false, posts = false;
+	unsigned int i, j;
+
+	if (nsops > MAX_SEMOPS)
+		nsops = MAX_SEMOPS;
+	if (!nsops || umoven(tcp, addr, nsops * sizeof(sops[0]), sops))
+		return;
+
+	for (i = 0; i < nsops; ++i) {
+		const bool wait = sops[i].sem_op <= 0;
+
+		/* Account each semaphore of the call once.  */
+		for (j = 0; j < i; ++j) {
+			if (sops[j].sem_num == sops[i].sem_num
+			    && (sops[j].sem_op <= 0) == wait)
+				break;
+		}
+		if (j < i)
+			continue;
+
+		struct sem_counts *const sc =
+			get_sem_counts(semid, sops[i].sem_num);
+
+		if (wait) {
+			account_sem_wait(sc, tcp, wall_ns);
+			waits = true;
+		} else if (!syserror(tcp)) {
+			sc->posts++;
+			posts = true;
+		}
+	}
+
+	struct sem_counts *const set = get_sem_counts(semid, -1);
+
+	if (waits)
+		account_sem_wait(set, tcp, wall_ns);
+	else if (posts)
+		set->posts++;
+}
+
+static void
+count_msgsnd(struct tcb *const tcp, const uint64_t wall_ns)
+{
+	struct msg_counts *const mc = get_msg_counts(tcp->u_arg[0]);
+
+	mc->send_ns += wall_ns;
+	if (wall_ns > mc->send_max_ns)
+		mc->send_max_ns = wall_ns;
+	if (syserror(tcp))
+		return;
+	mc->sends++;
+	mc->sent_bytes += indirect_ipccall(tcp) ? tcp->u_arg[1]
+						: tcp->u_arg[2];
+}
+
+static void
+count_msgrcv(struct tcb *const tcp, const uint64_t wall_ns)
+{
+	struct msg_counts *const mc = get_msg_counts(tcp->u_arg[0]);
+
+	mc->recv_ns += wall_ns;
+	if (wall_ns > mc->recv_max_ns)
+		mc->recv_max_ns = wall_ns;
+	if (syserror(tcp)) {
+		/* IPC_NOWAIT found no message.  */
+		if (tcp->u_error == ENOMSG)
+			mc->nomsg++;
+		return;
+	}
+	mc->recvs++;
+	mc->recv_bytes += tcp->u_rval;
+}
+
+void
+count_ipc(struct tcb *const tcp, const uint64_t wall_ns)
+{
+	switch (tcp->s_ent->sen) {
+	case SEN_semop:
+	case SEN_semtimedop:
+		count_semop(tcp, wall_ns);
+		break;
+	case SEN_msgsnd:
+		count_msgsnd(tcp, wall_ns);
+		break;
+	case SEN_msgrcv:
+		count_msgrcv(tcp, wall_ns);
+		break;
+	}
+}
+
+static uint64_t
+sem_percentile(const struct sem_counts *const sc,
+	       const unsigned int permille)
+{
+	const uint64_t rank = (sc->waits * permille + 999) / 1000;
+	uint64_t seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; ++i) {
+		seen += sc->hist.buckets[i];
+		if (seen >= rank) {
+			const uint64_t v = hist_bucket_value(i);
+
+			return v < sc->min_ns ? sc->min_ns
+			     : v > sc->max_ns ? sc->max_ns : v;
+		}
+	}
+
+	return sc->max_ns;
+}
+
+static int
+sem_counts_cmp(const void *a, const void *b)
+{
+	const struct sem_counts *const x = *(const struct sem_counts **) a;
+	const struct sem_counts *const y = *(const struct sem_counts **) b;
+
+	return (x->time_ns < y->time_ns) ? 1 : (x->time_ns > y->time_ns) ? -1
+	     : (x->waits < y->waits) ? 1 : (x->waits > y->waits) ? -1
+	     : (x->semid != y->semid) ? x->semid - y->semid
+	     : x->semnum - y->semnum;
+}
+
+static void
+print_sem_line(FILE *outf, const struct sem_counts *const sc)
+{
+	if (sc->semnum < 0)
+		fprintf(outf, "%11d %7s", sc->semid, "all");
+	else
+		fprintf(outf, "%11s %7d", "", sc->semnum);
+	fprintf(outf, " %9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %9" PRIu64
+		" %11.6f %9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %9" PRIu64
+		"\n", sc->waits, sc->posts, sc->eagain, sc->errors,
+		sc->time_ns / 1e9, sem_percentile(sc, 500) / 1000,
+		sem_percentile(sc, 900) / 1000,
+		sem_percentile(sc, 990) / 1000, sc->max_ns / 1000);
+}
+
+/*
+ * Print the summary_ipc semaphore sets waited on the longest, each
+ * followed by its summary_ipc semaphores waited on the longest if more
+ * than one of its semaphores was used.
+ */
+static void
+sem_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	struct sem_counts **sorted, **nums;
+	unsigned int i, n = 0;
+
+	if (!sem_set_count)
+		return;
+
+	sorted = xcalloc(sem_set_count, sizeof(sorted[0]));
+	for (i = 0; i < sem_hash_size; ++i) {
+		struct sem_counts *sc;
+
+		for (sc = sem_hash[i]; sc; sc = sc->next) {
+			if (sc->semnum < 0)
+				sorted[n++] = sc;
+		}
+	}
+	sort_top(sorted, n, sizeof(sorted[0]), summary_ipc, sem_counts_cmp);
+	if (n > summary_ipc)
+		n = summary_ipc;
+
+	fprintf(outf, "\n%11.11s %7.7s %9.9s %9.9s %9.9s %9.9s %11.11s %9.9s"
+		" %9.9s %9.9s %9.9s\n", "semid", "semnum", "waits", "posts",
+		"eagain", "errors", "seconds", "p50 usecs", "p90 usecs",
+		"p99 usecs", "max usecs");
+	fprintf(outf, "%11.11s %7.7s %9.9s %9.9s %9.9s %9.9s %11.11s %9.9s"
+		" %9.9s %9.9s %9.9s\n", dashes, dashes, dashes, dashes,
+		dashes, dashes, dashes, dashes, dashes, dashes, dashes);
+
+	nums = xcalloc(sem_hash_count, sizeof(nums[0]));
+	for (i = 0; i < n; ++i) {
+		const struct sem_counts *const set = sorted[i];
+		struct sem_counts *sc;
+		unsigned int j, m = 0;
+
+		print_sem_line(outf, set);
+		for (sc = set->nums; sc; sc = sc->sibling)
+			nums[m++] = sc;
+		if (m < 2)
+			continue;
+		sort_top(nums, m, sizeof(nums[0]), summary_ipc,
+			 sem_counts_cmp);
+		for (j = 0; j < m && j < summary_ipc; ++j)
+			print_sem_line(outf, nums[j]);
+	}
+
+	free(nums);
+	free(sorted);
+}
+
+static int
+msg_counts_cmp(const void *a, const void *b)
+{
+	const struct msg_counts *const x = *(const struct msg_counts **) a;
+	const struct msg_counts *const y = *(const struct msg_counts **) b;
+	const uint64_t x_ns = x->send_ns + x->recv_ns;
+	const uint64_t y_ns = y->send_ns + y->recv_ns;
+	const uint64_t x_msgs = x->sends + x->recvs;
+	const uint64_t y_msgs = y->sends + y->recvs;
+
+	return (x_ns < y_ns) ? 1 : (x_ns > y_ns) ? -1
+	     : (x_msgs < y_msgs) ? 1 : (x_msgs > y_msgs) ? -1
+	     : x->msqid - y->msqid;
+}
+
+/* Print the summary_ipc message queues waited on the longest.  */
+static void
+msg_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	struct msg_counts **sorted;
+	unsigned int i, n = 0;
+
+	if (!msg_hash_count)
+		return;
+
+	sorted = xcalloc(msg_hash_count, sizeof(sorted[0]));
+	for (i = 0; i < msg_hash_size; ++i) {
+		struct msg_counts *mc;
+
+		for (mc = msg_hash[i]; mc; mc = mc->next)
+			sorted[n++] = mc;
+	}
+	sort_top(sorted, n, sizeof(sorted[0]), summary_ipc, msg_counts_cmp);
+	if (n > summary_ipc)
+		n = summary_ipc;
+
+	fprintf(outf, "\n%11.11s %9.9s %11.11s %9.9s %11.11s %9.9s %11.11s"
+		" %9.9s %11.11s %9.9s\n", "msqid", "sends", "sent", "recvs",
+		"received", "nomsg", "send secs", "max snd", "recv secs",
+		"max rcv");
+	fprintf(outf, "%11.11s %9.9s %11.11s %9.9s %11.11s %9.9s %11.11s"
+		" %9.9s %11.11s %9.9s\n", dashes, dashes, dashes, dashes,
+		dashes, dashes, dashes, dashes, dashes, dashes);
+	for (i = 0; i < n; ++i) {
+		const struct msg_counts *const mc = sorted[i];
+
+		fprintf(outf, "%11d %9" PRIu64 " %11" PRIu64 " %9" PRIu64
+			" %11" PRIu64 " %9" PRIu64 " %11.6f %9" PRIu64
+			" %11.6f %9" PRIu64 "\n", mc->msqid, mc->sends,
+			mc->sent_bytes, mc->recvs, mc->recv_bytes, mc->nomsg,
+			mc->send_ns / 1e9, mc->send_max_ns / 1000,
+			mc->recv_ns / 1e9, mc->recv_max_ns / 1000);
+	}
+
+	free(sorted);
+}
+
+void
+ipc_summary(FILE *outf)
+{
+	sem_summary(outf);
+	msg_summary(outf);
+}
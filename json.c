@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * JSON Lines output (--json option).
+ *
+ * Every syscall and every other event of a tracee is written as a single
+ * JSON object on a line of its own.  The text printed by syscall decoders
+ * is collected in the deferred output buffer of the tracee and is written
+ * as the "args" string, next to typed fields taken from the tcb.
+ * Objects are written as they are formatted, without building them
+ * in memory first.
+ */
+
+#include "defs.h"
+#include "json.h"
+#include "printsiginfo.h"
+
+bool json_output;
+
+/* Write LEN bytes of STR as a JSON string.  */
+static void
+json_string_n(const char *const str, const size_t len)
+{
+	char buf[256];
+	size_t pos = 0;
+	size_t i;
+
+	buf[pos++] = '"';
+	for (i = 0; i < len; ++i) {
+		const unsigned char c = str[i];
+
+		/* Leave room for the longest escape and the final quote.  */
+		if (pos > sizeof(buf) - sizeof("\\u00XX\"")) {
+			buf[pos] = '\0';
+			tprints(buf);
+			pos = 0;
+		}
+
+		switch (c) {
+		case '"':
+		case '\\':
+			buf[pos++] = '\\';
+			buf[pos++] = c;
+			break;
+		case '\n':
+			buf[pos++] = '\\';
+			buf[pos++] = 'n';
+			break;
+		case '\t':
+			buf[pos++] = '\\';
+			buf[pos++] = 't';
+			break;
+		default:
+			if (c < ' ' || c == 0x7f) {
+				pos += sprintf(buf + pos, "\\u%04x", c);
+			} else {
+				buf[pos++] = c;
+			}
+			break;
+		}
+	}
+	buf[pos++] = '"';
+	buf[pos] = '\0';
+	tprints(buf);
+}
+
+static void
+json_string(const char *const str)
+{
+	json_string_n(str, strlen(str));
+}
+
+static void
+json_begin(const struct tcb *const tcp, const char *const type,
+	   const struct timespec *const ts)
+{
+	tprintf("{\"type\":\"%s\",\"pid\":%d,\"time\":%lld.%09ld",
+		type, tcp->pid, (long long) ts->tv_sec, (long) ts->tv_nsec);
+}
+
+static void
+json_end(void)
+{
+	tprints("}\n");
+	line_ended();
+}
+
+/* Start a line of a non-syscall event.  */
+static void
+json_event_begin(struct tcb *const tcp, const char *const type)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	set_current_tcp(tcp);
+	json_begin(tcp, type, &ts);
+}
+
+void
+json_syscall_entering(struct tcb *const tcp)
+{
+	clock_gettime(CLOCK_REALTIME, &tcp->json_time);
+	set_current_tcp(tcp);
+}
+
+/* Write the fields common to all syscall lines and the decoded arguments.  */
+static void
+json_syscall_begin(struct tcb *const tcp)
+{
+	unsigned int i;
+
+	const size_t args_len = (tcp->flags & TCB_DEFERRED_OUTPUT)
+				? end_deferred_output(tcp) : 0;
+	const char *const args = args_len ? tcp->deferred_buf : "";
+
+	set_current_tcp(tcp);
+	json_begin(tcp, "syscall", &tcp->json_time);
+	tprints(",\"syscall\":");
+	json_string(tcp->s_ent->sys_name);
+	tprints(",\"args\":");
+	json_string_n(args, args_len);
+	tprints(",\"raw_args\":[");
+	for (i = 0; i < tcp->s_ent->nargs; ++i)
+		tprintf("%s%" PRI_klu, i ? "," : "", tcp->u_arg[i]);
+	tprints("]");
+}
+
+void
+json_syscall_exiting(struct tcb *const tcp, const int sys_res,
+		     const struct timespec *const ts)
+{
+	json_syscall_begin(tcp);
+
+	if (sys_res & RVAL_NONE) {
+		tprints(",\"retval\":null");
+	} else if (syserror(tcp)) {
+		const char *const name = err_name(tcp->u_error);
+
+		tprints(",\"retval\":-1,\"errno\":");
+		if (name)
+			json_string(name);
+		else
+			tprintf("%lu", tcp->u_error);
+	} else {
+		switch (sys_res & RVAL_MASK) {
+		case RVAL_HEX:
+		case RVAL_UDECIMAL:
+#if ANY_WORDSIZE_LESS_THAN_KERNEL_LONG
+			if (current_wordsize < sizeof(tcp->u_rval)) {
+				tprintf(",\"retval\":%u",
+					(unsigned int) tcp->u_rval);
+				break;
+			}
+#endif
+			tprintf(",\"retval\":%" PRI_klu,
+				(kernel_ulong_t) tcp->u_rval);
+			break;
+		default:
+			tprintf(",\"retval\":%" PRI_kld, tcp->u_rval);
+			break;
+		}
+	}
+	if ((sys_res & RVAL_STR) && tcp->auxstr) {
+		tprints(",\"aux\":");
+		json_string(tcp->auxstr);
+	}
+	if (tcp->flags & TCB_TAMPERED)
+		tprints(",\"injected\":true");
+
+	struct timespec dt;
+	ts_sub(&dt, ts, &tcp->etime);
+	tprintf(",\"duration\":%lld.%09ld",
+		(long long) dt.tv_sec, (long) dt.tv_nsec);
+	json_end();
+}
+
+/*
+ * The syscall has no result to print: either it could not be fetched,
+ * or the tracee is gone before syscall exiting.
+ */
+void
+json_syscall_unfinished(struct tcb *const tcp, const char *const why)
+{
+	json_syscall_begin(tcp);
+	tprints(",\"retval\":null,");
+	json_string(why);
+	tprints(":true");
+	json_end();
+}
+
+void
+json_signal(struct tcb *const tcp, const unsigned int sig,
+	    const siginfo_t *const si)
+{
+	json_event_begin(tcp, "signal");
+	tprints(",\"signal\":");
+	json_string(signame(sig));
+	if (si && (tcp->flags & TCB_DEFERRED_OUTPUT)) {
+		/* The buffer is busy with an unfinished syscall.  */
+		tprintf(",\"si_code\":%d", si->si_code);
+	} else if (si) {
+		defer_tcp_output(tcp);
+		printsiginfo(si);
+		const size_t len = end_deferred_output(tcp);
+		tprints(",\"siginfo\":");
+		json_string_n(tcp->deferred_buf, len);
+	} else {
+		tprints(",\"stopped\":true");
+	}
+	json_end();
+}
+
+void
+json_exited(struct tcb *const tcp, const int status)
+{
+	json_event_begin(tcp, "exit");
+	tprintf(",\"status\":%d", status);
+	json_end();
+}
+
+void
+json_killed(struct tcb *const tcp, const int sig, const bool core_dumped)
+{
+	json_event_begin(tcp, "killed");
+	tprints(",\"signal\":");
+	json_string(signame(sig));
+	if (core_dumped)
+		tprints(",\"core_dumped\":true");
+	json_end();
+}
+
+void
+json_superseded(struct tcb *const tcp, const unsigned long old_pid)
+{
+	json_event_begin(tcp, "superseded");
+	tprintf(",\"old_pid\":%lu", old_pid);
+	json_end();
+}
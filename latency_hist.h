@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef STRACE_LATENCY_HIST_H
+#define STRACE_LATENCY_HIST_H
+
+/*
+ * Log-linear latency histogram: values below 2^HIST_SUB_BITS nanoseconds
+ * have a bucket each, every further power of two is split into
+ * 2^HIST_SUB_BITS buckets, so the relative error is at most 12.5%.
+ */
+#define HIST_SUB_BITS 3
+#define HIST_SUB_BUCKETS (1U << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+struct latency_hist {
+	uint32_t buckets[HIST_BUCKETS];
+};
+
+static inline unsigned int
+hist_bucket(const uint64_t ns)
+{
+	if (ns < HIST_SUB_BUCKETS)
+		return ns;
+
+	unsigned int exp = 0;
+	uint64_t v = ns;
+	unsigned int shift;
+
+	for (shift = 32; shift; shift >>= 1) {
+		if (v >> shift) {
+			v >>= shift;
+			exp += shift;
+		}
+	}
+
+	const unsigned int sub = (ns >> (exp - HIST_SUB_BITS)) &
+				 (HIST_SUB_BUCKETS - 1);
+
+	return (exp - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS + sub;
+}
+
+/* Return the lowest value that falls into the given bucket. */
+static inline uint64_t
+hist_bucket_value(const unsigned int i)
+{
+	if (i < HIST_SUB_BUCKETS)
+		return i;
+
+	const unsigned int exp = i / HIST_SUB_BUCKETS + HIST_SUB_BITS - 1;
+	const uint64_t sub = i % HIST_SUB_BUCKETS;
+
+	return (HIST_SUB_BUCKETS + sub) << (exp - HIST_SUB_BITS);
+}
+
+#endif /* !STRACE_LATENCY_HIST_H */
@@ -39,6 +39,9 @@
 
 SYS_FUNC(link)
 {
+	const kernel_ulong_t paths[] = { tcp->u_arg[0], tcp->u_arg[1] };
+
+	umove_snapshot_strings(tcp, paths, ARRAY_SIZE(paths));
 	printpath(tcp, tcp->u_arg[0]);
 	tprints(", ");
 	printpath(tcp, tcp->u_arg[1]);
@@ -48,6 +51,9 @@ SYS_FUNC(link)
 
 SYS_FUNC(linkat)
 {
+	const kernel_ulong_t paths[] = { tcp->u_arg[1], tcp->u_arg[3] };
+
+	umove_snapshot_strings(tcp, paths, ARRAY_SIZE(paths));
 	print_dirfd(tcp, tcp->u_arg[0]);
 	printpath(tcp, tcp->u_arg[1]);
 	tprints(", ");
@@ -71,6 +77,9 @@ SYS_FUNC(unlinkat)
 
 SYS_FUNC(symlinkat)
 {
+	const kernel_ulong_t paths[] = { tcp->u_arg[0], tcp->u_arg[2] };
+
+	umove_snapshot_strings(tcp, paths, ARRAY_SIZE(paths));
 	printpath(tcp, tcp->u_arg[0]);
 	tprints(", ");
 	print_dirfd(tcp, tcp->u_arg[1]);
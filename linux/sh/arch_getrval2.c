@@ -1,8 +1,5 @@
 long
 getrval2(struct tcb *tcp)
 {
-	unsigned long val;
-	if (upeek(tcp->pid, 4*(REG_REG0+1), &val) < 0)
-		return -1;
-	return val;
+	return sh_regs.regs[1];
 }
@@ -1,2 +1,3 @@
-static unsigned long sh_r0;
-#define ARCH_PC_PEEK_ADDR (4 * REG_PC)
+static struct pt_regs sh_regs;
+#define ARCH_REGS_FOR_GETREGSET sh_regs
+#define ARCH_PC_REG sh_regs.pc
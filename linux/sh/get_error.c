@@ -3,10 +3,10 @@
 static void
 get_error(struct tcb *tcp, const bool check_errno)
 {
-	if (check_errno && is_negated_errno(sh_r0)) {
+	if (check_errno && is_negated_errno(sh_regs.regs[0])) {
 		tcp->u_rval = -1;
-		tcp->u_error = -sh_r0;
+		tcp->u_error = -sh_regs.regs[0];
 	} else {
-		tcp->u_rval = sh_r0;
+		tcp->u_rval = sh_regs.regs[0];
 	}
 }
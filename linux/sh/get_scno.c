@@ -2,13 +2,10 @@
 static int
 arch_get_scno(struct tcb *tcp)
 {
-	kernel_ulong_t scno = 0;
-
 	/*
 	 * In the new syscall ABI, the system call number is in R3.
 	 */
-	if (upeek(tcp->pid, 4*(REG_REG0+3), &scno) < 0)
-		return -1;
+	kernel_ulong_t scno = sh_regs.regs[3];
 
 	if ((long) scno < 0) {
 		/* Odd as it may seem, a glibc bug has been known to cause
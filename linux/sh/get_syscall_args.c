@@ -2,18 +2,11 @@
 static int
 get_syscall_args(struct tcb *tcp)
 {
-	static const int syscall_regs[MAX_ARGS] = {
-		4 * (REG_REG0+4),
-		4 * (REG_REG0+5),
-		4 * (REG_REG0+6),
-		4 * (REG_REG0+7),
-		4 * (REG_REG0  ),
-		4 * (REG_REG0+1)
-	};
-	unsigned int i;
-
-	for (i = 0; i < tcp->s_ent->nargs; ++i)
-		if (upeek(tcp->pid, syscall_regs[i], &tcp->u_arg[i]) < 0)
-			return -1;
+	tcp->u_arg[0] = sh_regs.regs[4];
+	tcp->u_arg[1] = sh_regs.regs[5];
+	tcp->u_arg[2] = sh_regs.regs[6];
+	tcp->u_arg[3] = sh_regs.regs[7];
+	tcp->u_arg[4] = sh_regs.regs[0];
+	tcp->u_arg[5] = sh_regs.regs[1];
 	return 1;
 }
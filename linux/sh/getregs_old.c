@@ -0,0 +1,24 @@
+/*
+ * PTRACE_GETREGSET was added to the SuperH kernel in v2.6.31,
+ * we provide a slow fallback for old kernels that fetches
+ * only the registers used for decoding syscalls.
+ */
+static int
+getregs_old(pid_t pid)
+{
+	unsigned int i;
+	int r;
+
+	if (iflag) {
+		r = upeek(pid, 4 * REG_PC, &sh_regs.pc);
+		if (r)
+			return r;
+	}
+	/* R0..R3: the result and the syscall number, R4..R7: arguments. */
+	for (i = 0; i < 8; ++i) {
+		r = upeek(pid, 4 * (REG_REG0 + i), &sh_regs.regs[i]);
+		if (r)
+			return r;
+	}
+	return 0;
+}
@@ -0,0 +1 @@
+#include "x86_64/getregs_old.h"
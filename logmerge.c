@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Streaming merge of the per-process logs written by strace -ff -o PREFIX
+ * with -t, -tt or -ttt timestamps.  Unlike strace-log-merge that sorts
+ * the whole trace, this keeps only the current record of each log
+ * in memory and merges the logs using a heap ordered by timestamps.
+ */
+
+#include "defs.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/resource.h>
+
+struct merge_log {
+	FILE *fp;
+	char *name;
+	int pid;
+	/* The current record: a timestamped line with its continuation lines. */
+	char *rec;
+	size_t rec_len;
+	size_t rec_size;
+	/* The line that follows the current record, already read. */
+	char *next;
+	size_t next_size;
+	ssize_t next_len;
+	unsigned long long ts;
+};
+
+static struct merge_log *logs;
+static unsigned int nlogs;
+/* Heap of the logs that have a current record, ordered by ts. */
+static struct merge_log **heap;
+static unsigned int heap_size;
+
+/*
+ * Parse the timestamp at the beginning of the line in "HH:MM:SS[.frac]",
+ * "SECONDS.frac", or "NANOSECONDS" (--monotonic-ts) format followed
+ * by a space into nanoseconds.
+ * Returns the address of the rest of the line, NULL if there is
+ * no timestamp.
+ */
+const char *
+parse_log_timestamp(const char *s, unsigned long long *const ts)
+{
+	unsigned long long sec = 0, nsec = 0;
+	unsigned int n, fields = 0;
+
+	if (!isdigit((unsigned char) *s))
+		return NULL;
+
+	for (;;) {
+		unsigned long long v = 0;
+
+		for (n = 0; isdigit((unsigned char) *s); ++s, ++n)
+			v = v * 10 + (*s - '0');
+		if (!n)
+			return NULL;
+		sec = sec * 60 + v;
+		++fields;
+		if (*s != ':')
+			break;
+		++s;
+	}
+
+	if (fields == 1 && *s == ' ') {
+		*ts = sec;
+		return s + 1;
+	}
+
+	if (*s == '.') {
+		for (++s, n = 0; isdigit((unsigned char) *s); ++s, ++n) {
+			if (n < 9)
+				nsec = nsec * 10 + (*s - '0');
+		}
+		if (!n)
+			return NULL;
+		for (; n < 9; ++n)
+			nsec *= 10;
+	}
+
+	if (*s != ' ')
+		return NULL;
+
+	*ts = sec * 1000000000ULL + nsec;
+	return s + 1;
+}
+
+static void
+read_next_line(struct merge_log *const log)
+{
+	log->next_len = getline(&log->next, &log->next_size, log->fp);
+	if (log->next_len < 0 && ferror(log->fp))
+		perror_msg_and_die("%s", log->name);
+}
+
+static void
+append_to_record(struct merge_log *const log, const char *s, size_t len)
+{
+	if (log->rec_len + len + 2 > log->rec_size) {
+		log->rec_size = log->rec_len + len + 2;
+		log->rec = xreallocarray(log->rec, log->rec_size, 1);
+	}
+	memcpy(log->rec + log->rec_len, s, len);
+	log->rec_len += len;
+	/* Some logs have the last line which is not '\n' terminated. */
+	if (!len || s[len - 1] != '\n')
+		log->rec[log->rec_len++] = '\n';
+}
+
+/*
+ * Read the next record of the log, return false at the end of the log.
+ * Lines without a timestamp, like -k stack frames and -x/-X dumps,
+ * belong to the record of the preceding timestamped line.
+ */
+static bool
+read_record(struct merge_log *const log)
+{
+	log->rec_len = 0;
+
+	for (;;) {
+		unsigned long long ts;
+
+		if (log->next_len < 0)
+			return log->rec_len;
+		if (log->next_len == 1 && log->next[0] == '\n') {
+			read_next_line(log);
+			continue;
+		}
+
+		const bool has_ts = parse_log_timestamp(log->next, &ts);
+
+		if (log->rec_len && has_ts)
+			return true;
+		if (!log->rec_len)
+			log->ts = has_ts ? ts : 0;
+		append_to_record(log, log->next, log->next_len);
+		read_next_line(log);
+	}
+}
+
+static bool
+log_before(const struct merge_log *const a, const struct merge_log *const b)
+{
+	/* Logs are sorted by name, keep that order for equal timestamps. */
+	return a->ts < b->ts || (a->ts == b->ts && a < b);
+}
+
+static void
+heap_sift_down(unsigned int i)
+{
+	for (;;) {
+		unsigned int min = i;
+		const unsigned int l = 2 * i + 1;
+		const unsigned int r = l + 1;
+
+		if (l < heap_size && log_before(heap[l], heap[min]))
+			min = l;
+		if (r < heap_size && log_before(heap[r], heap[min]))
+			min = r;
+		if (min == i)
+			return;
+
+		struct merge_log *const tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+static void
+print_record(const struct merge_log *const log)
+{
+	const char *line = log->rec;
+	const char *const end = log->rec + log->rec_len;
+
+	while (line < end) {
+		const char *const eol = memchr(line, '\n', end - line);
+
+		printf("%-5d ", log->pid);
+		fwrite(line, 1, eol + 1 - line, stdout);
+		line = eol + 1;
+	}
+}
+
+static int
+log_name_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct merge_log *) a)->name,
+		      ((const struct merge_log *) b)->name);
+}
+
+/*
+ * Find all PREFIX.PID files, and PREFIX.PID.gz files
+ * written with --output-compress.
+ */
+static void
+open_logs(const char *const prefix)
+{
+	const char *const slash = strrchr(prefix, '/');
+	const char *const base = slash ? slash + 1 : prefix;
+	const size_t base_len = strlen(base);
+	char *const dirname = slash ? xstrndup(prefix, slash + 1 - prefix)
+				    : xstrdup("./");
+	unsigned int size = 0;
+	struct dirent *de;
+	DIR *dir;
+
+	if (!(dir = opendir(dirname)))
+		perror_msg_and_die("opendir '%s'", dirname);
+
+	while ((de = readdir(dir))) {
+		if (strncmp(de->d_name, base, base_len) ||
+		    de->d_name[base_len] != '.')
+			continue;
+
+		const char *const suffix = de->d_name + base_len + 1;
+		const char *const gz = strstr(suffix, ".gz");
+		char *const num = xstrndup(suffix, gz && !gz[3]
+						   ? (size_t) (gz - suffix)
+						   : strlen(suffix));
+		const int pid = string_to_uint(num);
+
+		free(num);
+
+		if (pid <= 0)
+			continue;
+
+		if (nlogs == size) {
+			size = size ? size * 2 : 64;
+			logs = xreallocarray(logs, size, sizeof(*logs));
+		}
+
+		struct merge_log *const log = &logs[nlogs];
+
+		memset(log, 0, sizeof(*log));
+		log->pid = pid;
+		log->name = xmalloc(strlen(dirname) + strlen(de->d_name) + 1);
+		sprintf(log->name, "%s%s", slash ? dirname : "", de->d_name);
+		++nlogs;
+	}
+	closedir(dir);
+	free(dirname);
+
+	if (!nlogs)
+		error_msg_and_die("%s: strace output not found", prefix);
+
+	qsort(logs, nlogs, sizeof(*logs), log_name_cmp);
+}
+
+void
+merge_logs(const char *const prefix)
+{
+	struct rlimit rl;
+	unsigned int i;
+
+	open_logs(prefix);
+
+	/* Each log is kept open, so use as many descriptors as allowed. */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	heap = xcalloc(nlogs, sizeof(*heap));
+	for (i = 0; i < nlogs; ++i) {
+		struct merge_log *const log = &logs[i];
+
+		log->fp = decompress_fopen(log->name);
+		if (!log->fp)
+			perror_msg_and_die("Can't fopen '%s'", log->name);
+		read_next_line(log);
+		if (read_record(log))
+			heap[heap_size++] = log;
+		else
+			fclose(log->fp);
+	}
+
+	for (i = heap_size / 2; i-- > 0; )
+		heap_sift_down(i);
+
+	while (heap_size) {
+		struct merge_log *const log = heap[0];
+
+		print_record(log);
+		if (!read_record(log)) {
+			fclose(log->fp);
+			heap[0] = heap[--heap_size];
+		}
+		heap_sift_down(0);
+	}
+
+	if (fflush(stdout) || ferror(stdout))
+		perror_msg_and_die("write");
+
+	exit(0);
+}
@@ -284,7 +284,7 @@ SYS_FUNC(mincore)
 			for (i = 0; i < len; i++) {
 				if (i)
 					tprints(", ");
-				if (abbrev(tcp) && i >= max_strlen) {
+				if (abbrev(tcp) && i >= tcb_max_strlen(tcp)) {
 					tprints("...");
 					break;
 				}
@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Tracee memory read from something other than a live process.
+ *
+ * Both kinds of sources are sorted arrays of ranges looked up by binary
+ * search: the ranges of captured memory are copies of the data added,
+ * the ranges of a core file are its PT_LOAD segments, pointing into
+ * the file mapped at load time.
+ */
+
+#include "defs.h"
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mem_source.h"
+
+struct mem_range {
+	kernel_ulong_t addr;
+	kernel_ulong_t len;
+	const char *data;
+};
+
+struct range_source {
+	struct mem_source source;
+	struct mem_range *ranges;
+	size_t nranges;
+	size_t size;
+	/* The core file mapping, NULL if the data of the ranges is owned */
+	void *map;
+	size_t map_size;
+};
+
+static const char *
+range_find(const struct mem_source *const source, const kernel_ulong_t addr,
+	   kernel_ulong_t *const avail)
+{
+	const struct range_source *const rs = (const void *) source;
+	size_t lo = 0, hi = rs->nranges;
+
+	/* Find the last range that starts at or before ADDR.  */
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+
+		if (rs->ranges[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (!lo)
+		return NULL;
+
+	const struct mem_range *const r = &rs->ranges[lo - 1];
+
+	if (addr - r->addr >= r->len)
+		return NULL;
+	*avail = r->len - (addr - r->addr);
+	return r->data + (addr - r->addr);
+}
+
+static void
+range_free(struct mem_source *const source)
+{
+	struct range_source *const rs = (void *) source;
+	size_t i;
+
+	if (rs->map) {
+		munmap(rs->map, rs->map_size);
+	} else {
+		for (i = 0; i < rs->nranges; ++i)
+			free((char *) rs->ranges[i].data);
+	}
+	free(rs->ranges);
+	free(rs);
+}
+
+static struct range_source *
+range_source_new(void)
+{
+	struct range_source *const rs = xcalloc(1, sizeof(*rs));
+
+	rs->source.find = range_find;
+	rs->source.free = range_free;
+	return rs;
+}
+
+/* Insert a range keeping them sorted, ranges must not overlap.  */
+static void
+range_insert(struct range_source *const rs, const kernel_ulong_t addr,
+	     const kernel_ulong_t len, const char *const data)
+{
+	size_t i = rs->nranges;
+
+	if (rs->nranges >= rs->size) {
+		rs->size = rs->size ? rs->size * 2 : 16;
+		rs->ranges = xreallocarray(rs->ranges, rs->size,
+					   sizeof(rs->ranges[0]));
+	}
+	/* Ranges are usually added in the order of their addresses.  */
+	while (i && rs->ranges[i - 1].addr > addr)
+		--i;
+	memmove(&rs->ranges[i + 1], &rs->ranges[i],
+		(rs->nranges - i) * sizeof(rs->ranges[0]));
+	rs->ranges[i].addr = addr;
+	rs->ranges[i].len = len;
+	rs->ranges[i].data = data;
+	rs->nranges++;
+}
+
+struct mem_source *
+mem_source_records_new(void)
+{
+	return &range_source_new()->source;
+}
+
+void
+mem_source_records_add(struct mem_source *const source,
+		       const kernel_ulong_t addr, const void *const data,
+		       const unsigned int len)
+{
+	if (!len)
+		return;
+
+	char *const copy = xmalloc(len);
+
+	memcpy(copy, data, len);
+	range_insert((struct range_source *) source, addr, len, copy);
+}
+
+/*
+ * Add the PT_LOAD segments of the ELF core file mapped at MAP.
+ * Only the part of a segment present in the file is available:
+ * the rest, like the unmodified pages of mapped files, is not dumped.
+ */
+#define DEFINE_ADD_CORE_SEGMENTS(bits)					\
+static bool								\
+add_core_segments ## bits(struct range_source *const rs,		\
+			  const char *const map, const size_t size)	\
+{									\
+	const Elf ## bits ## _Ehdr *const eh = (const void *) map;	\
+	unsigned int i;							\
+									\
+	if (size < sizeof(*eh) || eh->e_type != ET_CORE			\
+	    || eh->e_phentsize != sizeof(Elf ## bits ## _Phdr)		\
+	    || eh->e_phoff > size					\
+	    || (size - eh->e_phoff) / sizeof(Elf ## bits ## _Phdr)	\
+	       < eh->e_phnum)						\
+		return false;						\
+									\
+	for (i = 0; i < eh->e_phnum; ++i) {				\
+		Elf ## bits ## _Phdr ph;				\
+									\
+		memcpy(&ph, map + eh->e_phoff + i * sizeof(ph),		\
+		       sizeof(ph));					\
+		if (ph.p_type != PT_LOAD || !ph.p_filesz		\
+		    || ph.p_offset > size				\
+		    || ph.p_filesz > size - ph.p_offset)		\
+			continue;					\
+		range_insert(rs, ph.p_vaddr, ph.p_filesz,		\
+			     map + ph.p_offset);			\
+	}								\
+									\
+	return true;							\
+}
+
+DEFINE_ADD_CORE_SEGMENTS(32)
+DEFINE_ADD_CORE_SEGMENTS(64)
+
+struct mem_source *
+mem_source_core_open(const char *const path)
+{
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+
+	if (fd < 0) {
+		perror_msg("open: %s", path);
+		return NULL;
+	}
+	if (fstat(fd, &st) || st.st_size < EI_NIDENT) {
+		error_msg("%s: not an ELF core file", path);
+		close(fd);
+		return NULL;
+	}
+
+	const size_t size = st.st_size;
+	char *const map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror_msg("mmap: %s", path);
+		return NULL;
+	}
+
+	struct range_source *const rs = range_source_new();
+	bool ok = false;
+
+	rs->map = map;
+	rs->map_size = size;
+	if (!memcmp(map, ELFMAG, SELFMAG)) {
+		if (map[EI_CLASS] == ELFCLASS32)
+			ok = add_core_segments32(rs, map, size);
+		else if (map[EI_CLASS] == ELFCLASS64)
+			ok = add_core_segments64(rs, map, size);
+	}
+	if (!ok) {
+		error_msg("%s: not an ELF core file", path);
+		range_free(&rs->source);
+		return NULL;
+	}
+
+	return &rs->source;
+}
+
+void
+mem_source_free(struct mem_source *const source)
+{
+	if (source)
+		source->free(source);
+}
+
+unsigned int
+mem_source_read(const struct mem_source *const source, kernel_ulong_t addr,
+		unsigned int len, void *laddr)
+{
+	unsigned int nread = 0;
+
+	while (len) {
+		kernel_ulong_t avail;
+		const char *const src = source->find(source, addr, &avail);
+
+		if (!src)
+			break;
+
+		const unsigned int n = MIN(avail, len);
+
+		memcpy(laddr, src, n);
+		addr += n;
+		laddr += n;
+		nread += n;
+		len -= n;
+	}
+
+	return nread;
+}
+
+int
+mem_source_read_str(const struct mem_source *const source, kernel_ulong_t addr,
+		    unsigned int len, char *laddr)
+{
+	while (len) {
+		kernel_ulong_t avail;
+		const char *const src = source->find(source, addr, &avail);
+
+		if (!src)
+			return -1;
+
+		const unsigned int n = MIN(avail, len);
+		const char *const nul = memchr(src, '\0', n);
+
+		if (nul) {
+			memcpy(laddr, src, nul - src + 1);
+			return 1;
+		}
+		memcpy(laddr, src, n);
+		addr += n;
+		laddr += n;
+		len -= n;
+	}
+
+	return 0;
+}
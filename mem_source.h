@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef STRACE_MEM_SOURCE_H
+#define STRACE_MEM_SOURCE_H
+
+#include "defs.h"
+
+/*
+ * Memory of a tcb that is read by umoven and umovestr instead of the
+ * memory of the live process, so that decoders can run without a tracee:
+ * on tracee memory captured earlier, or on a core file.
+ */
+struct mem_source {
+	/*
+	 * Return the local copy of the memory at ADDR and store the number
+	 * of bytes that follow it contiguously, NULL if ADDR is not available.
+	 */
+	const char *(*find)(const struct mem_source *, kernel_ulong_t addr,
+			    kernel_ulong_t *avail);
+	void (*free)(struct mem_source *);
+};
+
+/* Memory made of the ranges added by mem_source_records_add.  */
+extern struct mem_source *mem_source_records_new(void);
+extern void mem_source_records_add(struct mem_source *, kernel_ulong_t addr,
+				   const void *data, unsigned int len);
+/* Memory dumped to an ELF core file, NULL if it cannot be loaded.  */
+extern struct mem_source *mem_source_core_open(const char *path);
+extern void mem_source_free(struct mem_source *);
+
+/* Return the number of bytes copied, stopping at the first gap.  */
+extern unsigned int mem_source_read(const struct mem_source *,
+				    kernel_ulong_t addr, unsigned int len,
+				    void *laddr);
+/* Like umovestr.  */
+extern int mem_source_read_str(const struct mem_source *, kernel_ulong_t addr,
+			       unsigned int len, char *laddr);
+
+#endif /* !STRACE_MEM_SOURCE_H */
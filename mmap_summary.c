@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Memory mapping footprint of the tracees (--summary-mmap option).
+ *
+ * Mappings made and removed by mmap, munmap, mremap and brk are tracked
+ * per address space, that is, per thread group, from the raw syscall
+ * arguments and return values.  Mappings inherited from the parent
+ * or made before attaching are not known, so unmapping them is ignored.
+ */
+
+#include "defs.h"
+#include "syscall.h"
+
+/* A mapping [start, end) in the sorted array of an address space.  */
+struct mapping {
+	kernel_ulong_t start, end;
+};
+
+struct mm_counts {
+	struct mm_counts *next;
+	int tgid;
+	char comm[sizeof("1234567890123456")];
+	struct mapping *maps;
+	size_t nmaps, maps_size;
+	kernel_ulong_t brk_start, brk_end;
+	uint64_t size, peak_size;
+	uint64_t mapped_bytes, unmapped_bytes;
+	uint64_t maps_calls, unmaps_calls;
+};
+
+unsigned int summary_mmap;
+
+static struct mm_counts **mm_hash;
+static unsigned int mm_hash_size;
+static unsigned int mm_hash_count;
+static struct timespec first_ts, last_ts;
+
+#ifdef USE_LIBUNWIND
+/* Bytes mapped per -k stack, indexed by stack id.  */
+struct mmap_site {
+	uint64_t bytes, calls;
+};
+static struct mmap_site *sites;
+static unsigned int nsites;
+# define SUMMARY_MMAP_SITES 20
+#endif
+
+static void
+mm_hash_expand(void)
+{
+	struct mm_counts **const old_hash = mm_hash;
+	const unsigned int old_size = mm_hash_size;
+	unsigned int i;
+
+	mm_hash_size = old_size ? old_size * 2 : 64;
+	mm_hash = xcalloc(mm_hash_size, sizeof(mm_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct mm_counts *mm, *next;
+
+		for (mm = old_hash[i]; mm; mm = next) {
+			const unsigned int b =
+				(unsigned int) mm->tgid & (mm_hash_size - 1);
+
+			next = mm->next;
+			mm->next = mm_hash[b];
+			mm_hash[b] = mm;
+		}
+	}
+
+	free(old_hash);
+}
+
+/* Find the address space of the tracee, create it if CREATE is set.  */
+static struct mm_counts *
+get_mm_counts(struct tcb *const tcp, const bool create)
+{
+	const int tgid = get_tcb_tgid(tcp);
+	struct mm_counts *mm;
+
+	if (mm_hash_size) {
+		for (mm = mm_hash[(unsigned int) tgid & (mm_hash_size - 1)];
+		     mm; mm = mm->next) {
+			if (mm->tgid == tgid)
+				return mm;
+		}
+	}
+
+	if (!create)
+		return NULL;
+
+	if (mm_hash_count >= mm_hash_size)
+		mm_hash_expand();
+
+	const unsigned int b = (unsigned int) tgid & (mm_hash_size - 1);
+
+	mm = xcalloc(1, sizeof(*mm));
+	mm->tgid = tgid;
+	read_proc_comm(tcp->pid, mm->comm, sizeof(mm->comm));
+	mm->next = mm_hash[b];
+	mm_hash[b] = mm;
+	++mm_hash_count;
+
+	return mm;
+}
+
+/* Return the index of the first mapping that ends after ADDR.  */
+static size_t
+find_mapping(const struct mm_counts *const mm, const kernel_ulong_t addr)
+{
+	size_t lo = 0, hi = mm->nmaps;
+
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+
+		if (mm->maps[mid].end <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * Replace mappings with indices [lo, hi) with N mappings from NEW_MAPS.
+ */
+static void
+replace_mappings(struct mm_counts *const mm, const size_t lo, const size_t hi,
+		 const struct mapping *const new_maps, const size_t n)
+{
+	const size_t nmaps = mm->nmaps - (hi - lo) + n;
+
+	if (nmaps > mm->maps_size) {
+		mm->maps_size = MAX(nmaps, mm->maps_size * 2);
+		mm->maps = xreallocarray(mm->maps, mm->maps_size,
+					 sizeof(mm->maps[0]));
+	}
+	memmove(&mm->maps[lo + n], &mm->maps[hi],
+		(mm->nmaps - hi) * sizeof(mm->maps[0]));
+	memcpy(&mm->maps[lo], new_maps, n * sizeof(mm->maps[0]));
+	mm->nmaps = nmaps;
+}
+
+static void
+unmap_range(struct mm_counts *const mm, const kernel_ulong_t start,
+	    const kernel_ulong_t end)
+{
+	const size_t lo = find_mapping(mm, start);
+	struct mapping rest[2];
+	size_t hi, n = 0;
+	uint64_t bytes = 0;
+
+	for (hi = lo; hi < mm->nmaps && mm->maps[hi].start < end; ++hi) {
+		const struct mapping *const m = &mm->maps[hi];
+
+		bytes += MIN(m->end, end) - MAX(m->start, start);
+	}
+	if (hi == lo)
+		return;
+
+	if (mm->maps[lo].start < start)
+		rest[n++] = (struct mapping) { mm->maps[lo].start, start };
+	if (mm->maps[hi - 1].end > end)
+		rest[n++] = (struct mapping) { end, mm->maps[hi - 1].end };
+	replace_mappings(mm, lo, hi, rest, n);
+
+	mm->size -= bytes;
+	mm->unmapped_bytes += bytes;
+}
+
+static void
+map_range(struct mm_counts *const mm, const kernel_ulong_t start,
+	  const kernel_ulong_t end)
+{
+	/* A new mapping replaces whatever has been mapped there.  */
+	unmap_range(mm, start, end);
+
+	const struct mapping m = { start, end };
+	const size_t i = find_mapping(mm, start);
+
+	replace_mappings(mm, i, i, &m, 1);
+
+	mm->size += end - start;
+	mm->mapped_bytes += end - start;
+	if (mm->size > mm->peak_size)
+		mm->peak_size = mm->size;
+}
+
+static void
+reset_mm(struct mm_counts *const mm)
+{
+	mm->nmaps = 0;
+	mm->size = 0;
+	mm->brk_start = mm->brk_end = 0;
+}
+
+static kernel_ulong_t
+page_align(const kernel_ulong_t len)
+{
+	const kernel_ulong_t mask = get_pagesize() - 1;
+
+	return (len + mask) & ~mask;
+}
+
+#ifdef USE_LIBUNWIND
+static void
+count_mmap_site(struct tcb *const tcp, const uint64_t bytes)
+{
+	const unsigned int id = unwind_stack_id(tcp);
+
+	if (!id)
+		return;
+	if (id > nsites) {
+		const unsigned int n = MAX(id, nsites * 2);
+
+		sites = xreallocarray(sites, n, sizeof(sites[0]));
+		memset(&sites[nsites], 0, (n - nsites) * sizeof(sites[0]));
+		nsites = n;
+	}
+	sites[id - 1].bytes += bytes;
+	sites[id - 1].calls++;
+}
+#endif
+
+void
+count_mmap(struct tcb *const tcp, const struct timespec *const ts)
+{
+	if (!first_ts.tv_sec && !first_ts.tv_nsec)
+		first_ts = *ts;
+	last_ts = *ts;
+
+	if (syserror(tcp))
+		return;
+
+	const kernel_ulong_t rval = tcp->u_rval;
+	struct mm_counts *mm;
+	kernel_ulong_t len;
+
+	switch (tcp->s_ent->sen) {
+	case SEN_mmap:
+	case SEN_mmap_pgoff:
+	case SEN_mmap_4koff:
+		mm = get_mm_counts(tcp, true);
+		len = page_align(tcp->u_arg[1]);
+		map_range(mm, rval, rval + len);
+		mm->maps_calls++;
+#ifdef USE_LIBUNWIND
+		if (stack_trace_enabled && stack_traced(tcp))
+			count_mmap_site(tcp, len);
+#endif
+		break;
+	case SEN_munmap:
+		mm = get_mm_counts(tcp, true);
+		unmap_range(mm, tcp->u_arg[0],
+			    tcp->u_arg[0] + page_align(tcp->u_arg[1]));
+		mm->unmaps_calls++;
+		break;
+	case SEN_mremap:
+		mm = get_mm_counts(tcp, true);
+		len = page_align(tcp->u_arg[2]);
+		unmap_range(mm, tcp->u_arg[0],
+			    tcp->u_arg[0] + page_align(tcp->u_arg[1]));
+		map_range(mm, rval, rval + len);
+		mm->maps_calls++;
+#ifdef USE_LIBUNWIND
+		if (stack_trace_enabled && stack_traced(tcp))
+			count_mmap_site(tcp, len);
+#endif
+		break;
+	case SEN_brk:
+		mm = get_mm_counts(tcp, true);
+		if (!mm->brk_start) {
+			/* The first brk call finds out where the heap is.  */
+			mm->brk_start = mm->brk_end = rval;
+		}
+		if (rval > mm->brk_end)
+			map_range(mm, mm->brk_end, rval);
+		else if (rval < mm->brk_end)
+			unmap_range(mm, rval, mm->brk_end);
+		mm->brk_end = rval;
+		break;
+	case SEN_execve:
+	case SEN_execveat:
+		/* The address space is replaced.  */
+		mm = get_mm_counts(tcp, false);
+		if (mm) {
+			reset_mm(mm);
+			read_proc_comm(tcp->pid, mm->comm, sizeof(mm->comm));
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static int
+mm_counts_cmp(const void *a, const void *b)
+{
+	const struct mm_counts *const x = *(const struct mm_counts **) a;
+	const struct mm_counts *const y = *(const struct mm_counts **) b;
+
+	return (x->peak_size < y->peak_size) ? 1
+	     : (x->peak_size > y->peak_size) ? -1
+	     : (x->tgid > y->tgid) - (x->tgid < y->tgid);
+}
+
+#ifdef USE_LIBUNWIND
+static void
+mmap_site_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	unsigned int *sorted;
+	unsigned int i, n = 0;
+
+	for (i = 0; i < nsites; ++i) {
+		if (sites[i].calls)
+			++n;
+	}
+	if (!n)
+		return;
+
+	sorted = xcalloc(n, sizeof(sorted[0]));
+	for (i = 0, n = 0; i < nsites; ++i) {
+		if (sites[i].calls)
+			sorted[n++] = i;
+	}
+	for (i = 1; i < n; ++i) {
+		/* Insertion sort by bytes, the number of sites is small.  */
+		const unsigned int id = sorted[i];
+		unsigned int j;
+
+		for (j = i; j > 0 && sites[sorted[j - 1]].bytes < sites[id].bytes;
+		     --j)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = id;
+	}
+
+	fprintf(outf, "\n%14.14s %9.9s %s\n", "bytes mapped", "calls",
+		"mapping site");
+	fprintf(outf, "%14.14s %9.9s %s\n", dashes, dashes, dashes);
+	for (i = 0; i < n && i < SUMMARY_MMAP_SITES; ++i) {
+		fprintf(outf, "%14" PRIu64 " %9" PRIu64 " ",
+			sites[sorted[i]].bytes, sites[sorted[i]].calls);
+		unwind_print_folded_stack(outf, sorted[i] + 1);
+		fputc('\n', outf);
+	}
+
+	free(sorted);
+}
+#endif
+
+/*
+ * Print the address spaces with the largest peak footprint,
+ * at most summary_mmap of them, and the mapping churn.
+ */
+void
+mmap_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	struct mm_counts **sorted;
+	uint64_t mapped = 0, unmapped = 0;
+	unsigned int i, n = 0;
+
+	if (!mm_hash_count)
+		return;
+
+	sorted = xcalloc(mm_hash_count, sizeof(sorted[0]));
+	for (i = 0; i < mm_hash_size; ++i) {
+		struct mm_counts *mm;
+
+		for (mm = mm_hash[i]; mm; mm = mm->next) {
+			sorted[n++] = mm;
+			mapped += mm->mapped_bytes;
+			unmapped += mm->unmapped_bytes;
+		}
+	}
+	sort_top(sorted, n, sizeof(sorted[0]), summary_mmap, mm_counts_cmp);
+
+	fprintf(outf, "\n%14.14s %14.14s %14.14s %14.14s %9.9s %9.9s %s\n",
+		"peak bytes", "bytes at exit", "bytes mapped", "bytes unmapped",
+		"maps", "unmaps", "process");
+	fprintf(outf, "%14.14s %14.14s %14.14s %14.14s %9.9s %9.9s %s\n",
+		dashes, dashes, dashes, dashes, dashes, dashes, dashes);
+	for (i = 0; i < n && i < summary_mmap; ++i) {
+		const struct mm_counts *const mm = sorted[i];
+
+		fprintf(outf, "%14" PRIu64 " %14" PRIu64 " %14" PRIu64
+			" %14" PRIu64 " %9" PRIu64 " %9" PRIu64 " %d (%s)\n",
+			mm->peak_size, mm->size, mm->mapped_bytes,
+			mm->unmapped_bytes, mm->maps_calls, mm->unmaps_calls,
+			mm->tgid, mm->comm);
+	}
+
+	struct timespec dt;
+	ts_sub(&dt, &last_ts, &first_ts);
+	const double secs = dt.tv_sec + dt.tv_nsec / 1e9;
+
+	if (secs > 0)
+		fprintf(outf, "\nMapping churn: %.0f bytes/sec mapped,"
+			" %.0f bytes/sec unmapped over %.6f seconds\n",
+			mapped / secs, unmapped / secs, secs);
+
+	free(sorted);
+
+#ifdef USE_LIBUNWIND
+	if (stack_trace_enabled)
+		mmap_site_summary(outf);
+#endif
+}
@@ -46,6 +46,25 @@ fetch_struct_mmsghdr_or_printaddr(struct tcb *const tcp,
 	}
 }
 
+/*
+ * Read the first N elements of the mmsghdr vector with a single
+ * process_vm_readv call, fetch_struct_mmsghdr then copies them
+ * from the snapshot.
+ */
+static void
+snapshot_mmsgvec(struct tcb *const tcp, const kernel_ulong_t addr,
+		 unsigned int n)
+{
+	if (n > IOV_MAX)
+		n = IOV_MAX;
+
+	const struct umove_range range = {
+		.addr = addr,
+		.len = n * sizeof_struct_mmsghdr()
+	};
+	umove_snapshot(tcp, &range, 1);
+}
+
 struct print_struct_mmsghdr_config {
 	const int *p_user_msg_namelen;
 	unsigned int msg_len_vlen;
@@ -81,16 +100,6 @@ print_struct_mmsghdr(struct tcb *tcp, void *elem_buf,
 	return true;
 }
 
-static void
-free_mmsgvec_data(void *ptr)
-{
-	char **pstr = ptr;
-	free(*pstr);
-	*pstr = 0;
-
-	free(ptr);
-}
-
 struct mmsgvec_data {
 	char *timeout;
 	unsigned int count;
@@ -104,13 +113,18 @@ save_mmsgvec_namelen(struct tcb *const tcp, kernel_ulong_t addr,
 	if (len > IOV_MAX)
 		len = IOV_MAX;
 
+	/* The data lives in the scratch memory until the syscall exit.  */
 	const size_t data_size = offsetof(struct mmsgvec_data, namelen)
 				 + sizeof(int) * len;
-	struct mmsgvec_data *const data = xmalloc(data_size);
-	data->timeout = xstrdup(timeout);
+	const size_t timeout_size = strlen(timeout) + 1;
+	struct mmsgvec_data *const data =
+		tcb_scratch_alloc(tcp, data_size + timeout_size);
+	data->timeout = memcpy((char *) data + data_size, timeout,
+			       timeout_size);
 
 	unsigned int i, fetched;
 
+	snapshot_mmsgvec(tcp, addr, len);
 	for (i = 0; i < len; ++i, addr += fetched) {
 		struct mmsghdr mh;
 
@@ -121,7 +135,7 @@ save_mmsgvec_namelen(struct tcb *const tcp, kernel_ulong_t addr,
 	}
 	data->count = i;
 
-	set_tcb_priv_data(tcp, data, free_mmsgvec_data);
+	set_tcb_priv_data(tcp, data, NULL);
 }
 
 static void
@@ -143,11 +157,61 @@ decode_mmsgvec(struct tcb *const tcp, const kernel_ulong_t addr,
 		c.p_user_msg_namelen = data->namelen;
 	}
 
+	if (entering(tcp) || !syserror(tcp))
+		snapshot_mmsgvec(tcp, addr,
+				 abbrev(tcp) && vlen > tcb_max_strlen(tcp)
+				 ? tcb_max_strlen(tcp) + 1 : vlen);
 	print_array(tcp, addr, vlen, &mmsg, sizeof_struct_mmsghdr(),
 		    fetch_struct_mmsghdr_or_printaddr,
 		    print_struct_mmsghdr, &c);
 }
 
+/* Messages of 0, 1, 2-3, 4-7, ..., 32768-65535, and 65536 or more bytes */
+#define MMSG_SIZE_BUCKETS 18
+
+/*
+ * Print the address of the vector followed by the number and the total
+ * size of the first N messages, and the distribution of their sizes.
+ */
+static void
+print_mmsgvec_stats(struct tcb *const tcp, kernel_ulong_t addr,
+		    unsigned int n)
+{
+	unsigned int hist[MMSG_SIZE_BUCKETS] = { 0 };
+	unsigned long long bytes = 0;
+	unsigned int i, j, fetched;
+	struct mmsghdr mmsg;
+
+	printaddr(addr);
+	if (!addr)
+		return;
+
+	snapshot_mmsgvec(tcp, addr, n);
+	for (i = 0; i < n; ++i, addr += fetched) {
+		fetched = fetch_struct_mmsghdr(tcp, addr, &mmsg);
+		if (!fetched)
+			break;
+		bytes += mmsg.msg_len;
+		for (j = 0; j < MMSG_SIZE_BUCKETS - 1 && mmsg.msg_len >> j; ++j)
+			;
+		hist[j]++;
+	}
+
+	tprintf(" /* %u messages, %llu bytes", i, bytes);
+	for (j = 0; j < MMSG_SIZE_BUCKETS; ++j) {
+		if (!hist[j])
+			continue;
+		if (j <= 1)
+			tprintf(", %u: %u", j, hist[j]);
+		else if (j < MMSG_SIZE_BUCKETS - 1)
+			tprintf(", %u-%u: %u", 1U << (j - 1), (1U << j) - 1,
+				hist[j]);
+		else
+			tprintf(", %u+: %u", 1U << (j - 1), hist[j]);
+	}
+	tprints(" */");
+}
+
 void
 dumpiov_in_mmsghdr(struct tcb *const tcp, kernel_ulong_t addr)
 {
@@ -155,6 +219,7 @@ dumpiov_in_mmsghdr(struct tcb *const tcp, kernel_ulong_t addr)
 	unsigned int i, fetched;
 	struct mmsghdr mmsg;
 
+	snapshot_mmsgvec(tcp, addr, len);
 	for (i = 0; i < len; ++i, addr += fetched) {
 		fetched = fetch_struct_mmsghdr(tcp, addr, &mmsg);
 		if (!fetched)
@@ -186,10 +251,14 @@ SYS_FUNC(sendmmsg)
 		const unsigned int msg_len_vlen =
 			syserror(tcp) ? 0 : tcp->u_rval;
 		/* msgvec */
-		temporarily_clear_syserror(tcp);
-		decode_mmsgvec(tcp, tcp->u_arg[1], tcp->u_arg[2],
-			       msg_len_vlen, false);
-		restore_cleared_syserror(tcp);
+		if (mmsg_stats) {
+			print_mmsgvec_stats(tcp, tcp->u_arg[1], msg_len_vlen);
+		} else {
+			temporarily_clear_syserror(tcp);
+			decode_mmsgvec(tcp, tcp->u_arg[1], tcp->u_arg[2],
+				       msg_len_vlen, false);
+			restore_cleared_syserror(tcp);
+		}
 		/* vlen */
 		tprintf(", %u, ", (unsigned int) tcp->u_arg[2]);
 		/* flags */
@@ -204,7 +273,8 @@ SYS_FUNC(recvmmsg)
 		printfd(tcp, tcp->u_arg[0]);
 		tprints(", ");
 		if (verbose(tcp)) {
-			save_mmsgvec_namelen(tcp, tcp->u_arg[1], tcp->u_arg[2],
+			save_mmsgvec_namelen(tcp, tcp->u_arg[1],
+					     mmsg_stats ? 0 : tcp->u_arg[2],
 					     sprint_timespec(tcp, tcp->u_arg[4]));
 		} else {
 			/* msgvec */
@@ -220,8 +290,13 @@ SYS_FUNC(recvmmsg)
 	} else {
 		if (verbose(tcp)) {
 			/* msgvec */
-			decode_mmsgvec(tcp, tcp->u_arg[1], tcp->u_rval,
-				       tcp->u_rval, true);
+			if (mmsg_stats)
+				print_mmsgvec_stats(tcp, tcp->u_arg[1],
+						    syserror(tcp) ? 0
+						    : tcp->u_rval);
+			else
+				decode_mmsgvec(tcp, tcp->u_arg[1], tcp->u_rval,
+					       tcp->u_rval, true);
 			/* vlen */
 			tprintf(", %u, ", (unsigned int) tcp->u_arg[2]);
 			/* flags */
@@ -26,6 +26,14 @@
 # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
 # THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+# The layouts are regenerated only when the preprocessed source
+# of the type, the compiler, or mpers.awk changes.  If MPERS_CACHE_DIR
+# is set, the layouts are also kept there, keyed by the same checksum,
+# and shared between build trees.
+# Several instances may run at once for files that define the same type,
+# so temporary files are private to the instance and results are renamed
+# into place.
+
 export LC_ALL=C
 
 MPERS_AWK="${0%/*}/mpers.awk"
@@ -39,6 +47,7 @@ CPPFLAGS="$CPPFLAGS -MM -MG"
 
 VAR_NAME='mpers_target_var'
 BITS_DIR="mpers${ARCH_FLAG}"
+CC_ID="$($CC -dumpmachine 2>/dev/null || :) $($CC -dumpversion 2>/dev/null || :) $(cksum < "$MPERS_AWK")"
 
 mkdir -p ${BITS_DIR}
 set -- $(sed -r -n \
@@ -46,11 +55,13 @@ set -- $(sed -r -n \
 		"${PARSER_FILE}")
 for m_type; do
 	f_h="${BITS_DIR}/${m_type}.h"
-	f_c="${BITS_DIR}/${m_type}.c"
-	f_i="${BITS_DIR}/${m_type}.i"
-	f_o="${BITS_DIR}/${m_type}.o"
-	f_d1="${BITS_DIR}/${m_type}.d1"
-	f_d2="${BITS_DIR}/${m_type}.d2"
+	f_key="${BITS_DIR}/${m_type}.key"
+	tmp="${BITS_DIR}/${m_type}.$$"
+	f_c="${tmp}.c"
+	f_i="${tmp}.i"
+	f_o="${tmp}.o"
+	f_d1="${tmp}.d1"
+	f_d2="${tmp}.d2"
 	sed -e '
 		/DEF_MPERS_TYPE('"${m_type}"')$/n
 		/DEF_MPERS_TYPE/d
@@ -58,18 +69,42 @@ for m_type; do
 		/^#[[:space:]]*include[[:space:]][[:space:]]*MPERS_DEFS$/ {s//'"${m_type} ${VAR_NAME}"';/;q}
 		' "${PARSER_FILE}" > "${f_c}"
 	$CPP $CPPFLAGS "${f_c}" > "${f_i}"
-	grep -F -q "${m_type}.h" "${f_i}" ||
+	if ! grep -F -q "${m_type}.h" "${f_i}"; then
+		rm -f "${f_c}" "${f_i}"
 		continue
+	fi
 	sed -i -e '/DEF_MPERS_TYPE/d' "${f_c}"
-	$CC $CFLAGS $ARCH_FLAG "${f_c}" -o "${f_o}"
-	readelf --debug-dump=info "${f_o}" > "${f_d1}"
-	sed -r -n '
-		/^[[:space:]]*<1>/,/^[[:space:]]*<1><[^>]+>: Abbrev Number: 0/!d
-		/^[[:space:]]*<[^>]*><[^>]*>: Abbrev Number: 0/d
-		s/^[[:space:]]*<[[:xdigit:]]+>[[:space:]]+//
-		s/^[[:space:]]*((<[[:xdigit:]]+>){2}):[[:space:]]+/\1\n/
-		s/[[:space:]]+$//
-		p' "${f_d1}" > "${f_d2}"
-	gawk -v VAR_NAME="$VAR_NAME" -v ARCH_FLAG="${ARCH_FLAG#-}" \
-		-f "$MPERS_AWK" "${f_d2}" > "${f_h}"
+	key="$({ printf '%s\n' "$CC_ID" "$ARCH_FLAG"
+		 $CC $CFLAGS $ARCH_FLAG -E -P "${f_c}"; } | md5sum)"
+	key="${key%% *}"
+	if [ -f "${f_h}" ] && [ "$(cat "${f_key}" 2>/dev/null)" = "$key" ]; then
+		rm -f "${f_c}" "${f_i}"
+		continue
+	fi
+	if [ -n "${MPERS_CACHE_DIR-}" ] &&
+	   [ -f "${MPERS_CACHE_DIR}/${key}.h" ]; then
+		cp "${MPERS_CACHE_DIR}/${key}.h" "${tmp}.h"
+	else
+		$CC $CFLAGS $ARCH_FLAG "${f_c}" -o "${f_o}"
+		readelf --debug-dump=info "${f_o}" > "${f_d1}"
+		sed -r -n '
+			/^[[:space:]]*<1>/,/^[[:space:]]*<1><[^>]+>: Abbrev Number: 0/!d
+			/^[[:space:]]*<[^>]*><[^>]*>: Abbrev Number: 0/d
+			s/^[[:space:]]*<[[:xdigit:]]+>[[:space:]]+//
+			s/^[[:space:]]*((<[[:xdigit:]]+>){2}):[[:space:]]+/\1\n/
+			s/[[:space:]]+$//
+			p' "${f_d1}" > "${f_d2}"
+		gawk -v VAR_NAME="$VAR_NAME" -v ARCH_FLAG="${ARCH_FLAG#-}" \
+			-f "$MPERS_AWK" "${f_d2}" > "${tmp}.h"
+		if [ -n "${MPERS_CACHE_DIR-}" ]; then
+			mkdir -p "${MPERS_CACHE_DIR}"
+			cp "${tmp}.h" "${MPERS_CACHE_DIR}/${key}.h.$$"
+			mv -f "${MPERS_CACHE_DIR}/${key}.h.$$" \
+				"${MPERS_CACHE_DIR}/${key}.h"
+		fi
+	fi
+	mv -f "${tmp}.h" "${f_h}"
+	echo "$key" > "${tmp}.key"
+	mv -f "${tmp}.key" "${f_key}"
+	rm -f "${f_c}" "${f_i}" "${f_o}" "${f_d1}" "${f_d2}"
 done
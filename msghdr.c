@@ -66,15 +66,17 @@ print_scm_rights(struct tcb *tcp, const void *cmsg_data,
 
 	tprints("[");
 
+	printfd_batch_begin();
 	for (i = 0; i < nfds; ++i) {
 		if (i)
 			tprints(", ");
-		if (abbrev(tcp) && i >= max_strlen) {
+		if (abbrev(tcp) && i >= tcb_max_strlen(tcp)) {
 			tprints("...");
 			break;
 		}
 		printfd(tcp, fds[i]);
 	}
+	printfd_batch_end();
 
 	tprints("]");
 }
@@ -160,7 +162,7 @@ print_cmsg_ip_opts(struct tcb *tcp, const void *cmsg_data,
 	for (i = 0; i < data_len; ++i) {
 		if (i)
 			tprints(", ");
-		if (abbrev(tcp) && i >= max_strlen) {
+		if (abbrev(tcp) && i >= tcb_max_strlen(tcp)) {
 			tprints("...");
 			break;
 		}
@@ -295,10 +297,9 @@ decode_msg_control(struct tcb *const tcp, const kernel_ulong_t addr,
 	unsigned int control_len = in_control_len > get_optmem_max()
 				   ? get_optmem_max() : in_control_len;
 	unsigned int buf_len = control_len;
-	char *buf = buf_len < cmsg_size ? NULL : malloc(buf_len);
+	char *buf = buf_len < cmsg_size ? NULL : tcb_scratch_alloc(tcp, buf_len);
 	if (!buf || umoven(tcp, addr, buf_len, buf) < 0) {
 		printaddr(addr);
-		free(buf);
 		return;
 	}
 
@@ -355,7 +356,6 @@ decode_msg_control(struct tcb *const tcp, const kernel_ulong_t addr,
 		tprints(", ...");
 	}
 	tprints("]");
-	free(buf);
 }
 
 void
@@ -48,6 +48,13 @@
 #include "xlat/nl_xfrm_types.h"
 #include "xlat/nlmsgerr_attrs.h"
 
+/*
+ * Netlink messages of up to this many bytes are fetched in one go,
+ * so that parsing of message headers and attributes does not cost
+ * a read of tracee memory each.
+ */
+#define NETLINK_SNAPSHOT_SIZE (64 * 1024)
+
 /*
  * Fetch a struct nlmsghdr from the given address.
  */
@@ -107,7 +114,14 @@ decode_nlmsg_type_generic(const struct xlat *const xlat,
 			  const uint16_t type,
 			  const char *const dflt)
 {
-	printxval(genl_families_xlat(), type, dflt);
+	const char *const name = genl_family_name(type);
+
+	if (name) {
+		tprints(name);
+	} else {
+		tprintf("%#x", type);
+		tprints_comment(dflt);
+	}
 }
 
 static void
@@ -455,12 +469,18 @@ decode_netlink(struct tcb *const tcp,
 		return;
 	}
 
+	const struct umove_range range = {
+		.addr = addr,
+		.len = MIN(len, NETLINK_SNAPSHOT_SIZE)
+	};
+	umove_snapshot(tcp, &range, 1);
+
 	struct nlmsghdr nlmsghdr;
 	bool print_array = false;
 	unsigned int elt;
 
 	for (elt = 0; fetch_nlmsghdr(tcp, &nlmsghdr, addr, len); elt++) {
-		if (abbrev(tcp) && elt == max_strlen) {
+		if (abbrev(tcp) && elt == tcb_max_strlen(tcp)) {
 			tprints("...");
 			break;
 		}
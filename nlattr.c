@@ -111,7 +111,7 @@ decode_nlattr(struct tcb *const tcp,
 	unsigned int elt;
 
 	for (elt = 0; fetch_nlattr(tcp, &nla, addr, len); elt++) {
-		if (abbrev(tcp) && elt == max_strlen) {
+		if (abbrev(tcp) && elt == tcb_max_strlen(tcp)) {
 			tprints("...");
 			break;
 		}
@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Decoding of event buffers read from inotify and fanotify descriptors
+ * (--notify-events option), and statistics of these events
+ * (--summary-notify option).  Descriptors are recognized by the paths
+ * of their anonymous inodes, which are cached by getfdpath.
+ */
+
+#include "defs.h"
+#include "syscall.h"
+
+/* Buffers larger than this are decoded and counted only partially.  */
+#define NOTIFY_BUF_MAX (64 * 1024)
+
+#define INOTIFY_EVENT_SIZE 16	/* wd, mask, cookie, len */
+#define FANOTIFY_METADATA_SIZE 24
+
+struct inotify_event_hdr {
+	int32_t wd;
+	uint32_t mask;
+	uint32_t cookie;
+	uint32_t len;
+};
+
+struct fanotify_event_hdr {
+	uint32_t event_len;
+	uint8_t vers;
+	uint8_t reserved;
+	uint16_t metadata_len;
+	uint64_t ATTRIBUTE_ALIGNED(8) mask;
+	int32_t fd;
+	int32_t pid;
+};
+
+enum notify_kind {
+	NOTIFY_NONE,
+	NOTIFY_INOTIFY,
+	NOTIFY_FANOTIFY
+};
+
+unsigned int summary_notify;
+
+static enum notify_kind
+get_fd_notify_kind(struct tcb *const tcp, const int fd)
+{
+	char path[sizeof("anon_inode:[fanotify]")];
+
+	if (getfdpath(tcp, fd, path, sizeof(path)) < 0)
+		return NOTIFY_NONE;
+	if (!strcmp(path, "anon_inode:inotify"))
+		return NOTIFY_INOTIFY;
+	if (!strcmp(path, "anon_inode:[fanotify]"))
+		return NOTIFY_FANOTIFY;
+	return NOTIFY_NONE;
+}
+
+/*
+ * Fetch up to NOTIFY_BUF_MAX bytes of the buffer with a single read,
+ * return the number of bytes fetched.
+ */
+static unsigned int
+fetch_notify_buf(struct tcb *const tcp, const kernel_ulong_t addr,
+		 const kernel_ulong_t len, char **const pbuf)
+{
+	struct umove_req req = {
+		.addr = addr,
+		.len = MIN(len, NOTIFY_BUF_MAX)
+	};
+
+	req.laddr = *pbuf = tcb_scratch_alloc(tcp, req.len);
+	umoven_batch(tcp, &req, 1);
+	return req.nread;
+}
+
+static void
+print_inotify_events(struct tcb *const tcp, const char *const buf,
+		     const unsigned int size, const bool truncated)
+{
+	unsigned int off, i;
+
+	tprints("[");
+	for (off = 0, i = 0; off + INOTIFY_EVENT_SIZE <= size; ++i) {
+		struct inotify_event_hdr ev;
+
+		if (i)
+			tprints(", ");
+		if (abbrev(tcp) && i >= tcb_max_strlen(tcp)) {
+			tprints("...]");
+			return;
+		}
+		memcpy(&ev, buf + off, sizeof(ev));
+		tprintf("{wd=%d, mask=", ev.wd);
+		printflags(inotify_flags, ev.mask, "IN_???");
+		tprintf(", cookie=%u, len=%u", ev.cookie, ev.len);
+		off += INOTIFY_EVENT_SIZE;
+		if (ev.len) {
+			tprints(", name=");
+			if (ev.len > size - off) {
+				tprints("???");
+				off = size;
+			} else {
+				print_quoted_cstring(buf + off, ev.len);
+				off += ev.len;
+			}
+		}
+		tprints("}");
+	}
+	if (off < size || truncated)
+		tprints(off || i ? ", ..." : "...");
+	tprints("]");
+}
+
+static void
+print_fanotify_events(struct tcb *const tcp, const char *const buf,
+		      const unsigned int size, const bool truncated)
+{
+	unsigned int off, i;
+
+	tprints("[");
+	for (off = 0, i = 0; off + FANOTIFY_METADATA_SIZE <= size; ++i) {
+		struct fanotify_event_hdr ev;
+
+		if (i)
+			tprints(", ");
+		if (abbrev(tcp) && i >= tcb_max_strlen(tcp)) {
+			tprints("...]");
+			return;
+		}
+		memcpy(&ev, buf + off, sizeof(ev));
+		tprintf("{event_len=%u, vers=%u, metadata_len=%u, mask=",
+			ev.event_len, ev.vers, ev.metadata_len);
+		printflags64(fan_event_flags, ev.mask, "FAN_???");
+		tprints(", fd=");
+		printfd(tcp, ev.fd);
+		tprintf(", pid=%d}", ev.pid);
+		if (ev.event_len < FANOTIFY_METADATA_SIZE) {
+			tprints_comment("event_len is too small");
+			off = size;
+			break;
+		}
+		off += ev.event_len;
+	}
+	if (off < size || truncated)
+		tprints(off || i ? ", ..." : "...");
+	tprints("]");
+}
+
+/*
+ * Print the buffer of LEN bytes read from FD at ADDR as notification
+ * events, return false if FD is not a notification descriptor.
+ */
+bool
+decode_notify_events(struct tcb *const tcp, const int fd,
+		     const kernel_ulong_t addr, const kernel_ulong_t len)
+{
+	const enum notify_kind kind = get_fd_notify_kind(tcp, fd);
+	char *buf;
+
+	if (kind == NOTIFY_NONE)
+		return false;
+
+	const unsigned int size = fetch_notify_buf(tcp, addr, len, &buf);
+
+	if (!size) {
+		printaddr(addr);
+		return true;
+	}
+
+	if (kind == NOTIFY_INOTIFY)
+		print_inotify_events(tcp, buf, size, size < len);
+	else
+		print_fanotify_events(tcp, buf, size, size < len);
+	return true;
+}
+
+struct notify_counts {
+	struct notify_counts *next;
+	int tgid;
+	int fd;
+	int wd;			/* -1 for fanotify */
+	uint64_t mask;
+	enum notify_kind kind;
+	uint64_t events;
+};
+
+static struct notify_counts **notify_hash;
+static unsigned int notify_hash_size;
+static unsigned int notify_hash_count;
+static uint64_t notify_reads, notify_bytes;
+
+static unsigned int
+hash_notify(const int tgid, const int fd, const int wd, const uint64_t mask)
+{
+	return (unsigned int) ((tgid * 31 + fd) * 31 + wd + mask * 17)
+	       * 2654435761U;
+}
+
+static void
+notify_hash_expand(void)
+{
+	struct notify_counts **const old_hash = notify_hash;
+	const unsigned int old_size = notify_hash_size;
+	unsigned int i;
+
+	notify_hash_size = old_size ? old_size * 2 : 64;
+	notify_hash = xcalloc(notify_hash_size, sizeof(notify_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct notify_counts *nc, *next;
+
+		for (nc = old_hash[i]; nc; nc = next) {
+			const unsigned int b =
+				hash_notify(nc->tgid, nc->fd, nc->wd, nc->mask)
+				& (notify_hash_size - 1);
+
+			next = nc->next;
+			nc->next = notify_hash[b];
+			notify_hash[b] = nc;
+		}
+	}
+
+	free(old_hash);
+}
+
+static void
+account_notify_event(const int tgid, const int fd, const int wd,
+		     const uint64_t mask, const enum notify_kind kind)
+{
+	struct notify_counts *nc;
+
+	if (notify_hash_size) {
+		for (nc = notify_hash[hash_notify(tgid, fd, wd, mask)
+				      & (notify_hash_size - 1)];
+		     nc; nc = nc->next) {
+			if (nc->tgid == tgid && nc->fd == fd &&
+			    nc->wd == wd && nc->mask == mask) {
+				nc->events++;
+				return;
+			}
+		}
+	}
+
+	if (notify_hash_count >= notify_hash_size)
+		notify_hash_expand();
+
+	const unsigned int b = hash_notify(tgid, fd, wd, mask)
+			       & (notify_hash_size - 1);
+
+	nc = xcalloc(1, sizeof(*nc));
+	nc->tgid = tgid;
+	nc->fd = fd;
+	nc->wd = wd;
+	nc->mask = mask;
+	nc->kind = kind;
+	nc->events = 1;
+	nc->next = notify_hash[b];
+	notify_hash[b] = nc;
+	++notify_hash_count;
+}
+
+/* Count the events returned by a read from a notification descriptor.  */
+void
+count_notify(struct tcb *const tcp)
+{
+	if (tcp->s_ent->sen != SEN_read || syserror(tcp) || !tcp->u_rval)
+		return;
+
+	const int fd = tcp->u_arg[0];
+	const enum notify_kind kind = get_fd_notify_kind(tcp, fd);
+
+	if (kind == NOTIFY_NONE)
+		return;
+
+	const int tgid = get_tcb_tgid(tcp);
+	char *buf;
+	const unsigned int size = fetch_notify_buf(tcp, tcp->u_arg[1],
+						   tcp->u_rval, &buf);
+	unsigned int off = 0;
+
+	notify_reads++;
+	notify_bytes += tcp->u_rval;
+
+	if (kind == NOTIFY_INOTIFY) {
+		struct inotify_event_hdr ev;
+
+		for (; off + INOTIFY_EVENT_SIZE <= size;
+		     off += INOTIFY_EVENT_SIZE + ev.len) {
+			memcpy(&ev, buf + off, sizeof(ev));
+			account_notify_event(tgid, fd, ev.wd, ev.mask, kind);
+		}
+	} else {
+		struct fanotify_event_hdr ev;
+
+		for (; off + FANOTIFY_METADATA_SIZE <= size;
+		     off += ev.event_len) {
+			memcpy(&ev, buf + off, sizeof(ev));
+			account_notify_event(tgid, fd, -1, ev.mask, kind);
+			if (ev.event_len < FANOTIFY_METADATA_SIZE)
+				break;
+		}
+	}
+}
+
+static int
+notify_counts_cmp(const void *a, const void *b)
+{
+	const struct notify_counts *const x = *(const struct notify_counts **) a;
+	const struct notify_counts *const y = *(const struct notify_counts **) b;
+
+	return (x->events < y->events) ? 1 : (x->events > y->events) ? -1
+	     : (x->tgid != y->tgid) ? x->tgid - y->tgid
+	     : (x->fd != y->fd) ? x->fd - y->fd
+	     : x->wd - y->wd;
+}
+
+/*
+ * Print the summary_notify watch descriptor and event mask pairs
+ * that have got the most events.
+ */
+void
+notify_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	struct notify_counts **sorted;
+	unsigned int i, n = 0;
+
+	if (!notify_hash_count)
+		return;
+
+	sorted = xcalloc(notify_hash_count, sizeof(sorted[0]));
+	for (i = 0; i < notify_hash_size; ++i) {
+		struct notify_counts *nc;
+
+		for (nc = notify_hash[i]; nc; nc = nc->next)
+			sorted[n++] = nc;
+	}
+	sort_top(sorted, n, sizeof(sorted[0]), summary_notify,
+		 notify_counts_cmp);
+	if (n > summary_notify)
+		n = summary_notify;
+
+	fprintf(outf, "\nNotification events in %" PRIu64 " reads of %" PRIu64
+		" bytes:\n", notify_reads, notify_bytes);
+	fprintf(outf, "%11.11s %-16.16s %6.6s %s\n",
+		"events", "pid:fd", "wd", "mask");
+	fprintf(outf, "%11.11s %-16.16s %6.6s %s\n",
+		dashes, dashes, dashes, dashes);
+	for (i = 0; i < n; ++i) {
+		const struct notify_counts *const nc = sorted[i];
+		char pidfd[sizeof("4294967295:4294967295")];
+		char wd[sizeof("-2147483648")] = "-";
+
+		snprintf(pidfd, sizeof(pidfd), "%d:%d", nc->tgid, nc->fd);
+		if (nc->kind == NOTIFY_INOTIFY)
+			snprintf(wd, sizeof(wd), "%d", nc->wd);
+		fprintf(outf, "%11" PRIu64 " %-16s %6s %s\n",
+			nc->events, pidfd, wd,
+			nc->kind == NOTIFY_INOTIFY
+			? sprintflags("", inotify_flags, nc->mask)
+			: sprintflags("", fan_event_flags, nc->mask));
+	}
+
+	free(sorted);
+}
@@ -38,9 +38,24 @@
 typedef unsigned int number_slot_t;
 #define BITS_PER_SLOT (sizeof(number_slot_t) * 8)
 
+/*
+ * Small numbers are kept in a bit vector, numbers that would make it
+ * too sparse are kept in a sorted array, so that e.g. -e read=100000
+ * does not allocate a bit for each number below.  The bit vector grows
+ * to cover the number being added only while it has at least
+ * one member per DENSE_BITS_PER_MEMBER bits, and then takes over
+ * the members of the array it covers.
+ */
+#define DENSE_MIN_BITS 4096
+#define DENSE_BITS_PER_MEMBER 64
+
 struct number_set {
 	number_slot_t *vec;
 	unsigned int nslots;
+	unsigned int nmembers;
+	unsigned int *sparse;	/* Sorted numbers beyond the bit vector */
+	unsigned int nsparse;
+	unsigned int sparse_size;
 	bool not;
 };
 
@@ -67,33 +82,118 @@ reallocate_number_set(struct number_set *const set, const unsigned int new_nslot
 	set->nslots = new_nslots;
 }
 
+/*
+ * Return the index of the first member of the sorted array
+ * that is not less than NUMBER.
+ */
+static unsigned int
+sparse_lower_bound(const struct number_set *const set,
+		   const unsigned int number)
+{
+	unsigned int lo = 0, hi = set->nsparse;
+
+	while (lo < hi) {
+		const unsigned int mid = lo + (hi - lo) / 2;
+
+		if (set->sparse[mid] < number)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static bool
+sparse_isset(const unsigned int number, const struct number_set *const set)
+{
+	const unsigned int i = sparse_lower_bound(set, number);
+
+	return i < set->nsparse && set->sparse[i] == number;
+}
+
+static bool
+number_isset_in(const unsigned int number, const struct number_set *const set)
+{
+	if (number / BITS_PER_SLOT < set->nslots)
+		return number_isset(number, set->vec);
+	return set->nsparse && sparse_isset(number, set);
+}
+
 bool
 number_set_array_is_empty(const struct number_set *const set,
 			  const unsigned int idx)
 {
-	return !(set && (set[idx].nslots || set[idx].not));
+	return !(set && (set[idx].nslots || set[idx].nsparse || set[idx].not));
 }
 
 bool
 is_number_in_set(const unsigned int number, const struct number_set *const set)
 {
-	return set && ((number / BITS_PER_SLOT < set->nslots)
-		&& number_isset(number, set->vec)) ^ set->not;
+	return set && number_isset_in(number, set) ^ set->not;
 }
 
 bool
 is_number_in_set_array(const unsigned int number, const struct number_set *const set,
 		       const unsigned int idx)
 {
-	return set && ((number / BITS_PER_SLOT < set[idx].nslots)
-		&& number_isset(number, set[idx].vec)) ^ set[idx].not;
+	return set && number_isset_in(number, &set[idx]) ^ set[idx].not;
+}
+
+static void
+add_number_to_sparse(const unsigned int number, struct number_set *const set)
+{
+	const unsigned int i = sparse_lower_bound(set, number);
+
+	if (i < set->nsparse && set->sparse[i] == number)
+		return;
+
+	if (set->nsparse == set->sparse_size) {
+		set->sparse_size = set->sparse_size ? set->sparse_size * 2 : 8;
+		set->sparse = xreallocarray(set->sparse, set->sparse_size,
+					    sizeof(*set->sparse));
+	}
+	memmove(set->sparse + i + 1, set->sparse + i,
+		sizeof(*set->sparse) * (set->nsparse - i));
+	set->sparse[i] = number;
+	++set->nsparse;
+	++set->nmembers;
+}
+
+/* Move the members of the sorted array covered by the bit vector to it. */
+static void
+move_sparse_to_vec(struct number_set *const set)
+{
+	const unsigned int limit = set->nslots * BITS_PER_SLOT;
+	unsigned int i;
+
+	for (i = 0; i < set->nsparse && set->sparse[i] < limit; ++i)
+		number_setbit(set->sparse[i], set->vec);
+	memmove(set->sparse, set->sparse + i,
+		sizeof(*set->sparse) * (set->nsparse - i));
+	set->nsparse -= i;
 }
 
 void
 add_number_to_set(const unsigned int number, struct number_set *const set)
 {
-	reallocate_number_set(set, number / BITS_PER_SLOT + 1);
-	number_setbit(number, set->vec);
+	if (number / BITS_PER_SLOT >= set->nslots) {
+		const unsigned int max_bits =
+			(set->nmembers + 1) * DENSE_BITS_PER_MEMBER;
+
+		if (number >= DENSE_MIN_BITS && number >= max_bits) {
+			add_number_to_sparse(number, set);
+			return;
+		}
+		reallocate_number_set(set, number / BITS_PER_SLOT + 1);
+		if (set->nsparse)
+			move_sparse_to_vec(set);
+	}
+
+	if (!number_isset(number, set->vec)) {
+		number_setbit(number, set->vec);
+		++set->nmembers;
+	}
 }
 
 void
@@ -112,6 +212,8 @@ clear_number_set_array(struct number_set *const set, const unsigned int nmemb)
 		if (set[i].nslots)
 			memset(set[i].vec, 0,
 			       sizeof(*set[i].vec) * set[i].nslots);
+		set[i].nmembers = 0;
+		set[i].nsparse = 0;
 		set[i].not = false;
 	}
 }
@@ -138,6 +240,8 @@ free_number_set_array(struct number_set *const set, unsigned int nmemb)
 		--nmemb;
 		free(set[nmemb].vec);
 		set[nmemb].vec = NULL;
+		free(set[nmemb].sparse);
+		set[nmemb].sparse = NULL;
 	}
 	free(set);
 }
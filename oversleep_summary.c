@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Oversleep per thread (--summary-oversleep option).
+ *
+ * The timeout requested by nanosleep, clock_nanosleep, poll, ppoll,
+ * select, pselect6, epoll_wait, and epoll_pwait is fetched on syscall
+ * entering; when the call returns because the timeout expired, the time
+ * it took beyond the timeout is accounted to the thread.  This is the
+ * delay added by timer slack and by the scheduler to the wakeups of the
+ * thread, plus the ptrace stops of the syscall itself.  With -k,
+ * the oversleep is also accounted to the call sites.
+ */
+
+#include "defs.h"
+#include "syscall.h"
+#include "latency_hist.h"
+#include <sys/param.h>
+
+#ifndef TIMER_ABSTIME
+# define TIMER_ABSTIME 1
+#endif
+
+struct oversleep_counts {
+	struct oversleep_counts *next;
+	int pid;
+	char comm[sizeof("1234567890123456")];
+	uint64_t sleeps;	/* Calls that returned on their timeout */
+	uint64_t early;		/* Calls that returned before it */
+	uint64_t requested_ns, over_ns, max_ns;
+	struct latency_hist hist;
+};
+
+unsigned int summary_oversleep;
+static struct oversleep_counts *oversleep_list;
+static unsigned int oversleep_count;
+
+#ifdef USE_LIBUNWIND
+/* Oversleep per -k stack, indexed by stack id.  */
+struct oversleep_site {
+	uint64_t over_ns, max_ns, sleeps;
+};
+static struct oversleep_site *sites;
+static unsigned int nsites;
+# define SUMMARY_OVERSLEEP_SITES 20
+#endif
+
+/*
+ * Fetch a struct timespec, or a struct timeval if usecs is set,
+ * of the tracee and return it in nanoseconds, -1 if there is none.
+ */
+static int64_t
+fetch_timeout(struct tcb *const tcp, const kernel_ulong_t addr,
+	      const bool usecs)
+{
+	int64_t sec, frac;
+
+	if (!addr)
+		return -1;
+	if (current_klongsize == sizeof(int32_t)) {
+		int32_t t[2];
+
+		if (umove(tcp, addr, &t))
+			return -1;
+		sec = t[0];
+		frac = t[1];
+	} else {
+		int64_t t[2];
+
+		if (umove(tcp, addr, &t))
+			return -1;
+		sec = t[0];
+		frac = t[1];
+	}
+
+	if (usecs)
+		frac *= 1000;
+	if (sec < 0 || frac < 0 || frac >= 1000000000
+	    || sec > INT64_MAX / 1000000000 - 1)
+		return -1;
+
+	return sec * 1000000000 + frac;
+}
+
+/* Return the timeout in milliseconds in nanoseconds, -1 if there is none. */
+static int64_t
+ms_timeout(const kernel_ulong_t arg)
+{
+	const int ms = arg;
+
+	return ms < 0 ? -1 : (int64_t) ms * 1000000;
+}
+
+/*
+ * An absolute clock_nanosleep deadline is turned into a timeout
+ * using the clock of the tracer, per-process clocks are not supported.
+ */
+static int64_t
+abs_timeout(struct tcb *const tcp, const clockid_t clk,
+	    const kernel_ulong_t addr)
+{
+	const int64_t deadline = fetch_timeout(tcp, addr, false);
+	struct timespec now;
+
+	if (deadline < 0)
+		return -1;
+	switch (clk) {
+	case CLOCK_REALTIME:
+	case CLOCK_MONOTONIC:
+#ifdef CLOCK_BOOTTIME
+	case CLOCK_BOOTTIME:
+#endif
+#ifdef CLOCK_TAI
+	case CLOCK_TAI:
+#endif
+		break;
+	default:
+		return -1;
+	}
+	if (clock_gettime(clk, &now))
+		return -1;
+
+	const int64_t now_ns = (int64_t) now.tv_sec * 1000000000
+			       + now.tv_nsec;
+
+	return deadline > now_ns ? deadline - now_ns : 0;
+}
+
+void
+count_oversleep_entry(struct tcb *const tcp)
+{
+	switch (tcp->s_ent->sen) {
+	case SEN_nanosleep:
+		tcp->sleep_ns = fetch_timeout(tcp, tcp->u_arg[0], false);
+		break;
+	case SEN_clock_nanosleep:
+		tcp->sleep_ns = (tcp->u_arg[1] & TIMER_ABSTIME)
+			? abs_timeout(tcp, tcp->u_arg[0], tcp->u_arg[2])
+			: fetch_timeout(tcp, tcp->u_arg[2], false);
+		break;
+	case SEN_poll:
+		tcp->sleep_ns = ms_timeout(tcp->u_arg[2]);
+		break;
+	case SEN_epoll_wait:
+	case SEN_epoll_pwait:
+		tcp->sleep_ns = ms_timeout(tcp->u_arg[3]);
+		break;
+	/* These update the timeout, it is fetched before the kernel does.  */
+	case SEN_ppoll:
+		tcp->sleep_ns = fetch_timeout(tcp, tcp->u_arg[2], false);
+		break;
+	case SEN_select:
+		tcp->sleep_ns = fetch_timeout(tcp, tcp->u_arg[4], true);
+		break;
+	case SEN_pselect6:
+		tcp->sleep_ns = fetch_timeout(tcp, tcp->u_arg[4], false);
+		break;
+	default:
+		tcp->sleep_ns = -1;
+		break;
+	}
+}
+
+static struct oversleep_counts *
+get_oversleep_counts(struct tcb *const tcp)
+{
+	if (tcp->oversleep_counts)
+		return tcp->oversleep_counts;
+
+	struct oversleep_counts *const oc = xcalloc(1, sizeof(*oc));
+
+	oc->pid = tcp->pid;
+	read_proc_comm(tcp->pid, oc->comm, sizeof(oc->comm));
+	oc->next = oversleep_list;
+	oversleep_list = oc;
+	++oversleep_count;
+
+	return tcp->oversleep_counts = oc;
+}
+
+#ifdef USE_LIBUNWIND
+static void
+count_oversleep_site(struct tcb *const tcp, const uint64_t ns)
+{
+	const unsigned int id = unwind_stack_id(tcp);
+
+	if (!id)
+		return;
+	if (id > nsites) {
+		const unsigned int n = MAX(id, nsites * 2);
+
+		sites = xreallocarray(sites, n, sizeof(sites[0]));
+		memset(&sites[nsites], 0, (n - nsites) * sizeof(sites[0]));
+		nsites = n;
+	}
+	sites[id - 1].over_ns += ns;
+	sites[id - 1].sleeps++;
+	if (ns > sites[id - 1].max_ns)
+		sites[id - 1].max_ns = ns;
+}
+#endif
+
+void
+count_oversleep(struct tcb *const tcp, const uint64_t ns)
+{
+	/* Zero timeouts do not sleep.  */
+	if (tcp->sleep_ns <= 0)
+		return;
+
+	const uint64_t timeout = tcp->sleep_ns;
+	struct oversleep_counts *const oc = get_oversleep_counts(tcp);
+
+	tcp->sleep_ns = -1;
+
+	/* All these calls return 0 when their timeout expires.  */
+	if (syserror(tcp) || tcp->u_rval) {
+		oc->early++;
+		return;
+	}
+
+	const uint64_t over = ns > timeout ? ns - timeout : 0;
+
+	oc->sleeps++;
+	oc->requested_ns += timeout;
+	oc->over_ns += over;
+	if (over > oc->max_ns)
+		oc->max_ns = over;
+
+	uint32_t *const b = &oc->hist.buckets[hist_bucket(over)];
+
+	if (*b < UINT32_MAX)
+		++*b;
+
+#ifdef USE_LIBUNWIND
+	if (stack_trace_enabled && stack_traced(tcp))
+		count_oversleep_site(tcp, over);
+#endif
+}
+
+static uint64_t
+oversleep_percentile(const struct oversleep_counts *const oc,
+		     const unsigned int permille)
+{
+	const uint64_t rank = (oc->sleeps * permille + 999) / 1000;
+	uint64_t seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; ++i) {
+		seen += oc->hist.buckets[i];
+		if (seen >= rank) {
+			const uint64_t v = hist_bucket_value(i);
+
+			return v > oc->max_ns ? oc->max_ns : v;
+		}
+	}
+
+	return oc->max_ns;
+}
+
+static int
+oversleep_counts_cmp(const void *a, const void *b)
+{
+	const struct oversleep_counts *const x =
+		*(const struct oversleep_counts **) a;
+	const struct oversleep_counts *const y =
+		*(const struct oversleep_counts **) b;
+
+	return (x->over_ns < y->over_ns) ? 1 : (x->over_ns > y->over_ns) ? -1
+	     : (x->pid > y->pid) - (x->pid < y->pid);
+}
+
+#ifdef USE_LIBUNWIND
+static void
+oversleep_site_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	unsigned int *sorted;
+	unsigned int i, n = 0;
+
+	for (i = 0; i < nsites; ++i) {
+		if (sites[i].sleeps)
+			++n;
+	}
+	if (!n)
+		return;
+
+	sorted = xcalloc(n, sizeof(sorted[0]));
+	for (i = 0, n = 0; i < nsites; ++i) {
+		if (sites[i].sleeps)
+			sorted[n++] = i;
+	}
+	for (i = 1; i < n; ++i) {
+		/* Insertion sort by oversleep, the number of sites is small. */
+		const unsigned int id = sorted[i];
+		unsigned int j;
+
+		for (j = i; j > 0 &&
+			    sites[sorted[j - 1]].over_ns < sites[id].over_ns;
+		     --j)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = id;
+	}
+
+	fprintf(outf, "\n%11.11s %9.9s %9.9s %s\n", "oversleep", "sleeps",
+		"max usecs", "sleep site");
+	fprintf(outf, "%11.11s %9.9s %9.9s %s\n",
+		dashes, dashes, dashes, dashes);
+	for (i = 0; i < n && i < SUMMARY_OVERSLEEP_SITES; ++i) {
+		fprintf(outf, "%11.6f %9" PRIu64 " %9" PRIu64 " ",
+			sites[sorted[i]].over_ns / 1e9, sites[sorted[i]].sleeps,
+			sites[sorted[i]].max_ns / 1000);
+		unwind_print_folded_stack(outf, sorted[i] + 1);
+		fputc('\n', outf);
+	}
+
+	free(sorted);
+}
+#endif
+
+/*
+ * Print the threads that overslept the most in total,
+ * at most summary_oversleep of them.
+ */
+void
+oversleep_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	struct oversleep_counts **sorted;
+	struct oversleep_counts *oc;
+	unsigned int i, n = 0;
+
+	if (!oversleep_count)
+		return;
+
+	sorted = xcalloc(oversleep_count, sizeof(sorted[0]));
+	for (oc = oversleep_list; oc; oc = oc->next)
+		sorted[n++] = oc;
+	sort_top(sorted, n, sizeof(sorted[0]), summary_oversleep,
+		 oversleep_counts_cmp);
+
+	fprintf(outf, "\n%9.9s %9.9s %11.11s %11.11s %9.9s %9.9s %9.9s"
+		" %7.7s %s\n",
+		"sleeps", "early", "requested", "oversleep", "p50 usecs",
+		"p99 usecs", "max usecs", "pid", "comm");
+	fprintf(outf, "%9.9s %9.9s %11.11s %11.11s %9.9s %9.9s %9.9s"
+		" %7.7s %s\n",
+		dashes, dashes, dashes, dashes, dashes, dashes, dashes,
+		dashes, dashes);
+	for (i = 0; i < n && i < summary_oversleep; ++i) {
+		oc = sorted[i];
+		fprintf(outf, "%9" PRIu64 " %9" PRIu64 " %11.6f %11.6f"
+			" %9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %7d %s\n",
+			oc->sleeps, oc->early, oc->requested_ns / 1e9,
+			oc->over_ns / 1e9,
+			oversleep_percentile(oc, 500) / 1000,
+			oversleep_percentile(oc, 990) / 1000,
+			oc->max_ns / 1000, oc->pid, oc->comm);
+	}
+
+	free(sorted);
+
+#ifdef USE_LIBUNWIND
+	if (stack_trace_enabled)
+		oversleep_site_summary(outf);
+#endif
+}
@@ -0,0 +1,433 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "defs.h"
+#include "path_glob.h"
+
+/*
+ * The patterns are stored in a trie of pattern items, so patterns sharing
+ * a prefix share its nodes.  The trie is an NFA where wildcard nodes loop
+ * on the characters they match; it is turned into a DFA lazily, one
+ * transition at a time, so the cost of matching a path does not depend
+ * on the number of patterns once the states it goes through are built.
+ */
+
+enum glob_item {
+	GLOB_CHAR,	/* A literal character */
+	GLOB_ANY,	/* ? */
+	GLOB_CLASS,	/* [...] */
+	GLOB_STAR,	/* * */
+	GLOB_GLOBSTAR,	/* ** */
+};
+
+struct glob_node {
+	enum glob_item item;
+	unsigned char c;
+	bool accept;
+	unsigned int first_child;	/* 0 if none */
+	unsigned int next_sibling;	/* 0 if none */
+	uint32_t class[256 / 32];
+};
+
+struct dfa_state {
+	unsigned int *nodes;	/* Sorted NFA nodes */
+	unsigned int nnodes;
+	unsigned int hash;
+	int hash_next;
+	bool accept;
+	int next[256];		/* -1 if not built yet */
+};
+
+#define DFA_HASH_SIZE 1024
+/* The DFA is rebuilt from scratch when it grows larger. */
+#define DFA_MAX_STATES 1024
+
+struct path_glob {
+	struct glob_node *nodes;	/* nodes[0] is the root */
+	unsigned int nnodes;
+	unsigned int nodes_allocated;
+
+	struct dfa_state *states;
+	unsigned int nstates;
+	unsigned int states_allocated;
+	int hash[DFA_HASH_SIZE];
+
+	/* Scratch space for computing a transition */
+	unsigned int *set;
+	unsigned int *mark;
+	unsigned int mark_gen;
+};
+
+bool
+path_is_pattern(const char *const str)
+{
+	const size_t len = strlen(str);
+
+	/* "/" itself is an exact path, not everything under the root. */
+	return (len > 1 && str[len - 1] == '/') || strpbrk(str, "*?[\\");
+}
+
+static bool
+glob_node_matches(const struct glob_node *const n, const unsigned char c)
+{
+	switch (n->item) {
+	case GLOB_CHAR:
+		return n->c == c;
+	case GLOB_CLASS:
+		return n->class[c / 32] & (1U << (c % 32));
+	case GLOB_ANY:
+	case GLOB_STAR:
+		return c != '/';
+	case GLOB_GLOBSTAR:
+		return true;
+	}
+
+	return false;
+}
+
+static bool
+glob_node_same(const struct glob_node *const a, const struct glob_node *b)
+{
+	return a->item == b->item && a->c == b->c &&
+	       !memcmp(a->class, b->class, sizeof(a->class));
+}
+
+/*
+ * Parse the character class at *p, the opening bracket included.
+ * Return false if it is not closed.
+ */
+static bool
+parse_class(const char **const p, struct glob_node *const n)
+{
+	const char *s = *p + 1;
+	bool negate = false;
+	bool first = true;
+	unsigned int i;
+
+	if (*s == '!' || *s == '^') {
+		negate = true;
+		++s;
+	}
+
+	for (; *s && (first || *s != ']'); first = false) {
+		unsigned char lo = *s++;
+		unsigned char hi = lo;
+
+		if (lo == '\\' && *s)
+			hi = lo = *s++;
+		if (s[0] == '-' && s[1] && s[1] != ']') {
+			hi = s[1];
+			s += 2;
+			if (hi == '\\' && *s)
+				hi = *s++;
+		}
+		for (i = lo; i <= hi; ++i)
+			n->class[i / 32] |= 1U << (i % 32);
+	}
+
+	if (*s != ']')
+		return false;
+
+	if (negate) {
+		for (i = 0; i < ARRAY_SIZE(n->class); ++i)
+			n->class[i] = ~n->class[i];
+	}
+	/* Like the other wildcards, a class never matches '/'. */
+	n->class['/' / 32] &= ~(1U << ('/' % 32));
+
+	*p = s + 1;
+	return true;
+}
+
+/* Parse the next item of the pattern at *p. */
+static void
+parse_item(const char **const p, struct glob_node *const n)
+{
+	memset(n, 0, sizeof(*n));
+
+	switch (**p) {
+	case '*':
+		n->item = GLOB_STAR;
+		while (*++*p == '*')
+			n->item = GLOB_GLOBSTAR;
+		return;
+	case '?':
+		n->item = GLOB_ANY;
+		++*p;
+		return;
+	case '[':
+		n->item = GLOB_CLASS;
+		if (parse_class(p, n))
+			return;
+		memset(n, 0, sizeof(*n));
+		break;
+	case '\\':
+		if ((*p)[1])
+			++*p;
+		break;
+	}
+
+	n->item = GLOB_CHAR;
+	n->c = **p;
+	++*p;
+}
+
+static unsigned int
+add_child(struct path_glob *const g, const unsigned int parent,
+	  const struct glob_node *const item)
+{
+	unsigned int i;
+
+	for (i = g->nodes[parent].first_child; i; i = g->nodes[i].next_sibling)
+		if (glob_node_same(&g->nodes[i], item))
+			return i;
+
+	if (g->nnodes >= g->nodes_allocated) {
+		g->nodes_allocated *= 2;
+		g->nodes = xreallocarray(g->nodes, g->nodes_allocated,
+					 sizeof(*g->nodes));
+	}
+
+	i = g->nnodes++;
+	g->nodes[i] = *item;
+	g->nodes[i].next_sibling = g->nodes[parent].first_child;
+	g->nodes[parent].first_child = i;
+
+	return i;
+}
+
+static void
+add_pattern(struct path_glob *const g, const char *p)
+{
+	unsigned int node = 0;
+	struct glob_node item;
+
+	while (*p) {
+		parse_item(&p, &item);
+		node = add_child(g, node, &item);
+	}
+
+	g->nodes[node].accept = true;
+}
+
+static void
+dfa_flush(struct path_glob *const g)
+{
+	unsigned int i;
+
+	for (i = 0; i < g->nstates; ++i)
+		free(g->states[i].nodes);
+	g->nstates = 0;
+	memset(g->hash, -1, sizeof(g->hash));
+}
+
+struct path_glob *
+path_glob_add(struct path_glob *g, const char *const pattern)
+{
+	if (!g) {
+		g = xcalloc(1, sizeof(*g));
+		g->nodes_allocated = 16;
+		g->nodes = xcalloc(g->nodes_allocated, sizeof(*g->nodes));
+		g->nnodes = 1;
+		memset(g->hash, -1, sizeof(g->hash));
+	}
+
+	const size_t len = strlen(pattern);
+
+	if (len && pattern[len - 1] == '/') {
+		/* "dir/" matches "dir" and everything under it. */
+		char *const buf = xmalloc(len + 3);
+
+		memcpy(buf, pattern, len - 1);
+		buf[len - 1] = '\0';
+		add_pattern(g, buf);
+		memcpy(buf + len - 1, "/**", 4);
+		add_pattern(g, buf);
+		free(buf);
+	} else {
+		add_pattern(g, pattern);
+	}
+
+	dfa_flush(g);
+	free(g->set);
+	free(g->mark);
+	g->set = xcalloc(g->nnodes, sizeof(*g->set));
+	g->mark = xcalloc(g->nnodes, sizeof(*g->mark));
+	g->mark_gen = 0;
+
+	return g;
+}
+
+/*
+ * Add the node to the scratch set along with the wildcard nodes that
+ * can match an empty string after it.
+ */
+static void
+set_add(struct path_glob *const g, unsigned int *const n,
+	const unsigned int node)
+{
+	unsigned int i;
+
+	if (g->mark[node] == g->mark_gen)
+		return;
+	g->mark[node] = g->mark_gen;
+	g->set[(*n)++] = node;
+
+	for (i = g->nodes[node].first_child; i; i = g->nodes[i].next_sibling)
+		if (g->nodes[i].item == GLOB_STAR ||
+		    g->nodes[i].item == GLOB_GLOBSTAR)
+			set_add(g, n, i);
+}
+
+static void
+set_begin(struct path_glob *const g)
+{
+	if (!++g->mark_gen) {
+		memset(g->mark, 0, g->nnodes * sizeof(*g->mark));
+		g->mark_gen = 1;
+	}
+}
+
+static int
+cmp_uint(const void *a, const void *b)
+{
+	const unsigned int x = *(const unsigned int *) a;
+	const unsigned int y = *(const unsigned int *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Return the DFA state of the scratch set, adding it if it is new. */
+static int
+dfa_state(struct path_glob *const g, const unsigned int n)
+{
+	unsigned int h = 2166136261U;
+	unsigned int i;
+	int s;
+
+	qsort(g->set, n, sizeof(*g->set), cmp_uint);
+	for (i = 0; i < n; ++i)
+		h = (h ^ g->set[i]) * 16777619U;
+
+	for (s = g->hash[h % DFA_HASH_SIZE]; s >= 0;
+	     s = g->states[s].hash_next) {
+		if (g->states[s].hash == h && g->states[s].nnodes == n &&
+		    !memcmp(g->states[s].nodes, g->set, n * sizeof(*g->set)))
+			return s;
+	}
+
+	if (g->nstates >= g->states_allocated) {
+		g->states_allocated = g->states_allocated
+				      ? g->states_allocated * 2 : 16;
+		g->states = xreallocarray(g->states, g->states_allocated,
+					  sizeof(*g->states));
+	}
+
+	struct dfa_state *const st = &g->states[g->nstates];
+
+	st->nodes = xreallocarray(NULL, n ? n : 1, sizeof(*st->nodes));
+	memcpy(st->nodes, g->set, n * sizeof(*g->set));
+	st->nnodes = n;
+	st->hash = h;
+	st->hash_next = g->hash[h % DFA_HASH_SIZE];
+	st->accept = false;
+	for (i = 0; i < n; ++i)
+		if (g->nodes[g->set[i]].accept)
+			st->accept = true;
+	memset(st->next, -1, sizeof(st->next));
+	g->hash[h % DFA_HASH_SIZE] = g->nstates;
+
+	return g->nstates++;
+}
+
+static int
+dfa_start(struct path_glob *const g)
+{
+	unsigned int n = 0;
+
+	set_begin(g);
+	set_add(g, &n, 0);
+
+	return dfa_state(g, n);
+}
+
+static int
+dfa_next(struct path_glob *const g, const int from, const unsigned char c)
+{
+	unsigned int n = 0;
+	unsigned int i, j;
+
+	set_begin(g);
+	for (i = 0; i < g->states[from].nnodes; ++i) {
+		const unsigned int node = g->states[from].nodes[i];
+
+		/* Wildcards that match strings loop on their characters. */
+		if ((g->nodes[node].item == GLOB_STAR ||
+		     g->nodes[node].item == GLOB_GLOBSTAR) &&
+		    glob_node_matches(&g->nodes[node], c))
+			set_add(g, &n, node);
+
+		for (j = g->nodes[node].first_child; j;
+		     j = g->nodes[j].next_sibling) {
+			if (g->nodes[j].item != GLOB_STAR &&
+			    g->nodes[j].item != GLOB_GLOBSTAR &&
+			    glob_node_matches(&g->nodes[j], c))
+				set_add(g, &n, j);
+		}
+	}
+
+	const int to = dfa_state(g, n);
+
+	/* g->states might have been reallocated. */
+	g->states[from].next[c] = to;
+	return to;
+}
+
+bool
+path_glob_match(struct path_glob *const g, const char *path)
+{
+	if (!g)
+		return false;
+
+	if (g->nstates > DFA_MAX_STATES)
+		dfa_flush(g);
+
+	/* The start state is always the first one. */
+	int s = g->nstates ? 0 : dfa_start(g);
+
+	for (; *path; ++path) {
+		const unsigned char c = *path;
+
+		if (!g->states[s].nnodes)
+			return false;
+
+		const int next = g->states[s].next[c];
+		s = next >= 0 ? next : dfa_next(g, s, c);
+	}
+
+	return g->states[s].accept;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef STRACE_PATH_GLOB_H
+#define STRACE_PATH_GLOB_H
+
+/*
+ * A set of path patterns compiled into a single matcher.
+ *
+ * In a pattern, "*" matches any string without '/', "**" matches any string,
+ * "?" matches any character but '/', "[...]" matches a character class
+ * like in a shell, and '\' quotes the next character.  A pattern that ends
+ * with '/' matches the directory and everything under it.
+ */
+struct path_glob;
+
+/* Return true if the string is a pattern rather than a plain path. */
+extern bool path_is_pattern(const char *);
+
+/*
+ * Add a pattern to the set, allocating the set if NULL is specified,
+ * return the set.
+ */
+extern struct path_glob *path_glob_add(struct path_glob *, const char *);
+
+/* Return true if the path matches any pattern of the set. */
+extern bool path_glob_match(struct path_glob *, const char *);
+
+#endif /* !STRACE_PATH_GLOB_H */
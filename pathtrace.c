@@ -28,39 +28,102 @@
  */
 
 #include "defs.h"
+#include <fcntl.h>
 #include <sys/param.h>
 #include <poll.h>
 
+#include "path_glob.h"
+#include "selfprof.h"
+#include "strintern.h"
 #include "syscall.h"
 
 struct path_set global_path_set;
 
+static unsigned int
+hash_path(const char *path)
+{
+	/* FNV-1a */
+	unsigned int h = 2166136261U;
+
+	for (; *path; ++path)
+		h = (h ^ (unsigned char) *path) * 16777619U;
+
+	return h;
+}
+
 /*
  * Return true if specified path matches one that we're tracing.
  */
 static bool
 pathmatch(const char *path, struct path_set *set)
 {
-	unsigned i;
+	unsigned int i;
+
+	if (path[0] == '/' && path_glob_match(set->glob, path))
+		return true;
+
+	if (!set->hash_size)
+		return false;
 
-	for (i = 0; i < set->num_selected; ++i) {
-		if (strcmp(path, set->paths_selected[i]) == 0)
+	for (i = hash_path(path) & (set->hash_size - 1); set->hash[i];
+	     i = (i + 1) & (set->hash_size - 1)) {
+		if (strcmp(path, set->hash[i]) == 0)
 			return true;
 	}
 	return false;
 }
 
+static void
+hash_add_path(const char *path, struct path_set *set)
+{
+	unsigned int i;
+
+	for (i = hash_path(path) & (set->hash_size - 1); set->hash[i];
+	     i = (i + 1) & (set->hash_size - 1))
+		;
+	set->hash[i] = path;
+}
+
+static bool get_cwd(struct tcb *, char *buf, unsigned int bufsize);
+
 /*
  * Return true if specified path (in user-space) matches.
+ * Patterns are matched against the path resolved relative to dirfd.
  */
 static bool
-upathmatch(struct tcb *const tcp, const kernel_ulong_t upath,
+upathmatch(struct tcb *const tcp, const int dirfd, const kernel_ulong_t upath,
 	   struct path_set *set)
 {
 	char path[PATH_MAX + 1];
 
-	return umovestr(tcp, upath, sizeof(path), path) > 0 &&
-		pathmatch(path, set);
+	if (umovestr(tcp, upath, sizeof(path), path) <= 0)
+		return false;
+	if (pathmatch(path, set))
+		return true;
+	if (!set->glob || path[0] == '/')
+		return false;
+
+	char buf[PATH_MAX * 2 + 2];
+	const char *rel = path;
+
+	while (rel[0] == '.' && rel[1] == '/')
+		rel += 2;
+	if (!strcmp(rel, "."))
+		++rel;
+
+	if (dirfd == AT_FDCWD ? !get_cwd(tcp, buf, PATH_MAX + 1)
+			      : getfdpath(tcp, dirfd, buf, PATH_MAX + 1) <= 0)
+		return false;
+
+	if (rel[0]) {
+		size_t n = strlen(buf);
+
+		if (buf[n - 1] != '/')
+			buf[n++] = '/';
+		strcpy(buf + n, rel);
+	}
+
+	return path_glob_match(set->glob, buf);
 }
 
 /*
@@ -82,16 +145,201 @@ fdmatch(struct tcb *tcp, int fd, struct path_set *set)
 static void
 storepath(const char *path, struct path_set *set)
 {
+	const bool pattern = path_is_pattern(path);
 	unsigned i;
 
-	if (pathmatch(path, set))
+	if (pattern) {
+		for (i = 0; i < set->num_selected; ++i)
+			if (!strcmp(path, set->paths_selected[i]))
+				return; /* already in table */
+	} else if (pathmatch(path, set)) {
 		return; /* already in table */
+	}
 
 	i = set->num_selected++;
 	set->paths_selected = xreallocarray(set->paths_selected,
 					    set->num_selected,
 					    sizeof(set->paths_selected[0]));
 	set->paths_selected[i] = path;
+
+	if (pattern) {
+		set->glob = path_glob_add(set->glob, path);
+		return;
+	}
+
+	/* Keep the hash table at most half full. */
+	if (set->num_selected * 2 > set->hash_size) {
+		free(set->hash);
+		set->hash_size = set->hash_size ? set->hash_size * 2 : 16;
+		set->hash = xcalloc(set->hash_size, sizeof(set->hash[0]));
+		for (i = 0; i < set->num_selected; ++i)
+			hash_add_path(set->paths_selected[i], set);
+	} else {
+		hash_add_path(path, set);
+	}
+}
+
+/*
+ * Cache of paths and socket protocols associated with file descriptors
+ * of each tracee.  An fd number gets a new generation whenever
+ * a descriptor with this number may have been closed or replaced
+ * by some tracee, the cached information of older generations is stale.
+ */
+#define FD_CACHE_SIZE 64
+#define FD_GENERATIONS 256
+
+struct fd_cache {
+	struct {
+		int fd;
+		unsigned int generation;
+		const char *path;	/* interned */
+		bool proto_known;
+		enum sock_proto proto;
+	} entries[FD_CACHE_SIZE];
+	const char *cwd;	/* interned */
+	unsigned int cwd_generation;
+};
+
+static unsigned int fd_generation[FD_GENERATIONS];
+/*
+ * Incremented whenever some tracee changes its working directory,
+ * threads may share it.
+ */
+static unsigned int cwd_generation = 1;
+
+static void
+fd_cache_invalidate_fd(const int fd)
+{
+	if (fd >= 0)
+		++fd_generation[fd % FD_GENERATIONS];
+}
+
+static void
+fd_cache_invalidate_all(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < FD_GENERATIONS; ++i)
+		++fd_generation[i];
+}
+
+/*
+ * Called on exiting of every syscall, including those that are filtered.
+ * Paths cached before the descriptor was closed are invalidated here,
+ * and so are paths cached in the middle of the syscall by other threads.
+ */
+void
+fd_cache_syscall_hook(const struct tcb *tcp)
+{
+	switch (tcp->s_ent->sen) {
+	case SEN_close:
+		fd_cache_invalidate_fd(tcp->u_arg[0]);
+		break;
+	case SEN_dup2:
+	case SEN_dup3:
+		fd_cache_invalidate_fd(tcp->u_arg[1]);
+		break;
+	case SEN_execve:
+	case SEN_execveat:
+	case SEN_execv:
+		/* Descriptors with FD_CLOEXEC flag are closed. */
+		fd_cache_invalidate_all();
+		break;
+	case SEN_chdir:
+	case SEN_chroot:
+	case SEN_fchdir:
+		++cwd_generation;
+		break;
+	}
+}
+
+void
+fd_cache_free(struct tcb *tcp)
+{
+	unsigned int i;
+
+	if (!tcp->fd_cache)
+		return;
+
+	for (i = 0; i < FD_CACHE_SIZE; ++i) {
+		if (tcp->fd_cache->entries[i].path)
+			selfprof_cache_add(SELFPROF_CACHE_FD_PATHS, -1, 0);
+		str_intern_release(tcp->fd_cache->entries[i].path);
+	}
+	str_intern_release(tcp->fd_cache->cwd);
+	selfprof_cache_add(SELFPROF_CACHE_FD_PATHS, 0,
+			   -(long) sizeof(*tcp->fd_cache));
+	free(tcp->fd_cache);
+	tcp->fd_cache = NULL;
+}
+
+static bool
+fd_cache_valid(const struct tcb *tcp, const int fd)
+{
+	if (!tcp->fd_cache)
+		return false;
+
+	const unsigned int i = fd % FD_CACHE_SIZE;
+	return tcp->fd_cache->entries[i].path &&
+	       tcp->fd_cache->entries[i].fd == fd &&
+	       tcp->fd_cache->entries[i].generation
+	       == fd_generation[fd % FD_GENERATIONS];
+}
+
+static void
+fd_cache_alloc(struct tcb *tcp)
+{
+	if (!tcp->fd_cache) {
+		tcp->fd_cache = xcalloc(1, sizeof(*tcp->fd_cache));
+		selfprof_cache_add(SELFPROF_CACHE_FD_PATHS, 0,
+				   sizeof(*tcp->fd_cache));
+	}
+}
+
+static void
+fd_cache_store(struct tcb *tcp, const int fd, const char *path)
+{
+	fd_cache_alloc(tcp);
+
+	const unsigned int i = fd % FD_CACHE_SIZE;
+	const char *const interned = str_intern(path);
+	if (!tcp->fd_cache->entries[i].path)
+		selfprof_cache_add(SELFPROF_CACHE_FD_PATHS, 1, 0);
+	str_intern_release(tcp->fd_cache->entries[i].path);
+	tcp->fd_cache->entries[i].fd = fd;
+	tcp->fd_cache->entries[i].generation = fd_generation[fd % FD_GENERATIONS];
+	tcp->fd_cache->entries[i].path = interned;
+	tcp->fd_cache->entries[i].proto_known = false;
+}
+
+/*
+ * Return true and store the socket protocol of fd in *proto
+ * if it is cached.
+ */
+bool
+fd_cache_get_proto(const struct tcb *tcp, const int fd,
+		   enum sock_proto *const proto)
+{
+	if (fd < 0 || !fd_cache_valid(tcp, fd) ||
+	    !tcp->fd_cache->entries[fd % FD_CACHE_SIZE].proto_known)
+		return false;
+
+	*proto = tcp->fd_cache->entries[fd % FD_CACHE_SIZE].proto;
+	return true;
+}
+
+/*
+ * Remember the socket protocol of fd.  It is cached along with the path,
+ * so nothing is stored unless the path of fd is already cached.
+ */
+void
+fd_cache_set_proto(struct tcb *tcp, const int fd, const enum sock_proto proto)
+{
+	if (fd < 0 || !fd_cache_valid(tcp, fd))
+		return;
+
+	tcp->fd_cache->entries[fd % FD_CACHE_SIZE].proto = proto;
+	tcp->fd_cache->entries[fd % FD_CACHE_SIZE].proto_known = true;
 }
 
 /*
@@ -106,17 +354,102 @@ getfdpath(struct tcb *tcp, int fd, char *buf, unsigned bufsize)
 	if (fd < 0)
 		return -1;
 
+	if (fd_cache_valid(tcp, fd)) {
+		const char *cached = tcp->fd_cache->entries[fd % FD_CACHE_SIZE].path;
+
+		n = strlen(cached);
+		if (n > bufsize - 1)
+			n = bufsize - 1;
+		memcpy(buf, cached, n);
+		buf[n] = '\0';
+		return n;
+	}
+
 	sprintf(linkpath, "/proc/%u/fd/%u", tcp->pid, fd);
 	n = readlink(linkpath, buf, bufsize - 1);
 	/*
 	 * NB: if buf is too small, readlink doesn't fail,
 	 * it returns truncated result (IOW: n == bufsize - 1).
 	 */
-	if (n >= 0)
+	if (n >= 0) {
 		buf[n] = '\0';
+		fd_cache_store(tcp, fd, buf);
+	}
 	return n;
 }
 
+/*
+ * Get the working directory of the tracee, it is cached along with
+ * the paths of its descriptors.
+ */
+static bool
+get_cwd(struct tcb *tcp, char *buf, unsigned int bufsize)
+{
+	fd_cache_alloc(tcp);
+
+	if (!tcp->fd_cache->cwd ||
+	    tcp->fd_cache->cwd_generation != cwd_generation) {
+		char linkpath[sizeof("/proc/%u/cwd") + sizeof(int) * 3];
+		ssize_t n;
+
+		sprintf(linkpath, "/proc/%u/cwd", tcp->pid);
+		n = readlink(linkpath, buf, bufsize - 1);
+		if (n <= 0)
+			return false;
+		buf[n] = '\0';
+
+		str_intern_release(tcp->fd_cache->cwd);
+		tcp->fd_cache->cwd = str_intern(buf);
+		tcp->fd_cache->cwd_generation = cwd_generation;
+		return true;
+	}
+
+	const size_t n = strlen(tcp->fd_cache->cwd);
+
+	if (n >= bufsize)
+		return false;
+	memcpy(buf, tcp->fd_cache->cwd, n + 1);
+	return true;
+}
+
+/*
+ * Add the canonicalized version of the directory prefix pattern,
+ * other patterns are matched as specified.
+ */
+static void
+select_prefix_realpath(const char *pattern, struct path_set *set)
+{
+	const size_t len = strlen(pattern);
+	char *const dir = xstrndup(pattern, len - 1);
+	char *rpath;
+
+	if (len < 2 || path_is_pattern(dir)) {
+		free(dir);
+		return;
+	}
+
+	rpath = realpath(dir, NULL);
+	free(dir);
+	if (!rpath)
+		return;
+
+	const size_t rlen = strlen(rpath);
+	char *const rpattern = xmalloc(rlen + 2);
+
+	memcpy(rpattern, rpath, rlen);
+	strcpy(rpattern + rlen, rpath[rlen - 1] == '/' ? "" : "/");
+	free(rpath);
+
+	/* if realpath and specified path are same, we're done */
+	if (strcmp(pattern, rpattern) == 0) {
+		free(rpattern);
+		return;
+	}
+
+	error_msg("Requested path '%s' resolved into '%s'", pattern, rpattern);
+	storepath(rpattern, set);
+}
+
 /*
  * Add a path to the set we're tracing.  Also add the canonicalized
  * version of the path.  Specifying NULL will delete all paths.
@@ -128,6 +461,12 @@ pathtrace_select_set(const char *path, struct path_set *set)
 
 	storepath(path, set);
 
+	if (path_is_pattern(path)) {
+		if (path[strlen(path) - 1] == '/')
+			select_prefix_realpath(path, set);
+		return;
+	}
+
 	rpath = realpath(path, NULL);
 
 	if (rpath == NULL)
@@ -191,19 +530,19 @@ pathtrace_match_set(struct tcb *tcp, struct path_set *set)
 	case SEN_utimensat:
 		/* fd, path */
 		return fdmatch(tcp, tcp->u_arg[0], set) ||
-			upathmatch(tcp, tcp->u_arg[1], set);
+			upathmatch(tcp, tcp->u_arg[0], tcp->u_arg[1], set);
 
 	case SEN_link:
 	case SEN_mount:
 	case SEN_pivotroot:
 		/* path, path */
-		return upathmatch(tcp, tcp->u_arg[0], set) ||
-			upathmatch(tcp, tcp->u_arg[1], set);
+		return upathmatch(tcp, AT_FDCWD, tcp->u_arg[0], set) ||
+			upathmatch(tcp, AT_FDCWD, tcp->u_arg[1], set);
 
 	case SEN_quotactl:
 	case SEN_symlink:
 		/* x, path */
-		return upathmatch(tcp, tcp->u_arg[1], set);
+		return upathmatch(tcp, AT_FDCWD, tcp->u_arg[1], set);
 
 	case SEN_linkat:
 	case SEN_renameat2:
@@ -211,8 +550,8 @@ pathtrace_match_set(struct tcb *tcp, struct path_set *set)
 		/* fd, path, fd, path */
 		return fdmatch(tcp, tcp->u_arg[0], set) ||
 			fdmatch(tcp, tcp->u_arg[2], set) ||
-			upathmatch(tcp, tcp->u_arg[1], set) ||
-			upathmatch(tcp, tcp->u_arg[3], set);
+			upathmatch(tcp, tcp->u_arg[0], tcp->u_arg[1], set) ||
+			upathmatch(tcp, tcp->u_arg[2], tcp->u_arg[3], set);
 
 	case SEN_old_mmap:
 #if defined(S390)
@@ -228,7 +567,7 @@ pathtrace_match_set(struct tcb *tcp, struct path_set *set)
 	case SEN_symlinkat:
 		/* x, fd, path */
 		return fdmatch(tcp, tcp->u_arg[1], set) ||
-			upathmatch(tcp, tcp->u_arg[2], set);
+			upathmatch(tcp, tcp->u_arg[1], tcp->u_arg[2], set);
 
 	case SEN_copy_file_range:
 	case SEN_splice:
@@ -247,7 +586,8 @@ pathtrace_match_set(struct tcb *tcp, struct path_set *set)
 		unsigned long long mask = 0;
 		int argn = getllval(tcp, &mask, 2);
 		return fdmatch(tcp, tcp->u_arg[argn], set) ||
-			upathmatch(tcp, tcp->u_arg[argn + 1], set);
+			upathmatch(tcp, tcp->u_arg[argn],
+				   tcp->u_arg[argn + 1], set);
 	}
 	case SEN_oldselect:
 	case SEN_pselect6:
@@ -372,7 +712,7 @@ pathtrace_match_set(struct tcb *tcp, struct path_set *set)
 	 */
 
 	if (s->sys_flags & TRACE_FILE)
-		return upathmatch(tcp, tcp->u_arg[0], set);
+		return upathmatch(tcp, AT_FDCWD, tcp->u_arg[0], set);
 
 	if (s->sys_flags & (TRACE_DESC | TRACE_NETWORK))
 		return fdmatch(tcp, tcp->u_arg[0], set);
@@ -0,0 +1,613 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Counting backend of -c that reads the raw_syscalls tracepoints
+ * through perf_event_open (--count-backend=perf option).
+ *
+ * The tracee is never stopped: the kernel records sys_enter and sys_exit
+ * events of the tracee, and of its descendants with -f, into a ring buffer
+ * per CPU, and the tracer pairs them by thread id to account the calls,
+ * errors and durations with count_syscall_raw.
+ */
+
+#include "defs.h"
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+
+# include <fcntl.h>
+# include <poll.h>
+# include <sys/param.h>
+# include <sys/ioctl.h>
+# include <sys/mman.h>
+# include <sys/wait.h>
+# include <linux/perf_event.h>
+# include "number_set.h"
+# include "perf_count.h"
+# include "scno.h"
+
+# ifndef PERF_FLAG_FD_CLOEXEC
+#  define PERF_FLAG_FD_CLOEXEC (1UL << 3)
+# endif
+
+/* Data pages of the ring buffer of each CPU, a power of two.  */
+# define RING_PAGES 64
+
+struct cpu_ring {
+	int enter_fd, exit_fd;
+	struct perf_event_mmap_page *meta;
+	const char *data;
+	bool hup;
+};
+
+/* A sys_enter or sys_exit record.  */
+struct raw_event {
+	uint64_t time;
+	int64_t scno, ret;
+	int tid;
+	bool exiting;
+};
+
+/*
+ * The half of the current syscall of a thread that has been seen
+ * so far.  Records of different CPUs are not ordered, so the exit of
+ * a syscall may be read before its entry if the thread has migrated.
+ */
+struct thread_state {
+	struct thread_state *next;
+	int tid;
+	bool entered, exited;
+	int64_t scno, ret;
+	uint64_t time;
+};
+
+static struct raw_syscalls_tp sys_enter_tp, sys_exit_tp;
+static struct cpu_ring *rings;
+static unsigned int nrings;
+static size_t ring_data_size;
+static struct raw_event *events;
+static size_t nevents, events_size;
+static char *record_buf;
+static uint64_t lost_events;
+static int perf_child;
+static bool perf_child_exited;
+static int perf_child_status;
+
+static struct thread_state **thread_hash;
+static unsigned int thread_hash_size;
+static unsigned int thread_hash_count;
+
+static const char *const tracefs_dirs[] = {
+	"/sys/kernel/tracing",
+	"/sys/kernel/debug/tracing"
+};
+
+/*
+ * Find the location of the named field in the format description
+ * of a tracepoint, lines of which look like
+ *	field:long id;	offset:8;	size:8;	signed:1;
+ */
+static bool
+parse_tp_field(FILE *fp, const char *const name, struct tp_field *const f)
+{
+	const size_t name_len = strlen(name);
+	char line[256];
+
+	rewind(fp);
+	while (fgets(line, sizeof(line), fp)) {
+		const char *const decl = strstr(line, "field:");
+		const char *const end = decl ? strchr(decl, ';') : NULL;
+		const char *const offset = end ? strstr(end, "offset:") : NULL;
+		const char *const size = end ? strstr(end, "size:") : NULL;
+
+		if (!offset || !size || end - decl < (ptrdiff_t) name_len + 1 ||
+		    memcmp(end - name_len, name, name_len) ||
+		    (end[-name_len - 1] != ' ' && end[-name_len - 1] != '\t'))
+			continue;
+
+		if (sscanf(offset, "offset:%u", &f->offset) != 1 ||
+		    sscanf(size, "size:%u", &f->size) != 1 ||
+		    (f->size != 4 && f->size != 8))
+			return false;
+		return true;
+	}
+
+	return false;
+}
+
+static bool
+read_tracepoint(const char *const dir, const char *const name,
+		struct raw_syscalls_tp *const tp, const bool exiting)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+	bool ok;
+
+	snprintf(path, sizeof(path), "%s/events/raw_syscalls/%s/id", dir, name);
+	fp = fopen(path, "r");
+	if (!fp)
+		return false;
+	ok = fscanf(fp, "%" SCNu64, &tp->id) == 1;
+	fclose(fp);
+	if (!ok)
+		return false;
+
+	snprintf(path, sizeof(path), "%s/events/raw_syscalls/%s/format",
+		 dir, name);
+	fp = fopen(path, "r");
+	if (!fp)
+		return false;
+	ok = parse_tp_field(fp, "id", &tp->scno) &&
+	     (!exiting || parse_tp_field(fp, "ret", &tp->ret));
+	fclose(fp);
+
+	return ok;
+}
+
+void
+read_raw_syscalls_tracepoints(struct raw_syscalls_tp *const enter_tp,
+			      struct raw_syscalls_tp *const exit_tp)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(tracefs_dirs); ++i) {
+		if (read_tracepoint(tracefs_dirs[i], "sys_enter",
+				    enter_tp, false) &&
+		    read_tracepoint(tracefs_dirs[i], "sys_exit",
+				    exit_tp, true))
+			return;
+	}
+
+	error_msg_and_die("Cannot read raw_syscalls tracepoints from %s"
+			  " or %s", tracefs_dirs[0], tracefs_dirs[1]);
+}
+
+static int
+open_tracepoint(const struct raw_syscalls_tp *const tp, const int pid,
+		const int cpu)
+{
+	struct perf_event_attr attr = {
+		.type = PERF_TYPE_TRACEPOINT,
+		.size = sizeof(attr),
+		.config = tp->id,
+		.sample_period = 1,
+		.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME
+			       | PERF_SAMPLE_RAW,
+		.disabled = 1,
+		.enable_on_exec = 1,
+		.inherit = followfork != 0,
+		.watermark = 1,
+		.wakeup_watermark = ring_data_size / 4,
+	};
+
+	return syscall(__NR_perf_event_open, &attr, pid, cpu, -1,
+		       PERF_FLAG_FD_CLOEXEC);
+}
+
+/*
+ * Open the events of both tracepoints on every CPU, the events of
+ * sys_exit are redirected to the ring buffer of sys_enter of the same CPU.
+ */
+static void
+open_rings(const int pid)
+{
+	const long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	const size_t page_size = get_pagesize();
+	long cpu;
+
+	ring_data_size = RING_PAGES * page_size;
+	rings = xcalloc(ncpus > 0 ? ncpus : 1, sizeof(rings[0]));
+
+	for (cpu = 0; cpu < ncpus; ++cpu) {
+		struct cpu_ring *const r = &rings[nrings];
+
+		r->enter_fd = open_tracepoint(&sys_enter_tp, pid, cpu);
+		if (r->enter_fd < 0) {
+			/* Offline CPUs cannot be traced.  */
+			if (errno == ENODEV)
+				continue;
+			perror_msg_and_die("perf_event_open: raw_syscalls:"
+					   "sys_enter on cpu %ld", cpu);
+		}
+		r->exit_fd = open_tracepoint(&sys_exit_tp, pid, cpu);
+		if (r->exit_fd < 0)
+			perror_msg_and_die("perf_event_open: raw_syscalls:"
+					   "sys_exit on cpu %ld", cpu);
+
+		void *const p = mmap(NULL, page_size + ring_data_size,
+				     PROT_READ | PROT_WRITE, MAP_SHARED,
+				     r->enter_fd, 0);
+		if (p == MAP_FAILED)
+			perror_msg_and_die("mmap: perf ring buffer");
+		r->meta = p;
+		r->data = (const char *) p + page_size;
+
+		if (ioctl(r->exit_fd, PERF_EVENT_IOC_SET_OUTPUT, r->enter_fd))
+			perror_msg_and_die("ioctl: PERF_EVENT_IOC_SET_OUTPUT");
+		++nrings;
+	}
+
+	if (!nrings)
+		error_msg_and_die("No CPUs to trace");
+}
+
+/*
+ * Start the command stopped before exec, open the events for it,
+ * and let it exec: the events are enabled by the exec.
+ */
+int
+perf_count_startup(char **argv)
+{
+	int fds[2];
+	char c;
+
+	read_raw_syscalls_tracepoints(&sys_enter_tp, &sys_exit_tp);
+
+	if (pipe(fds))
+		perror_msg_and_die("pipe");
+
+	perf_child = fork();
+	if (perf_child < 0)
+		perror_msg_and_die("fork");
+
+	if (perf_child == 0) {
+		ssize_t rc;
+
+		close(fds[1]);
+		/*
+		 * Wait until the events are open, do not run the command
+		 * untraced if the parent has failed to open them.
+		 */
+		while ((rc = read(fds[0], &c, 1)) < 0 && errno == EINTR)
+			;
+		if (rc != 1)
+			_exit(1);
+		close(fds[0]);
+		execvp(argv[0], argv);
+		perror_msg_and_die("exec");
+	}
+
+	close(fds[0]);
+	open_rings(perf_child);
+	c = 0;
+	if (write(fds[1], &c, 1) != 1)
+		perror_msg_and_die("write");
+	close(fds[1]);
+
+	return perf_child;
+}
+
+static void
+copy_from_ring(const struct cpu_ring *const r, const uint64_t pos,
+	       void *const buf, const size_t len)
+{
+	const size_t off = pos & (ring_data_size - 1);
+	const size_t first = MIN(len, ring_data_size - off);
+
+	memcpy(buf, r->data + off, first);
+	memcpy((char *) buf + first, r->data, len - first);
+}
+
+static int64_t
+get_tp_field(const char *const raw, const uint32_t raw_size,
+	     const struct tp_field *const f)
+{
+	if (f->offset + f->size > raw_size)
+		return -1;
+
+	if (f->size == 4) {
+		int32_t v;
+
+		memcpy(&v, raw + f->offset, sizeof(v));
+		return v;
+	} else {
+		int64_t v;
+
+		memcpy(&v, raw + f->offset, sizeof(v));
+		return v;
+	}
+}
+
+/*
+ * Parse a PERF_RECORD_SAMPLE record, laid out as
+ * { header, pid, tid, time, raw size, raw data } by the sample_type.
+ */
+static void
+add_sample(const char *const rec, const size_t rec_size)
+{
+	struct {
+		struct perf_event_header header;
+		uint32_t pid, tid;
+		uint64_t time;
+		uint32_t raw_size;
+	} s;
+	uint16_t type;
+
+	/* The raw data follows raw_size without padding.  */
+	const size_t raw_offset = offsetof(typeof(s), raw_size)
+				  + sizeof(s.raw_size);
+
+	if (rec_size < raw_offset)
+		return;
+	memcpy(&s, rec, raw_offset);
+
+	const char *const raw = rec + raw_offset;
+
+	if (s.raw_size < sizeof(type) || raw_offset + s.raw_size > rec_size)
+		return;
+	memcpy(&type, raw, sizeof(type));
+
+	const struct raw_syscalls_tp *const tp =
+		type == sys_exit_tp.id ? &sys_exit_tp :
+		type == sys_enter_tp.id ? &sys_enter_tp : NULL;
+	if (!tp)
+		return;
+
+	if (nevents == events_size) {
+		events_size = events_size ? events_size * 2 : 1024;
+		events = xreallocarray(events, events_size, sizeof(events[0]));
+	}
+
+	struct raw_event *const e = &events[nevents++];
+
+	e->time = s.time;
+	e->tid = s.tid;
+	e->exiting = tp == &sys_exit_tp;
+	e->scno = get_tp_field(raw, s.raw_size, &tp->scno);
+	e->ret = e->exiting ? get_tp_field(raw, s.raw_size, &tp->ret) : 0;
+}
+
+static void
+read_ring(struct cpu_ring *const r)
+{
+	const uint64_t head = r->meta->data_head;
+	uint64_t tail = r->meta->data_tail;
+
+	/* Read the data only after data_head.  */
+	__sync_synchronize();
+
+	while (tail < head) {
+		struct perf_event_header header;
+
+		copy_from_ring(r, tail, &header, sizeof(header));
+		if (header.size < sizeof(header))
+			break;
+
+		if (header.type == PERF_RECORD_SAMPLE) {
+			if (!record_buf)
+				record_buf = xmalloc(0x10000);
+			copy_from_ring(r, tail, record_buf, header.size);
+			add_sample(record_buf, header.size);
+		} else if (header.type == PERF_RECORD_LOST) {
+			struct {
+				struct perf_event_header header;
+				uint64_t id, lost;
+			} lost;
+
+			copy_from_ring(r, tail, &lost, sizeof(lost));
+			lost_events += lost.lost;
+		}
+		tail += header.size;
+	}
+
+	/* Release the space only after the data has been read.  */
+	__sync_synchronize();
+	r->meta->data_tail = tail;
+}
+
+static void
+thread_hash_expand(void)
+{
+	struct thread_state **const old_hash = thread_hash;
+	const unsigned int old_size = thread_hash_size;
+	unsigned int i;
+
+	thread_hash_size = old_size ? old_size * 2 : 64;
+	thread_hash = xcalloc(thread_hash_size, sizeof(thread_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct thread_state *ts, *next;
+
+		for (ts = old_hash[i]; ts; ts = next) {
+			const unsigned int b =
+				(unsigned int) ts->tid & (thread_hash_size - 1);
+
+			next = ts->next;
+			ts->next = thread_hash[b];
+			thread_hash[b] = ts;
+		}
+	}
+
+	free(old_hash);
+}
+
+static struct thread_state *
+get_thread_state(const int tid)
+{
+	struct thread_state *ts;
+
+	if (thread_hash_size) {
+		for (ts = thread_hash[(unsigned int) tid
+				      & (thread_hash_size - 1)];
+		     ts; ts = ts->next) {
+			if (ts->tid == tid)
+				return ts;
+		}
+	}
+
+	if (thread_hash_count >= thread_hash_size)
+		thread_hash_expand();
+
+	const unsigned int b = (unsigned int) tid & (thread_hash_size - 1);
+
+	ts = xcalloc(1, sizeof(*ts));
+	ts->tid = tid;
+	ts->next = thread_hash[b];
+	thread_hash[b] = ts;
+	++thread_hash_count;
+
+	return ts;
+}
+
+static void
+account_raw_call(const int64_t scno, const int64_t ret, const uint64_t ns)
+{
+	if (scno < 0 || !is_number_in_set_array(scno, trace_set, 0))
+		return;
+
+	count_syscall_raw(scno, ret < 0 && ret >= -4095, ns);
+}
+
+static void
+process_event(const struct raw_event *const e)
+{
+	struct thread_state *const ts = get_thread_state(e->tid);
+
+	if (e->exiting) {
+		if (ts->entered && ts->scno == e->scno && ts->time <= e->time)
+			account_raw_call(e->scno, e->ret, e->time - ts->time);
+		else {
+			ts->exited = true;
+			ts->scno = e->scno;
+			ts->ret = e->ret;
+			ts->time = e->time;
+		}
+		ts->entered = false;
+	} else {
+		if (ts->exited && ts->scno == e->scno && ts->time >= e->time) {
+			account_raw_call(e->scno, ts->ret, ts->time - e->time);
+			ts->exited = false;
+			return;
+		}
+		ts->exited = false;
+		ts->entered = true;
+		ts->scno = e->scno;
+		ts->time = e->time;
+	}
+}
+
+static int
+raw_event_cmp(const void *a, const void *b)
+{
+	const struct raw_event *const x = a;
+	const struct raw_event *const y = b;
+
+	return (x->time > y->time) - (x->time < y->time);
+}
+
+/* Read all rings and account the syscalls recorded there so far.  */
+static void
+read_rings(void)
+{
+	unsigned int i;
+	size_t j;
+
+	for (i = 0; i < nrings; ++i)
+		read_ring(&rings[i]);
+
+	qsort(events, nevents, sizeof(events[0]), raw_event_cmp);
+	for (j = 0; j < nevents; ++j)
+		process_event(&events[j]);
+	nevents = 0;
+}
+
+/*
+ * Wait for new records with signals in SIGMASK unblocked and account them.
+ * Returns false when the traced processes are gone: the events report
+ * POLLHUP once the task and all the tasks that inherited them have exited.
+ * As a fallback for kernels that do not report it, tracing also ends
+ * when the command has been reaped and nothing has been recorded for
+ * a second.
+ */
+bool
+perf_count_poll(const sigset_t *const sigmask)
+{
+	struct pollfd *const fds = xcalloc(nrings, sizeof(*fds));
+	const struct timespec timeout = { .tv_sec = 1 };
+	unsigned int i, nhup = 0;
+	int rc;
+
+	for (i = 0; i < nrings; ++i) {
+		fds[i].fd = rings[i].enter_fd;
+		fds[i].events = POLLIN;
+	}
+
+	rc = ppoll(fds, nrings, &timeout, sigmask);
+	if (rc < 0 && errno != EINTR)
+		perror_msg_and_die("ppoll");
+
+	for (i = 0; i < nrings; ++i) {
+		if (rc > 0 && (fds[i].revents & POLLHUP))
+			rings[i].hup = true;
+		nhup += rings[i].hup;
+	}
+	free(fds);
+
+	read_rings();
+
+	if (!perf_child_exited &&
+	    waitpid(perf_child, &perf_child_status, WNOHANG) == perf_child)
+		perf_child_exited = true;
+
+	return nhup < nrings && !(perf_child_exited && rc == 0);
+}
+
+/*
+ * Account what is left in the rings, kill the command with SIG if it is
+ * still running and SIG is not 0, and return its wait status.
+ */
+int
+perf_count_finish(const int sig)
+{
+	unsigned int i;
+
+	read_rings();
+
+	if (sig && !perf_child_exited)
+		kill(perf_child, sig);
+
+	for (i = 0; i < nrings; ++i) {
+		close(rings[i].exit_fd);
+		close(rings[i].enter_fd);
+	}
+	nrings = 0;
+
+	if (lost_events)
+		error_msg("%" PRIu64 " syscall events have been lost,"
+			  " counts are incomplete", lost_events);
+
+	while (!perf_child_exited) {
+		if (waitpid(perf_child, &perf_child_status, 0) == perf_child)
+			perf_child_exited = true;
+		else if (errno != EINTR)
+			perror_msg_and_die("waitpid");
+	}
+
+	return perf_child_status;
+}
+
+#endif /* HAVE_LINUX_PERF_EVENT_H */
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef STRACE_PERF_COUNT_H
+#define STRACE_PERF_COUNT_H
+
+/* Location of a field in the raw data of a tracepoint record.  */
+struct tp_field {
+	unsigned int offset, size;
+};
+
+/* raw_syscalls:sys_enter or raw_syscalls:sys_exit tracepoint.  */
+struct raw_syscalls_tp {
+	uint64_t id;
+	/* "id" field of both, "ret" field of sys_exit */
+	struct tp_field scno, ret;
+};
+
+/*
+ * Read the ids and the field locations of the raw_syscalls tracepoints
+ * from tracefs, die if they are not available.
+ */
+extern void read_raw_syscalls_tracepoints(struct raw_syscalls_tp *enter_tp,
+					  struct raw_syscalls_tp *exit_tp);
+
+#endif /* !STRACE_PERF_COUNT_H */
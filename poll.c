@@ -48,6 +48,24 @@ print_pollfd(struct tcb *tcp, void *elem_buf, size_t elem_size, void *data)
 	return true;
 }
 
+/*
+ * Fetch the pollfd array in a single read,
+ * subsequent umove calls are served from the snapshot.
+ */
+static void
+snapshot_pollfds(struct tcb *const tcp, const kernel_ulong_t addr,
+		 const unsigned int nfds)
+{
+	if (nfds > -1U / sizeof(struct pollfd))
+		return;
+
+	const struct umove_range range = {
+		.addr = addr,
+		.len = nfds * sizeof(struct pollfd)
+	};
+	umove_snapshot(tcp, &range, 1);
+}
+
 static void
 decode_poll_entering(struct tcb *tcp)
 {
@@ -55,8 +73,10 @@ decode_poll_entering(struct tcb *tcp)
 	const unsigned int nfds = tcp->u_arg[1];
 	struct pollfd fds;
 
+	printfd_batch_begin();
 	print_array(tcp, addr, nfds, &fds, sizeof(fds),
 		    umoven_or_printaddr, print_pollfd, 0);
+	printfd_batch_end();
 	tprintf(", %u, ", nfds);
 }
 
@@ -70,7 +90,7 @@ decode_poll_exiting(struct tcb *const tcp, const kernel_ulong_t pts)
 	const kernel_ulong_t end = start + size;
 	kernel_ulong_t cur;
 	const unsigned int max_printed =
-		abbrev(tcp) ? max_strlen : -1U;
+		abbrev(tcp) ? tcb_max_strlen(tcp) : -1U;
 	unsigned int printed;
 
 	static char outstr[1024];
@@ -88,6 +108,9 @@ decode_poll_exiting(struct tcb *const tcp, const kernel_ulong_t pts)
 	    size / sizeof(fds) != nfds || end < start)
 		return 0;
 
+	/* The kernel has updated revents, the array has to be read again. */
+	snapshot_pollfds(tcp, start, nfds);
+
 	outptr = outstr;
 
 	for (printed = 0, cur = start; cur < end; cur += sizeof(fds)) {
@@ -31,22 +31,41 @@
 /*
  * The printf-like function to use in header files
  * shared between strace and its tests.
+ * Tests define it to printf and print field names and integers with it,
+ * strace uses its own printers that avoid format string parsing.
  */
-#ifndef STRACE_PRINTF
+#ifdef STRACE_PRINTF
+# define STRACE_PRINT_FIELD_NAME(prefix_, name_)			\
+	STRACE_PRINTF("%s%s=", (prefix_), (name_))
+# define STRACE_PRINT_D(val_)	STRACE_PRINTF("%lld", (val_))
+# define STRACE_PRINT_U(val_)	STRACE_PRINTF("%llu", (val_))
+# define STRACE_PRINT_X(val_)	STRACE_PRINTF("%#llx", (val_))
+#else
 # define STRACE_PRINTF tprintf
+# define STRACE_PRINT_FIELD_NAME(prefix_, name_)			\
+	tprint_field_name((prefix_), (name_))
+# define STRACE_PRINT_D(val_)	tprint_int(val_)
+# define STRACE_PRINT_U(val_)	tprint_uint(val_)
+# define STRACE_PRINT_X(val_)	tprint_hex(val_)
 #endif
 
 #define PRINT_FIELD_D(prefix_, where_, field_)				\
-	STRACE_PRINTF("%s%s=%lld", (prefix_), #field_,			\
-		      sign_extend_unsigned_to_ll((where_).field_))
+	do {								\
+		STRACE_PRINT_FIELD_NAME((prefix_), #field_);		\
+		STRACE_PRINT_D(sign_extend_unsigned_to_ll((where_).field_)); \
+	} while (0)
 
 #define PRINT_FIELD_U(prefix_, where_, field_)				\
-	STRACE_PRINTF("%s%s=%llu", (prefix_), #field_,			\
-		      zero_extend_signed_to_ull((where_).field_))
+	do {								\
+		STRACE_PRINT_FIELD_NAME((prefix_), #field_);		\
+		STRACE_PRINT_U(zero_extend_signed_to_ull((where_).field_)); \
+	} while (0)
 
 #define PRINT_FIELD_X(prefix_, where_, field_)				\
-	STRACE_PRINTF("%s%s=%#llx", (prefix_), #field_,			\
-		      zero_extend_signed_to_ull((where_).field_))
+	do {								\
+		STRACE_PRINT_FIELD_NAME((prefix_), #field_);		\
+		STRACE_PRINT_X(zero_extend_signed_to_ull((where_).field_)); \
+	} while (0)
 
 #define PRINT_FIELD_0X(prefix_, where_, field_)				\
 	STRACE_PRINTF("%s%s=%#0*llx", (prefix_), #field_,		\
@@ -60,7 +79,7 @@
 
 #define PRINT_FIELD_FLAGS(prefix_, where_, field_, xlat_, dflt_)	\
 	do {								\
-		STRACE_PRINTF("%s%s=", (prefix_), #field_);		\
+		STRACE_PRINT_FIELD_NAME((prefix_), #field_);		\
 		printflags64((xlat_),					\
 			     zero_extend_signed_to_ull((where_).field_),\
 			     (dflt_));					\
@@ -68,7 +87,7 @@
 
 #define PRINT_FIELD_XVAL(prefix_, where_, field_, xlat_, dflt_)		\
 	do {								\
-		STRACE_PRINTF("%s%s=", (prefix_), #field_);		\
+		STRACE_PRINT_FIELD_NAME((prefix_), #field_);		\
 		printxval64((xlat_),					\
 			    zero_extend_signed_to_ull((where_).field_),	\
 			    (dflt_));		\
@@ -76,23 +95,23 @@
 
 #define PRINT_FIELD_UID(prefix_, where_, field_)					\
 	do {										\
+		STRACE_PRINT_FIELD_NAME((prefix_), #field_);				\
 		if (sign_extend_unsigned_to_ll((where_).field_) == -1LL)		\
-			STRACE_PRINTF("%s%s=-1", (prefix_), #field_);			\
+			STRACE_PRINT_D(-1LL);						\
 		else									\
-			STRACE_PRINTF("%s%s=%llu", (prefix_), #field_,			\
-				      zero_extend_signed_to_ull((where_).field_));	\
+			STRACE_PRINT_U(zero_extend_signed_to_ull((where_).field_));	\
 	} while (0)
 
 #define PRINT_FIELD_STRING(prefix_, where_, field_, len_, style_)	\
 	do {								\
-		STRACE_PRINTF("%s%s=", (prefix_), #field_);		\
+		STRACE_PRINT_FIELD_NAME((prefix_), #field_);		\
 		print_quoted_string((const char *)(where_).field_,	\
 				    (len_), (style_));			\
 	} while (0)
 
 #define PRINT_FIELD_CSTRING(prefix_, where_, field_)			\
 	do {								\
-		STRACE_PRINTF("%s%s=", (prefix_), #field_);		\
+		STRACE_PRINT_FIELD_NAME((prefix_), #field_);		\
 		print_quoted_cstring((const char *)(where_).field_,	\
 				     sizeof((where_).field_));		\
 	} while (0)
@@ -114,51 +133,51 @@
 
 #define PRINT_FIELD_IFINDEX(prefix_, where_, field_)			\
 	do {								\
-		STRACE_PRINTF("%s%s=", (prefix_), #field_);		\
+		STRACE_PRINT_FIELD_NAME((prefix_), #field_);		\
 		print_ifindex((where_).field_);				\
 	} while (0)
 
 #define PRINT_FIELD_SOCKADDR(prefix_, where_, field_)			\
 	do {								\
-		STRACE_PRINTF("%s%s=", (prefix_), #field_);		\
+		STRACE_PRINT_FIELD_NAME((prefix_), #field_);		\
 		print_sockaddr(&(where_).field_,			\
 			       sizeof((where_).field_));		\
 	} while (0)
 
 #define PRINT_FIELD_DEV(prefix_, where_, field_)			\
 	do {								\
-		STRACE_PRINTF("%s%s=", (prefix_), #field_);		\
+		STRACE_PRINT_FIELD_NAME((prefix_), #field_);		\
 		print_dev_t((where_).field_);				\
 	} while (0)
 
 #define PRINT_FIELD_PTR(prefix_, where_, field_)			\
 	do {								\
-		STRACE_PRINTF("%s%s=", (prefix_), #field_);		\
+		STRACE_PRINT_FIELD_NAME((prefix_), #field_);		\
 		printaddr((mpers_ptr_t) (where_).field_);		\
 	} while (0)
 
 #define PRINT_FIELD_FD(prefix_, where_, field_, tcp_)			\
 	do {								\
-		STRACE_PRINTF("%s%s=", (prefix_), #field_);		\
+		STRACE_PRINT_FIELD_NAME((prefix_), #field_);		\
 		printfd((tcp_), (where_).field_);			\
 	} while (0)
 
 #define PRINT_FIELD_STRN(prefix_, where_, field_, len_, tcp_)		\
 	do {								\
-		STRACE_PRINTF("%s%s=", (prefix_), #field_);		\
+		STRACE_PRINT_FIELD_NAME((prefix_), #field_);		\
 		printstrn((tcp_), (where_).field_, (len_));		\
 	} while (0)
 
 
 #define PRINT_FIELD_STR(prefix_, where_, field_, tcp_)			\
 	do {								\
-		STRACE_PRINTF("%s%s=", (prefix_), #field_);		\
+		STRACE_PRINT_FIELD_NAME((prefix_), #field_);		\
 		printstr((tcp_), (where_).field_);			\
 	} while (0)
 
 #define PRINT_FIELD_PATH(prefix_, where_, field_, tcp_)			\
 	do {								\
-		STRACE_PRINTF("%s%s=", (prefix_), #field_);		\
+		STRACE_PRINT_FIELD_NAME((prefix_), #field_);		\
 		printpath((tcp_), (where_).field_);			\
 	} while (0)
 
@@ -0,0 +1,436 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Process tree analyzer of strace -f logs, a streaming replacement
+ * of strace-graph.  The log is read in a single pass, and only a fixed
+ * amount of information is kept for each process: its parent, children,
+ * the last program executed, start and end times, and syscall counts.
+ * Binary traces written by --binary-output are also accepted.
+ */
+
+#include "defs.h"
+#include <ctype.h>
+#include <limits.h>
+#include "bintrace.h"
+
+/* The length limit of kept exec arguments and unfinished syscalls. */
+#define PROC_TEXT_MAX 512
+#define PROC_HASH_SIZE 4096
+
+struct proc {
+	struct proc *parent;
+	struct proc *first_child;
+	struct proc *last_child;
+	struct proc *next_sibling;
+	struct proc *next;	/* In the order of appearance. */
+	struct proc *hash_next;
+	int pid;
+	bool ended;
+	bool has_start;
+	bool has_end;
+	unsigned long long start;
+	unsigned long long end;
+	unsigned long long syscalls;
+	unsigned long long total_syscalls;
+	unsigned int execs;
+	char *exec;		/* The last program executed. */
+	char *unfinished;	/* The beginning of the unfinished syscall. */
+	char status[sizeof("killed by SIGRTMIN+32 (core dumped)")];
+};
+
+static struct proc *proc_hash[PROC_HASH_SIZE];
+static struct proc *first_proc, *last_proc;
+
+static struct proc **
+proc_bucket(const int pid)
+{
+	return &proc_hash[(unsigned int) pid % PROC_HASH_SIZE];
+}
+
+/*
+ * Return the current process with the given pid, creating a new one
+ * if there is no such process or it has already ended.
+ */
+static struct proc *
+get_proc(const int pid, const bool has_ts, const unsigned long long ts)
+{
+	struct proc **pp, *p;
+
+	for (pp = proc_bucket(pid); (p = *pp); pp = &p->hash_next) {
+		if (p->pid == pid)
+			break;
+	}
+
+	if (p && !p->ended)
+		return p;
+
+	/* The pid has been reused, forget the ended process. */
+	if (p)
+		*pp = p->hash_next;
+
+	p = xcalloc(1, sizeof(*p));
+	p->pid = pid;
+	p->has_start = has_ts;
+	p->start = ts;
+	p->hash_next = *proc_bucket(pid);
+	*proc_bucket(pid) = p;
+
+	if (last_proc)
+		last_proc->next = p;
+	else
+		first_proc = p;
+	last_proc = p;
+
+	return p;
+}
+
+static void
+end_proc(struct proc *const p, const bool has_ts, const unsigned long long ts)
+{
+	p->ended = true;
+	if (has_ts && !p->has_end) {
+		p->has_end = true;
+		p->end = ts;
+	}
+}
+
+/*
+ * Make the process with the given pid a child of the parent.
+ * The child may have already been seen since its syscalls could be
+ * printed before the return of the syscall that has created it.
+ */
+static void
+add_child(struct proc *const parent, const int pid,
+	  const bool has_ts, const unsigned long long ts)
+{
+	struct proc *const child = get_proc(pid, has_ts, ts);
+
+	if (child == parent || child->parent)
+		return;
+
+	child->parent = parent;
+	if (parent->last_child)
+		parent->last_child->next_sibling = child;
+	else
+		parent->first_child = child;
+	parent->last_child = child;
+}
+
+static char *
+xstrndup_max(const char *const s, const size_t len)
+{
+	return xstrndup(s, len > PROC_TEXT_MAX ? PROC_TEXT_MAX : len);
+}
+
+/*
+ * Return the end of the quoted string or the bracketed array at s.
+ */
+static const char *
+skip_arg(const char *s)
+{
+	unsigned int depth = 0;
+	bool quoted = false;
+
+	for (; *s; ++s) {
+		if (quoted) {
+			if (*s == '\\' && s[1]) {
+				++s;
+			} else if (*s == '"') {
+				quoted = false;
+				if (!depth)
+					return s + 1;
+			}
+		} else if (*s == '"') {
+			quoted = true;
+		} else if (*s == '[') {
+			++depth;
+		} else if (*s == ']' && depth && !--depth) {
+			return s + 1;
+		}
+	}
+
+	return s;
+}
+
+/*
+ * Remember the filename and argv of a successful execve, args points
+ * to the first argument, or to the dirfd argument of execveat.
+ */
+static void
+handle_exec(struct proc *const p, const char *const args)
+{
+	const char *const filename = strchr(args, '"');
+
+	++p->execs;
+	free(p->exec);
+	p->exec = NULL;
+	if (!filename)
+		return;
+
+	const char *end = skip_arg(filename);
+
+	if (!strncmp(end, "...", 3))
+		end += 3;
+	if (!strncmp(end, ", [", 3))
+		end = skip_arg(end + 2);
+
+	p->exec = xstrndup_max(filename, end - filename);
+}
+
+static void
+handle_syscall(struct proc *const p, const char *const name,
+	       const char *const args, const char *const result,
+	       const bool has_ts, const unsigned long long ts)
+{
+	const long long rval = strtoll(result, NULL, 0);
+
+	if (!strcmp(name, "execve") || !strcmp(name, "execveat")) {
+		if (rval == 0 && *result == '0')
+			handle_exec(p, args);
+	} else if (!strcmp(name, "fork") || !strcmp(name, "vfork") ||
+		   !strcmp(name, "clone") || !strcmp(name, "clone2")) {
+		if (rval > 0 && rval <= INT_MAX)
+			add_child(p, rval, has_ts, ts);
+	}
+}
+
+/*
+ * Parse a line of strace -f output, with or without -t/-tt/-ttt timestamps.
+ */
+static void
+handle_line(char *line)
+{
+	unsigned long long ts = 0;
+	const char *s = line;
+	char *end;
+	int pid = 0;
+
+	end = strchr(line, '\n');
+	if (end)
+		*end = '\0';
+
+	if (!strncmp(s, "[pid ", 5)) {
+		pid = strtol(s + 5, &end, 10);
+		if (*end != ']')
+			return;
+		s = end + 1;
+		while (*s == ' ')
+			++s;
+	} else if (isdigit((unsigned char) *s)) {
+		const long n = strtol(s, &end, 10);
+
+		if (*end == ' ') {
+			pid = n;
+			s = end;
+			while (*s == ' ')
+				++s;
+		}
+	}
+
+	const char *const rest = parse_log_timestamp(s, &ts);
+	const bool has_ts = rest;
+
+	if (rest)
+		s = rest;
+
+	struct proc *const p = get_proc(pid, has_ts, ts);
+
+	if (!strncmp(s, "--- ", 4))
+		return;
+	if (!strncmp(s, "+++ ", 4)) {
+		const char *const status = s + 4;
+		const char *const status_end = strstr(status, " +++");
+		size_t len = status_end ? (size_t) (status_end - status)
+					: strlen(status);
+
+		if (len >= sizeof(p->status))
+			len = sizeof(p->status) - 1;
+		memcpy(p->status, status, len);
+		p->status[len] = '\0';
+		end_proc(p, has_ts, ts);
+		return;
+	}
+
+	char *call = NULL;
+
+	if (!strncmp(s, "<... ", 5)) {
+		const char *const resumed = strstr(s, " resumed>");
+
+		if (!resumed)
+			return;
+		if (p->unfinished) {
+			const size_t len = strlen(p->unfinished);
+			const char *const tail = resumed + sizeof(" resumed>") - 1;
+
+			call = xmalloc(len + strlen(tail) + 1);
+			memcpy(call, p->unfinished, len);
+			strcpy(call + len, tail);
+			free(p->unfinished);
+			p->unfinished = NULL;
+		} else {
+			++p->syscalls;
+			call = xstrdup(s + 5);
+			call[resumed - s - 5] = '(';
+		}
+	} else {
+		const size_t len = strlen(s);
+		static const char unfinished[] = " <unfinished ...>";
+
+		if (!isalpha((unsigned char) *s) && *s != '_')
+			return;
+
+		++p->syscalls;
+		if (len >= sizeof(unfinished) - 1 &&
+		    !strcmp(s + len - sizeof(unfinished) + 1, unfinished)) {
+			free(p->unfinished);
+			p->unfinished =
+				xstrndup_max(s, len - sizeof(unfinished) + 1);
+			return;
+		}
+		call = xstrdup(s);
+	}
+
+	char *const args = strchr(call, '(');
+	char *result = NULL, *r;
+
+	for (r = call; (r = strstr(r, " = ")); r += 3)
+		result = r;
+
+	if (args && result && result > args) {
+		*args = '\0';
+		handle_syscall(p, call, args + 1, result + 3, has_ts, ts);
+	}
+	free(call);
+}
+
+static void
+handle_event(const struct bintrace_event *const ev, void *data)
+{
+	struct proc *const p = get_proc(ev->pid, true, ev->ts);
+
+	if (!ev->exiting) {
+		++p->syscalls;
+		if (!strcmp(ev->name, "exit_group") || !strcmp(ev->name, "exit"))
+			end_proc(p, true, ev->ts);
+		return;
+	}
+
+	if (ev->error)
+		return;
+	if (!strcmp(ev->name, "execve") || !strcmp(ev->name, "execveat")) {
+		++p->execs;
+	} else if (!strcmp(ev->name, "fork") || !strcmp(ev->name, "vfork") ||
+		   !strcmp(ev->name, "clone") || !strcmp(ev->name, "clone2")) {
+		if (ev->rval > 0 && ev->rval <= INT_MAX)
+			add_child(p, ev->rval, true, ev->ts);
+	}
+}
+
+static unsigned long long
+count_total_syscalls(struct proc *const p)
+{
+	struct proc *c;
+
+	p->total_syscalls = p->syscalls;
+	for (c = p->first_child; c; c = c->next_sibling)
+		p->total_syscalls += count_total_syscalls(c);
+
+	return p->total_syscalls;
+}
+
+static void
+print_proc(const struct proc *const p, const char *const lead,
+	   const char *const cont)
+{
+	const struct proc *c;
+
+	printf("%s%d", lead, p->pid);
+	if (p->has_start && p->has_end)
+		printf(" [%.6f]", (p->end - p->start) / 1e9);
+	printf(" %s", p->exec ? p->exec : p->execs ? "(exec)" : "(no exec)");
+	printf(" syscalls=%llu", p->syscalls);
+	if (p->first_child)
+		printf(" total=%llu", p->total_syscalls);
+	if (p->execs > 1)
+		printf(" execs=%u", p->execs);
+	printf(" %s\n", p->ended ? (*p->status ? p->status : "exited")
+				 : "unfinished");
+
+	const size_t cont_len = strlen(cont);
+	char *const child_lead = xmalloc(cont_len + 5);
+	char *const child_cont = xmalloc(cont_len + 5);
+
+	for (c = p->first_child; c; c = c->next_sibling) {
+		const bool last = !c->next_sibling;
+
+		sprintf(child_lead, "%s%s", cont, last ? "`-- " : "|-- ");
+		sprintf(child_cont, "%s%s", cont, last ? "    " : "|   ");
+		print_proc(c, child_lead, child_cont);
+	}
+
+	free(child_cont);
+	free(child_lead);
+}
+
+void
+print_process_tree(const char *const path)
+{
+	struct proc *p;
+
+	if (!bintrace_read(path, handle_event, NULL)) {
+		FILE *const fp = fopen(path, "r");
+		char *line = NULL;
+		size_t size = 0;
+
+		if (!fp)
+			perror_msg_and_die("Can't fopen '%s'", path);
+		while (getline(&line, &size, fp) >= 0)
+			handle_line(line);
+		if (ferror(fp))
+			perror_msg_and_die("%s", path);
+		fclose(fp);
+		free(line);
+	}
+
+	/*
+	 * Processes whose parents are not in the trace, e.g. attached ones,
+	 * are printed as separate trees.
+	 */
+	for (p = first_proc; p; p = p->next) {
+		if (!p->parent) {
+			count_total_syscalls(p);
+			print_proc(p, "", "");
+		}
+	}
+
+	if (fflush(stdout) || ferror(stdout))
+		perror_msg_and_die("write");
+
+	exit(0);
+}
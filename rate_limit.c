@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Output rate limits (--rate-limit option).
+ *
+ * Lines of traced syscalls are limited by token buckets of N lines
+ * per second, one for all syscalls and one for each syscall of a set.
+ * Syscalls over a limit are neither decoded nor printed, but they are
+ * still counted by -c and -C and tampered with by -e inject.  The number
+ * of dropped syscalls is reported per syscall at most once a second,
+ * before the next line printed, and at the end of tracing.
+ */
+
+#include "defs.h"
+
+#include <limits.h>
+#include <time.h>
+#include "filter.h"
+#include "number_set.h"
+
+struct rate_bucket {
+	unsigned int rate;	/* Lines per second, 0 means no limit */
+	uint64_t tat;		/* Theoretical arrival time, ns */
+};
+
+bool rate_limits_in_use;
+
+static struct rate_bucket global_bucket;
+/* Buckets of the syscalls with limits of their own, by personality */
+static struct rate_bucket *syscall_buckets[SUPPORTED_PERSONALITIES];
+/* Syscalls dropped since the last report, by personality */
+static uint64_t *dropped[SUPPORTED_PERSONALITIES];
+static bool dropped_any;
+static uint64_t next_report;
+
+/*
+ * Token bucket of rate events per second, with a burst of at most
+ * one second worth of events, implemented as GCRA.
+ */
+bool
+token_bucket_allows(const unsigned int rate, uint64_t *const tat,
+		    const uint64_t now)
+{
+	const uint64_t interval = 1000000000 / rate;
+	const uint64_t burst = 1000000000 - interval;
+
+	if (*tat > now + burst)
+		return false;
+
+	*tat = MAX(*tat, now) + interval;
+
+	return true;
+}
+
+/*
+ * Parse the --rate-limit argument, "N" lines per second of all syscalls
+ * or "SET:N" lines per second of each syscall of SET,
+ * return false if it is invalid.
+ */
+bool
+parse_rate_limit(const char *const arg)
+{
+	const char *const colon = strrchr(arg, ':');
+	const int rate = string_to_uint_upto(colon ? colon + 1 : arg,
+					     1000000000);
+	unsigned int p, i;
+
+	if (rate <= 0)
+		return false;
+
+	rate_limits_in_use = true;
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		if (!dropped[p])
+			dropped[p] = xcalloc(nsyscall_vec[p] + 1,
+					     sizeof(*dropped[p]));
+	}
+
+	if (!colon) {
+		global_bucket.rate = rate;
+		return true;
+	}
+
+	char *const set_str = xstrndup(arg, colon - arg);
+	struct number_set *const set =
+		alloc_number_set_array(SUPPORTED_PERSONALITIES);
+
+	qualify_syscall_tokens(set_str, set, "system call");
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		for (i = 0; i < nsyscall_vec[p]; ++i) {
+			if (!is_number_in_set_array(i, set, p))
+				continue;
+			if (!syscall_buckets[p])
+				syscall_buckets[p] =
+					xcalloc(nsyscall_vec[p],
+						sizeof(*syscall_buckets[p]));
+			syscall_buckets[p][i].rate = rate;
+		}
+	}
+
+	free_number_set_array(set, SUPPORTED_PERSONALITIES);
+	free(set_str);
+	return true;
+}
+
+/*
+ * Print the numbers of syscalls dropped since the last report
+ * to FP, or to the current tcb if FP is NULL.
+ */
+static void
+print_dropped(FILE *const fp)
+{
+#define print_part(...) \
+	(fp ? (void) fprintf(fp, __VA_ARGS__) : tprintf(__VA_ARGS__))
+
+	const char *sep = "";
+	unsigned int p, i;
+
+	print_part("<... rate limit dropped");
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		for (i = 0; i <= nsyscall_vec[p]; ++i) {
+			if (!dropped[p][i])
+				continue;
+			print_part("%s %" PRIu64 " %s", sep, dropped[p][i],
+				   i < nsyscall_vec[p]
+				   && sysent_vec[p][i].sys_name
+				   ? sysent_vec[p][i].sys_name : "unknown");
+			dropped[p][i] = 0;
+			sep = ",";
+		}
+	}
+	print_part(">\n");
+	dropped_any = false;
+
+#undef print_part
+}
+
+/*
+ * Return true if the syscall of TCP is within the rate limits,
+ * otherwise account it as dropped.  Report the syscalls dropped
+ * so far to the output of TCP at most once a second.
+ */
+bool
+rate_limit_allows(struct tcb *const tcp)
+{
+	const unsigned int p = current_personality;
+	const unsigned int nsc = nsyscall_vec[p];
+	struct rate_bucket *const b =
+		syscall_buckets[p] && tcp->scno < nsc
+		? &syscall_buckets[p][tcp->scno] : NULL;
+	struct timespec ts;
+	uint64_t now;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+	if ((b && b->rate && !token_bucket_allows(b->rate, &b->tat, now))
+	    || (global_bucket.rate
+		&& !token_bucket_allows(global_bucket.rate,
+					&global_bucket.tat, now))) {
+		++dropped[p][MIN(tcp->scno, nsc)];
+		dropped_any = true;
+		return false;
+	}
+
+	if (dropped_any && now >= next_report) {
+		printleader(tcp);
+		print_dropped(NULL);
+		line_ended();
+		next_report = now + 1000000000;
+	}
+
+	return true;
+}
+
+/* Report the syscalls dropped since the last report at the end.  */
+void
+rate_limit_finish(FILE *const fp)
+{
+	if (dropped_any)
+		print_dropped(fp);
+}
@@ -3,6 +3,9 @@
 static void
 decode_renameat(struct tcb *tcp)
 {
+	const kernel_ulong_t paths[] = { tcp->u_arg[1], tcp->u_arg[3] };
+
+	umove_snapshot_strings(tcp, paths, ARRAY_SIZE(paths));
 	print_dirfd(tcp, tcp->u_arg[0]);
 	printpath(tcp, tcp->u_arg[1]);
 	tprints(", ");
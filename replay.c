@@ -0,0 +1,626 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Replay of file system calls of a binary trace (--replay option).
+ *
+ * Descriptors returned by open, openat and creat are replaced with new
+ * files in the scratch directory, reads and writes on them transfer
+ * as many bytes as the traced system calls did, with the data written
+ * taken from an I/O capture if one is given.  System calls are issued
+ * in the order they have finished in the trace, which preserves
+ * the order of each thread, either at the times they have been entered
+ * relative to the first one, or as fast as possible.
+ */
+
+#include "defs.h"
+#include <sys/param.h>
+#include <fcntl.h>
+#include "bintrace.h"
+#include "iocapture.h"
+#include "syscall.h"
+
+#define REPLAY_HASH_SIZE 256
+
+/* The syscall a thread has entered last.  */
+struct replay_thread {
+	struct replay_thread *next;
+	int pid;
+	bool entered;
+	int sen;
+	const char *name;
+	unsigned int personality;
+	unsigned long long ts;
+	uint64_t args[MAX_ARGS];
+};
+
+/* The scratch file descriptor replacing a descriptor of the trace.  */
+struct replay_fd {
+	struct replay_fd *next;
+	int pid;
+	int fd;
+	int real_fd;
+};
+
+/* Data of a write system call split into records of the I/O capture.  */
+struct replay_chunk {
+	off_t pos;
+	unsigned int len;
+	uint64_t offset;
+};
+
+/* Captured data written to a descriptor by a thread.  */
+struct replay_stream {
+	struct replay_stream *next;
+	int pid;
+	int fd;
+	struct replay_chunk *chunks;
+	size_t nchunks;
+	size_t size;
+	size_t cursor;
+};
+
+static struct replay_thread *threads_hash[REPLAY_HASH_SIZE];
+static struct replay_fd *fds_hash[REPLAY_HASH_SIZE];
+static struct replay_stream *streams_hash[REPLAY_HASH_SIZE];
+
+static const char *scratch_dir;
+static unsigned long scratch_files;
+static const char *data_path;
+static int data_fd = -1;
+static bool replay_fast;
+
+static char *buf;
+static size_t buf_size;
+
+static bool started;
+static unsigned long long start_ts;
+static struct timespec start_time;
+
+static struct {
+	unsigned long syscalls;
+	unsigned long failed;
+	unsigned long skipped;
+	unsigned long opens;
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long syncs;
+	unsigned long long read_bytes;
+	unsigned long long write_bytes;
+} stats;
+
+static unsigned int
+hash_pid_fd(const int pid, const int fd)
+{
+	return ((unsigned int) pid * 31 + (unsigned int) fd)
+	       % REPLAY_HASH_SIZE;
+}
+
+static struct replay_thread *
+get_thread(const int pid)
+{
+	struct replay_thread **const bucket =
+		&threads_hash[(unsigned int) pid % REPLAY_HASH_SIZE];
+	struct replay_thread *th;
+
+	for (th = *bucket; th; th = th->next)
+		if (th->pid == pid)
+			return th;
+
+	th = xcalloc(1, sizeof(*th));
+	th->pid = pid;
+	th->next = *bucket;
+	*bucket = th;
+
+	return th;
+}
+
+/*
+ * Threads share descriptors and children inherit them, so unless EXACT
+ * is set, a descriptor not opened by PID is looked up by its number only.
+ */
+static struct replay_fd *
+find_fd(const int pid, const int fd, const bool exact)
+{
+	struct replay_fd *rfd;
+	unsigned int i;
+
+	for (rfd = fds_hash[hash_pid_fd(pid, fd)]; rfd; rfd = rfd->next)
+		if (rfd->pid == pid && rfd->fd == fd)
+			return rfd;
+
+	if (exact)
+		return NULL;
+
+	for (i = 0; i < ARRAY_SIZE(fds_hash); ++i)
+		for (rfd = fds_hash[i]; rfd; rfd = rfd->next)
+			if (rfd->fd == fd)
+				return rfd;
+
+	return NULL;
+}
+
+static void
+drop_fd(const int pid, const int fd, const bool exact)
+{
+	struct replay_fd *const rfd = find_fd(pid, fd, exact);
+	struct replay_fd **p;
+
+	if (!rfd)
+		return;
+
+	for (p = &fds_hash[hash_pid_fd(rfd->pid, rfd->fd)]; *p != rfd;
+	     p = &(*p)->next)
+		;
+	*p = rfd->next;
+	close(rfd->real_fd);
+	free(rfd);
+}
+
+static void
+add_fd(const int pid, const int fd, const int real_fd)
+{
+	struct replay_fd **const bucket = &fds_hash[hash_pid_fd(pid, fd)];
+	struct replay_fd *const rfd = xcalloc(1, sizeof(*rfd));
+
+	rfd->pid = pid;
+	rfd->fd = fd;
+	rfd->real_fd = real_fd;
+	rfd->next = *bucket;
+	*bucket = rfd;
+}
+
+static struct replay_stream *
+find_stream(const int pid, const int fd, const bool create)
+{
+	struct replay_stream **const bucket =
+		&streams_hash[hash_pid_fd(pid, fd)];
+	struct replay_stream *st;
+
+	for (st = *bucket; st; st = st->next)
+		if (st->pid == pid && st->fd == fd)
+			return st;
+
+	if (!create)
+		return NULL;
+
+	st = xcalloc(1, sizeof(*st));
+	st->pid = pid;
+	st->fd = fd;
+	st->next = *bucket;
+	*bucket = st;
+
+	return st;
+}
+
+static void
+index_capture_record(const struct iocapture_event *const ev, void *data)
+{
+	if (ev->type != IOCAPTURE_WRITE)
+		return;
+
+	struct replay_stream *const st = find_stream(ev->pid, ev->fd, true);
+
+	if (st->nchunks >= st->size) {
+		st->size = st->size ? st->size * 2 : 16;
+		st->chunks = xreallocarray(st->chunks, st->size,
+					   sizeof(st->chunks[0]));
+	}
+	st->chunks[st->nchunks++] = (struct replay_chunk) {
+		.pos = ev->data_pos,
+		.len = ev->len,
+		.offset = ev->offset
+	};
+}
+
+static void
+grow_buf(const size_t size)
+{
+	if (size > buf_size) {
+		free(buf);
+		buf_size = size;
+		buf = xmalloc(buf_size);
+	}
+}
+
+/*
+ * Fill the buffer with LEN bytes of the next write system call of PID
+ * to FD captured by --io-capture, pad the rest with zeros.
+ */
+static void
+fill_write_data(const int pid, const int fd, const size_t len)
+{
+	struct replay_stream *const st =
+		data_fd >= 0 ? find_stream(pid, fd, false) : NULL;
+	size_t done = 0;
+
+	if (st) {
+		/* Skip the rest of the data of the previous system call.  */
+		while (st->cursor < st->nchunks &&
+		       st->chunks[st->cursor].offset)
+			++st->cursor;
+
+		while (st->cursor < st->nchunks && done < len) {
+			const struct replay_chunk *const ch =
+				&st->chunks[st->cursor];
+
+			if (ch->offset != done)
+				break;
+
+			const size_t n = MIN(ch->len, len - done);
+
+			if (pread(data_fd, buf + done, n, ch->pos) != (ssize_t) n)
+				perror_msg_and_die("%s", data_path);
+			done += n;
+			++st->cursor;
+		}
+	}
+
+	memset(buf + done, 0, len - done);
+}
+
+static int
+open_scratch_file(const uint64_t flags)
+{
+	char name[PATH_MAX];
+	/*
+	 * O_DIRECT is not reproduced, the alignment of the buffers
+	 * of the tracee is unknown.
+	 */
+	const int keep = O_APPEND | O_TRUNC | O_SYNC | O_DSYNC | O_NONBLOCK;
+
+	if (snprintf(name, sizeof(name), "%s/replay.%lu",
+		     scratch_dir, scratch_files++) >= (int) sizeof(name))
+		error_msg_and_die("%s: scratch directory name is too long",
+				  scratch_dir);
+
+	/* Reads of data never written need the file to be writable.  */
+	return open(name, O_RDWR | O_CREAT | O_CLOEXEC | (flags & keep), 0600);
+}
+
+/*
+ * Read LEN bytes at OFFSET, or at the current position if OFFSET
+ * is negative.  The part of the file that has not been written yet
+ * is written as zeros first, so the data is there for later reads.
+ */
+static ssize_t
+replay_read(const int fd, const size_t len, const int64_t offset)
+{
+	grow_buf(len);
+
+	ssize_t got = offset < 0 ? read(fd, buf, len)
+				 : pread(fd, buf, len, offset);
+
+	if (got < 0 || (size_t) got == len)
+		return got;
+
+	const size_t missing = len - got;
+
+	memset(buf, 0, missing);
+	if (offset < 0) {
+		if (write(fd, buf, missing) != (ssize_t) missing ||
+		    lseek(fd, -(off_t) missing, SEEK_CUR) < 0)
+			return -1;
+		return read(fd, buf, missing);
+	}
+	if (pwrite(fd, buf, missing, offset + got) != (ssize_t) missing)
+		return -1;
+	return pread(fd, buf, missing, offset + got);
+}
+
+static ssize_t
+replay_write(const int pid, const int rec_fd, const int fd,
+	     const size_t len, const int64_t offset)
+{
+	grow_buf(len);
+	fill_write_data(pid, rec_fd, len);
+
+	return offset < 0 ? write(fd, buf, len)
+			  : pwrite(fd, buf, len, offset);
+}
+
+/* Wait until the time of TS relative to the first replayed syscall.  */
+static void
+replay_wait(const unsigned long long ts)
+{
+	if (!started) {
+		started = true;
+		start_ts = ts;
+		clock_gettime(CLOCK_MONOTONIC, &start_time);
+		return;
+	}
+	if (replay_fast || ts <= start_ts)
+		return;
+
+	const unsigned long long delta = ts - start_ts;
+	struct timespec t = {
+		.tv_sec = start_time.tv_sec + delta / 1000000000,
+		.tv_nsec = start_time.tv_nsec + delta % 1000000000
+	};
+
+	if (t.tv_nsec >= 1000000000) {
+		t.tv_nsec -= 1000000000;
+		++t.tv_sec;
+	}
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL)
+	       == EINTR)
+		;
+}
+
+static bool
+is_replayed(const int sen)
+{
+	switch (sen) {
+	case SEN_open:
+	case SEN_openat:
+	case SEN_creat:
+	case SEN_close:
+	case SEN_dup:
+	case SEN_dup2:
+	case SEN_dup3:
+	case SEN_fcntl:
+	case SEN_fcntl64:
+	case SEN_read:
+	case SEN_readv:
+	case SEN_pread:
+	case SEN_preadv:
+	case SEN_write:
+	case SEN_writev:
+	case SEN_pwrite:
+	case SEN_pwritev:
+	case SEN_lseek:
+	case SEN_ftruncate:
+	case SEN_fsync:
+	case SEN_fdatasync:
+	case SEN_fallocate:
+	case SEN_sync_file_range:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Replay the syscall TH has entered, which has returned RVAL.
+ * Returns false if it has not been replayed.
+ */
+static bool
+replay_syscall(const struct replay_thread *const th, const int64_t rval)
+{
+	const uint64_t *const args = th->args;
+	/*
+	 * 64-bit offsets of 32-bit personalities are split between
+	 * arguments in architecture specific ways, such offsets
+	 * are not reproduced.
+	 */
+	const bool wide = th->personality == 0 && PERSONALITY0_WORDSIZE == 8;
+	const int64_t offset = wide ? (int64_t) args[3] : -1;
+	struct replay_fd *rfd = NULL;
+	uint64_t flags;
+	int64_t rc = 0;
+
+	switch (th->sen) {
+	case SEN_open:
+	case SEN_openat:
+	case SEN_creat:
+		flags = th->sen == SEN_open ? args[1]
+			: th->sen == SEN_openat ? args[2]
+			: O_CREAT | O_WRONLY | O_TRUNC;
+		if (flags & (O_DIRECTORY | O_PATH))
+			return false;
+		drop_fd(th->pid, rval, true);
+		rc = open_scratch_file(flags);
+		if (rc >= 0)
+			add_fd(th->pid, rval, rc);
+		++stats.opens;
+		break;
+	case SEN_close:
+		if (!find_fd(th->pid, args[0], false))
+			return false;
+		drop_fd(th->pid, args[0], false);
+		rc = 0;
+		break;
+	case SEN_fcntl:
+	case SEN_fcntl64:
+		if (args[1] != F_DUPFD && args[1] != F_DUPFD_CLOEXEC)
+			return false;
+		/* fall through */
+	case SEN_dup:
+	case SEN_dup2:
+	case SEN_dup3:
+		if (rval == (int) args[0])
+			return false;
+		/* The descriptor replaced by dup2 is closed.  */
+		drop_fd(th->pid, rval, true);
+		if (!(rfd = find_fd(th->pid, args[0], false)))
+			return false;
+		rc = fcntl(rfd->real_fd, F_DUPFD_CLOEXEC, 0);
+		if (rc >= 0)
+			add_fd(th->pid, rval, rc);
+		break;
+	default:
+		if (!(rfd = find_fd(th->pid, args[0], false)))
+			return false;
+		break;
+	}
+
+	switch (th->sen) {
+	case SEN_read:
+	case SEN_readv:
+		rc = replay_read(rfd->real_fd, rval, -1);
+		++stats.reads;
+		stats.read_bytes += rval;
+		break;
+	case SEN_pread:
+	case SEN_preadv:
+		rc = replay_read(rfd->real_fd, rval, offset);
+		++stats.reads;
+		stats.read_bytes += rval;
+		break;
+	case SEN_write:
+	case SEN_writev:
+		rc = replay_write(th->pid, args[0], rfd->real_fd, rval, -1);
+		++stats.writes;
+		stats.write_bytes += rval;
+		break;
+	case SEN_pwrite:
+	case SEN_pwritev:
+		rc = replay_write(th->pid, args[0], rfd->real_fd, rval, offset);
+		++stats.writes;
+		stats.write_bytes += rval;
+		break;
+	case SEN_lseek:
+		rc = lseek(rfd->real_fd, wide ? (int64_t) args[1]
+					       : (int32_t) args[1], args[2]);
+		break;
+	case SEN_ftruncate:
+		rc = ftruncate(rfd->real_fd, wide ? (int64_t) args[1]
+						  : (int32_t) args[1]);
+		break;
+	case SEN_fsync:
+		rc = fsync(rfd->real_fd);
+		++stats.syncs;
+		break;
+	case SEN_fdatasync:
+		rc = fdatasync(rfd->real_fd);
+		++stats.syncs;
+		break;
+	case SEN_fallocate:
+		if (!wide)
+			return false;
+		rc = fallocate(rfd->real_fd, args[1], args[2], args[3]);
+		break;
+	case SEN_sync_file_range:
+		if (!wide)
+			return false;
+		rc = sync_file_range(rfd->real_fd, args[1], args[2], args[3]);
+		++stats.syncs;
+		break;
+	case SEN_open:
+	case SEN_openat:
+	case SEN_creat:
+	case SEN_close:
+	case SEN_fcntl:
+	case SEN_fcntl64:
+	case SEN_dup:
+	case SEN_dup2:
+	case SEN_dup3:
+		/* Replayed above.  */
+		break;
+	default:
+		error_msg("replay of %s is not supported",
+			  th->name ? th->name : "unknown syscall");
+		return false;
+	}
+
+	++stats.syscalls;
+	if (rc < 0)
+		++stats.failed;
+	return true;
+}
+
+static void
+replay_event(const struct bintrace_event *const ev, void *data)
+{
+	struct replay_thread *const th = get_thread(ev->pid);
+
+	if (!ev->exiting) {
+		th->entered = true;
+		th->personality = ev->personality;
+		if (ev->personality < SUPPORTED_PERSONALITIES &&
+		    ev->scno < nsyscall_vec[ev->personality]) {
+			const struct_sysent *const s =
+				&sysent_vec[ev->personality][ev->scno];
+
+			th->sen = s->sen;
+			th->name = s->sys_name;
+		} else {
+			th->sen = 0;
+			th->name = NULL;
+		}
+		th->ts = ev->ts;
+		memcpy(th->args, ev->args, sizeof(th->args));
+		return;
+	}
+
+	if (!th->entered)
+		return;
+	th->entered = false;
+
+	/* Failed syscalls are not replayed.  */
+	if (ev->error || !is_replayed(th->sen)) {
+		++stats.skipped;
+		return;
+	}
+
+	replay_wait(th->ts);
+	if (!replay_syscall(th, ev->rval))
+		++stats.skipped;
+}
+
+void ATTRIBUTE_NORETURN
+replay_trace(const char *path, const char *dir, const char *data,
+	     bool fast)
+{
+	struct timespec end_time;
+	unsigned int i;
+
+	scratch_dir = dir;
+	data_path = data;
+	replay_fast = fast;
+
+	if (data_path) {
+		if (!iocapture_read(data_path, index_capture_record, NULL))
+			error_msg_and_die("%s: not an I/O capture", data_path);
+		data_fd = open(data_path, O_RDONLY | O_CLOEXEC);
+		if (data_fd < 0)
+			perror_msg_and_die("%s", data_path);
+	}
+
+	if (!bintrace_read(path, replay_event, NULL))
+		error_msg_and_die("%s: not a binary trace", path);
+
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	for (i = 0; i < ARRAY_SIZE(fds_hash); ++i)
+		while (fds_hash[i])
+			drop_fd(fds_hash[i]->pid, fds_hash[i]->fd, true);
+
+	printf("%lu syscalls replayed in %.6f seconds, %lu failed"
+	       ", %lu skipped\n", stats.syscalls,
+	       started ? (end_time.tv_sec - start_time.tv_sec)
+			 + (end_time.tv_nsec - start_time.tv_nsec) / 1e9
+		       : 0.0,
+	       stats.failed, stats.skipped);
+	printf("%lu opens, %lu reads of %llu bytes, %lu writes of %llu bytes"
+	       ", %lu syncs\n", stats.opens, stats.reads, stats.read_bytes,
+	       stats.writes, stats.write_bytes, stats.syncs);
+
+	if (fflush(stdout))
+		perror_msg_and_die("stdout");
+	exit(0);
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Flight recorder (--ring-buffer option).
+ *
+ * The trace output is written to a stream whose data goes to a ring
+ * buffer in memory that keeps only the most recent part of the output.
+ * The contents of the buffer are written to the real output only
+ * when ring_dump is called, and when the stream is closed.
+ */
+
+#include "defs.h"
+
+#ifdef HAVE_FOPENCOOKIE
+
+static char *ring_buf;
+static size_t ring_size;
+static size_t ring_head;	/* Offset of the next byte to write */
+static bool ring_wrapped;	/* The oldest byte is at ring_head */
+static FILE *ring_out;		/* The real output */
+static FILE *ring_fp;		/* The stream that writes to the buffer */
+
+static ssize_t
+ring_write(void *cookie, const char *data, size_t len)
+{
+	const ssize_t ret = len;
+
+	if (len >= ring_size) {
+		memcpy(ring_buf, data + len - ring_size, ring_size);
+		ring_head = 0;
+		ring_wrapped = true;
+		return ret;
+	}
+
+	const size_t tail = ring_size - ring_head;
+
+	if (len < tail) {
+		memcpy(ring_buf + ring_head, data, len);
+		ring_head += len;
+	} else {
+		memcpy(ring_buf + ring_head, data, tail);
+		memcpy(ring_buf, data + tail, len - tail);
+		ring_head = len - tail;
+		ring_wrapped = true;
+	}
+
+	return ret;
+}
+
+static void
+ring_write_out(const char *data, size_t len)
+{
+	if (len && fwrite(data, 1, len, ring_out) != len)
+		perror_msg("fwrite");
+}
+
+static void
+ring_dump_buffer(void)
+{
+	if (ring_wrapped) {
+		/* Skip the remainder of the partially overwritten line */
+		const char *const tail = ring_buf + ring_head;
+		const size_t tail_len = ring_size - ring_head;
+		const char *nl = memchr(tail, '\n', tail_len);
+
+		if (nl) {
+			++nl;
+			ring_write_out(nl, tail - nl + tail_len);
+			ring_write_out(ring_buf, ring_head);
+		} else {
+			nl = memchr(ring_buf, '\n', ring_head);
+			if (nl) {
+				++nl;
+				ring_write_out(nl, ring_buf + ring_head - nl);
+			}
+		}
+	} else {
+		ring_write_out(ring_buf, ring_head);
+	}
+
+	ring_head = 0;
+	ring_wrapped = false;
+
+	if (fflush(ring_out))
+		perror_msg("fflush");
+}
+
+void
+ring_dump(void)
+{
+	if (fflush(ring_fp))
+		perror_msg("fflush");
+	ring_dump_buffer();
+}
+
+static int
+ring_close(void *cookie)
+{
+	ring_dump_buffer();
+	if (ring_out != stderr)
+		fclose(ring_out);
+	free(ring_buf);
+	ring_buf = NULL;
+	return 0;
+}
+
+FILE *
+ring_open(FILE *const out, const size_t size)
+{
+	static const cookie_io_functions_t ring_funcs = {
+		.write = ring_write,
+		.close = ring_close
+	};
+
+	ring_buf = xmalloc(size);
+	ring_size = size;
+	ring_out = out;
+	ring_fp = fopencookie(NULL, "w", ring_funcs);
+	if (!ring_fp)
+		perror_msg_and_die("fopencookie");
+
+	return ring_fp;
+}
+
+#else /* !HAVE_FOPENCOOKIE */
+
+FILE *
+ring_open(FILE *const out, const size_t size)
+{
+	error_msg_and_die("--ring-buffer is not supported by this build");
+}
+
+void
+ring_dump(void)
+{
+}
+
+#endif /* HAVE_FOPENCOOKIE */
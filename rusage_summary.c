@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Resource usage of exited processes (--summary-rusage option).
+ *
+ * The rusage reported by wait4 when the thread group leader
+ * of a tracee is reaped covers all threads of the process and
+ * its children waited for, like the one reported to its parent.
+ * The command name is read at the exit event stop of the leader,
+ * while it can still be read.
+ */
+
+#include "defs.h"
+#include <sys/resource.h>
+
+struct rusage_counts {
+	struct rusage_counts *next;
+	int pid;
+	char comm[sizeof("1234567890123456")];
+	bool reaped;
+	struct rusage ru;
+};
+
+unsigned int summary_rusage;
+static struct rusage_counts *rusage_list;
+static unsigned int rusage_count;
+
+static struct rusage_counts *
+alloc_rusage_counts(struct tcb *const tcp)
+{
+	struct rusage_counts *const rc = xcalloc(1, sizeof(*rc));
+
+	rc->pid = tcp->pid;
+	strcpy(rc->comm, "?");
+	rc->next = rusage_list;
+	rusage_list = rc;
+	++rusage_count;
+
+	return tcp->rusage_counts = rc;
+}
+
+void
+count_rusage_exiting(struct tcb *const tcp)
+{
+	if (tcp->rusage_counts || get_tcb_tgid(tcp) != tcp->pid)
+		return;
+
+	struct rusage_counts *const rc = alloc_rusage_counts(tcp);
+
+	read_proc_comm(tcp->pid, rc->comm, sizeof(rc->comm));
+}
+
+void
+count_rusage(struct tcb *const tcp, const struct rusage *const ru)
+{
+	struct rusage_counts *rc = tcp->rusage_counts;
+
+	/* The tgid of a tracee that has exited cannot be read anymore.  */
+	if (!rc) {
+		if (tcp->tgid != tcp->pid)
+			return;
+		rc = alloc_rusage_counts(tcp);
+	}
+
+	rc->ru = *ru;
+	rc->reaped = true;
+}
+
+static uint64_t
+tv_to_ns(const struct timeval *tv)
+{
+	return (uint64_t) tv->tv_sec * 1000000000 + tv->tv_usec * 1000;
+}
+
+static uint64_t
+cpu_ns(const struct rusage_counts *const rc)
+{
+	return tv_to_ns(&rc->ru.ru_utime) + tv_to_ns(&rc->ru.ru_stime);
+}
+
+static int
+rusage_counts_cmp(const void *a, const void *b)
+{
+	const struct rusage_counts *const x =
+		*(const struct rusage_counts **) a;
+	const struct rusage_counts *const y =
+		*(const struct rusage_counts **) b;
+	const uint64_t m = cpu_ns(x);
+	const uint64_t n = cpu_ns(y);
+
+	if (m != n)
+		return m < n ? 1 : -1;
+	if (x->ru.ru_maxrss != y->ru.ru_maxrss)
+		return x->ru.ru_maxrss < y->ru.ru_maxrss ? 1 : -1;
+	return x->pid - y->pid;
+}
+
+/* Print the summary_rusage exited processes that used most CPU time. */
+void
+rusage_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	struct rusage_counts **sorted;
+	struct rusage_counts *rc;
+	unsigned int i, n = 0;
+
+	if (!rusage_count)
+		return;
+
+	sorted = xcalloc(rusage_count, sizeof(sorted[0]));
+	for (rc = rusage_list; rc; rc = rc->next) {
+		if (rc->reaped)
+			sorted[n++] = rc;
+	}
+	sort_top(sorted, n, sizeof(sorted[0]), summary_rusage,
+		 rusage_counts_cmp);
+
+	if (n) {
+		fprintf(outf, "\n%11.11s %11.11s %9.9s %9.9s %9.9s %9.9s"
+			" %9.9s %7.7s %s\n",
+			"user secs", "sys secs", "maxrss KB", "minflt",
+			"majflt", "nvcsw", "nivcsw", "pid", "command");
+		fprintf(outf, "%11.11s %11.11s %9.9s %9.9s %9.9s %9.9s"
+			" %9.9s %7.7s %s\n",
+			dashes, dashes, dashes, dashes, dashes, dashes,
+			dashes, dashes, dashes);
+	}
+	for (i = 0; i < n && i < summary_rusage; ++i) {
+		const struct rusage *const ru = &sorted[i]->ru;
+
+		fprintf(outf, "%11.6f %11.6f %9ld %9ld %9ld %9ld %9ld"
+			" %7d %s\n",
+			tv_to_ns(&ru->ru_utime) / 1e9,
+			tv_to_ns(&ru->ru_stime) / 1e9,
+			ru->ru_maxrss, ru->ru_minflt, ru->ru_majflt,
+			ru->ru_nvcsw, ru->ru_nivcsw,
+			sorted[i]->pid, sorted[i]->comm);
+	}
+
+	free(sorted);
+}
@@ -0,0 +1,401 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "defs.h"
+#include "selfprof.h"
+#include "string_to_uint.h"
+#include <linux/ioctl.h>
+
+bool self_profile;
+unsigned long long selfprof_counters[SELFPROF_NCOUNTERS];
+struct selfprof_cache_stats selfprof_caches[SELFPROF_NCACHES];
+
+static struct {
+	unsigned long long calls;
+	unsigned long long self_ns;
+	unsigned long long total_ns;
+} phases[SELFPROF_NPHASES];
+
+static const char *const phase_names[SELFPROF_NPHASES] = {
+	[SELFPROF_WAIT] = "wait4",
+	[SELFPROF_GET_REGS] = "get_regs",
+	[SELFPROF_DECODE] = "syscall_*_decode",
+	[SELFPROF_SYS_FUNC] = "sys_func",
+	[SELFPROF_UMOVE] = "umoven/umovestr",
+	[SELFPROF_OUTPUT] = "tprintf/tprints",
+	[SELFPROF_FLUSH] = "output flush",
+	[SELFPROF_RESTART] = "ptrace_restart",
+};
+
+static const char *const counter_names[SELFPROF_NCOUNTERS] = {
+	[SELFPROF_PTRACE] = "ptrace",
+	[SELFPROF_PROCESS_VM_READV] = "process_vm_readv",
+};
+
+static const char *const cache_names[SELFPROF_NCACHES] = {
+	[SELFPROF_CACHE_TCBS] = "tcbs",
+	[SELFPROF_CACHE_INJECT] = "inject",
+	[SELFPROF_CACHE_FD_PATHS] = "fd-paths",
+	[SELFPROF_CACHE_STRINGS] = "strings",
+	[SELFPROF_CACHE_SOCKET_INODES] = "socket-inodes",
+	[SELFPROF_CACHE_DYXLAT] = "dyxlat",
+	[SELFPROF_CACHE_MMAP] = "mmap",
+	[SELFPROF_CACHE_STACKS] = "stacks",
+	[SELFPROF_CACHE_SIGMASKS] = "sigmasks",
+};
+
+/* Caches that evict their least recently used entries over a limit.  */
+static const bool cache_evictable[SELFPROF_NCACHES] = {
+	[SELFPROF_CACHE_SOCKET_INODES] = true,
+	[SELFPROF_CACHE_MMAP] = true,
+};
+
+/* Costs of a syscall decoder or an ioctl decoder.  */
+struct decoder_cost {
+	unsigned long long calls;
+	unsigned long long ns;
+	unsigned long long reads;
+};
+
+static struct decoder_cost *syscall_costs[SUPPORTED_PERSONALITIES];
+static struct decoder_cost unknown_syscall_cost;
+/* Indexed by _IOC_TYPE of the ioctl command. */
+static struct decoder_cost ioctl_costs[256];
+
+static struct decoder_cost *cur_decoder, *cur_ioctl_decoder;
+static unsigned long long decoder_start_ns, ioctl_decoder_start_ns;
+
+#define MAX_DEPTH 16
+
+/* Phases that have been entered but not left yet.  */
+static struct {
+	unsigned long long start_ns;
+	unsigned long long child_ns;
+} stack[MAX_DEPTH];
+static unsigned int depth;
+
+static unsigned long long
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+selfprof_enter_phase(const enum selfprof_phase phase)
+{
+	if (depth < MAX_DEPTH) {
+		stack[depth].start_ns = now_ns();
+		stack[depth].child_ns = 0;
+	}
+	++depth;
+}
+
+void
+selfprof_leave_phase(const enum selfprof_phase phase)
+{
+	if (!depth)
+		return;
+	if (--depth >= MAX_DEPTH)
+		return;
+
+	const unsigned long long elapsed = now_ns() - stack[depth].start_ns;
+
+	++phases[phase].calls;
+	phases[phase].total_ns += elapsed;
+	phases[phase].self_ns += elapsed - stack[depth].child_ns;
+	if (depth)
+		stack[depth - 1].child_ns += elapsed;
+}
+
+void
+selfprof_enter_decoder(const struct tcb *const tcp)
+{
+	selfprof_enter_phase(SELFPROF_SYS_FUNC);
+
+	if (scno_is_valid(tcp->scno)) {
+		if (!syscall_costs[current_personality])
+			syscall_costs[current_personality] =
+				xcalloc(nsyscall_vec[current_personality],
+					sizeof(struct decoder_cost));
+		cur_decoder = &syscall_costs[current_personality][tcp->scno];
+	} else {
+		cur_decoder = &unknown_syscall_cost;
+	}
+	decoder_start_ns = now_ns();
+}
+
+void
+selfprof_leave_decoder(void)
+{
+	if (cur_decoder) {
+		++cur_decoder->calls;
+		cur_decoder->ns += now_ns() - decoder_start_ns;
+		cur_decoder = NULL;
+	}
+
+	selfprof_leave_phase(SELFPROF_SYS_FUNC);
+}
+
+void
+selfprof_enter_ioctl_decoder(const unsigned int code)
+{
+	cur_ioctl_decoder = &ioctl_costs[_IOC_TYPE(code)];
+	ioctl_decoder_start_ns = now_ns();
+}
+
+void
+selfprof_leave_ioctl_decoder(void)
+{
+	if (cur_ioctl_decoder) {
+		++cur_ioctl_decoder->calls;
+		cur_ioctl_decoder->ns += now_ns() - ioctl_decoder_start_ns;
+		cur_ioctl_decoder = NULL;
+	}
+}
+
+void
+selfprof_count_read(void)
+{
+	if (cur_decoder)
+		++cur_decoder->reads;
+	if (cur_ioctl_decoder)
+		++cur_ioctl_decoder->reads;
+}
+
+struct decoder_entry {
+	const struct decoder_cost *cost;
+	char name[sizeof("ioctl 0xff ('x')") + 64];
+};
+
+static int
+decoder_entry_cmp(const void *a, const void *b)
+{
+	const unsigned long long ns_a =
+		((const struct decoder_entry *) a)->cost->ns;
+	const unsigned long long ns_b =
+		((const struct decoder_entry *) b)->cost->ns;
+
+	return (ns_a < ns_b) - (ns_a > ns_b);
+}
+
+static void
+print_decoder_costs(FILE *const outf, const char *const title,
+		    struct decoder_entry *const entries, const unsigned int n)
+{
+	const char *const dashes = "----------------";
+	unsigned long long total_ns = 0;
+	unsigned int i;
+
+	if (!n)
+		return;
+
+	qsort(entries, n, sizeof(*entries), decoder_entry_cmp);
+	for (i = 0; i < n; ++i)
+		total_ns += entries[i].cost->ns;
+
+	fprintf(outf, "\n%s:\n", title);
+	fprintf(outf, "%6.6s %11.11s %11.11s %11.11s %11.11s %s\n",
+		"% time", "seconds", "calls", "nsecs/call", "reads",
+		"decoder");
+	fprintf(outf, "%6.6s %11.11s %11.11s %11.11s %11.11s %s\n",
+		dashes, dashes, dashes, dashes, dashes, dashes);
+	for (i = 0; i < n; ++i) {
+		const struct decoder_cost *const c = entries[i].cost;
+
+		fprintf(outf, "%6.2f %11.6f %11llu %11llu %11llu %s\n",
+			total_ns ? 100.0 * c->ns / total_ns : 0.0,
+			c->ns / 1e9, c->calls, c->ns / c->calls, c->reads,
+			entries[i].name);
+	}
+}
+
+static void
+print_syscall_decoder_costs(FILE *const outf)
+{
+	struct decoder_entry *entries;
+	unsigned int n = !!unknown_syscall_cost.calls;
+	unsigned int p, i;
+
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		if (syscall_costs[p])
+			n += nsyscall_vec[p];
+	}
+	if (!n)
+		return;
+	entries = xcalloc(n, sizeof(*entries));
+
+	n = 0;
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		if (!syscall_costs[p])
+			continue;
+		for (i = 0; i < nsyscall_vec[p]; ++i) {
+			if (!syscall_costs[p][i].calls)
+				continue;
+			entries[n].cost = &syscall_costs[p][i];
+			if (p)
+				snprintf(entries[n].name,
+					 sizeof(entries[n].name),
+					 "%s (personality %u)",
+					 sysent_vec[p][i].sys_name, p);
+			else
+				snprintf(entries[n].name,
+					 sizeof(entries[n].name),
+					 "%s", sysent_vec[p][i].sys_name);
+			++n;
+		}
+	}
+	if (unknown_syscall_cost.calls) {
+		entries[n].cost = &unknown_syscall_cost;
+		strcpy(entries[n].name, "unknown syscalls");
+		++n;
+	}
+
+	print_decoder_costs(outf, "Decoder self-profile", entries, n);
+	free(entries);
+}
+
+static void
+print_ioctl_decoder_costs(FILE *const outf)
+{
+	struct decoder_entry entries[ARRAY_SIZE(ioctl_costs)];
+	unsigned int n = 0, i;
+
+	for (i = 0; i < ARRAY_SIZE(ioctl_costs); ++i) {
+		if (!ioctl_costs[i].calls)
+			continue;
+		entries[n].cost = &ioctl_costs[i];
+		if (i >= ' ' && i < 0x7f)
+			sprintf(entries[n].name, "ioctl %#04x ('%c')", i, i);
+		else
+			sprintf(entries[n].name, "ioctl %#04x", i);
+		++n;
+	}
+
+	print_decoder_costs(outf, "ioctl decoder self-profile", entries, n);
+}
+
+/*
+ * Parse the --cache-limit argument, "CACHE:N" entries of CACHE,
+ * return false if it is invalid.
+ */
+bool
+parse_cache_limit(const char *const arg)
+{
+	const char *const colon = strchr(arg, ':');
+	unsigned int i;
+
+	if (!colon)
+		return false;
+
+	const int limit = string_to_uint(colon + 1);
+
+	if (limit <= 0)
+		return false;
+
+	for (i = 0; i < SELFPROF_NCACHES; ++i) {
+		if (cache_evictable[i]
+		    && strlen(cache_names[i]) == (size_t) (colon - arg)
+		    && !strncmp(arg, cache_names[i], colon - arg)) {
+			selfprof_caches[i].limit = limit;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void
+print_cache_stats(FILE *const outf)
+{
+	const char *const dashes = "----------------";
+	unsigned int i;
+
+	fprintf(outf, "\nTracer caches:\n");
+	fprintf(outf, "%11.11s %11.11s %11.11s %11.11s %11.11s %s\n",
+		"entries", "bytes", "peak bytes", "limit", "evictions",
+		"cache");
+	fprintf(outf, "%11.11s %11.11s %11.11s %11.11s %11.11s %s\n",
+		dashes, dashes, dashes, dashes, dashes, "-------------");
+
+	for (i = 0; i < SELFPROF_NCACHES; ++i) {
+		const struct selfprof_cache_stats *const s =
+			&selfprof_caches[i];
+
+		if (!s->peak_bytes && !s->limit)
+			continue;
+		fprintf(outf, "%11lld %11lld %11lld ",
+			s->entries, s->bytes, s->peak_bytes);
+		if (s->limit)
+			fprintf(outf, "%11llu %11llu", s->limit, s->evictions);
+		else
+			fprintf(outf, "%11s %11s", "-", "-");
+		fprintf(outf, " %s\n", cache_names[i]);
+	}
+}
+
+void
+selfprof_summary(FILE *const outf)
+{
+	const char *const dashes = "----------------";
+	unsigned long long self_ns = 0;
+	unsigned int i;
+
+	for (i = 0; i < SELFPROF_NPHASES; ++i)
+		self_ns += phases[i].self_ns;
+
+	fprintf(outf, "\nTracer self-profile:\n");
+	fprintf(outf, "%6.6s %11.11s %11.11s %11.11s %11.11s %s\n",
+		"% time", "self, s", "total, s", "calls", "nsecs/call",
+		"phase");
+	fprintf(outf, "%6.6s %11.11s %11.11s %11.11s %11.11s %s\n",
+		dashes, dashes, dashes, dashes, dashes,
+		"-----------------------");
+
+	for (i = 0; i < SELFPROF_NPHASES; ++i) {
+		if (!phases[i].calls)
+			continue;
+		fprintf(outf, "%6.2f %11.6f %11.6f %11llu %11llu %s\n",
+			self_ns ? 100.0 * phases[i].self_ns / self_ns : 0.0,
+			phases[i].self_ns / 1e9, phases[i].total_ns / 1e9,
+			phases[i].calls, phases[i].self_ns / phases[i].calls,
+			phase_names[i]);
+	}
+
+	print_syscall_decoder_costs(outf);
+	print_ioctl_decoder_costs(outf);
+
+	fprintf(outf, "\nSystem calls made by the tracer:\n");
+	for (i = 0; i < SELFPROF_NCOUNTERS; ++i)
+		fprintf(outf, "%11llu %s\n", selfprof_counters[i],
+			counter_names[i]);
+
+	print_cache_stats(outf);
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef STRACE_SELFPROF_H
+#define STRACE_SELFPROF_H
+
+/*
+ * Timing of the phases of the tracer itself (--self-profile option).
+ * Phases nest: the time of a phase does not include the time
+ * of the phases entered within it.
+ */
+
+#include "defs.h"
+
+enum selfprof_phase {
+	SELFPROF_WAIT,
+	SELFPROF_GET_REGS,
+	SELFPROF_DECODE,
+	SELFPROF_SYS_FUNC,
+	SELFPROF_UMOVE,
+	SELFPROF_OUTPUT,
+	SELFPROF_FLUSH,
+	SELFPROF_RESTART,
+
+	SELFPROF_NPHASES
+};
+
+enum selfprof_counter {
+	SELFPROF_PTRACE,
+	SELFPROF_PROCESS_VM_READV,
+
+	SELFPROF_NCOUNTERS
+};
+
+/*
+ * Caches and tables of the tracer.  Their memory is accounted
+ * whether --self-profile is given or not, so that the caches that
+ * support eviction can be kept within the limits of --cache-limit.
+ */
+enum selfprof_cache {
+	SELFPROF_CACHE_TCBS,
+	SELFPROF_CACHE_INJECT,
+	SELFPROF_CACHE_FD_PATHS,
+	SELFPROF_CACHE_STRINGS,
+	SELFPROF_CACHE_SOCKET_INODES,
+	SELFPROF_CACHE_DYXLAT,
+	SELFPROF_CACHE_MMAP,
+	SELFPROF_CACHE_STACKS,
+	SELFPROF_CACHE_SIGMASKS,
+
+	SELFPROF_NCACHES
+};
+
+struct selfprof_cache_stats {
+	long long entries;
+	long long bytes;
+	long long peak_bytes;
+	unsigned long long evictions;
+	/* The maximum number of entries, 0 means no limit */
+	unsigned long long limit;
+};
+
+extern bool self_profile;
+extern unsigned long long selfprof_counters[SELFPROF_NCOUNTERS];
+extern struct selfprof_cache_stats selfprof_caches[SELFPROF_NCACHES];
+
+extern void selfprof_enter_phase(enum selfprof_phase);
+extern void selfprof_leave_phase(enum selfprof_phase);
+extern void selfprof_enter_decoder(const struct tcb *);
+extern void selfprof_leave_decoder(void);
+extern void selfprof_enter_ioctl_decoder(unsigned int code);
+extern void selfprof_leave_ioctl_decoder(void);
+extern void selfprof_count_read(void);
+extern bool parse_cache_limit(const char *);
+extern void selfprof_summary(FILE *);
+
+static inline void
+selfprof_enter(const enum selfprof_phase phase)
+{
+	if (self_profile)
+		selfprof_enter_phase(phase);
+}
+
+static inline void
+selfprof_leave(const enum selfprof_phase phase)
+{
+	if (self_profile)
+		selfprof_leave_phase(phase);
+}
+
+/* Attribute the time and memory reads to the sys_func of the syscall. */
+static inline void
+selfprof_enter_sys_func(const struct tcb *const tcp)
+{
+	if (self_profile)
+		selfprof_enter_decoder(tcp);
+}
+
+static inline void
+selfprof_leave_sys_func(void)
+{
+	if (self_profile)
+		selfprof_leave_decoder();
+}
+
+/* Attribute the time and memory reads to the ioctl decoder of CODE. */
+static inline void
+selfprof_enter_ioctl(const unsigned int code)
+{
+	if (self_profile)
+		selfprof_enter_ioctl_decoder(code);
+}
+
+static inline void
+selfprof_leave_ioctl(void)
+{
+	if (self_profile)
+		selfprof_leave_ioctl_decoder();
+}
+
+/* Account a read of tracee memory. */
+static inline void
+selfprof_read(void)
+{
+	if (self_profile)
+		selfprof_count_read();
+}
+
+static inline void
+selfprof_count(const enum selfprof_counter counter)
+{
+	if (self_profile)
+		++selfprof_counters[counter];
+}
+
+/* Account entries and bytes added to the cache, or removed if negative. */
+static inline void
+selfprof_cache_add(const enum selfprof_cache cache, const long entries,
+		   const long bytes)
+{
+	struct selfprof_cache_stats *const s = &selfprof_caches[cache];
+
+	s->entries += entries;
+	s->bytes += bytes;
+	if (s->peak_bytes < s->bytes)
+		s->peak_bytes = s->bytes;
+}
+
+/* Return true if the cache has more entries than its limit allows. */
+static inline bool
+selfprof_cache_over_limit(const enum selfprof_cache cache)
+{
+	const struct selfprof_cache_stats *const s = &selfprof_caches[cache];
+
+	return s->limit && (unsigned long long) s->entries > s->limit;
+}
+
+static inline void
+selfprof_cache_evicted(const enum selfprof_cache cache)
+{
+	++selfprof_caches[cache].evictions;
+}
+
+#endif /* !STRACE_SELFPROF_H */
@@ -0,0 +1,527 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Sharded tracing (--shards option).
+ *
+ * strace becomes a coordinator that forks N tracer processes, shards,
+ * before anything is traced, and does not trace anything itself.
+ * Each shard owns the processes whose pids hash to its index: it attaches
+ * to the owned processes of -p and --attach-cgroup, and shard 0 starts
+ * the command.  A new process that is auto-attached by the shard tracing
+ * its parent but is owned by another shard is handed off in its first
+ * syscall entering stop: the syscall is replaced with pause(2), which
+ * parks the process, the process is detached, and its pid and syscall
+ * are sent to the coordinator, which forwards them to the owner.
+ * The owner seizes and interrupts the process, and puts the syscall back
+ * in the interrupt stop, so the syscall is restarted and traced there.
+ * No signal is sent to the process, but a handled signal that arrives
+ * while it is parked interrupts the syscall with EINTR.
+ * Threads stay with the shard of their process.
+ *
+ * Each shard writes its output to a pipe, the coordinator copies complete
+ * lines from the pipes to the output, so lines of different shards never
+ * interleave.  With -c, the shards send their statistics to the coordinator
+ * when they are done, and the coordinator prints the merged summary.
+ *
+ * A shard that has no tracees left tells the coordinator so along with
+ * the number of handoffs it has received.  When every shard has reported
+ * being idle after the last handoff sent to it, no process is traced
+ * or being handed off, and the coordinator tells the shards to exit.
+ */
+
+#include "defs.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "shard.h"
+
+enum shard_msg_type {
+	SHARD_HANDOFF,	/* shard: the process PID parked in SCNO is to be adopted */
+	SHARD_ADOPT,	/* coordinator: attach to the process PID parked in SCNO */
+	SHARD_IDLE,	/* shard: no tracees are left after ADOPTED handoffs */
+	SHARD_EXIT,	/* coordinator: tracing is over */
+	SHARD_COUNTS,	/* shard: a record of export_counts follows */
+};
+
+struct shard_msg {
+	uint32_t type;
+	int32_t pid;
+	uint64_t adopted;
+	uint64_t scno;
+};
+
+/* The state of a shard kept by the coordinator */
+struct shard {
+	pid_t pid;
+	int sock;		/* -1 when the shard has closed it */
+	int out;		/* -1 at the end of the output */
+	char *buf;		/* The incomplete line of the output */
+	size_t len, size;
+	uint64_t adopts_sent;
+	uint64_t idle_adopted;
+	bool idle;
+};
+
+unsigned int nshards;
+
+static struct shard *shards;
+static int shard_signal_fd = -1;
+/* Whether shard 0 starts the command */
+static bool shard_command;
+
+/* The state of a shard */
+static unsigned int shard_index;
+static int shard_sock = -1;
+static uint64_t adopted, idle_adopted;
+static bool idle_reported;
+
+static unsigned int
+shard_of(const int pid)
+{
+	return ((uint32_t) pid * 2654435761U >> 16) % nshards;
+}
+
+bool
+shard_owns(const int pid)
+{
+	return shard_of(pid) == shard_index;
+}
+
+/* The command is started by shard 0, it follows from there.  */
+bool
+shard_owns_command(void)
+{
+	return shard_index == 0;
+}
+
+/*
+ * Fork the shards, shard 0 starts the command if COMMAND is set.
+ * Return the socket to the coordinator in a shard, whose output stream
+ * is replaced by the pipe to the coordinator, or -1 in the coordinator.
+ */
+int
+shard_fork(FILE **const log, const bool command)
+{
+	sigset_t mask, old_mask;
+	unsigned int i;
+
+	/*
+	 * The coordinator forwards the signals that stop tracing,
+	 * the shards get them unblocked.
+	 */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGHUP);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGQUIT);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, &old_mask);
+
+	shard_command = command;
+	shards = xcalloc(nshards, sizeof(*shards));
+	fflush(NULL);
+
+	for (i = 0; i < nshards; ++i) {
+		int sv[2], pfd[2];
+
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv))
+			perror_msg_and_die("socketpair");
+		if (pipe2(pfd, O_CLOEXEC))
+			perror_msg_and_die("pipe2");
+
+		const pid_t pid = fork();
+
+		if (pid < 0)
+			perror_msg_and_die("fork");
+		if (!pid) {
+			unsigned int j;
+
+			for (j = 0; j < i; ++j) {
+				close(shards[j].sock);
+				close(shards[j].out);
+			}
+			close(sv[0]);
+			close(pfd[0]);
+			sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+			shard_index = i;
+			shard_sock = sv[1];
+			/* Nothing is buffered, it has been flushed.  */
+			if (*log != stderr)
+				fclose(*log);
+			*log = fdopen(pfd[1], "w");
+			if (!*log)
+				perror_msg_and_die("fdopen");
+			return shard_sock;
+		}
+
+		close(sv[1]);
+		close(pfd[1]);
+		shards[i].pid = pid;
+		shards[i].sock = sv[0];
+		shards[i].out = pfd[0];
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	shard_signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (shard_signal_fd < 0)
+		perror_msg_and_die("signalfd");
+
+	return -1;
+}
+
+static bool
+shard_send(const int sock, const struct shard_msg *const msg,
+	   const void *const data, const size_t len)
+{
+	struct iovec iov[] = {
+		{ .iov_base = (void *) msg, .iov_len = sizeof(*msg) },
+		{ .iov_base = (void *) data, .iov_len = len }
+	};
+	const struct msghdr mh = {
+		.msg_iov = iov,
+		.msg_iovlen = len ? 2 : 1
+	};
+
+	for (;;) {
+		if (sendmsg(sock, &mh, MSG_NOSIGNAL) >= 0)
+			return true;
+		if (errno != EINTR)
+			return false;
+	}
+}
+
+/* Whether a new process auto-attached by this shard is to be handed off.  */
+bool
+shard_hands_off(const int pid)
+{
+	return !shard_owns(pid) && get_proc_tgid(pid) == pid;
+}
+
+/*
+ * Send the process PID, detached while parked instead of making
+ * the syscall SCNO, to the shard that owns it, return false on error.
+ */
+bool
+shard_handoff(const int pid, const kernel_ulong_t scno)
+{
+	const struct shard_msg msg = {
+		.type = SHARD_HANDOFF,
+		.pid = pid,
+		.scno = scno
+	};
+
+	if (shard_send(shard_sock, &msg, NULL, 0))
+		return true;
+
+	perror_msg("handoff of pid %d", pid);
+	return false;
+}
+
+/*
+ * Receive a message from the coordinator, return the pid of a process
+ * to adopt and store the syscall it is parked instead of in *SCNO,
+ * return 0 if there are no more messages for now, or -1 if tracing
+ * is over.
+ */
+int
+shard_receive(kernel_ulong_t *const scno)
+{
+	struct shard_msg msg;
+	const ssize_t n = recv(shard_sock, &msg, sizeof(msg), MSG_DONTWAIT);
+
+	if (n < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+	if (n < (ssize_t) sizeof(msg) || msg.type != SHARD_ADOPT)
+		return -1;
+
+	++adopted;
+	*scno = msg.scno;
+	return msg.pid;
+}
+
+/* Tell the coordinator this shard has no tracees left.  */
+void
+shard_idle(void)
+{
+	if (idle_reported && idle_adopted == adopted)
+		return;
+
+	const struct shard_msg msg = {
+		.type = SHARD_IDLE,
+		.adopted = adopted
+	};
+
+	if (!shard_send(shard_sock, &msg, NULL, 0))
+		perror_msg_and_die("shard %u", shard_index);
+	idle_reported = true;
+	idle_adopted = adopted;
+}
+
+static void
+send_counts_record(const void *const data, const size_t len)
+{
+	const struct shard_msg msg = { .type = SHARD_COUNTS };
+
+	if (!shard_send(shard_sock, &msg, data, len))
+		perror_msg("shard %u", shard_index);
+}
+
+/* Send the -c statistics of this shard to the coordinator.  */
+void
+shard_send_counts(void)
+{
+	export_counts(send_counts_record);
+}
+
+/*
+ * Processes handed off to this shard after it has stopped tracing
+ * are passed to RELEASE, which lets them make their syscall untraced.
+ */
+void
+shard_finish(void (*const release)(int pid, kernel_ulong_t scno))
+{
+	kernel_ulong_t scno;
+	int pid;
+
+	shutdown(shard_sock, SHUT_RD);
+	while ((pid = shard_receive(&scno)) > 0)
+		release(pid, scno);
+	close(shard_sock);
+	shard_sock = -1;
+}
+
+static void
+forward_handoff(const int pid, const uint64_t scno)
+{
+	const unsigned int owner = shard_of(pid);
+	const struct shard_msg msg = {
+		.type = SHARD_ADOPT,
+		.pid = pid,
+		.scno = scno
+	};
+	unsigned int i;
+
+	/* Another shard adopts the process if the owner is gone.  */
+	for (i = 0; i < nshards; ++i) {
+		struct shard *const s = &shards[(owner + i) % nshards];
+
+		if (s->sock >= 0 && shard_send(s->sock, &msg, NULL, 0)) {
+			++s->adopts_sent;
+			return;
+		}
+	}
+
+	error_msg("pid %d is left parked by a handoff", pid);
+}
+
+static void
+read_shard_sock(struct shard *const s)
+{
+	union {
+		struct shard_msg msg;
+		char buf[sizeof(struct shard_msg) + COUNTS_RECORD_MAX];
+	} u;
+	const ssize_t n = recv(s->sock, &u, sizeof(u), MSG_DONTWAIT);
+
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (n < (ssize_t) sizeof(u.msg)) {
+		close(s->sock);
+		s->sock = -1;
+		return;
+	}
+
+	switch (u.msg.type) {
+	case SHARD_HANDOFF:
+		forward_handoff(u.msg.pid, u.msg.scno);
+		break;
+	case SHARD_IDLE:
+		s->idle = true;
+		s->idle_adopted = u.msg.adopted;
+		break;
+	case SHARD_COUNTS:
+		import_counts(u.buf + sizeof(u.msg), n - sizeof(u.msg));
+		break;
+	}
+}
+
+static void
+write_lines(FILE *const log, struct shard *const s, const size_t len)
+{
+	if (len && fwrite(s->buf, 1, len, log) != len && log != stderr)
+		perror_msg("write");
+	s->len -= len;
+	memmove(s->buf, s->buf + len, s->len);
+}
+
+static void
+read_shard_out(FILE *const log, struct shard *const s)
+{
+	if (s->size - s->len < 4096) {
+		s->size = s->size ? s->size * 2 : 65536;
+		s->buf = xreallocarray(s->buf, s->size, 1);
+	}
+
+	const ssize_t n = read(s->out, s->buf + s->len, s->size - s->len);
+
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return;
+		perror_msg("read");
+	}
+	if (n <= 0) {
+		/* The last line is written out even if it is incomplete.  */
+		write_lines(log, s, s->len);
+		close(s->out);
+		s->out = -1;
+		return;
+	}
+
+	s->len += n;
+
+	const char *const eol = memrchr(s->buf, '\n', s->len);
+
+	if (eol)
+		write_lines(log, s, eol + 1 - s->buf);
+}
+
+static void
+read_signals(void)
+{
+	struct signalfd_siginfo si;
+	unsigned int i;
+
+	while (read(shard_signal_fd, &si, sizeof(si)) == sizeof(si)) {
+		for (i = 0; i < nshards; ++i)
+			kill(shards[i].pid, si.ssi_signo);
+	}
+}
+
+static bool
+all_idle(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < nshards; ++i) {
+		const struct shard *const s = &shards[i];
+
+		if (s->sock >= 0
+		    && (!s->idle || s->idle_adopted != s->adopts_sent))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * The main loop of the coordinator: merge the output of the shards,
+ * forward handoffs, and tell the shards to exit when they are all idle.
+ * Return the exit code of strace: that of shard 0 if it has started
+ * the command, or the lowest one of the shards otherwise.
+ */
+int
+shard_coordinate(FILE *const log)
+{
+	struct pollfd *const fds = xcalloc(2 * nshards + 1, sizeof(*fds));
+	bool exit_sent = false;
+	int exit_code = -1;
+	unsigned int i;
+
+	for (;;) {
+		unsigned int n = 0;
+
+		fds[n++] = (struct pollfd) {
+			.fd = shard_signal_fd, .events = POLLIN
+		};
+		for (i = 0; i < nshards; ++i) {
+			fds[n++] = (struct pollfd) {
+				.fd = shards[i].sock, .events = POLLIN
+			};
+			fds[n++] = (struct pollfd) {
+				.fd = shards[i].out, .events = POLLIN
+			};
+		}
+
+		if (!exit_sent && all_idle()) {
+			const struct shard_msg msg = { .type = SHARD_EXIT };
+
+			for (i = 0; i < nshards; ++i) {
+				if (shards[i].sock >= 0)
+					shard_send(shards[i].sock, &msg,
+						   NULL, 0);
+			}
+			exit_sent = true;
+		}
+
+		bool done = true;
+
+		for (i = 0; i < nshards; ++i) {
+			if (shards[i].sock >= 0 || shards[i].out >= 0)
+				done = false;
+		}
+		if (done)
+			break;
+
+		if (poll(fds, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror_msg_and_die("poll");
+		}
+
+		if (fds[0].revents)
+			read_signals();
+		for (i = 0; i < nshards; ++i) {
+			if (fds[2 * i + 1].revents)
+				read_shard_sock(&shards[i]);
+			if (fds[2 * i + 2].revents)
+				read_shard_out(log, &shards[i]);
+		}
+	}
+
+	free(fds);
+
+	for (i = 0; i < nshards; ++i) {
+		int status, code;
+
+		while (waitpid(shards[i].pid, &status, 0) < 0) {
+			if (errno != EINTR)
+				perror_msg_and_die("waitpid");
+		}
+		free(shards[i].buf);
+
+		code = WIFSIGNALED(status) ? 0x100 | WTERMSIG(status)
+					   : WEXITSTATUS(status);
+		if (shard_command ? !i : exit_code < 0 || code < exit_code)
+			exit_code = code;
+	}
+
+	return exit_code;
+}
@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Trace output to a shared memory ring (-o shm:PATH).
+ *
+ * Each chunk of the output is written as a record into a ring
+ * in a memfd that is passed to a consumer on the same host, see
+ * shm_output.h for the layout and the protocol.  Neither side makes
+ * a system call per chunk unless the other one is waiting for it.
+ * When the ring is full, --output-policy decides whether the tracer
+ * waits for the consumer or the output is dropped; dropped writes are
+ * counted in the ring header and reported on exit.
+ */
+
+#include "defs.h"
+
+#include <limits.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <asm/unistd.h>
+#include <linux/futex.h>
+#include "shm_output.h"
+
+#ifndef MFD_CLOEXEC
+# define MFD_CLOEXEC 1U
+#endif
+
+#if defined HAVE_FOPENCOOKIE && defined __NR_memfd_create
+
+/* The largest --sample rate the sample policy raises the rate to.  */
+# define MAX_SAMPLE_RATE_SCALE 1024
+/* How often the tracer checks the ring while it waits for room.  */
+# define WAIT_INTERVAL_NS 10000000
+
+# define RECORD_SIZE(len_) \
+	(sizeof(struct strace_shm_record) + (((len_) + 7) & ~(uint64_t) 7))
+
+static struct strace_shm_header *hdr;
+static char *ring;
+static uint64_t ring_size;
+static int sock_fd = -1;
+static const char *shm_name;
+static bool consumer_gone;
+static unsigned int base_sample_rate;
+
+static void
+futex_wake(uint32_t *const word)
+{
+	__atomic_add_fetch(word, 1, __ATOMIC_SEQ_CST);
+	syscall(__NR_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Return true if the consumer has closed its end of the connection.  */
+static bool
+check_consumer(void)
+{
+	struct pollfd pfd = { .fd = sock_fd, .events = POLLIN };
+
+	if (!consumer_gone && poll(&pfd, 1, 0) > 0) {
+		consumer_gone = true;
+		error_msg("%s: the consumer is gone, discarding the output",
+			  shm_name);
+	}
+	return consumer_gone;
+}
+
+static uint64_t
+room(const uint64_t head)
+{
+	return ring_size - (head - __atomic_load_n(&hdr->tail,
+						   __ATOMIC_ACQUIRE));
+}
+
+/* Wait for NEED bytes of room, return false if the consumer is gone.  */
+static bool
+wait_for_room(const uint64_t head, const uint64_t need)
+{
+	const struct timespec ts = { 0, WAIT_INTERVAL_NS };
+
+	while (room(head) < need) {
+		if (check_consumer())
+			return false;
+
+		__atomic_store_n(&hdr->producer_waiting, 1, __ATOMIC_SEQ_CST);
+		const uint32_t seq = __atomic_load_n(&hdr->tail_futex,
+						     __ATOMIC_SEQ_CST);
+		if (room(head) < need)
+			syscall(__NR_futex, &hdr->tail_futex, FUTEX_WAIT, seq,
+				&ts, NULL, 0);
+		__atomic_store_n(&hdr->producer_waiting, 0, __ATOMIC_RELAXED);
+	}
+
+	return true;
+}
+
+static void
+put_record(uint64_t *const head, const uint32_t type,
+	   const char *const data, const uint32_t len)
+{
+	struct strace_shm_record *const rec =
+		(void *) (ring + (*head & (ring_size - 1)));
+
+	rec->len = len;
+	rec->type = type;
+	if (data)
+		memcpy(rec + 1, data, len);
+	*head += RECORD_SIZE(len);
+}
+
+static void
+overrun(const size_t len)
+{
+	__atomic_store_n(&hdr->overruns, hdr->overruns + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&hdr->overrun_bytes, hdr->overrun_bytes + len,
+			 __ATOMIC_RELAXED);
+
+	if (output_policy == OUTPUT_POLICY_SAMPLE &&
+	    sample_rate < base_sample_rate * MAX_SAMPLE_RATE_SCALE)
+		sample_rate *= 2;
+}
+
+static ssize_t
+shm_write(void *cookie, const char *data, size_t len)
+{
+	/* Larger writes are split, so that each chunk fits the ring.  */
+	const size_t max_chunk = ring_size / 4;
+	uint64_t head = hdr->head;
+	size_t done = 0;
+
+	if (consumer_gone)
+		return len;
+
+	while (done < len) {
+		const size_t n = MIN(len - done, max_chunk);
+		const uint64_t size = RECORD_SIZE(n);
+		const uint64_t to_end = ring_size - (head & (ring_size - 1));
+		const uint64_t need = size > to_end ? to_end + size : size;
+
+		if (room(head) < need &&
+		    (output_policy != OUTPUT_POLICY_BLOCK ||
+		     !wait_for_room(head, need))) {
+			overrun(len - done);
+			break;
+		}
+
+		if (size > to_end)
+			put_record(&head, STRACE_SHM_PAD, NULL,
+				   to_end - sizeof(struct strace_shm_record));
+		put_record(&head, STRACE_SHM_TEXT, data + done, n);
+		__atomic_store_n(&hdr->head, head, __ATOMIC_RELEASE);
+		done += n;
+	}
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&hdr->consumer_waiting, __ATOMIC_RELAXED))
+		futex_wake(&hdr->head_futex);
+
+	/* Go back to the original rate once the consumer has caught up.  */
+	if (output_policy == OUTPUT_POLICY_SAMPLE &&
+	    sample_rate > base_sample_rate &&
+	    room(head) > ring_size / 4 * 3)
+		sample_rate /= 2;
+
+	return len;
+}
+
+static int
+shm_close(void *cookie)
+{
+	__atomic_store_n(&hdr->closed, 1, __ATOMIC_RELEASE);
+	futex_wake(&hdr->head_futex);
+
+	if (hdr->overruns)
+		error_msg("%" PRIu64 " writes (%" PRIu64 " bytes) of output"
+			  " to %s have been dropped", hdr->overruns,
+			  hdr->overrun_bytes, shm_name);
+
+	munmap(hdr, STRACE_SHM_HEADER_SIZE + ring_size);
+	close(sock_fd);
+	return 0;
+}
+
+/* Pass the memfd to the consumer.  */
+static void
+send_fd(const int fd)
+{
+	union {
+		struct cmsghdr cmsg;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	char byte = 0;
+	struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf),
+	};
+	struct cmsghdr *const cmsg = CMSG_FIRSTHDR(&msg);
+
+	memset(&control, 0, sizeof(control));
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	if (sendmsg(sock_fd, &msg, MSG_NOSIGNAL) != 1)
+		perror_msg_and_die("sendmsg: %s", shm_name);
+}
+
+FILE *
+shm_output_open(const char *const name)
+{
+	static const cookie_io_functions_t shm_funcs = {
+		.write = shm_write,
+		.close = shm_close
+	};
+	FILE *fp;
+	int fd;
+
+	shm_name = name;
+	for (ring_size = 4096; ring_size < output_queue_size; ring_size *= 2)
+		;
+
+	fd = syscall(__NR_memfd_create, "strace", MFD_CLOEXEC);
+	if (fd < 0)
+		perror_msg_and_die("memfd_create");
+	if (ftruncate(fd, STRACE_SHM_HEADER_SIZE + ring_size))
+		perror_msg_and_die("ftruncate");
+	hdr = mmap(NULL, STRACE_SHM_HEADER_SIZE + ring_size,
+		   PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED)
+		perror_msg_and_die("mmap");
+	ring = (char *) hdr + STRACE_SHM_HEADER_SIZE;
+
+	hdr->magic = STRACE_SHM_MAGIC;
+	hdr->version = STRACE_SHM_VERSION;
+	hdr->data_size = ring_size;
+
+	sock_fd = connect_unix(name + 4);
+	send_fd(fd);
+	close(fd);
+	base_sample_rate = sample_rate;
+
+	fp = fopencookie(NULL, "w", shm_funcs);
+	if (!fp)
+		perror_msg_and_die("fopencookie");
+
+	return fp;
+}
+
+#else /* !(HAVE_FOPENCOOKIE && __NR_memfd_create) */
+
+FILE *
+shm_output_open(const char *const name)
+{
+	error_msg_and_die("Output to a shared memory ring is not supported"
+			  " by this build");
+}
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Layout of the shared memory ring of -o shm:PATH.
+ *
+ * strace connects to the unix stream socket PATH, sends a single byte
+ * with the memfd of the ring attached in a SCM_RIGHTS message, and from
+ * then on writes the output into the ring only; the connection is kept
+ * open until strace is done, so each side notices the other one is gone.
+ *
+ * The memfd holds the header, STRACE_SHM_HEADER_SIZE bytes, followed
+ * by data_size bytes of records, data_size is a power of two.  head
+ * and tail count the bytes produced and consumed since the start, the
+ * record at head is at offset head % data_size of the data.
+ *
+ * Each record is a struct strace_shm_record followed by len bytes
+ * of data padded to a multiple of 8 bytes; records never wrap around,
+ * the rest of the data before the end is skipped by a STRACE_SHM_PAD
+ * record.  Each STRACE_SHM_TEXT record holds a chunk of the trace output,
+ * usually a whole line.
+ *
+ * strace writes a record, then stores head with release semantics.
+ * The consumer loads head with acquire semantics, reads the records
+ * up to it in place, then stores tail with release semantics.
+ *
+ * Wakeups are futex-based (shared futexes, not FUTEX_PRIVATE_FLAG).
+ * To wait for data, the consumer sets consumer_waiting, issues a full
+ * memory barrier, loads head_futex, and calls FUTEX_WAIT on head_futex
+ * with that value if head is still equal to tail and closed is not set;
+ * strace increments head_futex and calls FUTEX_WAKE on it after it has
+ * stored head if consumer_waiting is set, and always after it has set
+ * closed.  The same protocol with producer_waiting and tail_futex is used
+ * by strace to wait for room with --output-policy=block, so the consumer
+ * should increment tail_futex and call FUTEX_WAKE on it after it has
+ * stored tail if producer_waiting is set; strace also polls every 10ms.
+ *
+ * Writes that do not fit in the ring are dropped unless --output-policy
+ * is block, they are counted in overruns and overrun_bytes.
+ */
+
+#ifndef STRACE_SHM_OUTPUT_H
+# define STRACE_SHM_OUTPUT_H
+
+# include <stdint.h>
+
+# define STRACE_SHM_MAGIC	0x43525453	/* "STRC" */
+# define STRACE_SHM_VERSION	1
+# define STRACE_SHM_HEADER_SIZE	4096
+
+enum {
+	STRACE_SHM_PAD,
+	STRACE_SHM_TEXT,
+};
+
+struct strace_shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t data_size;
+
+	/* Written by strace.  */
+	uint64_t head __attribute__((aligned(64)));
+	uint64_t overruns;
+	uint64_t overrun_bytes;
+	uint32_t head_futex;
+	uint32_t closed;
+	uint32_t producer_waiting;
+
+	/* Written by the consumer.  */
+	uint64_t tail __attribute__((aligned(64)));
+	uint32_t tail_futex;
+	uint32_t consumer_waiting;
+};
+
+struct strace_shm_record {
+	uint32_t len;
+	uint32_t type;
+};
+
+#endif /* !STRACE_SHM_OUTPUT_H */
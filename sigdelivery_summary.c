@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Signal delivery latency (--summary-sigdelivery option).
+ *
+ * Signals sent by kill, tkill, tgkill, rt_sigqueueinfo, and
+ * rt_tgsigqueueinfo are queued as pending sends on syscall entering,
+ * and matched to the signal-delivery-stops of their receivers by the
+ * sender in si_pid, the signal, and the target thread or process.
+ * The latency is the time from the entering of the sending syscall
+ * to the delivery stop, per sender, receiver, and signal.  A standard
+ * signal that is pending already is not queued again by the kernel,
+ * so the other pending sends of the signal to the same target
+ * are accounted as coalesced when it is delivered.
+ */
+
+#include "defs.h"
+#include "syscall.h"
+#include "latency_hist.h"
+#include "nsig.h"
+
+#ifndef ASM_SIGRTMIN
+# define ASM_SIGRTMIN 32
+#endif
+
+/* The sends to processes that are not traced are never delivered.  */
+#define MAX_PENDING_SENDS 4096
+
+struct sigdelivery_pair {
+	struct sigdelivery_pair *next;
+	int sender, receiver;	/* Thread group ids */
+	unsigned int sig;
+	uint64_t sent, delivered, coalesced;
+	uint64_t time_ns, max_ns;
+	struct latency_hist hist;
+};
+
+struct pending_send {
+	struct pending_send *next;
+	struct sigdelivery_pair *pair;
+	struct timespec ts;	/* Entering of the sending syscall */
+	int sender_tid;
+	int target;		/* Thread id if thread_directed, tgid otherwise */
+	bool thread_directed;
+};
+
+unsigned int summary_sigdelivery;
+static struct sigdelivery_pair *pair_list;
+static unsigned int pair_count;
+static struct pending_send *pending_head, **pending_tail = &pending_head;
+static unsigned int pending_count;
+
+static struct sigdelivery_pair *
+get_pair(const int sender, const int receiver, const unsigned int sig)
+{
+	struct sigdelivery_pair *sp;
+
+	for (sp = pair_list; sp; sp = sp->next) {
+		if (sp->sender == sender && sp->receiver == receiver
+		    && sp->sig == sig)
+			return sp;
+	}
+
+	sp = xcalloc(1, sizeof(*sp));
+	sp->sender = sender;
+	sp->receiver = receiver;
+	sp->sig = sig;
+	sp->next = pair_list;
+	pair_list = sp;
+	++pair_count;
+
+	return sp;
+}
+
+static void
+remove_pending(struct pending_send **const pp)
+{
+	struct pending_send *const ps = *pp;
+
+	*pp = ps->next;
+	if (pending_tail == &ps->next)
+		pending_tail = pp;
+	--pending_count;
+	free(ps);
+}
+
+void
+count_sigdelivery_entry(struct tcb *const tcp)
+{
+	int tgid, target;
+	unsigned int sig;
+	bool thread_directed;
+
+	switch (tcp->s_ent->sen) {
+	case SEN_kill:
+		target = tcp->u_arg[0];
+		sig = tcp->u_arg[1];
+		/* tkill shares the decoder of kill.  */
+		thread_directed = tcp->s_ent->sys_name[0] == 't';
+		tgid = thread_directed ? get_proc_tgid(target) : target;
+		break;
+	case SEN_rt_sigqueueinfo:
+		tgid = target = tcp->u_arg[0];
+		sig = tcp->u_arg[1];
+		thread_directed = false;
+		break;
+	case SEN_tgkill:
+	case SEN_rt_tgsigqueueinfo:
+		tgid = tcp->u_arg[0];
+		target = tcp->u_arg[1];
+		sig = tcp->u_arg[2];
+		thread_directed = true;
+		break;
+	default:
+		return;
+	}
+
+	/* Process groups, signal 0, and invalid signals are not followed.  */
+	if (target <= 0 || tgid <= 0 || !sig || sig >= NSIG)
+		return;
+
+	if (pending_count >= MAX_PENDING_SENDS)
+		remove_pending(&pending_head);
+
+	struct pending_send *const ps = xcalloc(1, sizeof(*ps));
+
+	ps->pair = get_pair(get_tcb_tgid(tcp), tgid, sig);
+	ps->pair->sent++;
+	ps->ts = tcp->etime;
+	ps->sender_tid = tcp->pid;
+	ps->target = target;
+	ps->thread_directed = thread_directed;
+	*pending_tail = ps;
+	pending_tail = &ps->next;
+	++pending_count;
+}
+
+/* A failed send has not generated a signal, forget it.  */
+void
+count_sigdelivery_exit(struct tcb *const tcp)
+{
+	struct pending_send **pp, **last = NULL;
+
+	if (!syserror(tcp))
+		return;
+
+	for (pp = &pending_head; *pp; pp = &(*pp)->next) {
+		if ((*pp)->sender_tid == tcp->pid)
+			last = pp;
+	}
+	if (last) {
+		(*last)->pair->sent--;
+		remove_pending(last);
+	}
+}
+
+static bool
+send_matches(const struct pending_send *const ps, const bool thread_directed,
+	     const int target, const unsigned int sig)
+{
+	return ps->thread_directed == thread_directed && ps->target == target
+	       && ps->pair->sig == sig;
+}
+
+/*
+ * Find the first pending send that is delivered to the thread,
+ * the signals directed to the thread are dequeued first.
+ */
+static struct pending_send **
+find_pending(const int tid, const int tgid, const unsigned int sig,
+	     const int sender, bool *const thread_directed)
+{
+	struct pending_send **pp;
+	unsigned int pass;
+
+	for (pass = 0; pass < 2; ++pass) {
+		*thread_directed = !pass;
+		for (pp = &pending_head; *pp; pp = &(*pp)->next) {
+			if ((*pp)->pair->sender == sender
+			    && send_matches(*pp, *thread_directed,
+					    pass ? tgid : tid, sig))
+				return pp;
+		}
+	}
+
+	return NULL;
+}
+
+/* Account the delivery of a signal, given its siginfo fields.  */
+void
+count_sigdelivery(struct tcb *const tcp, const int sig, const int code,
+		  const int sender)
+{
+	/* Only the signals sent by processes carry the sender.  */
+	if (code > 0 || sender <= 0)
+		return;
+
+	const int tgid = get_tcb_tgid(tcp);
+	bool thread_directed;
+	struct pending_send **const found =
+		find_pending(tcp->pid, tgid, sig, sender, &thread_directed);
+
+	if (!found)
+		return;
+
+	struct sigdelivery_pair *const sp = (*found)->pair;
+	struct timespec now, lat;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts_sub(&lat, &now, &(*found)->ts);
+
+	const uint64_t ns = (uint64_t) lat.tv_sec * 1000000000 + lat.tv_nsec;
+
+	sp->delivered++;
+	sp->time_ns += ns;
+	if (ns > sp->max_ns)
+		sp->max_ns = ns;
+
+	uint32_t *const b = &sp->hist.buckets[hist_bucket(ns)];
+
+	if (*b < UINT32_MAX)
+		++*b;
+
+	remove_pending(found);
+
+	if ((unsigned int) sig >= ASM_SIGRTMIN)
+		return;
+
+	/* The other sends of the standard signal have been merged into it. */
+	const int target = thread_directed ? tcp->pid : tgid;
+	struct pending_send **pp;
+
+	for (pp = &pending_head; *pp;) {
+		if (send_matches(*pp, thread_directed, target, sig)
+		    && ts_cmp(&(*pp)->ts, &now) < 0) {
+			(*pp)->pair->coalesced++;
+			remove_pending(pp);
+		} else {
+			pp = &(*pp)->next;
+		}
+	}
+}
+
+static uint64_t
+sigdelivery_percentile(const struct sigdelivery_pair *const sp,
+		       const unsigned int permille)
+{
+	const uint64_t rank = (sp->delivered * permille + 999) / 1000;
+	uint64_t seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; ++i) {
+		seen += sp->hist.buckets[i];
+		if (seen >= rank) {
+			const uint64_t v = hist_bucket_value(i);
+
+			return v > sp->max_ns ? sp->max_ns : v;
+		}
+	}
+
+	return sp->max_ns;
+}
+
+static int
+sigdelivery_pair_cmp(const void *a, const void *b)
+{
+	const struct sigdelivery_pair *const x =
+		*(const struct sigdelivery_pair **) a;
+	const struct sigdelivery_pair *const y =
+		*(const struct sigdelivery_pair **) b;
+
+	if (x->sent != y->sent)
+		return x->sent < y->sent ? 1 : -1;
+	if (x->sender != y->sender)
+		return x->sender < y->sender ? -1 : 1;
+	if (x->receiver != y->receiver)
+		return x->receiver < y->receiver ? -1 : 1;
+	return (x->sig > y->sig) - (x->sig < y->sig);
+}
+
+/*
+ * Print the sender, receiver, and signal pairs with the most signals
+ * sent, at most summary_sigdelivery of them.
+ */
+void
+sigdelivery_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	struct sigdelivery_pair **sorted;
+	struct sigdelivery_pair *sp;
+	unsigned int i, n = 0;
+
+	if (!pair_count)
+		return;
+
+	sorted = xcalloc(pair_count, sizeof(sorted[0]));
+	for (sp = pair_list; sp; sp = sp->next) {
+		if (sp->sent)
+			sorted[n++] = sp;
+	}
+	sort_top(sorted, n, sizeof(sorted[0]), summary_sigdelivery,
+		 sigdelivery_pair_cmp);
+
+	if (n) {
+		fprintf(outf, "\n%9.9s %9.9s %9.9s %9.9s %9.9s %9.9s"
+			" %7.7s %7.7s %s\n",
+			"sent", "delivered", "coalesced", "p50 usecs",
+			"p99 usecs", "max usecs", "sender", "target",
+			"signal");
+		fprintf(outf, "%9.9s %9.9s %9.9s %9.9s %9.9s %9.9s"
+			" %7.7s %7.7s %s\n",
+			dashes, dashes, dashes, dashes, dashes, dashes,
+			dashes, dashes, dashes);
+	}
+	for (i = 0; i < n && i < summary_sigdelivery; ++i) {
+		sp = sorted[i];
+		fprintf(outf, "%9" PRIu64 " %9" PRIu64 " %9" PRIu64
+			" %9" PRIu64 " %9" PRIu64 " %9" PRIu64
+			" %7d %7d %s\n",
+			sp->sent, sp->delivered, sp->coalesced,
+			sigdelivery_percentile(sp, 500) / 1000,
+			sigdelivery_percentile(sp, 990) / 1000,
+			sp->max_ns / 1000, sp->sender, sp->receiver,
+			signame(sp->sig));
+	}
+
+	free(sorted);
+}
@@ -34,6 +34,7 @@
 
 #include "defs.h"
 #include "nsig.h"
+#include "selfprof.h"
 
 /* The libc headers do not define this constant since it should only be
    used by the implementation.  So we define it here.  */
@@ -165,6 +166,64 @@ popcount32(const uint32_t *a, unsigned int size)
 	return count;
 }
 
+/*
+ * Formatted signal masks, looked up by their words.  The same few masks
+ * are printed over and over by the rt_sigprocmask calls of threading
+ * runtimes, so a small direct mapped cache catches most of them.
+ */
+#define SIGMASK_CACHE_SIZE 64
+
+struct sigmask_cache_entry {
+	uint32_t mask[NSIG_BYTES / 4];
+	unsigned int size;	/* in 4-byte words, 0 means the entry is free */
+	unsigned int personality;
+	char *str;
+};
+
+static struct sigmask_cache_entry sigmask_cache[SIGMASK_CACHE_SIZE];
+
+static struct sigmask_cache_entry *
+sigmask_cache_lookup(const uint32_t *const mask, const unsigned int size)
+{
+	uint32_t hash = current_personality;
+	unsigned int j;
+
+	for (j = 0; j < size; ++j)
+		hash = hash * 31 + mask[j];
+	hash ^= hash >> 16;
+	hash ^= hash >> 8;
+
+	return &sigmask_cache[hash % SIGMASK_CACHE_SIZE];
+}
+
+static bool
+sigmask_cache_match(const struct sigmask_cache_entry *const e,
+		    const uint32_t *const mask, const unsigned int size)
+{
+	return e->size == size && e->personality == current_personality &&
+	       !memcmp(e->mask, mask, size * sizeof(mask[0]));
+}
+
+static void
+sigmask_cache_store(struct sigmask_cache_entry *const e,
+		    const uint32_t *const mask, const unsigned int size,
+		    const char *const str)
+{
+	const size_t len = strlen(str);
+
+	if (e->size) {
+		selfprof_cache_add(SELFPROF_CACHE_SIGMASKS, -1,
+				   -(long) (strlen(e->str) + 1));
+		free(e->str);
+	}
+
+	memcpy(e->mask, mask, size * sizeof(mask[0]));
+	e->size = size;
+	e->personality = current_personality;
+	e->str = xstrdup(str);
+	selfprof_cache_add(SELFPROF_CACHE_SIGMASKS, 1, len + 1);
+}
+
 const char *
 sprintsigmask_n(const char *prefix, const void *sig_mask, unsigned int bytes)
 {
@@ -178,18 +237,26 @@ sprintsigmask_n(const char *prefix, const void *sig_mask, unsigned int bytes)
 	static char outstr[128 + 8 * (NSIG_BYTES * 8 * 2 / 3)];
 
 	char *s;
+	char *str;
 	const uint32_t *mask;
 	uint32_t inverted_mask[NSIG_BYTES / 4];
+	struct sigmask_cache_entry *e;
 	unsigned int size;
 	int i;
 	char sep;
 
-	s = stpcpy(outstr, prefix);
+	str = s = stpcpy(outstr, prefix);
 
 	mask = sig_mask;
 	/* length of signal mask in 4-byte words */
 	size = (bytes >= NSIG_BYTES) ? NSIG_BYTES / 4 : (bytes + 3) / 4;
 
+	e = sigmask_cache_lookup(mask, size);
+	if (sigmask_cache_match(e, mask, size)) {
+		strcpy(s, e->str);
+		return outstr;
+	}
+
 	/* check whether 2/3 or more bits are set */
 	if (popcount32(mask, size) >= size * (4 * 8) * 2 / 3) {
 		/* show those signals that are NOT in the mask */
@@ -221,6 +288,8 @@ sprintsigmask_n(const char *prefix, const void *sig_mask, unsigned int bytes)
 		*s++ = sep;
 	*s++ = ']';
 	*s = '\0';
+
+	sigmask_cache_store(e, sig_mask, size, str);
 	return outstr;
 }
 
@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Trace output to a socket (-o unix:PATH and -o tcp:HOST:PORT).
+ *
+ * The output stream appends the data to a bounded queue that a writer
+ * thread sends to the socket, so a slow consumer stalls the tracer only
+ * when the queue is full, and then only with the block policy of
+ * --output-policy: the drop policy discards the output that does not fit,
+ * the sample policy also raises the --sample rate of the tracer until
+ * the queue drains.
+ */
+
+#include "defs.h"
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+output_policy_t output_policy = OUTPUT_POLICY_BLOCK;
+size_t output_queue_size = 1024 * 1024;
+
+/*
+ * Whether the output goes to a consumer connected through a socket,
+ * including -o shm:PATH.
+ */
+bool
+is_socket_output(const char *const name)
+{
+	return !strncmp(name, "unix:", 5) || !strncmp(name, "tcp:", 4)
+	       || !strncmp(name, "shm:", 4);
+}
+
+#ifdef HAVE_FOPENCOOKIE
+
+/* The largest --sample rate the sample policy raises the rate to.  */
+# define MAX_SAMPLE_RATE_SCALE 1024
+
+static char *queue;
+static size_t queue_head;	/* Offset of the first byte to send */
+static size_t queue_len;	/* Bytes queued */
+static bool closing;
+static int send_errno;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_not_full = PTHREAD_COND_INITIALIZER;
+static pthread_t writer;
+static int sock_fd = -1;
+static const char *sock_name;
+
+static uint64_t dropped_writes, dropped_bytes;
+static bool send_error_reported;
+static unsigned int base_sample_rate;
+
+int
+connect_unix(const char *const path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	const size_t len = strlen(path);
+
+	if (len >= sizeof(addr.sun_path))
+		error_msg_and_die("Socket path is too long: %s", path);
+	memcpy(addr.sun_path, path, len);
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if (fd < 0)
+		perror_msg_and_die("socket");
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)))
+		perror_msg_and_die("connect: %s", path);
+
+	return fd;
+}
+
+/* Connect to HOST:PORT, HOST may be an IPv6 address in brackets.  */
+static int
+connect_tcp(const char *const spec)
+{
+	const char *const colon = strrchr(spec, ':');
+
+	if (!colon || colon == spec || !colon[1])
+		error_msg_and_die("Invalid output address tcp:%s,"
+				  " HOST:PORT expected", spec);
+
+	char *host = xstrndup(spec, colon - spec);
+	const char *const port = colon + 1;
+	const size_t host_len = strlen(host);
+
+	if (host[0] == '[' && host[host_len - 1] == ']') {
+		host[host_len - 1] = '\0';
+		memmove(host, host + 1, host_len - 1);
+	}
+
+	const struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+	};
+	struct addrinfo *res, *ai;
+	int rc = getaddrinfo(host, port, &hints, &res);
+	int fd = -1;
+
+	if (rc)
+		error_msg_and_die("getaddrinfo: %s: %s", spec,
+				  gai_strerror(rc));
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+			    ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (!connect(fd, ai->ai_addr, ai->ai_addrlen))
+			break;
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0)
+		perror_msg_and_die("connect: %s", spec);
+
+	freeaddrinfo(res);
+	free(host);
+	return fd;
+}
+
+static void *
+writer_thread(void *arg)
+{
+	pthread_mutex_lock(&queue_lock);
+
+	for (;;) {
+		while (!queue_len && !closing)
+			pthread_cond_wait(&queue_not_empty, &queue_lock);
+		if (!queue_len)
+			break;
+
+		const size_t len = MIN(queue_len,
+				       output_queue_size - queue_head);
+		const char *const data = queue + queue_head;
+
+		pthread_mutex_unlock(&queue_lock);
+		const ssize_t n = send(sock_fd, data, len, MSG_NOSIGNAL);
+		const int err = errno;
+		pthread_mutex_lock(&queue_lock);
+
+		if (n < 0 && err == EINTR)
+			continue;
+		if (n <= 0) {
+			/* The consumer is gone, discard the output.  */
+			send_errno = n < 0 ? err : EPIPE;
+			queue_len = 0;
+			pthread_cond_broadcast(&queue_not_full);
+			break;
+		}
+
+		queue_head = (queue_head + n) % output_queue_size;
+		queue_len -= n;
+		pthread_cond_broadcast(&queue_not_full);
+	}
+
+	pthread_mutex_unlock(&queue_lock);
+	return NULL;
+}
+
+/* Append to the queue, the caller ensures there is room for LEN bytes.  */
+static void
+enqueue(const char *const data, const size_t len)
+{
+	const size_t tail = (queue_head + queue_len) % output_queue_size;
+	const size_t first = MIN(len, output_queue_size - tail);
+
+	memcpy(queue + tail, data, first);
+	memcpy(queue, data + first, len - first);
+	queue_len += len;
+	pthread_cond_signal(&queue_not_empty);
+}
+
+/* Handle a write that does not fit the queue according to the policy.  */
+static void
+overflow(const char *const data, const size_t len)
+{
+	if (output_policy == OUTPUT_POLICY_BLOCK) {
+		size_t done = 0;
+
+		while (done < len && !send_errno) {
+			while (queue_len == output_queue_size && !send_errno)
+				pthread_cond_wait(&queue_not_full, &queue_lock);
+
+			const size_t n = MIN(len - done,
+					     output_queue_size - queue_len);
+			enqueue(data + done, n);
+			done += n;
+		}
+		return;
+	}
+
+	++dropped_writes;
+	dropped_bytes += len;
+
+	if (output_policy == OUTPUT_POLICY_SAMPLE &&
+	    sample_rate < base_sample_rate * MAX_SAMPLE_RATE_SCALE)
+		sample_rate *= 2;
+}
+
+static ssize_t
+socket_write(void *cookie, const char *data, size_t len)
+{
+	pthread_mutex_lock(&queue_lock);
+
+	if (send_errno) {
+		const int err = send_errno;
+
+		pthread_mutex_unlock(&queue_lock);
+		if (!send_error_reported) {
+			send_error_reported = true;
+			errno = err;
+			perror_msg("send: %s, discarding the output", sock_name);
+		}
+		return len;
+	}
+
+	if (len <= output_queue_size - queue_len)
+		enqueue(data, len);
+	else
+		overflow(data, len);
+
+	/* Go back to the original rate once the consumer has caught up.  */
+	if (output_policy == OUTPUT_POLICY_SAMPLE &&
+	    sample_rate > base_sample_rate &&
+	    queue_len < output_queue_size / 4)
+		sample_rate /= 2;
+
+	pthread_mutex_unlock(&queue_lock);
+	return len;
+}
+
+static int
+socket_close(void *cookie)
+{
+	pthread_mutex_lock(&queue_lock);
+	closing = true;
+	pthread_cond_signal(&queue_not_empty);
+	pthread_mutex_unlock(&queue_lock);
+
+	pthread_join(writer, NULL);
+	close(sock_fd);
+	free(queue);
+
+	if (dropped_writes)
+		error_msg("%" PRIu64 " writes (%" PRIu64 " bytes) of output"
+			  " to %s have been dropped", dropped_writes,
+			  dropped_bytes, sock_name);
+	return 0;
+}
+
+FILE *
+socket_output_open(const char *const name)
+{
+	static const cookie_io_functions_t socket_funcs = {
+		.write = socket_write,
+		.close = socket_close
+	};
+	sigset_t all, saved;
+	FILE *fp;
+	int rc;
+
+	sock_name = name;
+	sock_fd = name[0] == 'u' ? connect_unix(name + 5)
+				 : connect_tcp(name + 4);
+	queue = xmalloc(output_queue_size);
+	base_sample_rate = sample_rate;
+
+	/* Signals are handled by the tracer thread only.  */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &saved);
+	rc = pthread_create(&writer, NULL, writer_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	if (rc) {
+		errno = rc;
+		perror_msg_and_die("pthread_create");
+	}
+
+	fp = fopencookie(NULL, "w", socket_funcs);
+	if (!fp)
+		perror_msg_and_die("fopencookie");
+
+	return fp;
+}
+
+#else /* !HAVE_FOPENCOOKIE */
+
+FILE *
+socket_output_open(const char *const name)
+{
+	error_msg_and_die("Output to a socket is not supported"
+			  " by this build");
+}
+
+#endif /* HAVE_FOPENCOOKIE */
@@ -28,6 +28,7 @@
  */
 
 #include "defs.h"
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -42,35 +43,241 @@
 #endif
 
 #include <sys/un.h>
+#include "selfprof.h"
+#include "strintern.h"
 #ifndef UNIX_PATH_MAX
 # define UNIX_PATH_MAX sizeof(((struct sockaddr_un *) 0)->sun_path)
 #endif
 
-typedef struct {
+/*
+ * Socket details are obtained from full NETLINK_SOCK_DIAG dumps of each
+ * protocol and kept in a hash table indexed by inode number.  A dump is
+ * requested on a lookup miss only; every dump refreshes the details of all
+ * sockets of its protocol and drops those that no longer exist.
+ *
+ * The entries are also kept in a list ordered by their last use,
+ * so that the least recently used ones are dropped when the cache
+ * is over its --cache-limit.
+ */
+
+typedef struct inode_entry {
+	struct inode_entry *next;
+	struct inode_entry *lru_prev;	/* More recently used */
+	struct inode_entry *lru_next;	/* Less recently used */
 	unsigned long inode;
-	char *details;
-} cache_entry;
+	const char *details;	/* interned */
+	enum sock_proto proto;
+	unsigned int dump_gen;	/* Generation of the dump that filled it */
+} inode_entry;
+
+static inode_entry **inode_hash;
+static unsigned int inode_hash_size;
+static unsigned int inode_hash_count;
+static inode_entry *lru_head, *lru_tail;
+
+static unsigned int dump_gen[SOCK_PROTO_NETLINK + 1];
+
+/* The NETLINK_SOCK_DIAG socket, opened on demand and kept open. */
+static int diag_fd = -1;
+
+/*
+ * While a list of descriptors is printed, each protocol is dumped
+ * at most once: sockets that are missing from the dump of their protocol,
+ * like unbound unconnected unix sockets, would otherwise cost a dump each.
+ */
+static unsigned int batch_depth;
+static bool batch_dumped[SOCK_PROTO_NETLINK + 1];
+
+static inode_entry **
+inode_hash_bucket(const unsigned long inode)
+{
+	return &inode_hash[inode & (inode_hash_size - 1)];
+}
+
+static inode_entry *
+inode_hash_find(const unsigned long inode)
+{
+	inode_entry *e;
+
+	if (!inode_hash_size)
+		return NULL;
+
+	for (e = *inode_hash_bucket(inode); e; e = e->next)
+		if (e->inode == inode)
+			return e;
+
+	return NULL;
+}
+
+static void
+lru_unlink(inode_entry *const e)
+{
+	if (e->lru_prev)
+		e->lru_prev->lru_next = e->lru_next;
+	else
+		lru_head = e->lru_next;
+	if (e->lru_next)
+		e->lru_next->lru_prev = e->lru_prev;
+	else
+		lru_tail = e->lru_prev;
+}
+
+static void
+lru_push(inode_entry *const e)
+{
+	e->lru_prev = NULL;
+	e->lru_next = lru_head;
+	if (lru_head)
+		lru_head->lru_prev = e;
+	else
+		lru_tail = e;
+	lru_head = e;
+}
+
+static void
+lru_touch(inode_entry *const e)
+{
+	if (e != lru_head) {
+		lru_unlink(e);
+		lru_push(e);
+	}
+}
+
+static void
+free_inode_entry(inode_entry *const e)
+{
+	lru_unlink(e);
+	str_intern_release(e->details);
+	free(e);
+	--inode_hash_count;
+	selfprof_cache_add(SELFPROF_CACHE_SOCKET_INODES, -1,
+			   -(long) sizeof(*e));
+}
+
+static void
+inode_hash_expand(void)
+{
+	inode_entry **const old_hash = inode_hash;
+	const unsigned int old_size = inode_hash_size;
+	unsigned int i;
+
+	inode_hash_size = old_size ? old_size * 2 : 1024;
+	inode_hash = xcalloc(inode_hash_size, sizeof(inode_hash[0]));
+	selfprof_cache_add(SELFPROF_CACHE_SOCKET_INODES, 0,
+			   (long) (inode_hash_size - old_size)
+			   * sizeof(inode_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		inode_entry *e, *next;
+
+		for (e = old_hash[i]; e; e = next) {
+			inode_entry **const b = inode_hash_bucket(e->inode);
 
-#define CACHE_SIZE 1024U
-static cache_entry cache[CACHE_SIZE];
-#define CACHE_MASK (CACHE_SIZE - 1)
+			next = e->next;
+			e->next = *b;
+			*b = e;
+		}
+	}
+
+	free(old_hash);
+}
 
 static int
-cache_inode_details(const unsigned long inode, char *const details)
+cache_inode_details(const unsigned long inode, const enum sock_proto proto,
+		    char *const details)
 {
-	cache_entry *e = &cache[inode & CACHE_MASK];
-	free(e->details);
-	e->inode = inode;
-	e->details = details;
+	inode_entry *e = inode_hash_find(inode);
+	const char *const interned = str_intern(details);
+
+	free(details);
+
+	if (e) {
+		str_intern_release(e->details);
+		lru_touch(e);
+	} else {
+		if (inode_hash_count >= inode_hash_size)
+			inode_hash_expand();
+
+		inode_entry **const b = inode_hash_bucket(inode);
+
+		e = xmalloc(sizeof(*e));
+		e->inode = inode;
+		e->next = *b;
+		*b = e;
+		++inode_hash_count;
+		lru_push(e);
+		selfprof_cache_add(SELFPROF_CACHE_SOCKET_INODES, 1,
+				   sizeof(*e));
+	}
+
+	e->details = interned;
+	e->proto = proto;
+	e->dump_gen = dump_gen[proto];
 
 	return 1;
 }
 
+static bool
+is_stale(const inode_entry *const e, const enum sock_proto proto)
+{
+	return e->proto == proto && e->dump_gen != dump_gen[proto];
+}
+
+static bool
+is_evictable(const inode_entry *const e, const enum sock_proto proto)
+{
+	return selfprof_cache_over_limit(SELFPROF_CACHE_SOCKET_INODES) &&
+	       (e->proto != proto || e->dump_gen != dump_gen[proto]);
+}
+
+/*
+ * Drop entries of the given protocol that were not refreshed by
+ * the latest dump, then the least recently used entries while the cache
+ * is over its limit.  The entries filled by the latest dump are kept,
+ * the socket that caused the dump is among them.
+ */
+static void
+purge_inode_hash(const enum sock_proto proto)
+{
+	unsigned int i;
+
+	for (i = 0; i < inode_hash_size; ++i) {
+		inode_entry **pe = &inode_hash[i];
+
+		while (*pe) {
+			inode_entry *const e = *pe;
+
+			if (is_stale(e, proto)) {
+				*pe = e->next;
+				free_inode_entry(e);
+			} else {
+				pe = &e->next;
+			}
+		}
+	}
+
+	while (lru_tail && is_evictable(lru_tail, proto)) {
+		inode_entry *const e = lru_tail;
+		inode_entry **pe = inode_hash_bucket(e->inode);
+
+		while (*pe != e)
+			pe = &(*pe)->next;
+		*pe = e->next;
+		free_inode_entry(e);
+		selfprof_cache_evicted(SELFPROF_CACHE_SOCKET_INODES);
+	}
+}
+
 static const char *
 get_sockaddr_by_inode_cached(const unsigned long inode)
 {
-	const cache_entry *const e = &cache[inode & CACHE_MASK];
-	return (e && inode == e->inode) ? e->details : NULL;
+	inode_entry *const e = inode_hash_find(inode);
+
+	if (!e)
+		return NULL;
+
+	lru_touch(e);
+	return e->details;
 }
 
 static bool
@@ -134,7 +341,7 @@ inet_send_query(const int fd, const int family, const int proto)
 
 static int
 inet_parse_response(const void *const data, const int data_len,
-		    const unsigned long inode, void *opaque_data)
+		    const unsigned long proto, void *opaque_data)
 {
 	const char *const proto_name = opaque_data;
 	const struct inet_diag_msg *const diag_msg = data;
@@ -143,8 +350,6 @@ inet_parse_response(const void *const data, const int data_len,
 
 	if (data_len < (int) NLMSG_LENGTH(sizeof(*diag_msg)))
 		return -1;
-	if (diag_msg->idiag_inode != inode)
-		return 0;
 
 	switch (diag_msg->idiag_family) {
 		case AF_INET:
@@ -184,11 +389,16 @@ inet_parse_response(const void *const data, const int data_len,
 			return false;
 	}
 
-	return cache_inode_details(inode, details);
+	return cache_inode_details(diag_msg->idiag_inode, proto, details);
 }
 
+/*
+ * Receive a dump and pass each message to the parser.
+ * Messages the parser fails to handle are skipped, the dump is always
+ * read up to its end so that the socket can be used for the next query.
+ */
 static bool
-receive_responses(const int fd, const unsigned long inode,
+receive_responses(const int fd, const unsigned long arg,
 		  const unsigned long expected_msg_type,
 		  int (*parser)(const void *, int,
 				unsigned long, void *),
@@ -206,7 +416,6 @@ receive_responses(const int fd, const unsigned long inode,
 		.iov_base = hdr_buf.buf,
 		.iov_len = sizeof(hdr_buf.buf)
 	};
-	int flags = 0;
 
 	for (;;) {
 		struct msghdr msg = {
@@ -216,7 +425,7 @@ receive_responses(const int fd, const unsigned long inode,
 			.msg_iovlen = 1
 		};
 
-		ssize_t ret = recvmsg(fd, &msg, flags);
+		ssize_t ret = recvmsg(fd, &msg, 0);
 		if (ret < 0) {
 			if (errno == EINTR)
 				continue;
@@ -227,21 +436,17 @@ receive_responses(const int fd, const unsigned long inode,
 		if (!NLMSG_OK(h, ret))
 			return false;
 		for (; NLMSG_OK(h, ret); h = NLMSG_NEXT(h, ret)) {
-			if (h->nlmsg_type != expected_msg_type)
-				return false;
-			const int rc = parser(NLMSG_DATA(h),
-					      h->nlmsg_len, inode, opaque_data);
-			if (rc > 0)
+			if (h->nlmsg_type == NLMSG_DONE)
 				return true;
-			if (rc < 0)
+			if (h->nlmsg_type != expected_msg_type)
 				return false;
+			parser(NLMSG_DATA(h), h->nlmsg_len, arg, opaque_data);
 		}
-		flags = MSG_DONTWAIT;
 	}
 }
 
 static bool
-unix_send_query(const int fd, const unsigned long inode)
+unix_send_query(const int fd)
 {
 	struct {
 		const struct nlmsghdr nlh;
@@ -254,7 +459,6 @@ unix_send_query(const int fd, const unsigned long inode)
 		},
 		.udr = {
 			.sdiag_family = AF_UNIX,
-			.udiag_ino = inode,
 			.udiag_states = -1,
 			.udiag_show = UDIAG_SHOW_NAME | UDIAG_SHOW_PEER
 		}
@@ -264,7 +468,7 @@ unix_send_query(const int fd, const unsigned long inode)
 
 static int
 unix_parse_response(const void *data, const int data_len,
-		    const unsigned long inode, void *opaque_data)
+		    const unsigned long proto, void *opaque_data)
 {
 	const char *proto_name = opaque_data;
 	const struct unix_diag_msg *diag_msg = data;
@@ -276,8 +480,8 @@ unix_parse_response(const void *data, const int data_len,
 
 	if (rta_len < 0)
 		return -1;
-	if (diag_msg->udiag_ino != inode)
-		return 0;
+
+	const unsigned long inode = diag_msg->udiag_ino;
 	if (diag_msg->udiag_family != AF_UNIX)
 		return -1;
 
@@ -337,11 +541,11 @@ unix_parse_response(const void *data, const int data_len,
 		     peer_str, path_str) < 0)
 		return -1;
 
-	return cache_inode_details(inode, details);
+	return cache_inode_details(inode, proto, details);
 }
 
 static bool
-netlink_send_query(const int fd, const unsigned long inode)
+netlink_send_query(const int fd)
 {
 	struct {
 		const struct nlmsghdr nlh;
@@ -363,7 +567,7 @@ netlink_send_query(const int fd, const unsigned long inode)
 
 static int
 netlink_parse_response(const void *data, const int data_len,
-		       const unsigned long inode, void *opaque_data)
+		       const unsigned long proto, void *opaque_data)
 {
 	const char *proto_name = opaque_data;
 	const struct netlink_diag_msg *const diag_msg = data;
@@ -372,8 +576,6 @@ netlink_parse_response(const void *data, const int data_len,
 
 	if (data_len < (int) NLMSG_LENGTH(sizeof(*diag_msg)))
 		return -1;
-	if (diag_msg->ndiag_ino != inode)
-		return 0;
 
 	if (diag_msg->ndiag_family != AF_NETLINK)
 		return -1;
@@ -392,71 +594,69 @@ netlink_parse_response(const void *data, const int data_len,
 			return -1;
 	}
 
-	return cache_inode_details(inode, details);
+	return cache_inode_details(diag_msg->ndiag_ino, proto, details);
 }
 
-static const char *
-unix_get(const int fd, const unsigned long inode)
+static bool
+unix_dump(const int fd)
 {
-	return unix_send_query(fd, inode)
-		&& receive_responses(fd, inode, SOCK_DIAG_BY_FAMILY,
-				     unix_parse_response, (void *) "UNIX")
-		? get_sockaddr_by_inode_cached(inode) : NULL;
+	return unix_send_query(fd)
+		&& receive_responses(fd, SOCK_PROTO_UNIX, SOCK_DIAG_BY_FAMILY,
+				     unix_parse_response, (void *) "UNIX");
 }
 
-static const char *
-inet_get(const int fd, const int family, const int protocol,
-	 const unsigned long inode, const char *proto_name)
+static bool
+inet_dump(const int fd, const int family, const int protocol,
+	  const enum sock_proto proto, const char *proto_name)
 {
 	return inet_send_query(fd, family, protocol)
-		&& receive_responses(fd, inode, SOCK_DIAG_BY_FAMILY,
-				     inet_parse_response, (void *) proto_name)
-		? get_sockaddr_by_inode_cached(inode) : NULL;
+		&& receive_responses(fd, proto, SOCK_DIAG_BY_FAMILY,
+				     inet_parse_response, (void *) proto_name);
 }
 
-static const char *
-tcp_v4_get(const int fd, const unsigned long inode)
+static bool
+tcp_v4_dump(const int fd)
 {
-	return inet_get(fd, AF_INET, IPPROTO_TCP, inode, "TCP");
+	return inet_dump(fd, AF_INET, IPPROTO_TCP, SOCK_PROTO_TCP, "TCP");
 }
 
-static const char *
-udp_v4_get(const int fd, const unsigned long inode)
+static bool
+udp_v4_dump(const int fd)
 {
-	return inet_get(fd, AF_INET, IPPROTO_UDP, inode, "UDP");
+	return inet_dump(fd, AF_INET, IPPROTO_UDP, SOCK_PROTO_UDP, "UDP");
 }
 
-static const char *
-tcp_v6_get(const int fd, const unsigned long inode)
+static bool
+tcp_v6_dump(const int fd)
 {
-	return inet_get(fd, AF_INET6, IPPROTO_TCP, inode, "TCPv6");
+	return inet_dump(fd, AF_INET6, IPPROTO_TCP, SOCK_PROTO_TCPv6, "TCPv6");
 }
 
-static const char *
-udp_v6_get(const int fd, const unsigned long inode)
+static bool
+udp_v6_dump(const int fd)
 {
-	return inet_get(fd, AF_INET6, IPPROTO_UDP, inode, "UDPv6");
+	return inet_dump(fd, AF_INET6, IPPROTO_UDP, SOCK_PROTO_UDPv6, "UDPv6");
 }
 
-static const char *
-netlink_get(const int fd, const unsigned long inode)
+static bool
+netlink_dump(const int fd)
 {
-	return netlink_send_query(fd, inode)
-		&& receive_responses(fd, inode, SOCK_DIAG_BY_FAMILY,
-				     netlink_parse_response, (void *) "NETLINK")
-		? get_sockaddr_by_inode_cached(inode) : NULL;
+	return netlink_send_query(fd)
+		&& receive_responses(fd, SOCK_PROTO_NETLINK,
+				     SOCK_DIAG_BY_FAMILY,
+				     netlink_parse_response, (void *) "NETLINK");
 }
 
 static const struct {
 	const char *const name;
-	const char * (*const get)(int, unsigned long);
+	bool (*const dump)(int);
 } protocols[] = {
-	[SOCK_PROTO_UNIX] = { "UNIX", unix_get },
-	[SOCK_PROTO_TCP] = { "TCP", tcp_v4_get },
-	[SOCK_PROTO_UDP] = { "UDP", udp_v4_get },
-	[SOCK_PROTO_TCPv6] = { "TCPv6", tcp_v6_get },
-	[SOCK_PROTO_UDPv6] = { "UDPv6", udp_v6_get },
-	[SOCK_PROTO_NETLINK] = { "NETLINK", netlink_get }
+	[SOCK_PROTO_UNIX] = { "UNIX", unix_dump },
+	[SOCK_PROTO_TCP] = { "TCP", tcp_v4_dump },
+	[SOCK_PROTO_UDP] = { "UDP", udp_v4_dump },
+	[SOCK_PROTO_TCPv6] = { "TCPv6", tcp_v6_dump },
+	[SOCK_PROTO_UDPv6] = { "UDPv6", udp_v6_dump },
+	[SOCK_PROTO_NETLINK] = { "NETLINK", netlink_dump }
 };
 
 enum sock_proto
@@ -471,35 +671,67 @@ get_proto_by_name(const char *const name)
 	return SOCK_PROTO_UNKNOWN;
 }
 
+static int
+get_diag_fd(void)
+{
+	if (diag_fd < 0) {
+		diag_fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_SOCK_DIAG);
+		if (diag_fd >= 0)
+			fcntl(diag_fd, F_SETFD, FD_CLOEXEC);
+	}
+
+	return diag_fd;
+}
+
+static bool
+dump_proto(const enum sock_proto proto)
+{
+	if (batch_depth) {
+		if (batch_dumped[proto])
+			return true;
+		batch_dumped[proto] = true;
+	}
+
+	const int fd = get_diag_fd();
+	if (fd < 0)
+		return false;
+
+	++dump_gen[proto];
+	if (!protocols[proto].dump(fd)) {
+		/* The rest of the dump might be still queued. */
+		close(diag_fd);
+		diag_fd = -1;
+		return false;
+	}
+
+	purge_inode_hash(proto);
+	return true;
+}
+
 static const char *
 get_sockaddr_by_inode_uncached(const unsigned long inode,
 			       const enum sock_proto proto)
 {
 	if ((unsigned int) proto >= ARRAY_SIZE(protocols) ||
-	    (proto != SOCK_PROTO_UNKNOWN && !protocols[proto].get))
-		return NULL;
-
-	const int fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_SOCK_DIAG);
-	if (fd < 0)
+	    (proto != SOCK_PROTO_UNKNOWN && !protocols[proto].dump))
 		return NULL;
-	const char *details = NULL;
 
 	if (proto != SOCK_PROTO_UNKNOWN) {
-		details = protocols[proto].get(fd, inode);
+		if (!dump_proto(proto))
+			return NULL;
 	} else {
 		unsigned int i;
 		for (i = (unsigned int) SOCK_PROTO_UNKNOWN + 1;
 		     i < ARRAY_SIZE(protocols); ++i) {
-			if (!protocols[i].get)
+			if (!protocols[i].dump)
 				continue;
-			details = protocols[i].get(fd, inode);
-			if (details)
+			if (dump_proto(i) &&
+			    get_sockaddr_by_inode_cached(inode))
 				break;
 		}
 	}
 
-	close(fd);
-	return details;
+	return get_sockaddr_by_inode_cached(inode);
 }
 
 static bool
@@ -522,6 +754,23 @@ print_sockaddr_by_inode_uncached(const unsigned long inode,
 	return false;
 }
 
+/*
+ * Start printing a list of descriptors, the socket details of the list
+ * are looked up with at most one dump of each protocol.
+ */
+void
+printfd_batch_begin(void)
+{
+	++batch_depth;
+}
+
+void
+printfd_batch_end(void)
+{
+	if (!--batch_depth)
+		memset(batch_dumped, 0, sizeof(batch_dumped));
+}
+
 /* Given an inode number of a socket, return its protocol details.  */
 const char *
 get_sockaddr_by_inode(struct tcb *const tcp, const int fd,
@@ -549,8 +798,65 @@ print_sockaddr_by_inode(struct tcb *const tcp, const int fd,
  * numbers of msg types used in the protocol are not defined
  * statically. Kernel defines them on demand.  So the xlat converted
  * from header files doesn't help for decoding the protocol. Following
- * codes are building xlat(dyxlat) at runtime.
+ * codes are building a hash table of family ids at runtime, it is
+ * refreshed when an unknown id is seen, at most once a second,
+ * so families registered after the first lookup are decoded too.
  */
+
+struct genl_family {
+	uint16_t id;
+	char *name;	/* NULL if the slot is free */
+};
+
+static struct genl_family *genl_families;
+static unsigned int genl_families_size;	/* Power of 2 */
+static unsigned int genl_families_used;
+
+static struct genl_family *
+genl_family_slot(struct genl_family *const table, const unsigned int size,
+		 const uint16_t id)
+{
+	unsigned int i = (id * 0x9e3779b1U) & (size - 1);
+
+	while (table[i].name && table[i].id != id)
+		i = (i + 1) & (size - 1);
+
+	return &table[i];
+}
+
+static void
+genl_family_add(const uint16_t id, const char *const name, const size_t len)
+{
+	if (genl_families_used * 4 >= genl_families_size * 3) {
+		const unsigned int size =
+			genl_families_size ? genl_families_size * 2 : 64;
+		struct genl_family *const table = xcalloc(size, sizeof(*table));
+		unsigned int i;
+
+		for (i = 0; i < genl_families_size; ++i) {
+			if (genl_families[i].name)
+				*genl_family_slot(table, size,
+						  genl_families[i].id) =
+					genl_families[i];
+		}
+		free(genl_families);
+		genl_families = table;
+		genl_families_size = size;
+	}
+
+	struct genl_family *const f =
+		genl_family_slot(genl_families, genl_families_size, id);
+
+	if (f->name) {
+		if (!strncmp(f->name, name, len) && !f->name[len])
+			return;
+		free(f->name);
+	} else {
+		++genl_families_used;
+	}
+	f->id = id;
+	f->name = xstrndup(name, len);
+}
 static bool
 genl_send_dump_families(const int fd)
 {
@@ -575,7 +881,6 @@ genl_parse_families_response(const void *const data,
 			     const int data_len, const unsigned long inode,
 			     void *opaque_data)
 {
-	struct dyxlat *const dyxlat = opaque_data;
 	const struct genlmsghdr *const gnlh = data;
 	struct rtattr *attr;
 	int rta_len = data_len - NLMSG_LENGTH(sizeof(*gnlh));
@@ -608,7 +913,7 @@ genl_parse_families_response(const void *const data,
 		}
 
 		if (name && id) {
-			dyxlat_add_pair(dyxlat, *id, name, name_len);
+			genl_family_add(*id, name, name_len);
 			name = NULL;
 			id = NULL;
 		}
@@ -617,32 +922,52 @@ genl_parse_families_response(const void *const data,
 	return 0;
 }
 
-const struct xlat *
-genl_families_xlat(void)
+static void
+genl_dump_families(void)
 {
-	static struct dyxlat *dyxlat;
+	int fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+	if (fd < 0)
+		return;
 
-	if (!dyxlat) {
-		dyxlat = dyxlat_alloc(32);
+	if (genl_send_dump_families(fd))
+		receive_responses(fd, 0, GENL_ID_CTRL,
+				  genl_parse_families_response, NULL);
+	close(fd);
+}
 
-		int fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
-		if (fd < 0)
-			goto out;
+/* Return the name of the Netlink GENERIC family ID, NULL if unknown.  */
+const char *
+genl_family_name(const uint16_t id)
+{
+	static time_t last_dump;
+	static bool dumped;
+	struct timespec ts;
 
-		if (genl_send_dump_families(fd))
-			receive_responses(fd, 0, GENL_ID_CTRL,
-					  genl_parse_families_response, dyxlat);
-		close(fd);
+	if (genl_families) {
+		const struct genl_family *const f =
+			genl_family_slot(genl_families, genl_families_size, id);
+
+		if (f->name)
+			return f->name;
 	}
 
-out:
-	return dyxlat_get(dyxlat);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (dumped && ts.tv_sec == last_dump)
+		return NULL;
+	dumped = true;
+	last_dump = ts.tv_sec;
+
+	genl_dump_families();
+	if (!genl_families)
+		return NULL;
+
+	return genl_family_slot(genl_families, genl_families_size, id)->name;
 }
 
 #else /* !HAVE_LINUX_GENETLINK_H */
 
-const struct xlat *
-genl_families_xlat(void)
+const char *
+genl_family_name(const uint16_t id)
 {
 	return NULL;
 }
@@ -0,0 +1,426 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Process spawn profile (--spawn-profile option).
+ *
+ * Every process gets a record with its parent, the time of its creation
+ * and the time the parent spent in fork, vfork or clone, the time of
+ * its first exec, the time spent in execs, the last program executed,
+ * and the time and status of its exit.  The records are filled from
+ * the exiting stops of the syscalls that create processes, the exec
+ * events, and the exits, so the syscalls themselves do not have to be
+ * decoded or printed.  A child may exec or even exit before the exiting
+ * stop of the vfork or fork of its parent is seen, so records are created
+ * by whichever comes first.  The profile is written when tracing ends.
+ */
+
+#include "defs.h"
+#include <limits.h>
+#include <sys/wait.h>
+#include "spawn_profile.h"
+#include "syscall.h"
+
+struct spawn_record {
+	struct spawn_record *hash_next;
+	struct spawn_record *next;
+	int pid;
+	/* The thread group and the thread that created the process */
+	int ppid, parent_tid;
+	bool forked, exited;
+	int status;
+	unsigned int execs;
+	/* Creation time, the entering time of the fork if forked */
+	struct timespec start_ts;
+	struct timespec first_exec_ts, exit_ts;
+	uint64_t fork_ns, first_exec_ns, exec_ns;
+	char *path;
+};
+
+static FILE *spawn_profile_file;
+static const char *spawn_profile_path;
+static enum spawn_profile_format spawn_profile_format;
+static struct spawn_record *record_list, **record_tail = &record_list;
+static struct spawn_record **record_hash;
+static unsigned int record_hash_size;
+static unsigned int record_count;
+
+bool
+spawn_profile_enabled(void)
+{
+	return spawn_profile_file;
+}
+
+void
+spawn_profile_init(FILE *fp, const char *path,
+		   const enum spawn_profile_format format)
+{
+	spawn_profile_file = fp;
+	spawn_profile_path = path;
+	spawn_profile_format = format;
+}
+
+static unsigned int
+hash_pid(const int pid)
+{
+	return (unsigned int) pid * 2654435761U;
+}
+
+static void
+record_hash_expand(void)
+{
+	struct spawn_record **const old_hash = record_hash;
+	const unsigned int old_size = record_hash_size;
+	unsigned int i;
+
+	record_hash_size = old_size ? old_size * 2 : 256;
+	record_hash = xcalloc(record_hash_size, sizeof(record_hash[0]));
+
+	/* Keep the newest record of a reused pid first.  */
+	for (i = 0; i < old_size; ++i) {
+		struct spawn_record *sr, *next, *rev = NULL;
+
+		for (sr = old_hash[i]; sr; sr = next) {
+			next = sr->hash_next;
+			sr->hash_next = rev;
+			rev = sr;
+		}
+		for (sr = rev; sr; sr = next) {
+			const unsigned int b = hash_pid(sr->pid)
+					       & (record_hash_size - 1);
+
+			next = sr->hash_next;
+			sr->hash_next = record_hash[b];
+			record_hash[b] = sr;
+		}
+	}
+
+	free(old_hash);
+}
+
+/* Return the newest record of the pid, NULL if there is none.  */
+static struct spawn_record *
+find_record(const int pid)
+{
+	struct spawn_record *sr;
+
+	if (!record_hash_size)
+		return NULL;
+	for (sr = record_hash[hash_pid(pid) & (record_hash_size - 1)];
+	     sr; sr = sr->hash_next) {
+		if (sr->pid == pid)
+			return sr;
+	}
+
+	return NULL;
+}
+
+static struct spawn_record *
+new_record(const int pid, const struct timespec *const ts)
+{
+	if (record_count >= record_hash_size)
+		record_hash_expand();
+
+	const unsigned int b = hash_pid(pid) & (record_hash_size - 1);
+	struct spawn_record *const sr = xcalloc(1, sizeof(*sr));
+
+	sr->pid = pid;
+	sr->start_ts = *ts;
+	sr->hash_next = record_hash[b];
+	record_hash[b] = sr;
+	*record_tail = sr;
+	record_tail = &sr->next;
+	++record_count;
+
+	return sr;
+}
+
+static uint64_t
+ts_ns(const struct timespec *const ts)
+{
+	return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static uint64_t
+ts_diff_ns(const struct timespec *const a, const struct timespec *const b)
+{
+	return ts_ns(a) - ts_ns(b);
+}
+
+void
+spawn_profile_syscall_exiting(struct tcb *const tcp,
+			      const struct timespec *const ts)
+{
+	switch (tcp->s_ent->sen) {
+	case SEN_clone:
+		if (clone_creates_thread(tcp))
+			return;
+		break;
+	case SEN_fork:
+	case SEN_vfork:
+		break;
+	default:
+		return;
+	}
+	if (syserror(tcp) || (kernel_long_t) tcp->u_rval <= 0)
+		return;
+
+	const int pid = tcp->u_rval;
+	struct spawn_record *sr = find_record(pid);
+
+	/* The pid of an earlier process has been reused.  */
+	if (!sr || sr->forked)
+		sr = new_record(pid, &tcp->etime);
+	sr->forked = true;
+	sr->ppid = get_tcb_tgid(tcp);
+	sr->parent_tid = tcp->pid;
+	sr->start_ts = tcp->etime;
+	sr->fork_ns = ts_diff_ns(ts, &tcp->etime);
+}
+
+void
+spawn_profile_exec(struct tcb *const tcp)
+{
+	char proc_exe[sizeof("/proc/%d/exe") + sizeof(int) * 3];
+	char exe[PATH_MAX];
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	/* The entering time is known if the execve has been traced.  */
+	const bool timed = !entering(tcp) && !filtered(tcp);
+	const uint64_t ns = timed ? ts_diff_ns(&ts, &tcp->etime) : 0;
+	struct spawn_record *sr = find_record(tcp->pid);
+
+	if (!sr || sr->exited)
+		sr = new_record(tcp->pid, timed ? &tcp->etime : &ts);
+
+	if (!sr->execs++) {
+		sr->first_exec_ts = ts;
+		sr->first_exec_ns = ns;
+	}
+	sr->exec_ns += ns;
+
+	sprintf(proc_exe, "/proc/%d/exe", tcp->pid);
+	const ssize_t n = readlink(proc_exe, exe, sizeof(exe) - 1);
+
+	if (n > 0) {
+		exe[n] = '\0';
+		free(sr->path);
+		sr->path = xstrdup(exe);
+	}
+}
+
+void
+spawn_profile_exited(struct tcb *const tcp, const int status)
+{
+	struct spawn_record *const sr = find_record(tcp->pid);
+
+	/* Threads and processes that have not been seen to start.  */
+	if (!sr || sr->exited)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &sr->exit_ts);
+	sr->exited = true;
+	sr->status = status;
+}
+
+/* Return the exit status or the name of the killing signal.  */
+static const char *
+exit_status(const struct spawn_record *const sr, char *const buf)
+{
+	if (!sr->exited)
+		return "-";
+	if (WIFSIGNALED(sr->status))
+		return signame(WTERMSIG(sr->status));
+	sprintf(buf, "%d", WEXITSTATUS(sr->status));
+	return buf;
+}
+
+static int
+spawn_record_cmp(const void *a, const void *b)
+{
+	const struct spawn_record *const x =
+		*(const struct spawn_record **) a;
+	const struct spawn_record *const y =
+		*(const struct spawn_record **) b;
+
+	const uint64_t x_ns = ts_ns(&x->start_ts);
+	const uint64_t y_ns = ts_ns(&y->start_ts);
+
+	return (x_ns < y_ns) ? -1 : (x_ns > y_ns) ? 1 : x->pid - y->pid;
+}
+
+/*
+ * Write a line per process in the order of creation, with its start
+ * relative to the creation of the first process.
+ */
+static void
+write_text(FILE *const fp, struct spawn_record *const *const sorted,
+	   const unsigned int n, const struct timespec *const end_ts)
+{
+	const struct timespec *const base_ts = &sorted[0]->start_ts;
+	unsigned int i;
+
+	fprintf(fp, "%7s %7s %11s %9s %11s %9s %5s %11s %7s %s\n",
+		"pid", "ppid", "start", "fork us", "to exec us", "exec us",
+		"execs", "lifetime", "exit", "program");
+	for (i = 0; i < n; ++i) {
+		const struct spawn_record *const sr = sorted[i];
+		char ppid[sizeof(int) * 3] = "-";
+		char fork_us[sizeof(uint64_t) * 3] = "-";
+		char to_exec_us[sizeof(uint64_t) * 3] = "-";
+		char status[sizeof(int) * 3];
+
+		if (sr->forked) {
+			sprintf(ppid, "%d", sr->ppid);
+			sprintf(fork_us, "%" PRIu64, sr->fork_ns / 1000);
+			if (sr->execs)
+				sprintf(to_exec_us, "%" PRIu64,
+					ts_diff_ns(&sr->first_exec_ts,
+						   &sr->start_ts) / 1000);
+		}
+
+		fprintf(fp, "%7d %7s %11.6f %9s %11s %9" PRIu64 " %5u %11.6f"
+			" %7s %s\n", sr->pid, ppid,
+			ts_diff_ns(&sr->start_ts, base_ts) / 1e9, fork_us,
+			to_exec_us, sr->exec_ns / 1000, sr->execs,
+			ts_diff_ns(sr->exited ? &sr->exit_ts : end_ts,
+				   &sr->start_ts) / 1e9,
+			exit_status(sr, status), sr->path ? sr->path : "-");
+	}
+}
+
+static void
+write_json_string(FILE *const fp, const char *str)
+{
+	fputc('"', fp);
+	for (; *str; ++str) {
+		const unsigned char c = *str;
+
+		if (c == '"' || c == '\\')
+			fprintf(fp, "\\%c", c);
+		else if (c < ' ')
+			fprintf(fp, "\\u%04x", c);
+		else
+			fputc(c, fp);
+	}
+	fputc('"', fp);
+}
+
+/* Timestamps of trace events are in microseconds.  */
+static void
+write_us(FILE *const fp, const char *const name, const uint64_t ns)
+{
+	fprintf(fp, ",\"%s\":%" PRIu64 ".%03u", name, ns / 1000,
+		(unsigned int) (ns % 1000));
+}
+
+/*
+ * Write a complete event per process lasting its lifetime, named after
+ * its program, with the first exec nested in it, and a complete event
+ * for the fork on the track of the parent thread.
+ */
+static void
+write_chrome(FILE *const fp, struct spawn_record *const *const sorted,
+	     const unsigned int n, const struct timespec *const end_ts)
+{
+	unsigned int i;
+
+	fputs("[", fp);
+	for (i = 0; i < n; ++i) {
+		const struct spawn_record *const sr = sorted[i];
+		const char *const base = sr->path ? strrchr(sr->path, '/')
+						  : NULL;
+		char status[sizeof(int) * 3];
+
+		fprintf(fp, "%s\n{\"name\":", i ? "," : "");
+		if (sr->path)
+			write_json_string(fp, base ? base + 1 : sr->path);
+		else
+			fprintf(fp, "\"pid %d\"", sr->pid);
+		fprintf(fp, ",\"cat\":\"process\",\"ph\":\"X\",\"pid\":%d"
+			",\"tid\":%d", sr->pid, sr->pid);
+		write_us(fp, "ts", ts_ns(&sr->start_ts));
+		write_us(fp, "dur", ts_diff_ns(sr->exited ? &sr->exit_ts
+							  : end_ts,
+					       &sr->start_ts));
+		fputs(",\"args\":{\"path\":", fp);
+		write_json_string(fp, sr->path ? sr->path : "");
+		fprintf(fp, ",\"ppid\":%d,\"execs\":%u,\"exit\":\"%s\"}}",
+			sr->forked ? sr->ppid : 0, sr->execs,
+			exit_status(sr, status));
+
+		if (sr->execs) {
+			fprintf(fp, ",\n{\"name\":\"exec\",\"cat\":\"process\""
+				",\"ph\":\"X\",\"pid\":%d,\"tid\":%d",
+				sr->pid, sr->pid);
+			write_us(fp, "ts", ts_ns(&sr->first_exec_ts)
+					   - sr->first_exec_ns);
+			write_us(fp, "dur", sr->first_exec_ns);
+			fputs("}", fp);
+		}
+
+		if (sr->forked) {
+			fprintf(fp, ",\n{\"name\":\"fork\",\"cat\":\"process\""
+				",\"ph\":\"X\",\"pid\":%d,\"tid\":%d",
+				sr->ppid, sr->parent_tid);
+			write_us(fp, "ts", ts_ns(&sr->start_ts));
+			write_us(fp, "dur", sr->fork_ns);
+			fprintf(fp, ",\"args\":{\"child\":%d}}", sr->pid);
+		}
+	}
+	fputs("\n]\n", fp);
+}
+
+void
+spawn_profile_finish(void)
+{
+	struct spawn_record **sorted;
+	struct spawn_record *sr;
+	struct timespec end_ts;
+	unsigned int n = 0;
+
+	if (!spawn_profile_file)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &end_ts);
+	sorted = xcalloc(record_count ? record_count : 1, sizeof(sorted[0]));
+	for (sr = record_list; sr; sr = sr->next)
+		sorted[n++] = sr;
+	qsort(sorted, n, sizeof(sorted[0]), spawn_record_cmp);
+
+	if (spawn_profile_format == SPAWN_PROFILE_CHROME)
+		write_chrome(spawn_profile_file, sorted, n, &end_ts);
+	else if (n)
+		write_text(spawn_profile_file, sorted, n, &end_ts);
+
+	free(sorted);
+	if (fflush(spawn_profile_file) || ferror(spawn_profile_file))
+		perror_msg("%s", spawn_profile_path);
+	spawn_profile_file = NULL;
+}
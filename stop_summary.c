@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Tracer stop time summary (--summary-stops option).
+ *
+ * Every ptrace stop holds the tracee from the moment wait4 reports it
+ * until strace restarts it, that is the time the traced program pays
+ * for being traced.  The stop times are accounted per kind of stop and,
+ * for syscall stops, per syscall, with a latency histogram each.
+ */
+
+#include "defs.h"
+#include "latency_hist.h"
+
+struct stop_counts {
+	uint64_t stops;
+	uint64_t time_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	struct latency_hist *hist;
+};
+
+struct syscall_stop_counts {
+	unsigned int pers;
+	kernel_ulong_t scno;
+	const struct stop_counts *sc;
+};
+
+static const char *const stop_kind_names[] = {
+	[STOP_SYSCALL_ENTRY] = "syscall entry",
+	[STOP_SYSCALL_EXIT] = "syscall exit",
+	[STOP_SIGNAL] = "signal",
+	[STOP_GROUP] = "group-stop",
+	[STOP_EVENT] = "event",
+};
+
+unsigned int summary_stops;
+static struct stop_counts kind_counts[STOP_KINDS];
+static struct stop_counts *syscall_counts[SUPPORTED_PERSONALITIES];
+
+static void
+account_stop(struct stop_counts *const sc, const uint64_t ns)
+{
+	if (!sc->hist)
+		sc->hist = xcalloc(1, sizeof(*sc->hist));
+
+	if (!sc->stops || ns < sc->min_ns)
+		sc->min_ns = ns;
+	if (ns > sc->max_ns)
+		sc->max_ns = ns;
+	++sc->stops;
+	sc->time_ns += ns;
+
+	uint32_t *const b = &sc->hist->buckets[hist_bucket(ns)];
+	if (*b < UINT32_MAX)
+		++*b;
+}
+
+/* The tracee has been reported stopped by wait4.  */
+void
+count_stop_begin(struct tcb *const tcp)
+{
+	clock_gettime(CLOCK_MONOTONIC, &tcp->stop_ts);
+	tcp->stop_kind = STOP_EVENT;
+}
+
+/* The tracee is about to be restarted, account the time it was held.  */
+void
+count_stop_end(struct tcb *const tcp)
+{
+	struct timespec now, dt;
+
+	if (!ts_nz(&tcp->stop_ts))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts_sub(&dt, &now, &tcp->stop_ts);
+	tcp->stop_ts.tv_sec = tcp->stop_ts.tv_nsec = 0;
+
+	const uint64_t ns = (uint64_t) dt.tv_sec * 1000000000 + dt.tv_nsec;
+
+	account_stop(&kind_counts[tcp->stop_kind], ns);
+
+	if (tcp->stop_kind != STOP_SYSCALL_ENTRY
+	    && tcp->stop_kind != STOP_SYSCALL_EXIT)
+		return;
+
+#if SUPPORTED_PERSONALITIES > 1
+	const unsigned int pers = tcp->currpers;
+#else
+	const unsigned int pers = 0;
+#endif
+
+	if (tcp->scno >= nsyscall_vec[pers])
+		return;
+	if (!syscall_counts[pers])
+		syscall_counts[pers] = xcalloc(nsyscall_vec[pers],
+					       sizeof(struct stop_counts));
+	account_stop(&syscall_counts[pers][tcp->scno], ns);
+}
+
+/*
+ * Return the value below which the given permille of stops fall,
+ * rounded down to its bucket and clamped to the observed range.
+ */
+static uint64_t
+stop_percentile(const struct stop_counts *const sc,
+		const unsigned int permille)
+{
+	const uint64_t rank = (sc->stops * permille + 999) / 1000;
+	uint64_t seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; ++i) {
+		seen += sc->hist->buckets[i];
+		if (seen >= rank) {
+			const uint64_t v = hist_bucket_value(i);
+
+			return v < sc->min_ns ? sc->min_ns
+			     : v > sc->max_ns ? sc->max_ns : v;
+		}
+	}
+
+	return sc->max_ns;
+}
+
+static void
+print_stop_header(FILE *outf, const char *const name)
+{
+	const char *dashes = "----------------";
+
+	fprintf(outf, "\n%9.9s %11.11s %11.11s %11.11s %11.11s %11.11s"
+		" %11.11s %11.11s %s\n", "stops", "seconds", "min usecs",
+		"p50", "p90", "p99", "p99.9", "max usecs", name);
+	fprintf(outf, "%9.9s %11.11s %11.11s %11.11s %11.11s %11.11s"
+		" %11.11s %11.11s %s\n", dashes, dashes, dashes, dashes,
+		dashes, dashes, dashes, dashes, dashes);
+}
+
+static void
+print_stop_line(FILE *outf, const struct stop_counts *const sc,
+		const char *const name, const unsigned int pers)
+{
+	fprintf(outf, "%9" PRIu64 " %11.6f %11" PRIu64 " %11" PRIu64
+		" %11" PRIu64 " %11" PRIu64 " %11" PRIu64 " %11" PRIu64 " %s",
+		sc->stops, sc->time_ns / 1e9, sc->min_ns / 1000,
+		stop_percentile(sc, 500) / 1000,
+		stop_percentile(sc, 900) / 1000,
+		stop_percentile(sc, 990) / 1000,
+		stop_percentile(sc, 999) / 1000, sc->max_ns / 1000, name);
+	if (pers)
+		fprintf(outf, " (personality %u)", pers);
+	fputc('\n', outf);
+}
+
+static int
+syscall_stop_counts_cmp(const void *a, const void *b)
+{
+	const struct syscall_stop_counts *const x = a;
+	const struct syscall_stop_counts *const y = b;
+
+	return (x->sc->time_ns < y->sc->time_ns) ? 1
+	     : (x->sc->time_ns > y->sc->time_ns) ? -1
+	     : (x->pers != y->pers) ? (int) x->pers - (int) y->pers
+	     : (x->scno > y->scno) - (x->scno < y->scno);
+}
+
+/*
+ * Print the stop times per kind of stop and of the summary_stops
+ * syscalls whose stops have held the tracees the longest.
+ */
+void
+stop_summary(FILE *outf)
+{
+	struct syscall_stop_counts *sorted;
+	unsigned int i, n = 0, pers;
+	kernel_ulong_t scno;
+
+	print_stop_header(outf, "stop");
+	for (i = 0; i < STOP_KINDS; ++i) {
+		if (kind_counts[i].stops)
+			print_stop_line(outf, &kind_counts[i],
+					stop_kind_names[i], 0);
+	}
+
+	for (pers = 0; pers < SUPPORTED_PERSONALITIES; ++pers) {
+		if (!syscall_counts[pers])
+			continue;
+		for (scno = 0; scno < nsyscall_vec[pers]; ++scno)
+			n += !!syscall_counts[pers][scno].stops;
+	}
+	if (!n)
+		return;
+
+	sorted = xcalloc(n, sizeof(sorted[0]));
+	n = 0;
+	for (pers = 0; pers < SUPPORTED_PERSONALITIES; ++pers) {
+		if (!syscall_counts[pers])
+			continue;
+		for (scno = 0; scno < nsyscall_vec[pers]; ++scno) {
+			if (!syscall_counts[pers][scno].stops)
+				continue;
+			sorted[n].pers = pers;
+			sorted[n].scno = scno;
+			sorted[n].sc = &syscall_counts[pers][scno];
+			++n;
+		}
+	}
+	sort_top(sorted, n, sizeof(sorted[0]), summary_stops,
+		 syscall_stop_counts_cmp);
+
+	print_stop_header(outf, "syscall");
+	for (i = 0; i < n && i < summary_stops; ++i) {
+		const struct_sysent *const s =
+			&sysent_vec[sorted[i].pers][sorted[i].scno];
+
+		print_stop_line(outf, sorted[i].sc,
+				s->sys_name ? s->sys_name : "unknown",
+				sorted[i].pers);
+	}
+
+	free(sorted);
+}
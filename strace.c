@@ -36,20 +36,36 @@
 #include <signal.h>
 #include <sys/resource.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <sys/stat.h>
 #include <pwd.h>
 #include <grp.h>
 #include <dirent.h>
+#include <fnmatch.h>
+#include <getopt.h>
 #include <sys/utsname.h>
 #ifdef HAVE_PRCTL
 # include <sys/prctl.h>
 #endif
 #include <asm/unistd.h>
 
+#include "bintrace.h"
+#include "iocapture.h"
+#include "filter_seccomp.h"
+#include "json.h"
+#include "mem_source.h"
 #include "number_set.h"
 #include "scno.h"
 #include "ptrace.h"
 #include "printsiginfo.h"
+#include "selfprof.h"
+#include "syscall.h"
+#include "trace_events.h"
+#include "spawn_profile.h"
+#include "file_deps.h"
+#include "shard.h"
 
 /* In some libc, these aren't declared. Do it ourself: */
 extern char **environ;
@@ -59,6 +75,16 @@ extern char *optarg;
 #ifdef USE_LIBUNWIND
 /* if this is true do the stack trace for every system call */
 bool stack_trace_enabled;
+/* walk frame pointers instead of unwinding with libunwind */
+bool stack_unwind_fp;
+/* print each unique stack trace only once */
+bool stack_dedup;
+/* unwind stacks from a copy after restarting the tracee */
+unsigned int stack_snapshot_size;
+/* leave symbol resolution to strace-symbolize */
+bool stack_offline;
+/* keep resolved symbols in this directory across runs */
+const char *stack_cache_dir;
 #endif
 
 #define my_tkill(tid, sig) syscall(__NR_tkill, (tid), (sig))
@@ -75,17 +101,41 @@ bool stack_trace_enabled;
 const unsigned int syscall_trap_sig = SIGTRAP | 0x80;
 
 cflag_t cflag = CFLAG_NONE;
+execve_env_t execve_env = EXECVE_ENV_FULL;
+bool mmsg_stats;
+bool bpf_dedup;
+bool notify_events;
 unsigned int followfork;
 unsigned int ptrace_setoptions = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC
 				 | PTRACE_O_TRACEEXIT;
 unsigned int xflag;
 bool debug_flag;
 bool Tflag;
+unsigned int time_precision = 6;
 bool iflag;
 bool count_wallclock;
+/* With -c but without -w, the rusage of every stop is collected.  */
+static bool count_stime;
+/* The rusage of stops is collected for count_stime or --summary-rusage.  */
+static bool collect_rusage;
+/* How -c counts syscalls, --count-backend option.  */
+static enum {
+	COUNT_BACKEND_PTRACE,
+	COUNT_BACKEND_PERF,
+	COUNT_BACKEND_BPF,
+} count_backend;
+static const char *const count_backend_names[] = {
+	[COUNT_BACKEND_PTRACE] = "ptrace",
+	[COUNT_BACKEND_PERF] = "perf",
+	[COUNT_BACKEND_BPF] = "bpf",
+};
+/* --count-cgroup option of --count-backend=bpf */
+static const char *count_cgroup;
 unsigned int qflag;
 static unsigned int tflag;
 static bool rflag;
+/* Print CLOCK_MONOTONIC timestamps in nanoseconds. */
+static bool monotonic_ts;
 static bool print_pid_pfx;
 
 /* -I n */
@@ -131,6 +181,13 @@ unsigned int show_fd_path;
 
 static bool detach_on_execve;
 
+/* --trace-exec patterns, only processes running matching executables are traced */
+static const char **trace_exec_patterns;
+static unsigned int ntrace_exec_patterns;
+/* --trace-threads patterns, only threads with matching names are traced */
+static const char **trace_thread_patterns;
+static unsigned int ntrace_thread_patterns;
+
 static int exit_code;
 static int strace_child;
 static int strace_tracer_pid;
@@ -153,6 +210,71 @@ static struct tcb *current_tcp;
 static struct tcb **tcbtab;
 static unsigned int nprocs, tcbtabsize;
 
+/* Size of output buffers, 0 means the output is flushed after each line. */
+static unsigned int output_buffer_size;
+/* Name of the file to write binary trace records to. */
+static const char *binary_outfname;
+/* Binary trace to print, see --binary-decode and --binary-query options. */
+static const char *binary_decode_path;
+static const char *binary_query;
+/* Number of threads of --binary-decode, 0 means one per online CPU. */
+static unsigned int binary_decode_jobs;
+static const char *iocapture_outfname;
+static const char *iocapture_streams_prefix;
+/* Name of the file to write trace events to. */
+static const char *trace_events_outfname;
+/* Name of the file to write the process spawn profile to. */
+static const char *spawn_profile_outfname;
+static enum spawn_profile_format spawn_profile_format;
+/* Name of the file to write file dependencies of processes to. */
+static const char *file_deps_outfname;
+/* Old summary or binary trace to compare, see --summary-diff option. */
+static const char *summary_diff_path;
+/* Merge the summaries given as arguments, see --summary-merge option. */
+static bool merge_summaries;
+/* Binary trace to replay, see --replay option. */
+static const char *replay_path;
+static const char *replay_dir;
+static const char *replay_data;
+static bool replay_fast;
+/* Iterations of each decoder benchmark, see --bench-decoders option. */
+static bool bench_decoders;
+static unsigned int bench_iterations;
+#define MAX_OUTPUT_BUFFER_SIZE	(1 << 30)
+/* Buffered output is flushed at least once in this number of seconds. */
+#define OUTPUT_FLUSH_INTERVAL	1
+
+/* The output file is rotated when it grows this large, 0 means never. */
+static unsigned long long output_rotate_size;
+/* The output file is rotated when it is this old, 0 means never. */
+static unsigned int output_rotate_interval;
+/* Number of rotated segments to keep, 0 means all of them. */
+static unsigned int output_rotate_keep;
+/* Compress rotated segments with gzip. */
+static bool output_rotate_gzip;
+
+bool complete_lines;
+/* Number of -ff output files kept open, 0 means all of them. */
+static unsigned int output_max_files;
+
+/* Size of the flight recorder buffer, 0 means the output is not buffered. */
+static size_t ring_buffer_size;
+static bool ring_triggers;
+static bool trigger_window_given;
+#define output_rotation (output_rotate_size || output_rotate_interval)
+
+/*
+ * Rotation state of an output file.  The active segment is always
+ * written to NAME, rotated segments are renamed to NAME.1, NAME.2, etc.
+ */
+struct output_log {
+	char *name;
+	unsigned long long size; /* Bytes written to the active segment */
+	time_t start;		/* Time the active segment was started */
+	unsigned int seq;	/* Number of the last rotated segment */
+};
+static struct output_log shared_output_log;
+
 #ifndef HAVE_PROGRAM_INVOCATION_NAME
 char *program_invocation_name;
 #endif
@@ -161,15 +283,26 @@ unsigned os_release; /* generated from uname()'s u.release */
 
 static void detach(struct tcb *tcp);
 static void cleanup(void);
+static struct tcb *pid2tcb(int pid);
 static void interrupt(int sig);
+static void summary_alarm(int sig);
+static void ring_alarm(int sig);
 static sigset_t start_set, blocked_set;
 
 #ifdef HAVE_SIG_ATOMIC_T
-static volatile sig_atomic_t interrupted;
+static volatile sig_atomic_t interrupted, summary_pending, delay_pending;
+static volatile sig_atomic_t ring_dump_pending, cgroup_rescan_pending;
+static volatile sig_atomic_t thread_rescan_pending;
 #else
-static volatile int interrupted;
+static volatile int interrupted, summary_pending, delay_pending;
+static volatile int ring_dump_pending, cgroup_rescan_pending;
+static volatile int thread_rescan_pending;
 #endif
 
+/* --attach-cgroup directories, rescanned for new members every second */
+static const char **attach_cgroups;
+static unsigned int nattach_cgroups;
+
 #ifndef HAVE_STRERROR
 
 #if !HAVE_DECL_SYS_ERRLIST
@@ -226,36 +359,284 @@ Output format:\n\
 #ifdef USE_LIBUNWIND
 "\
   -k             obtain stack trace between each syscall (experimental)\n\
+  --stack-unwinder=libunwind|fp\n\
+                 unwind -k stacks with libunwind (default) or frame pointers\n\
+  --stack-dedup  print each unique -k stack once, then refer to it by id\n\
+  --stack-snapshot[=SIZE]\n\
+                 unwind -k stacks from a copy of SIZE KiB of the stack\n\
+                 after restarting the tracee (default 16)\n\
+  --stack-offline\n\
+                 print -k frames as build-id and file offset, without\n\
+                 symbols, for strace-symbolize\n\
+  --stack-cache=DIR\n\
+                 keep -k symbols of binaries with a build-id in DIR\n\
+                 across runs\n\
 "
 #endif
 "\
-  -o file        send trace output to FILE instead of stderr\n\
+  -o file        send trace output to FILE instead of stderr,\n\
+                 or to a socket if FILE is unix:PATH or tcp:HOST:PORT,\n\
+                 or to a shared memory ring passed to unix:PATH\n\
+                 if FILE is shm:PATH\n\
+  --output-policy=block|drop|sample\n\
+                 when a socket consumer or the --output-async writer\n\
+                 falls behind, block (default),\n\
+                 drop the output, or drop it and sample syscalls\n\
+  --output-queue=size\n\
+                 queue up to SIZE bytes of socket output, or of each\n\
+                 --output-async file (default 1M)\n\
+  --output-async write the output from a separate thread\n\
+  --output-buffer=size\n\
+                 buffer up to SIZE bytes of output instead of flushing each line\n\
+  --complete-lines\n\
+                 write lines of each process only when they are complete\n\
+  --fold-repeats print a syscall repeated with the same arguments and result\n\
+                 once, followed by the number of repetitions\n\
+  --json         write the trace as JSON Lines\n\
+  --output-compress[=level]\n\
+                 compress -o FILE with gzip of LEVEL (default 1) into FILE.gz\n\
+  --output-max-files=n\n\
+                 with -ff, keep at most N output files open, reopen others\n\
+                 when needed\n\
+  --output-rotate-size=size\n\
+                 rotate -o FILE when it grows to SIZE bytes (k, M, G suffixes)\n\
+  --output-rotate-interval=secs\n\
+                 rotate -o FILE every SECS seconds\n\
+  --output-rotate-keep=n\n\
+                 keep only N last rotated segments of -o FILE\n\
+  --output-rotate-gzip\n\
+                 compress rotated segments of -o FILE with gzip\n\
+  --ring-buffer=size\n\
+                 keep last SIZE bytes of output in memory, write them out\n\
+                 on SIGUSR1, on a trigger, and on exit\n\
+  --ring-trigger=set\n\
+                 write out the --ring-buffer when a syscall of SET is seen\n\
+  --ring-trigger-error=set\n\
+                 write out the --ring-buffer when a syscall fails with\n\
+                 an error of SET\n\
+  --binary-output=file\n\
+                 write raw syscall records to FILE instead of decoding them\n\
+  --binary-decode=file\n\
+                 print records of binary trace FILE as text and exit\n\
+  --binary-query=query\n\
+                 print only the syscalls of --binary-decode selected by\n\
+                 QUERY: pid=PID,from=TIME,to=TIME,syscall=NAME,failed\n\
+  --binary-decode-jobs=n\n\
+                 decode --binary-decode trace in N threads (default:\n\
+                 the number of online CPUs)\n\
+  --io-capture=file\n\
+                 write data of -e read= and -e write= descriptors to FILE\n\
+                 as binary records instead of hex dumps\n\
+  --io-capture-streams=prefix\n\
+                 append data of -e read= and -e write= descriptors to\n\
+                 PREFIX.PID.FD.in and PREFIX.PID.FD.out files instead of\n\
+                 hex dumps, with an index of them in PREFIX.index\n\
+  --trace-events=file\n\
+                 also write syscalls, signals and exits to FILE as Chrome\n\
+                 trace events for timeline viewers\n\
+  --spawn-profile=file\n\
+                 write fork, exec and exit times, programs and exit statuses\n\
+                 of traced processes to FILE when tracing ends, implies -f\n\
+  --spawn-profile-format=text|chrome\n\
+                 write the spawn profile as a table (default)\n\
+                 or as Chrome trace events\n\
+  --file-deps=file\n\
+                 write the files read, written, stat'ed and executed\n\
+                 by each traced process to FILE, implies -f\n\
+  --merge-logs=prefix\n\
+                 merge PREFIX.PID logs written with -ff -o PREFIX by\n\
+                 timestamps to stdout and exit\n\
+  --process-tree=file\n\
+                 print the tree of processes of -f log or binary trace\n\
+                 FILE with their programs, times and syscall counts, and exit\n\
+  --summary-diff=old new\n\
+                 compare the -c summaries or binary traces OLD and NEW\n\
+                 per syscall with significance of the changes, and exit\n\
+  --summary-merge\n\
+                 merge the --summary-format=json summaries given as\n\
+                 arguments into a single summary, and exit\n\
+  --replay=file  replay file syscalls of binary trace FILE on files in\n\
+                 the --replay-dir directory, and exit\n\
+  --replay-dir=dir\n\
+                 create the files of --replay in DIR\n\
+  --replay-data=file\n\
+                 write the data captured by --io-capture in FILE\n\
+                 with --replay instead of zeros\n\
+  --replay-fast  replay syscalls as fast as possible instead of at their\n\
+                 times in the trace\n\
   -q             suppress messages about attaching, detaching, etc.\n\
   -r             print relative timestamp\n\
   -s strsize     limit length of print strings to STRSIZE chars (default %d)\n\
   -t             print absolute timestamp\n\
   -tt            print absolute timestamp with usecs\n\
   -T             print time spent in each syscall\n\
+  --monotonic-ts  print CLOCK_MONOTONIC timestamp in nanoseconds\n\
+  --time-precision=us|ns\n\
+                 print -r, -tt, -ttt and -T times in usecs (default) or nsecs\n\
   -x             print non-ascii strings in hex\n\
   -xx            print all strings in hex\n\
   -y             print paths associated with file descriptor arguments\n\
   -yy            print protocol specific information associated with socket file descriptors\n\
+  --execve-env=full|size|hash\n\
+                 print the environment of execve in full (default),\n\
+                 or only its size, or its size and hash\n\
+  --mmsg-stats   print message vectors of sendmmsg and recvmmsg as the number,\n\
+                 total size and size distribution of the messages\n\
+  --bpf-dedup    print each unique classic BPF program once, then refer to it\n\
+                 by id\n\
+  --notify-events\n\
+                 decode event buffers read from inotify and fanotify\n\
+                 descriptors\n\
 \n\
 Statistics:\n\
   -c             count time, calls, and errors for each syscall and report summary\n\
   -C             like -c but also print regular output\n\
-  -O overhead    set overhead for tracing syscalls to OVERHEAD usecs\n\
-  -S sortby      sort syscall counts by: time, calls, name, nothing (default %s)\n\
+  -O overhead    set overhead for tracing syscalls to OVERHEAD usecs,\n\
+                 or measure it at startup if OVERHEAD is \"auto\"\n\
+  -S sortby      sort syscall counts by: time, calls, errors, name, nothing,\n\
+                 or a comma-separated list of keys (default %s)\n\
   -w             summarise syscall latency (default is system time)\n\
+  --count-backend=ptrace|perf|bpf\n\
+                 count -c syscalls by stopping the tracee (default),\n\
+                 with perf tracepoints without stopping it,\n\
+                 or in the kernel for the whole system\n\
+  --count-cgroup=path\n\
+                 count only syscalls of cgroup PATH with bpf backend\n\
+  --summary-latency\n\
+                 add latency percentiles per syscall to the summary\n\
+  --summary-histogram\n\
+                 also print latency histogram of each syscall\n\
+  --summary-format=text|csv|json\n\
+                 print syscall statistics of the summary and of\n\
+                 --summary-interval snapshots as a table (default),\n\
+                 CSV rows, or a line of JSON each\n\
+  --summary-io[=n]\n\
+                 also print N files that moved the most bytes (default %u)\n\
+  --summary-access[=n]\n\
+                 also print read and write sizes, sequentiality, and copied\n\
+                 bytes of N files that moved the most bytes (default %u)\n\
+  --summary-flows[=n]\n\
+                 also print N sockets that moved the most bytes\n\
+                 with their endpoints (default %u)\n\
+  --summary-connects[=n]\n\
+                 also print outcomes and latency of connects to N\n\
+                 destinations connected to the most (default %u)\n\
+  --summary-fds[=n]\n\
+                 also print N paths opened the most and N oldest\n\
+                 descriptors left open (default %u)\n\
+  --summary-futex[=n]\n\
+                 also print N futexes waited on the longest (default %u)\n\
+  --summary-ipc[=n]\n\
+                 also print SysV semaphore waits of N semaphore sets and\n\
+                 throughput of N message queues waited on the longest\n\
+                 (default %u)\n\
+  --summary-handoff[=n]\n\
+                 also print latency of N pairs of processes that spent\n\
+                 the most time waiting for each other's pipe or socket\n\
+                 writes or futex wakes (default %u)\n\
+  --summary-aio[=n]\n\
+                 also print AIO completion latency per opcode and of\n\
+                 N files waited for the longest (default %u)\n\
+  --summary-epoll[=n]\n\
+                 also print event loop statistics of N epoll instances\n\
+                 waited on the most (default %u)\n\
+  --summary-v4l2[=n]\n\
+                 also print video buffer queue statistics of N V4L2\n\
+                 descriptors that dequeued the most buffers (default %u)\n\
+  --summary-notify[=n]\n\
+                 also print N inotify watch descriptors and fanotify\n\
+                 descriptors with event masks received the most (default %u)\n\
+  --summary-mmap[=n]\n\
+                 also print memory mapping footprint of N processes\n\
+                 with the largest peak (default %u)\n\
+  --summary-sync[=n]\n\
+                 also print latency of fsync and similar calls and bytes\n\
+                 written before them for N files that took longest (default %u)\n\
+  --summary-oversleep[=n]\n\
+                 also print time slept beyond the requested timeout\n\
+                 for N threads that overslept most (default %u)\n\
+  --summary-sigdelivery[=n]\n\
+                 also print latency from sending to delivery of signals\n\
+                 for N sender and target pairs that sent most (default %u)\n\
+  --summary-args=set:{argN,retval}[:top[=n]]\n\
+                 also print log2 histograms, or N most frequent values\n\
+                 (default %u), of raw argument N or return value of syscalls\n\
+                 in set, may be given multiple times\n\
+  --summary-interval=n\n\
+                 also print statistics of each N seconds while tracing\n\
+  --summary-pids[=n]\n\
+                 also print summaries of N busiest processes (default %u)\n\
+  --summary-threads[=n]\n\
+                 also print how N threads that spent the most time\n\
+                 in syscalls split their time (default %u)\n\
+  --summary-rusage[=n]\n\
+                 also print CPU time, memory, page faults, and context\n\
+                 switches of N exited processes that used the most CPU time\n\
+                 (default %u)\n\
+  --summary-stops[=n]\n\
+                 also print how long tracees are held in ptrace stops\n\
+                 per kind of stop and of N syscalls (default %u)\n\
+  --summary-top=n\n\
+                 print only N syscalls that sort first in the summary\n\
+  --top[=n]      instead of tracing, refresh a table of syscall rates,\n\
+                 error rates, latencies, and busiest processes\n\
+                 each N seconds (default 1)\n\
+  --self-profile print time spent by strace itself in each phase of tracing\n\
+                 and the memory used by its caches\n\
+  --cache-limit=cache:n\n\
+                 keep at most N entries in a cache of strace,\n\
+                 cache: socket-inodes, mmap\n\
+  --bench-decoders[=n] [name]...\n\
+                 time N runs of syscall decoders on prepared memory\n\
+                 images and exit (default 10000)\n\
 \n\
 Filtering:\n\
   -e expr        a qualifying expression: option=[!]all or option=[!]val1[,val2]...\n\
-     options:    trace, abbrev, verbose, raw, signal, read, write, fault\n\
-  -P path        trace accesses to path\n\
+     options:    trace, abbrev, verbose, raw, signal, read, write, fault,\n\
+                 inject, stack, strlen\n\
+  -P path        trace accesses to path, path/ for anything under a directory,\n\
+                 or a glob pattern with *, **, ?, [...]\n\
+  --seccomp-bpf  enable seccomp-bpf filtering of syscalls (requires -f)\n\
+  --sample=n     trace only every Nth syscall of each process\n\
+  --rate-limit=[set:]n\n\
+                 print at most N syscalls per second, or N of each syscall\n\
+                 of SET, count and report the rest as dropped\n\
+  --terse-rate=[set:]n\n\
+                 abbreviate the decoding of each syscall, or of each one\n\
+                 of SET, while it is called more than N times per second\n\
+  --overhead-budget=n[%%]\n\
+                 lower the level of detail while strace is busy for more\n\
+                 than N percent of the time, restore it when load drops\n\
+  --filter=expr  trace only syscalls whose arguments, result or duration\n\
+                 match EXPR, e.g. 'arg0 == 3 && retval > 0'\n\
+  --trigger=set  trace quietly until a syscall of SET is seen, then trace\n\
+                 fully for a --trigger-window\n\
+  --trigger-path=path\n\
+                 a trigger syscall has to access PATH\n\
+  --trigger-error=set\n\
+                 a trigger syscall has to fail with an error of SET\n\
+  --trigger-signal=set\n\
+                 trace quietly until a signal of SET is seen\n\
+  --trigger-window=n[s]\n\
+                 trace fully for N syscalls (default: 100) or N seconds\n\
+                 after a trigger\n\
 \n\
 Tracing:\n\
   -b execve      detach on execve syscall\n\
+  --trace-exec=pattern[,pattern...]\n\
+                 trace syscalls only of processes running executables\n\
+                 matching PATTERN, keep following forks of the others\n\
+  --trace-threads=pattern[,pattern...]\n\
+                 trace syscalls only of threads with names matching PATTERN\n\
   -D             run tracer process as a detached grandchild, not as parent\n\
+  --tracer-cpus=list\n\
+                 run tracer on CPUs of LIST, or of NUMA nodes of node:LIST\n\
+  --tracer-sched=policy[:prio]\n\
+                 run tracer with scheduling POLICY (other, batch, idle,\n\
+                 fifo, rr) and real-time priority or nice value PRIO\n\
+  --tracer-mlock lock memory of tracer\n\
+  --shards=n     trace with N tracer processes, each of them traces\n\
+                 the processes whose pids hash to it\n\
   -f             follow forks\n\
   -ff            follow forks with output into separate files\n\
   -I interruptible\n\
@@ -269,10 +650,17 @@ Startup:\n\
   -E var         remove var from the environment for command\n\
   -E var=val     put var=val in the environment for command\n\
   -p pid         trace process with process id PID, may be repeated\n\
+  --attach-cgroup=path\n\
+                 trace processes of cgroup PATH and those that join it later,\n\
+                 may be repeated\n\
   -u username    run command as username handling setuid and/or setgid\n\
 \n\
 Miscellaneous:\n\
   -d             enable debug output to stderr\n\
+  --control=path accept commands that change filters and control the output\n\
+                 on unix socket PATH\n\
+  --resident     keep running without tracees and attach to the processes\n\
+                 given by --control commands, requires --control\n\
   -v             verbose mode: print unabbreviated argv, stat, termios, etc. args\n\
   -h             print help message\n\
   -V             print version\n\
@@ -283,7 +671,15 @@ Miscellaneous:\n\
 /* this is broken, so don't document it
 -z -- print only succeeding syscalls\n\
  */
-, DEFAULT_ACOLUMN, DEFAULT_STRLEN, DEFAULT_SORTBY);
+, DEFAULT_ACOLUMN, DEFAULT_STRLEN, DEFAULT_SORTBY, DEFAULT_SUMMARY_IO,
+	DEFAULT_SUMMARY_ACCESS, DEFAULT_SUMMARY_FLOWS, DEFAULT_SUMMARY_CONNECTS, DEFAULT_SUMMARY_FDS,
+	DEFAULT_SUMMARY_FUTEX, DEFAULT_SUMMARY_IPC, DEFAULT_SUMMARY_HANDOFF,
+	DEFAULT_SUMMARY_AIO, DEFAULT_SUMMARY_EPOLL, DEFAULT_SUMMARY_V4L2,
+	DEFAULT_SUMMARY_NOTIFY, DEFAULT_SUMMARY_MMAP, DEFAULT_SUMMARY_SYNC,
+	DEFAULT_SUMMARY_OVERSLEEP, DEFAULT_SUMMARY_SIGDELIVERY,
+	DEFAULT_SUMMARY_ARGS_TOP,
+	DEFAULT_SUMMARY_PIDS, DEFAULT_SUMMARY_THREADS, DEFAULT_SUMMARY_RUSAGE,
+	DEFAULT_SUMMARY_STOPS);
 	exit(0);
 }
 
@@ -303,26 +699,114 @@ error_opt_arg(int opt, const char *arg)
 	error_msg_and_help("invalid -%c argument: '%s'", opt, arg);
 }
 
+static void ATTRIBUTE_NORETURN
+error_long_opt_arg(const char *name, const char *arg)
+{
+	error_msg_and_help("invalid --%s argument: '%s'", name, arg);
+}
+
+/*
+ * Parse a size given in bytes with an optional k, M, or G suffix.
+ * Return 0 if the size is invalid.
+ */
+static unsigned long long
+parse_size(const char *const str)
+{
+	char *end;
+	const int n = string_to_uint_ex(str, &end, INT_MAX, "kKMG");
+
+	if (n <= 0 || (*end && end[1]))
+		return 0;
+
+	switch (*end) {
+	case 'k':
+	case 'K':
+		return (unsigned long long) n << 10;
+	case 'M':
+		return (unsigned long long) n << 20;
+	case 'G':
+		return (unsigned long long) n << 30;
+	default:
+		return n;
+	}
+}
+
 static const char *ptrace_attach_cmd;
 
+#if USE_SEIZE
+/* Set when PTRACE_SEIZE has succeeded once, see test_ptrace_seize.  */
+static bool seize_works;
+
+/*
+ * Returns 0 if the tracee has been seized, -1 on error, and 1 if
+ * PTRACE_SEIZE has turned out not to be supported and PTRACE_ATTACH
+ * has to be used instead from now on.
+ */
+static int
+try_ptrace_seize(int pid)
+{
+	if (ptrace(PTRACE_SEIZE, pid, 0L,
+		   (unsigned long) ptrace_setoptions) == 0) {
+		seize_works = true;
+		return 0;
+	}
+
+	/* Kernels without PTRACE_SEIZE fail unknown requests with EIO.  */
+	if (seize_works || (errno != EIO && errno != EINVAL))
+		return -1;
+
+	if (debug_flag)
+		error_msg("PTRACE_SEIZE doesn't work");
+	post_attach_sigstop = TCB_IGNORE_ONE_SIGSTOP; /* use_seize is 0 now */
+	return 1;
+}
+#endif
+
 static int
 ptrace_attach_or_seize(int pid)
 {
 #if USE_SEIZE
 	int r;
-	if (!use_seize)
-		return ptrace_attach_cmd = "PTRACE_ATTACH",
-		       ptrace(PTRACE_ATTACH, pid, 0L, 0L);
-	r = ptrace(PTRACE_SEIZE, pid, 0L, (unsigned long) ptrace_setoptions);
-	if (r)
-		return ptrace_attach_cmd = "PTRACE_SEIZE", r;
-	r = ptrace(PTRACE_INTERRUPT, pid, 0L, 0L);
-	return ptrace_attach_cmd = "PTRACE_INTERRUPT", r;
-#else
-		return ptrace_attach_cmd = "PTRACE_ATTACH",
-		       ptrace(PTRACE_ATTACH, pid, 0L, 0L);
+	if (use_seize) {
+		r = try_ptrace_seize(pid);
+		if (r < 0)
+			return ptrace_attach_cmd = "PTRACE_SEIZE", r;
+		if (r == 0) {
+			r = ptrace(PTRACE_INTERRUPT, pid, 0L, 0L);
+			return ptrace_attach_cmd = "PTRACE_INTERRUPT", r;
+		}
+	}
+#endif
+	return ptrace_attach_cmd = "PTRACE_ATTACH",
+	       ptrace(PTRACE_ATTACH, pid, 0L, 0L);
+}
+
+/*
+ * Unlike ptrace_attach_or_seize, the split variant lets the caller seize
+ * many tracees before interrupting any of them, see attach_tcb.
+ */
+static int
+ptrace_seize(int pid)
+{
+#if USE_SEIZE
+	if (use_seize) {
+		const int r = try_ptrace_seize(pid);
+
+		if (r <= 0)
+			return ptrace_attach_cmd = "PTRACE_SEIZE", r;
+	}
 #endif
+	return ptrace_attach_cmd = "PTRACE_ATTACH",
+	       ptrace(PTRACE_ATTACH, pid, 0L, 0L);
+}
+
+#if USE_SEIZE
+static int
+ptrace_interrupt(int pid)
+{
+	return ptrace(PTRACE_INTERRUPT, pid, 0L, 0L);
 }
+#endif
 
 /*
  * Used when we want to unblock stopped traced process.
@@ -337,11 +821,22 @@ ptrace_restart(const unsigned int op, struct tcb *const tcp, unsigned int sig)
 	int err;
 	const char *msg;
 
+	umove_cache_invalidate();
+
+	if (summary_stops && op != PTRACE_DETACH)
+		count_stop_end(tcp);
+
 	errno = 0;
+	selfprof_enter(SELFPROF_RESTART);
+	selfprof_count(SELFPROF_PTRACE);
 	ptrace(op, tcp->pid, 0L, (unsigned long) sig);
 	err = errno;
-	if (!err)
+	selfprof_leave(SELFPROF_RESTART);
+	if (!err) {
+		if (summary_threads && op != PTRACE_DETACH)
+			count_thread_resume(tcp);
 		return 0;
+	}
 
 	switch (op) {
 		case PTRACE_CONT:
@@ -458,6 +953,342 @@ strace_fopen(const char *path)
 	return fp;
 }
 
+/*
+ * Open a file of the trace output, with --output-compress
+ * the output is written to PATH.gz, with --output-async
+ * it is written by the writer thread.
+ */
+static FILE *
+output_fopen(const char *const path)
+{
+	if (output_async)
+		return async_open(strace_fopen(path), path);
+	if (!output_compress_level)
+		return strace_fopen(path);
+
+	char *const name = xmalloc(strlen(path) + sizeof(".gz"));
+
+	sprintf(name, "%s.gz", path);
+	FILE *const fp = compress_open(strace_fopen(name));
+	free(name);
+
+	return fp;
+}
+
+/*
+ * Allocate a buffer of output_buffer_size bytes for the output stream.
+ * The buffer has to be freed by the caller after the stream is closed.
+ */
+static char *
+set_output_buffer(FILE *fp)
+{
+	char *buf;
+
+	if (!output_buffer_size)
+		return NULL;
+
+	buf = xmalloc(output_buffer_size);
+	if (setvbuf(fp, buf, _IOFBF, output_buffer_size)) {
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+#ifdef HAVE_FOPENCOOKIE
+/*
+ * With --complete-lines, each tracee writes to its own stream
+ * that keeps the incomplete line in memory; complete lines are written
+ * to the shared log at once, so lines of different tracees never
+ * interleave and there is no need for unfinished/resumed pairs.
+ */
+struct line_stream {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+static void
+line_stream_write_out(const char *const data, const size_t len)
+{
+	if (len && fwrite(data, 1, len, shared_log) != len &&
+	    shared_log != stderr)
+		perror_msg("%s", outfname);
+}
+
+static ssize_t
+line_stream_write(void *cookie, const char *data, size_t len)
+{
+	struct line_stream *const ls = cookie;
+	const char *const eol = memrchr(data, '\n', len);
+	const ssize_t ret = len;
+
+	if (eol) {
+		const size_t head = eol + 1 - data;
+
+		line_stream_write_out(ls->buf, ls->len);
+		line_stream_write_out(data, head);
+		ls->len = 0;
+		data += head;
+		len -= head;
+	}
+
+	if (len) {
+		if (ls->len + len > ls->size) {
+			ls->size = ls->len + len + 128;
+			ls->buf = xreallocarray(ls->buf, ls->size, 1);
+		}
+		memcpy(ls->buf + ls->len, data, len);
+		ls->len += len;
+	}
+
+	return ret;
+}
+
+static int
+line_stream_close(void *cookie)
+{
+	struct line_stream *const ls = cookie;
+
+	line_stream_write_out(ls->buf, ls->len);
+	free(ls->buf);
+	free(ls);
+
+	return 0;
+}
+
+static FILE *
+line_stream_open(void)
+{
+	static const cookie_io_functions_t funcs = {
+		.write = line_stream_write,
+		.close = line_stream_close
+	};
+	struct line_stream *const ls = xcalloc(1, sizeof(*ls));
+	FILE *const fp = fopencookie(ls, "w", funcs);
+
+	if (!fp)
+		perror_msg_and_die("fopencookie");
+	/* The line buffer is the only buffer of the stream. */
+	setvbuf(fp, NULL, _IONBF, 0);
+
+	return fp;
+}
+
+/*
+ * With -ff and --output-max-files, the file of each tracee is kept open
+ * only while it is among the output_max_files most recently written ones,
+ * other files are closed and reopened for appending when they are written
+ * to again.  The streams are unbuffered, the incomplete line is kept
+ * in a buffer taken from a pool shared by all tracees only until
+ * the line is complete.
+ */
+struct pid_log {
+	char *name;
+	int fd;			/* -1 if the file is closed */
+	bool error_reported;
+	struct pid_log *prev;	/* More recently written open file */
+	struct pid_log *next;	/* Less recently written open file */
+	char *buf;		/* The incomplete line, if any */
+	size_t len;
+	size_t size;
+};
+
+/* Open files, the most recently written one first. */
+static struct pid_log *pid_log_head, *pid_log_tail;
+static unsigned int pid_log_nopen;
+
+/* Free line buffers of size PID_LOG_BUF_SIZE. */
+#define PID_LOG_BUF_SIZE 512
+#define PID_LOG_POOL_SIZE 64
+static char *pid_log_pool[PID_LOG_POOL_SIZE];
+static unsigned int pid_log_pool_len;
+
+static void
+pid_log_unlink(struct pid_log *const pl)
+{
+	if (pl->prev)
+		pl->prev->next = pl->next;
+	else
+		pid_log_head = pl->next;
+	if (pl->next)
+		pl->next->prev = pl->prev;
+	else
+		pid_log_tail = pl->prev;
+	pl->prev = pl->next = NULL;
+}
+
+static void
+pid_log_close_fd(struct pid_log *const pl)
+{
+	pid_log_unlink(pl);
+	if (close(pl->fd) && !pl->error_reported) {
+		pl->error_reported = true;
+		perror_msg("%s", pl->name);
+	}
+	pl->fd = -1;
+	--pid_log_nopen;
+}
+
+/*
+ * Make the file the most recently written one, open it if it is closed,
+ * truncating it on the first open.  Return false if it cannot be opened.
+ */
+static bool
+pid_log_use(struct pid_log *const pl, const bool create)
+{
+	if (pl->fd >= 0) {
+		if (pl != pid_log_head) {
+			pid_log_unlink(pl);
+			pl->next = pid_log_head;
+			pid_log_head->prev = pl;
+			pid_log_head = pl;
+		}
+		return true;
+	}
+
+	if (pid_log_nopen >= output_max_files)
+		pid_log_close_fd(pid_log_tail);
+
+	swap_uid();
+	pl->fd = open(pl->name, O_WRONLY | O_CREAT | O_CLOEXEC | O_LARGEFILE |
+				(create ? O_TRUNC : O_APPEND), 0666);
+	swap_uid();
+	if (pl->fd < 0) {
+		if (create)
+			perror_msg_and_die("Can't open '%s'", pl->name);
+		if (!pl->error_reported) {
+			pl->error_reported = true;
+			perror_msg("Can't open '%s'", pl->name);
+		}
+		return false;
+	}
+
+	pl->next = pid_log_head;
+	if (pid_log_head)
+		pid_log_head->prev = pl;
+	else
+		pid_log_tail = pl;
+	pid_log_head = pl;
+	++pid_log_nopen;
+
+	return true;
+}
+
+static void
+pid_log_write_out(struct pid_log *const pl, const char *data, size_t len)
+{
+	if (!len || !pid_log_use(pl, false))
+		return;
+
+	while (len) {
+		const ssize_t n = write(pl->fd, data, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (!pl->error_reported) {
+				pl->error_reported = true;
+				perror_msg("%s", pl->name);
+			}
+			return;
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+static ssize_t
+pid_log_write(void *cookie, const char *data, size_t len)
+{
+	struct pid_log *const pl = cookie;
+	const char *const eol = memrchr(data, '\n', len);
+	const ssize_t ret = len;
+
+	if (eol) {
+		const size_t head = eol + 1 - data;
+
+		if (pl->len) {
+			/* Complete the line and write it at once.  */
+			if (pl->len + head > pl->size) {
+				pl->size = pl->len + head;
+				pl->buf = xreallocarray(pl->buf, pl->size, 1);
+			}
+			memcpy(pl->buf + pl->len, data, head);
+			pid_log_write_out(pl, pl->buf, pl->len + head);
+			pl->len = 0;
+		} else {
+			pid_log_write_out(pl, data, head);
+		}
+		data += head;
+		len -= head;
+
+		if (pl->buf && pid_log_pool_len < PID_LOG_POOL_SIZE &&
+		    pl->size == PID_LOG_BUF_SIZE) {
+			pid_log_pool[pid_log_pool_len++] = pl->buf;
+		} else {
+			free(pl->buf);
+		}
+		pl->buf = NULL;
+		pl->size = 0;
+	}
+
+	if (len) {
+		if (!pl->buf && pid_log_pool_len) {
+			pl->buf = pid_log_pool[--pid_log_pool_len];
+			pl->size = PID_LOG_BUF_SIZE;
+		}
+		if (pl->len + len > pl->size) {
+			pl->size = MAX(pl->len + len, PID_LOG_BUF_SIZE);
+			pl->buf = xreallocarray(pl->buf, pl->size, 1);
+		}
+		memcpy(pl->buf + pl->len, data, len);
+		pl->len += len;
+	}
+
+	return ret;
+}
+
+static int
+pid_log_close(void *cookie)
+{
+	struct pid_log *const pl = cookie;
+
+	pid_log_write_out(pl, pl->buf, pl->len);
+	if (pl->fd >= 0)
+		pid_log_close_fd(pl);
+	free(pl->buf);
+	free(pl->name);
+	free(pl);
+
+	return 0;
+}
+
+static FILE *
+pid_log_open(const char *const name)
+{
+	static const cookie_io_functions_t funcs = {
+		.write = pid_log_write,
+		.close = pid_log_close
+	};
+	struct pid_log *const pl = xcalloc(1, sizeof(*pl));
+	FILE *fp;
+
+	pl->name = xstrdup(name);
+	pl->fd = -1;
+	/* Create the file now, like strace_fopen does. */
+	pid_log_use(pl, true);
+
+	fp = fopencookie(pl, "w", funcs);
+	if (!fp)
+		perror_msg_and_die("fopencookie");
+	setvbuf(fp, NULL, _IONBF, 0);
+
+	return fp;
+}
+#endif /* HAVE_FOPENCOOKIE */
+
 static int popen_pid;
 
 #ifndef _PATH_BSHELL
@@ -513,13 +1344,18 @@ static void
 tvprintf(const char *const fmt, va_list args)
 {
 	if (current_tcp) {
+		selfprof_enter(SELFPROF_OUTPUT);
 		int n = vfprintf(current_tcp->outf, fmt, args);
+		selfprof_leave(SELFPROF_OUTPUT);
 		if (n < 0) {
 			/* very unlikely due to vfprintf buffering */
 			if (current_tcp->outf != stderr)
 				perror_msg("%s", outfname);
-		} else
+		} else {
 			current_tcp->curcol += n;
+			if (current_tcp->outlog)
+				current_tcp->outlog->size += n;
+		}
 	}
 }
 
@@ -532,25 +1368,103 @@ tprintf(const char *fmt, ...)
 	va_end(args);
 }
 
-#ifndef HAVE_FPUTS_UNLOCKED
-# define fputs_unlocked fputs
+#ifndef HAVE_FWRITE_UNLOCKED
+# define fwrite_unlocked fwrite
 #endif
 
+/* Print LEN bytes of STR, the length is known so it is not recounted.  */
 void
-tprints(const char *str)
+tprints_n(const char *const str, const size_t len)
 {
 	if (current_tcp) {
-		int n = fputs_unlocked(str, current_tcp->outf);
-		if (n >= 0) {
-			current_tcp->curcol += strlen(str);
+		selfprof_enter(SELFPROF_OUTPUT);
+		size_t n = fwrite_unlocked(str, 1, len, current_tcp->outf);
+		selfprof_leave(SELFPROF_OUTPUT);
+		if (n == len) {
+			current_tcp->curcol += len;
+			if (current_tcp->outlog)
+				current_tcp->outlog->size += len;
 			return;
 		}
-		/* very unlikely due to fputs_unlocked buffering */
+		/* very unlikely due to fwrite_unlocked buffering */
 		if (current_tcp->outf != stderr)
 			perror_msg("%s", outfname);
 	}
 }
 
+void
+tprints(const char *str)
+{
+	tprints_n(str, strlen(str));
+}
+
+/*
+ * Integer printers that do not go through the format string parsing
+ * of tprintf.  Digits are written backwards from the end of the buffer.
+ */
+static char *
+format_udec(char *end, unsigned long long val)
+{
+	do {
+		*--end = '0' + val % 10;
+		val /= 10;
+	} while (val);
+	return end;
+}
+
+void
+tprint_uint(const unsigned long long val)
+{
+	char buf[sizeof(val) * 3];
+	char *const end = buf + sizeof(buf);
+	const char *const p = format_udec(end, val);
+
+	tprints_n(p, end - p);
+}
+
+void
+tprint_int(const long long val)
+{
+	char buf[sizeof(val) * 3 + 1];
+	char *const end = buf + sizeof(buf);
+	char *p = format_udec(end, val < 0 ? -(unsigned long long) val
+					   : (unsigned long long) val);
+
+	if (val < 0)
+		*--p = '-';
+	tprints_n(p, end - p);
+}
+
+/* The same as tprintf("%#llx", val).  */
+void
+tprint_hex(unsigned long long val)
+{
+	char buf[sizeof(val) * 2 + 2];
+	char *const end = buf + sizeof(buf);
+	char *p = end;
+
+	if (!val) {
+		tprints_n("0", 1);
+		return;
+	}
+	do {
+		*--p = "0123456789abcdef"[val & 0xf];
+		val >>= 4;
+	} while (val);
+	*--p = 'x';
+	*--p = '0';
+	tprints_n(p, end - p);
+}
+
+/* The same as tprintf("%s%s=", prefix, name).  */
+void
+tprint_field_name(const char *const prefix, const char *const name)
+{
+	tprints(prefix);
+	tprints(name);
+	tprints_n("=", 1);
+}
+
 void
 tprints_comment(const char *const str)
 {
@@ -575,39 +1489,241 @@ tprintf_comment(const char *fmt, ...)
 static void
 flush_tcp_output(const struct tcb *const tcp)
 {
+	selfprof_enter(SELFPROF_FLUSH);
 	if (fflush(tcp->outf) && tcp->outf != stderr)
 		perror_msg("%s", outfname);
+	/* Complete lines have been written to the shared log. */
+	if (complete_lines && fflush(shared_log) && shared_log != stderr)
+		perror_msg("%s", outfname);
+	selfprof_leave(SELFPROF_FLUSH);
 }
 
+/*
+ * Flush the output of the tracee unless the output is buffered
+ * (--output-buffer option) and the last flush is recent enough.
+ */
 void
-line_ended(void)
+maybe_flush_tcp_output(const struct tcb *const tcp)
 {
-	if (current_tcp) {
-		current_tcp->curcol = 0;
-		flush_tcp_output(current_tcp);
-	}
-	if (printing_tcp) {
-		printing_tcp->curcol = 0;
-		printing_tcp = NULL;
+	if (output_buffer_size) {
+		static time_t last_flush;
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		if (ts.tv_sec >= last_flush &&
+		    ts.tv_sec - last_flush < OUTPUT_FLUSH_INTERVAL)
+			return;
+		last_flush = ts.tv_sec;
+
+		/* Flush all outputs, not just the output of this tracee. */
+		selfprof_enter(SELFPROF_FLUSH);
+		if (fflush(NULL))
+			perror_msg("%s", outfname ? outfname : "fflush");
+		selfprof_leave(SELFPROF_FLUSH);
+		return;
 	}
+
+	flush_tcp_output(tcp);
 }
 
-void
-printleader(struct tcb *tcp)
+static time_t
+monotonic_seconds(void)
 {
-	/* If -ff, "previous tcb we printed" is always the same as current,
-	 * because we have per-tcb output files.
-	 */
-	if (followfork >= 2)
-		printing_tcp = tcp;
+	struct timespec ts;
 
-	if (printing_tcp) {
-		current_tcp = printing_tcp;
-		if (printing_tcp->curcol != 0 && (followfork < 2 || printing_tcp == tcp)) {
-			/*
-			 * case 1: we have a shared log (i.e. not -ff), and last line
-			 * wasn't finished (same or different tcb, doesn't matter).
-			 * case 2: split log, we are the same tcb, but our last line
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static void
+init_output_log(struct output_log *const log, const char *const name)
+{
+	log->name = xstrdup(name);
+	log->size = 0;
+	log->start = monotonic_seconds();
+	log->seq = 0;
+}
+
+/*
+ * Start compressing the rotated segment in a grandchild process
+ * that is reparented to init, so strace neither waits for it
+ * nor sees its termination among the events of tracees.
+ */
+static void
+compress_segment(const char *const name)
+{
+	pid_t pid;
+
+	swap_uid();
+	pid = fork();
+	if (pid < 0) {
+		perror_msg("fork");
+	} else if (pid == 0) {
+		sigset_t empty_set;
+
+		if (fork())
+			_exit(0);
+		sigemptyset(&empty_set);
+		sigprocmask(SIG_SETMASK, &empty_set, NULL);
+		execlp("gzip", "gzip", "-f", "-q", "--", name, NULL);
+		_exit(1);
+	} else {
+		while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+			;
+	}
+	swap_uid();
+}
+
+static void
+remove_segment(const struct output_log *const log, const unsigned int seq)
+{
+	char *const name = xmalloc(strlen(log->name) + sizeof(".4294967295.gz"));
+
+	sprintf(name, "%s.%u", log->name, seq);
+	swap_uid();
+	unlink(name);
+	if (output_rotate_gzip) {
+		strcat(name, ".gz");
+		unlink(name);
+	}
+	swap_uid();
+	free(name);
+}
+
+/*
+ * Rename the active segment of the output and continue writing
+ * to a new file with the same name.  The new file replaces the old one
+ * under the file descriptor of FP, so FP remains valid for all tracees
+ * that share it.
+ */
+static void
+rotate_output(FILE *const fp, struct output_log *const log)
+{
+	char *const seg = xmalloc(strlen(log->name) + sizeof(".4294967295"));
+	FILE *new_fp = NULL;
+
+	if (fflush(fp))
+		perror_msg("%s", log->name);
+
+	sprintf(seg, "%s.%u", log->name, log->seq + 1);
+	swap_uid();
+	if (rename(log->name, seg) < 0) {
+		perror_msg("Can't rename '%s' to '%s'", log->name, seg);
+	} else {
+		++log->seq;
+		new_fp = fopen_for_output(log->name, "w");
+		if (!new_fp)
+			perror_msg("Can't fopen '%s'", log->name);
+	}
+	swap_uid();
+
+	if (new_fp) {
+		if (dup2(fileno(new_fp), fileno(fp)) < 0)
+			perror_msg("dup2");
+		else
+			set_cloexec_flag(fileno(fp));
+		fclose(new_fp);
+
+		if (output_rotate_gzip)
+			compress_segment(seg);
+		if (output_rotate_keep && log->seq > output_rotate_keep)
+			remove_segment(log, log->seq - output_rotate_keep);
+	}
+	free(seg);
+
+	/* Do not retry on every line if the rotation has failed. */
+	log->size = 0;
+	log->start = monotonic_seconds();
+}
+
+/*
+ * Rotate all output files now, return false if output rotation
+ * is not enabled.
+ */
+bool
+rotate_all_output(void)
+{
+	unsigned int i;
+
+	if (!output_rotation)
+		return false;
+
+	if (shared_output_log.name)
+		rotate_output(shared_log, &shared_output_log);
+
+	for (i = 0; i < tcbtabsize; ++i) {
+		struct tcb *const tcp = tcbtab[i];
+
+		if (tcp->pid && tcp->outlog
+		    && tcp->outlog != &shared_output_log)
+			rotate_output(tcp->outf, tcp->outlog);
+	}
+
+	return true;
+}
+
+static void
+maybe_rotate_output(const struct tcb *const tcp)
+{
+	struct output_log *const log = tcp->outlog;
+
+	if ((output_rotate_size && log->size >= output_rotate_size) ||
+	    (output_rotate_interval &&
+	     monotonic_seconds() - log->start >= output_rotate_interval))
+		rotate_output(complete_lines ? shared_log : tcp->outf, log);
+}
+
+void
+line_ended(void)
+{
+	if (current_tcp) {
+		current_tcp->curcol = 0;
+		maybe_flush_tcp_output(current_tcp);
+	}
+	if (printing_tcp) {
+		printing_tcp->curcol = 0;
+		printing_tcp = NULL;
+	}
+	/* Segments are rotated only between lines. */
+	if (current_tcp && current_tcp->outlog)
+		maybe_rotate_output(current_tcp);
+}
+
+/* Direct tprintf output to TCP without printing a line leader.  */
+void
+set_current_tcp(struct tcb *tcp)
+{
+	current_tcp = tcp;
+	tcp->curcol = 0;
+}
+
+void
+printleader(struct tcb *tcp)
+{
+	/* If -ff, "previous tcb we printed" is always the same as current,
+	 * because we have per-tcb output files.
+	 */
+	/*
+	 * Folded repetitions are reported before the next line,
+	 * and a line other than a syscall ends the repetition.
+	 */
+	if (tcp->rep && !(tcp->flags & TCB_DEFERRED_OUTPUT)) {
+		if (tcp->rep->count)
+			print_repeats(tcp);
+		tcp->rep->s_ent = NULL;
+	}
+
+	if (tcb_output_separate())
+		printing_tcp = tcp;
+
+	if (printing_tcp) {
+		current_tcp = printing_tcp;
+		if (printing_tcp->curcol != 0 &&
+		    (!tcb_output_separate() || printing_tcp == tcp)) {
+			/*
+			 * case 1: we have a shared log (i.e. not -ff), and last line
+			 * wasn't finished (same or different tcb, doesn't matter).
+			 * case 2: split log, we are the same tcb, but our last line
 			 * didn't finish ("SIGKILL nuked us after syscall entry" etc).
 			 */
 			tprints(" <unfinished ...>\n");
@@ -621,32 +1737,47 @@ printleader(struct tcb *tcp)
 
 	if (print_pid_pfx)
 		tprintf("%-5d ", tcp->pid);
-	else if (nprocs > 1 && !outfname)
+	else if ((nprocs > 1 || nshards) && !outfname)
 		tprintf("[pid %5u] ", tcp->pid);
 
-	if (tflag) {
-		char str[sizeof("HH:MM:SS")];
-		struct timeval tv, dtv;
-		static struct timeval otv;
+	if (monotonic_ts) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		tprintf("%llu ", ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+	} else if (tflag) {
+		/* The time of day is formatted once a second. */
+		static char str[sizeof("HH:MM:SS")];
+		static time_t str_sec = -1;
+		struct timespec ts, dts;
+		static struct timespec ots;
 
-		gettimeofday(&tv, NULL);
 		if (rflag) {
-			if (otv.tv_sec == 0)
-				otv = tv;
-			tv_sub(&dtv, &tv, &otv);
-			tprintf("%6ld.%06ld ",
-				(long) dtv.tv_sec, (long) dtv.tv_usec);
-			otv = tv;
-		} else if (tflag > 2) {
-			tprintf("%ld.%06ld ",
-				(long) tv.tv_sec, (long) tv.tv_usec);
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			if (!ts_nz(&ots))
+				ots = ts;
+			ts_sub(&dts, &ts, &ots);
+			tprintf("%6ld.%0*ld ", (long) dts.tv_sec,
+				time_precision, ts_frac(&dts));
+			ots = ts;
 		} else {
-			time_t local = tv.tv_sec;
-			strftime(str, sizeof(str), "%T", localtime(&local));
-			if (tflag > 1)
-				tprintf("%s.%06ld ", str, (long) tv.tv_usec);
-			else
-				tprintf("%s ", str);
+			clock_gettime(CLOCK_REALTIME, &ts);
+			if (tflag > 2) {
+				tprintf("%ld.%0*ld ", (long) ts.tv_sec,
+					time_precision, ts_frac(&ts));
+			} else {
+				if (ts.tv_sec != str_sec) {
+					time_t local = ts.tv_sec;
+					strftime(str, sizeof(str), "%T",
+						 localtime(&local));
+					str_sec = ts.tv_sec;
+				}
+				if (tflag > 1)
+					tprintf("%s.%0*ld ", str,
+						time_precision, ts_frac(&ts));
+				else
+					tprintf("%s ", str);
+			}
 		}
 	}
 	if (iflag)
@@ -660,6 +1791,99 @@ tabto(void)
 		tprints(acolumn_spaces + current_tcp->curcol);
 }
 
+#ifdef HAVE_OPEN_MEMSTREAM
+/*
+ * Redirect the output of the tracee to its deferred output buffer
+ * until the output is either committed or discarded.
+ */
+void
+defer_tcp_output(struct tcb *tcp)
+{
+	if (!tcp->deferred_outf) {
+		tcp->deferred_outf = open_memstream(&tcp->deferred_buf,
+						    &tcp->deferred_size);
+		if (!tcp->deferred_outf)
+			perror_msg_and_die("open_memstream");
+	}
+
+	FILE *const fp = tcp->outf;
+	tcp->outf = tcp->deferred_outf;
+	tcp->deferred_outf = fp;
+	tcp->flags |= TCB_DEFERRED_OUTPUT;
+}
+
+/*
+ * Restore the output of the tracee and return the length
+ * of the deferred output, which is left in tcp->deferred_buf.
+ */
+size_t
+end_deferred_output(struct tcb *tcp)
+{
+	FILE *const fp = tcp->outf;
+	size_t len;
+
+	if (fflush(fp))
+		perror_msg_and_die("open_memstream");
+	len = ftello(fp);
+	rewind(fp);
+
+	tcp->outf = tcp->deferred_outf;
+	tcp->deferred_outf = fp;
+	tcp->flags &= ~TCB_DEFERRED_OUTPUT;
+	/* The output is accounted when it is actually written.  */
+	if (tcp->outlog)
+		tcp->outlog->size -= len;
+	return len;
+}
+
+/* Append the deferred output of the tracee to its log.  */
+void
+commit_deferred_output(struct tcb *tcp)
+{
+	write_deferred_output(tcp, end_deferred_output(tcp));
+}
+
+/*
+ * Append LEN bytes of the deferred output left by end_deferred_output
+ * to the log of the tracee.
+ */
+void
+write_deferred_output(struct tcb *tcp, const size_t len)
+{
+	if (tcp->rep && tcp->rep->count)
+		print_repeats(tcp);
+
+	if (!tcb_output_separate() && printing_tcp && printing_tcp != tcp
+	    && printing_tcp->curcol != 0) {
+		current_tcp = printing_tcp;
+		tprints(" <unfinished ...>\n");
+		printing_tcp->curcol = 0;
+	}
+
+	current_tcp = tcp;
+	printing_tcp = tcp;
+	if (fwrite(tcp->deferred_buf, 1, len, tcp->outf) != len
+	    && tcp->outf != stderr)
+		perror_msg("%s", outfname);
+	if (tcp->outlog)
+		tcp->outlog->size += len;
+}
+
+void
+discard_deferred_output(struct tcb *tcp)
+{
+	end_deferred_output(tcp);
+	tcp->curcol = 0;
+}
+#else /* !HAVE_OPEN_MEMSTREAM */
+/* Without open_memstream, the output is never deferred.  */
+void defer_tcp_output(struct tcb *tcp) {}
+void commit_deferred_output(struct tcb *tcp) {}
+void write_deferred_output(struct tcb *tcp, size_t len) {}
+void discard_deferred_output(struct tcb *tcp) {}
+size_t end_deferred_output(struct tcb *tcp) { return 0; }
+#endif
+
 /* Should be only called directly *after successful attach* to a tracee.
  * Otherwise, "strace -oFILE -ff -p<nonexistant_pid>"
  * may create bogus empty FILE.<nonexistant_pid>, and then die.
@@ -668,68 +1892,492 @@ static void
 newoutf(struct tcb *tcp)
 {
 	tcp->outf = shared_log; /* if not -ff mode, the same file is for all */
+	if (output_rotation)
+		tcp->outlog = &shared_output_log;
 	if (followfork >= 2) {
 		char name[520 + sizeof(int) * 3];
 		sprintf(name, "%.512s.%u", outfname, tcp->pid);
-		tcp->outf = strace_fopen(name);
+#ifdef HAVE_FOPENCOOKIE
+		if (output_max_files)
+			tcp->outf = pid_log_open(name);
+		else
+#endif
+			tcp->outf = output_fopen(name);
+		tcp->outbuf = set_output_buffer(tcp->outf);
+		if (output_rotation) {
+			tcp->outlog = xmalloc(sizeof(*tcp->outlog));
+			init_output_log(tcp->outlog, name);
+		}
+	}
+#ifdef HAVE_FOPENCOOKIE
+	else if (complete_lines) {
+		tcp->outf = line_stream_open();
+		tcp->outbuf = set_output_buffer(tcp->outf);
+	}
+#endif
+}
+
+/*
+ * Stops that have been reaped by harvest_events() but not dispatched yet.
+ * When many tracees stop at about the same time, all of them are collected
+ * at once and the subsequent next_event() calls take them from this queue
+ * without any wait4 and sigprocmask calls.
+ *
+ * The queue is dispatched in rounds: harvest_events() reaps every pending
+ * stop, and no new stop is reaped until all of them have been dispatched.
+ * As a tracee cannot stop again before it is restarted, each stopped tracee
+ * is served exactly once per round, so a thread that makes syscalls in
+ * a tight loop cannot make the others wait longer than one round,
+ * whatever order wait4 reports the stops in.
+ */
+static struct harvested_event {
+	int pid;
+	int status;
+	struct rusage ru;
+} *harvested_events;
+static unsigned int harvested_pos, harvested_cnt, harvested_cap;
+/* Whether the last harvest_events() has reaped all pending stops */
+static bool stops_drained;
+/* errno of the failed wait4 of the last harvest_events(), if any */
+static int harvest_errno;
+
+static void
+harvest_events(void)
+{
+	harvested_pos = harvested_cnt = 0;
+	stops_drained = false;
+	harvest_errno = 0;
+
+	for (;;) {
+		if (harvested_cnt == harvested_cap) {
+			harvested_cap = harvested_cap ? harvested_cap * 2 : 64;
+			harvested_events = xreallocarray(harvested_events,
+							 harvested_cap,
+							 sizeof(*harvested_events));
+		}
+
+		struct harvested_event *const e =
+			&harvested_events[harvested_cnt];
+
+		e->pid = wait4(-1, &e->status, __WALL | WNOHANG,
+			       (collect_rusage ? &e->ru : NULL));
+		if (e->pid <= 0) {
+			if (e->pid < 0)
+				harvest_errno = errno;
+			else
+				stops_drained = true;
+			break;
+		}
+		++harvested_cnt;
 	}
 }
 
+/*
+ * The event loop of the tracer, used when it has to handle signals
+ * or timers while waiting for tracees.  Instead of unblocking signals
+ * around a blocking wait4, all handled signals and SIGCHLD stay blocked
+ * and are read from a signalfd, the timers are timerfds, and all of them
+ * are waited for with epoll_wait only when harvest_events() has reaped
+ * all stops, so a busy tracer does not make any sigprocmask calls and
+ * sleeps only when there is nothing to do.
+ */
+static int event_loop_fd = -1;
+static int signal_fd = -1;
+static int summary_timer_fd = -1;
+static int delay_timer_fd = -1;
+static int cgroup_timer_fd = -1;
+static int thread_timer_fd = -1;
+/* --control socket and its current connection */
+static const char *control_path;
+/* Keep running without tracees, see --resident option. */
+static bool resident;
+static int control_fd = -1;
+static int control_conn_fd = -1;
+/* The socket of a --shards tracer to its coordinator, -1 in the coordinator */
+static int shard_fd = -1;
+/* Set when the coordinator has told the shard to exit */
+static bool shard_exit_pending;
+
+static void adopt_tcb(int pid, kernel_ulong_t scno);
+
+static void
+event_loop_add(const int fd)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+
+	if (epoll_ctl(event_loop_fd, EPOLL_CTL_ADD, fd, &ev))
+		perror_msg_and_die("epoll_ctl");
+}
+
+static int
+create_interval_timer(const unsigned int seconds)
+{
+	const struct itimerspec its = {
+		.it_interval = { .tv_sec = seconds },
+		.it_value = { .tv_sec = seconds }
+	};
+	const int fd = timerfd_create(CLOCK_MONOTONIC,
+				      TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if (fd < 0 || timerfd_settime(fd, 0, &its, NULL))
+		perror_msg_and_die("timerfd_create");
+
+	return fd;
+}
+
+static void
+event_loop_init(void)
+{
+	sigset_t mask;
+	int sig;
+
+	/*
+	 * The signals that have handlers installed by set_sigaction
+	 * are read from the signalfd along with SIGCHLD.
+	 */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	for (sig = 1; sig < NSIG; ++sig) {
+		if (sigismember(&blocked_set, sig) > 0
+		    && sigismember(&start_set, sig) == 0)
+			sigaddset(&mask, sig);
+	}
+	sigaddset(&blocked_set, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	event_loop_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (event_loop_fd < 0)
+		perror_msg_and_die("epoll_create1");
+
+	signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signal_fd < 0)
+		perror_msg_and_die("signalfd");
+	event_loop_add(signal_fd);
+
+	if (summary_interval) {
+		summary_timer_fd = create_interval_timer(summary_interval);
+		event_loop_add(summary_timer_fd);
+	}
+	if (inject_delays) {
+		delay_timer_fd = delay_timer_init();
+		event_loop_add(delay_timer_fd);
+	}
+	if (nattach_cgroups) {
+		cgroup_timer_fd = create_interval_timer(1);
+		event_loop_add(cgroup_timer_fd);
+	}
+	if (ntrace_thread_patterns) {
+		thread_timer_fd = create_interval_timer(1);
+		event_loop_add(thread_timer_fd);
+	}
+	if (control_path) {
+		control_fd = control_init(control_path);
+		event_loop_add(control_fd);
+	}
+	if (shard_fd >= 0)
+		event_loop_add(shard_fd);
+}
+
+static void
+read_signal_fd(void)
+{
+	struct signalfd_siginfo si;
+
+	while (read(signal_fd, &si, sizeof(si)) == sizeof(si)) {
+		switch (si.ssi_signo) {
+		case SIGCHLD:
+			stops_drained = false;
+			break;
+		case SIGUSR1:
+			if (ring_buffer_size) {
+				ring_dump_pending = 1;
+				break;
+			}
+			/* fall through */
+		default:
+			interrupted = si.ssi_signo;
+		}
+	}
+}
+
+/* Return true if the timer has expired since the last call.  */
+static bool
+read_timer_fd(const int fd)
+{
+	uint64_t expirations;
+
+	return read(fd, &expirations, sizeof(expirations)) > 0;
+}
+
+static void
+read_shard_fd(void)
+{
+	kernel_ulong_t scno;
+	int pid;
+
+	while ((pid = shard_receive(&scno)) > 0)
+		adopt_tcb(pid, scno);
+	if (pid < 0)
+		shard_exit_pending = true;
+}
+
+/* Sleep until a tracee stops, a handled signal arrives or a timer expires.  */
+static void
+wait_event_loop(void)
+{
+	struct epoll_event evs[4];
+	int i, n;
+
+	n = epoll_wait(event_loop_fd, evs, ARRAY_SIZE(evs), -1);
+	if (n < 0 && errno != EINTR)
+		perror_msg_and_die("epoll_wait");
+
+	for (i = 0; i < n; ++i) {
+		const int fd = evs[i].data.fd;
+
+		if (fd == signal_fd)
+			read_signal_fd();
+		else if (fd == summary_timer_fd)
+			summary_pending |= read_timer_fd(fd);
+		else if (fd == delay_timer_fd)
+			delay_pending |= read_timer_fd(fd);
+		else if (fd == cgroup_timer_fd)
+			cgroup_rescan_pending |= read_timer_fd(fd);
+		else if (fd == thread_timer_fd)
+			thread_rescan_pending |= read_timer_fd(fd);
+		else if (fd == control_fd) {
+			const int conn_fd =
+				control_accept(control_fd, control_conn_fd);
+
+			if (conn_fd != control_conn_fd) {
+				control_conn_fd = conn_fd;
+				event_loop_add(conn_fd);
+			}
+		} else if (fd == control_conn_fd) {
+			if (!control_input(fd))
+				control_conn_fd = -1;
+		} else if (fd == shard_fd) {
+			read_shard_fd();
+		}
+	}
+}
+
+static bool
+pop_harvested_event(int *pid, int *status, struct rusage *ru)
+{
+	while (harvested_pos < harvested_cnt) {
+		const struct harvested_event *const e =
+			&harvested_events[harvested_pos++];
+
+		if (!e->pid)
+			continue;
+		*pid = e->pid;
+		*status = e->status;
+		if (collect_rusage)
+			*ru = e->ru;
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Take the harvested stop of the given tracee, if there is any.
+ */
+static bool
+unqueue_harvested_event(const int pid, int *status)
+{
+	unsigned int i;
+
+	for (i = harvested_pos; i < harvested_cnt; ++i) {
+		if (harvested_events[i].pid == pid) {
+			harvested_events[i].pid = 0;
+			if (status)
+				*status = harvested_events[i].status;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Hash table of tcbs in use keyed by pid, the number of buckets
+ * is kept equal to tcbtabsize, which is always a power of two.
+ */
+static struct tcb **pid_hash;
+/* List of unused tcbs. */
+static struct tcb *free_tcbs;
+
+static struct tcb **
+pid_hash_bucket(const int pid)
+{
+	return &pid_hash[(unsigned int) pid & (tcbtabsize - 1)];
+}
+
+static void
+pid_hash_add(struct tcb *tcp)
+{
+	struct tcb **const bucket = pid_hash_bucket(tcp->pid);
+
+	tcp->next_tcb = *bucket;
+	*bucket = tcp;
+}
+
+static void
+pid_hash_del(struct tcb *tcp)
+{
+	struct tcb **p;
+
+	for (p = pid_hash_bucket(tcp->pid); *p; p = &(*p)->next_tcb) {
+		if (*p == tcp) {
+			*p = tcp->next_tcb;
+			tcp->next_tcb = NULL;
+			return;
+		}
+	}
+}
+
+/* Put unused tcbs on the free list, lowest index first. */
+static void
+rebuild_free_tcbs(const unsigned int from)
+{
+	unsigned int i;
+
+	free_tcbs = NULL;
+	for (i = tcbtabsize; i > from; --i) {
+		if (!tcbtab[i - 1]->pid) {
+			tcbtab[i - 1]->next_tcb = free_tcbs;
+			free_tcbs = tcbtab[i - 1];
+		}
+	}
+}
+
+static void
+rehash_tcbs(void)
+{
+	unsigned int i;
+
+	free(pid_hash);
+	pid_hash = xcalloc(tcbtabsize, sizeof(pid_hash[0]));
+	for (i = 0; i < tcbtabsize; ++i) {
+		if (tcbtab[i]->pid)
+			pid_hash_add(tcbtab[i]);
+	}
+}
+
+/*
+ * The table is not shrunk below this size, and it is shrunk only
+ * when less than a quarter of it is in use, so that a steady number
+ * of short-lived tracees does not make it grow and shrink all the time.
+ * It is allocated at this size at once, too.
+ */
+#define TCBTAB_MIN_SIZE 64
+
+static void
+expand_tcbtab(void)
+{
+	/* Allocate some (more) TCBs (and expand the table).
+	   We don't want to relocate the TCBs because our
+	   callers have pointers and it would be a pain.
+	   So tcbtab is a table of pointers.  TCBs are allocated
+	   one by one, so that shrink_tcbtab can free them.  */
+	const unsigned int old_tcbtabsize = tcbtabsize;
+	const unsigned int new_tcbtabsize =
+		tcbtabsize ? tcbtabsize * 2 : TCBTAB_MIN_SIZE;
+
+	tcbtab = xreallocarray(tcbtab, new_tcbtabsize, sizeof(tcbtab[0]));
+	while (tcbtabsize < new_tcbtabsize)
+		tcbtab[tcbtabsize++] = xcalloc(1, sizeof(struct tcb));
+	selfprof_cache_add(SELFPROF_CACHE_TCBS,
+			   new_tcbtabsize - old_tcbtabsize,
+			   (new_tcbtabsize - old_tcbtabsize)
+			   * (sizeof(struct tcb) + sizeof(tcbtab[0])));
+
+	/* The free list is empty here, all old tcbs are in use. */
+	rebuild_free_tcbs(old_tcbtabsize);
+	rehash_tcbs();
+}
+
+/*
+ * Free unused tcbs after the number of tracees has dropped.
+ * Tcbs in use are moved to the beginning of the table, so this must not
+ * be called while the table is being iterated over; next_event calls it
+ * between events.
+ */
 static void
-expand_tcbtab(void)
+shrink_tcbtab(void)
 {
-	/* Allocate some (more) TCBs (and expand the table).
-	   We don't want to relocate the TCBs because our
-	   callers have pointers and it would be a pain.
-	   So tcbtab is a table of pointers.  Since we never
-	   free the TCBs, we allocate a single chunk of many.  */
-	unsigned int new_tcbtabsize, alloc_tcbtabsize;
-	struct tcb *newtcbs;
-
-	if (tcbtabsize) {
-		alloc_tcbtabsize = tcbtabsize;
-		new_tcbtabsize = tcbtabsize * 2;
-	} else {
-		new_tcbtabsize = alloc_tcbtabsize = 1;
+	unsigned int new_tcbtabsize = tcbtabsize;
+	unsigned int i;
+
+	if (tcbtabsize <= TCBTAB_MIN_SIZE || nprocs >= tcbtabsize / 4)
+		return;
+
+	while (new_tcbtabsize > TCBTAB_MIN_SIZE
+	       && nprocs < new_tcbtabsize / 4)
+		new_tcbtabsize /= 2;
+
+	struct tcb **const new_tcbtab =
+		xcalloc(new_tcbtabsize, sizeof(new_tcbtab[0]));
+	unsigned int nused = 0;
+	unsigned int nunused = nprocs;
+
+	for (i = 0; i < tcbtabsize; ++i) {
+		struct tcb *const tcp = tcbtab[i];
+
+		if (tcp->pid)
+			new_tcbtab[nused++] = tcp;
+		else if (nunused < new_tcbtabsize)
+			new_tcbtab[nunused++] = tcp;
+		else
+			free(tcp);
 	}
 
-	newtcbs = xcalloc(alloc_tcbtabsize, sizeof(newtcbs[0]));
-	tcbtab = xreallocarray(tcbtab, new_tcbtabsize, sizeof(tcbtab[0]));
-	while (tcbtabsize < new_tcbtabsize)
-		tcbtab[tcbtabsize++] = newtcbs++;
+	/* All the tcbs that have not been moved to new_tcbtab are freed.  */
+	const long nfreed = tcbtabsize - nunused;
+	const long nslots = tcbtabsize - new_tcbtabsize;
+
+	selfprof_cache_add(SELFPROF_CACHE_TCBS, -nfreed,
+			   -nfreed * (long) sizeof(struct tcb)
+			   - nslots * (long) sizeof(tcbtab[0]));
+
+	free(tcbtab);
+	tcbtab = new_tcbtab;
+	tcbtabsize = new_tcbtabsize;
+	rebuild_free_tcbs(0);
+	rehash_tcbs();
+
+	if (debug_flag)
+		error_msg("shrunk tcb table to %u, active tcbs:%d",
+			  tcbtabsize, nprocs);
 }
 
 static struct tcb *
 alloctcb(int pid)
 {
-	unsigned int i;
 	struct tcb *tcp;
 
-	if (nprocs == tcbtabsize)
+	if (!free_tcbs)
 		expand_tcbtab();
 
-	for (i = 0; i < tcbtabsize; i++) {
-		tcp = tcbtab[i];
-		if (!tcp->pid) {
-			memset(tcp, 0, sizeof(*tcp));
-			tcp->pid = pid;
-#if SUPPORTED_PERSONALITIES > 1
-			tcp->currpers = current_personality;
-#endif
+	tcp = free_tcbs;
+	if (!tcp || tcp->pid)
+		error_msg_and_die("bug in alloctcb");
+	free_tcbs = tcp->next_tcb;
 
-#ifdef USE_LIBUNWIND
-			if (stack_trace_enabled)
-				unwind_tcb_init(tcp);
+	memset(tcp, 0, sizeof(*tcp));
+	tcp->pid = pid;
+	pid_hash_add(tcp);
+#if SUPPORTED_PERSONALITIES > 1
+	tcp->currpers = current_personality;
 #endif
 
-			nprocs++;
-			if (debug_flag)
-				error_msg("new tcb for pid %d, active tcbs:%d",
-					  tcp->pid, nprocs);
-			return tcp;
-		}
-	}
-	error_msg_and_die("bug in alloctcb");
+	nprocs++;
+	if (debug_flag)
+		error_msg("new tcb for pid %d, active tcbs:%d",
+			  tcp->pid, nprocs);
+	return tcp;
 }
 
 void *
@@ -763,17 +2411,161 @@ free_tcb_priv_data(struct tcb *tcp)
 	}
 }
 
+/*
+ * Scratch memory is allocated from chunks by bumping the pointer.
+ * When the current chunk is exhausted, a larger one is allocated,
+ * and on reset only the largest chunk is kept for reuse.
+ */
+struct scratch_chunk {
+	struct scratch_chunk *next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+#define SCRATCH_ALIGN 16
+#define SCRATCH_MIN_SIZE 4096
+
+void *
+tcb_scratch_alloc(struct tcb *tcp, size_t size)
+{
+	struct scratch_chunk *chunk = tcp->_scratch;
+
+	size = (size + SCRATCH_ALIGN - 1) & -(size_t) SCRATCH_ALIGN;
+	if (!size)
+		size = SCRATCH_ALIGN;
+
+	if (!chunk || chunk->size - chunk->used < size) {
+		size_t chunk_size = chunk ? chunk->size * 2 : SCRATCH_MIN_SIZE;
+
+		while (chunk_size < size)
+			chunk_size *= 2;
+
+		struct scratch_chunk *const new_chunk =
+			xmalloc(sizeof(*new_chunk) + chunk_size);
+		new_chunk->next = chunk;
+		new_chunk->size = chunk_size;
+		new_chunk->used = 0;
+		tcp->_scratch = chunk = new_chunk;
+	}
+
+	void *const p = chunk->data + chunk->used;
+	chunk->used += size;
+
+	return p;
+}
+
+void
+tcb_scratch_reset(struct tcb *tcp)
+{
+	struct scratch_chunk *const chunk = tcp->_scratch;
+
+	if (!chunk)
+		return;
+
+	while (chunk->next) {
+		struct scratch_chunk *const next = chunk->next->next;
+
+		free(chunk->next);
+		chunk->next = next;
+	}
+	chunk->used = 0;
+}
+
+void
+tcb_scratch_free(struct tcb *tcp)
+{
+	tcb_scratch_reset(tcp);
+	free(tcp->_scratch);
+	tcp->_scratch = NULL;
+}
+
+/*
+ * Thread groups some threads of which are in group-stop.
+ * Every thread of a stopped thread group reports the group-stop,
+ * it is printed only when the first of them does.
+ */
+struct group_stop {
+	int tgid;
+	unsigned int nthreads;
+};
+
+static struct group_stop *group_stops;
+static unsigned int group_stops_count, group_stops_size;
+
+/* Return true if TCP is the first thread of its group to stop. */
+static bool
+group_stop_begin(struct tcb *tcp)
+{
+	if (tcp->flags & TCB_GROUP_STOPPED)
+		return false;
+	tcp->flags |= TCB_GROUP_STOPPED;
+
+	const int tgid = get_tcb_tgid(tcp);
+	unsigned int i;
+
+	for (i = 0; i < group_stops_count; ++i) {
+		if (group_stops[i].tgid == tgid) {
+			++group_stops[i].nthreads;
+			return false;
+		}
+	}
+
+	if (group_stops_count >= group_stops_size) {
+		group_stops_size = group_stops_size * 2 + 4;
+		group_stops = xreallocarray(group_stops, group_stops_size,
+					    sizeof(*group_stops));
+	}
+	group_stops[group_stops_count++] = (struct group_stop) { tgid, 1 };
+	return true;
+}
+
+static void
+group_stop_end(struct tcb *tcp)
+{
+	unsigned int i;
+
+	tcp->flags &= ~TCB_GROUP_STOPPED;
+	for (i = 0; i < group_stops_count; ++i) {
+		if (group_stops[i].tgid == tcp->tgid) {
+			if (!--group_stops[i].nthreads)
+				group_stops[i] = group_stops[--group_stops_count];
+			return;
+		}
+	}
+}
+
 static void
 droptcb(struct tcb *tcp)
 {
 	if (tcp->pid == 0)
 		return;
 
-	int p;
-	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p)
-		free(tcp->inject_vec[p]);
+	if (tcp->flags & TCB_GROUP_STOPPED)
+		group_stop_end(tcp);
+
+	if (tcp->inj) {
+		int p;
+		for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+			const long n = tcp->inj->ncounters[p];
+
+			selfprof_cache_add(SELFPROF_CACHE_INJECT, -n,
+					   -n * (long) sizeof(struct
+							      inject_counter));
+			free(tcp->inj->counters[p]);
+		}
+		selfprof_cache_add(SELFPROF_CACHE_INJECT, 0,
+				   -(long) sizeof(*tcp->inj));
+		delay_queue_remove(tcp);
+		free(tcp->inj);
+		tcp->inj = NULL;
+	}
 
 	free_tcb_priv_data(tcp);
+	tcb_scratch_free(tcp);
+	fd_cache_free(tcp);
+	mem_source_free(tcp->mem_source);
+	tcp->mem_source = NULL;
 
 #ifdef USE_LIBUNWIND
 	if (stack_trace_enabled) {
@@ -786,11 +2578,33 @@ droptcb(struct tcb *tcp)
 		error_msg("dropped tcb for pid %d, %d remain",
 			  tcp->pid, nprocs);
 
+	if (tcp->flags & TCB_DEFERRED_OUTPUT) {
+		if (json_output)
+			json_syscall_unfinished(tcp, "unfinished");
+		else
+			commit_deferred_output(tcp);
+	}
+	if (tcp->deferred_outf) {
+		fclose(tcp->deferred_outf);
+		free(tcp->deferred_buf);
+	}
+	if (tcp->rep) {
+		if (tcp->rep->count)
+			print_repeats(tcp);
+		free(tcp->rep);
+		tcp->rep = NULL;
+	}
+
 	if (tcp->outf) {
-		if (followfork >= 2) {
+		if (tcb_output_separate()) {
 			if (tcp->curcol != 0)
 				fprintf(tcp->outf, " <detached ...>\n");
 			fclose(tcp->outf);
+			free(tcp->outbuf);
+			if (tcp->outlog && tcp->outlog != &shared_output_log) {
+				free(tcp->outlog->name);
+				free(tcp->outlog);
+			}
 		} else {
 			if (printing_tcp == tcp && tcp->curcol != 0)
 				fprintf(tcp->outf, " <detached ...>\n");
@@ -803,7 +2617,12 @@ droptcb(struct tcb *tcp)
 	if (printing_tcp == tcp)
 		printing_tcp = NULL;
 
+	while (unqueue_harvested_event(tcp->pid, NULL))
+		;
+	pid_hash_del(tcp);
 	memset(tcp, 0, sizeof(*tcp));
+	tcp->next_tcb = free_tcbs;
+	free_tcbs = tcp;
 }
 
 /* Detach traced process.
@@ -812,10 +2631,23 @@ droptcb(struct tcb *tcp)
  * would SIGSTOP it and wait for its SIGSTOP notification forever.
  */
 static void
-detach(struct tcb *tcp)
+detach_finish(struct tcb *tcp)
+{
+	if (!qflag && (tcp->flags & TCB_ATTACHED))
+		error_msg("Process %u detached", tcp->pid);
+
+	droptcb(tcp);
+}
+
+/*
+ * Start detaching from the tracee.  Return false if it is done
+ * and the tcb has been dropped, or true if detach_handle_stop
+ * has to be called on the next stop of the tracee.
+ */
+static bool
+detach_start(struct tcb *tcp)
 {
 	int error;
-	int status;
 
 	/*
 	 * Linux wrongly insists the child be stopped
@@ -831,7 +2663,7 @@ detach(struct tcb *tcp)
 	 * would be left stopped (process state T).
 	 */
 	if (tcp->flags & TCB_IGNORE_ONE_SIGSTOP)
-		goto wait_loop;
+		return true;
 
 	error = ptrace(PTRACE_DETACH, tcp->pid, 0, 0);
 	if (!error) {
@@ -861,28 +2693,122 @@ detach(struct tcb *tcp)
 		 */
 		error = ptrace(PTRACE_INTERRUPT, tcp->pid, 0, 0);
 		if (!error)
-			goto wait_loop;
+			return true;
 		if (errno != ESRCH)
 			perror_msg("detach: ptrace(PTRACE_INTERRUPT,%u)", tcp->pid);
 	} else {
 		error = my_tkill(tcp->pid, SIGSTOP);
 		if (!error)
-			goto wait_loop;
+			return true;
 		if (errno != ESRCH)
 			perror_msg("detach: tkill(%u,SIGSTOP)", tcp->pid);
 	}
 	/* Either process doesn't exist, or some weird error. */
-	goto drop;
 
- wait_loop:
-	/* We end up here in three cases:
-	 * 1. We sent PTRACE_INTERRUPT (use_seize case)
-	 * 2. We sent SIGSTOP (!use_seize)
-	 * 3. Attach SIGSTOP was already pending (TCB_IGNORE_ONE_SIGSTOP set)
-	 */
+ drop:
+	detach_finish(tcp);
+	return false;
+}
+
+/*
+ * Handle a wait status of the tracee being detached.  We end up here
+ * in three cases:
+ * 1. We sent PTRACE_INTERRUPT (use_seize case)
+ * 2. We sent SIGSTOP (!use_seize)
+ * 3. Attach SIGSTOP was already pending (TCB_IGNORE_ONE_SIGSTOP set)
+ *
+ * Return true if detaching is done and the tcb has been dropped,
+ * or false if the next stop of the tracee has to be waited for.
+ */
+static bool
+detach_handle_stop(struct tcb *tcp, const int status)
+{
+	unsigned int sig;
+	int error;
+
+	if (!WIFSTOPPED(status)) {
+		/*
+		 * Tracee exited or was killed by signal.
+		 * We shouldn't normally reach this place:
+		 * we don't want to consume exit status.
+		 * Consider "strace -p PID" being ^C-ed:
+		 * we want merely to detach from PID.
+		 *
+		 * However, we _can_ end up here if tracee
+		 * was SIGKILLed.
+		 */
+		goto drop;
+	}
+	sig = WSTOPSIG(status);
+	if (debug_flag)
+		error_msg("detach wait: event:%d sig:%d",
+			  (unsigned)status >> 16, sig);
+	if (use_seize) {
+		unsigned event = (unsigned)status >> 16;
+		if (event == PTRACE_EVENT_STOP /*&& sig == SIGTRAP*/) {
+			/*
+			 * sig == SIGTRAP: PTRACE_INTERRUPT stop.
+			 * sig == other: process was already stopped
+			 * with this stopping sig (see tests/detach-stopped).
+			 * Looks like re-injecting this sig is not necessary
+			 * in DETACH for the tracee to remain stopped.
+			 */
+			sig = 0;
+		}
+		/*
+		 * PTRACE_INTERRUPT is not guaranteed to produce
+		 * the above event if other ptrace-stop is pending.
+		 * See tests/detach-sleeping testcase:
+		 * strace got SIGINT while tracee is sleeping.
+		 * We sent PTRACE_INTERRUPT.
+		 * We see syscall exit, not PTRACE_INTERRUPT stop.
+		 * We won't get PTRACE_INTERRUPT stop
+		 * if we would CONT now. Need to DETACH.
+		 */
+		if (sig == syscall_trap_sig)
+			sig = 0;
+		/* else: not sure in which case we can be here.
+		 * Signal stop? Inject it while detaching.
+		 */
+		ptrace_restart(PTRACE_DETACH, tcp, sig);
+		goto drop;
+	}
+	/* Note: this check has to be after use_seize check */
+	/* (else, in use_seize case SIGSTOP will be mistreated) */
+	if (sig == SIGSTOP) {
+		/* Detach, suppressing SIGSTOP */
+		ptrace_restart(PTRACE_DETACH, tcp, 0);
+		goto drop;
+	}
+	if (sig == syscall_trap_sig)
+		sig = 0;
+	/* Can't detach just yet, may need to wait for SIGSTOP */
+	error = ptrace_restart(PTRACE_CONT, tcp, sig);
+	if (error < 0) {
+		/* Should not happen.
+		 * Note: ptrace_restart returns 0 on ESRCH, so it's not it.
+		 * ptrace_restart already emitted error message.
+		 */
+		goto drop;
+	}
+	return false;
+
+ drop:
+	detach_finish(tcp);
+	return true;
+}
+
+static void
+detach(struct tcb *tcp)
+{
+	int status;
+
+	if (!detach_start(tcp))
+		return;
+
 	for (;;) {
-		unsigned int sig;
-		if (waitpid(tcp->pid, &status, __WALL) < 0) {
+		if (!unqueue_harvested_event(tcp->pid, &status) &&
+		    waitpid(tcp->pid, &status, __WALL) < 0) {
 			if (errno == EINTR)
 				continue;
 			/*
@@ -891,80 +2817,12 @@ detach(struct tcb *tcp)
 			 * and want to emit a message otherwise:
 			 */
 			perror_msg("detach: waitpid(%u)", tcp->pid);
-			break;
-		}
-		if (!WIFSTOPPED(status)) {
-			/*
-			 * Tracee exited or was killed by signal.
-			 * We shouldn't normally reach this place:
-			 * we don't want to consume exit status.
-			 * Consider "strace -p PID" being ^C-ed:
-			 * we want merely to detach from PID.
-			 *
-			 * However, we _can_ end up here if tracee
-			 * was SIGKILLed.
-			 */
-			break;
-		}
-		sig = WSTOPSIG(status);
-		if (debug_flag)
-			error_msg("detach wait: event:%d sig:%d",
-				  (unsigned)status >> 16, sig);
-		if (use_seize) {
-			unsigned event = (unsigned)status >> 16;
-			if (event == PTRACE_EVENT_STOP /*&& sig == SIGTRAP*/) {
-				/*
-				 * sig == SIGTRAP: PTRACE_INTERRUPT stop.
-				 * sig == other: process was already stopped
-				 * with this stopping sig (see tests/detach-stopped).
-				 * Looks like re-injecting this sig is not necessary
-				 * in DETACH for the tracee to remain stopped.
-				 */
-				sig = 0;
-			}
-			/*
-			 * PTRACE_INTERRUPT is not guaranteed to produce
-			 * the above event if other ptrace-stop is pending.
-			 * See tests/detach-sleeping testcase:
-			 * strace got SIGINT while tracee is sleeping.
-			 * We sent PTRACE_INTERRUPT.
-			 * We see syscall exit, not PTRACE_INTERRUPT stop.
-			 * We won't get PTRACE_INTERRUPT stop
-			 * if we would CONT now. Need to DETACH.
-			 */
-			if (sig == syscall_trap_sig)
-				sig = 0;
-			/* else: not sure in which case we can be here.
-			 * Signal stop? Inject it while detaching.
-			 */
-			ptrace_restart(PTRACE_DETACH, tcp, sig);
-			break;
-		}
-		/* Note: this check has to be after use_seize check */
-		/* (else, in use_seize case SIGSTOP will be mistreated) */
-		if (sig == SIGSTOP) {
-			/* Detach, suppressing SIGSTOP */
-			ptrace_restart(PTRACE_DETACH, tcp, 0);
-			break;
-		}
-		if (sig == syscall_trap_sig)
-			sig = 0;
-		/* Can't detach just yet, may need to wait for SIGSTOP */
-		error = ptrace_restart(PTRACE_CONT, tcp, sig);
-		if (error < 0) {
-			/* Should not happen.
-			 * Note: ptrace_restart returns 0 on ESRCH, so it's not it.
-			 * ptrace_restart already emitted error message.
-			 */
-			break;
+			detach_finish(tcp);
+			return;
 		}
+		if (detach_handle_stop(tcp, status))
+			return;
 	}
-
- drop:
-	if (!qflag && (tcp->flags & TCB_ATTACHED))
-		error_msg("Process %u detached", tcp->pid);
-
-	droptcb(tcp);
 }
 
 static void
@@ -995,67 +2853,256 @@ process_opt_p_list(char *opt)
 	}
 }
 
-static void
-attach_tcb(struct tcb *const tcp)
+static void attach_tcb(struct tcb *, bool rescan);
+
+/*
+ * Add tcbs for the members of the cgroup that are not traced yet,
+ * attach to them in rescans.  Processes are read from cgroup.procs,
+ * their threads are found by attach_tcb, with -f; otherwise every thread
+ * of cgroup.threads is attached on its own, like with -p TID.
+ * Return the number of new members.
+ */
+static unsigned int
+scan_cgroup(const char *const path, const bool rescan)
 {
-	if (ptrace_attach_or_seize(tcp->pid) < 0) {
-		perror_msg("attach: ptrace(%s, %d)",
-			   ptrace_attach_cmd, tcp->pid);
-		droptcb(tcp);
-		return;
+	char fname[PATH_MAX];
+	unsigned int n = 0;
+	FILE *fp;
+	int pid;
+
+	snprintf(fname, sizeof(fname), "%s/%s", path,
+		 followfork ? "cgroup.procs" : "cgroup.threads");
+	fp = fopen(fname, "r");
+	if (!fp) {
+		if (rescan)
+			return 0;
+		perror_msg_and_die("%s", fname);
 	}
 
-	tcp->flags |= TCB_ATTACHED | TCB_STARTUP | post_attach_sigstop;
-	newoutf(tcp);
-	if (debug_flag)
-		error_msg("attach to pid %d (main) succeeded", tcp->pid);
+	while (fscanf(fp, "%d", &pid) == 1) {
+		if (pid <= 0 || pid == strace_tracer_pid || pid2tcb(pid)
+		    || (nshards && !shard_owns(pid)))
+			continue;
+
+		struct tcb *const tcp = alloctcb(pid);
+
+		if (rescan)
+			attach_tcb(tcp, true);
+		++n;
+	}
+
+	fclose(fp);
+	return n;
+}
+
+static void
+rescan_cgroups(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < nattach_cgroups; ++i)
+		scan_cgroup(attach_cgroups[i], true);
+}
 
+/*
+ * Seize the threads of the process that have no tcb yet and add their pids
+ * to the *tids array.  Return the number of threads seized.
+ * Threads that cannot be seized in the first scan are counted in *nerr;
+ * in rescans, they most likely are new threads already attached
+ * by PTRACE_O_TRACECLONE, so their errors are ignored.
+ */
+static unsigned int
+attach_threads(const int pid, const bool rescan, pid_t **tids,
+	       unsigned int *ntids, unsigned int *tids_size,
+	       unsigned int *nerr)
+{
 	char procdir[sizeof("/proc/%d/task") + sizeof(int) * 3];
+	unsigned int nseized = 0;
 	DIR *dir;
-	unsigned int ntid = 0, nerr = 0;
 
-	if (followfork && tcp->pid != strace_child &&
-	    sprintf(procdir, "/proc/%d/task", tcp->pid) > 0 &&
-	    (dir = opendir(procdir)) != NULL) {
-		struct_dirent *de;
+	sprintf(procdir, "/proc/%d/task", pid);
+	dir = opendir(procdir);
+	if (!dir)
+		return 0;
 
-		while ((de = read_dir(dir)) != NULL) {
-			if (de->d_fileno == 0)
-				continue;
+	struct_dirent *de;
 
-			int tid = string_to_uint(de->d_name);
-			if (tid <= 0 || tid == tcp->pid)
-				continue;
+	while ((de = read_dir(dir)) != NULL) {
+		if (de->d_fileno == 0)
+			continue;
 
-			++ntid;
-			if (ptrace_attach_or_seize(tid) < 0) {
-				++nerr;
+		int tid = string_to_uint(de->d_name);
+		if (tid <= 0 || pid2tcb(tid))
+			continue;
+
+		if (ptrace_seize(tid) < 0) {
+			if (!rescan) {
+				++*nerr;
 				if (debug_flag)
 					perror_msg("attach: ptrace(%s, %d)",
 						   ptrace_attach_cmd, tid);
-				continue;
 			}
-			if (debug_flag)
-				error_msg("attach to pid %d succeeded", tid);
+			continue;
+		}
+		if (debug_flag)
+			error_msg("attach to pid %d succeeded", tid);
+
+		struct tcb *tid_tcp = alloctcb(tid);
+		tid_tcp->flags |= TCB_ATTACHED | TCB_STARTUP |
+				  post_attach_sigstop;
+		newoutf(tid_tcp);
+
+		if (*ntids == *tids_size) {
+			*tids_size = *tids_size ? *tids_size * 2 : 64;
+			*tids = xreallocarray(*tids, *tids_size, sizeof(**tids));
+		}
+		(*tids)[(*ntids)++] = tid;
+		++nseized;
+	}
+
+	closedir(dir);
+	return nseized;
+}
+
+/*
+ * Attach to the process of the tcb.  In cgroup rescans, processes that
+ * are already traced, most likely children of tracees whose first stop
+ * has not been seen yet, and processes that are gone are skipped silently.
+ */
+static void
+attach_tcb(struct tcb *const tcp, const bool rescan)
+{
+	if (ptrace_seize(tcp->pid) < 0) {
+		if (!rescan || (errno != EPERM && errno != ESRCH))
+			perror_msg("attach: ptrace(%s, %d)",
+				   ptrace_attach_cmd, tcp->pid);
+		droptcb(tcp);
+		return;
+	}
+
+	tcp->flags |= TCB_ATTACHED | TCB_STARTUP | post_attach_sigstop;
+	newoutf(tcp);
+	if (debug_flag)
+		error_msg("attach to pid %d (main) succeeded", tcp->pid);
 
-			struct tcb *tid_tcp = alloctcb(tid);
-			tid_tcp->flags |= TCB_ATTACHED | TCB_STARTUP |
-					  post_attach_sigstop;
-			newoutf(tid_tcp);
+	/*
+	 * All threads are seized before any of them is interrupted,
+	 * so the process is stopped only for as long as it takes to issue
+	 * PTRACE_INTERRUPT to every thread, and their stops are collected
+	 * by the main loop afterwards.  Threads created by threads that
+	 * have not been seized yet are missed by a scan of the task
+	 * directory, so it is rescanned until no new threads show up.
+	 */
+	enum { MAX_RESCANS = 16 };
+	pid_t *tids = NULL;
+	unsigned int ntids = 0, tids_size = 0;
+	unsigned int ntid = 0, nerr = 0;
+	const pid_t main_pid = tcp->pid;
+
+	if (followfork && tcp->pid != strace_child) {
+		unsigned int i;
+
+		ntid = attach_threads(main_pid, false, &tids, &ntids,
+				      &tids_size, &nerr);
+		for (i = 0; i < MAX_RESCANS; ++i) {
+			const unsigned int n =
+				attach_threads(main_pid, true, &tids, &ntids,
+					       &tids_size, &nerr);
+			if (!n)
+				break;
+			ntid += n;
 		}
+		ntid += nerr;
+	}
 
-		closedir(dir);
+#if USE_SEIZE
+	if (use_seize) {
+		unsigned int i;
+
+		if (ptrace_interrupt(main_pid) < 0 && errno != ESRCH)
+			perror_msg("attach: ptrace(PTRACE_INTERRUPT, %d)",
+				   main_pid);
+		for (i = 0; i < ntids; ++i) {
+			if (ptrace_interrupt(tids[i]) < 0 && errno != ESRCH)
+				perror_msg("attach: ptrace(PTRACE_INTERRUPT, %d)",
+					   tids[i]);
+		}
 	}
+#endif
+	free(tids);
 
 	if (!qflag) {
 		if (ntid > nerr)
 			error_msg("Process %u attached"
 				  " with %u threads",
-				  tcp->pid, ntid - nerr + 1);
+				  main_pid, ntid - nerr + 1);
 		else
 			error_msg("Process %u attached",
-				  tcp->pid);
+				  main_pid);
+	}
+}
+
+/*
+ * Attach to a process handed off by another shard.  The process is parked
+ * in pause(2) instead of the syscall SCNO, which is put back in the stop
+ * caused by PTRACE_INTERRUPT, see startup_tcb.
+ */
+static void
+adopt_tcb(const int pid, const kernel_ulong_t scno)
+{
+	struct tcb *const tcp = alloctcb(pid);
+
+	if (ptrace_seize(pid) < 0) {
+		if (errno != ESRCH)
+			perror_msg("attach: ptrace(%s, %d)",
+				   ptrace_attach_cmd, pid);
+		droptcb(tcp);
+		return;
+	}
+
+	tcp->flags |= TCB_ATTACHED | TCB_STARTUP | TCB_ADOPTED;
+	tcp->scno = scno;
+	newoutf(tcp);
+#if USE_SEIZE
+	if (ptrace_interrupt(pid) < 0 && errno != ESRCH)
+		perror_msg("attach: ptrace(PTRACE_INTERRUPT, %d)", pid);
+#endif
+	if (!qflag)
+		error_msg("Process %d attached", pid);
+}
+
+/*
+ * Let a process handed off to this shard after it has stopped tracing
+ * make its syscall SCNO untraced: it is detached in its first stop
+ * once the syscall is put back.
+ */
+static void
+release_handoff(const int pid, const kernel_ulong_t scno)
+{
+	struct tcb *const tcp = alloctcb(pid);
+	int status;
+
+	if (ptrace_seize(pid) < 0)
+		goto drop;
+#if USE_SEIZE
+	if (ptrace_interrupt(pid) < 0)
+		goto drop;
+#endif
+	while (waitpid(pid, &status, __WALL) < 0) {
+		if (errno != EINTR)
+			goto drop;
+	}
+	if (WIFSTOPPED(status)) {
+		clear_regs();
+		if (syscall_set_scno(tcp, scno) && errno != ESRCH)
+			perror_msg("handoff of pid %d", pid);
+		/* The signal of a signal-delivery-stop is delivered.  */
+		ptrace(PTRACE_DETACH, pid, 0L,
+		       (unsigned long) ((unsigned int) status >> 16
+					? 0 : WSTOPSIG(status)));
 	}
+drop:
+	droptcb(tcp);
 }
 
 static void
@@ -1111,7 +3158,13 @@ startup_attach(void)
 			continue;
 		}
 
-		attach_tcb(tcp);
+		/* Another shard attaches to it.  */
+		if (nshards && !shard_owns(tcp->pid)) {
+			droptcb(tcp);
+			continue;
+		}
+
+		attach_tcb(tcp, false);
 
 		if (interactive) {
 			sigprocmask(SIG_SETMASK, &start_set, NULL);
@@ -1201,6 +3254,9 @@ exec_or_die(void)
 	if (params_for_tracee.child_sa.sa_handler != SIG_DFL)
 		sigaction(SIGCHLD, &params_for_tracee.child_sa, NULL);
 
+	if (seccomp_filtering)
+		init_seccomp_filter();
+
 	execv(params->pathname, params->argv);
 	perror_msg_and_die("exec");
 }
@@ -1452,55 +3508,23 @@ startup_child(char **argv)
 }
 
 #if USE_SEIZE
+/*
+ * PTRACE_SEIZE, unlike ATTACH, doesn't force tracee to trap.  After
+ * attaching tracee continues to run unless a trap condition occurs.
+ * PTRACE_SEIZE doesn't affect signal or group stop state.
+ *
+ * It is available since Linux 3.4.  Rather than probing it with a forked
+ * child on every startup, it is assumed to work on these kernels, and
+ * try_ptrace_seize falls back to PTRACE_ATTACH if the first attach
+ * shows otherwise.
+ */
 static void
 test_ptrace_seize(void)
 {
-	int pid;
-
-	/* Need fork for test. NOMMU has no forks */
-	if (NOMMU_SYSTEM) {
-		post_attach_sigstop = 0; /* this sets use_seize to 1 */
-		return;
-	}
-
-	pid = fork();
-	if (pid < 0)
-		perror_msg_and_die("fork");
-
-	if (pid == 0) {
-		pause();
-		_exit(0);
-	}
-
-	/* PTRACE_SEIZE, unlike ATTACH, doesn't force tracee to trap.  After
-	 * attaching tracee continues to run unless a trap condition occurs.
-	 * PTRACE_SEIZE doesn't affect signal or group stop state.
-	 */
-	if (ptrace(PTRACE_SEIZE, pid, 0, 0) == 0) {
+	if (NOMMU_SYSTEM || os_release >= KERNEL_VERSION(3, 4, 0))
 		post_attach_sigstop = 0; /* this sets use_seize to 1 */
-	} else if (debug_flag) {
+	else if (debug_flag)
 		error_msg("PTRACE_SEIZE doesn't work");
-	}
-
-	kill(pid, SIGKILL);
-
-	while (1) {
-		int status, tracee_pid;
-
-		errno = 0;
-		tracee_pid = waitpid(pid, &status, 0);
-		if (tracee_pid <= 0) {
-			if (errno == EINTR)
-				continue;
-			perror_msg_and_die("%s: unexpected wait result %d",
-					 __func__, tracee_pid);
-		}
-		if (WIFSIGNALED(status)) {
-			return;
-		}
-		error_msg_and_die("%s: unexpected wait status %#x",
-				  __func__, status);
-	}
 }
 #else /* !USE_SEIZE */
 # define test_ptrace_seize() ((void)0)
@@ -1539,6 +3563,24 @@ get_os_release(void)
 	return rel;
 }
 
+static void
+add_patterns(const char ***const patterns, unsigned int *const npatterns,
+	     const char *const option, const char *const arg)
+{
+	char *copy = xstrdup(arg);
+	char *saveptr = NULL;
+	const char *pattern;
+
+	for (pattern = strtok_r(copy, ",", &saveptr); pattern;
+	     pattern = strtok_r(NULL, ",", &saveptr)) {
+		*patterns = xreallocarray(*patterns, *npatterns + 1,
+					  sizeof(**patterns));
+		(*patterns)[(*npatterns)++] = pattern;
+	}
+	if (!*npatterns)
+		error_long_opt_arg(option, arg);
+}
+
 static void
 set_sigaction(int signo, void (*sighandler)(int), struct sigaction *oldact)
 {
@@ -1563,6 +3605,212 @@ init(int argc, char *argv[])
 {
 	int c, i;
 	int optF = 0;
+	bool opt_overhead_auto = false;
+	bool opt_overhead = false;
+
+	enum {
+		GETOPT_SECCOMP = 0x100,
+		GETOPT_OUTPUT_BUFFER,
+		GETOPT_OUTPUT_POLICY,
+		GETOPT_OUTPUT_QUEUE,
+		GETOPT_OUTPUT_COMPRESS,
+		GETOPT_OUTPUT_ASYNC,
+		GETOPT_OUTPUT_MAX_FILES,
+		GETOPT_OUTPUT_ROTATE_SIZE,
+		GETOPT_OUTPUT_ROTATE_INTERVAL,
+		GETOPT_OUTPUT_ROTATE_KEEP,
+		GETOPT_OUTPUT_ROTATE_GZIP,
+		GETOPT_BINARY_OUTPUT,
+		GETOPT_IO_CAPTURE,
+		GETOPT_IO_CAPTURE_STREAMS,
+		GETOPT_BINARY_DECODE,
+		GETOPT_BINARY_QUERY,
+		GETOPT_BINARY_DECODE_JOBS,
+		GETOPT_TRACE_EVENTS,
+		GETOPT_SPAWN_PROFILE,
+		GETOPT_SPAWN_PROFILE_FORMAT,
+		GETOPT_FILE_DEPS,
+		GETOPT_MERGE_LOGS,
+		GETOPT_PROCESS_TREE,
+		GETOPT_SUMMARY_DIFF,
+		GETOPT_SUMMARY_MERGE,
+		GETOPT_REPLAY,
+		GETOPT_REPLAY_DIR,
+		GETOPT_REPLAY_DATA,
+		GETOPT_REPLAY_FAST,
+		GETOPT_EXECVE_ENV,
+		GETOPT_MMSG_STATS,
+		GETOPT_BPF_DEDUP,
+		GETOPT_NOTIFY_EVENTS,
+		GETOPT_COUNT_BACKEND,
+		GETOPT_TRACE_EXEC,
+		GETOPT_TRACE_THREADS,
+		GETOPT_COUNT_CGROUP,
+		GETOPT_ATTACH_CGROUP,
+		GETOPT_SUMMARY_LATENCY,
+		GETOPT_SUMMARY_HISTOGRAM,
+		GETOPT_SUMMARY_FORMAT,
+		GETOPT_SUMMARY_IO,
+		GETOPT_SUMMARY_ACCESS,
+		GETOPT_SUMMARY_FLOWS,
+		GETOPT_SUMMARY_CONNECTS,
+		GETOPT_SUMMARY_FDS,
+		GETOPT_SUMMARY_FUTEX,
+		GETOPT_SUMMARY_IPC,
+		GETOPT_SUMMARY_HANDOFF,
+		GETOPT_SUMMARY_AIO,
+		GETOPT_SUMMARY_EPOLL,
+		GETOPT_SUMMARY_V4L2,
+		GETOPT_SUMMARY_NOTIFY,
+		GETOPT_SUMMARY_MMAP,
+		GETOPT_SUMMARY_SYNC,
+		GETOPT_SUMMARY_OVERSLEEP,
+		GETOPT_SUMMARY_SIGDELIVERY,
+		GETOPT_SUMMARY_ARGS,
+		GETOPT_SUMMARY_INTERVAL,
+		GETOPT_SUMMARY_PIDS,
+		GETOPT_SUMMARY_THREADS,
+		GETOPT_SUMMARY_RUSAGE,
+		GETOPT_SUMMARY_STOPS,
+		GETOPT_SUMMARY_TOP,
+		GETOPT_TOP,
+		GETOPT_TIME_PRECISION,
+		GETOPT_MONOTONIC_TS,
+		GETOPT_STACK_UNWINDER,
+		GETOPT_STACK_DEDUP,
+		GETOPT_STACK_SNAPSHOT,
+		GETOPT_STACK_OFFLINE,
+		GETOPT_STACK_CACHE,
+		GETOPT_SAMPLE,
+		GETOPT_RATE_LIMIT,
+		GETOPT_TERSE_RATE,
+		GETOPT_OVERHEAD_BUDGET,
+		GETOPT_SELF_PROFILE,
+		GETOPT_CACHE_LIMIT,
+		GETOPT_BENCH_DECODERS,
+		GETOPT_RING_BUFFER,
+		GETOPT_RING_TRIGGER,
+		GETOPT_RING_TRIGGER_ERROR,
+		GETOPT_COMPLETE_LINES,
+		GETOPT_FOLD_REPEATS,
+		GETOPT_FILTER,
+		GETOPT_TRIGGER,
+		GETOPT_TRIGGER_PATH,
+		GETOPT_TRIGGER_ERROR,
+		GETOPT_TRIGGER_SIGNAL,
+		GETOPT_TRIGGER_WINDOW,
+		GETOPT_CONTROL,
+		GETOPT_RESIDENT,
+		GETOPT_TRACER_CPUS,
+		GETOPT_TRACER_SCHED,
+		GETOPT_TRACER_MLOCK,
+		GETOPT_SHARDS,
+		GETOPT_JSON,
+	};
+	static const struct option longopts[] = {
+		{ "seccomp-bpf", no_argument, 0, GETOPT_SECCOMP },
+		{ "output-buffer", required_argument, 0, GETOPT_OUTPUT_BUFFER },
+		{ "output-policy", required_argument, 0, GETOPT_OUTPUT_POLICY },
+		{ "output-queue", required_argument, 0, GETOPT_OUTPUT_QUEUE },
+		{ "output-compress", optional_argument, 0, GETOPT_OUTPUT_COMPRESS },
+		{ "output-async", no_argument, 0, GETOPT_OUTPUT_ASYNC },
+		{ "output-max-files", required_argument, 0, GETOPT_OUTPUT_MAX_FILES },
+		{ "output-rotate-size", required_argument, 0, GETOPT_OUTPUT_ROTATE_SIZE },
+		{ "output-rotate-interval", required_argument, 0, GETOPT_OUTPUT_ROTATE_INTERVAL },
+		{ "output-rotate-keep", required_argument, 0, GETOPT_OUTPUT_ROTATE_KEEP },
+		{ "output-rotate-gzip", no_argument, 0, GETOPT_OUTPUT_ROTATE_GZIP },
+		{ "binary-output", required_argument, 0, GETOPT_BINARY_OUTPUT },
+		{ "io-capture", required_argument, 0, GETOPT_IO_CAPTURE },
+		{ "io-capture-streams", required_argument, 0, GETOPT_IO_CAPTURE_STREAMS },
+		{ "binary-decode", required_argument, 0, GETOPT_BINARY_DECODE },
+		{ "binary-query", required_argument, 0, GETOPT_BINARY_QUERY },
+		{ "binary-decode-jobs", required_argument, 0, GETOPT_BINARY_DECODE_JOBS },
+		{ "trace-events", required_argument, 0, GETOPT_TRACE_EVENTS },
+		{ "spawn-profile", required_argument, 0, GETOPT_SPAWN_PROFILE },
+		{ "spawn-profile-format", required_argument, 0, GETOPT_SPAWN_PROFILE_FORMAT },
+		{ "file-deps", required_argument, 0, GETOPT_FILE_DEPS },
+		{ "merge-logs", required_argument, 0, GETOPT_MERGE_LOGS },
+		{ "process-tree", required_argument, 0, GETOPT_PROCESS_TREE },
+		{ "summary-diff", required_argument, 0, GETOPT_SUMMARY_DIFF },
+		{ "summary-merge", no_argument, 0, GETOPT_SUMMARY_MERGE },
+		{ "replay", required_argument, 0, GETOPT_REPLAY },
+		{ "replay-dir", required_argument, 0, GETOPT_REPLAY_DIR },
+		{ "replay-data", required_argument, 0, GETOPT_REPLAY_DATA },
+		{ "replay-fast", no_argument, 0, GETOPT_REPLAY_FAST },
+		{ "execve-env", required_argument, 0, GETOPT_EXECVE_ENV },
+		{ "mmsg-stats", no_argument, 0, GETOPT_MMSG_STATS },
+		{ "bpf-dedup", no_argument, 0, GETOPT_BPF_DEDUP },
+		{ "notify-events", no_argument, 0, GETOPT_NOTIFY_EVENTS },
+		{ "count-backend", required_argument, 0, GETOPT_COUNT_BACKEND },
+		{ "trace-exec", required_argument, 0, GETOPT_TRACE_EXEC },
+		{ "trace-threads", required_argument, 0, GETOPT_TRACE_THREADS },
+		{ "count-cgroup", required_argument, 0, GETOPT_COUNT_CGROUP },
+		{ "attach-cgroup", required_argument, 0, GETOPT_ATTACH_CGROUP },
+		{ "summary-latency", no_argument, 0, GETOPT_SUMMARY_LATENCY },
+		{ "summary-histogram", no_argument, 0, GETOPT_SUMMARY_HISTOGRAM },
+		{ "summary-format", required_argument, 0, GETOPT_SUMMARY_FORMAT },
+		{ "summary-io", optional_argument, 0, GETOPT_SUMMARY_IO },
+		{ "summary-access", optional_argument, 0, GETOPT_SUMMARY_ACCESS },
+		{ "summary-flows", optional_argument, 0, GETOPT_SUMMARY_FLOWS },
+		{ "summary-connects", optional_argument, 0, GETOPT_SUMMARY_CONNECTS },
+		{ "summary-fds", optional_argument, 0, GETOPT_SUMMARY_FDS },
+		{ "summary-futex", optional_argument, 0, GETOPT_SUMMARY_FUTEX },
+		{ "summary-ipc", optional_argument, 0, GETOPT_SUMMARY_IPC },
+		{ "summary-handoff", optional_argument, 0, GETOPT_SUMMARY_HANDOFF },
+		{ "summary-aio", optional_argument, 0, GETOPT_SUMMARY_AIO },
+		{ "summary-epoll", optional_argument, 0, GETOPT_SUMMARY_EPOLL },
+		{ "summary-v4l2", optional_argument, 0, GETOPT_SUMMARY_V4L2 },
+		{ "summary-notify", optional_argument, 0, GETOPT_SUMMARY_NOTIFY },
+		{ "summary-mmap", optional_argument, 0, GETOPT_SUMMARY_MMAP },
+		{ "summary-sync", optional_argument, 0, GETOPT_SUMMARY_SYNC },
+		{ "summary-oversleep", optional_argument, 0,
+		  GETOPT_SUMMARY_OVERSLEEP },
+		{ "summary-sigdelivery", optional_argument, 0,
+		  GETOPT_SUMMARY_SIGDELIVERY },
+		{ "summary-args", required_argument, 0, GETOPT_SUMMARY_ARGS },
+		{ "summary-interval", required_argument, 0, GETOPT_SUMMARY_INTERVAL },
+		{ "summary-pids", optional_argument, 0, GETOPT_SUMMARY_PIDS },
+		{ "summary-threads", optional_argument, 0, GETOPT_SUMMARY_THREADS },
+		{ "summary-rusage", optional_argument, 0, GETOPT_SUMMARY_RUSAGE },
+		{ "summary-stops", optional_argument, 0, GETOPT_SUMMARY_STOPS },
+		{ "summary-top", required_argument, 0, GETOPT_SUMMARY_TOP },
+		{ "top", optional_argument, 0, GETOPT_TOP },
+		{ "time-precision", required_argument, 0, GETOPT_TIME_PRECISION },
+		{ "monotonic-ts", no_argument, 0, GETOPT_MONOTONIC_TS },
+		{ "sample", required_argument, 0, GETOPT_SAMPLE },
+		{ "rate-limit", required_argument, 0, GETOPT_RATE_LIMIT },
+		{ "terse-rate", required_argument, 0, GETOPT_TERSE_RATE },
+		{ "overhead-budget", required_argument, 0, GETOPT_OVERHEAD_BUDGET },
+		{ "self-profile", no_argument, 0, GETOPT_SELF_PROFILE },
+		{ "cache-limit", required_argument, 0, GETOPT_CACHE_LIMIT },
+		{ "bench-decoders", optional_argument, 0, GETOPT_BENCH_DECODERS },
+		{ "ring-buffer", required_argument, 0, GETOPT_RING_BUFFER },
+		{ "ring-trigger", required_argument, 0, GETOPT_RING_TRIGGER },
+		{ "ring-trigger-error", required_argument, 0, GETOPT_RING_TRIGGER_ERROR },
+		{ "complete-lines", no_argument, 0, GETOPT_COMPLETE_LINES },
+		{ "fold-repeats", no_argument, 0, GETOPT_FOLD_REPEATS },
+		{ "filter", required_argument, 0, GETOPT_FILTER },
+		{ "trigger", required_argument, 0, GETOPT_TRIGGER },
+		{ "trigger-path", required_argument, 0, GETOPT_TRIGGER_PATH },
+		{ "trigger-error", required_argument, 0, GETOPT_TRIGGER_ERROR },
+		{ "trigger-signal", required_argument, 0, GETOPT_TRIGGER_SIGNAL },
+		{ "trigger-window", required_argument, 0, GETOPT_TRIGGER_WINDOW },
+		{ "control", required_argument, 0, GETOPT_CONTROL },
+		{ "resident", no_argument, 0, GETOPT_RESIDENT },
+		{ "tracer-cpus", required_argument, 0, GETOPT_TRACER_CPUS },
+		{ "tracer-sched", required_argument, 0, GETOPT_TRACER_SCHED },
+		{ "tracer-mlock", no_argument, 0, GETOPT_TRACER_MLOCK },
+		{ "shards", required_argument, 0, GETOPT_SHARDS },
+		{ "json", no_argument, 0, GETOPT_JSON },
+#ifdef USE_LIBUNWIND
+		{ "stack-unwinder", required_argument, 0, GETOPT_STACK_UNWINDER },
+		{ "stack-dedup", no_argument, 0, GETOPT_STACK_DEDUP },
+		{ "stack-snapshot", optional_argument, 0, GETOPT_STACK_SNAPSHOT },
+		{ "stack-offline", no_argument, 0, GETOPT_STACK_OFFLINE },
+		{ "stack-cache", required_argument, 0, GETOPT_STACK_CACHE },
+#endif
+		{ 0, 0, 0, 0 }
+	};
 
 	if (!program_invocation_name || !*program_invocation_name) {
 		static char name[] = "strace";
@@ -1580,17 +3828,18 @@ init(int argc, char *argv[])
 	qualify("trace=all");
 	qualify("abbrev=all");
 	qualify("verbose=all");
-#if DEFAULT_QUAL_FLAGS != (QUAL_TRACE | QUAL_ABBREV | QUAL_VERBOSE)
+	qualify("stack=all");
+#if DEFAULT_QUAL_FLAGS != (QUAL_TRACE | QUAL_ABBREV | QUAL_VERBOSE | QUAL_STACK)
 # error Bug in DEFAULT_QUAL_FLAGS
 #endif
 	qualify("signal=all");
-	while ((c = getopt(argc, argv,
+	while ((c = getopt_long(argc, argv,
 		"+b:cCdfFhiqrtTvVwxyz"
 #ifdef USE_LIBUNWIND
 		"k"
 #endif
 		"D"
-		"a:e:o:O:p:s:S:u:E:P:I:")) != EOF) {
+		"a:e:o:O:p:s:S:u:E:P:I:", longopts, NULL)) != EOF) {
 		switch (c) {
 		case 'b':
 			if (strcmp(optarg, "execve") != 0)
@@ -1671,6 +3920,11 @@ init(int argc, char *argv[])
 			outfname = optarg;
 			break;
 		case 'O':
+			opt_overhead = true;
+			if (strcmp(optarg, "auto") == 0) {
+				opt_overhead_auto = true;
+				break;
+			}
 			i = string_to_uint(optarg);
 			if (i < 0)
 				error_opt_arg(c, optarg);
@@ -1691,22 +3945,625 @@ init(int argc, char *argv[])
 		case 'S':
 			set_sortby(optarg);
 			break;
-		case 'u':
-			username = optarg;
+		case 'u':
+			username = optarg;
+			break;
+#ifdef USE_LIBUNWIND
+		case 'k':
+			stack_trace_enabled = true;
+			break;
+#endif
+		case 'E':
+			if (putenv(optarg) < 0)
+				perror_msg_and_die("putenv");
+			break;
+		case 'I':
+			opt_intr = string_to_uint_upto(optarg, NUM_INTR_OPTS - 1);
+			if (opt_intr <= 0)
+				error_opt_arg(c, optarg);
+			break;
+		case GETOPT_SECCOMP:
+			seccomp_filtering = true;
+			break;
+		case GETOPT_OUTPUT_BUFFER:
+			i = string_to_uint_upto(optarg, MAX_OUTPUT_BUFFER_SIZE);
+			if (i <= 0)
+				error_long_opt_arg("output-buffer", optarg);
+			output_buffer_size = i;
+			break;
+		case GETOPT_OUTPUT_POLICY:
+			if (strcmp(optarg, "block") == 0)
+				output_policy = OUTPUT_POLICY_BLOCK;
+			else if (strcmp(optarg, "drop") == 0)
+				output_policy = OUTPUT_POLICY_DROP;
+			else if (strcmp(optarg, "sample") == 0)
+				output_policy = OUTPUT_POLICY_SAMPLE;
+			else
+				error_long_opt_arg("output-policy", optarg);
+			break;
+		case GETOPT_OUTPUT_QUEUE: {
+			const unsigned long long size = parse_size(optarg);
+
+			output_queue_size = size;
+			if (!size || output_queue_size != size)
+				error_long_opt_arg("output-queue", optarg);
+			break;
+		}
+		case GETOPT_OUTPUT_COMPRESS:
+			i = optarg ? string_to_uint_upto(optarg, 9) : 1;
+			if (i <= 0)
+				error_long_opt_arg("output-compress", optarg);
+			output_compress_level = i;
+			break;
+		case GETOPT_OUTPUT_ASYNC:
+			output_async = true;
+			break;
+		case GETOPT_OUTPUT_MAX_FILES:
+#ifdef HAVE_FOPENCOOKIE
+			i = string_to_uint(optarg);
+			if (i <= 0)
+				error_long_opt_arg("output-max-files", optarg);
+			output_max_files = i;
+			break;
+#else
+			error_msg_and_die("--output-max-files is not supported"
+					  " by this build of strace");
+#endif
+		case GETOPT_OUTPUT_ROTATE_SIZE:
+			output_rotate_size = parse_size(optarg);
+			if (!output_rotate_size)
+				error_long_opt_arg("output-rotate-size", optarg);
+			break;
+		case GETOPT_OUTPUT_ROTATE_INTERVAL:
+			i = string_to_uint(optarg);
+			if (i <= 0)
+				error_long_opt_arg("output-rotate-interval", optarg);
+			output_rotate_interval = i;
+			break;
+		case GETOPT_OUTPUT_ROTATE_KEEP:
+			i = string_to_uint(optarg);
+			if (i <= 0)
+				error_long_opt_arg("output-rotate-keep", optarg);
+			output_rotate_keep = i;
+			break;
+		case GETOPT_OUTPUT_ROTATE_GZIP:
+			output_rotate_gzip = true;
+			break;
+		case GETOPT_BINARY_OUTPUT:
+			binary_outfname = optarg;
+			break;
+		case GETOPT_IO_CAPTURE:
+			iocapture_outfname = optarg;
+			break;
+		case GETOPT_IO_CAPTURE_STREAMS:
+			iocapture_streams_prefix = optarg;
+			break;
+		case GETOPT_TRACE_EVENTS:
+			trace_events_outfname = optarg;
+			break;
+		case GETOPT_SPAWN_PROFILE:
+			spawn_profile_outfname = optarg;
+			break;
+		case GETOPT_SPAWN_PROFILE_FORMAT:
+			if (strcmp(optarg, "text") == 0)
+				spawn_profile_format = SPAWN_PROFILE_TEXT;
+			else if (strcmp(optarg, "chrome") == 0)
+				spawn_profile_format = SPAWN_PROFILE_CHROME;
+			else
+				error_long_opt_arg("spawn-profile-format",
+						   optarg);
+			break;
+		case GETOPT_FILE_DEPS:
+			file_deps_outfname = optarg;
+			break;
+		case GETOPT_SUMMARY_IO:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-io", optarg);
+				summary_io = i;
+			} else {
+				summary_io = DEFAULT_SUMMARY_IO;
+			}
+			break;
+		case GETOPT_SUMMARY_ACCESS:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-access",
+							   optarg);
+				summary_access = i;
+			} else {
+				summary_access = DEFAULT_SUMMARY_ACCESS;
+			}
+			break;
+		case GETOPT_SUMMARY_FLOWS:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-flows",
+							   optarg);
+				summary_flows = i;
+			} else {
+				summary_flows = DEFAULT_SUMMARY_FLOWS;
+			}
+			break;
+		case GETOPT_SUMMARY_CONNECTS:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-connects",
+							   optarg);
+				summary_connects = i;
+			} else {
+				summary_connects = DEFAULT_SUMMARY_CONNECTS;
+			}
+			break;
+		case GETOPT_SUMMARY_FDS:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-fds",
+							   optarg);
+				summary_fds = i;
+			} else {
+				summary_fds = DEFAULT_SUMMARY_FDS;
+			}
+			break;
+		case GETOPT_SUMMARY_FUTEX:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-futex",
+							   optarg);
+				summary_futex = i;
+			} else {
+				summary_futex = DEFAULT_SUMMARY_FUTEX;
+			}
+			break;
+		case GETOPT_SUMMARY_IPC:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-ipc",
+							   optarg);
+				summary_ipc = i;
+			} else {
+				summary_ipc = DEFAULT_SUMMARY_IPC;
+			}
+			break;
+		case GETOPT_SUMMARY_HANDOFF:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-handoff",
+							   optarg);
+				summary_handoff = i;
+			} else {
+				summary_handoff = DEFAULT_SUMMARY_HANDOFF;
+			}
+			break;
+		case GETOPT_SUMMARY_AIO:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-aio",
+							   optarg);
+				summary_aio = i;
+			} else {
+				summary_aio = DEFAULT_SUMMARY_AIO;
+			}
+			break;
+		case GETOPT_SUMMARY_EPOLL:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-epoll",
+							   optarg);
+				summary_epoll = i;
+			} else {
+				summary_epoll = DEFAULT_SUMMARY_EPOLL;
+			}
+			break;
+		case GETOPT_SUMMARY_V4L2:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-v4l2",
+							   optarg);
+				summary_v4l2 = i;
+			} else {
+				summary_v4l2 = DEFAULT_SUMMARY_V4L2;
+			}
+			break;
+		case GETOPT_SUMMARY_NOTIFY:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-notify",
+							   optarg);
+				summary_notify = i;
+			} else {
+				summary_notify = DEFAULT_SUMMARY_NOTIFY;
+			}
+			break;
+		case GETOPT_SUMMARY_MMAP:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-mmap",
+							   optarg);
+				summary_mmap = i;
+			} else {
+				summary_mmap = DEFAULT_SUMMARY_MMAP;
+			}
+			break;
+		case GETOPT_SUMMARY_SYNC:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-sync",
+							   optarg);
+				summary_sync = i;
+			} else {
+				summary_sync = DEFAULT_SUMMARY_SYNC;
+			}
+			break;
+		case GETOPT_SUMMARY_OVERSLEEP:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-oversleep",
+							   optarg);
+				summary_oversleep = i;
+			} else {
+				summary_oversleep = DEFAULT_SUMMARY_OVERSLEEP;
+			}
+			break;
+		case GETOPT_SUMMARY_SIGDELIVERY:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-sigdelivery",
+							   optarg);
+				summary_sigdelivery = i;
+			} else {
+				summary_sigdelivery =
+					DEFAULT_SUMMARY_SIGDELIVERY;
+			}
+			break;
+		case GETOPT_SUMMARY_ARGS:
+			if (!add_summary_args(optarg))
+				error_long_opt_arg("summary-args", optarg);
+			break;
+		case GETOPT_SUMMARY_THREADS:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-threads",
+							   optarg);
+				summary_threads = i;
+			} else {
+				summary_threads = DEFAULT_SUMMARY_THREADS;
+			}
+			break;
+		case GETOPT_SUMMARY_RUSAGE:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-rusage",
+							   optarg);
+				summary_rusage = i;
+			} else {
+				summary_rusage = DEFAULT_SUMMARY_RUSAGE;
+			}
+			break;
+		case GETOPT_SUMMARY_STOPS:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-stops",
+							   optarg);
+				summary_stops = i;
+			} else {
+				summary_stops = DEFAULT_SUMMARY_STOPS;
+			}
+			break;
+		case GETOPT_SUMMARY_TOP:
+			i = string_to_uint(optarg);
+			if (i <= 0)
+				error_long_opt_arg("summary-top", optarg);
+			summary_top = i;
+			break;
+		case GETOPT_TOP:
+			if (cflag == CFLAG_BOTH)
+				error_msg_and_help("--top and -C are mutually exclusive");
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("top", optarg);
+				summary_interval = i;
+			} else {
+				summary_interval = 1;
+			}
+			cflag = CFLAG_ONLY_STATS;
+			summary_latency = true;
+			top_mode = true;
+			break;
+		case GETOPT_TIME_PRECISION:
+			if (strcmp(optarg, "us") == 0)
+				time_precision = 6;
+			else if (strcmp(optarg, "ns") == 0)
+				time_precision = 9;
+			else
+				error_long_opt_arg("time-precision", optarg);
+			break;
+		case GETOPT_MONOTONIC_TS:
+			monotonic_ts = true;
+			break;
+#ifdef USE_LIBUNWIND
+		case GETOPT_STACK_UNWINDER:
+			if (strcmp(optarg, "libunwind") == 0)
+				stack_unwind_fp = false;
+			else if (strcmp(optarg, "fp") == 0)
+				stack_unwind_fp = true;
+			else
+				error_long_opt_arg("stack-unwinder", optarg);
+			break;
+		case GETOPT_STACK_DEDUP:
+			stack_dedup = true;
+			break;
+		case GETOPT_STACK_SNAPSHOT:
+			if (optarg) {
+				i = string_to_uint_upto(optarg, 1024);
+				if (i <= 0)
+					error_long_opt_arg("stack-snapshot",
+							   optarg);
+				stack_snapshot_size = i * 1024;
+			} else {
+				stack_snapshot_size = 16 * 1024;
+			}
+			break;
+		case GETOPT_STACK_OFFLINE:
+			stack_offline = true;
+			break;
+		case GETOPT_STACK_CACHE:
+			stack_cache_dir = optarg;
+			break;
+#endif
+		case GETOPT_SUMMARY_PIDS:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("summary-pids", optarg);
+				summary_pids = i;
+			} else {
+				summary_pids = DEFAULT_SUMMARY_PIDS;
+			}
+			break;
+		case GETOPT_SAMPLE:
+			i = string_to_uint(optarg);
+			if (i <= 0)
+				error_long_opt_arg("sample", optarg);
+			sample_rate = i;
+			break;
+		case GETOPT_RATE_LIMIT:
+			if (!parse_rate_limit(optarg))
+				error_long_opt_arg("rate-limit", optarg);
+			break;
+		case GETOPT_TERSE_RATE:
+			if (!parse_terse_rate(optarg))
+				error_long_opt_arg("terse-rate", optarg);
+			break;
+		case GETOPT_OVERHEAD_BUDGET:
+			if (!parse_overhead_budget(optarg))
+				error_long_opt_arg("overhead-budget", optarg);
+			break;
+		case GETOPT_SELF_PROFILE:
+			self_profile = true;
+			break;
+		case GETOPT_CACHE_LIMIT:
+			if (!parse_cache_limit(optarg))
+				error_long_opt_arg("cache-limit", optarg);
+			break;
+		case GETOPT_BENCH_DECODERS:
+			if (optarg) {
+				i = string_to_uint(optarg);
+				if (i <= 0)
+					error_long_opt_arg("bench-decoders",
+							   optarg);
+				bench_iterations = i;
+			}
+			bench_decoders = true;
+			break;
+		case GETOPT_RING_BUFFER: {
+			const unsigned long long size = parse_size(optarg);
+
+			ring_buffer_size = size;
+			if (!size || ring_buffer_size != size)
+				error_long_opt_arg("ring-buffer", optarg);
+			break;
+		}
+		case GETOPT_RING_TRIGGER:
+			qualify_ring_trigger(optarg);
+			ring_triggers = true;
+			break;
+		case GETOPT_RING_TRIGGER_ERROR:
+			qualify_ring_trigger_error(optarg);
+			ring_triggers = true;
+			break;
+		case GETOPT_SUMMARY_INTERVAL:
+			i = string_to_uint(optarg);
+			if (i <= 0)
+				error_long_opt_arg("summary-interval", optarg);
+			summary_interval = i;
+			break;
+		case GETOPT_SUMMARY_FORMAT:
+			if (strcmp(optarg, "text") == 0)
+				summary_format = SUMMARY_FORMAT_TEXT;
+			else if (strcmp(optarg, "csv") == 0)
+				summary_format = SUMMARY_FORMAT_CSV;
+			else if (strcmp(optarg, "json") == 0)
+				summary_format = SUMMARY_FORMAT_JSON;
+			else
+				error_long_opt_arg("summary-format", optarg);
+			break;
+		case GETOPT_SUMMARY_HISTOGRAM:
+			summary_histogram = true;
+			/* fall through */
+		case GETOPT_SUMMARY_LATENCY:
+			summary_latency = true;
+			break;
+		case GETOPT_COMPLETE_LINES:
+#ifdef HAVE_FOPENCOOKIE
+			complete_lines = true;
+			break;
+#else
+			error_msg_and_die("--complete-lines is not supported"
+					  " by this build of strace");
+#endif
+		case GETOPT_FOLD_REPEATS:
+#ifdef HAVE_OPEN_MEMSTREAM
+			fold_repeats = true;
+			break;
+#else
+			error_msg_and_die("--fold-repeats is not supported"
+					  " by this build of strace");
+#endif
+		case GETOPT_FILTER:
+			filter_expr_parse(optarg);
+			break;
+		case GETOPT_TRIGGER:
+			qualify_trigger(optarg);
+			trigger_on_syscalls();
+			break;
+		case GETOPT_TRIGGER_PATH:
+			trigger_select_path(optarg);
+			break;
+		case GETOPT_TRIGGER_ERROR:
+			qualify_trigger_error(optarg);
+			trigger_on_syscalls();
+			break;
+		case GETOPT_TRIGGER_SIGNAL:
+			qualify_trigger_signal(optarg);
+			trigger_on_signals();
+			break;
+		case GETOPT_TRIGGER_WINDOW:
+			if (!parse_trigger_window(optarg))
+				error_long_opt_arg("trigger-window", optarg);
+			trigger_window_given = true;
+			break;
+		case GETOPT_CONTROL:
+			control_path = optarg;
+			break;
+		case GETOPT_RESIDENT:
+			resident = true;
+			break;
+		case GETOPT_TRACER_CPUS:
+			if (!parse_tracer_cpus(optarg))
+				error_long_opt_arg("tracer-cpus", optarg);
+			break;
+		case GETOPT_TRACER_SCHED:
+			if (!parse_tracer_sched(optarg))
+				error_long_opt_arg("tracer-sched", optarg);
+			break;
+		case GETOPT_TRACER_MLOCK:
+			tracer_mlock = true;
+			break;
+		case GETOPT_SHARDS:
+			i = string_to_uint_upto(optarg, MAX_SHARDS);
+			if (i <= 0)
+				error_long_opt_arg("shards", optarg);
+			nshards = i;
+			break;
+		case GETOPT_JSON:
+#ifdef HAVE_OPEN_MEMSTREAM
+			json_output = true;
+			break;
+#else
+			error_msg_and_die("--json is not supported"
+					  " by this build of strace");
+#endif
+		case GETOPT_BINARY_DECODE:
+			binary_decode_path = optarg;
+			break;
+		case GETOPT_BINARY_QUERY:
+			binary_query = optarg;
+			break;
+		case GETOPT_BINARY_DECODE_JOBS:
+			i = string_to_uint_upto(optarg, MAX_DECODE_JOBS);
+			if (i <= 0)
+				error_long_opt_arg("binary-decode-jobs", optarg);
+			binary_decode_jobs = i;
+			break;
+		case GETOPT_MERGE_LOGS:
+			merge_logs(optarg);
+		case GETOPT_PROCESS_TREE:
+			print_process_tree(optarg);
+		case GETOPT_SUMMARY_DIFF:
+			summary_diff_path = optarg;
+			break;
+		case GETOPT_SUMMARY_MERGE:
+			merge_summaries = true;
+			break;
+		case GETOPT_REPLAY:
+			replay_path = optarg;
+			break;
+		case GETOPT_REPLAY_DIR:
+			replay_dir = optarg;
+			break;
+		case GETOPT_REPLAY_DATA:
+			replay_data = optarg;
+			break;
+		case GETOPT_REPLAY_FAST:
+			replay_fast = true;
+			break;
+		case GETOPT_EXECVE_ENV:
+			if (strcmp(optarg, "full") == 0)
+				execve_env = EXECVE_ENV_FULL;
+			else if (strcmp(optarg, "size") == 0)
+				execve_env = EXECVE_ENV_SIZE;
+			else if (strcmp(optarg, "hash") == 0)
+				execve_env = EXECVE_ENV_HASH;
+			else
+				error_long_opt_arg("execve-env", optarg);
+			break;
+		case GETOPT_MMSG_STATS:
+			mmsg_stats = true;
+			break;
+		case GETOPT_BPF_DEDUP:
+			bpf_dedup = true;
+			break;
+		case GETOPT_NOTIFY_EVENTS:
+			notify_events = true;
+			break;
+		case GETOPT_TRACE_EXEC:
+			add_patterns(&trace_exec_patterns, &ntrace_exec_patterns,
+				     "trace-exec", optarg);
 			break;
-#ifdef USE_LIBUNWIND
-		case 'k':
-			stack_trace_enabled = true;
+		case GETOPT_TRACE_THREADS:
+			add_patterns(&trace_thread_patterns,
+				     &ntrace_thread_patterns, "trace-threads",
+				     optarg);
 			break;
-#endif
-		case 'E':
-			if (putenv(optarg) < 0)
-				perror_msg_and_die("putenv");
+		case GETOPT_COUNT_BACKEND:
+			if (strcmp(optarg, "ptrace") == 0)
+				count_backend = COUNT_BACKEND_PTRACE;
+			else if (strcmp(optarg, "perf") == 0)
+				count_backend = COUNT_BACKEND_PERF;
+			else if (strcmp(optarg, "bpf") == 0)
+				count_backend = COUNT_BACKEND_BPF;
+			else
+				error_long_opt_arg("count-backend", optarg);
 			break;
-		case 'I':
-			opt_intr = string_to_uint_upto(optarg, NUM_INTR_OPTS - 1);
-			if (opt_intr <= 0)
-				error_opt_arg(c, optarg);
+		case GETOPT_COUNT_CGROUP:
+			count_cgroup = optarg;
+			break;
+		case GETOPT_ATTACH_CGROUP:
+			attach_cgroups = xreallocarray(attach_cgroups,
+						       nattach_cgroups + 1,
+						       sizeof(*attach_cgroups));
+			attach_cgroups[nattach_cgroups++] = optarg;
 			break;
 		default:
 			error_msg_and_help(NULL);
@@ -1717,16 +4574,76 @@ init(int argc, char *argv[])
 	argv += optind;
 	argc -= optind;
 
-	if (argc < 0 || (!argv[0] && !nprocs)) {
-		error_msg_and_help("must have PROG [ARGS] or -p PID");
+	if (binary_query && !binary_decode_path)
+		error_msg_and_help("--binary-query must be given with"
+				   " --binary-decode");
+	if (binary_decode_path) {
+		if (!binary_decode_jobs) {
+			const long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+			binary_decode_jobs = ncpus > 0
+					     ? MIN(ncpus, MAX_DECODE_JOBS) : 1;
+		}
+		bintrace_decode(binary_decode_path, binary_query,
+				binary_decode_jobs);
 	}
 
-	if (!argv[0] && daemonized_tracer) {
-		error_msg_and_help("PROG [ARGS] must be specified with -D");
+	if (summary_diff_path) {
+		if (argc != 1)
+			error_msg_and_help("--summary-diff must be given"
+					   " the new summary as the only"
+					   " argument");
+		summary_diff(summary_diff_path, argv[0]);
+	}
+
+	if (merge_summaries) {
+		if (argc < 1)
+			error_msg_and_help("--summary-merge must be given"
+					   " the summaries to merge");
+		summary_merge(argv, argc);
+	}
+
+	if (bench_decoders)
+		decoder_bench(bench_iterations, argv, argc);
+
+	if (replay_path) {
+		if (!replay_dir)
+			error_msg_and_help("--replay must be given with"
+					   " --replay-dir");
+		replay_trace(replay_path, replay_dir, replay_data,
+			     replay_fast);
 	}
+	if (replay_dir || replay_data || replay_fast)
+		error_msg_and_help("--replay-dir, --replay-data and"
+				   " --replay-fast must be given with --replay");
 
 	if (!followfork)
 		followfork = optF;
+	/* The spawn profile and file dependencies are about descendants.  */
+	if ((spawn_profile_outfname || file_deps_outfname) && !followfork)
+		followfork = 1;
+
+	for (i = 0; i < (int) nattach_cgroups; ++i) {
+		if (!scan_cgroup(attach_cgroups[i], false))
+			error_msg_and_die("No processes in cgroup %s",
+					  attach_cgroups[i]);
+	}
+
+	if (resident && !control_path)
+		error_msg_and_help("--resident must be given with --control");
+
+	/*
+	 * --count-backend=bpf counts the whole system, a --resident tracer
+	 * waits for the processes to attach to.
+	 */
+	if (argc < 0 || (!argv[0] && !nprocs && !resident
+			 && count_backend != COUNT_BACKEND_BPF)) {
+		error_msg_and_help("must have PROG [ARGS] or -p PID");
+	}
+
+	if (!argv[0] && daemonized_tracer) {
+		error_msg_and_help("PROG [ARGS] must be specified with -D");
+	}
 
 	if (followfork >= 2 && cflag) {
 		error_msg_and_help("(-c or -C) and -ff are mutually exclusive");
@@ -1735,30 +4652,408 @@ init(int argc, char *argv[])
 	if (count_wallclock && !cflag) {
 		error_msg_and_help("-w must be given with (-c or -C)");
 	}
+	count_stime = cflag && !count_wallclock;
+	collect_rusage = count_stime || summary_rusage;
 
-	if (cflag == CFLAG_ONLY_STATS) {
-		if (iflag)
-			error_msg("-%c has no effect with -c", 'i');
+	if (summary_pids && !cflag) {
+		error_msg_and_help("--summary-pids must be given with (-c or -C)");
+	}
+
+	if (summary_interval && !cflag) {
+		error_msg_and_help("--summary-interval must be given with (-c or -C)");
+	}
+
+	if (summary_io && !cflag) {
+		error_msg_and_help("--summary-io must be given with (-c or -C)");
+	}
+
+	if (summary_access && !cflag) {
+		error_msg_and_help("--summary-access must be given with (-c or -C)");
+	}
+
+	if (summary_flows && !cflag) {
+		error_msg_and_help("--summary-flows must be given with (-c or -C)");
+	}
+
+	if (summary_connects && !cflag) {
+		error_msg_and_help("--summary-connects must be given with (-c or -C)");
+	}
+
+	if (summary_fds && !cflag) {
+		error_msg_and_help("--summary-fds must be given with (-c or -C)");
+	}
+
+	if (summary_futex && !cflag) {
+		error_msg_and_help("--summary-futex must be given with (-c or -C)");
+	}
+
+	if (summary_ipc && !cflag) {
+		error_msg_and_help("--summary-ipc must be given with (-c or -C)");
+	}
+
+	if (summary_handoff && !cflag) {
+		error_msg_and_help("--summary-handoff must be given with (-c or -C)");
+	}
+
+	if (summary_aio && !cflag) {
+		error_msg_and_help("--summary-aio must be given with (-c or -C)");
+	}
+
+	if (summary_epoll && !cflag) {
+		error_msg_and_help("--summary-epoll must be given with (-c or -C)");
+	}
+
+	if (summary_v4l2 && !cflag) {
+		error_msg_and_help("--summary-v4l2 must be given with (-c or -C)");
+	}
+
+	if (summary_notify && !cflag) {
+		error_msg_and_help("--summary-notify must be given with (-c or -C)");
+	}
+
+	if (summary_mmap && !cflag) {
+		error_msg_and_help("--summary-mmap must be given with (-c or -C)");
+	}
+
+	if (summary_sync && !cflag) {
+		error_msg_and_help("--summary-sync must be given with (-c or -C)");
+	}
+
+	if (summary_oversleep && !cflag) {
+		error_msg_and_help("--summary-oversleep must be given with"
+				   " (-c or -C)");
+	}
+
+	if (summary_sigdelivery && !cflag) {
+		error_msg_and_help("--summary-sigdelivery must be given with"
+				   " (-c or -C)");
+	}
+
+	if (summary_args && !cflag) {
+		error_msg_and_help("--summary-args must be given with (-c or -C)");
+	}
+
+	if (summary_threads && !cflag) {
+		error_msg_and_help("--summary-threads must be given with (-c or -C)");
+	}
+
+	if (summary_rusage && !cflag) {
+		error_msg_and_help("--summary-rusage must be given with (-c or -C)");
+	}
+
+	if (summary_stops && !cflag) {
+		error_msg_and_help("--summary-stops must be given with (-c or -C)");
+	}
+
+	if (summary_top && !cflag) {
+		error_msg_and_help("--summary-top must be given with (-c or -C)");
+	}
+
+	if (summary_histogram && !cflag) {
+		error_msg_and_help("--summary-histogram must be given with (-c or -C)");
+	}
+
+	if (summary_latency && !cflag) {
+		error_msg_and_help("--summary-latency must be given with (-c or -C)");
+	}
+
+	if (top_mode && summary_format != SUMMARY_FORMAT_TEXT)
+		error_msg_and_help("--top and --summary-format=%s are mutually"
+				   " exclusive",
+				   summary_format == SUMMARY_FORMAT_CSV
+				   ? "csv" : "json");
+
+	if (summary_format != SUMMARY_FORMAT_TEXT) {
+		if (!cflag)
+			error_msg_and_help("--summary-format must be given with"
+					   " (-c or -C)");
+		/* Machine formats have syscall statistics only.  */
+		if (summary_io || summary_access || summary_flows
+		    || summary_connects || summary_fds || summary_futex
+		    || summary_ipc || summary_handoff || summary_aio
+		    || summary_epoll || summary_v4l2 || summary_notify
+		    || summary_mmap || summary_sync || summary_oversleep
+		    || summary_sigdelivery || summary_args || summary_pids
+		    || summary_threads || summary_rusage
+		    || summary_stops)
+			error_msg_and_help("--summary-{io,access,flows,connects,"
+					   "fds,futex,ipc,handoff,aio,epoll,v4l2,"
+					   "notify,mmap,sync,oversleep,sigdelivery,args,"
+					   "pids,threads,rusage,stops} are not supported"
+					   " with"
+					   " --summary-format=%s",
+					   summary_format == SUMMARY_FORMAT_CSV
+					   ? "csv" : "json");
+	}
+
+	if (count_backend != COUNT_BACKEND_PTRACE) {
+		const char *const name = count_backend_names[count_backend];
+
+#ifndef HAVE_LINUX_PERF_EVENT_H
+		error_msg_and_help("--count-backend=%s is not supported"
+				   " by this strace build", name);
+#endif
+#ifndef HAVE_LINUX_BPF_H
+		if (count_backend == COUNT_BACKEND_BPF)
+			error_msg_and_help("--count-backend=%s is not supported"
+					   " by this strace build", name);
+#endif
+		if (cflag != CFLAG_ONLY_STATS)
+			error_msg_and_help("--count-backend=%s must be given"
+					   " with -c", name);
+		if (nprocs || daemonized_tracer || username)
+			error_msg_and_help("-p, --attach-cgroup, -D and -u"
+					   " are not supported with"
+					   " --count-backend=%s", name);
+#ifdef USE_LIBUNWIND
+		if (stack_trace_enabled)
+			error_msg_and_help("-k is not supported with"
+					   " --count-backend=%s", name);
+#endif
+		if (seccomp_filtering || tracing_paths
+		    || filter_expr_in_use || sample_rate != 1 || overhead_budget
+		    || ntrace_exec_patterns || ntrace_thread_patterns
+		    || triggers_in_use || control_path)
+			error_msg_and_help("-P, --seccomp-bpf, --filter,"
+					   " --sample, --overhead-budget,"
+					   " --trace-exec, --trace-threads,"
+					   " --trigger and --control options"
+					   " are not supported with"
+					   " --count-backend=%s", name);
+		if (summary_io || summary_access || summary_flows
+		    || summary_connects || summary_fds || summary_futex
+		    || summary_ipc || summary_handoff || summary_aio
+		    || summary_epoll || summary_v4l2 || summary_notify
+		    || summary_mmap || summary_sync || summary_oversleep
+		    || summary_sigdelivery || summary_args || summary_pids
+		    || summary_threads || summary_rusage
+		    || summary_stops)
+			error_msg_and_help("--summary-{io,access,flows,connects,"
+					   "fds,futex,ipc,handoff,aio,epoll,v4l2,"
+					   "notify,mmap,sync,oversleep,sigdelivery,args,"
+					   "pids,threads,rusage,stops} are"
+					   " not supported with"
+					   " --count-backend=%s",
+					   name);
+		if (opt_overhead)
+			error_msg("-O has no effect with --count-backend=%s",
+				  name);
+		opt_overhead_auto = false;
+		/* Tracepoint times include no tracer overhead.  */
+		set_overhead(0);
+	}
+
+	if (count_cgroup && count_backend != COUNT_BACKEND_BPF)
+		error_msg_and_help("--count-cgroup must be given with"
+				   " --count-backend=bpf");
+
+	if (nshards) {
+		if (count_backend != COUNT_BACKEND_PTRACE || daemonized_tracer
+		    || ring_buffer_size || control_path || summary_interval
+		    || top_mode)
+			error_msg_and_help("--count-backend, -D, --ring-buffer,"
+					   " --control, --summary-interval,"
+					   " and --top are not supported with"
+					   " --shards");
+		/* These files are written by a single tracer.  */
+		if (output_rotation || output_async || output_compress_level
+		    || binary_outfname || iocapture_outfname
+		    || iocapture_streams_prefix || trace_events_outfname
+		    || spawn_profile_outfname || file_deps_outfname)
+			error_msg_and_help("--output-rotate-size,"
+					   " --output-rotate-interval,"
+					   " --output-async, --output-compress,"
+					   " --binary-output, --io-capture,"
+					   " --io-capture-streams, --trace-events,"
+					   " --spawn-profile, and --file-deps"
+					   " are not supported with --shards");
+		/* Only syscall and signal statistics are merged.  */
+		if (summary_io || summary_access || summary_flows
+		    || summary_connects || summary_fds || summary_futex
+		    || summary_ipc || summary_handoff || summary_aio
+		    || summary_epoll || summary_v4l2 || summary_notify
+		    || summary_mmap || summary_sync || summary_oversleep
+		    || summary_sigdelivery || summary_args || summary_pids
+		    || summary_threads || summary_rusage
+		    || summary_stops)
+			error_msg_and_help("--summary-{io,access,flows,connects,"
+					   "fds,futex,ipc,handoff,aio,epoll,v4l2,"
+					   "notify,mmap,sync,oversleep,sigdelivery,args,"
+					   "pids,threads,rusage,stops}"
+					   " are not supported with --shards");
+#ifdef USE_LIBUNWIND
+		if (cflag && stack_trace_enabled)
+			error_msg_and_help("-k with -c is not supported"
+					   " with --shards");
+#endif
+	}
+
+	if (complete_lines && followfork >= 2 && outfname)
+		error_msg_and_help("--complete-lines and -ff are mutually"
+				   " exclusive");
+
+	if (filter_expr_in_use && binary_outfname)
+		error_msg_and_help("--filter and --binary-output are mutually"
+				   " exclusive");
+
+	if (json_output) {
+		if (binary_outfname)
+			error_msg_and_help("--json and --binary-output are"
+					   " mutually exclusive");
 #ifdef USE_LIBUNWIND
 		if (stack_trace_enabled)
-			error_msg("-%c has no effect with -c", 'k');
+			error_msg_and_help("--json and -k are mutually"
+					   " exclusive");
+#endif
+	}
+
+	if (fold_repeats) {
+		if (json_output)
+			error_msg_and_help("--fold-repeats and --json are"
+					   " mutually exclusive");
+#ifdef USE_LIBUNWIND
+		if (stack_snapshot_size)
+			error_msg_and_help("--fold-repeats and --stack-snapshot"
+					   " are mutually exclusive");
+#endif
+	}
+
+	if (ring_buffer_size) {
+		if (followfork >= 2 && outfname)
+			error_msg_and_help("--ring-buffer and -ff are mutually"
+					   " exclusive");
+		if (output_rotation)
+			error_msg_and_help("--ring-buffer and output rotation"
+					   " are mutually exclusive");
+	} else if (ring_triggers) {
+		error_msg_and_help("--ring-trigger and --ring-trigger-error"
+				   " must be given with --ring-buffer");
+	}
+
+	if (trigger_window_given && !triggers_in_use)
+		error_msg_and_help("--trigger-window must be given with"
+				   " --trigger, --trigger-path, --trigger-error"
+				   " or --trigger-signal");
+
+	if (output_compress_level) {
+		if (!outfname || outfname[0] == '|' || outfname[0] == '!'
+		    || is_socket_output(outfname))
+			error_msg_and_help("--output-compress requires -o FILE");
+		if (output_rotation)
+			error_msg_and_help("--output-compress and output rotation"
+					   " are mutually exclusive");
+	}
+
+	if (output_async) {
+		if (!outfname || is_socket_output(outfname))
+			error_msg_and_help("--output-async requires -o FILE"
+					   " or -o |COMMAND");
+		if (output_compress_level)
+			error_msg_and_help("--output-async and --output-compress"
+					   " are mutually exclusive");
+		if (output_rotation)
+			error_msg_and_help("--output-async and output rotation"
+					   " are mutually exclusive");
+	}
+
+	if (output_max_files) {
+		if (followfork < 2 || !outfname)
+			error_msg_and_help("--output-max-files requires -ff"
+					   " -o FILE");
+		if (output_compress_level)
+			error_msg_and_help("--output-max-files and"
+					   " --output-compress are mutually"
+					   " exclusive");
+		if (output_async)
+			error_msg_and_help("--output-max-files and"
+					   " --output-async are mutually"
+					   " exclusive");
+		if (output_rotation)
+			error_msg_and_help("--output-max-files and output"
+					   " rotation are mutually exclusive");
+	}
+
+	if (output_rotation) {
+		if (!outfname || outfname[0] == '|' || outfname[0] == '!'
+		    || is_socket_output(outfname))
+			error_msg_and_help("--output-rotate-size and"
+					   " --output-rotate-interval require"
+					   " -o FILE");
+	} else if (output_rotate_keep || output_rotate_gzip) {
+		error_msg_and_help("--output-rotate-keep and --output-rotate-gzip"
+				   " must be given with --output-rotate-size"
+				   " or --output-rotate-interval");
+	}
+
+#ifdef USE_LIBUNWIND
+	if (stack_unwind_fp && !stack_trace_enabled) {
+		error_msg_and_help("--stack-unwinder must be given with -k");
+	}
+
+	if (stack_dedup && !stack_trace_enabled) {
+		error_msg_and_help("--stack-dedup must be given with -k");
+	}
+
+	if (stack_snapshot_size) {
+		if (!stack_trace_enabled)
+			error_msg_and_help("--stack-snapshot must be given"
+					   " with -k");
+		if (stack_unwind_fp)
+			error_msg_and_help("--stack-snapshot and"
+					   " --stack-unwinder=fp are mutually"
+					   " exclusive");
+	}
+
+	if (stack_offline && !stack_trace_enabled) {
+		error_msg_and_help("--stack-offline must be given with -k");
+	}
+
+	if (stack_cache_dir && !stack_trace_enabled) {
+		error_msg_and_help("--stack-cache must be given with -k");
+	}
 #endif
+
+	if (cflag == CFLAG_ONLY_STATS) {
+		if (iflag)
+			error_msg("-%c has no effect with -c", 'i');
 		if (rflag)
 			error_msg("-%c has no effect with -c", 'r');
 		if (tflag)
 			error_msg("-%c has no effect with -c", 't');
+		if (monotonic_ts)
+			error_msg("--monotonic-ts has no effect with -c");
 		if (Tflag)
 			error_msg("-%c has no effect with -c", 'T');
 		if (show_fd_path)
 			error_msg("-%c has no effect with -c", 'y');
 	}
 
+	if (monotonic_ts && (tflag || rflag))
+		error_msg_and_help("--monotonic-ts and -t/-r are mutually"
+				   " exclusive");
+
 	if (rflag) {
 		if (tflag > 1)
 			error_msg("-tt has no effect with -r");
 		tflag = 1;
 	}
 
+	if (seccomp_filtering) {
+		if (nprocs) {
+			error_msg("--seccomp-bpf is not enabled for processes"
+				  " attached with -p");
+			seccomp_filtering = false;
+		} else if (!followfork) {
+			error_msg("--seccomp-bpf is not enabled because"
+				  " it requires -f");
+			seccomp_filtering = false;
+		} else if (daemonized_tracer) {
+			error_msg("--seccomp-bpf is not enabled with -D");
+			seccomp_filtering = false;
+		}
+	}
+	check_seccomp_filter();
+
 	acolumn_spaces = xmalloc(acolumn + 1);
 	memset(acolumn_spaces, ' ', acolumn);
 	acolumn_spaces[acolumn] = '\0';
@@ -1769,14 +5064,8 @@ init(int argc, char *argv[])
 	set_sigaction(SIGCHLD, SIG_DFL, &params_for_tracee.child_sa);
 
 #ifdef USE_LIBUNWIND
-	if (stack_trace_enabled) {
-		unsigned int tcbi;
-
+	if (stack_trace_enabled)
 		unwind_init();
-		for (tcbi = 0; tcbi < tcbtabsize; ++tcbi) {
-			unwind_tcb_init(tcbtab[tcbi]);
-		}
-	}
 #endif
 
 	/* See if they want to run as another user. */
@@ -1801,9 +5090,17 @@ init(int argc, char *argv[])
 		ptrace_setoptions |= PTRACE_O_TRACECLONE |
 				     PTRACE_O_TRACEFORK |
 				     PTRACE_O_TRACEVFORK;
+	if (seccomp_filtering)
+		ptrace_setoptions |= PTRACE_O_TRACESECCOMP;
 	if (debug_flag)
 		error_msg("ptrace_setoptions = %#x", ptrace_setoptions);
 	test_ptrace_seize();
+	/* Handed off tracees are seized while they are stopped.  */
+	if (nshards && !use_seize)
+		error_msg_and_die("--shards requires PTRACE_SEIZE");
+
+	if (opt_overhead_auto && cflag)
+		calibrate_overhead();
 
 	/*
 	 * Is something weird with our stdin and/or stdout -
@@ -1829,18 +5126,72 @@ init(int argc, char *argv[])
 			if (followfork >= 2)
 				error_msg_and_help("piping the output and -ff are mutually exclusive");
 			shared_log = strace_popen(outfname + 1);
-		} else if (followfork < 2)
-			shared_log = strace_fopen(outfname);
+			if (output_async)
+				shared_log = async_open(shared_log, outfname);
+		} else if (is_socket_output(outfname)) {
+			if (followfork >= 2)
+				error_msg_and_help("output to a socket and -ff"
+						   " are mutually exclusive");
+			shared_log = strncmp(outfname, "shm:", 4)
+				     ? socket_output_open(outfname)
+				     : shm_output_open(outfname);
+		} else if (followfork < 2) {
+			shared_log = output_fopen(outfname);
+			if (output_rotation)
+				init_output_log(&shared_output_log, outfname);
+		}
 	} else {
 		/* -ff without -o FILE is the same as single -f */
 		if (followfork >= 2)
 			followfork = 1;
 	}
 
-	if (!outfname || outfname[0] == '|' || outfname[0] == '!') {
+	if (binary_outfname) {
+		FILE *fp = strace_fopen(binary_outfname);
+
+		set_output_buffer(fp);
+		bintrace_init(fp, binary_outfname);
+	}
+
+	if (iocapture_outfname)
+		iocapture_init(strace_fopen(iocapture_outfname),
+			       iocapture_outfname);
+
+	if (iocapture_streams_prefix) {
+		char name[520 + sizeof(".index")];
+
+		sprintf(name, "%.512s.index", iocapture_streams_prefix);
+		iocapture_streams_init(iocapture_streams_prefix,
+				       strace_fopen(name));
+	}
+
+	if (trace_events_outfname) {
+		FILE *fp = strace_fopen(trace_events_outfname);
+
+		set_output_buffer(fp);
+		trace_events_init(fp, trace_events_outfname);
+	}
+
+	if (spawn_profile_outfname)
+		spawn_profile_init(strace_fopen(spawn_profile_outfname),
+				   spawn_profile_outfname,
+				   spawn_profile_format);
+
+	if (file_deps_outfname)
+		file_deps_init(strace_fopen(file_deps_outfname),
+			       file_deps_outfname);
+
+	if (output_buffer_size) {
+		if (followfork < 2)
+			set_output_buffer(shared_log);
+	} else if (!outfname || outfname[0] == '|' || outfname[0] == '!'
+		   || is_socket_output(outfname)) {
 		setvbuf(shared_log, NULL, _IOLBF, 0);
 	}
 
+	if (ring_buffer_size)
+		shared_log = ring_open(shared_log, ring_buffer_size);
+
 	/*
 	 * argv[0]	-pPID	-oFILE	Default interactive setting
 	 * yes		*	0	INTR_WHILE_WAIT
@@ -1858,13 +5209,28 @@ init(int argc, char *argv[])
 	if (!opt_intr)
 		opt_intr = INTR_WHILE_WAIT;
 
+	if (nshards) {
+		shard_fd = shard_fork(&shared_log, argv[0] != NULL);
+		/* The coordinator does not trace.  */
+		if (shard_fd < 0)
+			return;
+		/* The -o |command is waited for by the coordinator.  */
+		popen_pid = 0;
+		if (!set_output_buffer(shared_log))
+			setvbuf(shared_log, NULL, _IOLBF, 0);
+	}
+
 	/*
 	 * startup_child() must be called before the signal handlers get
 	 * installed below as they are inherited into the spawned process.
 	 * Also we do not need to be protected by them as during interruption
 	 * in the startup_child() mode we kill the spawned process anyway.
 	 */
-	if (argv[0]) {
+	if (count_backend == COUNT_BACKEND_PERF)
+		perf_count_startup(argv);
+	else if (count_backend == COUNT_BACKEND_BPF)
+		bpf_count_startup(argv, count_cgroup);
+	else if (argv[0] && (!nshards || shard_owns_command())) {
 		startup_child(argv);
 	}
 
@@ -1886,66 +5252,254 @@ init(int argc, char *argv[])
 		set_sigaction(SIGTERM, interactive ? interrupt : SIG_IGN, NULL);
 	}
 
+	if (summary_interval && count_backend != COUNT_BACKEND_PTRACE) {
+		/*
+		 * SIGALRM is delivered only while count_backend_loop polls
+		 * the counters, so that it prints the summary.
+		 */
+		sigset_t mask;
+
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGALRM);
+		sigprocmask(SIG_BLOCK, &mask, NULL);
+		sigdelset(&start_set, SIGALRM);
+		set_sigaction(SIGALRM, summary_alarm, NULL);
+
+		const struct itimerval it = {
+			.it_interval = { .tv_sec = summary_interval },
+			.it_value = { .tv_sec = summary_interval }
+		};
+		setitimer(ITIMER_REAL, &it, NULL);
+	}
+
+	/* SIGUSR1 makes next_event dump the ring. */
+	if (ring_buffer_size)
+		set_sigaction(SIGUSR1, ring_alarm, NULL);
+
+	/*
+	 * Handled signals, the --summary-interval timer, the timer
+	 * of delayed tracees, the --attach-cgroup and the --trace-threads
+	 * rescan timers, the --control socket, and the --shards socket
+	 * are waited for along with tracees in the event loop.
+	 */
+	if (count_backend == COUNT_BACKEND_PTRACE
+	    && (interactive || summary_interval || inject_delays
+		|| ring_buffer_size || nattach_cgroups
+		|| ntrace_thread_patterns || control_path || shard_fd >= 0))
+		event_loop_init();
+
 	if (nprocs != 0 || daemonized_tracer)
 		startup_attach();
 
+	/*
+	 * Only now this process is the tracer for good,
+	 * and the tracees are out of its way.
+	 */
+	tracer_sched_apply();
+
 	/* Do we want pids printed in our -o OUTFILE?
 	 * -ff: no (every pid has its own file); or
 	 * -f: yes (there can be more pids in the future); or
 	 * -p PID1,PID2: yes (there are already more than one pid)
+	 * --shards: yes (the output of the shards is merged)
 	 */
-	print_pid_pfx = (outfname && followfork < 2 && (followfork == 1 || nprocs > 1));
+	print_pid_pfx = (outfname && followfork < 2
+			 && (followfork == 1 || nprocs > 1 || nshards));
 }
 
 static struct tcb *
 pid2tcb(int pid)
 {
-	unsigned int i;
+	struct tcb *tcp;
 
-	if (pid <= 0)
+	if (pid <= 0 || !tcbtabsize)
 		return NULL;
 
-	for (i = 0; i < tcbtabsize; i++) {
-		struct tcb *tcp = tcbtab[i];
+	for (tcp = *pid_hash_bucket(pid); tcp; tcp = tcp->next_tcb) {
 		if (tcp->pid == pid)
 			return tcp;
 	}
 
-	return NULL;
+	return NULL;
+}
+
+static void
+cleanup(void)
+{
+	unsigned int i, ndetaching = 0;
+	struct tcb *tcp;
+	int fatal_sig;
+	int status;
+
+	/* 'interrupted' is a volatile object, fetch it only once */
+	fatal_sig = interrupted;
+	if (!fatal_sig)
+		fatal_sig = SIGTERM;
+
+	/*
+	 * Detaching is done in two phases: every tracee is asked to stop
+	 * first, then their stops are handled in the order they arrive,
+	 * so tracees do not wait for each other to be detached.
+	 */
+	for (i = 0; i < tcbtabsize; i++) {
+		tcp = tcbtab[i];
+		if (!tcp->pid)
+			continue;
+		if (debug_flag)
+			error_msg("cleanup: looking at pid %u", tcp->pid);
+		if (tcp->pid == strace_child) {
+			kill(tcp->pid, SIGCONT);
+			kill(tcp->pid, fatal_sig);
+		}
+		if (detach_start(tcp)) {
+			tcp->flags |= TCB_DETACHING;
+			++ndetaching;
+		}
+	}
+
+	/* Stops that have been harvested already come first.  */
+	for (i = 0; i < tcbtabsize && ndetaching; i++) {
+		tcp = tcbtab[i];
+		while ((tcp->flags & TCB_DETACHING) &&
+		       unqueue_harvested_event(tcp->pid, &status)) {
+			if (detach_handle_stop(tcp, status))
+				--ndetaching;
+		}
+	}
+
+	while (ndetaching) {
+		const int pid = waitpid(-1, &status, __WALL);
+
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			perror_msg("detach: waitpid");
+			break;
+		}
+		if (pid == popen_pid) {
+			if (!WIFSTOPPED(status))
+				popen_pid = 0;
+			continue;
+		}
+
+		tcp = pid2tcb(pid);
+		if (!tcp || !(tcp->flags & TCB_DETACHING)) {
+			/* A new tracee that has not been seen yet.  */
+			if (WIFSTOPPED(status))
+				ptrace(PTRACE_DETACH, pid, 0, 0);
+			continue;
+		}
+		if (detach_handle_stop(tcp, status))
+			--ndetaching;
+	}
+
+	/* Give up on the tracees that could not be waited for.  */
+	for (i = 0; i < tcbtabsize && ndetaching; i++) {
+		tcp = tcbtab[i];
+		if (tcp->flags & TCB_DETACHING) {
+			detach_finish(tcp);
+			--ndetaching;
+		}
+	}
+	if (rate_limits_in_use)
+		rate_limit_finish(shared_log);
+	if (overhead_budget)
+		governor_finish(shared_log);
+	if (cflag) {
+		/* The coordinator prints the summary of all shards.  */
+		if (shard_fd >= 0)
+			shard_send_counts();
+		else
+			call_summary(shared_log);
+	}
+	if (self_profile && (shard_fd >= 0 || !nshards))
+		selfprof_summary(shared_log);
+	bintrace_finish();
+	trace_events_finish();
+	spawn_profile_finish();
+	file_deps_finish();
+}
+
+static void
+interrupt(int sig)
+{
+	interrupted = sig;
+}
+
+/*
+ * Print the -c summary of what has been gathered so far,
+ * return false if no summary is gathered.
+ */
+bool
+print_current_summary(void)
+{
+	if (!cflag)
+		return false;
+
+	call_summary(shared_log);
+	fflush(shared_log);
+	return true;
+}
+
+/*
+ * Attach to the process PID on behalf of a --control command,
+ * return false if it cannot be attached.
+ */
+bool
+attach_pid(const int pid)
+{
+	if (pid <= 0 || pid == strace_tracer_pid || pid2tcb(pid)
+	    || (nshards && !shard_owns(pid)))
+		return false;
+
+	attach_tcb(alloctcb(pid), false);
+	/* Its stop may have been sent before the signalfd has been read. */
+	stops_drained = false;
+
+	return pid2tcb(pid) != NULL;
 }
 
-static void
-cleanup(void)
+/*
+ * Detach from the process PID and its threads on behalf of a --control
+ * command, return false if it is not traced.  Its traced children
+ * are left alone.
+ */
+bool
+detach_pid(const int pid)
 {
 	unsigned int i;
-	struct tcb *tcp;
-	int fatal_sig;
+	bool found = false;
 
-	/* 'interrupted' is a volatile object, fetch it only once */
-	fatal_sig = interrupted;
-	if (!fatal_sig)
-		fatal_sig = SIGTERM;
+	for (i = 0; i < tcbtabsize; ++i) {
+		struct tcb *const tcp = tcbtab[i];
 
-	for (i = 0; i < tcbtabsize; i++) {
-		tcp = tcbtab[i];
-		if (!tcp->pid)
-			continue;
-		if (debug_flag)
-			error_msg("cleanup: looking at pid %u", tcp->pid);
-		if (tcp->pid == strace_child) {
-			kill(tcp->pid, SIGCONT);
-			kill(tcp->pid, fatal_sig);
+		if (tcp->pid && (tcp->pid == pid || get_tcb_tgid(tcp) == pid)) {
+			detach(tcp);
+			found = true;
 		}
-		detach(tcp);
 	}
-	if (cflag)
-		call_summary(shared_log);
+
+	return found;
+}
+
+/* Let a --resident tracer exit once it has no tracees left. */
+void
+leave_resident(void)
+{
+	resident = false;
+	stops_drained = false;
 }
 
 static void
-interrupt(int sig)
+summary_alarm(int sig)
 {
-	interrupted = sig;
+	summary_pending = 1;
+}
+
+static void
+ring_alarm(int sig)
+{
+	ring_dump_pending = 1;
 }
 
 static void
@@ -2009,7 +5563,13 @@ maybe_allocate_tcb(const int pid, int status)
 	if (followfork) {
 		/* We assume it's a fork/vfork/clone child */
 		struct tcb *tcp = alloctcb(pid);
-		tcp->flags |= TCB_ATTACHED | TCB_STARTUP | post_attach_sigstop;
+		tcp->flags |= TCB_ATTACHED | TCB_STARTUP | TCB_AUTO_ATTACHED
+			      | post_attach_sigstop;
+		/* The child may be traced by another shard, see handoff_tcb. */
+		if (nshards && shard_hands_off(pid)) {
+			tcp->flags |= TCB_HANDOFF;
+			return tcp;
+		}
 		newoutf(tcp);
 		if (!qflag)
 			error_msg("Process %d attached", pid);
@@ -2032,9 +5592,12 @@ static struct tcb *
 maybe_switch_tcbs(struct tcb *tcp, const int pid)
 {
 	FILE *fp;
+	char *outbuf;
+	struct output_log *outlog;
 	struct tcb *execve_thread;
 	long old_pid = 0;
 
+	selfprof_count(SELFPROF_PTRACE);
 	if (ptrace(PTRACE_GETEVENTMSG, pid, NULL, &old_pid) < 0)
 		return tcp;
 	/* Avoid truncation in pid2tcb() param passing */
@@ -2047,27 +5610,54 @@ maybe_switch_tcbs(struct tcb *tcp, const int pid)
 	if (!execve_thread)
 		return tcp;
 
-	if (execve_thread->curcol != 0) {
-		/*
-		 * One case we are here is -ff:
-		 * try "strace -oLOG -ff test/threaded_execve"
-		 */
-		fprintf(execve_thread->outf, " <pid changed to %d ...>\n", pid);
-		/*execve_thread->curcol = 0; - no need, see code below */
-	}
-	/* Swap output FILEs (needed for -ff) */
-	fp = execve_thread->outf;
-	execve_thread->outf = tcp->outf;
-	tcp->outf = fp;
-	/* And their column positions */
-	execve_thread->curcol = tcp->curcol;
-	tcp->curcol = 0;
+	/*
+	 * With --complete-lines, the incomplete execve line of the thread
+	 * stays in its line buffer and is completed on syscall exit,
+	 * there is no need to reprint it.
+	 */
+	const bool keep_line = complete_lines && !json_output;
+
+	if (keep_line) {
+		if (cflag != CFLAG_ONLY_STATS) {
+			printleader(tcp);
+			tprintf("+++ superseded by execve in pid %lu +++\n",
+				old_pid);
+			line_ended();
+		}
+	} else {
+		if (execve_thread->curcol != 0) {
+			/*
+			 * One case we are here is -ff:
+			 * try "strace -oLOG -ff test/threaded_execve"
+			 */
+			fprintf(execve_thread->outf,
+				" <pid changed to %d ...>\n", pid);
+			/*execve_thread->curcol = 0; - no need, see below */
+		}
+		/* Swap output FILEs and their buffers (needed for -ff) */
+		fp = execve_thread->outf;
+		execve_thread->outf = tcp->outf;
+		tcp->outf = fp;
+		outbuf = execve_thread->outbuf;
+		execve_thread->outbuf = tcp->outbuf;
+		tcp->outbuf = outbuf;
+		outlog = execve_thread->outlog;
+		execve_thread->outlog = tcp->outlog;
+		tcp->outlog = outlog;
+		/* And their column positions */
+		execve_thread->curcol = tcp->curcol;
+		tcp->curcol = 0;
+	}
 	/* Drop leader, but close execve'd thread outfile (if -ff) */
 	droptcb(tcp);
 	/* Switch to the thread, reusing leader's outfile and pid */
 	tcp = execve_thread;
+	pid_hash_del(tcp);
 	tcp->pid = pid;
-	if (cflag != CFLAG_ONLY_STATS) {
+	pid_hash_add(tcp);
+	if (cflag != CFLAG_ONLY_STATS && json_output) {
+		json_superseded(tcp, old_pid);
+	} else if (cflag != CFLAG_ONLY_STATS && !keep_line) {
 		printleader(tcp);
 		tprintf("+++ superseded by execve in pid %lu +++\n", old_pid);
 		line_ended();
@@ -2085,8 +5675,23 @@ print_signalled(struct tcb *tcp, const int pid, int status)
 		strace_child = 0;
 	}
 
-	if (cflag != CFLAG_ONLY_STATS
+	if (trace_events_enabled())
+		trace_events_killed(tcp, WTERMSIG(status));
+	if (spawn_profile_enabled())
+		spawn_profile_exited(tcp, status);
+	if (file_deps_enabled())
+		file_deps_exited(tcp, status);
+
+	if (cflag != CFLAG_ONLY_STATS && !(tcp->flags & TCB_UNTRACED)
 	    && is_number_in_set(WTERMSIG(status), signal_set)) {
+		if (json_output) {
+#ifdef WCOREDUMP
+			json_killed(tcp, WTERMSIG(status), WCOREDUMP(status));
+#else
+			json_killed(tcp, WTERMSIG(status), false);
+#endif
+			return;
+		}
 		printleader(tcp);
 #ifdef WCOREDUMP
 		tprintf("+++ killed by %s %s+++\n",
@@ -2108,20 +5713,56 @@ print_exited(struct tcb *tcp, const int pid, int status)
 		strace_child = 0;
 	}
 
-	if (cflag != CFLAG_ONLY_STATS &&
+	if (trace_events_enabled())
+		trace_events_exited(tcp, WEXITSTATUS(status));
+	if (spawn_profile_enabled())
+		spawn_profile_exited(tcp, status);
+	if (file_deps_enabled())
+		file_deps_exited(tcp, status);
+
+	if (cflag != CFLAG_ONLY_STATS && !(tcp->flags & TCB_UNTRACED) &&
 	    qflag < 2) {
+		if (json_output) {
+			json_exited(tcp, WEXITSTATUS(status));
+			return;
+		}
 		printleader(tcp);
 		tprintf("+++ exited with %d +++\n", WEXITSTATUS(status));
 		line_ended();
 	}
 }
 
+/* Whether a stop of the tracee by the signal is going to be printed. */
+static bool
+signal_printed(const struct tcb *tcp, const unsigned int sig)
+{
+	return cflag != CFLAG_ONLY_STATS && !hide_log(tcp)
+	       && is_number_in_set(sig, signal_set)
+	       && !(triggers_in_use && trigger_quiet()
+		    && !trigger_signal_matches(sig));
+}
+
 static void
 print_stopped(struct tcb *tcp, const siginfo_t *si, const unsigned int sig)
 {
-	if (cflag != CFLAG_ONLY_STATS
-	    && !hide_log(tcp)
-	    && is_number_in_set(sig, signal_set)) {
+	if (triggers_in_use)
+		trigger_signal(sig);
+
+	if (!hide_log(tcp) && is_number_in_set(sig, signal_set)) {
+		if (trace_events_enabled())
+			trace_events_signal(tcp, sig);
+		if (cflag)
+			count_signal(sig, !si);
+		if (summary_sigdelivery && si)
+			count_sigdelivery(tcp, si->si_signo, si->si_code,
+					  si->si_pid);
+	}
+
+	if (signal_printed(tcp, sig)) {
+		if (json_output) {
+			json_signal(tcp, sig, si);
+			return;
+		}
 		printleader(tcp);
 		if (si) {
 			tprintf("--- %s ", signame(sig));
@@ -2133,15 +5774,139 @@ print_stopped(struct tcb *tcp, const siginfo_t *si, const unsigned int sig)
 	}
 }
 
+/*
+ * Whether the name matches one of the patterns, a name that is a path
+ * is matched by its base name unless the pattern contains a slash.
+ */
+static bool
+patterns_match(const char **const patterns, const unsigned int npatterns,
+	       const char *const name)
+{
+	const char *const base = strrchr(name, '/');
+	unsigned int i;
+
+	for (i = 0; i < npatterns; ++i) {
+		const char *const pattern = patterns[i];
+
+		if (!fnmatch(pattern, strchr(pattern, '/') || !base
+					? name : base + 1, 0))
+			return true;
+	}
+
+	return false;
+}
+
+/* Whether the executable of the process matches --trace-exec patterns.  */
+static bool
+trace_exec_matches(const int pid)
+{
+	char proc_exe[sizeof("/proc/%d/exe") + sizeof(int) * 3];
+	char exe[PATH_MAX];
+
+	sprintf(proc_exe, "/proc/%d/exe", pid);
+	const ssize_t n = readlink(proc_exe, exe, sizeof(exe) - 1);
+	/* Trace the processes whose executable is unknown.  */
+	if (n <= 0)
+		return true;
+	exe[n] = '\0';
+
+	return patterns_match(trace_exec_patterns, ntrace_exec_patterns, exe);
+}
+
+/* Whether the name of the thread matches --trace-threads patterns.  */
+static bool
+trace_thread_matches(const int pid)
+{
+	char comm[sizeof("1234567890123456")] = "";
+
+	read_proc_comm(pid, comm, sizeof(comm));
+	return patterns_match(trace_thread_patterns, ntrace_thread_patterns,
+			      comm);
+}
+
+static bool
+selecting_tracees(void)
+{
+	return ntrace_exec_patterns || ntrace_thread_patterns;
+}
+
+/*
+ * With --trace-exec and --trace-threads, a process that runs
+ * a non-matching executable or a thread with a non-matching name
+ * is restarted with PTRACE_CONT outside of syscalls, so it only stops
+ * for forks, execs, and signals.  Its children start as untraced as well,
+ * as they run the same executable with the same name, until they exec
+ * a matching executable or get a matching name.
+ *
+ * Returns true if the tracee has become traced.
+ */
+static bool
+update_untraced(struct tcb *tcp, const bool at_exec)
+{
+	const bool traced =
+		(!ntrace_exec_patterns || trace_exec_matches(tcp->pid))
+		&& (!ntrace_thread_patterns || trace_thread_matches(tcp->pid));
+
+	if (traced == !(tcp->flags & TCB_UNTRACED))
+		return false;
+
+	if (!traced) {
+		tcp->flags |= TCB_UNTRACED;
+		return false;
+	}
+
+	tcp->flags &= ~(TCB_UNTRACED | TCB_HIDE_LOG);
+	/*
+	 * The entering stop of the execve has not been seen,
+	 * its exiting stop comes next and is not printed.
+	 */
+	if (at_exec && entering(tcp) && get_scno(tcp) == 1)
+		tcp->flags |= TCB_INSYSCALL | TCB_FILTERED;
+	return true;
+}
+
+/*
+ * Threads are renamed with prctl(PR_SET_NAME), which is not seen
+ * in untraced threads, or by writing to /proc/TID/comm, so the names
+ * of all tracees are checked every second.  A thread that has become
+ * traced is interrupted, so that it is restarted with PTRACE_SYSCALL.
+ */
+static void
+rescan_thread_names(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < tcbtabsize; ++i) {
+		struct tcb *const tcp = tcbtab[i];
+
+		if (!tcp->pid || (tcp->flags & TCB_STARTUP))
+			continue;
+#if USE_SEIZE
+		if (update_untraced(tcp, false) && use_seize)
+			ptrace_interrupt(tcp->pid);
+#else
+		update_untraced(tcp, false);
+#endif
+	}
+}
+
 static void
 startup_tcb(struct tcb *tcp)
 {
 	if (debug_flag)
 		error_msg("pid %d has TCB_STARTUP, initializing it", tcp->pid);
 
-	tcp->flags &= ~TCB_STARTUP;
+	/*
+	 * A child attached by the kernel has inherited the ptrace options
+	 * of its parent, and it is not inside a syscall that could be
+	 * resumed, so its registers are not fetched until its first
+	 * syscall stop either.
+	 */
+	const bool auto_attached = tcp->flags & TCB_AUTO_ATTACHED;
+
+	tcp->flags &= ~(TCB_STARTUP | TCB_AUTO_ATTACHED);
 
-	if (!use_seize) {
+	if (!use_seize && !auto_attached) {
 		if (debug_flag)
 			error_msg("setting opts 0x%x on pid %d",
 				  ptrace_setoptions, tcp->pid);
@@ -2153,19 +5918,40 @@ startup_tcb(struct tcb *tcp)
 		}
 	}
 
-	if (get_scno(tcp) == 1)
+	if (tcp->flags & TCB_ADOPTED) {
+		/*
+		 * The process has been handed off parked in pause(2),
+		 * the syscall it has been parked instead of is restarted.
+		 */
+		tcp->flags &= ~TCB_ADOPTED;
+		if (syscall_set_scno(tcp, tcp->scno) && errno != ESRCH)
+			perror_msg("handoff of pid %d", tcp->pid);
+	} else if (!auto_attached && get_scno(tcp) == 1) {
 		tcp->s_prev_ent = tcp->s_ent;
+	}
+
+	if (selecting_tracees())
+		update_untraced(tcp, false);
 }
 
 static void
 print_event_exit(struct tcb *tcp)
 {
+	if (trace_events_enabled() && exiting(tcp) && !filtered(tcp)
+	    && !hide_log(tcp))
+		trace_events_syscall_unfinished(tcp);
+
 	if (entering(tcp) || filtered(tcp) || hide_log(tcp)
-	    || cflag == CFLAG_ONLY_STATS) {
+	    || cflag == CFLAG_ONLY_STATS || bintrace_enabled()) {
+		return;
+	}
+
+	if (json_output) {
+		json_syscall_unfinished(tcp, "unfinished");
 		return;
 	}
 
-	if (followfork < 2 && printing_tcp && printing_tcp != tcp
+	if (!tcb_output_separate() && printing_tcp && printing_tcp != tcp
 	    && printing_tcp->curcol != 0) {
 		current_tcp = printing_tcp;
 		tprints(" <unfinished ...>\n");
@@ -2174,7 +5960,7 @@ print_event_exit(struct tcb *tcp)
 		current_tcp = tcp;
 	}
 
-	if ((followfork < 2 && printing_tcp != tcp)
+	if ((!tcb_output_separate() && printing_tcp != tcp)
 	    || (tcp->flags & TCB_REPRINT)) {
 		tcp->flags &= ~TCB_REPRINT;
 		printleader(tcp);
@@ -2250,8 +6036,35 @@ enum trace_event {
 	 * Restart the tracee with signal 0.
 	 */
 	TE_STOP_BEFORE_EXIT,
+
+	/*
+	 * SECCOMP_RET_TRACE rule is triggered.
+	 * Handle it as syscall-entry stop or as a request
+	 * to restart the tracee with PTRACE_SYSCALL.
+	 */
+	TE_SECCOMP,
 };
 
+/* Restart the tracees whose delay injected by delay_tcb has expired.  */
+static void
+restart_delayed_tcbs(void)
+{
+	struct tcb *const prev_tcp = current_tcp;
+	struct tcb *tcp;
+
+	while ((tcp = delay_queue_pop_expired())) {
+		const unsigned int restart_op = seccomp_filtering
+			? seccomp_filter_restart_operator(tcp) : PTRACE_SYSCALL;
+
+		current_tcp = tcp;
+		if (ptrace_restart(restart_op, tcp,
+				   tcp->inj->delay_restart_sig) < 0)
+			exit_code = 1;
+	}
+
+	current_tcp = prev_tcp;
+}
+
 static enum trace_event
 next_event(int *pstatus, siginfo_t *si)
 {
@@ -2261,9 +6074,36 @@ next_event(int *pstatus, siginfo_t *si)
 	struct tcb *tcp;
 	struct rusage ru;
 
-	if (interrupted)
+	if (interrupted || shard_exit_pending)
 		return TE_BREAK;
 
+	if (summary_pending) {
+		summary_pending = 0;
+		call_summary_interval(shared_log);
+	}
+
+	if (delay_pending) {
+		delay_pending = 0;
+		restart_delayed_tcbs();
+	}
+
+	shrink_tcbtab();
+
+	if (ring_dump_pending) {
+		ring_dump_pending = 0;
+		ring_dump();
+	}
+
+	if (cgroup_rescan_pending) {
+		cgroup_rescan_pending = 0;
+		rescan_cgroups();
+	}
+
+	if (thread_rescan_pending) {
+		thread_rescan_pending = 0;
+		rescan_thread_names();
+	}
+
 	/*
 	 * Used to exit simply when nprocs hits zero, but in this testcase:
 	 *  int main(void) { _exit(!!fork()); }
@@ -2281,28 +6121,75 @@ next_event(int *pstatus, siginfo_t *si)
 		 * but that loses the ability to wait for its completion
 		 * on exit. Oh well...
 		 */
-		if (nprocs == 0)
+		if (nprocs == 0 && !resident)
 			return TE_BREAK;
 	}
 
-	if (interactive)
-		sigprocmask(SIG_SETMASK, &start_set, NULL);
-	pid = wait4(-1, pstatus, __WALL, (cflag ? &ru : NULL));
-	wait_errno = errno;
-	if (interactive)
-		sigprocmask(SIG_SETMASK, &blocked_set, NULL);
+	if (event_loop_fd >= 0) {
+		if (!pop_harvested_event(&pid, pstatus, &ru)) {
+			selfprof_enter(SELFPROF_WAIT);
+			if (stops_drained) {
+				if (overhead_budget)
+					governor_idle_begin();
+				wait_event_loop();
+				if (overhead_budget)
+					governor_idle_end();
+			}
+			if (!stops_drained)
+				harvest_events();
+			selfprof_leave(SELFPROF_WAIT);
+
+			if (!pop_harvested_event(&pid, pstatus, &ru)) {
+				if (!harvest_errno || harvest_errno == EINTR)
+					return TE_NEXT;
+				if (nprocs == 0 && harvest_errno == ECHILD) {
+					if (resident) {
+						/* Wait for attach commands.  */
+						harvest_errno = 0;
+						stops_drained = true;
+						return TE_NEXT;
+					}
+					if (shard_fd < 0)
+						return TE_BREAK;
+					/*
+					 * A shard waits for handoffs until
+					 * the coordinator tells it to exit.
+					 */
+					shard_idle();
+					harvest_errno = 0;
+					stops_drained = true;
+					return TE_NEXT;
+				}
+				errno = harvest_errno;
+				perror_msg_and_die("wait4(__WALL)");
+			}
+		}
+	} else if (!pop_harvested_event(&pid, pstatus, &ru)) {
+		selfprof_enter(SELFPROF_WAIT);
+		if (overhead_budget)
+			governor_idle_begin();
+		pid = wait4(-1, pstatus, __WALL, (collect_rusage ? &ru : NULL));
+		wait_errno = errno;
+		if (overhead_budget)
+			governor_idle_end();
+		selfprof_leave(SELFPROF_WAIT);
 
-	if (pid < 0) {
-		if (wait_errno == EINTR)
-			return TE_NEXT;
-		if (nprocs == 0 && wait_errno == ECHILD)
-			return TE_BREAK;
-		/*
-		 * If nprocs > 0, ECHILD is not expected,
-		 * treat it as any other error here:
-		 */
-		errno = wait_errno;
-		perror_msg_and_die("wait4(__WALL)");
+		if (pid < 0) {
+			if (wait_errno == EINTR)
+				return TE_NEXT;
+			if (nprocs == 0 && wait_errno == ECHILD)
+				return TE_BREAK;
+			/*
+			 * If nprocs > 0, ECHILD is not expected,
+			 * treat it as any other error here:
+			 */
+			errno = wait_errno;
+			perror_msg_and_die("wait4(__WALL)");
+		}
+
+		selfprof_enter(SELFPROF_WAIT);
+		harvest_events();
+		selfprof_leave(SELFPROF_WAIT);
 	}
 
 	status = *pstatus;
@@ -2330,11 +6217,20 @@ next_event(int *pstatus, siginfo_t *si)
 	/* Set current output file */
 	current_tcp = tcp;
 
-	if (cflag) {
+	if (count_stime) {
 		tv_sub(&tcp->dtime, &ru.ru_stime, &tcp->stime);
 		tcp->stime = ru.ru_stime;
 	}
 
+	if (summary_threads)
+		count_thread_stop(tcp);
+
+	if (summary_stops)
+		count_stop_begin(tcp);
+
+	if (summary_rusage && (WIFSIGNALED(status) || WIFEXITED(status)))
+		count_rusage(tcp, &ru);
+
 	if (WIFSIGNALED(status))
 		return TE_SIGNALLED;
 
@@ -2370,6 +6266,16 @@ next_event(int *pstatus, siginfo_t *si)
 			return TE_RESTART;
 		} else if (sig == syscall_trap_sig) {
 			return TE_SYSCALL_STOP;
+		} else if (use_seize && !summary_sigdelivery
+			   && !signal_printed(tcp, sig)) {
+			/*
+			 * With PTRACE_SEIZE, group-stops are reported
+			 * as PTRACE_EVENT_STOP, so this is a signal-delivery-stop,
+			 * and its siginfo is needed only to print it
+			 * or to count it for --summary-sigdelivery.
+			 */
+			*si = (siginfo_t) {};
+			return TE_SIGNAL_DELIVERY_STOP;
 		} else {
 			*si = (siginfo_t) {};
 			/*
@@ -2378,6 +6284,7 @@ next_event(int *pstatus, siginfo_t *si)
 			 * TODO: shouldn't we check for errno == EINVAL too?
 			 * We can get ESRCH instead, you know...
 			 */
+			selfprof_count(SELFPROF_PTRACE);
 			bool stopped = ptrace(PTRACE_GETSIGINFO, pid, 0, si) < 0;
 			return stopped ? TE_GROUP_STOP : TE_SIGNAL_DELIVERY_STOP;
 		}
@@ -2401,6 +6308,8 @@ next_event(int *pstatus, siginfo_t *si)
 		return TE_STOP_BEFORE_EXECVE;
 	case PTRACE_EVENT_EXIT:
 		return TE_STOP_BEFORE_EXIT;
+	case PTRACE_EVENT_SECCOMP:
+		return TE_SECCOMP;
 	default:
 		return TE_RESTART;
 	}
@@ -2410,7 +6319,9 @@ static int
 trace_syscall(struct tcb *tcp, unsigned int *sig)
 {
 	if (entering(tcp)) {
+		selfprof_enter(SELFPROF_DECODE);
 		int res = syscall_entering_decode(tcp);
+		selfprof_leave(SELFPROF_DECODE);
 		switch (res) {
 		case 0:
 			return 0;
@@ -2420,16 +6331,87 @@ trace_syscall(struct tcb *tcp, unsigned int *sig)
 		syscall_entering_finish(tcp, res);
 		return res;
 	} else {
-		struct timeval tv = {};
-		int res = syscall_exiting_decode(tcp, &tv);
+		struct timespec ts = {};
+		selfprof_enter(SELFPROF_DECODE);
+		int res = syscall_exiting_decode(tcp, &ts);
+		selfprof_leave(SELFPROF_DECODE);
 		if (res != 0) {
-			res = syscall_exiting_trace(tcp, tv, res);
+			res = syscall_exiting_trace(tcp, ts, res);
 		}
 		syscall_exiting_finish(tcp);
 		return res;
 	}
 }
 
+/* Returns the kind of the ptrace stop for --summary-stops. */
+static enum stop_kind
+trace_event_stop_kind(enum trace_event ret, const struct tcb *tcp)
+{
+	switch (ret) {
+	case TE_SECCOMP:
+		if (seccomp_before_sysentry)
+			return STOP_EVENT;
+		/* fall through */
+	case TE_SYSCALL_STOP:
+		return entering(tcp) ? STOP_SYSCALL_ENTRY : STOP_SYSCALL_EXIT;
+	case TE_SIGNAL_DELIVERY_STOP:
+		return STOP_SIGNAL;
+	case TE_GROUP_STOP:
+		return STOP_GROUP;
+	default:
+		return STOP_EVENT;
+	}
+}
+
+/*
+ * Hand off a new process owned by another shard in its first syscall
+ * entering stop: the syscall is replaced with pause(2), which parks
+ * the process, the process is detached, and the owner puts the syscall
+ * back once it has seized the process, see adopt_tcb.
+ * Returns true if the process has been handed off, otherwise it is traced
+ * here from this stop on.
+ */
+static bool
+handoff_tcb(struct tcb *tcp, const enum trace_event ret)
+{
+	const kernel_ulong_t pause_nr = pause_scno();
+	const int pid = tcp->pid;
+
+	tcp->flags &= ~TCB_HANDOFF;
+
+	if ((ret != TE_SYSCALL_STOP
+	     && (ret != TE_SECCOMP || seccomp_before_sysentry))
+	    || pause_nr == (kernel_ulong_t) -1
+	    || get_scno(tcp) != 1 || current_personality != 0
+	    || !scno_is_valid(tcp->scno))
+		goto trace_here;
+
+	const kernel_ulong_t scno = tcp->scno;
+
+	if (syscall_set_scno(tcp, pause_nr))
+		goto trace_here;
+	if (ptrace(PTRACE_DETACH, pid, 0, 0)) {
+		if (errno != ESRCH)
+			perror_msg("handoff: ptrace(PTRACE_DETACH, %d)", pid);
+		syscall_set_scno(tcp, scno);
+		goto trace_here;
+	}
+
+	droptcb(tcp);
+	/* The process is adopted here if it cannot be sent.  */
+	if (!shard_handoff(pid, scno))
+		adopt_tcb(pid, scno);
+	return true;
+
+trace_here:
+	/* The syscall is decoded again.  */
+	free_tcb_priv_data(tcp);
+	newoutf(tcp);
+	if (!qflag)
+		error_msg("Process %d attached", pid);
+	return false;
+}
+
 /* Returns true iff the main trace loop has to continue. */
 static bool
 dispatch_event(enum trace_event ret, int *pstatus, siginfo_t *si)
@@ -2437,6 +6419,20 @@ dispatch_event(enum trace_event ret, int *pstatus, siginfo_t *si)
 	unsigned int restart_op = PTRACE_SYSCALL;
 	unsigned int restart_sig = 0;
 
+	/* A new process owned by another shard may be handed off now.  */
+	if (ret != TE_BREAK && ret != TE_NEXT && ret != TE_RESTART
+	    && (current_tcp->flags & TCB_HANDOFF)
+	    && handoff_tcb(current_tcp, ret))
+		return true;
+
+	/* Any other stop of the tracee means its group-stop is over. */
+	if (ret != TE_BREAK && ret != TE_NEXT && ret != TE_GROUP_STOP
+	    && (current_tcp->flags & TCB_GROUP_STOPPED))
+		group_stop_end(current_tcp);
+
+	if (summary_stops && ret != TE_BREAK && ret != TE_NEXT)
+		current_tcp->stop_kind = trace_event_stop_kind(ret, current_tcp);
+
 	switch (ret) {
 	case TE_BREAK:
 		return false;
@@ -2447,7 +6443,28 @@ dispatch_event(enum trace_event ret, int *pstatus, siginfo_t *si)
 	case TE_RESTART:
 		break;
 
+	case TE_SECCOMP:
+		if (seccomp_before_sysentry) {
+			/*
+			 * Before Linux 4.8, the seccomp stop precedes
+			 * the syscall-entry stop, the latter is obtained
+			 * by restarting the tracee with PTRACE_SYSCALL.
+			 */
+			break;
+		}
+		/*
+		 * Starting with Linux 4.8, there is no syscall-entry stop
+		 * after PTRACE_CONT, so the seccomp stop is handled
+		 * the same way as the syscall-entry stop.
+		 */
+		/* fall through */
 	case TE_SYSCALL_STOP:
+		/* A seccomp stop of an untraced process is not decoded.  */
+		if ((current_tcp->flags & TCB_UNTRACED) && entering(current_tcp))
+			break;
+		const bool renaming = ntrace_thread_patterns
+				      && exiting(current_tcp)
+				      && current_tcp->s_ent->sen == SEN_prctl;
 		if (trace_syscall(current_tcp, &restart_sig) < 0) {
 			/*
 			 * ptrace() failed in trace_syscall().
@@ -2462,10 +6479,15 @@ dispatch_event(enum trace_event ret, int *pstatus, siginfo_t *si)
 			 */
 			return true;
 		}
+		/* The thread may have been renamed by prctl(PR_SET_NAME).  */
+		if (renaming)
+			update_untraced(current_tcp, false);
 		break;
 
 	case TE_SIGNAL_DELIVERY_STOP:
 		restart_sig = WSTOPSIG(*pstatus);
+		if (current_tcp->flags & TCB_RESTART_PENDING)
+			count_restart(current_tcp, restart_sig);
 		print_stopped(current_tcp, si, restart_sig);
 		break;
 
@@ -2476,7 +6498,8 @@ dispatch_event(enum trace_event ret, int *pstatus, siginfo_t *si)
 
 	case TE_GROUP_STOP:
 		restart_sig = WSTOPSIG(*pstatus);
-		print_stopped(current_tcp, NULL, restart_sig);
+		if (group_stop_begin(current_tcp))
+			print_stopped(current_tcp, NULL, restart_sig);
 		if (use_seize) {
 			/*
 			 * This ends ptrace-stop, but does *not* end group-stop.
@@ -2513,6 +6536,9 @@ dispatch_event(enum trace_event ret, int *pstatus, siginfo_t *si)
 		if (os_release >= KERNEL_VERSION(3, 0, 0))
 			current_tcp = maybe_switch_tcbs(current_tcp, current_tcp->pid);
 
+		if (spawn_profile_enabled())
+			spawn_profile_exec(current_tcp);
+
 		if (detach_on_execve) {
 			if (current_tcp->flags & TCB_SKIP_DETACH_ON_FIRST_EXEC) {
 				current_tcp->flags &= ~TCB_SKIP_DETACH_ON_FIRST_EXEC;
@@ -2521,9 +6547,14 @@ dispatch_event(enum trace_event ret, int *pstatus, siginfo_t *si)
 				return true;
 			}
 		}
+
+		if (selecting_tracees())
+			update_untraced(current_tcp, true);
 		break;
 
 	case TE_STOP_BEFORE_EXIT:
+		if (summary_rusage)
+			count_rusage_exiting(current_tcp);
 		print_event_exit(current_tcp);
 		break;
 	}
@@ -2532,11 +6563,42 @@ dispatch_event(enum trace_event ret, int *pstatus, siginfo_t *si)
 	if (interrupted)
 		return false;
 
+	/* The delayed tracee is restarted by restart_delayed_tcbs.  */
+	if (current_tcp->flags & TCB_DELAYED) {
+		current_tcp->inj->delay_restart_sig = restart_sig;
+		delay_queue_add(current_tcp);
+		return true;
+	}
+
+	/*
+	 * With seccomp filtering, the tracee outside of a syscall is
+	 * restarted with PTRACE_CONT, its next stop is a seccomp stop.
+	 * Before Linux 4.8, the seccomp stop has to be followed by
+	 * the syscall-entry stop, though.
+	 */
+	if (seccomp_filtering && restart_op == PTRACE_SYSCALL
+	    && !(ret == TE_SECCOMP && seccomp_before_sysentry))
+		restart_op = seccomp_filter_restart_operator(current_tcp);
+
+	/*
+	 * An untraced process is restarted with PTRACE_CONT
+	 * once it is outside of syscalls, and its signals are not printed.
+	 */
+	if ((current_tcp->flags & TCB_UNTRACED) && restart_op == PTRACE_SYSCALL
+	    && !(current_tcp->flags & TCB_INSYSCALL)) {
+		current_tcp->flags |= TCB_HIDE_LOG;
+		restart_op = PTRACE_CONT;
+	}
+
 	if (ptrace_restart(restart_op, current_tcp, restart_sig) < 0) {
 		/* Note: ptrace_restart emitted error message */
 		exit_code = 1;
 		return false;
 	}
+#ifdef USE_LIBUNWIND
+	if (stack_snapshot_size)
+		unwind_print_snapshot(current_tcp);
+#endif
 	return true;
 }
 
@@ -2548,9 +6610,14 @@ static void ATTRIBUTE_NORETURN
 terminate(void)
 {
 	cleanup();
+	if (shard_fd >= 0)
+		shard_finish(release_handoff);
+	iocapture_finish();
 	fflush(NULL);
 	if (shared_log != stderr)
 		fclose(shared_log);
+	compress_finish();
+	async_finish();
 	if (popen_pid) {
 		while (waitpid(popen_pid, NULL, 0) < 0 && errno == EINTR)
 			;
@@ -2584,15 +6651,70 @@ terminate(void)
 	exit(exit_code);
 }
 
+/*
+ * The main loop of --count-backend=perf and --count-backend=bpf:
+ * there are no tracee stops to wait for, signals are handled between
+ * reads of the perf rings or of the bpf maps.
+ */
+static void
+count_backend_loop(void)
+{
+	const bool bpf = count_backend == COUNT_BACKEND_BPF;
+
+	sigprocmask(SIG_SETMASK, &blocked_set, NULL);
+
+	while (!interrupted && (bpf ? bpf_count_poll(&start_set)
+				    : perf_count_poll(&start_set))) {
+		if (summary_pending) {
+			summary_pending = 0;
+			call_summary_interval(shared_log);
+		}
+	}
+
+	const int status = bpf ? bpf_count_finish(interrupted)
+			       : perf_count_finish(interrupted);
+
+	if (WIFSIGNALED(status))
+		exit_code = 0x100 | WTERMSIG(status);
+	else
+		exit_code = WEXITSTATUS(status);
+}
+
 int
 main(int argc, char *argv[])
 {
 	init(argc, argv);
 
-	exit_code = !nprocs;
+	if (count_backend != COUNT_BACKEND_PTRACE) {
+		count_backend_loop();
+		terminate();
+	}
+
+	if (nshards && shard_fd < 0) {
+		exit_code = shard_coordinate(shared_log);
+		terminate();
+	}
+
+	exit_code = !nprocs && !resident;
 
+	/*
+	 * The trace loop is deliberately single-threaded.  All ptrace
+	 * requests for a tracee have to be issued by the very thread
+	 * that attached to it, and decoders fetch registers and arguments
+	 * with ptrace while formatting the output, so decoding cannot be
+	 * handed over to other threads without making them tracers of
+	 * their own subsets of tracees, which in turn would break the
+	 * following of forks and the ordering of the shared log.
+	 * To reduce the cost of many simultaneous stops, next_event()
+	 * harvests all pending stops at once instead.
+	 */
 	int status;
 	siginfo_t si;
+
+	/* startup_attach may have left the signals of the event loop unblocked. */
+	if (event_loop_fd >= 0)
+		sigprocmask(SIG_SETMASK, &blocked_set, NULL);
+
 	while (dispatch_event(next_event(&status, &si), &status, &si))
 		;
 	terminate();
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "defs.h"
+#include "selfprof.h"
+#include "strintern.h"
+
+/*
+ * Interned strings are kept in a hash table, each string is allocated
+ * along with its reference counter and is freed when the last reference
+ * to it is dropped.
+ */
+struct interned_str {
+	struct interned_str *next;
+	unsigned int hash;
+	unsigned int refcount;
+	char str[];
+};
+
+static struct interned_str **str_hash;
+static unsigned int str_hash_size;
+static unsigned int str_hash_count;
+
+static unsigned int
+hash_str(const char *str)
+{
+	/* FNV-1a */
+	unsigned int h = 2166136261U;
+
+	for (; *str; ++str)
+		h = (h ^ (unsigned char) *str) * 16777619U;
+
+	return h;
+}
+
+static struct interned_str *
+str_to_interned(const char *const str)
+{
+	return (struct interned_str *)
+		(str - offsetof(struct interned_str, str));
+}
+
+static void
+str_hash_expand(void)
+{
+	struct interned_str **const old_hash = str_hash;
+	const unsigned int old_size = str_hash_size;
+	unsigned int i;
+
+	str_hash_size = old_size ? old_size * 2 : 256;
+	str_hash = xcalloc(str_hash_size, sizeof(*str_hash));
+	selfprof_cache_add(SELFPROF_CACHE_STRINGS, 0,
+			   (long) (str_hash_size - old_size) * sizeof(*str_hash));
+
+	for (i = 0; i < old_size; ++i) {
+		struct interned_str *s, *next;
+
+		for (s = old_hash[i]; s; s = next) {
+			const unsigned int b = s->hash & (str_hash_size - 1);
+
+			next = s->next;
+			s->next = str_hash[b];
+			str_hash[b] = s;
+		}
+	}
+
+	free(old_hash);
+}
+
+const char *
+str_intern(const char *const str)
+{
+	if (!str)
+		return NULL;
+
+	const unsigned int hash = hash_str(str);
+	struct interned_str *s;
+
+	if (str_hash_size) {
+		for (s = str_hash[hash & (str_hash_size - 1)]; s; s = s->next) {
+			if (s->hash == hash && !strcmp(s->str, str)) {
+				++s->refcount;
+				return s->str;
+			}
+		}
+	}
+
+	if (str_hash_count >= str_hash_size)
+		str_hash_expand();
+
+	const size_t len = strlen(str);
+	const unsigned int b = hash & (str_hash_size - 1);
+
+	s = xmalloc(sizeof(*s) + len + 1);
+	s->hash = hash;
+	s->refcount = 1;
+	memcpy(s->str, str, len + 1);
+	s->next = str_hash[b];
+	str_hash[b] = s;
+	++str_hash_count;
+	selfprof_cache_add(SELFPROF_CACHE_STRINGS, 1, sizeof(*s) + len + 1);
+
+	return s->str;
+}
+
+const char *
+str_intern_ref(const char *const str)
+{
+	if (str)
+		++str_to_interned(str)->refcount;
+
+	return str;
+}
+
+void
+str_intern_release(const char *const str)
+{
+	if (!str)
+		return;
+
+	struct interned_str *const s = str_to_interned(str);
+
+	if (--s->refcount)
+		return;
+
+	struct interned_str **ps;
+
+	for (ps = &str_hash[s->hash & (str_hash_size - 1)]; *ps;
+	     ps = &(*ps)->next) {
+		if (*ps == s) {
+			*ps = s->next;
+			break;
+		}
+	}
+	--str_hash_count;
+	selfprof_cache_add(SELFPROF_CACHE_STRINGS, -1,
+			   -(long) (sizeof(*s) + strlen(s->str) + 1));
+	free(s);
+}
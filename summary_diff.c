@@ -0,0 +1,511 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Comparison of two -c summaries or binary traces (--summary-diff option).
+ *
+ * Summaries are read from the tables printed by -c, with latency
+ * percentiles if --summary-latency has been given and with latency
+ * histograms if --summary-histogram has been given.  Binary traces
+ * written by --binary-output are summarized with latency histograms
+ * of the times between syscall entering and exiting.
+ *
+ * Changes of syscall counts are tested as differences of Poisson counts,
+ * changes of error rates with a two-proportion test, and changes of
+ * latency distributions with the Mann-Whitney U test on the histograms.
+ */
+
+#include "defs.h"
+#include "bintrace.h"
+#include "latency_hist.h"
+
+#define DIFF_HASH_SIZE 512
+/* Two-sided normal quantiles of p = 0.05 and p = 0.001 */
+#define Z_SIGNIFICANT 1.96
+#define Z_HIGHLY_SIGNIFICANT 3.29
+
+struct diff_side {
+	uint64_t calls, errors;
+	uint64_t time_ns;
+	/* Percentiles from the --summary-latency columns */
+	bool has_percentiles;
+	uint64_t p50_ns, p99_ns;
+	/* NULL unless the summary has a histogram */
+	struct latency_hist *hist;
+	uint64_t hist_calls;
+};
+
+struct diff_entry {
+	struct diff_entry *next;
+	char *name;
+	struct diff_side side[2];
+	double z_calls, z_errors, z_latency;
+	bool has_z_latency;
+};
+
+/* The syscall a thread is in, for binary traces.  */
+struct diff_thread {
+	struct diff_thread *next;
+	int pid;
+	bool entered;
+	unsigned long long ts;
+};
+
+static struct diff_entry *entries_hash[DIFF_HASH_SIZE];
+static unsigned int nentries;
+static struct diff_thread *threads_hash[DIFF_HASH_SIZE];
+
+/* strace is not linked with libm.  */
+static double
+dsqrt(const double v)
+{
+	double x = v > 1 ? v : 1;
+	unsigned int i;
+
+	if (v <= 0)
+		return 0;
+	for (i = 0; i < 64; ++i) {
+		const double next = (x + v / x) / 2;
+
+		if (next >= x)
+			break;
+		x = next;
+	}
+	return x;
+}
+
+static double
+dabs(const double v)
+{
+	return v < 0 ? -v : v;
+}
+
+static unsigned int
+hash_name(const char *name)
+{
+	unsigned int h = 2166136261U;
+
+	for (; *name; ++name)
+		h = (h ^ (unsigned char) *name) * 16777619U;
+	return h;
+}
+
+static struct diff_entry *
+get_entry(const char *name)
+{
+	struct diff_entry **const bucket =
+		&entries_hash[hash_name(name) % DIFF_HASH_SIZE];
+	struct diff_entry *e;
+
+	for (e = *bucket; e; e = e->next)
+		if (!strcmp(e->name, name))
+			return e;
+
+	e = xcalloc(1, sizeof(*e));
+	e->name = xstrdup(name);
+	e->next = *bucket;
+	*bucket = e;
+	++nentries;
+
+	return e;
+}
+
+static void
+side_hist_add(struct diff_side *s, const uint64_t ns, const uint32_t calls)
+{
+	if (!s->hist)
+		s->hist = xcalloc(1, sizeof(*s->hist));
+
+	uint32_t *const b = &s->hist->buckets[hist_bucket(ns)];
+	*b = calls < UINT32_MAX - *b ? *b + calls : UINT32_MAX;
+	s->hist_calls += calls;
+}
+
+static uint64_t
+side_percentile(const struct diff_side *s, const unsigned int permille)
+{
+	const uint64_t rank = (s->hist_calls * permille + 999) / 1000;
+	uint64_t seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; ++i) {
+		seen += s->hist->buckets[i];
+		if (seen >= rank)
+			return hist_bucket_value(i);
+	}
+
+	return hist_bucket_value(HIST_BUCKETS - 1);
+}
+
+static void
+handle_event(const struct bintrace_event *const ev, void *data)
+{
+	const unsigned int idx = *(const unsigned int *) data;
+	struct diff_thread **const bucket =
+		&threads_hash[(unsigned int) ev->pid % DIFF_HASH_SIZE];
+	struct diff_thread *th;
+
+	for (th = *bucket; th; th = th->next)
+		if (th->pid == ev->pid)
+			break;
+	if (!th) {
+		th = xcalloc(1, sizeof(*th));
+		th->pid = ev->pid;
+		th->next = *bucket;
+		*bucket = th;
+	}
+
+	if (!ev->exiting) {
+		th->entered = true;
+		th->ts = ev->ts;
+		return;
+	}
+
+	/* Syscalls entered before the tracing has begun are not counted.  */
+	if (!th->entered)
+		return;
+	th->entered = false;
+
+	struct diff_side *const s = &get_entry(ev->name)->side[idx];
+	const uint64_t ns = ev->ts > th->ts ? ev->ts - th->ts : 0;
+
+	s->calls++;
+	if (ev->error)
+		s->errors++;
+	s->time_ns += ns;
+	side_hist_add(s, ns, 1);
+}
+
+/*
+ * Parse a row of a -c table, "% time", "seconds", "usecs/call", "calls",
+ * optional "errors", LATENCY_COLUMNS optional columns, and "syscall".
+ */
+static void
+parse_row(char *line, const unsigned int idx, const bool latency)
+{
+	const unsigned int ncols = latency ? 6 : 0;
+	char *tok[5 + 1 + 6 + 1];
+	unsigned int n = 0;
+	char *p;
+
+	for (p = strtok(line, " \t\n"); p && n < ARRAY_SIZE(tok);
+	     p = strtok(NULL, " \t\n"))
+		tok[n++] = p;
+
+	if (n != 5 + ncols && n != 6 + ncols)
+		return;
+
+	struct diff_side *const s = &get_entry(tok[n - 1])->side[idx];
+	const uint64_t calls = strtoull(tok[3], NULL, 10);
+
+	s->calls += calls;
+	if (n == 6 + ncols)
+		s->errors += strtoull(tok[4], NULL, 10);
+	s->time_ns += strtod(tok[1], NULL) * 1e9;
+	if (latency && !s->has_percentiles) {
+		s->has_percentiles = true;
+		s->p50_ns = strtoull(tok[n - 1 - 5], NULL, 10) * 1000;
+		s->p99_ns = strtoull(tok[n - 1 - 3], NULL, 10) * 1000;
+	}
+}
+
+/*
+ * Read the tables printed by -c and the histograms printed by
+ * --summary-histogram.  Rows of several tables, like these of several
+ * personalities, are added up.
+ */
+static void
+parse_summary(FILE *fp, const char *path, const unsigned int idx)
+{
+	static const char hist_suffix[] = " latency histogram (usecs):\n";
+	enum { SEARCH, HEADER, ROWS, HISTOGRAM } state = SEARCH;
+	struct diff_side *hist_side = NULL;
+	bool latency = false;
+	bool tables = false;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+
+	while ((len = getline(&line, &size, fp)) >= 0) {
+		if (state == HISTOGRAM) {
+			double lo, hi;
+			unsigned int count;
+
+			if (sscanf(line, "%lf - %lf %u", &lo, &hi, &count) == 3) {
+				side_hist_add(hist_side, lo * 1e3 + 0.5, count);
+				continue;
+			}
+			state = SEARCH;
+		}
+
+		if (!strncmp(line, "% time ", 7)) {
+			latency = strstr(line, " min usecs ");
+			tables = true;
+			state = HEADER;
+		} else if (state == HEADER || state == ROWS) {
+			if (line[0] == '-') {
+				/* The dashes after the rows end the table.  */
+				if (state == ROWS)
+					state = SEARCH;
+				continue;
+			}
+			state = ROWS;
+			parse_row(line, idx, latency);
+		} else if ((size_t) len > sizeof(hist_suffix) - 1 &&
+			   !strcmp(line + len - (sizeof(hist_suffix) - 1),
+				   hist_suffix)) {
+			line[len - (sizeof(hist_suffix) - 1)] = '\0';
+			hist_side = &get_entry(line)->side[idx];
+			state = HISTOGRAM;
+		}
+	}
+
+	if (ferror(fp))
+		perror_msg_and_die("%s", path);
+	free(line);
+
+	if (!tables)
+		error_msg_and_die("%s: neither a binary trace nor a -c summary",
+				  path);
+}
+
+static void
+read_input(const char *path, const unsigned int idx)
+{
+	if (bintrace_read(path, handle_event, (void *) &idx))
+		return;
+
+	FILE *const fp = decompress_fopen(path);
+
+	if (!fp)
+		perror_msg_and_die("Can't fopen '%s'", path);
+	parse_summary(fp, path, idx);
+	fclose(fp);
+}
+
+/* z-score of the change of a Poisson count from N1 to N2.  */
+static double
+count_z(const uint64_t n1, const uint64_t n2)
+{
+	return n1 + n2 ? ((double) n2 - n1) / dsqrt((double) n1 + n2) : 0;
+}
+
+/* z-score of the change of the proportion from E1/N1 to E2/N2.  */
+static double
+proportion_z(const uint64_t e1, const uint64_t n1,
+	     const uint64_t e2, const uint64_t n2)
+{
+	if (!n1 || !n2)
+		return 0;
+
+	const double p = (double) (e1 + e2) / (n1 + n2);
+	const double var = p * (1 - p) * (1.0 / n1 + 1.0 / n2);
+
+	return var > 0 ? ((double) e2 / n2 - (double) e1 / n1) / dsqrt(var) : 0;
+}
+
+/*
+ * z-score of the Mann-Whitney U test of the histograms, positive if
+ * the latencies of the second one are larger.  Values in the same bucket
+ * are treated as ties.
+ */
+static double
+mann_whitney_z(const struct diff_side *a, const struct diff_side *b)
+{
+	const double n1 = a->hist_calls, n2 = b->hist_calls;
+	const double n = n1 + n2;
+	double rank = 0, rank_sum = 0, ties = 0;
+	unsigned int i;
+
+	if (!n1 || !n2)
+		return 0;
+
+	for (i = 0; i < HIST_BUCKETS; ++i) {
+		const double t = (double) a->hist->buckets[i]
+				 + b->hist->buckets[i];
+
+		if (!t)
+			continue;
+		/* Tied values get the mean of their ranks.  */
+		rank_sum += b->hist->buckets[i] * (rank + (t + 1) / 2);
+		rank += t;
+		ties += t * t * t - t;
+	}
+
+	const double u = rank_sum - n2 * (n2 + 1) / 2;
+	const double var = n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1)));
+
+	return var > 0 ? (u - n1 * n2 / 2) / dsqrt(var) : 0;
+}
+
+static const char *
+significance(const double z)
+{
+	return dabs(z) >= Z_HIGHLY_SIGNIFICANT ? "**"
+	     : dabs(z) >= Z_SIGNIFICANT ? "*" : "";
+}
+
+/* Format the relative change from OLD to NEW with its significance.  */
+static void
+format_change(char *buf, const size_t size, const double old,
+	      const double new, const char *sig)
+{
+	if (old == new)
+		snprintf(buf, size, "0%%%s", sig);
+	else if (old == 0)
+		snprintf(buf, size, "new%s", sig);
+	else
+		snprintf(buf, size, "%+.1f%%%s", (new - old) * 100 / old, sig);
+}
+
+static void
+format_usecs(char *buf, const size_t size, const struct diff_side *s,
+	     const unsigned int permille)
+{
+	if (s->hist_calls)
+		snprintf(buf, size, "%" PRIu64,
+			 side_percentile(s, permille) / 1000);
+	else if (s->has_percentiles)
+		snprintf(buf, size, "%" PRIu64,
+			 (permille == 500 ? s->p50_ns : s->p99_ns) / 1000);
+	else
+		snprintf(buf, size, "-");
+}
+
+static void
+format_mean(char *buf, const size_t size, const struct diff_side *s)
+{
+	if (s->calls)
+		snprintf(buf, size, "%" PRIu64, s->time_ns / s->calls / 1000);
+	else
+		snprintf(buf, size, "-");
+}
+
+static double
+max_z(const struct diff_entry *e)
+{
+	return MAX(e->z_calls, e->has_z_latency ? e->z_latency : e->z_calls);
+}
+
+/* The most significantly more frequent or slower syscalls go first.  */
+static int
+diff_entry_cmp(const void *a, const void *b)
+{
+	const struct diff_entry *const x = *(const struct diff_entry **) a;
+	const struct diff_entry *const y = *(const struct diff_entry **) b;
+	const double zx = max_z(x), zy = max_z(y);
+
+	return (zx < zy) ? 1 : (zx > zy) ? -1 : strcmp(x->name, y->name);
+}
+
+static void
+print_entry(const struct diff_entry *e)
+{
+	const struct diff_side *const o = &e->side[0];
+	const struct diff_side *const n = &e->side[1];
+	const double mean_o = o->calls ? (double) o->time_ns / o->calls : 0;
+	const double mean_n = n->calls ? (double) n->time_ns / n->calls : 0;
+	char calls_change[sizeof("+100.0%**") + sizeof(double) * 3];
+	char usecs_change[sizeof(calls_change)];
+	char err_o[sizeof("100.00")], err_n[sizeof("100.00**")];
+	char p50_o[sizeof(uint64_t) * 3], p50_n[sizeof(p50_o)];
+	char p99_o[sizeof(p50_o)], p99_n[sizeof(p50_o)];
+	char mean_o_str[sizeof(p50_o)], mean_n_str[sizeof(p50_o)];
+
+	format_change(calls_change, sizeof(calls_change), o->calls, n->calls,
+		      significance(e->z_calls));
+	format_change(usecs_change, sizeof(usecs_change), mean_o, mean_n,
+		      e->has_z_latency ? significance(e->z_latency) : "");
+	snprintf(err_o, sizeof(err_o), "%.2f",
+		 o->calls ? 100.0 * o->errors / o->calls : 0);
+	snprintf(err_n, sizeof(err_n), "%.2f%s",
+		 n->calls ? 100.0 * n->errors / n->calls : 0,
+		 significance(e->z_errors));
+	format_mean(mean_o_str, sizeof(mean_o_str), o);
+	format_mean(mean_n_str, sizeof(mean_n_str), n);
+	format_usecs(p50_o, sizeof(p50_o), o, 500);
+	format_usecs(p50_n, sizeof(p50_n), n, 500);
+	format_usecs(p99_o, sizeof(p99_o), o, 990);
+	format_usecs(p99_n, sizeof(p99_n), n, 990);
+
+	printf("%9" PRIu64 " %9" PRIu64 " %9s %7s %8s %11s %11s %9s"
+	       " %11s %11s %11s %11s %s\n",
+	       o->calls, n->calls, calls_change, err_o, err_n,
+	       mean_o_str, mean_n_str, usecs_change,
+	       p50_o, p50_n, p99_o, p99_n, e->name);
+}
+
+void ATTRIBUTE_NORETURN
+summary_diff(const char *old_path, const char *new_path)
+{
+	const char *dashes = "----------------";
+	struct diff_entry **sorted;
+	unsigned int i, n = 0;
+
+	read_input(old_path, 0);
+	read_input(new_path, 1);
+
+	sorted = xcalloc(nentries, sizeof(sorted[0]));
+	for (i = 0; i < ARRAY_SIZE(entries_hash); ++i) {
+		struct diff_entry *e;
+
+		for (e = entries_hash[i]; e; e = e->next) {
+			const struct diff_side *const o = &e->side[0];
+			const struct diff_side *const s = &e->side[1];
+
+			e->z_calls = count_z(o->calls, s->calls);
+			e->z_errors = proportion_z(o->errors, o->calls,
+						   s->errors, s->calls);
+			e->has_z_latency = o->hist_calls && s->hist_calls;
+			if (e->has_z_latency)
+				e->z_latency = mann_whitney_z(o, s);
+			sorted[n++] = e;
+		}
+	}
+	qsort(sorted, n, sizeof(sorted[0]), diff_entry_cmp);
+
+	printf("%9.9s %9.9s %9.9s %7.7s %8.8s %11.11s %11.11s %9.9s"
+	       " %11.11s %11.11s %11.11s %11.11s %s\n",
+	       "old calls", "new calls", "change", "errors%", "new err%",
+	       "usecs/call", "new usecs", "change",
+	       "p50 usecs", "new p50", "p99 usecs", "new p99", "syscall");
+	printf("%9.9s %9.9s %9.9s %7.7s %8.8s %11.11s %11.11s %9.9s"
+	       " %11.11s %11.11s %11.11s %11.11s %s\n",
+	       dashes, dashes, dashes, dashes, dashes, dashes, dashes,
+	       dashes, dashes, dashes, dashes, dashes, dashes);
+	for (i = 0; i < n; ++i)
+		print_entry(sorted[i]);
+	printf("* p < 0.05, ** p < 0.001: calls are tested as Poisson counts,"
+	       " errors as proportions,\nlatencies with the Mann-Whitney U"
+	       " test of histograms\n");
+
+	free(sorted);
+	if (fflush(stdout))
+		perror_msg_and_die("stdout");
+	exit(0);
+}
@@ -0,0 +1,384 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Merging of -c summaries (--summary-merge option).
+ *
+ * Summaries are read from the JSON objects printed by
+ * --summary-format=json, which have the times in nanoseconds and,
+ * with --summary-histogram, the latency histograms with the lowest value
+ * of each bucket, so nothing is lost by reading them back.  The statistics
+ * of each system call are added to these of count.c the same way as the
+ * aggregates of the bpf counting backend: counts and times are summed,
+ * minimum and maximum times are kept, histograms are summed bucket-wise,
+ * and each personality is kept apart.  The merged summary is printed
+ * by call_summary in any --summary-format.
+ *
+ * Snapshots printed by --summary-interval are skipped, the final summary
+ * of the same run covers them.
+ */
+
+#include "defs.h"
+#include "latency_hist.h"
+
+struct merge_input {
+	const char *path;
+	unsigned int lineno;
+	const char *p;
+};
+
+struct merge_syscall {
+	char name[64];
+	uint64_t calls, errors;
+	uint64_t time_ns, min_ns, max_ns;
+	bool has_hist;
+	struct latency_hist hist;
+};
+
+static void ATTRIBUTE_NORETURN
+malformed(const struct merge_input *in)
+{
+	error_msg_and_die("%s:%u: malformed summary", in->path, in->lineno);
+}
+
+static bool
+accept(struct merge_input *in, const char c)
+{
+	if (*in->p != c)
+		return false;
+	++in->p;
+	return true;
+}
+
+static void
+expect(struct merge_input *in, const char c)
+{
+	if (!accept(in, c))
+		malformed(in);
+}
+
+static uint64_t
+parse_number(struct merge_input *in)
+{
+	unsigned long long v;
+	char *end;
+
+	if (*in->p < '0' || *in->p > '9')
+		malformed(in);
+	errno = 0;
+	v = strtoull(in->p, &end, 10);
+	if (errno)
+		malformed(in);
+	in->p = end;
+
+	return v;
+}
+
+/* The strings of the summaries, names of system calls, have no escapes. */
+static void
+parse_string(struct merge_input *in, char *buf, const size_t size)
+{
+	expect(in, '"');
+
+	const char *const end = strchr(in->p, '"');
+
+	if (!end || (size_t) (end - in->p) >= size)
+		malformed(in);
+	memcpy(buf, in->p, end - in->p);
+	buf[end - in->p] = '\0';
+	in->p = end + 1;
+}
+
+/* Skip the value of a member nobody is interested in. */
+static void
+skip_value(struct merge_input *in)
+{
+	unsigned int depth = 0;
+
+	for (;; ++in->p) {
+		switch (*in->p) {
+		case '\0':
+			malformed(in);
+		case '"': {
+			const char *const end = strchr(in->p + 1, '"');
+
+			if (!end)
+				malformed(in);
+			in->p = end;
+			break;
+		}
+		case '{':
+		case '[':
+			++depth;
+			break;
+		case '}':
+		case ']':
+			if (!depth)
+				return;
+			if (!--depth) {
+				++in->p;
+				return;
+			}
+			break;
+		case ',':
+			if (!depth)
+				return;
+			break;
+		}
+	}
+}
+
+static void
+parse_object(struct merge_input *in,
+	     void (*member)(struct merge_input *, const char *key, void *),
+	     void *data)
+{
+	char key[64];
+
+	expect(in, '{');
+	if (accept(in, '}'))
+		return;
+	do {
+		parse_string(in, key, sizeof(key));
+		expect(in, ':');
+		member(in, key, data);
+	} while (accept(in, ','));
+	expect(in, '}');
+}
+
+static void
+parse_array(struct merge_input *in,
+	    void (*element)(struct merge_input *, void *), void *data)
+{
+	expect(in, '[');
+	if (accept(in, ']'))
+		return;
+	do {
+		element(in, data);
+	} while (accept(in, ','));
+	expect(in, ']');
+}
+
+/* A pair of the lowest value of a bucket and its number of calls. */
+static void
+hist_pair(struct merge_input *in, void *data)
+{
+	struct merge_syscall *const s = data;
+
+	expect(in, '[');
+	const uint64_t ns = parse_number(in);
+	expect(in, ',');
+	const uint64_t calls = parse_number(in);
+	expect(in, ']');
+
+	uint32_t *const b = &s->hist.buckets[hist_bucket(ns)];
+	*b = calls < UINT32_MAX - *b ? *b + calls : UINT32_MAX;
+	s->has_hist = true;
+}
+
+static void
+syscall_member(struct merge_input *in, const char *key, void *data)
+{
+	struct merge_syscall *const s = data;
+
+	if (!strcmp(key, "name"))
+		parse_string(in, s->name, sizeof(s->name));
+	else if (!strcmp(key, "calls"))
+		s->calls = parse_number(in);
+	else if (!strcmp(key, "errors"))
+		s->errors = parse_number(in);
+	else if (!strcmp(key, "time_ns"))
+		s->time_ns = parse_number(in);
+	else if (!strcmp(key, "min_ns"))
+		s->min_ns = parse_number(in);
+	else if (!strcmp(key, "max_ns"))
+		s->max_ns = parse_number(in);
+	else if (!strcmp(key, "histogram"))
+		parse_array(in, hist_pair, s);
+	else
+		/* The percentiles are recomputed from the histograms.  */
+		skip_value(in);
+}
+
+static int
+lookup_scno(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < nsyscalls; ++i) {
+		if (sysent[i].sys_name && !strcmp(sysent[i].sys_name, name))
+			return i;
+	}
+
+	return -1;
+}
+
+/* Add a system call of the current personality to the merged summary. */
+static void
+merge_syscall(struct merge_input *in, void *data)
+{
+	struct merge_syscall s;
+	unsigned int i;
+
+	memset(&s, 0, sizeof(s));
+	parse_object(in, syscall_member, &s);
+
+	const int scno = lookup_scno(s.name);
+
+	if (scno < 0) {
+		error_msg("%s:%u: unknown %u bit system call %s, skipped",
+			  in->path, in->lineno, current_wordsize * 8, s.name);
+		return;
+	}
+
+	count_syscall_aggregate(scno, s.calls, s.errors, s.time_ns,
+				s.min_ns, s.max_ns);
+	if (!s.has_hist)
+		return;
+	for (i = 0; i < HIST_BUCKETS; ++i) {
+		if (s.hist.buckets[i])
+			count_syscall_latency(scno, hist_bucket_value(i),
+					      s.hist.buckets[i]);
+	}
+}
+
+/*
+ * Summaries only record the word size of a personality, which tells
+ * the personalities of an architecture apart except x32 from i386.
+ */
+static void
+set_wordsize_personality(const struct merge_input *in,
+			 const unsigned int wordsize)
+{
+	unsigned int p;
+
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		set_personality(p);
+		if (current_wordsize * 8 == wordsize)
+			return;
+	}
+
+	error_msg_and_die("%s:%u: no %u bit personality", in->path,
+			  in->lineno, wordsize);
+}
+
+static void
+personality_member(struct merge_input *in, const char *key, void *data)
+{
+	bool *const has_wordsize = data;
+
+	if (!strcmp(key, "wordsize")) {
+		set_wordsize_personality(in, parse_number(in));
+		*has_wordsize = true;
+	} else if (!strcmp(key, "syscalls")) {
+		if (!*has_wordsize)
+			malformed(in);
+		parse_array(in, merge_syscall, NULL);
+	} else {
+		/* The overhead has been subtracted from the times already. */
+		skip_value(in);
+	}
+}
+
+static void
+merge_personality(struct merge_input *in, void *data)
+{
+	bool has_wordsize = false;
+
+	parse_object(in, personality_member, &has_wordsize);
+}
+
+static void
+summary_member(struct merge_input *in, const char *key, void *data)
+{
+	uint64_t *const interval = data;
+
+	if (!strcmp(key, "interval"))
+		*interval = parse_number(in);
+	else if (!strcmp(key, "personalities") && !*interval)
+		parse_array(in, merge_personality, NULL);
+	else
+		/* Calls of sampled summaries are extrapolated already. */
+		skip_value(in);
+}
+
+/*
+ * Merge the summaries of a file, which may also have other output,
+ * like the trace printed before the summary by -C.
+ */
+static void
+merge_file(const char *path)
+{
+	static const char prefix[] = "{\"timestamp\":";
+	struct merge_input in = { .path = path };
+	unsigned int nsummaries = 0;
+	char *line = NULL;
+	size_t size = 0;
+	FILE *const fp = decompress_fopen(path);
+
+	if (!fp)
+		perror_msg_and_die("Can't fopen '%s'", path);
+
+	while (getline(&line, &size, fp) >= 0) {
+		uint64_t interval = 0;
+
+		++in.lineno;
+		if (strncmp(line, prefix, sizeof(prefix) - 1))
+			continue;
+		in.p = line;
+		parse_object(&in, summary_member, &interval);
+		if (*in.p != '\n' && *in.p != '\0')
+			malformed(&in);
+		nsummaries += !interval;
+	}
+
+	if (ferror(fp))
+		perror_msg_and_die("%s", path);
+	free(line);
+	fclose(fp);
+
+	if (!nsummaries)
+		error_msg_and_die("%s: no --summary-format=json summary", path);
+}
+
+void ATTRIBUTE_NORETURN
+summary_merge(char *const *paths, const unsigned int npaths)
+{
+	unsigned int i;
+
+	for (i = 0; i < npaths; ++i)
+		merge_file(paths[i]);
+
+	/* The times of the summaries are free of overhead already. */
+	set_overhead(0);
+	call_summary(stdout);
+
+	if (fflush(stdout))
+		perror_msg_and_die("stdout");
+	exit(0);
+}
@@ -29,19 +29,32 @@
 #define STRACE_SUPPORTED_PERSONALITIES_H
 
 #if defined X86_64
-# define SUPPORTED_PERSONALITIES 3
+# define ARCH_PERSONALITIES 3
 #elif defined AARCH64 \
    || defined POWERPC64 \
    || defined RISCV \
    || defined SPARC64 \
    || defined TILE \
    || defined X32
-# define SUPPORTED_PERSONALITIES 2
+# define ARCH_PERSONALITIES 2
 #else
+# define ARCH_PERSONALITIES 1
+#endif
+
+/*
+ * A native-only build has the tables of personality 0 only,
+ * the syscalls of the other personalities are not decoded.
+ */
+#if ENABLE_NATIVE_ONLY
 # define SUPPORTED_PERSONALITIES 1
+#else
+# define SUPPORTED_PERSONALITIES ARCH_PERSONALITIES
 #endif
 
 #if defined TILE && defined __tilepro__
+# if ENABLE_NATIVE_ONLY
+#  error "native-only build is not supported on TILEPro"
+# endif
 # define DEFAULT_PERSONALITY 1
 #else
 # define DEFAULT_PERSONALITY 0
@@ -0,0 +1,489 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Durability cost per file (--summary-sync option).
+ *
+ * fsync, fdatasync, sync_file_range, syncfs, and msync calls are
+ * accounted to the path of their descriptor, or of the file mapped
+ * at the address for msync, with their latency and the bytes written
+ * through the same descriptor since its previous sync.  With -k,
+ * the time spent in syncs is also accounted to their call sites.
+ */
+
+#include "defs.h"
+#include "syscall.h"
+#include "strintern.h"
+#include "latency_hist.h"
+#include <sys/param.h>
+
+struct sync_counts {
+	struct sync_counts *next;
+	const char *path;	/* interned */
+	uint64_t calls, errors;
+	uint64_t time_ns, min_ns, max_ns;
+	uint64_t bytes;		/* Written since the previous syncs */
+	struct latency_hist hist;
+};
+
+/* Bytes written through each descriptor of a thread group since its sync */
+struct dirty_table {
+	struct dirty_table *next;
+	int tgid;
+	uint64_t *dirty;
+	unsigned int nfds;
+};
+
+unsigned int summary_sync;
+
+static struct sync_counts **sync_hash;
+static unsigned int sync_hash_size;
+static unsigned int sync_hash_count;
+static struct dirty_table **dirty_hash;
+static unsigned int dirty_hash_size;
+static unsigned int dirty_hash_count;
+
+#ifdef USE_LIBUNWIND
+/* Time spent in syncs per -k stack, indexed by stack id.  */
+struct sync_site {
+	uint64_t time_ns, calls, bytes;
+};
+static struct sync_site *sites;
+static unsigned int nsites;
+# define SUMMARY_SYNC_SITES 20
+#endif
+
+static void
+dirty_hash_expand(void)
+{
+	struct dirty_table **const old_hash = dirty_hash;
+	const unsigned int old_size = dirty_hash_size;
+	unsigned int i;
+
+	dirty_hash_size = old_size ? old_size * 2 : 64;
+	dirty_hash = xcalloc(dirty_hash_size, sizeof(dirty_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct dirty_table *dt, *next;
+
+		for (dt = old_hash[i]; dt; dt = next) {
+			const unsigned int b =
+				(unsigned int) dt->tgid & (dirty_hash_size - 1);
+
+			next = dt->next;
+			dt->next = dirty_hash[b];
+			dirty_hash[b] = dt;
+		}
+	}
+
+	free(old_hash);
+}
+
+/* Return the dirty byte counter of the descriptor, NULL if fd is invalid. */
+static uint64_t *
+get_dirty(struct tcb *const tcp, const int fd)
+{
+	if (fd < 0)
+		return NULL;
+
+	const int tgid = get_tcb_tgid(tcp);
+	struct dirty_table *dt = NULL;
+
+	if (dirty_hash_size) {
+		for (dt = dirty_hash[(unsigned int) tgid
+				     & (dirty_hash_size - 1)];
+		     dt; dt = dt->next) {
+			if (dt->tgid == tgid)
+				break;
+		}
+	}
+
+	if (!dt) {
+		if (dirty_hash_count >= dirty_hash_size)
+			dirty_hash_expand();
+
+		const unsigned int b =
+			(unsigned int) tgid & (dirty_hash_size - 1);
+
+		dt = xcalloc(1, sizeof(*dt));
+		dt->tgid = tgid;
+		dt->next = dirty_hash[b];
+		dirty_hash[b] = dt;
+		++dirty_hash_count;
+	}
+
+	if ((unsigned int) fd >= dt->nfds) {
+		const unsigned int n = MAX((unsigned int) fd + 1, dt->nfds * 2);
+
+		dt->dirty = xreallocarray(dt->dirty, n, sizeof(dt->dirty[0]));
+		memset(&dt->dirty[dt->nfds], 0,
+		       (n - dt->nfds) * sizeof(dt->dirty[0]));
+		dt->nfds = n;
+	}
+
+	return &dt->dirty[fd];
+}
+
+static unsigned int
+hash_path(const char *const path)
+{
+	/* Interned strings are compared by their addresses.  */
+	return (unsigned int) ((uintptr_t) path >> 4) * 2654435761U;
+}
+
+static void
+sync_hash_expand(void)
+{
+	struct sync_counts **const old_hash = sync_hash;
+	const unsigned int old_size = sync_hash_size;
+	unsigned int i;
+
+	sync_hash_size = old_size ? old_size * 2 : 64;
+	sync_hash = xcalloc(sync_hash_size, sizeof(sync_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct sync_counts *sc, *next;
+
+		for (sc = old_hash[i]; sc; sc = next) {
+			const unsigned int b =
+				hash_path(sc->path) & (sync_hash_size - 1);
+
+			next = sc->next;
+			sc->next = sync_hash[b];
+			sync_hash[b] = sc;
+		}
+	}
+
+	free(old_hash);
+}
+
+static struct sync_counts *
+get_sync_counts(const char *const buf)
+{
+	const char *const path = str_intern(buf);
+	struct sync_counts *sc;
+
+	if (sync_hash_size) {
+		for (sc = sync_hash[hash_path(path) & (sync_hash_size - 1)];
+		     sc; sc = sc->next) {
+			if (sc->path == path) {
+				str_intern_release(path);
+				return sc;
+			}
+		}
+	}
+
+	if (sync_hash_count >= sync_hash_size)
+		sync_hash_expand();
+
+	const unsigned int b = hash_path(path) & (sync_hash_size - 1);
+
+	sc = xcalloc(1, sizeof(*sc));
+	sc->path = path;
+	sc->next = sync_hash[b];
+	sync_hash[b] = sc;
+	++sync_hash_count;
+
+	return sc;
+}
+
+/*
+ * Store the path of the file mapped at addr in buf,
+ * return false if there is none.
+ */
+static bool
+get_mapping_path(struct tcb *const tcp, const kernel_ulong_t addr,
+		 char *const buf, const size_t size)
+{
+	char maps[sizeof("/proc/%u/maps") + sizeof(int) * 3];
+	char line[PATH_MAX + 80];
+	bool found = false;
+	FILE *fp;
+
+	sprintf(maps, "/proc/%u/maps", tcp->pid);
+	fp = fopen(maps, "r");
+	if (!fp)
+		return false;
+
+	while (fgets(line, sizeof(line), fp)) {
+		unsigned long start, end;
+		int pos = 0;
+
+		if (sscanf(line, "%lx-%lx %*s %*s %*s %*s %n",
+			   &start, &end, &pos) < 2 || !pos)
+			continue;
+		if (addr < start || addr >= end)
+			continue;
+
+		const size_t len = strcspn(line + pos, "\n");
+
+		if (len && len < size) {
+			memcpy(buf, line + pos, len);
+			buf[len] = '\0';
+			found = true;
+		}
+		break;
+	}
+
+	fclose(fp);
+	return found;
+}
+
+#ifdef USE_LIBUNWIND
+static void
+count_sync_site(struct tcb *const tcp, const uint64_t ns, const uint64_t bytes)
+{
+	const unsigned int id = unwind_stack_id(tcp);
+
+	if (!id)
+		return;
+	if (id > nsites) {
+		const unsigned int n = MAX(id, nsites * 2);
+
+		sites = xreallocarray(sites, n, sizeof(sites[0]));
+		memset(&sites[nsites], 0, (n - nsites) * sizeof(sites[0]));
+		nsites = n;
+	}
+	sites[id - 1].time_ns += ns;
+	sites[id - 1].bytes += bytes;
+	sites[id - 1].calls++;
+}
+#endif
+
+static void
+count_sync_call(struct tcb *const tcp, const char *const path,
+		uint64_t *const dirty, const uint64_t ns)
+{
+	struct sync_counts *const sc = get_sync_counts(path);
+	const uint64_t bytes = dirty ? *dirty : 0;
+
+	sc->calls++;
+	if (syserror(tcp)) {
+		sc->errors++;
+	} else if (dirty) {
+		sc->bytes += bytes;
+		*dirty = 0;
+	}
+	sc->time_ns += ns;
+	if (sc->calls == 1 || ns < sc->min_ns)
+		sc->min_ns = ns;
+	if (ns > sc->max_ns)
+		sc->max_ns = ns;
+
+	uint32_t *const b = &sc->hist.buckets[hist_bucket(ns)];
+
+	if (*b < UINT32_MAX)
+		++*b;
+
+#ifdef USE_LIBUNWIND
+	if (stack_trace_enabled && stack_traced(tcp))
+		count_sync_site(tcp, ns, syserror(tcp) ? 0 : bytes);
+#endif
+}
+
+static void
+count_written(struct tcb *const tcp, const int fd)
+{
+	uint64_t *const dirty = get_dirty(tcp, fd);
+
+	if (dirty && !syserror(tcp))
+		*dirty += tcp->u_rval;
+}
+
+void
+count_sync(struct tcb *const tcp, const uint64_t ns)
+{
+	const int fd = tcp->u_arg[0];
+	char path[PATH_MAX + 1];
+
+	switch (tcp->s_ent->sen) {
+	case SEN_write:
+	case SEN_writev:
+	case SEN_pwrite:
+	case SEN_pwritev:
+	case SEN_pwritev2:
+	case SEN_sendfile:
+	case SEN_sendfile64:
+		count_written(tcp, fd);
+		break;
+	case SEN_splice:
+	case SEN_copy_file_range:
+		count_written(tcp, tcp->u_arg[2]);
+		break;
+	case SEN_close: {
+		uint64_t *const dirty = get_dirty(tcp, fd);
+
+		if (dirty)
+			*dirty = 0;
+		break;
+	}
+	case SEN_fsync:
+	case SEN_fdatasync:
+	case SEN_sync_file_range:
+	case SEN_sync_file_range2:
+	case SEN_syncfs:
+		if (getfdpath(tcp, fd, path, sizeof(path)) < 0)
+			snprintf(path, sizeof(path), "<pid %d fd %d>",
+				 tcp->pid, fd);
+		count_sync_call(tcp, path, get_dirty(tcp, fd), ns);
+		break;
+	case SEN_msync:
+		if (!get_mapping_path(tcp, tcp->u_arg[0], path, sizeof(path)))
+			strcpy(path, "[anonymous]");
+		count_sync_call(tcp, path, NULL, ns);
+		break;
+	case SEN_sync:
+		count_sync_call(tcp, "[sync]", NULL, ns);
+		break;
+	}
+}
+
+static uint64_t
+sync_percentile(const struct sync_counts *const sc, const unsigned int permille)
+{
+	const uint64_t rank = (sc->calls * permille + 999) / 1000;
+	uint64_t seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; ++i) {
+		seen += sc->hist.buckets[i];
+		if (seen >= rank) {
+			const uint64_t v = hist_bucket_value(i);
+
+			return v < sc->min_ns ? sc->min_ns
+			     : v > sc->max_ns ? sc->max_ns : v;
+		}
+	}
+
+	return sc->max_ns;
+}
+
+static int
+sync_counts_cmp(const void *a, const void *b)
+{
+	const struct sync_counts *const x = *(const struct sync_counts **) a;
+	const struct sync_counts *const y = *(const struct sync_counts **) b;
+
+	return (x->time_ns < y->time_ns) ? 1 : (x->time_ns > y->time_ns) ? -1
+	     : strcmp(x->path, y->path);
+}
+
+#ifdef USE_LIBUNWIND
+static void
+sync_site_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	unsigned int *sorted;
+	unsigned int i, n = 0;
+
+	for (i = 0; i < nsites; ++i) {
+		if (sites[i].calls)
+			++n;
+	}
+	if (!n)
+		return;
+
+	sorted = xcalloc(n, sizeof(sorted[0]));
+	for (i = 0, n = 0; i < nsites; ++i) {
+		if (sites[i].calls)
+			sorted[n++] = i;
+	}
+	for (i = 1; i < n; ++i) {
+		/* Insertion sort by time, the number of sites is small.  */
+		const unsigned int id = sorted[i];
+		unsigned int j;
+
+		for (j = i; j > 0 &&
+			    sites[sorted[j - 1]].time_ns < sites[id].time_ns;
+		     --j)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = id;
+	}
+
+	fprintf(outf, "\n%11.11s %9.9s %14.14s %s\n", "seconds", "calls",
+		"bytes synced", "sync site");
+	fprintf(outf, "%11.11s %9.9s %14.14s %s\n",
+		dashes, dashes, dashes, dashes);
+	for (i = 0; i < n && i < SUMMARY_SYNC_SITES; ++i) {
+		fprintf(outf, "%11.6f %9" PRIu64 " %14" PRIu64 " ",
+			sites[sorted[i]].time_ns / 1e9, sites[sorted[i]].calls,
+			sites[sorted[i]].bytes);
+		unwind_print_folded_stack(outf, sorted[i] + 1);
+		fputc('\n', outf);
+	}
+
+	free(sorted);
+}
+#endif
+
+/*
+ * Print the files whose syncs took the longest in total,
+ * at most summary_sync of them.
+ */
+void
+sync_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	struct sync_counts **sorted;
+	unsigned int i, n = 0;
+
+	if (!sync_hash_count)
+		return;
+
+	sorted = xcalloc(sync_hash_count, sizeof(sorted[0]));
+	for (i = 0; i < sync_hash_size; ++i) {
+		struct sync_counts *sc;
+
+		for (sc = sync_hash[i]; sc; sc = sc->next)
+			sorted[n++] = sc;
+	}
+	sort_top(sorted, n, sizeof(sorted[0]), summary_sync, sync_counts_cmp);
+
+	fprintf(outf, "\n%9.9s %9.9s %11.11s %9.9s %9.9s %9.9s %14.14s %s\n",
+		"syncs", "errors", "seconds", "p50 usecs", "p99 usecs",
+		"max usecs", "bytes synced", "file");
+	fprintf(outf, "%9.9s %9.9s %11.11s %9.9s %9.9s %9.9s %14.14s %s\n",
+		dashes, dashes, dashes, dashes, dashes, dashes, dashes,
+		dashes);
+	for (i = 0; i < n && i < summary_sync; ++i) {
+		const struct sync_counts *const sc = sorted[i];
+
+		fprintf(outf, "%9" PRIu64 " %9" PRIu64 " %11.6f %9" PRIu64
+			" %9" PRIu64 " %9" PRIu64 " %14" PRIu64 " %s\n",
+			sc->calls, sc->errors, sc->time_ns / 1e9,
+			sync_percentile(sc, 500) / 1000,
+			sync_percentile(sc, 990) / 1000,
+			sc->max_ns / 1000, sc->bytes, sc->path);
+	}
+
+	free(sorted);
+
+#ifdef USE_LIBUNWIND
+	if (stack_trace_enabled)
+		sync_site_summary(outf);
+#endif
+}
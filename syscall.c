@@ -33,9 +33,17 @@
  */
 
 #include "defs.h"
+#include "bintrace.h"
+#include "iocapture.h"
+#include "filter_seccomp.h"
+#include "file_deps.h"
+#include "json.h"
 #include "native_defs.h"
 #include "nsig.h"
 #include "number_set.h"
+#include "selfprof.h"
+#include "spawn_profile.h"
+#include "trace_events.h"
 #include <sys/param.h>
 
 /* for struct iovec */
@@ -110,9 +118,29 @@ const char *const errnoent0[] = {
 const char *const signalent0[] = {
 #include "signalent.h"
 };
+
+/*
+ * The names of ioctls are stored in a structure of char arrays
+ * and ioctlent entries refer to them by offset, so the tables
+ * need no relocations in position independent executables.
+ * ioctlent[012].h files consist of IOCTLENT(name, code) lines.
+ */
+#define IOCTLENT(name, code)	char n_ ## name[sizeof(#name)];
+static const struct ioctl_strings0 {
+#include "ioctlent0.h"
+} ioctl_strings0 = {
+#undef IOCTLENT
+#define IOCTLENT(name, code)	#name,
+#include "ioctlent0.h"
+};
+#undef IOCTLENT
+#define IOCTLENT(name, code)	\
+	{ (code), offsetof(struct ioctl_strings0, n_ ## name) },
 const struct_ioctlent ioctlent0[] = {
 #include "ioctlent0.h"
 };
+#undef IOCTLENT
+const char *const ioctl_names0 = (const char *) &ioctl_strings0;
 
 #if SUPPORTED_PERSONALITIES > 1
 static const char *const errnoent1[] = {
@@ -121,9 +149,21 @@ static const char *const errnoent1[] = {
 static const char *const signalent1[] = {
 # include "signalent1.h"
 };
+# define IOCTLENT(name, code)	char n_ ## name[sizeof(#name)];
+static const struct ioctl_strings1 {
+# include "ioctlent1.h"
+} ioctl_strings1 = {
+# undef IOCTLENT
+# define IOCTLENT(name, code)	#name,
+# include "ioctlent1.h"
+};
+# undef IOCTLENT
+# define IOCTLENT(name, code)	\
+	{ (code), offsetof(struct ioctl_strings1, n_ ## name) },
 static const struct_ioctlent ioctlent1[] = {
 # include "ioctlent1.h"
 };
+# undef IOCTLENT
 # include PERSONALITY0_INCLUDE_PRINTERS_DECLS
 static const struct_printers printers0 = {
 # include PERSONALITY0_INCLUDE_PRINTERS_DEFS
@@ -141,9 +181,21 @@ static const char *const errnoent2[] = {
 static const char *const signalent2[] = {
 # include "signalent2.h"
 };
+# define IOCTLENT(name, code)	char n_ ## name[sizeof(#name)];
+static const struct ioctl_strings2 {
+# include "ioctlent2.h"
+} ioctl_strings2 = {
+# undef IOCTLENT
+# define IOCTLENT(name, code)	#name,
+# include "ioctlent2.h"
+};
+# undef IOCTLENT
+# define IOCTLENT(name, code)	\
+	{ (code), offsetof(struct ioctl_strings2, n_ ## name) },
 static const struct_ioctlent ioctlent2[] = {
 # include "ioctlent2.h"
 };
+# undef IOCTLENT
 # include PERSONALITY2_INCLUDE_PRINTERS_DECLS
 static const struct_printers printers2 = {
 # include PERSONALITY2_INCLUDE_PRINTERS_DEFS
@@ -191,17 +243,35 @@ enum {
 };
 
 #if SUPPORTED_PERSONALITIES > 1
-const struct_sysent *sysent = sysent0;
-const char *const *errnoent = errnoent0;
-const char *const *signalent = signalent0;
-const struct_ioctlent *ioctlent = ioctlent0;
-const struct_printers *printers = &printers0;
-#endif
+/* Fields are in the order of struct personality_tables.  */
+# define PERSONALITY_TABLES(n_)						\
+	{								\
+		sysent ## n_, errnoent ## n_, signalent ## n_,		\
+		ioctlent ## n_, (const char *) &ioctl_strings ## n_,	\
+		&printers ## n_,					\
+		nsyscalls ## n_, nerrnos ## n_, nsignals ## n_,		\
+		nioctlents ## n_,					\
+		PERSONALITY ## n_ ## _WORDSIZE,				\
+		PERSONALITY ## n_ ## _KLONGSIZE				\
+	}
+
+const struct personality_tables personality_tables[SUPPORTED_PERSONALITIES] = {
+	PERSONALITY_TABLES(0),
+	PERSONALITY_TABLES(1),
+# if SUPPORTED_PERSONALITIES > 2
+	PERSONALITY_TABLES(2),
+# endif
+};
 
+# undef PERSONALITY_TABLES
+
+const struct personality_tables *current_tables = &personality_tables[0];
+#else
 unsigned nsyscalls = nsyscalls0;
 unsigned nerrnos = nerrnos0;
 unsigned nsignals = nsignals0;
 unsigned nioctlents = nioctlents0;
+#endif
 
 const unsigned int nsyscall_vec[SUPPORTED_PERSONALITIES] = {
 	nsyscalls0,
@@ -226,76 +296,35 @@ const struct_sysent *const sysent_vec[SUPPORTED_PERSONALITIES] = {
 unsigned current_personality;
 
 # ifndef current_wordsize
-unsigned current_wordsize;
-static const int personality_wordsize[SUPPORTED_PERSONALITIES] = {
-	PERSONALITY0_WORDSIZE,
-	PERSONALITY1_WORDSIZE,
-# if SUPPORTED_PERSONALITIES > 2
-	PERSONALITY2_WORDSIZE,
-# endif
-};
+unsigned current_wordsize = PERSONALITY0_WORDSIZE;
 # endif
 
 # ifndef current_klongsize
-unsigned current_klongsize;
-static const int personality_klongsize[SUPPORTED_PERSONALITIES] = {
-	PERSONALITY0_KLONGSIZE,
-	PERSONALITY1_KLONGSIZE,
-#  if SUPPORTED_PERSONALITIES > 2
-	PERSONALITY2_KLONGSIZE,
-#  endif
-};
+unsigned current_klongsize = PERSONALITY0_KLONGSIZE;
 # endif
 
 void
 set_personality(int personality)
 {
-	nsyscalls = nsyscall_vec[personality];
-	sysent = sysent_vec[personality];
-
-	switch (personality) {
-	case 0:
-		errnoent = errnoent0;
-		nerrnos = nerrnos0;
-		ioctlent = ioctlent0;
-		nioctlents = nioctlents0;
-		signalent = signalent0;
-		nsignals = nsignals0;
-		printers = &printers0;
-		break;
-
-	case 1:
-		errnoent = errnoent1;
-		nerrnos = nerrnos1;
-		ioctlent = ioctlent1;
-		nioctlents = nioctlents1;
-		signalent = signalent1;
-		nsignals = nsignals1;
-		printers = &printers1;
-		break;
-
-# if SUPPORTED_PERSONALITIES > 2
-	case 2:
-		errnoent = errnoent2;
-		nerrnos = nerrnos2;
-		ioctlent = ioctlent2;
-		nioctlents = nioctlents2;
-		signalent = signalent2;
-		nsignals = nsignals2;
-		printers = &printers2;
-		break;
-# endif
-	}
-
+	current_tables = &personality_tables[personality];
 	current_personality = personality;
 # ifndef current_wordsize
-	current_wordsize = personality_wordsize[personality];
+	current_wordsize = current_tables->wordsize;
 # endif
 # ifndef current_klongsize
-	current_klongsize = personality_klongsize[personality];
+	current_klongsize = current_tables->klongsize;
 # endif
 }
 
+/*
+ * The personality is detected on every syscall entry rather than cached
+ * per process until execve: a process can make syscalls of another
+ * personality at any time, e.g. with int $0x80 in a 64-bit process or
+ * with __X32_SYSCALL_BIT, and the detection only looks at the registers
+ * or the PTRACE_GET_SYSCALL_INFO data fetched for the syscall number
+ * anyway.  The tables are switched only when the personality differs
+ * from the current one, which does not happen in 64-bit-only workloads.
+ */
 static void
 update_personality(struct tcb *tcp, unsigned int personality)
 {
@@ -323,6 +352,35 @@ update_personality(struct tcb *tcp, unsigned int personality)
 	}
 # endif
 }
+
+# define personality_is_decoded(tcp) true
+#elif ARCH_PERSONALITIES > 1
+/*
+ * A native-only build keeps track of the personality of the tracee
+ * only to print the syscalls of the other personalities undecoded,
+ * as there are no tables to decode them with.
+ */
+static void
+update_personality(struct tcb *tcp, unsigned int personality)
+{
+	if (personality == tcp->currpers)
+		return;
+	tcp->currpers = personality;
+
+	if (!qflag) {
+		if (personality)
+			error_msg("[ Process PID=%d runs in a mode"
+				  " not decoded by this native-only build. ]",
+				  tcp->pid);
+		else
+			error_msg("[ Process PID=%d runs in native mode. ]",
+				  tcp->pid);
+	}
+}
+
+# define personality_is_decoded(tcp) (!(tcp)->currpers)
+#else
+# define personality_is_decoded(tcp) true
 #endif
 
 #ifdef SYS_socket_subcall
@@ -429,6 +487,8 @@ dumpio(struct tcb *tcp)
 		return;
 
 	if (is_number_in_set(fd, read_set)) {
+		if (iocapture_enabled())
+			iocapture_begin(tcp, IOCAPTURE_READ);
 		switch (tcp->s_ent->sen) {
 		case SEN_read:
 		case SEN_pread:
@@ -452,6 +512,8 @@ dumpio(struct tcb *tcp)
 		}
 	}
 	if (is_number_in_set(fd, write_set)) {
+		if (iocapture_enabled())
+			iocapture_begin(tcp, IOCAPTURE_WRITE);
 		switch (tcp->s_ent->sen) {
 		case SEN_write:
 		case SEN_pwrite:
@@ -542,38 +604,130 @@ struct inject_opts *inject_vec[SUPPORTED_PERSONALITIES];
 static struct inject_opts *
 tcb_inject_opts(struct tcb *tcp)
 {
-	return (scno_in_range(tcp->scno) && tcp->inject_vec[current_personality])
-	       ? &tcp->inject_vec[current_personality][tcp->scno] : NULL;
+	return (scno_in_range(tcp->scno) && inject_vec[current_personality])
+	       ? &inject_vec[current_personality][tcp->scno] : NULL;
 }
 
+/* Return the tampering state of the tcb, allocating it on first use.  */
+struct tcb_inject *
+get_tcb_inject(struct tcb *tcp)
+{
+	if (!tcp->inj) {
+		tcp->inj = xcalloc(1, sizeof(*tcp->inj));
+		selfprof_cache_add(SELFPROF_CACHE_INJECT, 0,
+				   sizeof(*tcp->inj));
+	}
+	return tcp->inj;
+}
 
-static long
-tamper_with_syscall_entering(struct tcb *tcp, unsigned int *signo)
+/*
+ * Return the countdown of the injected syscall tcp->scno,
+ * creating it from the global options on the first invocation.
+ * Tracees only get counters for the injected syscalls they invoke,
+ * so the sorted array is expected to be short.
+ */
+static struct inject_counter *
+tcb_inject_counter(struct tcb *tcp, const struct inject_opts *opts)
 {
-	if (!tcp->inject_vec[current_personality]) {
-		tcp->inject_vec[current_personality] =
-			xcalloc(nsyscalls, sizeof(**inject_vec));
-		memcpy(tcp->inject_vec[current_personality],
-		       inject_vec[current_personality],
-		       nsyscalls * sizeof(**inject_vec));
+	struct tcb_inject *const inj = get_tcb_inject(tcp);
+	struct inject_counter **const vec = &inj->counters[current_personality];
+	unsigned int *const n = &inj->ncounters[current_personality];
+	unsigned int lo = 0, hi = *n;
+
+	while (lo < hi) {
+		const unsigned int mid = (lo + hi) / 2;
+
+		if ((*vec)[mid].scno < tcp->scno)
+			lo = mid + 1;
+		else if ((*vec)[mid].scno > tcp->scno)
+			hi = mid;
+		else
+			return &(*vec)[mid];
+	}
+
+	/* Grow the array whenever its size reaches a power of 2.  */
+	if (!(*n & (*n - 1)))
+		*vec = xreallocarray(*vec, *n ? *n * 2 : 1, sizeof(**vec));
+	memmove(&(*vec)[lo + 1], &(*vec)[lo], (*n - lo) * sizeof(**vec));
+	++*n;
+	selfprof_cache_add(SELFPROF_CACHE_INJECT, 1, sizeof(**vec));
+
+	(*vec)[lo].scno = tcp->scno;
+	(*vec)[lo].first = opts->first;
+
+	return &(*vec)[lo];
+}
+
+/* xorshift64*, seeded on first use, good enough to pick injections.  */
+static uint32_t
+inject_random(void)
+{
+	static uint64_t state;
+
+	if (!state) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		state = ((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec)
+			^ ((uint64_t) getpid() << 32) ^ 0x9e3779b97f4a7c15ULL;
 	}
 
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+
+	return (state * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+/* Allow at most opts->rate injections per second.  */
+static bool
+inject_rate_allows(struct inject_opts *opts)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return token_bucket_allows(opts->rate, &opts->rate_tat,
+				   (uint64_t) ts.tv_sec * 1000000000
+				   + ts.tv_nsec);
+}
+
+static long
+tamper_with_syscall_entering(struct tcb *tcp, unsigned int *signo)
+{
 	struct inject_opts *opts = tcb_inject_opts(tcp);
 
 	if (!opts || opts->first == 0)
 		return 0;
 
-	--opts->first;
+	if (opts->paths && !pathtrace_match_set(tcp, opts->paths))
+		return 0;
+
+	struct inject_counter *counter = tcb_inject_counter(tcp, opts);
+
+	if (counter->first == 0)
+		return 0;
+
+	--counter->first;
+
+	if (counter->first != 0)
+		return 0;
+
+	counter->first = opts->step;
 
-	if (opts->first != 0)
+	if (opts->prob && inject_random() % INJECT_PROB_SCALE >= opts->prob)
 		return 0;
 
-	opts->first = opts->step;
+	if (opts->rate && !inject_rate_allows(opts))
+		return 0;
 
 	if (opts->data.flags & INJECT_F_SIGNAL)
 		*signo = opts->data.signo;
 	if (opts->data.flags & INJECT_F_RETVAL && !arch_set_scno(tcp, -1))
 		tcp->flags |= TCB_TAMPERED;
+	if (opts->data.flags & INJECT_F_DELAY_ENTER)
+		delay_tcb(tcp, opts->data.delay_enter);
+	if (opts->data.flags & INJECT_F_DELAY_EXIT)
+		tcp->flags |= TCB_DELAY_EXIT;
 
 	return 0;
 }
@@ -611,6 +765,38 @@ tamper_with_syscall_exiting(struct tcb *tcp)
 	return 0;
 }
 
+/*
+ * Return false if syscall_entering_trace is going to filter out
+ * the syscall without looking at its arguments.
+ */
+static bool
+syscall_needs_args(const struct tcb *tcp)
+{
+	if (traced(tcp) && !trigger_skips(tcp))
+		return true;
+
+	switch (tcp->s_ent->sen) {
+#ifdef LINUX_MIPSO32
+	case SEN_syscall:
+#endif
+#ifdef SYS_socket_subcall
+	case SEN_socketcall:
+#endif
+#ifdef SYS_ipc_subcall
+	case SEN_ipc:
+#endif
+		/* The subcall is traced or not depending on the arguments.  */
+		return true;
+	case SEN_close:
+	case SEN_dup2:
+	case SEN_dup3:
+		/* See fd_cache_syscall_hook.  */
+		return fd_cache_in_use;
+	}
+
+	return false;
+}
+
 /*
  * Returns:
  * 0: "ignore this ptrace stop", bail out silently.
@@ -626,6 +812,20 @@ syscall_entering_decode(struct tcb *tcp)
 	if (res == 0)
 		return res;
 	int scno_good = res;
+
+	/*
+	 * The arguments of syscalls that are going to be filtered out
+	 * are not needed, so the registers are not fetched for them
+	 * if get_scno could do without.
+	 */
+	if (res == 1 && !syscall_needs_args(tcp))
+		return 1;
+	if (res == 1) {
+		get_regs(tcp->pid);
+		if (get_regs_error)
+			res = -1;
+	}
+
 	if (res != 1 || (res = get_syscall_args(tcp)) != 1) {
 		printleader(tcp);
 		tprintf("%s(", scno_good == 1 ? tcp->s_ent->sys_name : "????");
@@ -659,6 +859,109 @@ syscall_entering_decode(struct tcb *tcp)
 	return 1;
 }
 
+unsigned int sample_rate = 1;
+
+/* Return false if the traced syscall is skipped by --sample.  */
+static bool
+syscall_sampled(struct tcb *tcp)
+{
+	if (sample_rate == 1)
+		return true;
+
+	if (++tcp->sample_count < sample_rate)
+		return false;
+
+	tcp->sample_count = 0;
+	return true;
+}
+
+bool fold_repeats;
+
+static struct tcb_repeat *
+get_tcb_repeat(struct tcb *tcp)
+{
+	if (!tcp->rep)
+		tcp->rep = xcalloc(1, sizeof(*tcp->rep));
+	return tcp->rep;
+}
+
+static uint64_t
+hash_bytes(uint64_t h, const void *const data, const size_t len)
+{
+	const unsigned char *const p = data;
+	size_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < len; ++i)
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+/*
+ * Print the number of folded repetitions of the last syscall line
+ * of the tracee and the time they took.
+ */
+void
+print_repeats(struct tcb *tcp)
+{
+	struct tcb_repeat *const rep = tcp->rep;
+	const char *const name = rep->s_ent->sys_name;
+	const unsigned long count = rep->count;
+	struct timespec ts;
+
+	rep->count = 0;
+	ts_sub(&ts, &rep->end, &rep->start);
+
+	printleader(tcp);
+	tprintf("<... %s repeated %lu times over %lld.%03ld ms>\n",
+		name, count,
+		(long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000,
+		ts.tv_nsec / 1000 % 1000);
+	line_ended();
+}
+
+/*
+ * With --fold-repeats, the whole line of a syscall is deferred
+ * until syscall exiting.  Drop the line if it repeats the last line
+ * of the tracee, which requires the same syscall number, arguments
+ * and result, and the same text apart from the leader and -T time.
+ * Otherwise, print the line and remember it.
+ * Returns true if the line has been dropped.
+ */
+static bool
+fold_repeated_line(struct tcb *tcp, const struct timespec *ts)
+{
+	struct tcb_repeat *const rep = tcp->rep;
+	const size_t len = end_deferred_output(tcp);
+	const char *const buf = tcp->deferred_buf;
+	const uint64_t fnv_basis = 0xcbf29ce484222325ULL;
+	uint64_t key, hash;
+
+	key = hash_bytes(fnv_basis, &tcp->scno, sizeof(tcp->scno));
+	key = hash_bytes(key, tcp->u_arg,
+			 tcp->s_ent->nargs * sizeof(tcp->u_arg[0]));
+	key = hash_bytes(key, &tcp->u_rval, sizeof(tcp->u_rval));
+	key = hash_bytes(key, &tcp->u_error, sizeof(tcp->u_error));
+
+	hash = hash_bytes(fnv_basis, buf + rep->text_start,
+			  rep->time_start - rep->text_start);
+	hash = hash_bytes(hash, buf + rep->time_end, len - rep->time_end);
+
+	if (rep->s_ent == tcp->s_ent && rep->key == key && rep->hash == hash) {
+		++rep->count;
+		rep->end = *ts;
+		tcp->curcol = 0;
+		return true;
+	}
+
+	write_deferred_output(tcp, len);
+	rep->key = key;
+	rep->hash = hash;
+	rep->s_ent = tcp->s_ent;
+	rep->start = tcp->etime;
+	return false;
+}
+
 int
 syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 {
@@ -677,7 +980,15 @@ syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 			break;
 	}
 
-	if (!traced(tcp) || (tracing_paths && !pathtrace_match(tcp))) {
+	if (governor_report_pending && !hide_log(tcp))
+		governor_report(tcp);
+
+	if (!traced(tcp) || trigger_skips(tcp)
+	    || (governor_level == GOVERNOR_MINIMAL && !cflag)
+	    || (tracing_paths && !pathtrace_match(tcp))
+	    || (filter_expr_in_use && !filter_expr_entering(tcp))
+	    || !syscall_sampled(tcp)
+	    || (triggers_in_use && !trigger_entering(tcp))) {
 		tcp->flags |= TCB_FILTERED;
 		return 0;
 	}
@@ -691,32 +1002,128 @@ syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 	if (inject(tcp))
 		tamper_with_syscall_entering(tcp, sig);
 
+	/* See governor.c.  */
+	if (governor_level >= GOVERNOR_TERSE)
+		tcp->qual_flg = (tcp->qual_flg | QUAL_ABBREV) & ~QUAL_VERBOSE;
+
+	if (file_deps_enabled())
+		file_deps_syscall_entering(tcp);
+
 	if (cflag == CFLAG_ONLY_STATS) {
 		return 0;
 	}
 
+	if (bintrace_enabled()) {
+		bintrace_syscall_entering(tcp);
+		return 0;
+	}
+
+	/*
+	 * Syscalls over --rate-limit, and all syscalls while the overhead
+	 * governor only counts them, are neither decoded nor printed,
+	 * but they are still counted on syscall exiting.
+	 */
+	if (governor_level == GOVERNOR_MINIMAL
+	    || (rate_limits_in_use && !rate_limit_allows(tcp))) {
+		tcp->flags |= TCB_RATE_LIMITED;
+		return 0;
+	}
+
+	if (terse_rates_in_use)
+		terse_rate_account(tcp);
+
 #ifdef USE_LIBUNWIND
-	if (stack_trace_enabled) {
+	if (stack_trace_enabled && stack_traced(tcp)) {
 		if (tcp->s_ent->sys_flags & STACKTRACE_CAPTURE_ON_ENTER)
 			unwind_capture_stacktrace(tcp);
 	}
 #endif
 
-	printleader(tcp);
-	tprintf("%s(", tcp->s_ent->sys_name);
+	/*
+	 * If -z or --filter depends on the result, hold the output back
+	 * until syscall exiting, see syscall_exiting_trace.
+	 * With --fold-repeats, the whole line is held back.
+	 * With --json, the output is the "args" field of the syscall line.
+	 */
+	if ((tcp->flags & (TCB_FILTER_EXIT | TCB_TRIGGER_EXIT))
+	    || not_failing_only || json_output || fold_repeats)
+		defer_tcp_output(tcp);
+
+	if (json_output) {
+		json_syscall_entering(tcp);
+	} else {
+		printleader(tcp);
+		if (fold_repeats)
+			get_tcb_repeat(tcp)->text_start = tcp->curcol;
+		tprintf("%s(", tcp->s_ent->sys_name);
+	}
+	selfprof_enter_sys_func(tcp);
 	int res = raw(tcp) ? printargs(tcp) : tcp->s_ent->sys_func(tcp);
-	fflush(tcp->outf);
+	selfprof_leave_sys_func();
+	if (tcp->flags & TCB_DEFERRED_OUTPUT)
+		printing_tcp = NULL;
+	else
+		maybe_flush_tcp_output(tcp);
 	return res;
 }
 
+/*
+ * Return true if the syscall that has been filtered out on entering
+ * still has to be seen on exiting, see syscall_exiting_decode.
+ */
+static bool
+filtered_syscall_needs_exiting(const struct tcb *tcp)
+{
+	switch (tcp->s_ent->sen) {
+	case SEN_close:
+	case SEN_dup2:
+	case SEN_dup3:
+	case SEN_execve:
+	case SEN_execveat:
+	case SEN_execv:
+		/* See fd_cache_syscall_hook.  */
+		return fd_cache_in_use;
+	}
+
+#ifdef USE_LIBUNWIND
+	if (stack_trace_enabled
+	    && (tcp->s_ent->sys_flags & STACKTRACE_INVALIDATE_CACHE))
+		return true;
+#endif
+
+	return false;
+}
+
 void
 syscall_entering_finish(struct tcb *tcp, int res)
 {
+	/*
+	 * With seccomp filtering, the tracee is restarted with PTRACE_CONT
+	 * when it is not inside a syscall, so the exiting stop of a syscall
+	 * that has been filtered out is not requested unless it is needed.
+	 */
+	if (seccomp_filtering && res == 0 && filtered(tcp)
+	    && !filtered_syscall_needs_exiting(tcp)) {
+		tcp->sys_func_rval = 0;
+		free_tcb_priv_data(tcp);
+		tcb_scratch_reset(tcp);
+		return;
+	}
+
 	tcp->flags |= TCB_INSYSCALL;
 	tcp->sys_func_rval = res;
 	/* Measure the entrance time as late as possible to avoid errors. */
-	if ((Tflag || cflag) && !filtered(tcp))
-		gettimeofday(&tcp->etime, NULL);
+	if ((Tflag || cflag || filter_expr_timed || json_output
+	     || fold_repeats || trace_events_enabled()
+	     || spawn_profile_enabled()) && !filtered(tcp)) {
+		clock_gettime(CLOCK_MONOTONIC, &tcp->etime);
+		if (summary_handoff)
+			count_handoff_entry(tcp);
+		if (summary_oversleep)
+			count_oversleep_entry(tcp);
+		if (summary_sigdelivery)
+			count_sigdelivery_entry(tcp);
+	}
 }
 
 static bool
@@ -734,42 +1141,122 @@ syscall_tampered(struct tcb *tcp)
  *    value. Anyway, call syscall_exiting_finish(tcp) then.
  */
 int
-syscall_exiting_decode(struct tcb *tcp, struct timeval *ptv)
+syscall_exiting_decode(struct tcb *tcp, struct timespec *pts)
 {
 	/* Measure the exit time as early as possible to avoid errors. */
-	if ((Tflag || cflag) && !(filtered(tcp) || hide_log(tcp)))
-		gettimeofday(ptv, NULL);
+	if ((Tflag || cflag || filter_expr_timed || json_output
+	     || fold_repeats || trace_events_enabled()
+	     || spawn_profile_enabled())
+	    && !(filtered(tcp) || hide_log(tcp)))
+		clock_gettime(CLOCK_MONOTONIC, pts);
 
+	if (fd_cache_in_use)
+		fd_cache_syscall_hook(tcp);
+
+	if (filtered(tcp) || hide_log(tcp)) {
 #ifdef USE_LIBUNWIND
-	if (stack_trace_enabled) {
-		if (tcp->s_ent->sys_flags & STACKTRACE_INVALIDATE_CACHE)
+		if (stack_trace_enabled &&
+		    (tcp->s_ent->sys_flags & STACKTRACE_INVALIDATE_CACHE))
 			unwind_cache_invalidate(tcp);
-	}
 #endif
-
-	if (filtered(tcp) || hide_log(tcp))
 		return 0;
+	}
 
 	get_regs(tcp->pid);
 #if SUPPORTED_PERSONALITIES > 1
 	update_personality(tcp, tcp->currpers);
 #endif
-	return get_regs_error ? -1 : get_syscall_result(tcp);
+	int res = get_regs_error ? -1 : get_syscall_result(tcp);
+
+#ifdef USE_LIBUNWIND
+	if (stack_trace_enabled &&
+	    (tcp->s_ent->sys_flags & STACKTRACE_INVALIDATE_CACHE)) {
+		/*
+		 * The syscall result is needed to update the cache
+		 * incrementally, fall back to invalidation without it.
+		 */
+		if (res == 1)
+			unwind_cache_update(tcp);
+		else
+			unwind_cache_invalidate(tcp);
+	}
+#endif
+
+	return res;
 }
 
 int
-syscall_exiting_trace(struct tcb *tcp, struct timeval tv, int res)
+syscall_exiting_trace(struct tcb *tcp, struct timespec ts, int res)
 {
 	if (syserror(tcp) && syscall_tampered(tcp))
 		tamper_with_syscall_exiting(tcp);
 
+	if (tcp->flags & TCB_DELAY_EXIT) {
+		const struct inject_opts *opts = tcb_inject_opts(tcp);
+
+		if (opts)
+			delay_tcb(tcp, opts->data.delay_exit);
+	}
+
+	if (file_deps_enabled() && res == 1)
+		file_deps_syscall_exiting(tcp);
+
+	if ((tcp->flags & TCB_FILTER_EXIT) && res == 1
+	    && !filter_expr_exiting(tcp, &ts)) {
+		if (tcp->flags & TCB_DEFERRED_OUTPUT)
+			discard_deferred_output(tcp);
+		return 0;
+	}
+
+	if ((tcp->flags & TCB_TRIGGER_EXIT) && res == 1
+	    && !trigger_exiting(tcp)) {
+		if (tcp->flags & TCB_DEFERRED_OUTPUT)
+			discard_deferred_output(tcp);
+		return 0;
+	}
+
+	if (trace_events_enabled())
+		trace_events_syscall_exiting(tcp, &ts, res);
+
+	if (spawn_profile_enabled() && res == 1)
+		spawn_profile_syscall_exiting(tcp, &ts);
+
 	if (cflag) {
-		count_syscall(tcp, &tv);
+		count_syscall(tcp, &ts);
 		if (cflag == CFLAG_ONLY_STATS) {
 			return 0;
 		}
 	}
 
+	if (tcp->flags & TCB_RATE_LIMITED)
+		return 0;
+
+	if (bintrace_enabled()) {
+		bintrace_syscall_exiting(tcp);
+		/* The data is captured for --replay-data.  */
+		if (iocapture_enabled())
+			dumpio(tcp);
+		return 0;
+	}
+
+	/*
+	 * Failed syscalls are not shown with -z, the output of syscall
+	 * entering is discarded before decoding of syscall exiting.
+	 * With --fold-repeats, the line is completed in the deferred
+	 * output, see fold_repeated_line.
+	 */
+	struct tcb_repeat *rep = NULL;
+	if (tcp->flags & TCB_DEFERRED_OUTPUT) {
+		if (not_failing_only && res == 1 && syserror(tcp)) {
+			discard_deferred_output(tcp);
+			return 0;
+		}
+		if (fold_repeats && res == 1)
+			rep = tcp->rep;
+		else if (!json_output)
+			commit_deferred_output(tcp);
+	}
+
 	/* If not in -ff mode, and printing_tcp != tcp,
 	 * then the log currently does not end with output
 	 * of _our syscall entry_, but with something else.
@@ -779,14 +1266,21 @@ syscall_exiting_trace(struct tcb *tcp, struct timeval tv, int res)
 	 * "strace -ff -oLOG test/threaded_execve" corner case.
 	 * It's the only case when -ff mode needs reprinting.
 	 */
-	if ((followfork < 2 && printing_tcp != tcp) || (tcp->flags & TCB_REPRINT)) {
+	if (!json_output && !rep &&
+	    ((!tcb_output_separate() && printing_tcp != tcp) ||
+	     (tcp->flags & TCB_REPRINT))) {
 		tcp->flags &= ~TCB_REPRINT;
 		printleader(tcp);
 		tprintf("<... %s resumed> ", tcp->s_ent->sys_name);
 	}
-	printing_tcp = tcp;
+	if (!rep)
+		printing_tcp = tcp;
 
 	tcp->s_prev_ent = NULL;
+	if (res != 1 && json_output) {
+		json_syscall_unfinished(tcp, "unavailable");
+		return res;
+	}
 	if (res != 1) {
 		/* There was error in one of prior ptrace ops */
 		tprints(") ");
@@ -801,7 +1295,8 @@ syscall_exiting_trace(struct tcb *tcp, struct timeval tv, int res)
 	if (raw(tcp)) {
 		/* sys_res = printargs(tcp); - but it's nop on sysexit */
 	} else {
-	/* FIXME: not_failing_only (IOW, option -z) is broken:
+	/* FIXME: without open_memstream, the output of syscall
+	 * entering cannot be deferred and option -z is broken:
 	 * failure of syscall is known only after syscall return.
 	 * Thus we end up with something like this on, say, ENOENT:
 	 *     open("does_not_exist", O_RDONLY <unfinished ...>
@@ -813,8 +1308,18 @@ syscall_exiting_trace(struct tcb *tcp, struct timeval tv, int res)
 			return 0;	/* ignore failed syscalls */
 		if (tcp->sys_func_rval & RVAL_DECODED)
 			sys_res = tcp->sys_func_rval;
-		else
+		else {
+			selfprof_enter_sys_func(tcp);
 			sys_res = tcp->s_ent->sys_func(tcp);
+			selfprof_leave_sys_func();
+		}
+	}
+
+	if (json_output) {
+		json_syscall_exiting(tcp, sys_res, &ts);
+		if (ring_triggered(tcp))
+			ring_dump();
+		return 0;
 	}
 
 	tprints(") ");
@@ -908,12 +1413,13 @@ syscall_exiting_trace(struct tcb *tcp, struct timeval tv, int res)
 			case RVAL_HEX:
 #if ANY_WORDSIZE_LESS_THAN_KERNEL_LONG
 				if (current_wordsize < sizeof(tcp->u_rval)) {
-					tprintf("= %#x",
-						(unsigned int) tcp->u_rval);
+					tprints("= ");
+					tprint_hex((unsigned int) tcp->u_rval);
 				} else
 #endif
 				{
-					tprintf("= %#" PRI_klx, tcp->u_rval);
+					tprints("= ");
+					tprint_hex((kernel_ulong_t) tcp->u_rval);
 				}
 				break;
 			case RVAL_OCTAL:
@@ -923,23 +1429,25 @@ syscall_exiting_trace(struct tcb *tcp, struct timeval tv, int res)
 			case RVAL_UDECIMAL:
 #if ANY_WORDSIZE_LESS_THAN_KERNEL_LONG
 				if (current_wordsize < sizeof(tcp->u_rval)) {
-					tprintf("= %u",
-						(unsigned int) tcp->u_rval);
+					tprints("= ");
+					tprint_uint((unsigned int) tcp->u_rval);
 				} else
 #endif
 				{
-					tprintf("= %" PRI_klu, tcp->u_rval);
+					tprints("= ");
+					tprint_uint((kernel_ulong_t) tcp->u_rval);
 				}
 				break;
 			case RVAL_DECIMAL:
-				tprintf("= %" PRI_kld, tcp->u_rval);
+				tprints("= ");
+				tprint_int(tcp->u_rval);
 				break;
 			case RVAL_FD:
-				if (show_fd_path) {
-					tprints("= ");
+				tprints("= ");
+				if (show_fd_path)
 					printfd(tcp, tcp->u_rval);
-				} else
-					tprintf("= %" PRI_kld, tcp->u_rval);
+				else
+					tprint_int(tcp->u_rval);
 				break;
 			default:
 				error_msg("invalid rval format");
@@ -951,28 +1459,42 @@ syscall_exiting_trace(struct tcb *tcp, struct timeval tv, int res)
 		if (syscall_tampered(tcp))
 			tprints(" (INJECTED)");
 	}
+	const struct timespec exit_ts = ts;
+	if (rep)
+		rep->time_start = tcp->curcol;
 	if (Tflag) {
-		tv_sub(&tv, &tv, &tcp->etime);
-		tprintf(" <%ld.%06ld>",
-			(long) tv.tv_sec, (long) tv.tv_usec);
+		ts_sub(&ts, &ts, &tcp->etime);
+		tprintf(" <%ld.%0*ld>", (long) ts.tv_sec,
+			time_precision, ts_frac(&ts));
 	}
+	if (rep)
+		rep->time_end = tcp->curcol;
 	tprints("\n");
 	dumpio(tcp);
-	line_ended();
+
+	if (!rep || !fold_repeated_line(tcp, &exit_ts)) {
+		line_ended();
 
 #ifdef USE_LIBUNWIND
-	if (stack_trace_enabled)
-		unwind_print_stacktrace(tcp);
+		if (stack_trace_enabled && stack_traced(tcp))
+			unwind_print_stacktrace(tcp);
 #endif
+	}
+
+	if (ring_triggered(tcp))
+		ring_dump();
 	return 0;
 }
 
 void
 syscall_exiting_finish(struct tcb *tcp)
 {
-	tcp->flags &= ~(TCB_INSYSCALL | TCB_TAMPERED);
+	tcp->flags &= ~(TCB_INSYSCALL | TCB_TAMPERED | TCB_DELAY_EXIT
+			| TCB_FILTER_EXIT | TCB_TRIGGER_EXIT
+			| TCB_RATE_LIMITED);
 	tcp->sys_func_rval = 0;
 	free_tcb_priv_data(tcp);
+	tcb_scratch_reset(tcp);
 }
 
 bool
@@ -1109,7 +1631,7 @@ ptrace_setregs(pid_t pid)
 #endif /* ARCH_REGS_FOR_GETREGSET || ARCH_REGS_FOR_GETREGS */
 
 static void
-get_regs(pid_t pid)
+fetch_regs(pid_t pid)
 {
 #undef USE_GET_SYSCALL_RESULT_REGS
 #ifdef ptrace_getregset_or_getregs
@@ -1151,10 +1673,23 @@ get_regs(pid_t pid)
 #endif /* !ptrace_getregset_or_getregs */
 }
 
+static void
+get_regs(pid_t pid)
+{
+	if (get_regs_error != -1)
+		return;
+
+	selfprof_enter(SELFPROF_GET_REGS);
+	selfprof_count(SELFPROF_PTRACE);
+	fetch_regs(pid);
+	selfprof_leave(SELFPROF_GET_REGS);
+}
+
 #ifdef ptrace_setregset_or_setregs
 static int
 set_regs(pid_t pid)
 {
+	selfprof_count(SELFPROF_PTRACE);
 	return ptrace_setregset_or_setregs(pid);
 }
 #endif /* ptrace_setregset_or_setregs */
@@ -1173,6 +1708,94 @@ free_sysent_buf(void *ptr)
 	free(ptr);
 }
 
+#if defined X86_64 || defined X32 || defined I386
+# include <linux/audit.h>
+
+# ifndef __X32_SYSCALL_BIT
+#  define __X32_SYSCALL_BIT	0x40000000
+# endif
+
+/* Set when the kernel does not support PTRACE_GET_SYSCALL_INFO.  */
+static bool syscall_info_unsupported;
+
+/*
+ * Fetch the syscall number and personality with PTRACE_GET_SYSCALL_INFO
+ * on syscall entering, which, unlike fetching all the registers,
+ * is cheap enough to do for every syscall stop.  The registers are then
+ * fetched by get_regs only if the syscall has to be decoded.
+ *
+ * Returns 1 on success, 0 if the regular arch_get_scno has to be used.
+ */
+static int
+get_scno_from_syscall_info(struct tcb *tcp)
+{
+	struct_ptrace_syscall_info info;
+	unsigned int currpers;
+
+	if (syscall_info_unsupported)
+		return 0;
+
+	selfprof_count(SELFPROF_PTRACE);
+	if (ptrace(PTRACE_GET_SYSCALL_INFO, tcp->pid,
+		   (void *) sizeof(info), &info) < 0) {
+		if (errno == EIO || errno == EINVAL)
+			syscall_info_unsupported = true;
+		return 0;
+	}
+
+	if (info.op != PTRACE_SYSCALL_INFO_ENTRY
+	    && info.op != PTRACE_SYSCALL_INFO_SECCOMP)
+		return 0;
+
+	kernel_ulong_t scno = info.u.entry.nr;
+
+	switch (info.arch) {
+# if defined X86_64 || defined X32
+	case AUDIT_ARCH_X86_64:
+		if (scno & __X32_SYSCALL_BIT) {
+			/* See the -1 special case in arch_get_scno.  */
+			if ((long long) scno == -1)
+				return 0;
+			scno -= __X32_SYSCALL_BIT;
+#  ifdef X32
+			currpers = 0;
+#  else
+			currpers = 2;
+#  endif
+		} else {
+#  ifdef X32
+			/* Let arch_get_scno report the unsupported mode.  */
+			return 0;
+#  else
+			currpers = 0;
+#  endif
+		}
+		break;
+	case AUDIT_ARCH_I386:
+		scno = (uint32_t) scno;
+		currpers = 1;
+		break;
+# else /* I386 */
+	case AUDIT_ARCH_I386:
+		currpers = 0;
+		break;
+# endif
+	default:
+		return 0;
+	}
+
+	update_personality(tcp, currpers);
+	tcp->scno = scno;
+	return 1;
+}
+#else
+static int
+get_scno_from_syscall_info(struct tcb *tcp)
+{
+	return 0;
+}
+#endif
+
 /*
  * Returns:
  * 0: "ignore this ptrace stop", syscall_entering_decode() should return a "bail
@@ -1184,16 +1807,18 @@ free_sysent_buf(void *ptr)
 int
 get_scno(struct tcb *tcp)
 {
-	get_regs(tcp->pid);
+	if (get_scno_from_syscall_info(tcp) != 1) {
+		get_regs(tcp->pid);
 
-	if (get_regs_error)
-		return -1;
+		if (get_regs_error)
+			return -1;
 
-	int rc = arch_get_scno(tcp);
-	if (rc != 1)
-		return rc;
+		int rc = arch_get_scno(tcp);
+		if (rc != 1)
+			return rc;
+	}
 
-	if (scno_is_valid(tcp->scno)) {
+	if (scno_is_valid(tcp->scno) && personality_is_decoded(tcp)) {
 		tcp->s_ent = &sysent[tcp->scno];
 		tcp->qual_flg = qual_flags(tcp->scno);
 	} else {
@@ -1214,10 +1839,51 @@ get_scno(struct tcb *tcp)
 		if (debug_flag)
 			error_msg("pid %d invalid syscall %" PRI_kld,
 				  tcp->pid, tcp->scno);
+#if ARCH_PERSONALITIES > SUPPORTED_PERSONALITIES
+		/*
+		 * Keep the syscall of another personality out of
+		 * the statistics and the injection tables.
+		 */
+		if (!personality_is_decoded(tcp))
+			tcp->scno = (kernel_ulong_t) -1;
+#endif
 	}
 	return 1;
 }
 
+/*
+ * Returns the number of pause(2) of the native personality, in which
+ * a process handed off by --shards waits to be adopted, or -1 where
+ * the syscall restarted after an interruption of pause(2) is not known
+ * to be the one set by the tracer.
+ */
+kernel_ulong_t
+pause_scno(void)
+{
+#if defined X86_64 || defined I386
+	unsigned int i;
+
+	for (i = 0; i < nsyscall_vec[0]; ++i) {
+		if (sysent_vec[0][i].sen == SEN_pause)
+			return shuffle_scno(i);
+	}
+#endif
+	return (kernel_ulong_t) -1;
+}
+
+/*
+ * Makes the tracee execute SCNO instead of the syscall it has entered,
+ * or instead of the one it restarts after the current stop.
+ * Returns 0 on success.
+ */
+int
+syscall_set_scno(struct tcb *tcp, const kernel_ulong_t scno)
+{
+	get_regs(tcp->pid);
+
+	return get_regs_error ? -1 : arch_set_scno(tcp, scno);
+}
+
 #ifdef USE_GET_SYSCALL_RESULT_REGS
 static int get_syscall_result_regs(struct tcb *);
 #endif
@@ -157,8 +157,8 @@ SYS_FUNC(sysctl)
 		}
 out:
 		max_cnt = info.nlen;
-		if (abbrev(tcp) && max_cnt > max_strlen)
-			max_cnt = max_strlen;
+		if (abbrev(tcp) && max_cnt > tcb_max_strlen(tcp))
+			max_cnt = tcb_max_strlen(tcp);
 		while (cnt < max_cnt)
 			tprintf(", %x", name[cnt++]);
 		if (cnt < (unsigned) info.nlen)
@@ -1,9 +1,15 @@
 #ifndef STRACE_SYSENT_H
 #define STRACE_SYSENT_H
 
+/*
+ * nargs, sys_flags, sen, and sys_func are used on every syscall stop,
+ * sys_name is used only for printing.  nargs and sys_flags share a word,
+ * so the former are packed into the first 16 bytes of a 24-byte entry
+ * on 64-bit hosts instead of being spread over 32 bytes.
+ */
 typedef struct sysent {
-	unsigned nargs;
-	int	sys_flags;
+	unsigned nargs:8;
+	unsigned sys_flags:24;	/* see the flags below */
 	int	sen;
 	int	(*sys_func)();
 	const char *sys_name;
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Adaptive decoding depth (--terse-rate option).
+ *
+ * The calls of each syscall are counted in windows of a second.  Once
+ * a syscall is called more than N times in a window, its structures are
+ * abbreviated and not decoded verbosely, as by the overhead governor
+ * and "-e abbrev=all -e verbose=none", so hot syscalls stay cheap to
+ * decode while rare ones keep their full detail.  Full decoding is
+ * restored after a cooling period of a second without windows over
+ * the rate.  The state is checked when the syscall is called, so each
+ * transition is reported before the line of the syscall it applies to,
+ * like "<... terse decoding of read above 1000 calls/s>".
+ */
+
+#include "defs.h"
+
+#include <time.h>
+#include "filter.h"
+#include "number_set.h"
+
+#define TERSE_WINDOW_NS		1000000000ULL
+#define TERSE_COOLDOWN_NS	1000000000ULL
+
+struct terse_state {
+	unsigned int rate;	/* Calls per second, 0 means no threshold */
+	unsigned int calls;	/* Calls in the current window */
+	uint64_t window_start;	/* ns */
+	uint64_t terse_until;	/* ns, 0 unless decoding is terse */
+};
+
+bool terse_rates_in_use;
+
+/* The state of each syscall, by personality */
+static struct terse_state *terse_states[SUPPORTED_PERSONALITIES];
+
+/*
+ * Parse the --terse-rate argument, "N" calls per second of each syscall
+ * or "SET:N" calls per second of each syscall of SET,
+ * return false if it is invalid.
+ */
+bool
+parse_terse_rate(const char *const arg)
+{
+	const char *const colon = strrchr(arg, ':');
+	const int rate = string_to_uint_upto(colon ? colon + 1 : arg,
+					     1000000000);
+	struct number_set *set = NULL;
+	unsigned int p, i;
+
+	if (rate <= 0)
+		return false;
+
+	if (colon) {
+		char *const set_str = xstrndup(arg, colon - arg);
+
+		set = alloc_number_set_array(SUPPORTED_PERSONALITIES);
+		qualify_syscall_tokens(set_str, set, "system call");
+		free(set_str);
+	}
+
+	terse_rates_in_use = true;
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		if (!terse_states[p])
+			terse_states[p] = xcalloc(nsyscall_vec[p],
+						  sizeof(*terse_states[p]));
+		for (i = 0; i < nsyscall_vec[p]; ++i) {
+			if (!set || is_number_in_set_array(i, set, p))
+				terse_states[p][i].rate = rate;
+		}
+	}
+
+	if (set)
+		free_number_set_array(set, SUPPORTED_PERSONALITIES);
+	return true;
+}
+
+/*
+ * Account a call of the syscall of TCP, which is about to be decoded,
+ * and make its decoding terse while the syscall is hot.
+ */
+void
+terse_rate_account(struct tcb *const tcp)
+{
+	const unsigned int p = current_personality;
+
+	if (tcp->scno >= nsyscall_vec[p])
+		return;
+
+	struct terse_state *const s = &terse_states[p][tcp->scno];
+	struct timespec ts;
+	uint64_t now;
+
+	if (!s->rate)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+	if (now - s->window_start >= TERSE_WINDOW_NS) {
+		s->window_start = now;
+		s->calls = 0;
+	}
+
+	if (++s->calls > s->rate) {
+		if (!s->terse_until) {
+			printleader(tcp);
+			tprintf("<... terse decoding of %s above %u calls/s>\n",
+				tcp->s_ent->sys_name, s->rate);
+			line_ended();
+		}
+		s->terse_until = now + TERSE_COOLDOWN_NS;
+	} else if (s->terse_until && now >= s->terse_until) {
+		s->terse_until = 0;
+		printleader(tcp);
+		tprintf("<... full decoding of %s>\n", tcp->s_ent->sys_name);
+		line_ended();
+	}
+
+	if (s->terse_until)
+		tcp->qual_flg = (tcp->qual_flg | QUAL_ABBREV) & ~QUAL_VERBOSE;
+}
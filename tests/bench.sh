@@ -0,0 +1,127 @@
+#!/bin/sh -efu
+#
+# Run tracer overhead microbenchmarks of tests/microbench.c, see "make bench".
+#
+# Copyright (c) 2017 The strace developers.
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+# 3. The name of the author may not be used to endorse or promote products
+#    derived from this software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+# IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+# OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+# IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+# INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+# NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+# THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+# THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+# Environment:
+#   STRACE       strace binary to benchmark, ../strace by default;
+#   BENCH        space separated list of benchmarks to run, all by default;
+#   BENCH_MODES  semicolon separated list of strace options to benchmark;
+#   BENCH_SCALE  multiplier of the default number of iterations;
+#   BENCH_RUNS   number of runs of each case, the fastest one is reported.
+#
+# For each benchmark and strace mode, the following is reported:
+# the elapsed time, the number of syscalls made by the benchmark,
+# the tracing overhead per syscall, and the number of ptrace stops
+# per second assuming that every syscall stops twice, which does not hold
+# for benchmarks with several processes or threads in modes without -f.
+
+me="${0##*/}"
+bench=./microbench
+STRACE="${STRACE:-../strace}"
+BENCH="${BENCH:-$("$bench" list)}"
+BENCH_MODES="${BENCH_MODES:--c;-etrace=chdir;-f;-k;-yy}"
+BENCH_SCALE="${BENCH_SCALE:-1}"
+BENCH_RUNS="${BENCH_RUNS:-3}"
+
+tmp="$(mktemp -d -t bench.XXXXXX)"
+trap 'rm -rf -- "$tmp"' EXIT
+
+iterations()
+{
+	local n
+	case "$1" in
+		getpid|read-small|write-small) n=200000 ;;
+		read-large|write-large) n=50000 ;;
+		futex) n=20000 ;;
+		threads) n=10000 ;;
+		fork|clone) n=2000 ;;
+		execve) n=200 ;;
+		*) n=10000 ;;
+	esac
+	echo $((n * BENCH_SCALE))
+}
+
+now_ns()
+{
+	date +%s%N
+}
+
+# Print the fastest elapsed time of BENCH_RUNS runs of the command in ns.
+measure()
+{
+	local i start t best=
+	i=0
+	while [ "$i" -lt "$BENCH_RUNS" ]; do
+		start="$(now_ns)"
+		"$@" > /dev/null 2>&1 ||
+			{ echo >&2 "$me: $* failed"; return 1; }
+		t=$(($(now_ns) - start))
+		[ -n "$best" ] && [ "$best" -le "$t" ] || best=$t
+		i=$((i + 1))
+	done
+	echo "$best"
+}
+
+# Print the number of syscalls the command makes.
+count_syscalls()
+{
+	"$STRACE" -f -qq -c -o "$tmp/count" "$@" > /dev/null 2>&1 ||
+		{ echo >&2 "$me: counting syscalls of $* failed"; return 1; }
+	sed -n 's/^ *[^ ]\+ \+[^ ]\+ \+\([0-9]\+\) .*total$/\1/p' "$tmp/count"
+}
+
+report()
+{
+	printf '%-12s %-16s %10s %10s %12s %12s\n' "$@"
+}
+
+report benchmark mode 'time, ms' syscalls 'ns/syscall' 'stops/s'
+
+for b in $BENCH; do
+	n="$(iterations "$b")"
+	calls="$(count_syscalls "$bench" "$b" "$n")"
+	[ "${calls:-0}" -gt 0 ] || calls=1
+	base="$(measure "$bench" "$b" "$n")"
+	report "$b" untraced $((base / 1000000)) "$calls" - -
+
+	IFS=';'
+	set -- $BENCH_MODES
+	unset IFS
+	for mode; do
+		set -- $mode
+		if ! "$STRACE" "$@" -o /dev/null true > /dev/null 2>&1; then
+			report "$b" "$mode" - - - unsupported
+			continue
+		fi
+		t="$(measure "$STRACE" "$@" -o /dev/null "$bench" "$b" "$n")"
+		[ "$t" -gt 0 ] || t=1
+		report "$b" "$mode" $((t / 1000000)) "$calls" \
+			$(((t - base) / calls)) \
+			$((2 * calls * 1000000000 / t))
+	done
+done
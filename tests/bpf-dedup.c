@@ -0,0 +1,85 @@
+/*
+ * Check --bpf-dedup option.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+
+static void
+attach(const int fd, const struct sock_fprog *const prog, const char *text)
+{
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, prog, sizeof(*prog)))
+		perror_msg_and_skip("setsockopt SOL_SOCKET SO_ATTACH_FILTER");
+	printf("setsockopt(%d, SOL_SOCKET, SO_ATTACH_FILTER, {len=%u"
+	       ", filter=%s}, %u) = 0\n", fd, prog->len, text,
+	       (unsigned int) sizeof(*prog));
+}
+
+int
+main(void)
+{
+	static const struct sock_filter accept_c[] = {
+		BPF_STMT(BPF_RET|BPF_K, -1U)
+	};
+	static const struct sock_filter drop_c[] = {
+		BPF_STMT(BPF_RET|BPF_K, 0)
+	};
+	struct sock_filter *const accept_f =
+		tail_memdup(accept_c, sizeof(accept_c));
+	struct sock_filter *const drop_f = tail_memdup(drop_c, sizeof(drop_c));
+	TAIL_ALLOC_OBJECT_CONST_PTR(struct sock_fprog, prog);
+	char text[128];
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds))
+		perror_msg_and_skip("socketpair");
+
+	prog->len = ARRAY_SIZE(accept_c);
+	prog->filter = accept_f;
+	attach(fds[0], prog,
+	       "[BPF_STMT(BPF_RET|BPF_K, 0xffffffff)] /* bpf program 1 */");
+	snprintf(text, sizeof(text), "%p /* bpf program 1 */", accept_f);
+	attach(fds[0], prog, text);
+	attach(fds[1], prog, text);
+
+	prog->len = ARRAY_SIZE(drop_c);
+	prog->filter = drop_f;
+	attach(fds[1], prog,
+	       "[BPF_STMT(BPF_RET|BPF_K, 0)] /* bpf program 2 */");
+
+	prog->len = ARRAY_SIZE(accept_c);
+	prog->filter = accept_f;
+	attach(fds[0], prog, text);
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
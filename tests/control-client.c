@@ -0,0 +1,103 @@
+/*
+ * Send commands to the --control socket of strace.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+#include <asm/unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static int
+connect_control(const char *const path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	unsigned int i;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		error_msg_and_fail("%s: socket path is too long", path);
+	strcpy(addr.sun_path, path);
+
+	/* strace may not have created the socket yet.  */
+	for (i = 0; ; ++i) {
+		const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+		if (fd < 0)
+			perror_msg_and_fail("socket");
+		if (!connect(fd, (void *) &addr, sizeof(addr)))
+			return fd;
+		if ((errno != ENOENT && errno != ECONNREFUSED) || i >= 1000)
+			perror_msg_and_fail("connect: %s", path);
+		close(fd);
+		usleep(10000);
+	}
+}
+
+/*
+ * Usage: control-client SOCKET COMMAND...
+ * Send each COMMAND to the --control socket SOCKET, print the answers,
+ * and make a getpid syscall, which shows whether the commands have
+ * changed the traced set of this process.
+ */
+int
+main(int argc, char **argv)
+{
+	char buf[4096];
+	int i;
+
+	if (argc < 2)
+		error_msg_and_fail("usage: control-client SOCKET COMMAND...");
+
+	const int fd = connect_control(argv[1]);
+	FILE *const fp = fdopen(fd, "r");
+
+	if (!fp)
+		perror_msg_and_fail("fdopen");
+
+	for (i = 2; i < argc; ++i) {
+		const size_t len = strlen(argv[i]);
+
+		if (write(fd, argv[i], len) != (ssize_t) len
+		    || write(fd, "\n", 1) != 1)
+			perror_msg_and_fail("write");
+
+		do {
+			if (!fgets(buf, sizeof(buf), fp))
+				error_msg_and_fail("%s: no answer to '%s'",
+						   argv[1], argv[i]);
+			fputs(buf, stdout);
+		} while (strcmp(buf, "ok\n") && strcmp(buf, "error\n"));
+	}
+
+	fclose(fp);
+	syscall(__NR_getpid);
+	return 0;
+}
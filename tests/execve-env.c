@@ -0,0 +1,78 @@
+/*
+ * Check --execve-env=hash option.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FILENAME "test.execve\nfilename"
+#define Q_FILENAME "test.execve\\nfilename"
+
+static const char * const argv[] = {
+	FILENAME, NULL
+};
+
+static const char * const envp[] = {
+	"foobar=1", "foo\nbar=2", NULL
+};
+
+int
+main(void)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	unsigned int size = 0, i, j;
+
+	for (i = 0; envp[i]; ++i) {
+		const unsigned int len = strlen(envp[i]) + 1;
+
+		for (j = 0; j < len; ++j) {
+			hash ^= (unsigned char) envp[i][j];
+			hash *= 0x100000001b3ULL;
+		}
+		size += len;
+	}
+
+	char ** const tail_argv = tail_memdup(argv, sizeof(argv));
+	char ** const tail_envp = tail_memdup(envp, sizeof(envp));
+
+	execve(FILENAME, tail_argv, tail_envp);
+	printf("execve(\"%s\", [\"%s\"], %p /* 2 vars, %u bytes"
+	       ", hash 0x%016llx */) = -1 ENOENT (%m)\n",
+	       Q_FILENAME, Q_FILENAME, tail_envp, size,
+	       (unsigned long long) hash);
+
+	tail_envp[1] = (char *) -1L;
+	execve(FILENAME, tail_argv, tail_envp);
+	printf("execve(\"%s\", [\"%s\"], %p /* 2 vars, unreadable */)"
+	       " = -1 ENOENT (%m)\n", Q_FILENAME, Q_FILENAME, tail_envp);
+
+	return 0;
+}
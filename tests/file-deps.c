@@ -0,0 +1,83 @@
+/*
+ * Check --file-deps option.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+int
+main(void)
+{
+	static const char dir[] = "file-deps.tmp";
+	char cwd[PATH_MAX];
+	struct stat st;
+	int dfd, fd;
+
+	if (!getcwd(cwd, sizeof(cwd)))
+		perror_msg_and_fail("getcwd");
+	if (mkdir(dir, 0700))
+		perror_msg_and_skip("mkdir");
+	dfd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (dfd < 0)
+		perror_msg_and_fail("open");
+
+	fd = openat(dfd, "out", O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		perror_msg_and_fail("openat");
+	close(fd);
+	fd = openat(dfd, "./out", O_RDONLY);
+	if (fd < 0)
+		perror_msg_and_fail("openat");
+	close(fd);
+	if (stat("file-deps.tmp/out", &st))
+		perror_msg_and_fail("stat");
+	if (stat("file-deps.tmp/missing", &st) == 0)
+		error_msg_and_fail("stat");
+
+	if (renameat(dfd, "out", AT_FDCWD, "file-deps.tmp/in"))
+		perror_msg_and_fail("renameat");
+	fd = open("file-deps.tmp/in", O_RDONLY);
+	if (fd < 0)
+		perror_msg_and_fail("open");
+	close(fd);
+	if (unlinkat(dfd, "in", 0))
+		perror_msg_and_fail("unlinkat");
+	close(dfd);
+	if (rmdir(dir))
+		perror_msg_and_fail("rmdir");
+
+	printf("%d rw %s/%s\n", getpid(), cwd, dir);
+	printf("%d rws %s/%s/out\n", getpid(), cwd, dir);
+	printf("%d rw %s/%s/in\n", getpid(), cwd, dir);
+	printf("%d exit 0\n", getpid());
+	return 0;
+}
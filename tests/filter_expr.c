@@ -0,0 +1,72 @@
+/*
+ * Check --filter option.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+#include <asm/unistd.h>
+
+#if defined __NR_chdir && defined __NR_close
+
+# include <stdio.h>
+# include <unistd.h>
+
+int
+main(void)
+{
+	static const char missing[] = "filter_expr.missing";
+	long rc;
+
+	/* Rejected on exiting: succeeds.  */
+	if (syscall(__NR_chdir, "."))
+		perror_msg_and_fail("chdir");
+
+	rc = syscall(__NR_chdir, missing);
+	printf("chdir(\"%s\") = %s\n", missing, sprintrc(rc));
+
+	/* Rejected on exiting: fails with EBADF.  */
+	syscall(__NR_close, 43);
+
+	/* Accepted on entering.  */
+	rc = syscall(__NR_close, 41);
+	printf("close(41) = %s\n", sprintrc(rc));
+
+	rc = syscall(__NR_close, 0x141);
+	printf("close(%d) = %s\n", 0x141, sprintrc(rc));
+
+	/* Rejected on entering.  */
+	syscall(__NR_close, 0x143);
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("__NR_chdir && __NR_close")
+
+#endif
@@ -0,0 +1,262 @@
+/*
+ * Microbenchmarks of the tracing overhead, run by "make bench".
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "tests.h"
+#include <asm/unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static unsigned int iterations;
+
+static void
+do_getpid(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; ++i)
+		syscall(__NR_getpid);
+}
+
+static void
+do_rw(const char *const path, const int flags, const size_t size)
+{
+	char *const buf = tail_alloc(size);
+	const int fd = open(path, flags);
+	unsigned int i;
+
+	if (fd < 0)
+		perror_msg_and_fail("open: %s", path);
+	memset(buf, 0, size);
+
+	for (i = 0; i < iterations; ++i) {
+		if ((flags == O_RDONLY ? read(fd, buf, size)
+				       : write(fd, buf, size)) != (ssize_t) size)
+			perror_msg_and_fail("%s: %s",
+					    flags == O_RDONLY ? "read" : "write",
+					    path);
+	}
+
+	close(fd);
+}
+
+static void
+do_read_small(void)
+{
+	do_rw("/dev/zero", O_RDONLY, 1);
+}
+
+static void
+do_read_large(void)
+{
+	do_rw("/dev/zero", O_RDONLY, 65536);
+}
+
+static void
+do_write_small(void)
+{
+	do_rw("/dev/null", O_WRONLY, 1);
+}
+
+static void
+do_write_large(void)
+{
+	do_rw("/dev/null", O_WRONLY, 65536);
+}
+
+static const char *self;
+
+static void
+do_execve(void)
+{
+	if (!iterations)
+		return;
+
+	char count[sizeof(int) * 3];
+	sprintf(count, "%u", iterations - 1);
+
+	char *const argv[] = { (char *) self, (char *) "execve", count, NULL };
+	execv(self, argv);
+	perror_msg_and_fail("execv: %s", self);
+}
+
+static void
+do_fork(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; ++i) {
+		int status;
+		const pid_t pid = fork();
+
+		if (pid < 0)
+			perror_msg_and_fail("fork");
+		if (!pid)
+			_exit(0);
+		if (waitpid(pid, &status, 0) != pid || status)
+			perror_msg_and_fail("waitpid");
+	}
+}
+
+static void *
+thread_noop(void *arg)
+{
+	return arg;
+}
+
+static void
+do_clone(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; ++i) {
+		pthread_t t;
+
+		errno = pthread_create(&t, NULL, thread_noop, NULL);
+		if (errno)
+			perror_msg_and_fail("pthread_create");
+		errno = pthread_join(t, NULL);
+		if (errno)
+			perror_msg_and_fail("pthread_join");
+	}
+}
+
+static pthread_mutex_t pp_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pp_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int pp_turn;
+
+/* Each of the two threads waits for its turn, then passes it on. */
+static void *
+ping_pong(void *arg)
+{
+	const unsigned int me = (unsigned long) arg;
+	unsigned int i;
+
+	for (i = 0; i < iterations; ++i) {
+		pthread_mutex_lock(&pp_mutex);
+		while (pp_turn != me)
+			pthread_cond_wait(&pp_cond, &pp_mutex);
+		pp_turn = !me;
+		pthread_cond_signal(&pp_cond);
+		pthread_mutex_unlock(&pp_mutex);
+	}
+
+	return NULL;
+}
+
+static void
+do_futex(void)
+{
+	pthread_t t;
+
+	errno = pthread_create(&t, NULL, ping_pong, (void *) 1UL);
+	if (errno)
+		perror_msg_and_fail("pthread_create");
+	ping_pong((void *) 0UL);
+	errno = pthread_join(t, NULL);
+	if (errno)
+		perror_msg_and_fail("pthread_join");
+}
+
+#define NTHREADS 16
+
+static void *
+thread_getpid(void *arg)
+{
+	do_getpid();
+	return arg;
+}
+
+static void
+do_threads(void)
+{
+	pthread_t t[NTHREADS];
+	unsigned int i;
+
+	for (i = 0; i < NTHREADS; ++i) {
+		errno = pthread_create(&t[i], NULL, thread_getpid, NULL);
+		if (errno)
+			perror_msg_and_fail("pthread_create");
+	}
+	for (i = 0; i < NTHREADS; ++i) {
+		errno = pthread_join(t[i], NULL);
+		if (errno)
+			perror_msg_and_fail("pthread_join");
+	}
+}
+
+static const struct {
+	const char *name;
+	void (*func)(void);
+} benchmarks[] = {
+	{ "getpid", do_getpid },
+	{ "read-small", do_read_small },
+	{ "read-large", do_read_large },
+	{ "write-small", do_write_small },
+	{ "write-large", do_write_large },
+	{ "execve", do_execve },
+	{ "fork", do_fork },
+	{ "clone", do_clone },
+	{ "futex", do_futex },
+	{ "threads", do_threads },
+};
+
+int
+main(int argc, char *argv[])
+{
+	unsigned int i;
+
+	if (argc == 2 && !strcmp(argv[1], "list")) {
+		for (i = 0; i < ARRAY_SIZE(benchmarks); ++i)
+			puts(benchmarks[i].name);
+		return 0;
+	}
+
+	if (argc != 3)
+		error_msg_and_fail("usage: microbench list | microbench NAME ITERATIONS");
+
+	self = argv[0];
+	iterations = strtoul(argv[2], NULL, 10);
+
+	for (i = 0; i < ARRAY_SIZE(benchmarks); ++i) {
+		if (!strcmp(argv[1], benchmarks[i].name)) {
+			benchmarks[i].func();
+			return 0;
+		}
+	}
+
+	error_msg_and_fail("unknown benchmark: %s", argv[1]);
+}
@@ -0,0 +1,80 @@
+/*
+ * Check --notify-events option.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+int
+main(void)
+{
+	static const char dir[] = "notify-events.dir";
+	static const char file[] = "notify-events.dir/file";
+	static const int fd = 42;
+	char buf[256];
+
+	if (mkdir(dir, 0700))
+		perror_msg_and_fail("mkdir");
+
+	int ifd = inotify_init1(0);
+	if (ifd < 0)
+		perror_msg_and_skip("inotify_init1");
+	if (dup2(ifd, fd) != fd)
+		perror_msg_and_skip("dup2");
+	close(ifd);
+
+	const int wd = inotify_add_watch(fd, dir, IN_CREATE | IN_DELETE);
+	if (wd < 0)
+		perror_msg_and_skip("inotify_add_watch");
+
+	int tfd = open(file, O_CREAT | O_WRONLY, 0600);
+	if (tfd < 0)
+		perror_msg_and_fail("open");
+	close(tfd);
+	if (unlink(file))
+		perror_msg_and_fail("unlink");
+
+	const ssize_t rc = read(fd, buf, sizeof(buf));
+	if (rc != 64)
+		perror_msg_and_fail("read");
+	printf("read(%d, [{wd=%d, mask=IN_CREATE, cookie=0, len=16"
+	       ", name=\"file\"}, {wd=%d, mask=IN_DELETE, cookie=0, len=16"
+	       ", name=\"file\"}], %u) = %zd\n",
+	       fd, wd, wd, (unsigned int) sizeof(buf), rc);
+
+	if (rmdir(dir))
+		perror_msg_and_fail("rmdir");
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * Check -P option with directory prefix and glob patterns.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+#include <asm/unistd.h>
+
+#if defined __NR_openat && defined __NR_chdir && defined __NR_fchdir
+
+# include <fcntl.h>
+# include <stdio.h>
+# include <unistd.h>
+# include <sys/stat.h>
+
+static long
+k_openat(const int dirfd, const char *const path, const int flags)
+{
+	return syscall(__NR_openat, dirfd, path, flags, 0600);
+}
+
+int
+main(void)
+{
+	static const char dir[] = "pathtrace-glob.tmp";
+	long rc;
+
+	if (mkdir(dir, 0700))
+		perror_msg_and_skip("mkdir");
+
+	const int dfd = k_openat(AT_FDCWD, dir, O_RDONLY | O_DIRECTORY);
+	if (dfd < 0)
+		perror_msg_and_fail("openat");
+	printf("openat(AT_FDCWD, \"%s\", O_RDONLY|O_DIRECTORY) = %d\n",
+	       dir, dfd);
+
+	rc = k_openat(dfd, "a", O_WRONLY | O_CREAT | O_TRUNC);
+	printf("openat(%d, \"a\", O_WRONLY|O_CREAT|O_TRUNC, 0600) = %s\n",
+	       dfd, sprintrc(rc));
+
+	/* Matches the glob pattern. */
+	rc = k_openat(AT_FDCWD, "pathtrace-glob.1", O_RDONLY);
+	printf("openat(AT_FDCWD, \"pathtrace-glob.1\", O_RDONLY) = %s\n",
+	       sprintrc(rc));
+	/* Matches nothing. */
+	k_openat(AT_FDCWD, "pathtrace-glob.x", O_RDONLY);
+
+	const int cwdfd = k_openat(AT_FDCWD, ".", O_RDONLY | O_DIRECTORY);
+	if (cwdfd < 0)
+		perror_msg_and_fail("openat");
+
+	/* Relative paths are resolved against the new working directory. */
+	rc = syscall(__NR_chdir, dir);
+	printf("chdir(\"%s\") = %s\n", dir, sprintrc(rc));
+	rc = k_openat(AT_FDCWD, "b", O_RDONLY);
+	printf("openat(AT_FDCWD, \"b\", O_RDONLY) = %s\n", sprintrc(rc));
+
+	/* ... until it changes again. */
+	if (syscall(__NR_fchdir, cwdfd))
+		perror_msg_and_fail("fchdir");
+	k_openat(AT_FDCWD, "b", O_RDONLY);
+
+	if (unlinkat(dfd, "a", 0))
+		perror_msg_and_fail("unlinkat");
+	if (rmdir(dir))
+		perror_msg_and_fail("rmdir");
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("__NR_openat && __NR_chdir && __NR_fchdir")
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * Check delay injection.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+#include <asm/unistd.h>
+
+#ifdef __NR_chdir
+
+# include <assert.h>
+# include <stdlib.h>
+# include <time.h>
+# include <unistd.h>
+# include <sys/wait.h>
+
+static long
+elapsed_usecs(const struct timespec *const start)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now))
+		perror_msg_and_fail("clock_gettime");
+
+	return (now.tv_sec - start->tv_sec) * 1000000L
+	       + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+int
+main(int argc, char *argv[])
+{
+	assert(argc == 2);
+
+	const long delay = atol(argv[1]);
+	struct timespec start;
+	int status;
+
+	pid_t pid = fork();
+	if (pid < 0)
+		perror_msg_and_fail("fork");
+
+	if (!pid) {
+		/* This chdir is delayed.  */
+		if (clock_gettime(CLOCK_MONOTONIC, &start))
+			perror_msg_and_fail("clock_gettime");
+		syscall(__NR_chdir, "delay-me");
+		if (elapsed_usecs(&start) < delay)
+			error_msg_and_fail("chdir was not delayed");
+		return 0;
+	}
+
+	/*
+	 * While the child is delayed, syscalls of the parent
+	 * must not be delayed.
+	 */
+	usleep(delay / 4);
+	if (clock_gettime(CLOCK_MONOTONIC, &start))
+		perror_msg_and_fail("clock_gettime");
+	syscall(__NR_chdir, "do-not-delay-me");
+	if (elapsed_usecs(&start) >= delay / 2)
+		error_msg_and_fail("chdir of another tracee was delayed");
+
+	if (waitpid(pid, &status, 0) != pid)
+		perror_msg_and_fail("waitpid");
+	if (status)
+		error_msg_and_fail("child exited with status %#x", status);
+
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("__NR_chdir")
+
+#endif
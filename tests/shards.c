@@ -0,0 +1,76 @@
+/*
+ * Check --shards option.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+#include <asm/unistd.h>
+
+#ifdef __NR_getppid
+
+# include <stdio.h>
+# include <unistd.h>
+# include <sys/wait.h>
+
+# define NCHILDREN 8
+
+int
+main(void)
+{
+	const long ppid = getpid();
+	pid_t pids[NCHILDREN];
+	unsigned int i;
+
+	for (i = 0; i < NCHILDREN; ++i) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			perror_msg_and_fail("fork");
+		if (!pids[i]) {
+			syscall(__NR_getppid);
+			_exit(0);
+		}
+	}
+
+	for (i = 0; i < NCHILDREN; ++i) {
+		int status;
+
+		if (waitpid(pids[i], &status, 0) != pids[i])
+			perror_msg_and_fail("waitpid");
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			error_msg_and_fail("child %d: status %#x",
+					   pids[i], status);
+		printf("%-5d getppid() = %ld\n", pids[i], ppid);
+	}
+
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("__NR_getppid")
+
+#endif
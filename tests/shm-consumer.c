@@ -0,0 +1,165 @@
+/*
+ * Read the trace output from the shared memory ring of -o shm:PATH.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+#include <asm/unistd.h>
+
+#ifdef __NR_futex
+
+# include <limits.h>
+# include <stdio.h>
+# include <string.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/socket.h>
+# include <sys/un.h>
+# include <linux/futex.h>
+# include "shm_output.h"
+
+# define RECORD_SIZE(len_) \
+	(sizeof(struct strace_shm_record) + (((len_) + 7) & ~(uint64_t) 7))
+
+static int
+receive_fd(const int sock)
+{
+	union {
+		struct cmsghdr cmsg;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	char byte;
+	struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf),
+	};
+	struct cmsghdr *cmsg;
+	int fd;
+
+	if (recvmsg(sock, &msg, 0) != 1)
+		perror_msg_and_fail("recvmsg");
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS)
+		error_msg_and_fail("no descriptor received");
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+	return fd;
+}
+
+static void
+futex_wake(uint32_t *const word)
+{
+	__atomic_add_fetch(word, 1, __ATOMIC_SEQ_CST);
+	syscall(__NR_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+int
+main(int ac, char **av)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct strace_shm_header *hdr;
+	const char *ring;
+	uint64_t tail = 0;
+	int sock, conn, fd;
+
+	if (ac != 2)
+		error_msg_and_fail("usage: shm-consumer path");
+	if (strlen(av[1]) >= sizeof(addr.sun_path))
+		error_msg_and_fail("path is too long: %s", av[1]);
+	strcpy(addr.sun_path, av[1]);
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0)
+		perror_msg_and_skip("socket");
+	if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)))
+		perror_msg_and_skip("bind");
+	if (listen(sock, 1))
+		perror_msg_and_skip("listen");
+	conn = accept(sock, NULL, NULL);
+	if (conn < 0)
+		perror_msg_and_fail("accept");
+	fd = receive_fd(conn);
+
+	hdr = mmap(NULL, STRACE_SHM_HEADER_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED)
+		perror_msg_and_fail("mmap");
+	if (hdr->magic != STRACE_SHM_MAGIC ||
+	    hdr->version != STRACE_SHM_VERSION)
+		error_msg_and_fail("unexpected ring header");
+	const uint64_t size = hdr->data_size;
+	munmap(hdr, STRACE_SHM_HEADER_SIZE);
+
+	hdr = mmap(NULL, STRACE_SHM_HEADER_SIZE + size,
+		   PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED)
+		perror_msg_and_fail("mmap");
+	ring = (const char *) hdr + STRACE_SHM_HEADER_SIZE;
+
+	for (;;) {
+		const uint32_t closed =
+			__atomic_load_n(&hdr->closed, __ATOMIC_ACQUIRE);
+		const uint64_t head =
+			__atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+
+		while (tail < head) {
+			const struct strace_shm_record *const rec =
+				(const void *) (ring + (tail & (size - 1)));
+
+			if (rec->type == STRACE_SHM_TEXT)
+				fwrite(rec + 1, 1, rec->len, stdout);
+			tail += RECORD_SIZE(rec->len);
+		}
+		__atomic_store_n(&hdr->tail, tail, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&hdr->producer_waiting, __ATOMIC_SEQ_CST))
+			futex_wake(&hdr->tail_futex);
+
+		if (closed)
+			break;
+
+		__atomic_store_n(&hdr->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+		const uint32_t seq =
+			__atomic_load_n(&hdr->head_futex, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&hdr->head, __ATOMIC_SEQ_CST) == tail &&
+		    !__atomic_load_n(&hdr->closed, __ATOMIC_SEQ_CST))
+			syscall(__NR_futex, &hdr->head_futex, FUTEX_WAIT, seq,
+				NULL, NULL, 0);
+		__atomic_store_n(&hdr->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+	}
+
+	if (hdr->overruns)
+		error_msg_and_fail("%llu writes have been dropped",
+				   (unsigned long long) hdr->overruns);
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("__NR_futex")
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * Read the trace output of -o unix:PATH: listen on PATH, accept
+ * the connection of strace, and copy what it sends to stdout.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+int
+main(int ac, char **av)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	char buf[4096];
+	ssize_t len;
+	int sock, conn;
+
+	if (ac != 2)
+		error_msg_and_fail("usage: socket-consumer path");
+	if (strlen(av[1]) >= sizeof(addr.sun_path))
+		error_msg_and_fail("path is too long: %s", av[1]);
+	strcpy(addr.sun_path, av[1]);
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0)
+		perror_msg_and_skip("socket");
+	if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)))
+		perror_msg_and_skip("bind");
+	if (listen(sock, 1))
+		perror_msg_and_skip("listen");
+	conn = accept(sock, NULL, NULL);
+	if (conn < 0)
+		perror_msg_and_fail("accept");
+
+	while ((len = read(conn, buf, sizeof(buf))) > 0) {
+		if (fwrite(buf, 1, len, stdout) != (size_t) len)
+			perror_msg_and_fail("fwrite");
+	}
+	if (len < 0)
+		perror_msg_and_fail("read");
+
+	return 0;
+}
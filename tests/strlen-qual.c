@@ -0,0 +1,67 @@
+/*
+ * Check -e strlen= qualifier.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+#include <asm/unistd.h>
+
+#if defined __NR_write && defined __NR_pwrite64
+
+# include <fcntl.h>
+# include <unistd.h>
+
+static const char str[] = "0123456789abcdef";
+
+int
+main(void)
+{
+	long rc;
+
+	tprintf("%s", "");
+
+	const int fd = open("/dev/null", O_WRONLY);
+	if (fd < 0)
+		perror_msg_and_fail("open: %s", "/dev/null");
+
+	rc = syscall(__NR_write, fd, str, sizeof(str) - 1);
+	tprintf("write(%d, \"01234567\"..., %u) = %s\n",
+		fd, (unsigned) sizeof(str) - 1, sprintrc(rc));
+
+	rc = syscall(__NR_pwrite64, fd, str, sizeof(str) - 1, 0);
+	tprintf("pwrite64(%d, \"01\"..., %u, 0) = %s\n",
+		fd, (unsigned) sizeof(str) - 1, sprintrc(rc));
+
+	tprintf("+++ exited with 0 +++\n");
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("__NR_write && __NR_pwrite64")
+
+#endif
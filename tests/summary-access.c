@@ -0,0 +1,72 @@
+/*
+ * Check --summary-access option.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+
+int
+main(void)
+{
+	static const char fname[] = "summary-access.tmp";
+	static char buf[4096];
+	unsigned int i;
+
+	const int fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		perror_msg_and_fail("open");
+	if (unlink(fname))
+		perror_msg_and_fail("unlink");
+	const int null_fd = open("/dev/null", O_WRONLY);
+	if (null_fd < 0)
+		perror_msg_and_fail("open");
+
+	/* Sequential writes. */
+	for (i = 0; i < 3; ++i)
+		if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+			perror_msg_and_fail("write");
+
+	/* Random reads. */
+	if (pread(fd, buf, 512, 8192) != 512)
+		perror_msg_and_fail("pread");
+	if (pread(fd, buf, 512, 0) != 512)
+		perror_msg_and_fail("pread");
+	if (lseek(fd, 0, SEEK_SET))
+		perror_msg_and_fail("lseek");
+	/* A random read, then a sequential one. */
+	for (i = 0; i < 2; ++i)
+		if (read(fd, buf, sizeof(buf)) != sizeof(buf))
+			perror_msg_and_fail("read");
+
+	if (sendfile(null_fd, fd, NULL, sizeof(buf)) != sizeof(buf))
+		perror_msg_and_skip("sendfile");
+
+	return 0;
+}
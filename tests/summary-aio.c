@@ -0,0 +1,86 @@
+/*
+ * Check --summary-aio option.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+#include <asm/unistd.h>
+
+#if defined __NR_io_setup \
+ && defined __NR_io_submit \
+ && defined __NR_io_getevents
+
+# include <fcntl.h>
+# include <stdio.h>
+# include <unistd.h>
+# include <linux/aio_abi.h>
+
+int
+main(void)
+{
+	static const char fname[] = "summary-aio.sample";
+	static char buf[3][512];
+	aio_context_t ctx = 0;
+	struct io_event events[3];
+	unsigned int i;
+
+	const int fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		perror_msg_and_fail("open: %s", fname);
+
+	struct iocb cb[4] = {
+		{ .aio_lio_opcode = IOCB_CMD_PWRITE, .aio_nbytes = 512 },
+		{ .aio_lio_opcode = IOCB_CMD_PREAD, .aio_nbytes = 512 },
+		{ .aio_lio_opcode = IOCB_CMD_PREAD, .aio_nbytes = 512 },
+		{ .aio_lio_opcode = IOCB_CMD_PREAD, .aio_nbytes = 512 },
+	};
+	long cbs[4];
+
+	for (i = 0; i < ARRAY_SIZE(cb); ++i) {
+		cb[i].aio_fildes = fd;
+		cb[i].aio_buf = (unsigned long) buf[i % 3];
+		cbs[i] = (long) &cb[i];
+	}
+
+	if (syscall(__NR_io_setup, 4, &ctx))
+		perror_msg_and_skip("io_setup");
+	if (syscall(__NR_io_submit, ctx, 3, cbs) != 3)
+		perror_msg_and_fail("io_submit");
+	if (syscall(__NR_io_getevents, ctx, 3, 3, events, NULL) != 3)
+		perror_msg_and_fail("io_getevents");
+	/* This one is never reaped.  */
+	if (syscall(__NR_io_submit, ctx, 1, &cbs[3]) != 1)
+		perror_msg_and_fail("io_submit");
+
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("__NR_io_setup && __NR_io_submit && __NR_io_getevents")
+
+#endif
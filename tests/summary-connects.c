@@ -0,0 +1,106 @@
+/*
+ * Check --summary-connects option.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+static int
+inet_socket(void)
+{
+	const int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd < 0)
+		perror_msg_and_skip("socket");
+	return fd;
+}
+
+int
+main(void)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	struct sockaddr_in refused = addr;
+	socklen_t len = sizeof(addr);
+	const int listener = inet_socket();
+	unsigned int i;
+	int fd, err;
+
+	if (bind(listener, (void *) &addr, sizeof(addr)) || listen(listener, 8)
+	    || getsockname(listener, (void *) &addr, &len))
+		perror_msg_and_skip("bind");
+
+	/* A port nobody listens on.  */
+	fd = inet_socket();
+	len = sizeof(refused);
+	if (bind(fd, (void *) &refused, sizeof(refused))
+	    || getsockname(fd, (void *) &refused, &len))
+		perror_msg_and_skip("bind");
+	close(fd);
+
+	for (i = 0; i < 2; ++i) {
+		fd = inet_socket();
+		if (connect(fd, (void *) &addr, sizeof(addr)))
+			perror_msg_and_fail("connect");
+		close(fd);
+	}
+
+	fd = inet_socket();
+	if (fcntl(fd, F_SETFL, O_NONBLOCK))
+		perror_msg_and_fail("fcntl");
+	if (connect(fd, (void *) &addr, sizeof(addr))) {
+		struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+
+		if (errno != EINPROGRESS)
+			perror_msg_and_fail("connect");
+		if (poll(&pfd, 1, -1) != 1)
+			perror_msg_and_fail("poll");
+		len = sizeof(err);
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) || err)
+			perror_msg_and_fail("getsockopt");
+	}
+	close(fd);
+
+	fd = inet_socket();
+	if (!connect(fd, (void *) &refused, sizeof(refused))
+	    || errno != ECONNREFUSED)
+		perror_msg_and_skip("connect");
+	close(fd);
+
+	printf("%u %u\n", ntohs(addr.sin_port), ntohs(refused.sin_port));
+	return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * Check --summary-epoll option.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+#include <asm/unistd.h>
+
+#if defined __NR_epoll_create1 && defined __NR_epoll_ctl \
+ && defined __NR_epoll_wait
+
+# include <stdio.h>
+# include <unistd.h>
+# include <sys/epoll.h>
+
+static int
+wait_events(const int epfd, const int expected)
+{
+	struct epoll_event events[4];
+	const int rc = syscall(__NR_epoll_wait, epfd, events, 4, 0);
+
+	if (rc != expected)
+		perror_msg_and_fail("epoll_wait: %d", rc);
+	return rc;
+}
+
+int
+main(void)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	int fds[2];
+	char c = 0;
+
+	const int epfd = syscall(__NR_epoll_create1, 0);
+	if (epfd < 0)
+		perror_msg_and_skip("epoll_create1");
+	if (pipe(fds))
+		perror_msg_and_fail("pipe");
+
+	if (syscall(__NR_epoll_ctl, epfd, EPOLL_CTL_ADD, fds[0], &ev))
+		perror_msg_and_fail("epoll_ctl");
+	ev.events = EPOLLOUT;
+	if (syscall(__NR_epoll_ctl, epfd, EPOLL_CTL_ADD, fds[1], &ev))
+		perror_msg_and_fail("epoll_ctl");
+
+	/* The write end is ready.  */
+	wait_events(epfd, 1);
+	if (write(fds[1], &c, 1) != 1)
+		perror_msg_and_fail("write");
+	/* Both ends are ready.  */
+	wait_events(epfd, 2);
+	if (syscall(__NR_epoll_ctl, epfd, EPOLL_CTL_DEL, fds[1], &ev))
+		perror_msg_and_fail("epoll_ctl");
+	/* The read end is ready.  */
+	wait_events(epfd, 1);
+	if (read(fds[0], &c, 1) != 1)
+		perror_msg_and_fail("read");
+	/* Nothing is ready.  */
+	wait_events(epfd, 0);
+
+	printf("%d:%d\n", getpid(), epfd);
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("__NR_epoll_create1 && __NR_epoll_ctl && __NR_epoll_wait")
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * Check --summary-ipc option.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <sys/sem.h>
+
+struct msg {
+	long mtype;
+	char mtext[10];
+};
+
+int
+main(void)
+{
+	struct sembuf post = { 0, 1, 0 };
+	struct sembuf wait = { 0, -1, 0 };
+	struct sembuf try_wait = { 1, -1, IPC_NOWAIT };
+	struct msg msg = { 1, "0123456789" };
+	unsigned int i;
+
+	const int semid = semget(IPC_PRIVATE, 2, 0600);
+	if (semid < 0)
+		perror_msg_and_skip("semget");
+	const int msqid = msgget(IPC_PRIVATE, 0600);
+	if (msqid < 0) {
+		semctl(semid, 0, IPC_RMID, 0);
+		perror_msg_and_skip("msgget");
+	}
+
+	for (i = 0; i < 2; ++i) {
+		if (semop(semid, &post, 1))
+			perror_msg_and_fail("semop");
+		if (semop(semid, &wait, 1))
+			perror_msg_and_fail("semop");
+	}
+	if (semop(semid, &try_wait, 1) != -1 || errno != EAGAIN)
+		perror_msg_and_fail("semop");
+
+	for (i = 0; i < 2; ++i) {
+		if (msgsnd(msqid, &msg, sizeof(msg.mtext), 0))
+			perror_msg_and_fail("msgsnd");
+	}
+	for (i = 0; i < 2; ++i) {
+		if (msgrcv(msqid, &msg, sizeof(msg.mtext), 0, 0)
+		    != sizeof(msg.mtext))
+			perror_msg_and_fail("msgrcv");
+	}
+	if (msgrcv(msqid, &msg, sizeof(msg.mtext), 0, IPC_NOWAIT) != -1
+	    || errno != ENOMSG)
+		perror_msg_and_fail("msgrcv");
+
+	semctl(semid, 0, IPC_RMID, 0);
+	msgctl(msqid, IPC_RMID, NULL);
+
+	printf("%d %d\n", semid, msqid);
+	return 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * Check --summary-oversleep option.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+int
+main(void)
+{
+	const struct timespec ts = { 0, 10000000 };
+	unsigned int i;
+	int fds[2];
+
+	for (i = 0; i < 3; ++i)
+		if (nanosleep(&ts, NULL))
+			perror_msg_and_fail("nanosleep");
+	for (i = 0; i < 2; ++i)
+		if (poll(NULL, 0, 10))
+			perror_msg_and_fail("poll");
+
+	/* This one returns before its timeout. */
+	if (pipe(fds))
+		perror_msg_and_fail("pipe");
+	if (write(fds[1], "", 1) != 1)
+		perror_msg_and_fail("write");
+
+	struct pollfd pfd = { .fd = fds[0], .events = POLLIN };
+	if (poll(&pfd, 1, 10000) != 1)
+		perror_msg_and_fail("poll");
+
+	return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * Run a fixed number of system calls for the tracer syscall budget tests.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+#include <asm/unistd.h>
+
+#ifdef __NR_getpid
+
+# include <stdlib.h>
+# include <string.h>
+# include <unistd.h>
+# include <sys/socket.h>
+
+int
+main(int ac, char **av)
+{
+	if (ac != 3)
+		error_msg_and_fail("usage: syscall-budget getpid|read count");
+
+	const long n = atol(av[2]);
+	long i;
+
+	if (!strcmp(av[1], "getpid")) {
+		for (i = 0; i < n; ++i)
+			syscall(__NR_getpid);
+	} else if (!strcmp(av[1], "read")) {
+		int sv[2];
+		char c = 0;
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+			perror_msg_and_skip("socketpair");
+		for (i = 0; i < n; ++i) {
+			if (write(sv[1], &c, 1) != 1)
+				perror_msg_and_fail("write");
+			if (read(sv[0], &c, 1) != 1)
+				perror_msg_and_fail("read");
+		}
+	} else {
+		error_msg_and_fail("unknown workload: %s", av[1]);
+	}
+
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("__NR_getpid")
+
+#endif
@@ -0,0 +1,84 @@
+#!/bin/sh
+#
+# Helpers for the tracer syscall budget tests.
+#
+# Copyright (c) 2017 The strace developers.
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+# 3. The name of the author may not be used to endorse or promote products
+#    derived from this software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+# IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+# OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+# IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+# INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+# NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+# THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+# THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+# The tests run strace under another strace -c and check how many
+# system calls the inner strace makes per system call of its tracee,
+# so a change that adds a ptrace request to every stop, or defeats
+# one of the caches, is caught even if the output stays the same.
+
+. "${srcdir=.}/init.sh"
+
+# Nothing sensible can be counted through valgrind.
+[ -z "${STRACE_EXE-}" ] ||
+	skip_ 'tracer syscall budgets are not checked under valgrind'
+
+check_prog grep
+check_prog sed
+
+# The system calls the inner strace makes to control and inspect tracees.
+budget_syscalls='ptrace,wait4,epoll_wait,process_vm_readv,readlink,readlinkat,getxattr,socket,sendmsg,recvmsg'
+budget_csv="$LOG.budget"
+
+# budget_run STRACE_ARGS...
+# Run $STRACE with STRACE_ARGS under $STRACE -c.
+budget_run()
+{
+	> "$LOG" || fail_ "failed to write $LOG"
+	$STRACE -c --summary-format=csv -e trace="$budget_syscalls" \
+		-o "$budget_csv" $STRACE -o "$LOG" "$@" ||
+		dump_log_and_fail_with "$STRACE $* failed with code $?"
+}
+
+# budget_calls SYSCALL...
+# Print the number of calls to SYSCALLs made by the last budget_run.
+budget_calls()
+{
+	local name n sum=0
+
+	for name; do
+		n="$(sed -n "s/^[0-9]*,[0-9]*,[0-9]*,$name,\\([0-9]*\\),.*/\\1/p" \
+			"$budget_csv")"
+		sum=$((sum + ${n:-0}))
+	done
+	echo "$sum"
+}
+
+# budget_check LIMIT SYSCALL...
+# Fail unless the last budget_run made at most LIMIT calls to SYSCALLs.
+budget_check()
+{
+	local limit="$1"; shift
+	local calls
+
+	calls="$(budget_calls "$@")"
+	[ "$calls" -le "$limit" ] || {
+		cat < "$budget_csv"
+		fail_ "$*: $calls calls, the budget is $limit"
+	}
+}
@@ -0,0 +1,80 @@
+/*
+ * Check --trace-threads option.
+ *
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tests.h"
+#include <asm/unistd.h>
+
+#if defined __NR_getpid && defined __NR_getppid && defined __NR_gettid
+
+# include <errno.h>
+# include <pthread.h>
+# include <stdio.h>
+# include <time.h>
+# include <unistd.h>
+# include <sys/prctl.h>
+
+/*
+ * The thread renames itself while it is not traced yet,
+ * so it is noticed by the periodic rescan of thread names.
+ */
+static void *
+worker(void *arg)
+{
+	const struct timespec ts = { 2, 0 };
+
+	if (prctl(PR_SET_NAME, "worker"))
+		perror_msg_and_skip("prctl PR_SET_NAME");
+	if (nanosleep(&ts, NULL))
+		perror_msg_and_fail("nanosleep");
+	printf("%-5ld getppid() = %ld\n",
+	       (long) syscall(__NR_gettid), (long) syscall(__NR_getppid));
+	return NULL;
+}
+
+int
+main(void)
+{
+	pthread_t t;
+
+	errno = pthread_create(&t, NULL, worker, NULL);
+	if (errno)
+		perror_msg_and_fail("pthread_create");
+	errno = pthread_join(t, NULL);
+	if (errno)
+		perror_msg_and_fail("pthread_join");
+
+	syscall(__NR_getpid);
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("__NR_getpid && __NR_getppid && __NR_gettid")
+
+#endif
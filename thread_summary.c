@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Thread time summary (--summary-threads option).
+ *
+ * The wall time of every traced thread is split into the time it runs
+ * in user space, the time it spends inside syscalls, and the time it is
+ * kept stopped by strace, using the timestamps of its ptrace stops and
+ * restarts.  The time inside syscalls is further split by the kind of
+ * waiting the syscall does.
+ */
+
+#include "defs.h"
+#include "syscall.h"
+
+enum thread_time_kind {
+	THREAD_TIME_POLL,
+	THREAD_TIME_FUTEX,
+	THREAD_TIME_WAIT,
+	THREAD_TIME_IO,
+	THREAD_TIME_OTHER,
+
+	THREAD_TIME_SYSCALL_KINDS
+};
+
+struct thread_counts {
+	struct thread_counts *next;
+	int pid;
+	char comm[sizeof("1234567890123456")];
+	struct timespec stop_ts;	/* Last ptrace stop, if stopped */
+	struct timespec resume_ts;	/* Last restart, if running */
+	uint64_t user_ns;
+	uint64_t tracer_ns;
+	uint64_t syscall_ns[THREAD_TIME_SYSCALL_KINDS];
+	uint64_t total_syscall_ns;
+};
+
+unsigned int summary_threads;
+static struct thread_counts *thread_counts_list;
+static unsigned int thread_counts_count;
+
+static struct thread_counts *
+get_thread_counts(struct tcb *const tcp)
+{
+	if (tcp->thread_counts)
+		return tcp->thread_counts;
+
+	struct thread_counts *const tc = xcalloc(1, sizeof(*tc));
+
+	tc->pid = tcp->pid;
+	read_proc_comm(tcp->pid, tc->comm, sizeof(tc->comm));
+	tc->next = thread_counts_list;
+	thread_counts_list = tc;
+	++thread_counts_count;
+
+	return tcp->thread_counts = tc;
+}
+
+static enum thread_time_kind
+syscall_time_kind(const struct tcb *const tcp)
+{
+	switch (tcp->s_ent->sen) {
+	case SEN_epoll_pwait:
+	case SEN_epoll_wait:
+	case SEN_oldselect:
+	case SEN_poll:
+	case SEN_ppoll:
+	case SEN_pselect6:
+	case SEN_select:
+		return THREAD_TIME_POLL;
+	case SEN_futex:
+		return THREAD_TIME_FUTEX;
+	case SEN_clock_nanosleep:
+	case SEN_nanosleep:
+	case SEN_pause:
+	case SEN_rt_sigsuspend:
+	case SEN_rt_sigtimedwait:
+	case SEN_sigsuspend:
+	case SEN_wait4:
+	case SEN_waitid:
+	case SEN_waitpid:
+		return THREAD_TIME_WAIT;
+	}
+
+	return (tcp->s_ent->sys_flags & (TRACE_DESC | TRACE_NETWORK))
+	       ? THREAD_TIME_IO : THREAD_TIME_OTHER;
+}
+
+static uint64_t
+ts_diff_ns(const struct timespec *const a, const struct timespec *const b)
+{
+	struct timespec dt;
+
+	ts_sub(&dt, a, b);
+	return (uint64_t) dt.tv_sec * 1000000000 + dt.tv_nsec;
+}
+
+/*
+ * The tracee has stopped, the time since its restart has been spent
+ * in the syscall if the stop is inside of one, in user space otherwise.
+ */
+void
+count_thread_stop(struct tcb *const tcp)
+{
+	struct thread_counts *const tc = get_thread_counts(tcp);
+
+	clock_gettime(CLOCK_MONOTONIC, &tc->stop_ts);
+	if (!ts_nz(&tc->resume_ts))
+		return;
+
+	const uint64_t ns = ts_diff_ns(&tc->stop_ts, &tc->resume_ts);
+
+	if (exiting(tcp)) {
+		tc->syscall_ns[syscall_time_kind(tcp)] += ns;
+		tc->total_syscall_ns += ns;
+		/* The thread has got a new name if execve has succeeded.  */
+		if (tcp->s_ent->sen == SEN_execve
+		    || tcp->s_ent->sen == SEN_execveat)
+			read_proc_comm(tcp->pid, tc->comm, sizeof(tc->comm));
+	} else {
+		tc->user_ns += ns;
+	}
+	tc->resume_ts.tv_sec = tc->resume_ts.tv_nsec = 0;
+}
+
+/* The tracee is restarted, the time since its stop has been ours.  */
+void
+count_thread_resume(struct tcb *const tcp)
+{
+	struct thread_counts *const tc = get_thread_counts(tcp);
+
+	clock_gettime(CLOCK_MONOTONIC, &tc->resume_ts);
+	if (!ts_nz(&tc->stop_ts))
+		return;
+
+	tc->tracer_ns += ts_diff_ns(&tc->resume_ts, &tc->stop_ts);
+	tc->stop_ts.tv_sec = tc->stop_ts.tv_nsec = 0;
+}
+
+static uint64_t
+thread_wall_ns(const struct thread_counts *const tc)
+{
+	return tc->user_ns + tc->tracer_ns + tc->total_syscall_ns;
+}
+
+static int
+thread_counts_cmp(const void *a, const void *b)
+{
+	const struct thread_counts *const x =
+		*(const struct thread_counts **) a;
+	const struct thread_counts *const y =
+		*(const struct thread_counts **) b;
+
+	return (x->total_syscall_ns < y->total_syscall_ns) ? 1
+	     : (x->total_syscall_ns > y->total_syscall_ns) ? -1
+	     : x->pid - y->pid;
+}
+
+static double
+percent(const uint64_t part, const uint64_t whole)
+{
+	return whole ? 100.0 * part / whole : 0;
+}
+
+/*
+ * Print the time split of the summary_threads threads
+ * that have spent the most time inside syscalls.
+ */
+void
+thread_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	struct thread_counts **sorted;
+	struct thread_counts *tc;
+	unsigned int i = 0;
+
+	if (!thread_counts_count)
+		return;
+
+	sorted = xcalloc(thread_counts_count, sizeof(sorted[0]));
+	for (tc = thread_counts_list; tc; tc = tc->next)
+		sorted[i++] = tc;
+	sort_top(sorted, thread_counts_count, sizeof(sorted[0]),
+		 summary_threads, thread_counts_cmp);
+
+	fprintf(outf, "\n%7.7s %11.11s %7.7s %7.7s %7.7s"
+		" %7.7s %7.7s %7.7s %7.7s %7.7s %s\n",
+		"tid", "seconds", "% user", "% stop", "% sys",
+		"% poll", "% futex", "% wait", "% io", "% other", "thread");
+	fprintf(outf, "%7.7s %11.11s %7.7s %7.7s %7.7s"
+		" %7.7s %7.7s %7.7s %7.7s %7.7s %s\n",
+		dashes, dashes, dashes, dashes, dashes,
+		dashes, dashes, dashes, dashes, dashes, dashes);
+	for (i = 0; i < thread_counts_count && i < summary_threads; ++i) {
+		const uint64_t wall_ns = thread_wall_ns(sorted[i]);
+		unsigned int k;
+
+		tc = sorted[i];
+		fprintf(outf, "%7d %11.6f %7.2f %7.2f %7.2f", tc->pid,
+			wall_ns / 1e9, percent(tc->user_ns, wall_ns),
+			percent(tc->tracer_ns, wall_ns),
+			percent(tc->total_syscall_ns, wall_ns));
+		for (k = 0; k < THREAD_TIME_SYSCALL_KINDS; ++k)
+			fprintf(outf, " %7.2f",
+				percent(tc->syscall_ns[k], wall_ns));
+		fprintf(outf, " %s\n", tc->comm);
+	}
+
+	free(sorted);
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Trace event output (--trace-events option).
+ *
+ * Syscalls are written as complete events with the entering time and
+ * the duration, signals and process exits are written as instant events,
+ * in the JSON array format of Chrome trace events that is understood by
+ * chrome://tracing and Perfetto UI.  Every thread gets a track of its own
+ * inside its thread group.  Events are written as they happen.
+ */
+
+#include "defs.h"
+#include "trace_events.h"
+
+static FILE *trace_events_file;
+static const char *trace_events_path;
+static bool trace_events_written;
+
+bool
+trace_events_enabled(void)
+{
+	return trace_events_file;
+}
+
+void
+trace_events_init(FILE *fp, const char *path)
+{
+	trace_events_file = fp;
+	trace_events_path = path;
+	fputs("[", trace_events_file);
+}
+
+/* Timestamps of trace events are in microseconds.  */
+static void
+trace_events_print_us(const char *const name, const struct timespec *const ts)
+{
+	fprintf(trace_events_file, ",\"%s\":%lld.%03ld", name,
+		(long long) ts->tv_sec * 1000000 + ts->tv_nsec / 1000,
+		(long) ts->tv_nsec % 1000);
+}
+
+static void
+trace_events_begin(struct tcb *const tcp, const char *const name,
+		   const char *const cat, const char *const ph,
+		   const struct timespec *const ts)
+{
+	fprintf(trace_events_file,
+		"%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\","
+		"\"pid\":%d,\"tid\":%d",
+		trace_events_written ? "," : "", name, cat, ph,
+		get_tcb_tgid(tcp), tcp->pid);
+	trace_events_print_us("ts", ts);
+	trace_events_written = true;
+}
+
+static void
+trace_events_instant(struct tcb *const tcp, const char *const name,
+		     const char *const cat, const char *const scope)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	trace_events_begin(tcp, name, cat, "i", &ts);
+	fprintf(trace_events_file, ",\"s\":\"%s\"", scope);
+}
+
+static void
+trace_events_syscall_begin(struct tcb *const tcp,
+			   const struct timespec *const ts)
+{
+	struct timespec dt;
+
+	ts_sub(&dt, ts, &tcp->etime);
+	trace_events_begin(tcp, tcp->s_ent->sys_name, "syscall", "X",
+			   &tcp->etime);
+	trace_events_print_us("dur", &dt);
+}
+
+void
+trace_events_syscall_exiting(struct tcb *const tcp,
+			     const struct timespec *const ts, const int res)
+{
+	trace_events_syscall_begin(tcp, ts);
+	if (res != 1) {
+		fputs(",\"args\":{\"unavailable\":true}}", trace_events_file);
+	} else if (syserror(tcp)) {
+		const char *const name = err_name(tcp->u_error);
+
+		if (name)
+			fprintf(trace_events_file,
+				",\"args\":{\"errno\":\"%s\"}}", name);
+		else
+			fprintf(trace_events_file,
+				",\"args\":{\"errno\":%lu}}", tcp->u_error);
+	} else {
+		fprintf(trace_events_file, ",\"args\":{\"retval\":%" PRI_kld "}}",
+			tcp->u_rval);
+	}
+}
+
+void
+trace_events_syscall_unfinished(struct tcb *const tcp)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	trace_events_syscall_begin(tcp, &ts);
+	fputs(",\"args\":{\"unfinished\":true}}", trace_events_file);
+}
+
+void
+trace_events_signal(struct tcb *const tcp, const unsigned int sig)
+{
+	trace_events_instant(tcp, signame(sig), "signal", "t");
+	fputs("}", trace_events_file);
+}
+
+void
+trace_events_exited(struct tcb *const tcp, const int status)
+{
+	trace_events_instant(tcp, "exit", "process", "p");
+	fprintf(trace_events_file, ",\"args\":{\"status\":%d}}", status);
+}
+
+void
+trace_events_killed(struct tcb *const tcp, const int sig)
+{
+	trace_events_instant(tcp, "killed", "process", "p");
+	fprintf(trace_events_file, ",\"args\":{\"signal\":\"%s\"}}",
+		signame(sig));
+}
+
+void
+trace_events_finish(void)
+{
+	if (!trace_events_file)
+		return;
+	fputs("\n]\n", trace_events_file);
+	if (fflush(trace_events_file) || ferror(trace_events_file))
+		perror_msg("%s", trace_events_path);
+	trace_events_file = NULL;
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Placement of the tracer process (--tracer-cpus, --tracer-sched,
+ * and --tracer-mlock options).
+ *
+ * Every tracee stop waits for the tracer, so on a loaded host it is worth
+ * keeping the tracer on CPUs near the tracees, ahead of them in the run
+ * queue, and out of page faults.  The settings are applied by the tracer
+ * process only, once the tracees are started or attached, so the traced
+ * command does not inherit them; with -D this is the detached grandchild.
+ * Threads the tracer creates later inherit the affinity and the policy.
+ */
+
+#include "defs.h"
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <asm/unistd.h>
+#include "string_to_uint.h"
+
+#ifndef MPOL_BIND
+# define MPOL_BIND 2
+#endif
+
+static cpu_set_t tracer_cpus;
+static bool tracer_cpus_given;
+/* NUMA nodes of --tracer-cpus=node:LIST, as a set of bits */
+static unsigned long tracer_nodes;
+static int tracer_policy = -1;
+/* real-time priority, or nice value of non real-time policies */
+static int tracer_priority;
+bool tracer_mlock;
+
+/*
+ * Parse a list of numbers and ranges, like "0-3,8", below max,
+ * call add for each number, return false if the list is invalid.
+ */
+static bool
+parse_number_list(const char *str, const unsigned int max,
+		  void (*const add)(unsigned int, void *), void *const data)
+{
+	char *end;
+
+	for (;;) {
+		const int first = string_to_uint_ex(str, &end, max - 1, "-,\n");
+		int last = first;
+
+		if (first < 0)
+			return false;
+		if (*end == '-') {
+			last = string_to_uint_ex(end + 1, &end, max - 1, ",\n");
+			if (last < first)
+				return false;
+		}
+		for (int i = first; i <= last; ++i)
+			add(i, data);
+		if (*end != ',')
+			return !*end || !strcmp(end, "\n");
+		str = end + 1;
+	}
+}
+
+static void
+add_cpu(const unsigned int cpu, void *const set)
+{
+	CPU_SET(cpu, (cpu_set_t *) set);
+}
+
+static void
+add_node(const unsigned int node, void *const nodes)
+{
+	*(unsigned long *) nodes |= 1UL << node;
+}
+
+/* Add the CPUs of NUMA node to tracer_cpus. */
+static bool
+add_node_cpus(const unsigned int node)
+{
+	char path[sizeof("/sys/devices/system/node/node%u/cpulist")
+		  + sizeof(int) * 3];
+	char buf[BUFSIZ];
+	FILE *fp;
+	bool ok;
+
+	sprintf(path, "/sys/devices/system/node/node%u/cpulist", node);
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror_msg("%s", path);
+		return false;
+	}
+	ok = fgets(buf, sizeof(buf), fp) && strcmp(buf, "\n") &&
+	     parse_number_list(buf, CPU_SETSIZE, add_cpu, &tracer_cpus);
+	fclose(fp);
+	if (!ok)
+		error_msg("NUMA node %u has no CPUs", node);
+	return ok;
+}
+
+/*
+ * Parse the --tracer-cpus argument, a list of CPUs or "node:" followed
+ * by a list of NUMA nodes, return false if it is invalid.
+ */
+bool
+parse_tracer_cpus(const char *const arg)
+{
+	CPU_ZERO(&tracer_cpus);
+	tracer_nodes = 0;
+
+	if (strncmp(arg, "node:", 5)) {
+		if (!parse_number_list(arg, CPU_SETSIZE, add_cpu, &tracer_cpus))
+			return false;
+	} else {
+		if (!parse_number_list(arg + 5, sizeof(tracer_nodes) * 8,
+				       add_node, &tracer_nodes))
+			return false;
+		for (unsigned int i = 0; i < sizeof(tracer_nodes) * 8; ++i) {
+			if ((tracer_nodes & (1UL << i)) && !add_node_cpus(i))
+				return false;
+		}
+	}
+
+	tracer_cpus_given = true;
+	return true;
+}
+
+static const struct {
+	const char *name;
+	int policy;
+} tracer_policies[] = {
+	{ "other", SCHED_OTHER },
+	{ "batch", SCHED_BATCH },
+	{ "idle", SCHED_IDLE },
+	{ "fifo", SCHED_FIFO },
+	{ "rr", SCHED_RR },
+};
+
+/*
+ * Parse the --tracer-sched argument, "POLICY[:PRIORITY]",
+ * return false if it is invalid.
+ */
+bool
+parse_tracer_sched(const char *const arg)
+{
+	const char *const colon = strchr(arg, ':');
+	const size_t len = colon ? (size_t) (colon - arg) : strlen(arg);
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(tracer_policies); ++i) {
+		if (strlen(tracer_policies[i].name) == len &&
+		    !strncmp(tracer_policies[i].name, arg, len))
+			break;
+	}
+	if (i == ARRAY_SIZE(tracer_policies))
+		return false;
+	tracer_policy = tracer_policies[i].policy;
+
+	switch (tracer_policy) {
+	case SCHED_FIFO:
+	case SCHED_RR:
+		/* real-time priority, 1 by default */
+		tracer_priority = colon
+			? string_to_uint_upto(colon + 1,
+					      sched_get_priority_max(tracer_policy))
+			: 1;
+		return tracer_priority >=
+		       sched_get_priority_min(tracer_policy);
+	case SCHED_IDLE:
+		return !colon;
+	default: {
+		/* nice value, unchanged by default */
+		const char *const nice = colon ? colon + 1 : NULL;
+		const bool negative = nice && *nice == '-';
+
+		if (!nice) {
+			tracer_priority = getpriority(PRIO_PROCESS, 0);
+			return true;
+		}
+		tracer_priority = string_to_uint_upto(nice + negative,
+						      negative ? 20 : 19);
+		if (tracer_priority < 0)
+			return false;
+		if (negative)
+			tracer_priority = -tracer_priority;
+		return true;
+	}
+	}
+}
+
+/*
+ * Apply the placement settings to the tracer.  Failures are reported
+ * but are not fatal, the tracees are already started or attached.
+ */
+void
+tracer_sched_apply(void)
+{
+	if (tracer_cpus_given &&
+	    sched_setaffinity(0, sizeof(tracer_cpus), &tracer_cpus))
+		perror_msg("sched_setaffinity");
+
+#ifdef __NR_set_mempolicy
+	if (tracer_nodes &&
+	    syscall(__NR_set_mempolicy, MPOL_BIND, &tracer_nodes,
+		    sizeof(tracer_nodes) * 8 + 1))
+		perror_msg("set_mempolicy");
+#endif
+
+	if (tracer_policy >= 0) {
+		struct sched_param param = { 0 };
+
+		if (tracer_policy == SCHED_FIFO || tracer_policy == SCHED_RR)
+			param.sched_priority = tracer_priority;
+		if (sched_setscheduler(0, tracer_policy, &param))
+			perror_msg("sched_setscheduler");
+		else if ((tracer_policy == SCHED_OTHER ||
+			  tracer_policy == SCHED_BATCH) &&
+			 setpriority(PRIO_PROCESS, 0, tracer_priority))
+			perror_msg("setpriority");
+	}
+
+	if (tracer_mlock && mlockall(MCL_CURRENT | MCL_FUTURE))
+		perror_msg("mlockall");
+}
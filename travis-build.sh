@@ -38,6 +38,9 @@ case "${CHECK-}" in
 		CFLAGS_FOR_BUILD="$CFLAGS"
 		export CFLAGS CFLAGS_FOR_BUILD
 		;;
+	native-only)
+		DISTCHECK_CONFIGURE_FLAGS="$DISTCHECK_CONFIGURE_FLAGS --enable-native-only"
+		;;
 	valgrind)
 		DISTCHECK_CONFIGURE_FLAGS="$DISTCHECK_CONFIGURE_FLAGS --enable-valgrind"
 		;;
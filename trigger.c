@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Trigger-based tracing windows (--trigger* options).
+ *
+ * Until a trigger fires, tracing is quiet: traced syscalls that cannot
+ * be triggers are filtered out right after their number is known, before
+ * their arguments are fetched, and signals are not printed.  A trigger,
+ * that is a syscall of the --trigger set that accesses a --trigger-path
+ * and fails with a --trigger-error, or a signal of the --trigger-signal
+ * set, opens a window of full tracing that lasts for a number of syscalls
+ * or seconds, after which tracing becomes quiet again.
+ */
+
+#include "defs.h"
+
+#include <limits.h>
+#include <time.h>
+
+#define DEFAULT_TRIGGER_WINDOW 100
+
+bool triggers_in_use;
+
+static bool trigger_syscalls;
+static struct path_set trigger_paths;
+
+/* The window lasts for window_syscalls syscalls or window_secs seconds.  */
+static unsigned int window_syscalls = DEFAULT_TRIGGER_WINDOW;
+static unsigned int window_secs;
+
+static bool window_open;
+static unsigned int window_left;
+static struct timespec window_end;
+
+void
+trigger_on_syscalls(void)
+{
+	triggers_in_use = true;
+	trigger_syscalls = true;
+}
+
+void
+trigger_select_path(const char *const path)
+{
+	pathtrace_select_set(path, &trigger_paths);
+	trigger_on_syscalls();
+}
+
+void
+trigger_on_signals(void)
+{
+	triggers_in_use = true;
+}
+
+/*
+ * Parse the --trigger-window argument, "N" syscalls or "Ns" seconds,
+ * return false if it is invalid.
+ */
+bool
+parse_trigger_window(const char *const arg)
+{
+	char *end = NULL;
+	const int n = string_to_uint_ex(arg, &end, INT_MAX, "s");
+
+	if (n <= 0 || (*end && strcmp(end, "s")))
+		return false;
+
+	if (*end) {
+		window_secs = n;
+		window_syscalls = 0;
+	} else {
+		window_syscalls = n;
+		window_secs = 0;
+	}
+
+	return true;
+}
+
+static void
+open_window(void)
+{
+	window_open = true;
+	if (window_secs) {
+		clock_gettime(CLOCK_MONOTONIC, &window_end);
+		window_end.tv_sec += window_secs;
+	} else {
+		window_left = window_syscalls;
+	}
+}
+
+/* Return true if no tracing window is open.  */
+bool
+trigger_quiet(void)
+{
+	if (window_open && window_secs) {
+		struct timespec now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (ts_cmp(&now, &window_end) >= 0)
+			window_open = false;
+	}
+
+	return !window_open;
+}
+
+/*
+ * Return true if the syscall of TCP is filtered out by quiet tracing
+ * without looking at its arguments.
+ */
+bool
+trigger_skips(const struct tcb *const tcp)
+{
+	return triggers_in_use && trigger_quiet()
+	       && !(trigger_syscalls && trigger_syscall_matches(tcp));
+}
+
+/*
+ * Return false if the syscall of TCP, which has passed the other filters,
+ * is filtered out by quiet tracing.  If the trigger depends on the result
+ * of the syscall, set TCB_TRIGGER_EXIT, so it is checked again on exiting.
+ */
+bool
+trigger_entering(struct tcb *const tcp)
+{
+	if (trigger_quiet()) {
+		if (trigger_paths.num_selected
+		    && !pathtrace_match_set(tcp, &trigger_paths))
+			return false;
+		if (trigger_errors_in_use()) {
+			tcp->flags |= TCB_TRIGGER_EXIT;
+			return true;
+		}
+		open_window();
+	}
+
+	if (window_syscalls && --window_left == 0)
+		window_open = false;
+
+	return true;
+}
+
+/* Return false if the finished syscall of TCP has not fired the trigger.  */
+bool
+trigger_exiting(struct tcb *const tcp)
+{
+	if (!trigger_error_matches(tcp))
+		return false;
+
+	if (trigger_quiet())
+		open_window();
+	if (window_syscalls && --window_left == 0)
+		window_open = false;
+
+	return true;
+}
+
+/* Open a tracing window if the signal is a trigger.  */
+void
+trigger_signal(const unsigned int sig)
+{
+	if (trigger_signal_matches(sig) && trigger_quiet())
+		open_window();
+}
@@ -37,7 +37,9 @@
 #include <asm/unistd.h>
 
 #include "scno.h"
+#include "mem_source.h"
 #include "ptrace.h"
+#include "selfprof.h"
 
 static bool process_vm_readv_not_supported;
 
@@ -83,6 +85,7 @@ vm_read_mem(const pid_t pid, void *const laddr,
 		.iov_len = len
 	};
 
+	selfprof_count(SELFPROF_PROCESS_VM_READV);
 	const ssize_t rc = process_vm_readv(pid, &local, 1, &remote, 1, 0);
 	if (rc < 0 && errno == ENOSYS)
 		process_vm_readv_not_supported = true;
@@ -101,6 +104,308 @@ tracee_addr_is_invalid(kernel_ulong_t addr)
 #endif
 }
 
+/*
+ * Read several tracee memory ranges using as few process_vm_readv calls
+ * as possible.  The number of bytes read for each request is stored
+ * in its nread field.  Returns the number of requests read completely.
+ */
+unsigned int
+umoven_batch(struct tcb *const tcp, struct umove_req *const reqs,
+	     const unsigned int nreqs)
+{
+	enum { MAX_BATCH_IOV = 64 };
+	struct iovec local[MAX_BATCH_IOV];
+	struct iovec remote[MAX_BATCH_IOV];
+	unsigned int done = 0;
+	unsigned int i, j;
+
+	for (i = 0; i < nreqs; ++i) {
+		reqs[i].nread = 0;
+		selfprof_read();
+	}
+
+	if (tcp->mem_source) {
+		for (i = 0; i < nreqs; ++i) {
+			reqs[i].nread = mem_source_read(tcp->mem_source,
+							reqs[i].addr,
+							reqs[i].len,
+							reqs[i].laddr);
+			done += reqs[i].nread == reqs[i].len;
+		}
+		return done;
+	}
+
+	for (i = 0; i < nreqs && !process_vm_readv_not_supported; ) {
+		unsigned int n = 0;
+
+		/* Collect the next portion of valid requests. */
+		for (j = i; j < nreqs && n < MAX_BATCH_IOV; ++j) {
+			const unsigned long truncated_addr = reqs[j].addr;
+
+			if (!reqs[j].addr || tracee_addr_is_invalid(reqs[j].addr)
+#if SIZEOF_LONG < SIZEOF_KERNEL_LONG_T
+			    || reqs[j].addr != (kernel_ulong_t) truncated_addr
+#endif
+			   )
+				break;
+			local[n].iov_base = reqs[j].laddr;
+			local[n].iov_len = reqs[j].len;
+			remote[n].iov_base = (void *) truncated_addr;
+			remote[n].iov_len = reqs[j].len;
+			++n;
+		}
+
+		/*
+		 * process_vm_readv stops at the first inaccessible range,
+		 * so repeat the read for the ranges that follow it.
+		 */
+		for (j = 0; j < n; ) {
+			selfprof_count(SELFPROF_PROCESS_VM_READV);
+			ssize_t r = process_vm_readv(tcp->pid, &local[j], n - j,
+						     &remote[j], n - j, 0);
+			if (r < 0) {
+				if (errno == ENOSYS)
+					process_vm_readv_not_supported = true;
+				if (errno != EFAULT)
+					return done;
+				++j;
+				continue;
+			}
+			for (; j < n && (size_t) r >= local[j].iov_len; ++j) {
+				reqs[i + j].nread = local[j].iov_len;
+				r -= local[j].iov_len;
+				++done;
+			}
+			if (j < n) {
+				reqs[i + j].nread = r;
+				++j;
+			}
+		}
+
+		/* Skip the invalid request that has stopped the collection. */
+		i += n;
+		if (!n)
+			++i;
+	}
+
+	if (process_vm_readv_not_supported) {
+		for (; i < nreqs; ++i) {
+			if (!umoven(tcp, reqs[i].addr, reqs[i].len,
+				    reqs[i].laddr)) {
+				reqs[i].nread = reqs[i].len;
+				++done;
+			}
+		}
+	}
+
+	return done;
+}
+
+/*
+ * Snapshot of tracee memory ranges taken in bulk by umove_snapshot()
+ * at the current stop of the tracee.  umoven and umovestr serve reads
+ * that lie within the snapshot without calling process_vm_readv.
+ * The snapshot is discarded when any tracee is restarted.
+ */
+#define MAX_SNAPSHOT_RANGES 8
+
+static struct {
+	int pid;
+	unsigned int nranges;
+	struct {
+		kernel_ulong_t addr;
+		unsigned int len;	/* The number of bytes read. */
+		size_t offset;		/* Offset of the data in buf. */
+	} ranges[MAX_SNAPSHOT_RANGES];
+	char *buf;
+	size_t size;
+} snapshot;
+
+/*
+ * Small cache of whole tracee pages read by umovestr at the current stop,
+ * so that several strings located in the same page, like argv and envp
+ * strings, cost a single process_vm_readv call.  It is invalidated
+ * together with the snapshot.
+ */
+#define PAGE_CACHE_SIZE 4
+
+static struct {
+	int pid;
+	kernel_ulong_t addr;
+} page_cache[PAGE_CACHE_SIZE];
+static char *page_cache_buf;
+static unsigned int page_cache_next;
+
+void
+umove_cache_invalidate(void)
+{
+	unsigned int i;
+
+	snapshot.pid = 0;
+	snapshot.nranges = 0;
+
+	for (i = 0; i < PAGE_CACHE_SIZE; ++i)
+		page_cache[i].pid = 0;
+}
+
+/*
+ * Return the cached copy of the tracee page containing the given address,
+ * NULL if the page is not cached.
+ */
+static const char *
+find_cached_page(const int pid, const kernel_ulong_t addr)
+{
+	const size_t page_size = get_pagesize();
+	const kernel_ulong_t page_addr = addr & ~(kernel_ulong_t) (page_size - 1);
+	unsigned int i;
+
+	for (i = 0; i < PAGE_CACHE_SIZE; ++i) {
+		if (page_cache[i].pid == pid && page_cache[i].addr == page_addr)
+			return page_cache_buf + i * page_size;
+	}
+
+	return NULL;
+}
+
+/*
+ * Read the tracee page containing the given address into the cache.
+ */
+static const char *
+cache_page(const int pid, const kernel_ulong_t addr)
+{
+	const size_t page_size = get_pagesize();
+	const kernel_ulong_t page_addr = addr & ~(kernel_ulong_t) (page_size - 1);
+	const unsigned int i = page_cache_next;
+
+	if (!page_cache_buf)
+		page_cache_buf = xcalloc(PAGE_CACHE_SIZE, page_size);
+
+	char *const buf = page_cache_buf + i * page_size;
+	const ssize_t r = vm_read_mem(pid, buf, page_addr, page_size);
+	if (r != (ssize_t) page_size) {
+		/* A page is either readable or not, report a short read
+		   the same way as an unreadable page.  */
+		if (r >= 0)
+			errno = EFAULT;
+		return NULL;
+	}
+
+	page_cache[i].pid = pid;
+	page_cache[i].addr = page_addr;
+	page_cache_next = (i + 1) % PAGE_CACHE_SIZE;
+
+	return buf;
+}
+
+/*
+ * Return the address of the snapshot copy of tracee memory
+ * at the given address and the number of bytes available there.
+ */
+static const char *
+find_in_snapshot(const int pid, const kernel_ulong_t addr, unsigned int *avail)
+{
+	unsigned int i;
+
+	if (snapshot.pid != pid)
+		return NULL;
+
+	for (i = 0; i < snapshot.nranges; ++i) {
+		if (addr >= snapshot.ranges[i].addr &&
+		    addr - snapshot.ranges[i].addr < snapshot.ranges[i].len) {
+			const unsigned int off = addr - snapshot.ranges[i].addr;
+
+			*avail = snapshot.ranges[i].len - off;
+			return snapshot.buf + snapshot.ranges[i].offset + off;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Add the given ranges to the snapshot of the tracee.  Ranges that are
+ * already in the snapshot of the current stop are kept and not re-read,
+ * older ranges are discarded when there is no room left for new ones.
+ */
+void
+umove_snapshot(struct tcb *const tcp, const struct umove_range *const ranges,
+	       unsigned int nranges)
+{
+	struct umove_req reqs[MAX_SNAPSHOT_RANGES];
+	struct umove_range todo[MAX_SNAPSHOT_RANGES];
+	unsigned int ntodo = 0;
+	unsigned int i;
+
+	if (process_vm_readv_not_supported)
+		return;
+	if (nranges > MAX_SNAPSHOT_RANGES)
+		nranges = MAX_SNAPSHOT_RANGES;
+
+	for (i = 0; i < nranges; ++i) {
+		unsigned int avail;
+
+		if (!ranges[i].len ||
+		    (find_in_snapshot(tcp->pid, ranges[i].addr, &avail) &&
+		     avail >= ranges[i].len))
+			continue;
+		todo[ntodo++] = ranges[i];
+	}
+	if (!ntodo)
+		return;
+
+	if (snapshot.pid != tcp->pid ||
+	    snapshot.nranges + ntodo > MAX_SNAPSHOT_RANGES) {
+		snapshot.pid = 0;
+		snapshot.nranges = 0;
+	}
+
+	const unsigned int first = snapshot.nranges;
+	size_t total = first ? snapshot.ranges[first - 1].offset
+			       + snapshot.ranges[first - 1].len : 0;
+
+	for (i = 0; i < ntodo; ++i) {
+		snapshot.ranges[first + i].addr = todo[i].addr;
+		snapshot.ranges[first + i].offset = total;
+		total += todo[i].len;
+	}
+
+	if (total > snapshot.size) {
+		snapshot.buf = xreallocarray(snapshot.buf, total, 1);
+		snapshot.size = total;
+	}
+	for (i = 0; i < ntodo; ++i) {
+		reqs[i].addr = todo[i].addr;
+		reqs[i].len = todo[i].len;
+		reqs[i].laddr = snapshot.buf + snapshot.ranges[first + i].offset;
+	}
+
+	umoven_batch(tcp, reqs, ntodo);
+
+	for (i = 0; i < ntodo; ++i)
+		snapshot.ranges[first + i].len = reqs[i].nread;
+	snapshot.pid = tcp->pid;
+	snapshot.nranges = first + ntodo;
+}
+
+/*
+ * Snapshot NUL-terminated strings, each up to the end of its page.
+ */
+void
+umove_snapshot_strings(struct tcb *const tcp, const kernel_ulong_t *const addrs,
+		       const unsigned int n)
+{
+	struct umove_range ranges[MAX_SNAPSHOT_RANGES];
+	const size_t page_size = get_pagesize();
+	unsigned int i;
+
+	for (i = 0; i < n && i < MAX_SNAPSHOT_RANGES; ++i) {
+		ranges[i].addr = addrs[i];
+		ranges[i].len = page_size - (addrs[i] & (page_size - 1));
+	}
+
+	umove_snapshot(tcp, ranges, i);
+}
+
 /* legacy method of copying from tracee */
 static int
 umoven_peekdata(const int pid, kernel_ulong_t addr, unsigned int len,
@@ -113,6 +418,7 @@ umoven_peekdata(const int pid, kernel_ulong_t addr, unsigned int len,
 		addr &= -sizeof(long);		/* aligned address */
 
 		errno = 0;
+		selfprof_count(SELFPROF_PTRACE);
 		union {
 			long val;
 			char x[sizeof(long)];
@@ -150,18 +456,33 @@ umoven_peekdata(const int pid, kernel_ulong_t addr, unsigned int len,
 	return 0;
 }
 
-/*
- * Copy `len' bytes of data from process `pid'
- * at address `addr' to our space at `our_addr'.
- */
-int
-umoven(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
-       void *const our_addr)
+static int
+do_umoven(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
+	  void *const our_addr)
 {
 	if (tracee_addr_is_invalid(addr))
 		return -1;
 
+	if (tcp->mem_source)
+		return mem_source_read(tcp->mem_source, addr, len, our_addr)
+		       == len ? 0 : -1;
+
 	const int pid = tcp->pid;
+	unsigned int avail;
+	const char *cached = find_in_snapshot(pid, addr, &avail);
+
+	if (cached && avail >= len) {
+		memcpy(our_addr, cached, len);
+		return 0;
+	}
+
+	const size_t page_size = get_pagesize();
+	const unsigned int page_off = addr & (page_size - 1);
+	if (len <= page_size - page_off &&
+	    (cached = find_cached_page(pid, addr))) {
+		memcpy(our_addr, cached + page_off, len);
+		return 0;
+	}
 
 	if (process_vm_readv_not_supported)
 		return umoven_peekdata(pid, addr, len, our_addr);
@@ -208,6 +529,7 @@ umovestr_peekdata(const int pid, kernel_ulong_t addr, unsigned int len,
 		addr &= -sizeof(long);		/* aligned address */
 
 		errno = 0;
+		selfprof_count(SELFPROF_PTRACE);
 		union {
 			unsigned long val;
 			char x[sizeof(long)];
@@ -248,33 +570,44 @@ umovestr_peekdata(const int pid, kernel_ulong_t addr, unsigned int len,
 	return 0;
 }
 
-/*
- * Like `umove' but make the additional effort of looking
- * for a terminating zero byte.
- *
- * Returns < 0 on error, > 0 if NUL was seen,
- * (TODO if useful: return count of bytes including NUL),
- * else 0 if len bytes were read but no NUL byte seen.
- *
- * Note: there is no guarantee we won't overwrite some bytes
- * in laddr[] _after_ terminating NUL (but, of course,
- * we never write past laddr[len-1]).
- */
-int
-umovestr(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
-	 char *laddr)
+static int
+do_umovestr(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
+	    char *laddr)
 {
 	if (tracee_addr_is_invalid(addr))
 		return -1;
 
+	if (tcp->mem_source)
+		return mem_source_read_str(tcp->mem_source, addr, len, laddr);
+
 	const int pid = tcp->pid;
+	unsigned int avail;
+	const char *cached = find_in_snapshot(pid, addr, &avail);
+
+	unsigned int nread = 0;
+
+	if (cached) {
+		const unsigned int n = MIN(avail, len);
+
+		if (memchr(cached, '\0', n)) {
+			memcpy(laddr, cached, n);
+			return 1;
+		}
+		memcpy(laddr, cached, n);
+		if (n == len)
+			return 0;
+		/* Continue after the end of the snapshot.  */
+		addr += n;
+		laddr += n;
+		nread = n;
+		len -= n;
+	}
 
 	if (process_vm_readv_not_supported)
 		return umovestr_peekdata(pid, addr, len, laddr);
 
 	const size_t page_size = get_pagesize();
 	const size_t page_mask = page_size - 1;
-	unsigned int nread = 0;
 
 	while (len) {
 		/*
@@ -287,16 +620,33 @@ umovestr(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
 		if (chunk_len > end_in_page) /* crosses to the next page */
 			chunk_len -= end_in_page;
 
-		int r = vm_read_mem(pid, laddr, addr, chunk_len);
-		if (r > 0) {
-			if (memchr(laddr, '\0', r))
+		const char *page = find_cached_page(pid, addr);
+		if (!page)
+			page = cache_page(pid, addr);
+
+		if (page) {
+			/*
+			 * Look for NUL in the cached page, so that only
+			 * the string itself is copied.
+			 */
+			const char *const src = page + (addr & page_mask);
+			const char *const nul = memchr(src, '\0', chunk_len);
+
+			if (nul) {
+				memcpy(laddr, src, nul - src + 1);
 				return 1;
-			addr += r;
-			laddr += r;
-			nread += r;
-			len -= r;
+			}
+			memcpy(laddr, src, chunk_len);
+			addr += chunk_len;
+			laddr += chunk_len;
+			nread += chunk_len;
+			len -= chunk_len;
 			continue;
 		}
+		/*
+		 * The page cannot be read, cache_page has left errno set;
+		 * reading a part of the same page would fail the same way.
+		 */
 		switch (errno) {
 			case ENOSYS:
 			case EPERM:
@@ -324,3 +674,76 @@ umovestr(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
 
 	return 0;
 }
+
+/*
+ * Return the local copy of SIZE bytes at OFFSET of the tracee buffer
+ * described by the window, NULL if they cannot be fetched.  The window
+ * is refetched, up to two pages at a time, when the requested bytes
+ * are not in it; SIZE must not exceed the page size.  The copy is valid
+ * until the next call.
+ */
+const void *
+umove_window_get(struct tcb *const tcp, struct umove_window *const w,
+		 const kernel_ulong_t offset, const unsigned int size)
+{
+	if (offset >= w->start && offset - w->start <= w->size &&
+	    size <= w->size - (offset - w->start))
+		return w->buf + (offset - w->start);
+
+	const size_t page_size = get_pagesize();
+
+	if (size > page_size || offset > w->len || size > w->len - offset)
+		return NULL;
+	if (!w->buf)
+		w->buf = tcb_scratch_alloc(tcp, 2 * page_size);
+
+	/* Fetch up to the end of the page next to the one at OFFSET.  */
+	const kernel_ulong_t page_off = (w->addr + offset) & (page_size - 1);
+	const unsigned int n = MIN(w->len - offset, 2 * page_size - page_off);
+
+	w->size = 0;
+	if (umoven(tcp, w->addr + offset, n, w->buf))
+		return NULL;
+
+	w->start = offset;
+	w->size = n;
+	return w->buf;
+}
+
+/*
+ * Copy `len' bytes of data from process `pid'
+ * at address `addr' to our space at `our_addr'.
+ */
+int
+umoven(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
+       void *const our_addr)
+{
+	selfprof_read();
+	selfprof_enter(SELFPROF_UMOVE);
+	const int rc = do_umoven(tcp, addr, len, our_addr);
+	selfprof_leave(SELFPROF_UMOVE);
+	return rc;
+}
+
+/*
+ * Like `umove' but make the additional effort of looking
+ * for a terminating zero byte.
+ *
+ * Returns < 0 on error, > 0 if NUL was seen,
+ * (TODO if useful: return count of bytes including NUL),
+ * else 0 if len bytes were read but no NUL byte seen.
+ *
+ * Note: there is no guarantee we won't overwrite some bytes
+ * in laddr[] _after_ terminating NUL (but, of course,
+ * we never write past laddr[len-1]).
+ */
+int
+umovestr(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
+	 char *laddr)
+{
+	selfprof_read();
+	selfprof_enter(SELFPROF_UMOVE);
+	const int rc = do_umovestr(tcp, addr, len, laddr);
+	selfprof_leave(SELFPROF_UMOVE);
+	return rc;
+}
@@ -26,8 +26,16 @@
  */
 
 #include "defs.h"
+#include <elf.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <libunwind-ptrace.h>
+#include "ptrace.h"
+#include "selfprof.h"
+#include "strintern.h"
+#include "syscall.h"
 
 #ifdef _LARGEFILE64_SOURCE
 # ifdef HAVE_FOPEN64
@@ -45,6 +53,23 @@
 			error_msg("[unwind(" A ")] " F, __VA_ARGS__);	\
 	} while (0)
 
+#define MAX_STACK_DEPTH 256
+
+/* frame pointer register of the frame pointer unwinder */
+#if defined X86_64
+# define FP_UNWIND_REG UNW_X86_64_RBP
+#elif defined I386
+# define FP_UNWIND_REG UNW_X86_EBP
+#elif defined AARCH64
+# define FP_UNWIND_REG UNW_AARCH64_X29
+#endif
+
+/* registers copied by --stack-snapshot */
+#if defined X86_64
+# include <sys/user.h>
+# define STACK_SNAPSHOT_REGS struct user_regs_struct
+#endif
+
 /*
  * Keep a sorted array of cache entries,
  * so that we can binary search through it.
@@ -62,7 +87,61 @@ struct mmap_cache_t {
 	unsigned long start_addr;
 	unsigned long end_addr;
 	unsigned long mmap_offset;
-	char *binary_filename;
+	const char *binary_filename;	/* interned, see get_binary_symbols */
+	struct binary_symbols *symbols;
+};
+
+/*
+ * Symbols resolved by libunwind, cached per mapped binary.
+ *
+ * The result of unw_get_proc_name depends only on the contents
+ * of the binary and the offset of the instruction in that binary,
+ * so the cache is keyed by the device and inode of the file
+ * (as reported in /proc/ID/maps) and by the file offset of the ip.
+ * This way it survives rebuilds of mmap_cache and is shared
+ * by all tracees that map the same binary.
+ *
+ * The list of binaries also interns the file names used in mmap_cache.
+ */
+#define SYMBOL_CACHE_SIZE 1024	/* must be a power of 2 */
+#define BINARY_HASH_SIZE 256
+
+struct symbol_cache_t {
+	unsigned long true_offset;
+	unw_word_t function_offset;
+	char *symbol_name;	/* NULL if the slot is empty */
+};
+
+struct binary_symbols {
+	struct binary_symbols *next;
+	unsigned long dev;
+	unsigned long inode;
+	const char *binary_filename;	/* interned */
+	struct symbol_cache_t *cache;
+	char *build_id;	/* NULL if not read yet */
+	/* symbols of the --stack-cache file, sorted by true_offset */
+	struct symbol_cache_t *stored;
+	unsigned int nstored;
+	bool stored_loaded;
+};
+
+/*
+ * Memory mappings are shared by all threads of a thread group,
+ * so the mmap cache is kept per thread group and is shared
+ * by all its tcbs.  A new thread group (fork) gets a new address space,
+ * execve replaces the mappings and thus invalidates the cache.
+ *
+ * address_space_list is kept in the order of the last stack trace,
+ * when the mmap caches are over their --cache-limit, the caches
+ * of the least recently traced address spaces are dropped.
+ */
+struct address_space_t {
+	struct address_space_t *next;
+	int tgid;
+	unsigned int refcount;
+	struct mmap_cache_t *mmap_cache;	/* NULL if invalid */
+	unsigned int mmap_cache_size;
+	unsigned int mmap_cache_alloc;
 };
 
 /*
@@ -72,7 +151,8 @@ typedef void (*call_action_fn)(void *data,
 			       const char *binary_filename,
 			       const char *symbol_name,
 			       unw_word_t function_offset,
-			       unsigned long true_offset);
+			       unsigned long true_offset,
+			       const char *build_id);
 typedef void (*error_action_fn)(void *data,
 				const char *error,
 				unsigned long true_offset);
@@ -88,21 +168,157 @@ struct call_t {
 struct queue_t {
 	struct call_t *tail;
 	struct call_t *head;
+	struct stack_snapshot_t *snapshot;
 };
 
 static void queue_print(struct queue_t *queue);
-static void delete_mmap_cache(struct tcb *tcp, const char *caller);
+static void delete_mmap_cache(struct address_space_t *as, const char *caller);
+static void put_address_space(struct tcb *tcp);
 
 static unw_addr_space_t libunwind_as;
-static unsigned int mmap_cache_generation;
+static unw_addr_space_t snapshot_as;	/* NULL unless --stack-snapshot */
+static struct address_space_t *address_space_list;
+static struct binary_symbols *binary_symbols_hash[BINARY_HASH_SIZE];
+
+/*
+ * --stack-snapshot copies the registers and the top of the stack
+ * of a tracee at the syscall stop, so that the stack can be unwound
+ * after the tracee is restarted.  Memory outside the copy, that is,
+ * code and unwind tables, is read from the running tracee.
+ */
+struct stack_snapshot_t {
+	bool pending;	/* taken but not printed yet */
+#ifdef STACK_SNAPSHOT_REGS
+	STACK_SNAPSHOT_REGS regs;
+#endif
+	struct umove_req *reqs;	/* a request per page of the copy */
+	unsigned int nreqs;
+	unsigned long stack_start;
+	unsigned long stack_size;
+	char *stack;
+};
+
+/*
+ * The tracee whose snapshot is being unwound.  libunwind passes
+ * the UPT_info of the tracee rather than the cursor argument
+ * to the accessors it calls on its own, so the snapshot cannot be
+ * passed as an argument.
+ */
+static struct tcb *snapshot_tcp;
+
+#ifdef STACK_SNAPSHOT_REGS
+
+static int
+snapshot_access_mem(unw_addr_space_t as, unw_word_t addr, unw_word_t *val,
+		    int write, void *arg)
+{
+	const struct stack_snapshot_t *s = snapshot_tcp->queue->snapshot;
+	struct umove_req req = {
+		.addr = addr,
+		.len = sizeof(*val),
+		.laddr = val
+	};
+
+	if (write)
+		return -UNW_EINVAL;
+
+	if (addr >= s->stack_start &&
+	    addr + sizeof(*val) <= s->stack_start + s->stack_size) {
+		memcpy(val, s->stack + (addr - s->stack_start), sizeof(*val));
+		return 0;
+	}
+
+	return umoven_batch(snapshot_tcp, &req, 1) ? 0 : -UNW_EINVAL;
+}
+
+static int
+snapshot_access_reg(unw_addr_space_t as, unw_regnum_t reg, unw_word_t *val,
+		    int write, void *arg)
+{
+	static const unsigned short offsets[] = {
+		[UNW_X86_64_RAX] = offsetof(struct user_regs_struct, rax),
+		[UNW_X86_64_RDX] = offsetof(struct user_regs_struct, rdx),
+		[UNW_X86_64_RCX] = offsetof(struct user_regs_struct, rcx),
+		[UNW_X86_64_RBX] = offsetof(struct user_regs_struct, rbx),
+		[UNW_X86_64_RSI] = offsetof(struct user_regs_struct, rsi),
+		[UNW_X86_64_RDI] = offsetof(struct user_regs_struct, rdi),
+		[UNW_X86_64_RBP] = offsetof(struct user_regs_struct, rbp),
+		[UNW_X86_64_RSP] = offsetof(struct user_regs_struct, rsp),
+		[UNW_X86_64_R8] = offsetof(struct user_regs_struct, r8),
+		[UNW_X86_64_R9] = offsetof(struct user_regs_struct, r9),
+		[UNW_X86_64_R10] = offsetof(struct user_regs_struct, r10),
+		[UNW_X86_64_R11] = offsetof(struct user_regs_struct, r11),
+		[UNW_X86_64_R12] = offsetof(struct user_regs_struct, r12),
+		[UNW_X86_64_R13] = offsetof(struct user_regs_struct, r13),
+		[UNW_X86_64_R14] = offsetof(struct user_regs_struct, r14),
+		[UNW_X86_64_R15] = offsetof(struct user_regs_struct, r15),
+		[UNW_X86_64_RIP] = offsetof(struct user_regs_struct, rip),
+	};
+	const struct stack_snapshot_t *s = snapshot_tcp->queue->snapshot;
+
+	if (write)
+		return -UNW_EREADONLYREG;
+	if (reg < 0 || (unsigned int) reg >= ARRAY_SIZE(offsets))
+		return -UNW_EBADREG;
+
+	memcpy(val, (const char *) &s->regs + offsets[reg], sizeof(*val));
+	return 0;
+}
+
+static int
+snapshot_access_fpreg(unw_addr_space_t as, unw_regnum_t reg, unw_fpreg_t *val,
+		      int write, void *arg)
+{
+	return -UNW_EBADREG;
+}
+
+static int
+snapshot_resume(unw_addr_space_t as, unw_cursor_t *cursor, void *arg)
+{
+	return -UNW_EINVAL;
+}
+
+static unw_accessors_t snapshot_accessors = {
+	.find_proc_info = _UPT_find_proc_info,
+	.put_unwind_info = _UPT_put_unwind_info,
+	.get_dyn_info_list_addr = _UPT_get_dyn_info_list_addr,
+	.access_mem = snapshot_access_mem,
+	.access_reg = snapshot_access_reg,
+	.access_fpreg = snapshot_access_fpreg,
+	.resume = snapshot_resume,
+	.get_proc_name = _UPT_get_proc_name,
+};
+#endif /* STACK_SNAPSHOT_REGS */
 
 void
 unwind_init(void)
 {
+#ifndef FP_UNWIND_REG
+	if (stack_unwind_fp)
+		error_msg_and_die("frame pointer stack unwinding is not"
+				  " supported on this architecture");
+#endif
+
 	libunwind_as = unw_create_addr_space(&_UPT_accessors, 0);
 	if (!libunwind_as)
 		error_msg_and_die("failed to create address space for stack tracing");
 	unw_set_caching_policy(libunwind_as, UNW_CACHE_GLOBAL);
+
+	if (stack_cache_dir && mkdir(stack_cache_dir, 0755) && errno != EEXIST)
+		perror_msg_and_die("mkdir: %s", stack_cache_dir);
+
+	if (stack_snapshot_size) {
+#ifdef STACK_SNAPSHOT_REGS
+		snapshot_as = unw_create_addr_space(&snapshot_accessors, 0);
+		if (!snapshot_as)
+			error_msg_and_die("failed to create address space"
+					  " for stack tracing");
+		unw_set_caching_policy(snapshot_as, UNW_CACHE_GLOBAL);
+#else
+		error_msg_and_die("stack snapshots are not supported"
+				  " on this architecture");
+#endif
+	}
 }
 
 void
@@ -118,21 +334,354 @@ unwind_tcb_init(struct tcb *tcp)
 	tcp->queue = xmalloc(sizeof(*tcp->queue));
 	tcp->queue->head = NULL;
 	tcp->queue->tail = NULL;
+	tcp->queue->snapshot = NULL;
 }
 
 void
 unwind_tcb_fin(struct tcb *tcp)
 {
+	put_address_space(tcp);
+
+	/* The tcb is initialized on its first stack trace.  */
+	if (!tcp->libunwind_ui)
+		return;
+
 	queue_print(tcp->queue);
+	if (tcp->queue->snapshot) {
+		free(tcp->queue->snapshot->reqs);
+		free(tcp->queue->snapshot->stack);
+		free(tcp->queue->snapshot);
+	}
 	free(tcp->queue);
 	tcp->queue = NULL;
 
-	delete_mmap_cache(tcp, __func__);
-
 	_UPT_destroy(tcp->libunwind_ui);
 	tcp->libunwind_ui = NULL;
 }
 
+static int
+get_tgid(int pid)
+{
+	char filename[sizeof("/proc/4294967296/status")];
+	char buffer[64];
+	int tgid = pid;
+	FILE *fp;
+
+	sprintf(filename, "/proc/%u/status", pid);
+	fp = fopen_for_input(filename, "r");
+	if (!fp)
+		return pid;
+
+	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+		if (sscanf(buffer, "Tgid: %d", &tgid) == 1)
+			break;
+	}
+	fclose(fp);
+
+	return tgid;
+}
+
+static struct address_space_t *
+get_address_space(struct tcb *tcp)
+{
+	struct address_space_t *as;
+	int tgid;
+
+	if (tcp->address_space)
+		return tcp->address_space;
+
+	tgid = get_tgid(tcp->pid);
+	for (as = address_space_list; as; as = as->next) {
+		if (as->tgid == tgid)
+			break;
+	}
+
+	if (!as) {
+		as = xcalloc(1, sizeof(*as));
+		as->tgid = tgid;
+		as->next = address_space_list;
+		address_space_list = as;
+	}
+
+	as->refcount++;
+	tcp->address_space = as;
+
+	return as;
+}
+
+static void
+put_address_space(struct tcb *tcp)
+{
+	struct address_space_t *as = tcp->address_space;
+	struct address_space_t **pas;
+
+	if (!as)
+		return;
+	tcp->address_space = NULL;
+
+	if (--as->refcount)
+		return;
+
+	for (pas = &address_space_list; *pas; pas = &(*pas)->next) {
+		if (*pas == as) {
+			*pas = as->next;
+			break;
+		}
+	}
+	delete_mmap_cache(as, __func__);
+	free(as);
+}
+
+static struct binary_symbols *
+get_binary_symbols(unsigned long dev, unsigned long inode,
+		   const char *binary_filename)
+{
+	struct binary_symbols **bucket =
+		&binary_symbols_hash[(dev ^ inode) % BINARY_HASH_SIZE];
+	struct binary_symbols *b;
+
+	for (b = *bucket; b; b = b->next) {
+		if (b->dev == dev && b->inode == inode &&
+		    !strcmp(b->binary_filename, binary_filename))
+			return b;
+	}
+
+	b = xcalloc(1, sizeof(*b));
+	b->dev = dev;
+	b->inode = inode;
+	b->binary_filename = str_intern(binary_filename);
+	b->next = *bucket;
+	*bucket = b;
+
+	return b;
+}
+
+/*
+ * Return the GNU build-id of the binary in hex, or "" if it has none.
+ */
+static const char *
+get_build_id(struct binary_symbols *b)
+{
+	union {
+		Elf32_Ehdr e32;
+		Elf64_Ehdr e64;
+	} ehdr;
+	union {
+		Elf32_Phdr p32;
+		Elf64_Phdr p64;
+	} phdr;
+	unsigned long phoff, phentsize, phnum, i;
+	struct stat st;
+	bool is64;
+	int fd;
+
+	if (b->build_id)
+		return b->build_id;
+	b->build_id = xstrdup("");
+
+	fd = open(b->binary_filename, O_RDONLY);
+	if (fd < 0)
+		return b->build_id;
+
+	/* the file could have been replaced since it was mapped */
+	if (fstat(fd, &st) || st.st_ino != b->inode ||
+	    pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr) ||
+	    memcmp(ehdr.e32.e_ident, ELFMAG, SELFMAG))
+		goto out;
+
+	is64 = ehdr.e32.e_ident[EI_CLASS] == ELFCLASS64;
+	phoff = is64 ? ehdr.e64.e_phoff : ehdr.e32.e_phoff;
+	phentsize = is64 ? ehdr.e64.e_phentsize : ehdr.e32.e_phentsize;
+	phnum = is64 ? ehdr.e64.e_phnum : ehdr.e32.e_phnum;
+	if (phentsize < (is64 ? sizeof(phdr.p64) : sizeof(phdr.p32)))
+		goto out;
+
+	for (i = 0; i < phnum; ++i) {
+		char notes[1024];
+		unsigned long offset, size, pos;
+
+		if (pread(fd, &phdr, sizeof(phdr), phoff + i * phentsize) <
+		    (ssize_t) (is64 ? sizeof(phdr.p64) : sizeof(phdr.p32)))
+			break;
+		if ((is64 ? phdr.p64.p_type : phdr.p32.p_type) != PT_NOTE)
+			continue;
+
+		offset = is64 ? phdr.p64.p_offset : phdr.p32.p_offset;
+		size = is64 ? phdr.p64.p_filesz : phdr.p32.p_filesz;
+		if (size > sizeof(notes))
+			size = sizeof(notes);
+		if (pread(fd, notes, size, offset) != (ssize_t) size)
+			continue;
+
+		for (pos = 0; pos + sizeof(Elf32_Nhdr) <= size; ) {
+			Elf32_Nhdr nhdr;
+			unsigned long desc, j;
+
+			memcpy(&nhdr, notes + pos, sizeof(nhdr));
+			desc = pos + sizeof(nhdr) + ((nhdr.n_namesz + 3) & ~3U);
+			if (desc + nhdr.n_descsz > size)
+				break;
+
+			if (nhdr.n_type == NT_GNU_BUILD_ID &&
+			    nhdr.n_namesz == sizeof("GNU") &&
+			    !memcmp(notes + pos + sizeof(nhdr), "GNU",
+				    sizeof("GNU"))) {
+				free(b->build_id);
+				b->build_id = xmalloc(nhdr.n_descsz * 2 + 1);
+				for (j = 0; j < nhdr.n_descsz; ++j)
+					sprintf(b->build_id + j * 2, "%02x",
+						(unsigned char) notes[desc + j]);
+				b->build_id[j * 2] = '\0';
+				goto out;
+			}
+
+			pos = desc + ((nhdr.n_descsz + 3) & ~3U);
+		}
+	}
+
+out:
+	close(fd);
+	return b->build_id;
+}
+
+static struct symbol_cache_t *
+get_symbol_cache_slot(struct binary_symbols *b, unsigned long true_offset)
+{
+	if (!b->cache)
+		b->cache = xcalloc(SYMBOL_CACHE_SIZE, sizeof(*b->cache));
+
+	return &b->cache[(true_offset ^ (true_offset >> 10))
+			 & (SYMBOL_CACHE_SIZE - 1)];
+}
+
+/*
+ * Symbols resolved by earlier runs are kept in the --stack-cache directory,
+ * in a file per build-id with "true_offset function_offset symbol_name"
+ * lines.  Lines are appended with a single write, so concurrent runs
+ * can share the directory.
+ */
+static bool
+get_stored_symbols_path(struct binary_symbols *b, char *path, size_t size)
+{
+	const char *build_id = get_build_id(b);
+
+	if (!build_id[0])
+		return false;
+	return (size_t) snprintf(path, size, "%s/%s", stack_cache_dir,
+				 build_id) < size;
+}
+
+static int
+stored_symbol_cmp(const void *a, const void *b)
+{
+	const unsigned long a_offset =
+		((const struct symbol_cache_t *) a)->true_offset;
+	const unsigned long b_offset =
+		((const struct symbol_cache_t *) b)->true_offset;
+
+	return a_offset < b_offset ? -1 : a_offset > b_offset;
+}
+
+static void
+load_stored_symbols(struct binary_symbols *b)
+{
+	char path[PATH_MAX];
+	unsigned int allocated = 0;
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	FILE *fp;
+
+	b->stored_loaded = true;
+	if (!get_stored_symbols_path(b, path, sizeof(path)))
+		return;
+	fp = fopen_for_input(path, "r");
+	if (!fp)
+		return;
+
+	while ((len = getline(&line, &line_size, fp)) > 0) {
+		unsigned long true_offset, function_offset;
+		int name_pos;
+
+		if (line[len - 1] != '\n' ||
+		    sscanf(line, "%lx %lx %n", &true_offset, &function_offset,
+			   &name_pos) != 2)
+			continue;
+		line[len - 1] = '\0';
+
+		if (b->nstored >= allocated) {
+			allocated = allocated ? allocated * 2 : 64;
+			b->stored = xreallocarray(b->stored, allocated,
+						  sizeof(*b->stored));
+		}
+		b->stored[b->nstored].true_offset = true_offset;
+		b->stored[b->nstored].function_offset = function_offset;
+		b->stored[b->nstored].symbol_name = xstrdup(line + name_pos);
+		b->nstored++;
+	}
+
+	free(line);
+	fclose(fp);
+
+	if (b->nstored)
+		qsort(b->stored, b->nstored, sizeof(*b->stored),
+		      stored_symbol_cmp);
+	DPRINTF("%u symbols from %s", "stack-cache", b->nstored, path);
+}
+
+/*
+ * Fill the symbol cache slot from the --stack-cache file.
+ * Returns true if the symbol was found there.
+ */
+static bool
+find_stored_symbol(struct binary_symbols *b, unsigned long true_offset,
+		   struct symbol_cache_t *slot)
+{
+	const struct symbol_cache_t key = { .true_offset = true_offset };
+	const struct symbol_cache_t *found;
+
+	if (!b->stored_loaded)
+		load_stored_symbols(b);
+	if (!b->nstored)
+		return false;
+
+	found = bsearch(&key, b->stored, b->nstored, sizeof(*b->stored),
+			stored_symbol_cmp);
+	if (!found)
+		return false;
+
+	free(slot->symbol_name);
+	slot->symbol_name = xstrdup(found->symbol_name);
+	slot->true_offset = true_offset;
+	slot->function_offset = found->function_offset;
+	return true;
+}
+
+static void
+store_symbol(struct binary_symbols *b, unsigned long true_offset,
+	     unw_word_t function_offset, const char *symbol_name)
+{
+	char path[PATH_MAX];
+	char *line;
+	int fd, len;
+
+	if (!get_stored_symbols_path(b, path, sizeof(path)))
+		return;
+
+	len = asprintf(&line, "%lx %lx %s\n", true_offset,
+		       (unsigned long) function_offset, symbol_name);
+	if (len < 0)
+		error_msg_and_die("error in asprintf");
+
+	fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd >= 0) {
+		if (write(fd, line, len) != len)
+			DPRINTF("short write to %s", "stack-cache", path);
+		close(fd);
+	}
+	free(line);
+}
+
 /*
  * caching of /proc/ID/maps for each process to speed up stack tracing
  *
@@ -142,6 +691,7 @@ unwind_tcb_fin(struct tcb *tcp)
 static void
 build_mmap_cache(struct tcb *tcp)
 {
+	struct address_space_t *as = get_address_space(tcp);
 	FILE *fp;
 	struct mmap_cache_t *cache_head;
 	/* start with a small dynamically-allocated array and then expand it */
@@ -150,6 +700,8 @@ build_mmap_cache(struct tcb *tcp)
 	char buffer[PATH_MAX + 80];
 
 	unw_flush_cache(libunwind_as, 0, 0);
+	if (snapshot_as)
+		unw_flush_cache(snapshot_as, 0, 0);
 
 	sprintf(filename, "/proc/%u/maps", tcp->pid);
 	fp = fopen_for_input(filename, "r");
@@ -163,12 +715,14 @@ build_mmap_cache(struct tcb *tcp)
 	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
 		struct mmap_cache_t *entry;
 		unsigned long start_addr, end_addr, mmap_offset;
+		unsigned long dev_major, dev_minor, inode;
 		char exec_bit;
 		char binary_path[sizeof(buffer)];
 
-		if (sscanf(buffer, "%lx-%lx %*c%*c%c%*c %lx %*x:%*x %*d %[^\n]",
+		if (sscanf(buffer, "%lx-%lx %*c%*c%c%*c %lx %lx:%lx %lu %[^\n]",
 			   &start_addr, &end_addr, &exec_bit,
-			   &mmap_offset, binary_path) != 5)
+			   &mmap_offset, &dev_major, &dev_minor,
+			   &inode, binary_path) != 8)
 			continue;
 
 		/* ignore mappings that have no PROT_EXEC bit set */
@@ -184,8 +738,8 @@ build_mmap_cache(struct tcb *tcp)
 		 * sanity check to make sure that we're storing
 		 * non-overlapping regions in ascending order
 		 */
-		if (tcp->mmap_cache_size > 0) {
-			entry = &cache_head[tcp->mmap_cache_size - 1];
+		if (as->mmap_cache_size > 0) {
+			entry = &cache_head[as->mmap_cache_size - 1];
 			if (entry->start_addr == start_addr &&
 			    entry->end_addr == end_addr) {
 				/* duplicate entry, e.g. [vsyscall] */
@@ -199,62 +753,94 @@ build_mmap_cache(struct tcb *tcp)
 			}
 		}
 
-		if (tcp->mmap_cache_size >= cur_array_size) {
+		if (as->mmap_cache_size >= cur_array_size) {
 			cur_array_size *= 2;
 			cache_head = xreallocarray(cache_head, cur_array_size,
 						   sizeof(*cache_head));
 		}
 
-		entry = &cache_head[tcp->mmap_cache_size];
+		entry = &cache_head[as->mmap_cache_size];
 		entry->start_addr = start_addr;
 		entry->end_addr = end_addr;
 		entry->mmap_offset = mmap_offset;
-		entry->binary_filename = xstrdup(binary_path);
-		tcp->mmap_cache_size++;
+		entry->symbols = get_binary_symbols((dev_major << 20) | dev_minor,
+						    inode, binary_path);
+		entry->binary_filename = entry->symbols->binary_filename;
+		as->mmap_cache_size++;
 	}
 	fclose(fp);
-	tcp->mmap_cache = cache_head;
-	tcp->mmap_cache_generation = mmap_cache_generation;
+	as->mmap_cache = cache_head;
+	as->mmap_cache_alloc = cur_array_size;
+	selfprof_cache_add(SELFPROF_CACHE_MMAP, as->mmap_cache_size,
+			   cur_array_size * sizeof(*cache_head));
 
-	DPRINTF("tgen=%u, ggen=%u, tcp=%p, cache=%p",
+	DPRINTF("tgid=%d, tcp=%p, cache=%p",
 		"cache-build",
-		tcp->mmap_cache_generation,
-		mmap_cache_generation,
-		tcp, tcp->mmap_cache);
+		as->tgid, tcp, as->mmap_cache);
 }
 
 /* deleting the cache */
 static void
-delete_mmap_cache(struct tcb *tcp, const char *caller)
+delete_mmap_cache(struct address_space_t *as, const char *caller)
 {
-	unsigned int i;
-
-	DPRINTF("tgen=%u, ggen=%u, tcp=%p, cache=%p, caller=%s",
+	DPRINTF("tgid=%d, cache=%p, caller=%s",
 		"cache-delete",
-		tcp->mmap_cache_generation,
-		mmap_cache_generation,
-		tcp, tcp->mmap_cache, caller);
+		as->tgid, as->mmap_cache, caller);
+
+	selfprof_cache_add(SELFPROF_CACHE_MMAP, -(long) as->mmap_cache_size,
+			   -(long) (as->mmap_cache_alloc
+				    * sizeof(*as->mmap_cache)));
+	free(as->mmap_cache);
+	as->mmap_cache_alloc = 0;
+	as->mmap_cache = NULL;
+	as->mmap_cache_size = 0;
+}
 
-	for (i = 0; i < tcp->mmap_cache_size; i++) {
-		free(tcp->mmap_cache[i].binary_filename);
-		tcp->mmap_cache[i].binary_filename = NULL;
+/*
+ * Move the address space to the head of address_space_list
+ * and drop the mmap caches of the least recently used address spaces
+ * while the mmap caches are over their limit.
+ */
+static void
+touch_address_space(struct address_space_t *as)
+{
+	struct address_space_t **pas;
+
+	if (address_space_list != as) {
+		for (pas = &address_space_list; *pas != as;
+		     pas = &(*pas)->next)
+			;
+		*pas = as->next;
+		as->next = address_space_list;
+		address_space_list = as;
+	}
+
+	while (selfprof_cache_over_limit(SELFPROF_CACHE_MMAP)) {
+		struct address_space_t *victim = NULL;
+		struct address_space_t *p;
+
+		for (p = as->next; p; p = p->next) {
+			if (p->mmap_cache)
+				victim = p;
+		}
+		if (!victim)
+			break;
+
+		delete_mmap_cache(victim, __func__);
+		selfprof_cache_evicted(SELFPROF_CACHE_MMAP);
 	}
-	free(tcp->mmap_cache);
-	tcp->mmap_cache = NULL;
-	tcp->mmap_cache_size = 0;
 }
 
 static bool
 rebuild_cache_if_invalid(struct tcb *tcp, const char *caller)
 {
-	if ((tcp->mmap_cache_generation != mmap_cache_generation)
-	    && tcp->mmap_cache)
-		delete_mmap_cache(tcp, caller);
+	struct address_space_t *as = get_address_space(tcp);
 
-	if (!tcp->mmap_cache)
+	if (!as->mmap_cache)
 		build_mmap_cache(tcp);
+	touch_address_space(as);
 
-	if (!tcp->mmap_cache || !tcp->mmap_cache_size)
+	if (!as->mmap_cache || !as->mmap_cache_size)
 		return false;
 	else
 		return true;
@@ -269,12 +855,176 @@ unwind_cache_invalidate(struct tcb *tcp)
 		return;
 	}
 #endif
-	mmap_cache_generation++;
-	DPRINTF("tgen=%u, ggen=%u, tcp=%p, cache=%p", "increment",
-		tcp->mmap_cache_generation,
-		mmap_cache_generation,
-		tcp,
-		tcp->mmap_cache);
+	struct address_space_t *as = get_address_space(tcp);
+
+	if (as->mmap_cache)
+		delete_mmap_cache(as, __func__);
+}
+
+/*
+ * Remove [start, end) from the cache,
+ * trimming or splitting the entries it overlaps.
+ * Returns true if the cache has changed.
+ */
+static bool
+punch_mmap_cache(struct address_space_t *as, unsigned long start, unsigned long end)
+{
+	unsigned int i = 0;
+	bool changed = false;
+
+	if (start >= end)
+		return false;
+
+	unw_flush_cache(libunwind_as, start, end);
+	if (snapshot_as)
+		unw_flush_cache(snapshot_as, start, end);
+
+	while (i < as->mmap_cache_size) {
+		struct mmap_cache_t *entry = &as->mmap_cache[i];
+
+		if (entry->end_addr <= start) {
+			i++;
+			continue;
+		}
+		if (entry->start_addr >= end)
+			break;
+
+		changed = true;
+		if (entry->start_addr < start && entry->end_addr > end) {
+			/* the hole is in the middle of the entry */
+			struct mmap_cache_t *tail;
+
+			if (as->mmap_cache_size >= as->mmap_cache_alloc) {
+				selfprof_cache_add(SELFPROF_CACHE_MMAP, 0,
+						   sizeof(*as->mmap_cache));
+				as->mmap_cache =
+					xreallocarray(as->mmap_cache,
+						      ++as->mmap_cache_alloc,
+						      sizeof(*as->mmap_cache));
+			}
+			entry = &as->mmap_cache[i];
+			memmove(entry + 1, entry, (as->mmap_cache_size - i) *
+						  sizeof(*entry));
+			as->mmap_cache_size++;
+			selfprof_cache_add(SELFPROF_CACHE_MMAP, 1, 0);
+
+			tail = entry + 1;
+			tail->mmap_offset += end - tail->start_addr;
+			tail->start_addr = end;
+			entry->end_addr = start;
+			break;
+		}
+
+		if (entry->start_addr < start) {
+			entry->end_addr = start;
+			i++;
+		} else if (entry->end_addr > end) {
+			entry->mmap_offset += end - entry->start_addr;
+			entry->start_addr = end;
+			break;
+		} else {
+			memmove(entry, entry + 1,
+				(as->mmap_cache_size - i - 1) * sizeof(*entry));
+			as->mmap_cache_size--;
+			selfprof_cache_add(SELFPROF_CACHE_MMAP, -1, 0);
+		}
+	}
+
+	return changed;
+}
+
+static bool
+mmap_cache_overlaps(const struct address_space_t *as,
+		    unsigned long start, unsigned long end)
+{
+	unsigned int i;
+
+	for (i = 0; i < as->mmap_cache_size; i++) {
+		if (as->mmap_cache[i].start_addr >= end)
+			break;
+		if (as->mmap_cache[i].end_addr > start)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Apply the effect of a decoded memory mapping syscall to the cache.
+ * Only executable file mappings are cached, so every change that cannot
+ * create such a mapping is just a hole punched in the cache.
+ *
+ * Returns false if the cache has to be rebuilt.
+ */
+static bool
+update_mmap_cache(struct tcb *tcp, struct address_space_t *as)
+{
+	const unsigned long page_mask = get_pagesize() - 1;
+	const kernel_ulong_t addr = tcp->u_arg[0];
+	const kernel_ulong_t len = (tcp->u_arg[1] + page_mask) & ~page_mask;
+	kernel_ulong_t start, end;
+
+	switch (tcp->s_ent->sen) {
+	case SEN_brk:
+		/* the heap is not an executable file mapping */
+		return true;
+	case SEN_mmap:
+	case SEN_mmap_4koff:
+	case SEN_mmap_pgoff:
+		if (syserror(tcp))
+			return true;
+		if ((tcp->u_arg[2] & PROT_EXEC) &&
+		    !(tcp->u_arg[3] & MAP_ANONYMOUS))
+			return false;
+		start = tcp->u_rval;
+		end = start + len;
+		break;
+	case SEN_munmap:
+		if (syserror(tcp))
+			return true;
+		start = addr;
+		end = addr + len;
+		break;
+	case SEN_mprotect:
+	case SEN_pkey_mprotect:
+		/* mprotect may fail after changing a part of the range */
+		if (syserror(tcp) || (tcp->u_arg[2] & PROT_EXEC))
+			return false;
+		start = addr;
+		end = addr + len;
+		break;
+	case SEN_mremap:
+		if (syserror(tcp))
+			return true;
+		/* moving a cached mapping needs its new place in the cache */
+		if (mmap_cache_overlaps(as, addr, addr + len))
+			return false;
+		start = tcp->u_rval;
+		end = start + ((tcp->u_arg[2] + page_mask) & ~page_mask);
+		break;
+	default:
+		return false;
+	}
+
+	if (punch_mmap_cache(as, start, end))
+		DPRINTF("tgid=%d, tcp=%p, cache=%p", "update",
+			as->tgid, tcp, as->mmap_cache);
+	return true;
+}
+
+void
+unwind_cache_update(struct tcb *tcp)
+{
+#if SUPPORTED_PERSONALITIES > 1
+	if (tcp->currpers != DEFAULT_PERSONALITY) {
+		/* disable strack trace */
+		return;
+	}
+#endif
+	struct address_space_t *as = get_address_space(tcp);
+
+	if (as->mmap_cache && !update_mmap_cache(tcp, as))
+		delete_mmap_cache(as, __func__);
 }
 
 static void
@@ -295,98 +1045,467 @@ get_symbol_name(unw_cursor_t *cursor, char **name,
 	}
 }
 
+static const struct mmap_cache_t *
+find_mmap_cache_entry(const struct address_space_t *as, unsigned long ip)
+{
+	int lower = 0;
+	int upper = (int) as->mmap_cache_size - 1;
+
+	while (lower <= upper) {
+		int mid = (upper + lower) / 2;
+		const struct mmap_cache_t *entry = &as->mmap_cache[mid];
+
+		if (ip >= entry->start_addr && ip < entry->end_addr)
+			return entry;
+		else if (ip < entry->start_addr)
+			upper = mid - 1;
+		else
+			lower = mid + 1;
+	}
+
+	return NULL;
+}
+
+/*
+ * Print the frame of ip.  If cursor is NULL, only cached symbols
+ * are printed, other frames are left for offline symbolization.
+ */
 static int
 print_stack_frame(struct tcb *tcp,
 		  call_action_fn call_action,
 		  error_action_fn error_action,
 		  void *data,
 		  unw_cursor_t *cursor,
+		  unw_word_t ip,
 		  char **symbol_name,
 		  size_t *symbol_name_size)
 {
-	unw_word_t ip;
-	int lower = 0;
-	int upper = (int) tcp->mmap_cache_size - 1;
+	const struct mmap_cache_t *cur_mmap_cache =
+		find_mmap_cache_entry(tcp->address_space, ip);
 
-	if (unw_get_reg(cursor, UNW_REG_IP, &ip) < 0) {
-		perror_msg("Can't walk the stack of process %d", tcp->pid);
+	if (!cur_mmap_cache) {
+		/*
+		 * there is a bug in libunwind >= 1.0
+		 * after a set_tid_address syscall
+		 * unw_get_reg returns IP == 0
+		 */
+		if (ip)
+			error_action(data, "unexpected_backtracing_error", ip);
 		return -1;
 	}
 
-	while (lower <= upper) {
-		struct mmap_cache_t *cur_mmap_cache;
-		int mid = (upper + lower) / 2;
-
-		cur_mmap_cache = &tcp->mmap_cache[mid];
-
-		if (ip >= cur_mmap_cache->start_addr &&
-		    ip < cur_mmap_cache->end_addr) {
-			unsigned long true_offset;
-			unw_word_t function_offset;
+	unsigned long true_offset;
+	unw_word_t function_offset;
+	struct symbol_cache_t *slot = NULL;
+
+	true_offset = ip - cur_mmap_cache->start_addr +
+		cur_mmap_cache->mmap_offset;
+
+	/* symbols are resolved by strace-symbolize */
+	if (stack_offline) {
+		call_action(data,
+			    cur_mmap_cache->binary_filename,
+			    NULL, 0, true_offset,
+			    cur_mmap_cache->symbols->inode
+			    ? get_build_id(cur_mmap_cache->symbols) : NULL);
+		return 0;
+	}
 
-			get_symbol_name(cursor, symbol_name, symbol_name_size,
-					&function_offset);
-			true_offset = ip - cur_mmap_cache->start_addr +
-				cur_mmap_cache->mmap_offset;
+	/* anonymous mappings like [vdso] have no inode */
+	if (cur_mmap_cache->symbols->inode) {
+		slot = get_symbol_cache_slot(cur_mmap_cache->symbols,
+					     true_offset);
+		if ((slot->symbol_name &&
+		     slot->true_offset == true_offset) ||
+		    (stack_cache_dir &&
+		     find_stored_symbol(cur_mmap_cache->symbols,
+					true_offset, slot))) {
 			call_action(data,
 				    cur_mmap_cache->binary_filename,
-				    *symbol_name,
-				    function_offset,
-				    true_offset);
+				    slot->symbol_name,
+				    slot->function_offset,
+				    true_offset, NULL);
 			return 0;
-		} else if (ip < cur_mmap_cache->start_addr)
-			upper = mid - 1;
-		else
-			lower = mid + 1;
+		}
 	}
 
-	/*
-	 * there is a bug in libunwind >= 1.0
-	 * after a set_tid_address syscall
-	 * unw_get_reg returns IP == 0
-	 */
-	if (ip)
-		error_action(data, "unexpected_backtracing_error", ip);
-	return -1;
+	if (!cursor) {
+		call_action(data,
+			    cur_mmap_cache->binary_filename,
+			    NULL, 0, true_offset, NULL);
+		return 0;
+	}
+
+	get_symbol_name(cursor, symbol_name, symbol_name_size,
+			&function_offset);
+
+	if (slot) {
+		free(slot->symbol_name);
+		slot->symbol_name = xstrdup(*symbol_name);
+		slot->true_offset = true_offset;
+		slot->function_offset = function_offset;
+		if (stack_cache_dir)
+			store_symbol(cur_mmap_cache->symbols, true_offset,
+				     function_offset, *symbol_name);
+	}
+
+	call_action(data,
+		    cur_mmap_cache->binary_filename,
+		    *symbol_name,
+		    function_offset,
+		    true_offset, NULL);
+	return 0;
 }
 
+#ifdef FP_UNWIND_REG
 /*
- * walking the stack
+ * Tracee stack memory read in bulk for the frame pointer unwinder.
+ */
+#define STACK_CHUNK_PAGES 4
+
+struct stack_chunk_t {
+	unsigned long start;
+	unsigned long size;
+	char *buf;
+};
+
+/* Read a word of the tracee stack, refilling the chunk if necessary. */
+static bool
+read_stack_word(struct tcb *tcp, struct stack_chunk_t *chunk,
+		unsigned long addr, unsigned long *value)
+{
+	if (addr < chunk->start ||
+	    addr + sizeof(*value) > chunk->start + chunk->size) {
+		const unsigned long page_size = get_pagesize();
+		struct umove_req reqs[STACK_CHUNK_PAGES];
+		unsigned int i;
+
+		if (!chunk->buf)
+			chunk->buf = xmalloc(STACK_CHUNK_PAGES * page_size);
+
+		chunk->start = addr & ~(page_size - 1);
+		chunk->size = 0;
+		for (i = 0; i < STACK_CHUNK_PAGES; ++i) {
+			reqs[i].addr = chunk->start + i * page_size;
+			reqs[i].len = page_size;
+			reqs[i].laddr = chunk->buf + i * page_size;
+		}
+		umoven_batch(tcp, reqs, STACK_CHUNK_PAGES);
+		/* the chunk ends at the first page that cannot be read */
+		for (i = 0; i < STACK_CHUNK_PAGES; ++i) {
+			chunk->size += reqs[i].nread;
+			if (reqs[i].nread != page_size)
+				break;
+		}
+
+		if (addr + sizeof(*value) > chunk->start + chunk->size)
+			return false;
+	}
+
+	memcpy(value, chunk->buf + (addr - chunk->start), sizeof(*value));
+	return true;
+}
+
+/*
+ * Walk the chain of frame records {saved frame pointer, return address}
+ * that binaries built with frame pointers maintain on the stack.
+ * Returns the number of instruction pointers stored in ips.
  */
+static unsigned int
+get_stack_ips_fp(struct tcb *tcp, unw_cursor_t *cursor, unw_word_t *ips)
+{
+	struct stack_chunk_t chunk = { .buf = NULL };
+	unw_word_t ip, fp;
+	unsigned int n;
+
+	if (unw_get_reg(cursor, UNW_REG_IP, &ip) < 0 ||
+	    unw_get_reg(cursor, FP_UNWIND_REG, &fp) < 0) {
+		perror_msg("Can't walk the stack of process %d", tcp->pid);
+		return 0;
+	}
+
+	for (n = 0; n < MAX_STACK_DEPTH; ) {
+		unsigned long next_fp, ret;
+
+		ips[n++] = ip;
+
+		/* the stack grows down, caller frames are above */
+		if (!fp || (fp & (sizeof(fp) - 1)) ||
+		    !read_stack_word(tcp, &chunk, fp, &next_fp) ||
+		    !read_stack_word(tcp, &chunk, fp + sizeof(fp), &ret) ||
+		    !ret || next_fp <= fp)
+			break;
+
+		ip = ret;
+		fp = next_fp;
+	}
+
+	free(chunk.buf);
+	return n;
+}
+#else /* !FP_UNWIND_REG */
+static unsigned int
+get_stack_ips_fp(struct tcb *tcp, unw_cursor_t *cursor, unw_word_t *ips)
+{
+	return 0;
+}
+#endif /* FP_UNWIND_REG */
+
+static unsigned int
+get_stack_ips(struct tcb *tcp, unw_cursor_t *cursor, unw_word_t *ips)
+{
+	unsigned int n;
+
+	if (stack_unwind_fp)
+		return get_stack_ips_fp(tcp, cursor, ips);
+
+	for (n = 0; n < MAX_STACK_DEPTH; ) {
+		if (unw_get_reg(cursor, UNW_REG_IP, &ips[n]) < 0) {
+			perror_msg("Can't walk the stack of process %d",
+				   tcp->pid);
+			break;
+		}
+		++n;
+		if (unw_step(cursor) <= 0)
+			break;
+	}
+
+	return n;
+}
+
+/*
+ * Table of unique stacks for --stack-dedup.  Frames are stored as
+ * binary and file offset pairs, so the same code path gets the same id
+ * regardless of the process and the addresses its binaries are mapped at.
+ */
+struct stack_frame_t {
+	const struct binary_symbols *binary;	/* NULL if not mapped */
+	unsigned long offset;
+};
+
+struct stack_t {
+	struct stack_t *next;
+	unsigned int id;
+	unsigned int depth;
+	struct stack_frame_t *frames;
+	/* names of frames for unwind_print_folded_stack */
+	char **names;
+	unsigned int nnames;
+};
+
+static struct stack_t **stack_hash;
+static unsigned int stack_hash_size;
+static unsigned int nstacks;
+static struct stack_t **stacks;	/* indexed by id - 1 */
+
+static unsigned int
+stack_frames_hash(const struct stack_frame_t *frames, unsigned int depth)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;	/* FNV-1a */
+	unsigned int i;
+
+	for (i = 0; i < depth; ++i) {
+		h = (h ^ (uintptr_t) frames[i].binary) * 0x100000001b3ULL;
+		h = (h ^ frames[i].offset) * 0x100000001b3ULL;
+	}
+
+	return h ^ (h >> 32);
+}
+
 static void
-stacktrace_walk(struct tcb *tcp,
-		call_action_fn call_action,
-		error_action_fn error_action,
-		void *data)
+grow_stack_hash(void)
+{
+	const unsigned int new_size = stack_hash_size ? stack_hash_size * 2
+						      : 256;
+	struct stack_t **new_hash = xcalloc(new_size, sizeof(*new_hash));
+	unsigned int i;
+
+	for (i = 0; i < stack_hash_size; ++i) {
+		struct stack_t *st, *next;
+
+		for (st = stack_hash[i]; st; st = next) {
+			const unsigned int j =
+				stack_frames_hash(st->frames, st->depth) &
+				(new_size - 1);
+
+			next = st->next;
+			st->next = new_hash[j];
+			new_hash[j] = st;
+		}
+	}
+
+	free(stack_hash);
+	stack_hash = new_hash;
+	selfprof_cache_add(SELFPROF_CACHE_STACKS, 0,
+			   (long) (new_size - stack_hash_size)
+			   * (sizeof(*stack_hash) + sizeof(*stacks)));
+	stack_hash_size = new_size;
+}
+
+/*
+ * Return the stack of the given instruction pointers,
+ * adding it to the table if it is new.
+ */
+static struct stack_t *
+get_stack(struct tcb *tcp, const unw_word_t *ips, unsigned int depth,
+	  bool *is_new)
+{
+	struct stack_frame_t frames[MAX_STACK_DEPTH];
+	struct stack_t *st;
+	unsigned int i, h;
+
+	for (i = 0; i < depth; ++i) {
+		const struct mmap_cache_t *entry =
+			find_mmap_cache_entry(tcp->address_space, ips[i]);
+
+		if (entry) {
+			frames[i].binary = entry->symbols;
+			frames[i].offset = ips[i] - entry->start_addr +
+					   entry->mmap_offset;
+		} else {
+			frames[i].binary = NULL;
+			frames[i].offset = ips[i];
+		}
+	}
+
+	h = stack_frames_hash(frames, depth);
+	if (stack_hash_size) {
+		for (st = stack_hash[h & (stack_hash_size - 1)]; st;
+		     st = st->next) {
+			if (st->depth == depth &&
+			    !memcmp(st->frames, frames,
+				    depth * sizeof(frames[0]))) {
+				*is_new = false;
+				return st;
+			}
+		}
+	}
+
+	if (nstacks >= stack_hash_size) {
+		grow_stack_hash();
+		stacks = xreallocarray(stacks, stack_hash_size,
+				       sizeof(*stacks));
+	}
+
+	st = xcalloc(1, sizeof(*st));
+	stacks[nstacks] = st;
+	st->id = ++nstacks;
+	st->depth = depth;
+	st->frames = xcalloc(depth, sizeof(frames[0]));
+	memcpy(st->frames, frames, depth * sizeof(frames[0]));
+	st->next = stack_hash[h & (stack_hash_size - 1)];
+	stack_hash[h & (stack_hash_size - 1)] = st;
+	selfprof_cache_add(SELFPROF_CACHE_STACKS, 1,
+			   sizeof(*st) + depth * sizeof(frames[0]));
+
+	*is_new = true;
+	return st;
+}
+
+/*
+ * Walk the stack whose instruction pointers are in ips if the frame
+ * pointer unwinder is used, unwind it with the cursor otherwise.
+ */
+static void
+stacktrace_walk_frames(struct tcb *tcp,
+		       call_action_fn call_action,
+		       error_action_fn error_action,
+		       void *data,
+		       unw_cursor_t *cursor,
+		       const unw_word_t *ips,
+		       unsigned int depth)
 {
 	char *symbol_name;
 	size_t symbol_name_size = 40;
-	unw_cursor_t cursor;
 	int stack_depth;
 
-	if (!tcp->mmap_cache)
-		error_msg_and_die("bug: mmap_cache is NULL");
-	if (tcp->mmap_cache_size == 0)
-		error_msg_and_die("bug: mmap_cache is empty");
+	if (stack_unwind_fp) {
+		unsigned int i;
+
+		for (i = 0; i < depth; ++i) {
+			if (print_stack_frame(tcp, call_action, error_action,
+					      data, NULL, ips[i],
+					      NULL, NULL) < 0)
+				break;
+		}
+		if (depth >= MAX_STACK_DEPTH)
+			error_action(data, "too many stack frames", 0);
+		return;
+	}
 
 	symbol_name = xmalloc(symbol_name_size);
 
-	if (unw_init_remote(&cursor, libunwind_as, tcp->libunwind_ui) < 0)
-		perror_msg_and_die("Can't initiate libunwind");
+	for (stack_depth = 0; stack_depth < MAX_STACK_DEPTH; ++stack_depth) {
+		unw_word_t ip;
 
-	for (stack_depth = 0; stack_depth < 256; ++stack_depth) {
+		if (unw_get_reg(cursor, UNW_REG_IP, &ip) < 0) {
+			perror_msg("Can't walk the stack of process %d",
+				   tcp->pid);
+			break;
+		}
 		if (print_stack_frame(tcp, call_action, error_action, data,
-				&cursor, &symbol_name, &symbol_name_size) < 0)
+				cursor, ip, &symbol_name, &symbol_name_size) < 0)
 			break;
-		if (unw_step(&cursor) <= 0)
+		if (unw_step(cursor) <= 0)
 			break;
 	}
-	if (stack_depth >= 256)
+	if (stack_depth >= MAX_STACK_DEPTH)
 		error_action(data, "too many stack frames", 0);
 
 	free(symbol_name);
 }
 
+static void
+init_cursor(struct tcb *tcp, unw_cursor_t *cursor)
+{
+	if (!tcp->address_space || !tcp->address_space->mmap_cache)
+		error_msg_and_die("bug: mmap_cache is NULL");
+	if (tcp->address_space->mmap_cache_size == 0)
+		error_msg_and_die("bug: mmap_cache is empty");
+
+	if (unw_init_remote(cursor, snapshot_tcp ? snapshot_as : libunwind_as,
+			    tcp->libunwind_ui) < 0)
+		perror_msg_and_die("Can't initiate libunwind");
+}
+
+/*
+ * walking the stack
+ */
+static void
+stacktrace_walk(struct tcb *tcp,
+		call_action_fn call_action,
+		error_action_fn error_action,
+		void *data)
+{
+	unw_cursor_t cursor;
+	unw_word_t ips[MAX_STACK_DEPTH];
+	unsigned int depth = 0;
+
+	init_cursor(tcp, &cursor);
+
+	if (stack_dedup || stack_unwind_fp)
+		depth = get_stack_ips(tcp, &cursor, ips);
+
+	if (stack_dedup) {
+		/* "stack 4294967295:" */
+		char id_str[sizeof("stack ") + sizeof(int) * 3 + 1];
+		bool is_new;
+		const struct stack_t *st = get_stack(tcp, ips, depth, &is_new);
+
+		sprintf(id_str, is_new ? "stack %u:" : "stack %u", st->id);
+		error_action(data, id_str, 0);
+		if (!is_new)
+			return;
+
+		/* symbols are resolved when the stack is unwound again */
+		if (!stack_unwind_fp)
+			init_cursor(tcp, &cursor);
+	}
+
+	stacktrace_walk_frames(tcp, call_action, error_action, data,
+			       &cursor, ips, depth);
+}
+
 /*
  * printing an entry in stack to stream or buffer
  */
@@ -408,6 +1527,9 @@ stacktrace_walk(struct tcb *tcp,
 #define STACK_ENTRY_NOSYMBOL_FMT		\
 	" > %s() [0x%lx]\n",			\
 	binary_filename, true_offset
+#define STACK_ENTRY_BUILD_ID_FMT		\
+	" > %s() [0x%lx] build-id=%s\n",	\
+	binary_filename, true_offset, build_id
 #define STACK_ENTRY_BUG_FMT			\
 	" > BUG IN %s\n"
 #define STACK_ENTRY_ERROR_WITH_OFFSET_FMT	\
@@ -420,10 +1542,13 @@ print_call_cb(void *dummy,
 	      const char *binary_filename,
 	      const char *symbol_name,
 	      unw_word_t function_offset,
-	      unsigned long true_offset)
+	      unsigned long true_offset,
+	      const char *build_id)
 {
 	if (symbol_name && (symbol_name[0] != '\0'))
 		tprintf(STACK_ENTRY_SYMBOL_FMT);
+	else if (binary_filename && build_id && build_id[0])
+		tprintf(STACK_ENTRY_BUILD_ID_FMT);
 	else if (binary_filename)
 		tprintf(STACK_ENTRY_NOSYMBOL_FMT);
 	else
@@ -450,6 +1575,7 @@ sprint_call_or_error(const char *binary_filename,
 		     const char *symbol_name,
 		     unw_word_t function_offset,
 		     unsigned long true_offset,
+		     const char *build_id,
 		     const char *error)
 {
 	char *output_line = NULL;
@@ -457,6 +1583,8 @@ sprint_call_or_error(const char *binary_filename,
 
 	if (symbol_name)
 		n = asprintf(&output_line, STACK_ENTRY_SYMBOL_FMT);
+	else if (binary_filename && build_id && build_id[0])
+		n = asprintf(&output_line, STACK_ENTRY_BUILD_ID_FMT);
 	else if (binary_filename)
 		n = asprintf(&output_line, STACK_ENTRY_NOSYMBOL_FMT);
 	else if (error)
@@ -481,6 +1609,7 @@ queue_put(struct queue_t *queue,
 	  const char *symbol_name,
 	  unw_word_t function_offset,
 	  unsigned long true_offset,
+	  const char *build_id,
 	  const char *error)
 {
 	struct call_t *call;
@@ -490,6 +1619,7 @@ queue_put(struct queue_t *queue,
 						 symbol_name,
 						 function_offset,
 						 true_offset,
+						 build_id,
 						 error);
 	call->next = NULL;
 
@@ -507,13 +1637,15 @@ queue_put_call(void *queue,
 	       const char *binary_filename,
 	       const char *symbol_name,
 	       unw_word_t function_offset,
-	       unsigned long true_offset)
+	       unsigned long true_offset,
+	       const char *build_id)
 {
 	queue_put(queue,
 		  binary_filename,
 		  symbol_name,
 		  function_offset,
 		  true_offset,
+		  build_id,
 		  NULL);
 }
 
@@ -522,7 +1654,7 @@ queue_put_error(void *queue,
 		const char *error,
 		unsigned long ip)
 {
-	queue_put(queue, NULL, NULL, 0, ip, error);
+	queue_put(queue, NULL, NULL, 0, ip, NULL, error);
 }
 
 static void
@@ -547,6 +1679,51 @@ queue_print(struct queue_t *queue)
 	}
 }
 
+/*
+ * copying the registers and the top of the stack for --stack-snapshot
+ */
+static bool
+take_stack_snapshot(struct tcb *tcp)
+{
+#ifdef STACK_SNAPSHOT_REGS
+	const unsigned long page_size = get_pagesize();
+	struct stack_snapshot_t *s = tcp->queue->snapshot;
+	unsigned int i;
+
+	if (!s) {
+		s = xcalloc(1, sizeof(*s));
+		s->nreqs = (stack_snapshot_size + page_size - 1) / page_size;
+		s->reqs = xcalloc(s->nreqs, sizeof(*s->reqs));
+		s->stack = xmalloc(s->nreqs * page_size);
+		for (i = 0; i < s->nreqs; ++i) {
+			s->reqs[i].len = page_size;
+			s->reqs[i].laddr = s->stack + i * page_size;
+		}
+		tcp->queue->snapshot = s;
+	}
+
+	if (ptrace(PTRACE_GETREGS, tcp->pid, NULL, &s->regs) < 0)
+		return false;
+
+	s->stack_start = s->regs.rsp & ~(page_size - 1);
+	s->stack_size = 0;
+	for (i = 0; i < s->nreqs; ++i)
+		s->reqs[i].addr = s->stack_start + i * page_size;
+	umoven_batch(tcp, s->reqs, s->nreqs);
+	/* the copy ends at the first page that cannot be read */
+	for (i = 0; i < s->nreqs; ++i) {
+		s->stack_size += s->reqs[i].nread;
+		if (s->reqs[i].nread != page_size)
+			break;
+	}
+
+	s->pending = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
 /*
  * printing stack
  */
@@ -559,15 +1736,42 @@ unwind_print_stacktrace(struct tcb *tcp)
 		return;
 	}
 #endif
+	unwind_tcb_init(tcp);
 	if (tcp->queue->head) {
 		DPRINTF("tcp=%p, queue=%p", "queueprint", tcp, tcp->queue->head);
 		queue_print(tcp->queue);
 	} else if (rebuild_cache_if_invalid(tcp, __func__)) {
+		if (stack_snapshot_size && take_stack_snapshot(tcp)) {
+			DPRINTF("tcp=%p, stack=%#lx", "snapshot", tcp,
+				tcp->queue->snapshot->stack_start);
+			return;
+		}
 		DPRINTF("tcp=%p, queue=%p", "stackprint", tcp, tcp->queue->head);
 		stacktrace_walk(tcp, print_call_cb, print_error_cb, NULL);
 	}
 }
 
+/*
+ * printing the stack of a snapshot taken by unwind_print_stacktrace,
+ * called when the tracee has been restarted
+ */
+void
+unwind_print_snapshot(struct tcb *tcp)
+{
+	if (!tcp->queue)
+		return;
+
+	struct stack_snapshot_t *s = tcp->queue->snapshot;
+
+	if (!s || !s->pending)
+		return;
+	s->pending = false;
+
+	snapshot_tcp = tcp;
+	stacktrace_walk(tcp, print_call_cb, print_error_cb, NULL);
+	snapshot_tcp = NULL;
+}
+
 /*
  * capturing stack
  */
@@ -580,6 +1784,7 @@ unwind_capture_stacktrace(struct tcb *tcp)
 		return;
 	}
 #endif
+	unwind_tcb_init(tcp);
 	if (tcp->queue->head)
 		error_msg_and_die("bug: unprinted entries in queue");
 
@@ -589,3 +1794,105 @@ unwind_capture_stacktrace(struct tcb *tcp)
 		DPRINTF("tcp=%p, queue=%p", "captured", tcp, tcp->queue->head);
 	}
 }
+
+/*
+ * Stack ids for -c statistics
+ */
+static void
+add_frame_name(struct stack_t *st, char *name)
+{
+	st->names = xreallocarray(st->names, st->nnames + 1,
+				  sizeof(*st->names));
+	st->names[st->nnames++] = name;
+	selfprof_cache_add(SELFPROF_CACHE_STACKS, 0,
+			   sizeof(*st->names) + strlen(name) + 1);
+}
+
+static void
+name_call_cb(void *data,
+	     const char *binary_filename,
+	     const char *symbol_name,
+	     unw_word_t function_offset,
+	     unsigned long true_offset,
+	     const char *build_id)
+{
+	char *name;
+
+	if (symbol_name && symbol_name[0] != '\0')
+		name = xstrdup(symbol_name);
+	else if (asprintf(&name, "%s+0x%lx",
+			  binary_filename ? binary_filename : "?",
+			  true_offset) < 0)
+		error_msg_and_die("error in asprintf");
+
+	add_frame_name(data, name);
+}
+
+static void
+name_error_cb(void *data,
+	      const char *error,
+	      unsigned long true_offset)
+{
+	char *name;
+
+	if (asprintf(&name, "[0x%lx]", true_offset) < 0)
+		error_msg_and_die("error in asprintf");
+
+	add_frame_name(data, name);
+}
+
+/*
+ * Return the id of the current stack of the tracee, 0 if it is unknown.
+ */
+unsigned int
+unwind_stack_id(struct tcb *tcp)
+{
+#if SUPPORTED_PERSONALITIES > 1
+	if (tcp->currpers != DEFAULT_PERSONALITY) {
+		/* disable strack trace */
+		return 0;
+	}
+#endif
+	unw_cursor_t cursor;
+	unw_word_t ips[MAX_STACK_DEPTH];
+	unsigned int depth;
+	bool is_new;
+
+	if (!rebuild_cache_if_invalid(tcp, __func__))
+		return 0;
+
+	unwind_tcb_init(tcp);
+	init_cursor(tcp, &cursor);
+	depth = get_stack_ips(tcp, &cursor, ips);
+
+	struct stack_t *st = get_stack(tcp, ips, depth, &is_new);
+
+	if (is_new) {
+		if (!stack_unwind_fp)
+			init_cursor(tcp, &cursor);
+		stacktrace_walk_frames(tcp, name_call_cb, name_error_cb, st,
+				       &cursor, ips, depth);
+	}
+
+	return st->id;
+}
+
+/*
+ * Print the frames of the stack in the folded format of flame graph tools:
+ * function names separated by semicolons, the outermost frame first.
+ */
+void
+unwind_print_folded_stack(FILE *outf, unsigned int id)
+{
+	const struct stack_t *st;
+	unsigned int i;
+
+	if (!id || id > nstacks) {
+		fputs("[unknown]", outf);
+		return;
+	}
+
+	st = stacks[id - 1];
+	for (i = st->nnames; i > 0; --i)
+		fprintf(outf, "%s%s", st->names[i - 1], i > 1 ? ";" : "");
+}
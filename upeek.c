@@ -34,6 +34,7 @@
 
 #include "defs.h"
 #include "ptrace.h"
+#include "selfprof.h"
 
 int
 upeek(int pid, unsigned long off, kernel_ulong_t *res)
@@ -41,6 +42,7 @@ upeek(int pid, unsigned long off, kernel_ulong_t *res)
 	long val;
 
 	errno = 0;
+	selfprof_count(SELFPROF_PTRACE);
 	val = ptrace(PTRACE_PEEKUSER, (pid_t) pid, (void *) off, 0);
 	if (val == -1 && errno) {
 		if (errno != ESRCH) {
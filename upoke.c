@@ -27,10 +27,12 @@
 
 #include "defs.h"
 #include "ptrace.h"
+#include "selfprof.h"
 
 int
 upoke(int pid, unsigned long off, kernel_ulong_t val)
 {
+	selfprof_count(SELFPROF_PTRACE);
 	if (ptrace(PTRACE_POKEUSER, pid, off, val)) {
 		if (errno != ESRCH)
 			perror_msg("upoke: PTRACE_POKEUSER pid:%d @%#lx)", pid, off);
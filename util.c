@@ -40,6 +40,11 @@
 # include <sys/xattr.h>
 #endif
 #include <sys/uio.h>
+#include "iocapture.h"
+#if defined __SSE2__ && defined HAVE___BUILTIN_CTZLL
+# include <emmintrin.h>
+# define USE_SSE2_QUOTE 1
+#endif
 
 int
 tv_nz(const struct timeval *a)
@@ -103,6 +108,62 @@ tv_mul(struct timeval *tv, const struct timeval *a, int n)
 	tv->tv_usec %= 1000000;
 }
 
+int
+ts_nz(const struct timespec *a)
+{
+	return a->tv_sec || a->tv_nsec;
+}
+
+int
+ts_cmp(const struct timespec *a, const struct timespec *b)
+{
+	if (a->tv_sec < b->tv_sec
+	    || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec))
+		return -1;
+	if (a->tv_sec > b->tv_sec
+	    || (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec))
+		return 1;
+	return 0;
+}
+
+double
+ts_float(const struct timespec *ts)
+{
+	return ts->tv_sec + ts->tv_nsec/1000000000.0;
+}
+
+void
+ts_add(struct timespec *ts, const struct timespec *a, const struct timespec *b)
+{
+	ts->tv_sec = a->tv_sec + b->tv_sec;
+	ts->tv_nsec = a->tv_nsec + b->tv_nsec;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+void
+ts_sub(struct timespec *ts, const struct timespec *a, const struct timespec *b)
+{
+	ts->tv_sec = a->tv_sec - b->tv_sec;
+	ts->tv_nsec = a->tv_nsec - b->tv_nsec;
+	if (ts->tv_nsec < 0) {
+		ts->tv_sec--;
+		ts->tv_nsec += 1000000000;
+	}
+}
+
+/*
+ * Return the fractional part of ts in units of the --time-precision
+ * option, suitable for printing with "%0*ld" and time_precision.
+ */
+long
+ts_frac(const struct timespec *ts)
+{
+	return time_precision >= 9 ? ts->tv_nsec : ts->tv_nsec / 1000;
+}
+
 #if !defined HAVE_STPCPY
 char *
 stpcpy(char *dst, const char *src)
@@ -161,6 +222,66 @@ next_set_bit(const void *bit_array, unsigned cur_bit, unsigned size_bits)
 	}
 }
 
+static void
+swap_elements(char *a, char *b, size_t size)
+{
+	while (size--) {
+		const char t = *a;
+
+		*a++ = *b;
+		*b++ = t;
+	}
+}
+
+static void
+heap_sift_down(char *const base, size_t root, const size_t nmemb,
+	       const size_t size, int (*cmp)(const void *, const void *))
+{
+	for (;;) {
+		size_t child = 2 * root + 1;
+
+		if (child >= nmemb)
+			return;
+		if (child + 1 < nmemb
+		    && cmp(base + child * size, base + (child + 1) * size) < 0)
+			++child;
+		if (cmp(base + root * size, base + child * size) >= 0)
+			return;
+		swap_elements(base + root * size, base + child * size, size);
+		root = child;
+	}
+}
+
+/*
+ * Like qsort, but sorts only the first n elements of the result,
+ * the rest of the array is left in an unspecified order.
+ * The n smallest elements are selected with a max-heap
+ * in O(nmemb log n) comparisons, so printing the top n rows
+ * of a large table does not cost sorting all of it.
+ */
+void
+sort_top(void *const base, size_t nmemb, const size_t size, const size_t n,
+	 int (*cmp)(const void *, const void *))
+{
+	char *const p = base;
+	size_t i;
+
+	if (n < nmemb) {
+		if (!n)
+			return;
+		for (i = n / 2; i > 0; --i)
+			heap_sift_down(p, i - 1, n, size, cmp);
+		for (i = n; i < nmemb; ++i) {
+			if (cmp(p + i * size, p) < 0) {
+				swap_elements(p + i * size, p, size);
+				heap_sift_down(p, 0, n, size, cmp);
+			}
+		}
+		nmemb = n;
+	}
+	qsort(base, nmemb, size, cmp);
+}
+
 /*
  * Fetch 64bit argument at position arg_no and
  * return the index of the next argument.
@@ -228,7 +349,7 @@ printaddr(const kernel_ulong_t addr)
 	if (!addr)
 		tprints("NULL");
 	else
-		tprintf("%#" PRI_klx, addr);
+		tprint_hex(addr);
 }
 
 #define DEF_PRINTNUM(name, type) \
@@ -384,13 +505,18 @@ getfdproto(struct tcb *tcp, int fd)
 	ssize_t r;
 	char path[sizeof("/proc/%u/fd/%u") + 2 * sizeof(int)*3];
 
+	enum sock_proto proto;
+
 	if (fd < 0)
 		return SOCK_PROTO_UNKNOWN;
 
+	if (fd_cache_get_proto(tcp, fd, &proto))
+		return proto;
+
 	sprintf(path, "/proc/%u/fd/%u", tcp->pid, fd);
 	r = getxattr(path, "system.sockprotoname", buf, bufsize - 1);
 	if (r <= 0)
-		return SOCK_PROTO_UNKNOWN;
+		proto = SOCK_PROTO_UNKNOWN;
 	else {
 		/*
 		 * This is a protection for the case when the kernel
@@ -398,8 +524,11 @@ getfdproto(struct tcb *tcp, int fd)
 		 */
 		buf[r] = '\0';
 
-		return get_proto_by_name(buf);
+		proto = get_proto_by_name(buf);
 	}
+
+	fd_cache_set_proto(tcp, fd, proto);
+	return proto;
 #else
 	return SOCK_PROTO_UNKNOWN;
 #endif
@@ -432,7 +561,8 @@ printfd(struct tcb *tcp, int fd)
 		size_t len;
 		unsigned long inode;
 
-		tprintf("%d<", fd);
+		tprint_int(fd);
+		tprints("<");
 		if (show_fd_path <= 1
 		    || (str = STR_STRIP_PREFIX(path, "socket:[")) == path
 		    || !(len = strlen(str))
@@ -444,66 +574,134 @@ printfd(struct tcb *tcp, int fd)
 		}
 		tprints(">");
 	} else
-		tprintf("%d", fd);
+		tprint_int(fd);
 }
 
 /*
- * Quote string `instr' of length `size'
- * Write up to (3 + `size' * 4) bytes to `outstr' buffer.
- *
- * If QUOTE_0_TERMINATED `style' flag is set,
- * treat `instr' as a NUL-terminated string,
- * checking up to (`size' + 1) bytes of `instr'.
- *
- * If QUOTE_OMIT_LEADING_TRAILING_QUOTES `style' flag is set,
- * do not add leading and trailing quoting symbols.
- *
- * Returns 0 if QUOTE_0_TERMINATED is set and NUL was seen, 1 otherwise.
- * Note that if QUOTE_0_TERMINATED is not set, always returns 1.
+ * Fast paths of string_quote: the length of the leading run of bytes
+ * that are copied verbatim (printable characters other than '"' and '\\'),
+ * and the length of the leading run of bytes that do not force hex
+ * quoting with -x (printable characters and whitespace).
+ * Both check 16 bytes at a time with SSE2 or 8 bytes at a time otherwise,
+ * the first block with an interesting byte is finished byte by byte.
  */
-int
-string_quote(const char *instr, char *outstr, const unsigned int size,
-	     const unsigned int style)
+#define ONES_U64	0x0101010101010101ULL
+#define HIGHS_U64	0x8080808080808080ULL
+/* Nonzero if a byte of x is less than n (0 < n <= 128), may err to nonzero */
+#define HAS_LESS_U64(x, n)	(((x) - ONES_U64 * (n)) & ~(x) & HIGHS_U64)
+#define HAS_BYTE_U64(x, b)	HAS_LESS_U64((x) ^ (ONES_U64 * (b)), 1)
+
+static inline bool
+is_plain_char(const unsigned char c)
 {
-	const unsigned char *ustr = (const unsigned char *) instr;
-	char *s = outstr;
-	unsigned int i;
-	int usehex, c, eol;
+	return c >= ' ' && c <= 0x7e && c != '\"' && c != '\\';
+}
 
-	if (style & QUOTE_0_TERMINATED)
-		eol = '\0';
-	else
-		eol = 0x100; /* this can never match a char */
+static inline bool
+is_text_char(const unsigned char c)
+{
+	/* In ASCII isspace is only these chars: "\t\n\v\f\r". */
+	return (c >= ' ' && c <= 0x7e) || (unsigned) (c - 9) < 5;
+}
 
-	usehex = 0;
-	if ((xflag > 1) || (style & QUOTE_FORCE_HEX)) {
-		usehex = 1;
-	} else if (xflag) {
-		/* Check for presence of symbol which require
-		   to hex-quote the whole string. */
-		for (i = 0; i < size; ++i) {
-			c = ustr[i];
-			/* Check for NUL-terminated string. */
-			if (c == eol)
-				break;
+static unsigned int
+plain_run_length(const unsigned char *const str, const unsigned int size)
+{
+	unsigned int i = 0;
+
+#ifdef USE_SSE2_QUOTE
+	const __m128i below = _mm_set1_epi8(' ' - 1);
+	const __m128i above = _mm_set1_epi8(0x7f);
+	const __m128i quote = _mm_set1_epi8('\"');
+	const __m128i bslash = _mm_set1_epi8('\\');
+
+	for (; i + 16 <= size; i += 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i *) (str + i));
+		/* signed compares: bytes >= 0x80 are negative */
+		const __m128i printable =
+			_mm_and_si128(_mm_cmpgt_epi8(v, below),
+				      _mm_cmplt_epi8(v, above));
+		const __m128i special =
+			_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+				     _mm_cmpeq_epi8(v, bslash));
+		const unsigned int mask =
+			_mm_movemask_epi8(_mm_andnot_si128(special, printable));
+
+		if (mask != 0xffff)
+			return i + __builtin_ctzll(~mask);
+	}
+#else
+	for (; i + 8 <= size; i += 8) {
+		uint64_t x;
 
-			/* Force hex unless c is printable or whitespace */
-			if (c > 0x7e) {
-				usehex = 1;
-				break;
-			}
-			/* In ASCII isspace is only these chars: "\t\n\v\f\r".
-			 * They happen to have ASCII codes 9,10,11,12,13.
-			 */
-			if (c < ' ' && (unsigned)(c - 9) >= 5) {
-				usehex = 1;
-				break;
-			}
-		}
+		memcpy(&x, str + i, sizeof(x));
+		if ((x & HIGHS_U64) || HAS_LESS_U64(x, ' ') ||
+		    HAS_BYTE_U64(x, 0x7f) || HAS_BYTE_U64(x, '\"') ||
+		    HAS_BYTE_U64(x, '\\'))
+			break;
 	}
+#endif
 
-	if (!(style & QUOTE_OMIT_LEADING_TRAILING_QUOTES))
-		*s++ = '\"';
+	for (; i < size && is_plain_char(str[i]); ++i)
+		;
+	return i;
+}
+
+static unsigned int
+text_run_length(const unsigned char *const str, const unsigned int size)
+{
+	unsigned int i = 0;
+
+#ifdef USE_SSE2_QUOTE
+	const __m128i below = _mm_set1_epi8(' ' - 1);
+	const __m128i above = _mm_set1_epi8(0x7f);
+	const __m128i tab = _mm_set1_epi8('\t' - 1);
+	const __m128i cr = _mm_set1_epi8('\r' + 1);
+
+	for (; i + 16 <= size; i += 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i *) (str + i));
+		const __m128i printable =
+			_mm_and_si128(_mm_cmpgt_epi8(v, below),
+				      _mm_cmplt_epi8(v, above));
+		const __m128i space =
+			_mm_and_si128(_mm_cmpgt_epi8(v, tab),
+				      _mm_cmplt_epi8(v, cr));
+		const unsigned int mask =
+			_mm_movemask_epi8(_mm_or_si128(printable, space));
+
+		if (mask != 0xffff)
+			return i + __builtin_ctzll(~mask);
+	}
+#else
+	for (; i + 8 <= size; i += 8) {
+		uint64_t x;
+
+		memcpy(&x, str + i, sizeof(x));
+		if ((x & HIGHS_U64) || HAS_LESS_U64(x, ' ') ||
+		    HAS_BYTE_U64(x, 0x7f))
+			break;
+	}
+#endif
+
+	for (; i < size && is_text_char(str[i]); ++i)
+		;
+	return i;
+}
+
+/*
+ * Quote `size' chars of `ustr' to `s' and return the end of the output.
+ * If `lookahead' is set, the quoted data continues with ustr[size];
+ * if `last' is set, the chunk ends the string.
+ * Set `*ended' if the end of a NUL-terminated string was seen.
+ */
+static char *
+quote_chunk(const unsigned char *ustr, const unsigned int size,
+	    const bool lookahead, const bool last, const int eol,
+	    const bool usehex, const unsigned int style, char *s,
+	    bool *ended)
+{
+	unsigned int i;
+	int c;
 
 	if (usehex) {
 		/* Hex-quote the whole string. */
@@ -519,11 +717,22 @@ string_quote(const char *instr, char *outstr, const unsigned int size,
 		}
 	} else {
 		for (i = 0; i < size; ++i) {
+			const unsigned int run =
+				plain_run_length(ustr + i, size - i);
+
+			if (run) {
+				memcpy(s, ustr + i, run);
+				s += run;
+				i += run;
+				if (i >= size)
+					break;
+			}
+
 			c = ustr[i];
 			/* Check for NUL-terminated string. */
 			if (c == eol)
 				goto asciz_ended;
-			if ((i == (size - 1)) &&
+			if (last && (i == (size - 1)) &&
 			    (style & QUOTE_OMIT_TRAILING_0) && (c == '\0'))
 				goto asciz_ended;
 			switch (c) {
@@ -557,7 +766,7 @@ string_quote(const char *instr, char *outstr, const unsigned int size,
 					else {
 						/* Print \octal */
 						*s++ = '\\';
-						if (i + 1 < size
+						if ((i + 1 < size || lookahead)
 						    && ustr[i + 1] >= '0'
 						    && ustr[i + 1] <= '9'
 						) {
@@ -579,26 +788,73 @@ string_quote(const char *instr, char *outstr, const unsigned int size,
 		}
 	}
 
+	return s;
+
+ asciz_ended:
+	*ended = true;
+	return s;
+}
+
+/*
+ * Quote string `instr' of length `size'
+ * Write up to (3 + `size' * 4) bytes to `outstr' buffer.
+ *
+ * If QUOTE_0_TERMINATED `style' flag is set,
+ * treat `instr' as a NUL-terminated string,
+ * checking up to (`size' + 1) bytes of `instr'.
+ *
+ * If QUOTE_OMIT_LEADING_TRAILING_QUOTES `style' flag is set,
+ * do not add leading and trailing quoting symbols.
+ *
+ * Returns 0 if QUOTE_0_TERMINATED is set and NUL was seen, 1 otherwise.
+ * Note that if QUOTE_0_TERMINATED is not set, always returns 1.
+ */
+int
+string_quote(const char *instr, char *outstr, const unsigned int size,
+	     const unsigned int style)
+{
+	const unsigned char *ustr = (const unsigned char *) instr;
+	char *s = outstr;
+	unsigned int i;
+	int eol;
+	bool usehex, ended = false;
+
+	if (style & QUOTE_0_TERMINATED)
+		eol = '\0';
+	else
+		eol = 0x100; /* this can never match a char */
+
+	usehex = false;
+	if ((xflag > 1) || (style & QUOTE_FORCE_HEX)) {
+		usehex = true;
+	} else if (xflag) {
+		/* Check for presence of symbol which require
+		   to hex-quote the whole string. */
+		i = text_run_length(ustr, size);
+		/* Force hex unless c is printable or whitespace */
+		if (i < size && ustr[i] != eol)
+			usehex = true;
+	}
+
+	if (!(style & QUOTE_OMIT_LEADING_TRAILING_QUOTES))
+		*s++ = '\"';
+
+	s = quote_chunk(ustr, size, false, true, eol, usehex, style, s,
+			&ended);
+
 	if (!(style & QUOTE_OMIT_LEADING_TRAILING_QUOTES))
 		*s++ = '\"';
 	*s = '\0';
 
 	/* Return zero if we printed entire ASCIZ string (didn't truncate it) */
-	if (style & QUOTE_0_TERMINATED && ustr[i] == '\0') {
-		/* We didn't see NUL yet (otherwise we'd jump to 'asciz_ended')
-		 * but next char is NUL.
-		 */
+	if (ended)
+		return 0;
+	if (style & QUOTE_0_TERMINATED && ustr[size] == '\0') {
+		/* We didn't see NUL yet but next char is NUL. */
 		return 0;
 	}
 
 	return 1;
-
- asciz_ended:
-	if (!(style & QUOTE_OMIT_LEADING_TRAILING_QUOTES))
-		*s++ = '\"';
-	*s = '\0';
-	/* Return zero: we printed entire ASCIZ string (didn't truncate it) */
-	return 0;
 }
 
 #ifndef ALLOCA_CUTOFF
@@ -712,6 +968,23 @@ printpath(struct tcb *const tcp, const kernel_ulong_t addr)
 	printpathn(tcp, addr, PATH_MAX - 1);
 }
 
+/*
+ * printstr_ex fetches and quotes strings in chunks of this size,
+ * so its buffers do not grow with max_strlen.
+ */
+#define PRINTSTR_CHUNK	4096
+
+static int
+printstr_fetch(struct tcb *const tcp, const kernel_ulong_t addr,
+	       const unsigned int len, char *const laddr,
+	       const unsigned int style)
+{
+	if (style & QUOTE_0_TERMINATED)
+		return umovestr(tcp, addr, len, laddr);
+	else
+		return umoven(tcp, addr, len, laddr);
+}
+
 /*
  * Print string specified by address `addr' and length `len'.
  * If `user_style' has QUOTE_0_TERMINATED bit set, treat the string
@@ -719,65 +992,110 @@ printpath(struct tcb *const tcp, const kernel_ulong_t addr)
  * Pass `user_style' on to `string_quote'.
  * Append `...' to the output if either the string length exceeds `max_strlen',
  * or QUOTE_0_TERMINATED bit is set and the string length exceeds `len'.
+ *
+ * Strings longer than PRINTSTR_CHUNK are fetched and printed chunk
+ * by chunk; if a chunk other than the first one cannot be fetched,
+ * the string printed so far is closed and followed by `...'.
  */
 void
 printstr_ex(struct tcb *const tcp, const kernel_ulong_t addr,
 	    const kernel_ulong_t len, const unsigned int user_style)
 {
-	static char *str;
-	static char *outstr;
-
-	unsigned int size;
-	unsigned int style = user_style;
-	int rc;
+	/* One byte more because the quoting may look one byte ahead. */
+	static char str[PRINTSTR_CHUNK + 1];
+	static char outstr[4 * PRINTSTR_CHUNK + /* for quote and NUL */ 2];
+
+	const unsigned int style = user_style;
+	const int eol = style & QUOTE_0_TERMINATED ? '\0' : 0x100;
+	const bool quotes = !(style & QUOTE_OMIT_LEADING_TRAILING_QUOTES);
+	const unsigned int max_len = tcb_max_strlen(tcp);
+	/* Fetch one byte more to find out whether the string is longer. */
+	const unsigned int size = MIN(len, (kernel_ulong_t) max_len + 1);
+	const unsigned int limit = MIN(size, max_len);
+	unsigned int off, n, i;
+	bool usehex, lookahead, ended = false, failed = false, fetched = false;
+	char *s;
 	int ellipsis;
 
 	if (!addr) {
 		tprints("NULL");
 		return;
 	}
-	/* Allocate static buffers if they are not allocated yet. */
-	if (!str) {
-		const unsigned int outstr_size =
-			4 * max_strlen + /* for quotes and NUL */ 3;
+
+	usehex = xflag > 1 || (style & QUOTE_FORCE_HEX);
+	if (xflag && !usehex) {
 		/*
-		 * We can assume that outstr_size / 4 == max_strlen
-		 * since we have a guarantee that max_strlen <= -1U / 4.
+		 * Check for presence of symbol which require
+		 * to hex-quote the whole string.
 		 */
-
-		str = xmalloc(max_strlen + 1);
-		outstr = xmalloc(outstr_size);
+		for (off = 0; off < limit; off += n) {
+			n = MIN(limit - off, PRINTSTR_CHUNK);
+			lookahead = off + n < size;
+			if (printstr_fetch(tcp, addr + off, n + lookahead,
+					   str, style) < 0) {
+				if (!off) {
+					printaddr(addr);
+					return;
+				}
+				break;
+			}
+			i = text_run_length((unsigned char *) str, n);
+			if (i < n) {
+				/* Force hex unless c is printable or whitespace */
+				if ((unsigned char) str[i] != eol)
+					usehex = true;
+				break;
+			}
+		}
+		/* The chunk fetched above is reused if it is the only one. */
+		fetched = limit && limit <= PRINTSTR_CHUNK;
 	}
 
-	/* Fetch one byte more because string_quote may look one byte ahead. */
-	size = max_strlen + 1;
-
-	if (size > len)
-		size = len;
-	if (style & QUOTE_0_TERMINATED)
-		rc = umovestr(tcp, addr, size, str);
-	else
-		rc = umoven(tcp, addr, size, str);
-
-	if (rc < 0) {
-		printaddr(addr);
-		return;
+	for (off = 0;; off += n) {
+		n = MIN(limit - off, PRINTSTR_CHUNK);
+		lookahead = off + n < size;
+		if (!fetched && printstr_fetch(tcp, addr + off, n + lookahead,
+					       str, style) < 0) {
+			if (!off) {
+				printaddr(addr);
+				return;
+			}
+			failed = true;
+			break;
+		}
+		fetched = false;
+		if (!lookahead)
+			str[n] = '\xff';
+
+		s = outstr;
+		if (!off && quotes)
+			*s++ = '\"';
+		s = quote_chunk((unsigned char *) str, n, off + n < limit,
+				off + n == limit, eol, usehex, style, s, &ended);
+		*s = '\0';
+		tprints(outstr);
+
+		if (ended || off + n == limit)
+			break;
 	}
 
-	if (size > max_strlen)
-		size = max_strlen;
-	else
-		str[size] = '\xff';
+	if (quotes)
+		tprints("\"");
 
-	/* If string_quote didn't see NUL and (it was supposed to be ASCIZ str
-	 * or we were requested to print more than -s NUM chars)...
-	 */
-	ellipsis = string_quote(str, outstr, size, style)
-		   && len
-		   && ((style & QUOTE_0_TERMINATED)
-		       || len > max_strlen);
+	if (failed) {
+		/* A chunk could not be fetched. */
+		ellipsis = 1;
+	} else {
+		/* If quoting didn't see NUL and (it was supposed to be ASCIZ
+		 * str or we were requested to print more than -s NUM chars)...
+		 */
+		ellipsis = !ended
+			   && !(style & QUOTE_0_TERMINATED && str[n] == '\0')
+			   && len
+			   && ((style & QUOTE_0_TERMINATED)
+			       || len > max_len);
+	}
 
-	tprints(outstr);
 	if (ellipsis)
 		tprints("...");
 }
@@ -809,11 +1127,11 @@ dumpiov_upto(struct tcb *const tcp, const int len, const kernel_ulong_t addr,
 
 	size = sizeof_iov * len;
 	/* Assuming no sane program has millions of iovs */
-	if ((unsigned)len > 1024*1024 /* insane or negative size? */
-	    || (iov = malloc(size)) == NULL) {
+	if ((unsigned)len > 1024*1024 /* insane or negative size? */) {
 		error_msg("Out of memory");
 		return;
 	}
+	iov = tcb_scratch_alloc(tcp, size);
 	if (umoven(tcp, addr, size, iov) >= 0) {
 		for (i = 0; i < len; i++) {
 			kernel_ulong_t iov_len = iov_iov_len(i);
@@ -822,87 +1140,110 @@ dumpiov_upto(struct tcb *const tcp, const int len, const kernel_ulong_t addr,
 			if (!iov_len)
 				break;
 			data_size -= iov_len;
+			if (iocapture_enabled()) {
+				iocapture_data(tcp, iov_iov_base(i), iov_len);
+				continue;
+			}
 			/* include the buffer number to make it easy to
 			 * match up the trace with the source */
 			tprintf(" * %" PRI_klu " bytes in buffer %d\n", iov_len, i);
 			dumpstr(tcp, iov_iov_base(i), iov_len);
 		}
 	}
-	free(iov);
 #undef sizeof_iov
 #undef iov_iov_base
 #undef iov_iov_len
 #undef iov
 }
 
-void
-dumpstr(struct tcb *const tcp, const kernel_ulong_t addr, const int len)
+/*
+ * Format a line of dumpstr output for n (1..16) bytes at src
+ * that are at the given offset into dst, return the end of the line.
+ */
+static char *
+dumpstr_line(char *dst, const unsigned int offset,
+	     const unsigned char *const src, const unsigned int n)
 {
-	static int strsize = -1;
-	static unsigned char *str;
-
-	char outbuf[
-		(
-			(sizeof(
-			"xx xx xx xx xx xx xx xx  xx xx xx xx xx xx xx xx  "
-			"1234567890123456") + /*in case I'm off by few:*/ 4)
-		/*align to 8 to make memset easier:*/ + 7) & -8
-	];
-	const unsigned char *src;
-	int i;
-
-	memset(outbuf, ' ', sizeof(outbuf));
-
-	if (strsize < len + 16) {
-		free(str);
-		str = malloc(len + 16);
-		if (!str) {
-			strsize = -1;
-			error_msg("Out of memory");
-			return;
+	static const char hex[] = "0123456789abcdef";
+	unsigned int i, digits;
+
+	*dst++ = ' ';
+	*dst++ = '|';
+	*dst++ = ' ';
+
+	/* "%05x" */
+	for (digits = 5; digits < 8 && (offset >> (digits * 4)); ++digits)
+		;
+	for (i = digits; i > 0; --i)
+		*dst++ = hex[(offset >> ((i - 1) * 4)) & 0xf];
+	*dst++ = ' ';
+	*dst++ = ' ';
+
+	/* Hex dump */
+	for (i = 0; i < 16; ++i) {
+		if (i < n) {
+			*dst++ = hex[src[i] >> 4];
+			*dst++ = hex[src[i] & 0xf];
+		} else {
+			*dst++ = ' ';
+			*dst++ = ' ';
 		}
-		strsize = len + 16;
+		*dst++ = ' ';
+		if ((i & 7) == 7)
+			*dst++ = ' ';
 	}
 
-	if (umoven(tcp, addr, len, str) < 0)
-		return;
+	/* ASCII dump, space-padded to 16 bytes */
+	for (i = 0; i < 16; ++i) {
+		if (i >= n)
+			*dst++ = ' ';
+		else if (src[i] >= ' ' && src[i] < 0x7f)
+			*dst++ = src[i];
+		else
+			*dst++ = '.';
+	}
 
-	/* Space-pad to 16 bytes */
-	i = len;
-	while (i & 0xf)
-		str[i++] = ' ';
+	*dst++ = ' ';
+	*dst++ = '|';
+	*dst++ = '\n';
 
-	i = 0;
-	src = str;
-	while (i < len) {
+	return dst;
+}
+
+/*
+ * Hex dump len bytes of tracee memory at addr.  The memory is fetched
+ * and printed in chunks, each chunk with a single output call.
+ */
+void
+dumpstr(struct tcb *const tcp, const kernel_ulong_t addr, const int len)
+{
+	enum {
+		DUMPSTR_CHUNK = 4096,	/* a multiple of 16 */
+		/* " | 12345678  " + 16 * "xx " + "  " + 16 chars + " |\n" */
+		DUMPSTR_LINE_MAX = 13 + 16 * 3 + 2 + 16 + 3
+	};
+	static unsigned char str[DUMPSTR_CHUNK];
+	static char outbuf[DUMPSTR_CHUNK / 16 * DUMPSTR_LINE_MAX + 1];
+	int offset;
+
+	if (iocapture_enabled()) {
+		iocapture_data(tcp, addr, len);
+		return;
+	}
+
+	for (offset = 0; offset < len; offset += DUMPSTR_CHUNK) {
+		const unsigned int n = MIN(len - offset, DUMPSTR_CHUNK);
 		char *dst = outbuf;
-		/* Hex dump */
-		do {
-			if (i < len) {
-				*dst++ = "0123456789abcdef"[*src >> 4];
-				*dst++ = "0123456789abcdef"[*src & 0xf];
-			} else {
-				*dst++ = ' ';
-				*dst++ = ' ';
-			}
-			dst++; /* space is there by memset */
-			i++;
-			if ((i & 7) == 0)
-				dst++; /* space is there by memset */
-			src++;
-		} while (i & 0xf);
-		/* ASCII dump */
-		i -= 16;
-		src -= 16;
-		do {
-			if (*src >= ' ' && *src < 0x7f)
-				*dst++ = *src;
-			else
-				*dst++ = '.';
-			src++;
-		} while (++i & 0xf);
+		unsigned int i;
+
+		if (umoven(tcp, addr + offset, n, str) < 0)
+			return;
+
+		for (i = 0; i < n; i += 16)
+			dst = dumpstr_line(dst, offset + i, str + i,
+					   MIN(n - i, 16));
 		*dst = '\0';
-		tprintf(" | %05x  %s |\n", i - 16, outbuf);
+		tprints(outbuf);
 	}
 }
 
@@ -931,6 +1272,38 @@ umoven_or_printaddr_ignore_syserror(struct tcb *const tcp,
 	return 0;
 }
 
+/*
+ * Fetch the part of an array that starts at addr and ends before end_addr,
+ * but no more than a few pages of it, in a single read, so that
+ * subsequent per-element reads are served from the snapshot.
+ * Returns the address of the end of the fetched part.
+ */
+static kernel_ulong_t
+print_array_readahead(struct tcb *const tcp, const kernel_ulong_t addr,
+		      const kernel_ulong_t end_addr, const size_t elem_size)
+{
+	enum { READAHEAD_PAGES = 4 };
+	const size_t page_size = get_pagesize();
+	kernel_ulong_t end = (addr & ~(kernel_ulong_t) (page_size - 1)) +
+			     READAHEAD_PAGES * page_size;
+
+	/* Chunks should not split elements. */
+	if (end <= addr || end > end_addr)
+		end = end_addr;
+	else
+		end -= (end - addr) % elem_size;
+	if (end <= addr)
+		end = addr + elem_size;
+
+	const struct umove_range range = {
+		.addr = addr,
+		.len = end - addr
+	};
+	umove_snapshot(tcp, &range, 1);
+
+	return end;
+}
+
 /*
  * Iteratively fetch and print up to nmemb elements of elem_size size
  * from the array that starts at tracee's address start_addr.
@@ -957,8 +1330,8 @@ umoven_or_printaddr_ignore_syserror(struct tcb *const tcp,
  *   enclosed with [] brackets.
  *
  * If abbrev(tcp) is true, then
- * - the maximum number of elements printed equals to max_strlen;
- * - "..." is printed instead of max_strlen+1 element
+ * - the maximum number of elements printed equals to tcb_max_strlen(tcp);
+ * - "..." is printed instead of the next element
  *   and no more iterations will be made.
  *
  * This function returns true only if
@@ -999,15 +1372,34 @@ print_array(struct tcb *const tcp,
 		return false;
 	}
 
+	const unsigned int max_len = tcb_max_strlen(tcp);
 	const kernel_ulong_t abbrev_end =
-		(abbrev(tcp) && max_strlen < nmemb) ?
-			start_addr + elem_size * max_strlen : end_addr;
-	kernel_ulong_t cur;
+		(abbrev(tcp) && max_len < nmemb) ?
+			start_addr + elem_size * max_len : end_addr;
+	/*
+	 * Read ahead the elements that are going to be fetched, including
+	 * the one at abbrev_end, when the fetcher just reads tracee memory.
+	 * If the bulk read fails partway, umoven falls back to reading
+	 * the remaining elements one by one.
+	 */
+	const bool readahead = nmemb > 1 && verbose(tcp) &&
+		elem_size <= get_pagesize() &&
+		(umoven_func == umoven_or_printaddr_ignore_syserror ||
+		 (umoven_func == umoven_or_printaddr &&
+		  !(exiting(tcp) && syserror(tcp))));
+	const kernel_ulong_t readahead_end =
+		abbrev_end < end_addr ? abbrev_end + elem_size : end_addr;
+	kernel_ulong_t cur, fetched_end = start_addr;
 
 	for (cur = start_addr; cur < end_addr; cur += elem_size) {
 		if (cur != start_addr)
 			tprints(", ");
 
+		if (readahead && cur >= fetched_end)
+			fetched_end = print_array_readahead(tcp, cur,
+							    readahead_end,
+							    elem_size);
+
 		if (umoven_func(tcp, cur, elem_size, elem_buf))
 			break;
 
@@ -1036,8 +1428,11 @@ printargs(struct tcb *tcp)
 {
 	const int n = tcp->s_ent->nargs;
 	int i;
-	for (i = 0; i < n; ++i)
-		tprintf("%s%#" PRI_klx, i ? ", " : "", tcp->u_arg[i]);
+	for (i = 0; i < n; ++i) {
+		if (i)
+			tprints(", ");
+		tprint_hex(tcp->u_arg[i]);
+	}
 	return RVAL_DECODED;
 }
 
@@ -1046,9 +1441,11 @@ printargs_u(struct tcb *tcp)
 {
 	const int n = tcp->s_ent->nargs;
 	int i;
-	for (i = 0; i < n; ++i)
-		tprintf("%s%u", i ? ", " : "",
-			(unsigned int) tcp->u_arg[i]);
+	for (i = 0; i < n; ++i) {
+		if (i)
+			tprints(", ");
+		tprint_uint((unsigned int) tcp->u_arg[i]);
+	}
 	return RVAL_DECODED;
 }
 
@@ -1057,9 +1454,11 @@ printargs_d(struct tcb *tcp)
 {
 	const int n = tcp->s_ent->nargs;
 	int i;
-	for (i = 0; i < n; ++i)
-		tprintf("%s%d", i ? ", " : "",
-			(int) tcp->u_arg[i]);
+	for (i = 0; i < n; ++i) {
+		if (i)
+			tprints(", ");
+		tprint_int((int) tcp->u_arg[i]);
+	}
 	return RVAL_DECODED;
 }
 
@@ -1115,3 +1514,51 @@ read_int_from_file(const char *const fname, int *const pvalue)
 	*pvalue = (int) lval;
 	return 0;
 }
+
+/* Return the thread group id of the thread, or PID if it is not known.  */
+int
+get_proc_tgid(const int pid)
+{
+	char path[sizeof("/proc/%u/status") + sizeof(int) * 3];
+	char line[64];
+	int tgid = pid;
+	FILE *fp;
+
+	sprintf(path, "/proc/%u/status", pid);
+	fp = fopen(path, "r");
+	if (!fp)
+		return tgid;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "Tgid: %d", &tgid) == 1)
+			break;
+	}
+	fclose(fp);
+
+	return tgid;
+}
+
+/* Return the thread group id of the tracee, it is read once per tcb.  */
+int
+get_tcb_tgid(struct tcb *const tcp)
+{
+	if (!tcp->tgid)
+		tcp->tgid = get_proc_tgid(tcp->pid);
+
+	return tcp->tgid;
+}
+
+/* Read the command name of the process, COMM is left intact on error.  */
+void
+read_proc_comm(const int pid, char *const comm, const size_t size)
+{
+	char path[sizeof("/proc/%u/comm") + sizeof(int) * 3];
+	FILE *fp;
+
+	sprintf(path, "/proc/%u/comm", pid);
+	fp = fopen(path, "r");
+	if (!fp)
+		return;
+	if (fgets(comm, size, fp))
+		comm[strcspn(comm, "\n")] = '\0';
+	fclose(fp);
+}
@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2017 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Video capture streaming statistics (--summary-v4l2 option).
+ *
+ * Every V4L2 descriptor is tracked from the VIDIOC_QBUF, VIDIOC_DQBUF,
+ * and VIDIOC_STREAMOFF ioctls without decoding them: only the buffer
+ * index and the timestamp of a dequeued buffer are fetched.  This gives
+ * the number of buffers queued to the driver over time, the latency
+ * between queueing a buffer and dequeueing it, and the intervals between
+ * the timestamps of the frames.
+ */
+
+#include "defs.h"
+#include "syscall.h"
+#include <linux/ioctl.h>
+
+/* Buffers of a queue tracked for the latency, VIDEO_MAX_FRAME is 32 */
+#define V4L2_MAX_BUFFERS 64
+
+#define V4L2_NR_QBUF 15
+#define V4L2_NR_DQBUF 17
+#define V4L2_NR_STREAMOFF 19
+
+struct v4l2_counts {
+	struct v4l2_counts *next;
+	int tgid;
+	int fd;
+	unsigned int depth, peak_depth;
+	struct timespec first_ts, last_ts;
+	struct timespec change_ts;	/* Last change of depth */
+	double depth_ns;		/* depth integrated over time */
+	uint64_t qbufs, dqbufs, eagains;
+	uint64_t latencies, latency_ns, max_latency_ns;
+	uint64_t frames, interval_ns, min_interval_ns, max_interval_ns;
+	uint64_t frame_ns;		/* Timestamp of the last frame */
+	struct timespec qbuf_ts[V4L2_MAX_BUFFERS];
+};
+
+unsigned int summary_v4l2;
+static struct v4l2_counts **v4l2_hash;
+static unsigned int v4l2_hash_size;
+static unsigned int v4l2_hash_count;
+
+static unsigned int
+hash_v4l2(const int tgid, const int fd)
+{
+	return (unsigned int) (tgid * 31 + fd) * 2654435761U;
+}
+
+static void
+v4l2_hash_expand(void)
+{
+	struct v4l2_counts **const old_hash = v4l2_hash;
+	const unsigned int old_size = v4l2_hash_size;
+	unsigned int i;
+
+	v4l2_hash_size = old_size ? old_size * 2 : 16;
+	v4l2_hash = xcalloc(v4l2_hash_size, sizeof(v4l2_hash[0]));
+
+	for (i = 0; i < old_size; ++i) {
+		struct v4l2_counts *vc, *next;
+
+		for (vc = old_hash[i]; vc; vc = next) {
+			const unsigned int b = hash_v4l2(vc->tgid, vc->fd)
+					       & (v4l2_hash_size - 1);
+
+			next = vc->next;
+			vc->next = v4l2_hash[b];
+			v4l2_hash[b] = vc;
+		}
+	}
+
+	free(old_hash);
+}
+
+static struct v4l2_counts *
+get_v4l2_counts(struct tcb *const tcp, const int fd,
+		const struct timespec *const ts)
+{
+	const int tgid = get_tcb_tgid(tcp);
+	struct v4l2_counts *vc;
+
+	if (v4l2_hash_size) {
+		for (vc = v4l2_hash[hash_v4l2(tgid, fd)
+				    & (v4l2_hash_size - 1)];
+		     vc; vc = vc->next) {
+			if (vc->tgid == tgid && vc->fd == fd)
+				return vc;
+		}
+	}
+
+	if (v4l2_hash_count >= v4l2_hash_size)
+		v4l2_hash_expand();
+
+	const unsigned int b = hash_v4l2(tgid, fd) & (v4l2_hash_size - 1);
+
+	vc = xcalloc(1, sizeof(*vc));
+	vc->tgid = tgid;
+	vc->fd = fd;
+	vc->first_ts = vc->last_ts = vc->change_ts = *ts;
+	vc->min_interval_ns = UINT64_MAX;
+	vc->next = v4l2_hash[b];
+	v4l2_hash[b] = vc;
+	++v4l2_hash_count;
+
+	return vc;
+}
+
+static uint64_t
+ts_diff_ns(const struct timespec *const a, const struct timespec *const b)
+{
+	struct timespec dt;
+
+	ts_sub(&dt, a, b);
+	return (uint64_t) dt.tv_sec * 1000000000 + dt.tv_nsec;
+}
+
+static void
+set_v4l2_depth(struct v4l2_counts *const vc, const unsigned int depth,
+	       const struct timespec *const ts)
+{
+	vc->depth_ns += (double) vc->depth * ts_diff_ns(ts, &vc->change_ts);
+	vc->change_ts = *ts;
+	vc->depth = depth;
+	if (depth > vc->peak_depth)
+		vc->peak_depth = depth;
+}
+
+/*
+ * Fetch the index and the timestamp in nanoseconds of the struct
+ * v4l2_buffer at ADDR.  The timestamp is a struct timeval of kernel longs
+ * following five 32-bit fields; it is not fetched, and 0 is returned
+ * instead, for 32-bit processes using the 64-bit time layout, which is
+ * told by the size encoded in the ioctl command.
+ */
+static bool
+fetch_v4l2_buffer(struct tcb *const tcp, const kernel_ulong_t addr,
+		  const unsigned int size, const bool want_ts,
+		  uint32_t *const index, uint64_t *const ts_ns)
+{
+	union {
+		uint32_t u32[10];
+		uint64_t u64[5];
+	} buf;
+
+	*ts_ns = 0;
+	if (!want_ts)
+		return !umove(tcp, addr, index);
+
+	if (current_klongsize == 8) {
+		if (umoven(tcp, addr, 5 * sizeof(buf.u64[0]), &buf))
+			return false;
+		*ts_ns = buf.u64[3] * 1000000000 + buf.u64[4] * 1000;
+	} else if (size == 68) {
+		if (umoven(tcp, addr, 7 * sizeof(buf.u32[0]), &buf))
+			return false;
+		*ts_ns = (uint64_t) buf.u32[5] * 1000000000
+			 + (uint64_t) buf.u32[6] * 1000;
+	} else if (umoven(tcp, addr, sizeof(buf.u32[0]), &buf)) {
+		return false;
+	}
+
+	*index = buf.u32[0];
+	return true;
+}
+
+static void
+count_v4l2_qbuf(struct tcb *const tcp, struct v4l2_counts *const vc,
+		const unsigned int size, const struct timespec *const ts)
+{
+	uint32_t index;
+	uint64_t ts_ns;
+
+	if (!fetch_v4l2_buffer(tcp, tcp->u_arg[2], size, false,
+			       &index, &ts_ns))
+		return;
+
+	vc->qbufs++;
+	set_v4l2_depth(vc, vc->depth + 1, ts);
+	if (index < V4L2_MAX_BUFFERS)
+		vc->qbuf_ts[index] = *ts;
+}
+
+static void
+count_v4l2_dqbuf(struct tcb *const tcp, struct v4l2_counts *const vc,
+		 const unsigned int size, const struct timespec *const ts)
+{
+	uint32_t index;
+	uint64_t ts_ns;
+
+	if (!fetch_v4l2_buffer(tcp, tcp->u_arg[2], size, true,
+			       &index, &ts_ns))
+		return;
+
+	vc->dqbufs++;
+	if (vc->depth)
+		set_v4l2_depth(vc, vc->depth - 1, ts);
+
+	if (index < V4L2_MAX_BUFFERS && ts_nz(&vc->qbuf_ts[index])) {
+		const uint64_t ns = ts_diff_ns(ts, &vc->qbuf_ts[index]);
+
+		vc->latencies++;
+		vc->latency_ns += ns;
+		if (ns > vc->max_latency_ns)
+			vc->max_latency_ns = ns;
+		vc->qbuf_ts[index].tv_sec = 0;
+		vc->qbuf_ts[index].tv_nsec = 0;
+	}
+
+	if (!ts_ns)
+		return;
+	if (vc->frame_ns && ts_ns > vc->frame_ns) {
+		const uint64_t ns = ts_ns - vc->frame_ns;
+
+		vc->frames++;
+		vc->interval_ns += ns;
+		if (ns < vc->min_interval_ns)
+			vc->min_interval_ns = ns;
+		if (ns > vc->max_interval_ns)
+			vc->max_interval_ns = ns;
+	}
+	vc->frame_ns = ts_ns;
+}
+
+void
+count_v4l2(struct tcb *const tcp, const struct timespec *const ts)
+{
+	if (tcp->s_ent->sen != SEN_ioctl)
+		return;
+
+	const unsigned int code = tcp->u_arg[1];
+
+	if (_IOC_TYPE(code) != 'V')
+		return;
+
+	struct v4l2_counts *vc;
+
+	switch (_IOC_NR(code)) {
+	case V4L2_NR_QBUF:
+		if (syserror(tcp))
+			return;
+		vc = get_v4l2_counts(tcp, tcp->u_arg[0], ts);
+		count_v4l2_qbuf(tcp, vc, _IOC_SIZE(code), ts);
+		break;
+	case V4L2_NR_DQBUF:
+		if (syserror(tcp)) {
+			/* Non-blocking dequeue of an empty queue.  */
+			if (tcp->u_error != EAGAIN)
+				return;
+			vc = get_v4l2_counts(tcp, tcp->u_arg[0], ts);
+			vc->eagains++;
+			break;
+		}
+		vc = get_v4l2_counts(tcp, tcp->u_arg[0], ts);
+		count_v4l2_dqbuf(tcp, vc, _IOC_SIZE(code), ts);
+		break;
+	case V4L2_NR_STREAMOFF:
+		if (syserror(tcp))
+			return;
+		/* All buffers are returned to the application.  */
+		vc = get_v4l2_counts(tcp, tcp->u_arg[0], ts);
+		set_v4l2_depth(vc, 0, ts);
+		memset(vc->qbuf_ts, 0, sizeof(vc->qbuf_ts));
+		vc->frame_ns = 0;
+		break;
+	default:
+		return;
+	}
+
+	vc->last_ts = *ts;
+}
+
+static int
+v4l2_counts_cmp(const void *a, const void *b)
+{
+	const struct v4l2_counts *const x = *(const struct v4l2_counts **) a;
+	const struct v4l2_counts *const y = *(const struct v4l2_counts **) b;
+
+	return (x->dqbufs < y->dqbufs) ? 1 : (x->dqbufs > y->dqbufs) ? -1
+	     : (x->tgid != y->tgid) ? x->tgid - y->tgid
+	     : x->fd - y->fd;
+}
+
+/* Print the summary_v4l2 descriptors that have dequeued the most buffers.  */
+void
+v4l2_summary(FILE *outf)
+{
+	const char *dashes = "----------------";
+	struct v4l2_counts **sorted;
+	unsigned int i, n = 0;
+
+	if (!v4l2_hash_count)
+		return;
+
+	sorted = xcalloc(v4l2_hash_count, sizeof(sorted[0]));
+	for (i = 0; i < v4l2_hash_size; ++i) {
+		struct v4l2_counts *vc;
+
+		for (vc = v4l2_hash[i]; vc; vc = vc->next)
+			sorted[n++] = vc;
+	}
+	sort_top(sorted, n, sizeof(sorted[0]), summary_v4l2,
+		 v4l2_counts_cmp);
+	if (n > summary_v4l2)
+		n = summary_v4l2;
+
+	fprintf(outf, "\n%9.9s %9.9s %9.9s %9.9s %9.9s %11.11s %11.11s"
+		" %11.11s %11.11s %11.11s %9.9s %s\n", "qbufs", "dqbufs",
+		"eagain", "avg depth", "peak", "avg lat ms", "max lat ms",
+		"avg ivl ms", "min ivl ms", "max ivl ms", "fps", "pid:fd");
+	fprintf(outf, "%9.9s %9.9s %9.9s %9.9s %9.9s %11.11s %11.11s"
+		" %11.11s %11.11s %11.11s %9.9s %s\n", dashes, dashes, dashes,
+		dashes, dashes, dashes, dashes, dashes, dashes, dashes, dashes,
+		dashes);
+	for (i = 0; i < n; ++i) {
+		struct v4l2_counts *const vc = sorted[i];
+		const uint64_t life_ns = ts_diff_ns(&vc->last_ts,
+						    &vc->first_ts);
+		const double avg_ivl = vc->frames
+				       ? (double) vc->interval_ns / vc->frames
+				       : 0;
+
+		set_v4l2_depth(vc, vc->depth, &vc->last_ts);
+		fprintf(outf, "%9" PRIu64 " %9" PRIu64 " %9" PRIu64
+			" %9.2f %9u %11.3f %11.3f %11.3f %11.3f %11.3f"
+			" %9.2f %d:%d\n",
+			vc->qbufs, vc->dqbufs, vc->eagains,
+			life_ns ? vc->depth_ns / life_ns : vc->depth,
+			vc->peak_depth,
+			vc->latencies ? vc->latency_ns / 1e6 / vc->latencies
+				      : 0,
+			vc->max_latency_ns / 1e6, avg_ivl / 1e6,
+			vc->frames ? vc->min_interval_ns / 1e6 : 0,
+			vc->max_interval_ns / 1e6,
+			avg_ivl ? 1e9 / avg_ivl : 0, vc->tgid, vc->fd);
+	}
+
+	free(sorted);
+}
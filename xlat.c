@@ -32,15 +32,6 @@
 #include "defs.h"
 #include <stdarg.h>
 
-const char *
-xlookup(const struct xlat *xlat, const uint64_t val)
-{
-	for (; xlat->str != NULL; xlat++)
-		if (xlat->val == val)
-			return xlat->str;
-	return NULL;
-}
-
 static int
 xlat_bsearch_compare(const void *a, const void *b)
 {
@@ -59,6 +50,208 @@ xlat_search(const struct xlat *xlat, const size_t nmemb, const uint64_t val)
 	return e ? e->str : NULL;
 }
 
+/*
+ * Names of the bits of a generated table that consists of single bit
+ * flags, and positions of the bits in the table, the order of printing.
+ */
+struct xlat_bits {
+	const char *names[64];
+	unsigned short pos[64];
+};
+
+/*
+ * Sorted copies of generated xlat tables, looked up by the address
+ * of the table.  Tables that are too small or not terminated with
+ * XLAT_END_INDEXABLE are recorded with no copy and scanned linearly.
+ * Tables of single bit flags also get a bit to name map.
+ */
+struct xlat_index {
+	const struct xlat *xlat;
+	struct xlat *sorted;
+	size_t nmemb;
+	struct xlat_bits *bits;
+};
+
+#define XLAT_INDEX_MIN 16
+
+static struct xlat_index *xlat_index_hash;
+static unsigned int xlat_index_hash_size;
+static unsigned int xlat_index_count;
+
+static unsigned int
+hash_xlat_ptr(const struct xlat *xlat)
+{
+	const uintptr_t p = (uintptr_t) xlat;
+
+	return (p >> 4) ^ (p >> 16);
+}
+
+static int
+xlat_ptr_sort_compare(const void *a, const void *b)
+{
+	const struct xlat *x = *(const struct xlat **) a;
+	const struct xlat *y = *(const struct xlat **) b;
+
+	if (x->val != y->val)
+		return (x->val > y->val) ? 1 : -1;
+	/* keep the first of duplicate values like a linear scan does */
+	return (x > y) - (x < y);
+}
+
+static unsigned int
+ctz64(uint64_t x)
+{
+#ifdef HAVE___BUILTIN_CTZLL
+	return __builtin_ctzll(x);
+#else
+	unsigned int n = 0;
+
+	for (; !(x & 1); x >>= 1)
+		++n;
+	return n;
+#endif
+}
+
+static void
+build_xlat_bits(struct xlat_index *idx, const struct xlat *xlat,
+		const size_t size)
+{
+	struct xlat_bits *bits;
+	size_t i;
+
+	/* zero values are never printed for non-zero flags */
+	for (i = 0; i < size; ++i) {
+		if (xlat[i].val & (xlat[i].val - 1))
+			return;
+	}
+	if (size > (unsigned short) -1)
+		return;
+
+	bits = xcalloc(1, sizeof(*bits));
+	for (i = 0; i < size; ++i) {
+		if (!xlat[i].val)
+			continue;
+
+		const unsigned int bit = ctz64(xlat[i].val);
+
+		/* the first of duplicate bits wins */
+		if (!bits->names[bit]) {
+			bits->names[bit] = xlat[i].str;
+			bits->pos[bit] = i;
+		}
+	}
+	idx->bits = bits;
+}
+
+static void
+build_xlat_index(struct xlat_index *idx, const struct xlat *xlat)
+{
+	const struct xlat *end;
+	size_t i, n;
+
+	idx->xlat = xlat;
+	for (end = xlat; end->str; ++end)
+		;
+	if (end->val != XLAT_INDEXABLE)
+		return;
+
+	build_xlat_bits(idx, xlat, end - xlat);
+
+	if (end - xlat < XLAT_INDEX_MIN)
+		return;
+
+	/*
+	 * Sort pointers to the entries first so that duplicates
+	 * can be ordered by their position in the table.
+	 */
+	const size_t size = end - xlat;
+	const struct xlat **ptrs = xcalloc(size, sizeof(*ptrs));
+
+	for (i = 0; i < size; ++i)
+		ptrs[i] = &xlat[i];
+	qsort(ptrs, size, sizeof(*ptrs), xlat_ptr_sort_compare);
+
+	idx->sorted = xcalloc(size, sizeof(*idx->sorted));
+	for (i = n = 0; i < size; ++i) {
+		if (n && idx->sorted[n - 1].val == ptrs[i]->val)
+			continue;
+		idx->sorted[n++] = *ptrs[i];
+	}
+	idx->nmemb = n;
+
+	free(ptrs);
+}
+
+static void
+expand_xlat_index_hash(void)
+{
+	struct xlat_index *const old_hash = xlat_index_hash;
+	const unsigned int old_size = xlat_index_hash_size;
+	unsigned int i;
+
+	xlat_index_hash_size = old_size ? old_size * 2 : 256;
+	xlat_index_hash = xcalloc(xlat_index_hash_size,
+				  sizeof(*xlat_index_hash));
+
+	for (i = 0; i < old_size; ++i) {
+		unsigned int j;
+
+		if (!old_hash[i].xlat)
+			continue;
+		for (j = hash_xlat_ptr(old_hash[i].xlat);
+		     xlat_index_hash[j & (xlat_index_hash_size - 1)].xlat;
+		     ++j)
+			;
+		xlat_index_hash[j & (xlat_index_hash_size - 1)] = old_hash[i];
+	}
+
+	free(old_hash);
+}
+
+static const struct xlat_index *
+get_xlat_index(const struct xlat *xlat)
+{
+	struct xlat_index *idx;
+	unsigned int i;
+
+	if (xlat_index_hash_size) {
+		for (i = hash_xlat_ptr(xlat);; ++i) {
+			idx = &xlat_index_hash[i & (xlat_index_hash_size - 1)];
+			if (idx->xlat == xlat)
+				return idx;
+			if (!idx->xlat)
+				break;
+		}
+	}
+
+	/* keep the hash at most half full */
+	if (xlat_index_count * 2 >= xlat_index_hash_size)
+		expand_xlat_index_hash();
+
+	for (i = hash_xlat_ptr(xlat);
+	     xlat_index_hash[i & (xlat_index_hash_size - 1)].xlat; ++i)
+		;
+	idx = &xlat_index_hash[i & (xlat_index_hash_size - 1)];
+	build_xlat_index(idx, xlat);
+	++xlat_index_count;
+
+	return idx;
+}
+
+const char *
+xlookup(const struct xlat *xlat, const uint64_t val)
+{
+	const struct xlat_index *const idx = get_xlat_index(xlat);
+
+	if (idx->sorted)
+		return xlat_search(idx->sorted, idx->nmemb, val);
+
+	for (; xlat->str != NULL; xlat++)
+		if (xlat->val == val)
+			return xlat->str;
+	return NULL;
+}
+
 /**
  * Print entry in struct xlat table, if there.
  *
@@ -124,6 +317,80 @@ printxval_searchn(const struct xlat *xlat, size_t xlat_size, uint64_t val,
 	return 0;
 }
 
+/*
+ * Store names of the bits set in *flags that have names in bits
+ * in the order of the table, and clear those bits in *flags.
+ * Returns the number of names stored.
+ */
+static unsigned int
+get_bit_names(const struct xlat_bits *bits, uint64_t *flags,
+	      const char **names)
+{
+	unsigned short pos[64];
+	uint64_t f = *flags;
+	unsigned int n = 0;
+
+	while (f) {
+		const unsigned int bit = ctz64(f);
+		unsigned int i;
+
+		f &= f - 1;
+		if (!bits->names[bit])
+			continue;
+		*flags &= ~(1ULL << bit);
+
+		/* insertion sort, there are few bits set usually */
+		for (i = n; i > 0 && pos[i - 1] > bits->pos[bit]; --i) {
+			pos[i] = pos[i - 1];
+			names[i] = names[i - 1];
+		}
+		pos[i] = bits->pos[bit];
+		names[i] = bits->names[bit];
+		++n;
+	}
+
+	return n;
+}
+
+/*
+ * Print names separated by '|', preceded by '|' if sep is set,
+ * with as few output calls as possible.
+ */
+static void
+print_bit_names(const char **names, const unsigned int n, bool sep)
+{
+	char buf[512];
+	char *p = buf;
+	unsigned int i;
+
+	if (!n)
+		return;
+
+	for (i = 0; i < n; ++i) {
+		const size_t len = strlen(names[i]);
+
+		if (p + len + 2 > buf + sizeof(buf)) {
+			*p = '\0';
+			tprints(buf);
+			p = buf;
+		}
+		if (sep)
+			*p++ = '|';
+		sep = true;
+		if (len + 2 > sizeof(buf)) {
+			*p = '\0';
+			tprints(buf);
+			tprints(names[i]);
+			p = buf;
+		} else {
+			memcpy(p, names[i], len);
+			p += len;
+		}
+	}
+	*p = '\0';
+	tprints(buf);
+}
+
 /*
  * Interpret `xlat' as an array of flags
  * print the entries whose bits are on in `flags'
@@ -131,10 +398,19 @@ printxval_searchn(const struct xlat *xlat, size_t xlat_size, uint64_t val,
 void
 addflags(const struct xlat *xlat, uint64_t flags)
 {
-	for (; xlat->str; xlat++) {
-		if (xlat->val && (flags & xlat->val) == xlat->val) {
-			tprintf("|%s", xlat->str);
-			flags &= ~xlat->val;
+	const struct xlat_index *const idx = get_xlat_index(xlat);
+
+	if (idx->bits) {
+		const char *names[64];
+		const unsigned int n = get_bit_names(idx->bits, &flags, names);
+
+		print_bit_names(names, n, true);
+	} else {
+		for (; xlat->str; xlat++) {
+			if (xlat->val && (flags & xlat->val) == xlat->val) {
+				tprintf("|%s", xlat->str);
+				flags &= ~xlat->val;
+			}
 		}
 	}
 	if (flags) {
@@ -161,15 +437,30 @@ sprintflags(const char *prefix, const struct xlat *xlat, uint64_t flags)
 		return outstr;
 	}
 
-	for (; xlat->str; xlat++) {
-		if (xlat->val && (flags & xlat->val) == xlat->val) {
-			if (found)
+	const struct xlat_index *const idx = get_xlat_index(xlat);
+
+	if (idx->bits) {
+		const char *names[64];
+		const unsigned int n = get_bit_names(idx->bits, &flags, names);
+		unsigned int i;
+
+		for (i = 0; i < n; ++i) {
+			if (i)
 				*outptr++ = '|';
-			outptr = stpcpy(outptr, xlat->str);
-			found = 1;
-			flags &= ~xlat->val;
-			if (!flags)
-				break;
+			outptr = stpcpy(outptr, names[i]);
+		}
+		found = n;
+	} else {
+		for (; xlat->str; xlat++) {
+			if (xlat->val && (flags & xlat->val) == xlat->val) {
+				if (found)
+					*outptr++ = '|';
+				outptr = stpcpy(outptr, xlat->str);
+				found = 1;
+				flags &= ~xlat->val;
+				if (!flags)
+					break;
+			}
 		}
 	}
 	if (flags) {
@@ -189,6 +480,18 @@ printflags_ex(uint64_t flags, const char *dflt, const struct xlat *xlat, ...)
 
 	va_start(args, xlat);
 	for (; xlat; xlat = va_arg(args, const struct xlat *)) {
+		const struct xlat_index *const idx = get_xlat_index(xlat);
+
+		if (idx->bits && flags) {
+			const char *names[64];
+			const unsigned int m =
+				get_bit_names(idx->bits, &flags, names);
+
+			print_bit_names(names, m, n);
+			n += m;
+			continue;
+		}
+
 		for (; (flags || !n) && xlat->str; ++xlat) {
 			if ((flags == xlat->val) ||
 			    (xlat->val && (flags & xlat->val) == xlat->val)) {
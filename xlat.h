@@ -13,5 +13,11 @@ struct xlat {
 # define XLAT_TYPE(type, val)		{     (type)(val), #val }
 # define XLAT_TYPE_PAIR(type, val, str)	{     (type)(val), str  }
 # define XLAT_END			{		0, 0    }
+/*
+ * Terminator of tables generated by xlat/gen.sh: such tables are constant,
+ * so xlookup may build a sorted index of their entries.
+ */
+# define XLAT_END_INDEXABLE		{ XLAT_INDEXABLE, 0 }
+# define XLAT_INDEXABLE			1
 
 #endif /* !STRACE_XLAT_H */
@@ -234,7 +234,7 @@ gen_header()
 	if [ -n "${unterminated}" ]; then
 		echo " /* this array should remain not NULL-terminated */"
 	else
-		echo " XLAT_END"
+		echo " XLAT_END_INDEXABLE"
 	fi
 
 	cat <<-EOF